@@ -706,6 +706,13 @@ static void daemonRunStateInit(void *opaque)
         return;
     }
 
+    /* Let read-only clients look around while the networks, pools
+     * and guests marked for autostart are started, which may take
+     * a while on a busy host */
+    virNetServerUpdateReadonlyServices(srv, true);
+
+    virStateAutoStart();
+
     /* Only now accept clients from network */
     virNetServerUpdateServices(srv, true);
     virNetServerFree(srv);
@@ -973,6 +980,10 @@ int main(int argc, char **argv) {
         }
     }
 
+    /* Keep the worker threads from waiting on the log outputs */
+    if (virLogSetAsync(true) < 0)
+        VIR_WARN("Cannot start the logging thread, logging synchronously");
+
     /* Ensure the rundir exists (on tmpfs on some systems) */
     if (privileged) {
         run_dir = strdup(LOCALSTATEDIR "/run/libvirt");
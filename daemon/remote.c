@@ -3471,6 +3471,21 @@ static int remoteDispatchSupportsFeature(
         goto done;
     }
 
+    /* Asking for this one is how the client tells it can reassemble
+     * split replies, so it doesn't need an open connection either */
+    if (args->feature == VIR_DRV_FEATURE_REPLY_CHUNKS) {
+        virNetServerClientEnableReplyChunks(client);
+        supported = 1;
+        goto done;
+    }
+
+    /* Likewise for holes in streams */
+    if (args->feature == VIR_DRV_FEATURE_STREAM_HOLES) {
+        virNetServerClientEnableStreamHoles(client);
+        supported = 1;
+        goto done;
+    }
+
     if (!priv->conn) {
         virNetError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
         goto cleanup;
@@ -3743,6 +3758,87 @@ cleanup:
     return rv;
 }
 
+static int
+remoteDispatchConnectGetAllDomainStats(virNetServerPtr server ATTRIBUTE_UNUSED,
+                                       virNetServerClientPtr client,
+                                       virNetMessagePtr msg ATTRIBUTE_UNUSED,
+                                       virNetMessageErrorPtr rerr,
+                                       remote_connect_get_all_domain_stats_args *args,
+                                       remote_connect_get_all_domain_stats_ret *ret)
+{
+    int rv = -1;
+    int i;
+    struct daemonClientPrivate *priv =
+        virNetServerClientGetPrivateData(client);
+    virDomainStatsRecordPtr *retStats = NULL;
+    int nrecords = 0;
+
+    if (!priv->conn) {
+        virNetError(VIR_ERR_INTERNAL_ERROR, "%s", _("connection not open"));
+        goto cleanup;
+    }
+
+    if ((nrecords = virConnectGetAllDomainStats(priv->conn,
+                                                args->stats,
+                                                &retStats,
+                                                args->flags)) < 0)
+        goto cleanup;
+
+    if (nrecords > REMOTE_DOMAIN_LIST_MAX) {
+        virNetError(VIR_ERR_INTERNAL_ERROR,
+                    _("Number of domain stats records is %d, "
+                      "which exceeds max limit: %d"),
+                    nrecords, REMOTE_DOMAIN_LIST_MAX);
+        goto cleanup;
+    }
+
+    if (nrecords &&
+        VIR_ALLOC_N(ret->retStats.retStats_val, nrecords) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    for (i = 0; i < nrecords; i++) {
+        remote_domain_stats_record *dst = ret->retStats.retStats_val + i;
+
+        /* Account for the record first so that it is freed on failure */
+        ret->retStats.retStats_len++;
+
+        if (retStats[i]->nparams > REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX) {
+            virNetError(VIR_ERR_INTERNAL_ERROR,
+                        _("Number of stats entries is %d, "
+                          "which exceeds max limit: %d"),
+                        retStats[i]->nparams,
+                        REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX);
+            goto cleanup;
+        }
+
+        make_nonnull_domain(&dst->dom, retStats[i]->dom);
+        if (!dst->dom.name) {
+            virReportOOMError();
+            goto cleanup;
+        }
+
+        if (remoteSerializeTypedParameters(retStats[i]->params,
+                                           retStats[i]->nparams,
+                                           &dst->params.params_val,
+                                           &dst->params.params_len,
+                                           args->flags) < 0)
+            goto cleanup;
+    }
+
+    rv = 0;
+
+cleanup:
+    if (rv < 0) {
+        virNetMessageSaveError(rerr);
+        xdr_free((xdrproc_t) xdr_remote_connect_get_all_domain_stats_ret,
+                 (char *) ret);
+    }
+    virDomainStatsRecordListFree(retStats);
+    return rv;
+}
+
 /*----- Helpers. -----*/
 
 /* get_nonnull_domain and get_nonnull_network turn an on-wire
@@ -27,6 +27,7 @@
 #include "remote.h"
 #include "memory.h"
 #include "logging.h"
+#include "util.h"
 #include "virnetserverclient.h"
 #include "virterror_internal.h"
 
@@ -52,6 +53,8 @@ struct daemonClientStream {
     int filterID;
 
     virNetMessagePtr rx;
+    /* Zero bytes of the hole at the head of rx still to be written */
+    unsigned long long rxHole;
     int tx;
 
     daemonClientStreamPtr next;
@@ -285,7 +288,8 @@ daemonStreamFilter(virNetServerClientPtr client ATTRIBUTE_UNUSED,
 
     virMutexLock(&stream->priv->lock);
 
-    if (msg->header.type != VIR_NET_STREAM)
+    if (msg->header.type != VIR_NET_STREAM &&
+        msg->header.type != VIR_NET_STREAM_HOLE)
         goto cleanup;
 
     if (!virNetServerProgramMatches(stream->prog, msg))
@@ -555,6 +559,68 @@ daemonStreamHandleWriteData(virNetServerClientPtr client,
 }
 
 
+/*
+ * Write the zeroes a hole message from the client stands for.
+ *
+ * Returns:
+ *   -1  if fatal error occurred
+ *    0  if message was fully processed
+ *    1  if message is still being processed
+ */
+static int
+daemonStreamHandleWriteHole(virNetServerClientPtr client,
+                            daemonClientStream *stream,
+                            virNetMessagePtr msg)
+{
+    static const char zeroes[64 * 1024];
+    virNetMessageError rerr;
+    int ret;
+
+    /* The payload is only decoded the first time round */
+    if (msg->bufferOffset < msg->bufferLength) {
+        virNetStreamHole hole;
+
+        memset(&hole, 0, sizeof(hole));
+        if (virNetMessageDecodePayload(msg, (xdrproc_t)xdr_virNetStreamHole,
+                                       &hole) < 0)
+            goto error;
+        msg->bufferOffset = msg->bufferLength;
+        stream->rxHole = hole.length;
+    }
+
+    VIR_DEBUG("client=%p, stream=%p, proc=%d, serial=%d, hole=%llu",
+              client, stream, msg->header.proc, msg->header.serial,
+              stream->rxHole);
+
+    while (stream->rxHole) {
+        size_t len = sizeof(zeroes);
+
+        if (len > stream->rxHole)
+            len = stream->rxHole;
+
+        ret = virStreamSend(stream->st, zeroes, len);
+        if (ret == -2)
+            return 1;
+        if (ret < 0)
+            goto error;
+        stream->rxHole -= ret;
+    }
+
+    return 0;
+
+error:
+    memset(&rerr, 0, sizeof(rerr));
+
+    VIR_INFO("Stream send failed");
+    stream->closed = 1;
+    return virNetServerProgramSendReplyError(stream->prog,
+                                             client,
+                                             msg,
+                                             &rerr,
+                                             &msg->header);
+}
+
+
 /*
  * Process a finish handshake from the client.
  *
@@ -659,7 +725,10 @@ daemonStreamHandleWrite(virNetServerClientPtr client,
             break;
 
         case VIR_NET_CONTINUE:
-            ret = daemonStreamHandleWriteData(client, stream, msg);
+            if (msg->header.type == VIR_NET_STREAM_HOLE)
+                ret = daemonStreamHandleWriteHole(client, stream, msg);
+            else
+                ret = daemonStreamHandleWriteData(client, stream, msg);
             break;
 
         case VIR_NET_ERROR:
@@ -768,12 +837,24 @@ daemonStreamHandleRead(virNetServerClientPtr client,
             msg->cb = daemonStreamMessageFinished;
             msg->opaque = stream;
             stream->refs++;
-            ret = virNetServerProgramSendStreamData(remoteProgram,
-                                                    client,
-                                                    msg,
-                                                    stream->procedure,
-                                                    stream->serial,
-                                                    buffer, ret);
+            /* Zeroes, typically read from a hole in a sparse volume,
+             * are only sent by their number to clients that know */
+            if (ret > 0 &&
+                virNetServerClientHasStreamHoles(client) &&
+                virMemIsZero(buffer, ret))
+                ret = virNetServerProgramSendStreamHole(remoteProgram,
+                                                        client,
+                                                        msg,
+                                                        stream->procedure,
+                                                        stream->serial,
+                                                        ret);
+            else
+                ret = virNetServerProgramSendStreamData(remoteProgram,
+                                                        client,
+                                                        msg,
+                                                        stream->procedure,
+                                                        stream->serial,
+                                                        buffer, ret);
         }
     }
 
@@ -453,6 +453,9 @@ skip_function = (
     'virConnectDomainEventDeregisterAny', # overridden in virConnect.py
     'virSaveLastError', # We have our own python error wrapper
     'virFreeError', # Only needed if we use virSaveLastError
+    'virConnectGetAllDomainStats', # Needs a hand written wrapper for the record list
+    'virDomainStatsRecordListFree', # Only needed by virConnectGetAllDomainStats
+    'virStorageVolGetWipeInfo', # Needs a hand written wrapper for the info struct
 
     'virStreamRecvAll', # Pure python libvirt-override-virStream.py
     'virStreamSendAll', # Pure python libvirt-override-virStream.py
@@ -52,6 +52,9 @@
 #include "secret_conf.h"
 #include "netdev_vport_profile_conf.h"
 #include "netdev_bandwidth_conf.h"
+#include "virhashcode.h"
+#include "threadpool.h"
+#include "virtime.h"
 
 #define VIR_FROM_THIS VIR_FROM_DOMAIN
 
@@ -716,44 +719,130 @@ virDomainObjListDataFree(void *payload, const void *name ATTRIBUTE_UNUSED)
         virDomainObjUnlock(obj);
 }
 
+/* Hash keys cannot be NULL, so shift IDs by one to allow for ID 0 */
+#define VIR_DOMAIN_OBJ_LIST_ID_KEY(id) ((void *)((intptr_t)(id) + 1))
+
+static uint32_t virDomainObjListIDCode(const void *name, uint32_t seed)
+{
+    intptr_t id = (intptr_t)name;
+    return virHashCodeGen(&id, sizeof(id), seed);
+}
+static bool virDomainObjListIDEqual(const void *namea, const void *nameb)
+{
+    return namea == nameb;
+}
+static void *virDomainObjListIDCopy(const void *name)
+{
+    return (void *)name;
+}
+
 int virDomainObjListInit(virDomainObjListPtr doms)
 {
     doms->objs = virHashCreate(50, virDomainObjListDataFree);
-    if (!doms->objs)
+    doms->names = virHashCreate(50, NULL);
+    doms->ids = virHashCreateFull(50, NULL,
+                                  virDomainObjListIDCode,
+                                  virDomainObjListIDEqual,
+                                  virDomainObjListIDCopy,
+                                  NULL);
+    if (!doms->objs || !doms->names || !doms->ids) {
+        virDomainObjListDeinit(doms);
         return -1;
+    }
     return 0;
 }
 
 
 void virDomainObjListDeinit(virDomainObjListPtr doms)
 {
+    /* The indexes do not own any reference */
+    virHashFree(doms->ids);
+    virHashFree(doms->names);
     virHashFree(doms->objs);
+    doms->ids = doms->names = doms->objs = NULL;
 }
 
 
-static int virDomainObjListSearchID(const void *payload,
-                                    const void *name ATTRIBUTE_UNUSED,
-                                    const void *data)
+/*
+ * Drop the ID index entry of @obj, if it has an ID.
+ */
+static void virDomainObjListRemoveID(virDomainObjListPtr doms,
+                                     virDomainObjPtr obj)
 {
-    virDomainObjPtr obj = (virDomainObjPtr)payload;
-    const int *id = data;
-    int want = 0;
+    const void *key = VIR_DOMAIN_OBJ_LIST_ID_KEY(obj->def->id);
 
-    virDomainObjLock(obj);
     if (virDomainObjIsActive(obj) &&
-        obj->def->id == *id)
-        want = 1;
-    virDomainObjUnlock(obj);
-    return want;
+        virHashLookup(doms->ids, key) == obj)
+        virHashRemoveEntry(doms->ids, key);
+}
+
+/*
+ * Insert @obj into @doms, keeping the name and ID indexes in sync.
+ * The caller must hold a lock on the driver owning 'doms'.
+ */
+int virDomainObjListAdd(virDomainObjListPtr doms,
+                        virDomainObjPtr obj)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+    virUUIDFormat(obj->def->uuid, uuidstr);
+
+    if (virHashAddEntry(doms->names, obj->def->name, obj) < 0)
+        return -1;
+
+    /* Domains loaded from their status files are already running */
+    if (virDomainObjIsActive(obj) &&
+        virHashUpdateEntry(doms->ids,
+                           VIR_DOMAIN_OBJ_LIST_ID_KEY(obj->def->id), obj) < 0) {
+        virHashRemoveEntry(doms->names, obj->def->name);
+        return -1;
+    }
+
+    if (virHashAddEntry(doms->objs, uuidstr, obj) < 0) {
+        virDomainObjListRemoveID(doms, obj);
+        virHashRemoveEntry(doms->names, obj->def->name);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * Gives @obj the ID @id when it starts, or takes its ID away when @id
+ * is -1 as it stops, keeping the ID index of @doms in sync. This is
+ * the only way drivers are to change the ID of a domain in a list.
+ * The caller must hold a lock on the driver owning 'doms' and on @obj.
+ *
+ * Returns 0 on success, -1 with an error reported otherwise, leaving
+ * @obj inactive.
+ */
+int virDomainObjListSetID(virDomainObjListPtr doms,
+                          virDomainObjPtr obj,
+                          int id)
+{
+    virDomainObjListRemoveID(doms, obj);
+    obj->def->id = -1;
+
+    if (id == -1)
+        return 0;
+
+    if (virHashUpdateEntry(doms->ids, VIR_DOMAIN_OBJ_LIST_ID_KEY(id), obj) < 0)
+        return -1;
+
+    obj->def->id = id;
+    return 0;
 }
 
 virDomainObjPtr virDomainFindByID(const virDomainObjListPtr doms,
                                   int id)
 {
     virDomainObjPtr obj;
-    obj = virHashSearch(doms->objs, virDomainObjListSearchID, &id);
-    if (obj)
-        virDomainObjLock(obj);
+
+    if (id == -1 ||
+        !(obj = virHashLookup(doms->ids, VIR_DOMAIN_OBJ_LIST_ID_KEY(id))))
+        return NULL;
+
+    virDomainObjLock(obj);
     return obj;
 }
 
@@ -772,25 +861,11 @@ virDomainObjPtr virDomainFindByUUID(const virDomainObjListPtr doms,
     return obj;
 }
 
-static int virDomainObjListSearchName(const void *payload,
-                                      const void *name ATTRIBUTE_UNUSED,
-                                      const void *data)
-{
-    virDomainObjPtr obj = (virDomainObjPtr)payload;
-    int want = 0;
-
-    virDomainObjLock(obj);
-    if (STREQ(obj->def->name, (const char *)data))
-        want = 1;
-    virDomainObjUnlock(obj);
-    return want;
-}
-
 virDomainObjPtr virDomainFindByName(const virDomainObjListPtr doms,
                                     const char *name)
 {
     virDomainObjPtr obj;
-    obj = virHashSearch(doms->objs, virDomainObjListSearchName, name);
+    obj = virHashLookup(doms->names, name);
     if (obj)
         virDomainObjLock(obj);
     return obj;
@@ -1009,6 +1084,16 @@ virDomainActualNetDefFree(virDomainActualNetDefPtr def)
     VIR_FREE(def);
 }
 
+/* Whether @ifname was made up by libvirt when an interface of @type
+ * was started, rather than chosen by the user */
+static bool
+virDomainNetIfnameIsGenerated(int type, const char *ifname)
+{
+    return STRPREFIX(ifname, VIR_NET_GENERATED_PREFIX) ||
+        (type == VIR_DOMAIN_NET_TYPE_DIRECT &&
+         STRPREFIX(ifname, VIR_NET_GENERATED_MACVTAP_PREFIX));
+}
+
 void virDomainNetDefFree(virDomainNetDefPtr def)
 {
     if (!def)
@@ -1164,6 +1249,9 @@ virDomainChrSourceDefCopy(virDomainChrSourceDefPtr dest,
             virReportOOMError();
             return -1;
         }
+
+        dest->data.tcp.listen = src->data.tcp.listen;
+        dest->data.tcp.protocol = src->data.tcp.protocol;
         break;
 
     case VIR_DOMAIN_CHR_TYPE_UNIX:
@@ -1172,6 +1260,12 @@ virDomainChrSourceDefCopy(virDomainChrSourceDefPtr dest,
             virReportOOMError();
             return -1;
         }
+
+        dest->data.nix.listen = src->data.nix.listen;
+        break;
+
+    case VIR_DOMAIN_CHR_TYPE_SPICEVMC:
+        dest->data.spicevmc = src->data.spicevmc;
         break;
     }
 
@@ -1653,87 +1747,1258 @@ int virDomainObjUnref(virDomainObjPtr dom)
 
 static virDomainObjPtr virDomainObjNew(virCapsPtr caps)
 {
-    virDomainObjPtr domain;
+    virDomainObjPtr domain;
+
+    if (VIR_ALLOC(domain) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    if (caps->privateDataAllocFunc &&
+        !(domain->privateData = (caps->privateDataAllocFunc)())) {
+        virReportOOMError();
+        VIR_FREE(domain);
+        return NULL;
+    }
+    domain->privateDataFreeFunc = caps->privateDataFreeFunc;
+
+    if (virMutexInit(&domain->lock) < 0) {
+        virDomainReportError(VIR_ERR_INTERNAL_ERROR,
+                             "%s", _("cannot initialize mutex"));
+        if (domain->privateDataFreeFunc)
+            (domain->privateDataFreeFunc)(domain->privateData);
+        VIR_FREE(domain);
+        return NULL;
+    }
+
+    virDomainObjLock(domain);
+    virDomainObjSetState(domain, VIR_DOMAIN_SHUTOFF,
+                                 VIR_DOMAIN_SHUTOFF_UNKNOWN);
+    domain->refs = 1;
+
+    virDomainSnapshotObjListInit(&domain->snapshots);
+
+    VIR_DEBUG("obj=%p", domain);
+    return domain;
+}
+
+void virDomainObjAssignDef(virDomainObjPtr domain,
+                           const virDomainDefPtr def,
+                           bool live)
+{
+    if (!virDomainObjIsActive(domain)) {
+        if (live) {
+            /* save current configuration to be restored on domain shutdown */
+            if (!domain->newDef)
+                domain->newDef = domain->def;
+            domain->def = def;
+        } else {
+            virDomainDefFree(domain->def);
+            domain->def = def;
+        }
+    } else {
+        virDomainDefFree(domain->newDef);
+        domain->newDef = def;
+    }
+}
+
+virDomainObjPtr virDomainAssignDef(virCapsPtr caps,
+                                   virDomainObjListPtr doms,
+                                   const virDomainDefPtr def,
+                                   bool live)
+{
+    virDomainObjPtr domain;
+
+    if ((domain = virDomainFindByUUID(doms, def->uuid))) {
+        virDomainObjAssignDef(domain, def, live);
+        return domain;
+    }
+
+    if (!(domain = virDomainObjNew(caps)))
+        return NULL;
+    domain->def = def;
+
+    if (virDomainObjListAdd(doms, domain) < 0) {
+        VIR_FREE(domain);
+        return NULL;
+    }
+
+    return domain;
+}
+
+/*
+ * Deep copies of the parts of a domain definition, used when a
+ * separate persistent definition is needed next to the live one.
+ *
+ * They copy the configuration like formatting it and parsing it back
+ * as inactive XML would, just without going through XML: runtime
+ * only state, such as device aliases, is left out. All of them
+ * report an error and return NULL (or -1) on failure.
+ */
+static int
+virDomainCopyString(char **dst, const char *src)
+{
+    *dst = NULL;
+    if (src && !(*dst = strdup(src))) {
+        virReportOOMError();
+        return -1;
+    }
+    return 0;
+}
+
+static int
+virDomainDeviceInfoCopy(virDomainDeviceInfoPtr dst,
+                        const virDomainDeviceInfo *src)
+{
+    /* The alias is assigned on every start of the domain */
+    dst->alias = NULL;
+    dst->type = src->type;
+    dst->addr = src->addr;
+    dst->mastertype = src->mastertype;
+    dst->master = src->master;
+    dst->rombar = src->rombar;
+    dst->bootIndex = src->bootIndex;
+    dst->romfile = NULL;
+
+    if (src->type == VIR_DOMAIN_DEVICE_ADDRESS_TYPE_USB &&
+        virDomainCopyString(&dst->addr.usb.port, src->addr.usb.port) < 0)
+        return -1;
+
+    return virDomainCopyString(&dst->romfile, src->romfile);
+}
+
+static int
+virDomainChrSourceDefCopyInactive(virDomainChrSourceDefPtr dst,
+                                  virDomainChrSourceDefPtr src)
+{
+    if (virDomainChrSourceDefCopy(dst, src) < 0)
+        return -1;
+
+    /* Where a pty ends up is only known while the domain runs */
+    if (dst->type == VIR_DOMAIN_CHR_TYPE_PTY)
+        VIR_FREE(dst->data.file.path);
+
+    return 0;
+}
+
+static int
+virSecurityLabelDefCopy(virSecurityLabelDefPtr dst,
+                        const virSecurityLabelDef *src)
+{
+    dst->type = src->type;
+    dst->norelabel = src->norelabel;
+
+    switch (src->type) {
+    case VIR_DOMAIN_SECLABEL_DEFAULT:
+        dst->norelabel = false;
+        break;
+
+    case VIR_DOMAIN_SECLABEL_NONE:
+        dst->norelabel = true;
+        break;
+
+    case VIR_DOMAIN_SECLABEL_STATIC:
+        if (virDomainCopyString(&dst->model, src->model) < 0 ||
+            virDomainCopyString(&dst->label, src->label) < 0)
+            return -1;
+        break;
+
+    case VIR_DOMAIN_SECLABEL_DYNAMIC:
+        /* The labels themselves are generated on every start */
+        if (virDomainCopyString(&dst->baselabel, src->baselabel) < 0)
+            return -1;
+        if (dst->baselabel &&
+            virDomainCopyString(&dst->model, src->model) < 0)
+            return -1;
+        break;
+    }
+
+    return 0;
+}
+
+static virSecurityDeviceLabelDefPtr
+virSecurityDeviceLabelDefCopy(const virSecurityDeviceLabelDef *src)
+{
+    virSecurityDeviceLabelDefPtr def;
+
+    if (VIR_ALLOC(def) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    def->norelabel = src->norelabel;
+    if (virDomainCopyString(&def->label, src->label) < 0) {
+        VIR_FREE(def);
+        return NULL;
+    }
+
+    return def;
+}
+
+static virDomainDiskDefPtr
+virDomainDiskDefCopy(virDomainDiskDefPtr src)
+{
+    virDomainDiskDefPtr def;
+    int i;
+
+    if (VIR_ALLOC(def) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    def->type = src->type;
+    def->device = src->device;
+    def->bus = src->bus;
+    def->tray_status = src->tray_status;
+    def->protocol = src->protocol;
+    def->auth.secretType = src->auth.secretType;
+    if (src->auth.secretType == VIR_DOMAIN_DISK_SECRET_TYPE_UUID)
+        memcpy(def->auth.secret.uuid, src->auth.secret.uuid,
+               VIR_UUID_BUFLEN);
+    def->blkdeviotune = src->blkdeviotune;
+    def->cachemode = src->cachemode;
+    def->error_policy = src->error_policy;
+    def->rerror_policy = src->rerror_policy;
+    def->iomode = src->iomode;
+    def->ioeventfd = src->ioeventfd;
+    def->event_idx = src->event_idx;
+    def->copy_on_read = src->copy_on_read;
+    def->snapshot = src->snapshot;
+    def->startupPolicy = src->startupPolicy;
+    def->readonly = src->readonly;
+    def->shared = src->shared;
+    def->transient = src->transient;
+    def->rawio_specified = src->rawio_specified;
+    def->rawio = src->rawio;
+    /* Block jobs, and thus mirrors, don't survive the domain */
+
+    if (virDomainCopyString(&def->src, src->src) < 0 ||
+        virDomainCopyString(&def->dst, src->dst) < 0 ||
+        virDomainCopyString(&def->auth.username, src->auth.username) < 0 ||
+        virDomainCopyString(&def->driverName, src->driverName) < 0 ||
+        virDomainCopyString(&def->driverType, src->driverType) < 0 ||
+        virDomainCopyString(&def->serial, src->serial) < 0 ||
+        virDomainDeviceInfoCopy(&def->info, &src->info) < 0)
+        goto error;
+
+    if (src->auth.secretType == VIR_DOMAIN_DISK_SECRET_TYPE_USAGE &&
+        virDomainCopyString(&def->auth.secret.usage,
+                            src->auth.secret.usage) < 0)
+        goto error;
+
+    if (src->seclabel &&
+        !(def->seclabel = virSecurityDeviceLabelDefCopy(src->seclabel)))
+        goto error;
+
+    if (src->encryption &&
+        !(def->encryption = virStorageEncryptionCopy(src->encryption)))
+        goto error;
+
+    if (src->nhosts) {
+        if (VIR_ALLOC_N(def->hosts, src->nhosts) < 0) {
+            virReportOOMError();
+            goto error;
+        }
+        for (i = 0; i < src->nhosts; i++) {
+            def->nhosts++;
+            if (virDomainCopyString(&def->hosts[i].name,
+                                    src->hosts[i].name) < 0 ||
+                virDomainCopyString(&def->hosts[i].port,
+                                    src->hosts[i].port) < 0)
+                goto error;
+        }
+    }
+
+    return def;
+
+error:
+    virDomainDiskDefFree(def);
+    return NULL;
+}
+
+static virDomainControllerDefPtr
+virDomainControllerDefCopy(virDomainControllerDefPtr src)
+{
+    virDomainControllerDefPtr def;
+
+    if (VIR_ALLOC(def) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    def->type = src->type;
+    def->idx = src->idx;
+    def->model = src->model;
+    def->opts = src->opts;
+
+    if (virDomainDeviceInfoCopy(&def->info, &src->info) < 0) {
+        virDomainControllerDefFree(def);
+        return NULL;
+    }
+
+    return def;
+}
+
+static virDomainLeaseDefPtr
+virDomainLeaseDefCopy(virDomainLeaseDefPtr src)
+{
+    virDomainLeaseDefPtr def;
+
+    if (VIR_ALLOC(def) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    def->offset = src->offset;
+
+    if (virDomainCopyString(&def->lockspace, src->lockspace) < 0 ||
+        virDomainCopyString(&def->key, src->key) < 0 ||
+        virDomainCopyString(&def->path, src->path) < 0) {
+        virDomainLeaseDefFree(def);
+        return NULL;
+    }
+
+    return def;
+}
+
+static virDomainFSDefPtr
+virDomainFSDefCopy(virDomainFSDefPtr src)
+{
+    virDomainFSDefPtr def;
+
+    if (VIR_ALLOC(def) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    def->type = src->type;
+    def->fsdriver = src->fsdriver;
+    def->accessmode = src->accessmode;
+    def->wrpolicy = src->wrpolicy;
+    def->readonly = src->readonly;
+
+    if (virDomainCopyString(&def->src, src->src) < 0 ||
+        virDomainCopyString(&def->dst, src->dst) < 0 ||
+        virDomainDeviceInfoCopy(&def->info, &src->info) < 0) {
+        virDomainFSDefFree(def);
+        return NULL;
+    }
+
+    return def;
+}
+
+static int
+virDomainVirtPortProfileCopy(virNetDevVPortProfilePtr *dst,
+                             const virNetDevVPortProfilePtr src)
+{
+    *dst = NULL;
+    if (!src)
+        return 0;
+
+    if (VIR_ALLOC(*dst) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+    memcpy(*dst, src, sizeof(*src));
+
+    return 0;
+}
+
+/* Fills in @dst, which is either allocated on its own or embedded in
+ * a higher level device, which then has to set parent and info first */
+static int
+virDomainHostdevDefCopyInto(virDomainHostdevDefPtr dst,
+                            virDomainHostdevDefPtr src)
+{
+    dst->mode = src->mode;
+    dst->managed = src->managed;
+    dst->source = src->source;
+    /* How to give a PCI device back to the host is decided when
+     * taking it away, on every start */
+    memset(&dst->origstates, 0, sizeof(dst->origstates));
+
+    if (dst->parent.type == VIR_DOMAIN_DEVICE_NONE)
+        return virDomainDeviceInfoCopy(dst->info, src->info);
+
+    return 0;
+}
+
+static virDomainHostdevDefPtr
+virDomainHostdevDefCopy(virDomainHostdevDefPtr src)
+{
+    virDomainHostdevDefPtr def;
+
+    if (!(def = virDomainHostdevDefAlloc()))
+        return NULL;
+
+    if (virDomainHostdevDefCopyInto(def, src) < 0) {
+        virDomainHostdevDefFree(def);
+        return NULL;
+    }
+
+    return def;
+}
+
+static virDomainNetDefPtr
+virDomainNetDefCopy(virDomainNetDefPtr src)
+{
+    virDomainNetDefPtr def;
+
+    if (VIR_ALLOC(def) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    def->type = src->type;
+    memcpy(def->mac, src->mac, VIR_MAC_BUFLEN);
+    def->driver = src->driver;
+    def->tune = src->tune;
+    def->linkstate = src->linkstate;
+
+    if (virDomainCopyString(&def->model, src->model) < 0 ||
+        virDomainCopyString(&def->script, src->script) < 0 ||
+        virDomainCopyString(&def->filter, src->filter) < 0 ||
+        virDomainDeviceInfoCopy(&def->info, &src->info) < 0 ||
+        virNetDevBandwidthCopy(&def->bandwidth, src->bandwidth) < 0)
+        goto error;
+
+    /* Generated names are handed out again on start */
+    if (src->ifname &&
+        !virDomainNetIfnameIsGenerated(src->type, src->ifname) &&
+        virDomainCopyString(&def->ifname, src->ifname) < 0)
+        goto error;
+
+    if (src->filterparams) {
+        if (!(def->filterparams = virNWFilterHashTableCreate(0))) {
+            virReportOOMError();
+            goto error;
+        }
+        if (virNWFilterHashTablePutAll(src->filterparams,
+                                       def->filterparams) < 0)
+            goto error;
+    }
+
+    switch (src->type) {
+    case VIR_DOMAIN_NET_TYPE_ETHERNET:
+        if (virDomainCopyString(&def->data.ethernet.dev,
+                                src->data.ethernet.dev) < 0 ||
+            virDomainCopyString(&def->data.ethernet.ipaddr,
+                                src->data.ethernet.ipaddr) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_SERVER:
+    case VIR_DOMAIN_NET_TYPE_CLIENT:
+    case VIR_DOMAIN_NET_TYPE_MCAST:
+        def->data.socket.port = src->data.socket.port;
+        if (virDomainCopyString(&def->data.socket.address,
+                                src->data.socket.address) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_NETWORK:
+        /* The actual device is allocated from the network on start */
+        if (virDomainCopyString(&def->data.network.name,
+                                src->data.network.name) < 0 ||
+            virDomainCopyString(&def->data.network.portgroup,
+                                src->data.network.portgroup) < 0 ||
+            virDomainVirtPortProfileCopy(&def->data.network.virtPortProfile,
+                                         src->data.network.virtPortProfile) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_BRIDGE:
+        if (virDomainCopyString(&def->data.bridge.brname,
+                                src->data.bridge.brname) < 0 ||
+            virDomainCopyString(&def->data.bridge.ipaddr,
+                                src->data.bridge.ipaddr) < 0 ||
+            virDomainVirtPortProfileCopy(&def->data.bridge.virtPortProfile,
+                                         src->data.bridge.virtPortProfile) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_INTERNAL:
+        if (virDomainCopyString(&def->data.internal.name,
+                                src->data.internal.name) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_DIRECT:
+        def->data.direct.mode = src->data.direct.mode;
+        if (virDomainCopyString(&def->data.direct.linkdev,
+                                src->data.direct.linkdev) < 0 ||
+            virDomainVirtPortProfileCopy(&def->data.direct.virtPortProfile,
+                                         src->data.direct.virtPortProfile) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_HOSTDEV:
+        def->data.hostdev.def.parent.type = VIR_DOMAIN_DEVICE_NET;
+        def->data.hostdev.def.parent.data.net = def;
+        def->data.hostdev.def.info = &def->info;
+        if (virDomainHostdevDefCopyInto(&def->data.hostdev.def,
+                                        &src->data.hostdev.def) < 0 ||
+            virDomainVirtPortProfileCopy(&def->data.hostdev.virtPortProfile,
+                                         src->data.hostdev.virtPortProfile) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_NET_TYPE_USER:
+    case VIR_DOMAIN_NET_TYPE_LAST:
+        break;
+    }
+
+    return def;
+
+error:
+    virDomainNetDefFree(def);
+    return NULL;
+}
+
+static virDomainInputDefPtr
+virDomainInputDefCopy(virDomainInputDefPtr src)
+{
+    virDomainInputDefPtr def;
+
+    if (VIR_ALLOC(def) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    def->type = src->type;
+    def->bus = src->bus;
+
+    if (virDomainDeviceInfoCopy(&def->info, &src->info) < 0) {
+        virDomainInputDefFree(def);
+        return NULL;
+    }
+
+    return def;
+}
+
+static virDomainSoundDefPtr
+virDomainSoundDefCopy(virDomainSoundDefPtr src)
+{
+    virDomainSoundDefPtr def;
+
+    if (VIR_ALLOC(def) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    def->model = src->model;
+
+    if (virDomainDeviceInfoCopy(&def->info, &src->info) < 0) {
+        virDomainSoundDefFree(def);
+        return NULL;
+    }
+
+    return def;
+}
+
+static virDomainVideoDefPtr
+virDomainVideoDefCopy(virDomainVideoDefPtr src)
+{
+    virDomainVideoDefPtr def;
+
+    if (VIR_ALLOC(def) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    def->type = src->type;
+    def->vram = src->vram;
+    def->heads = src->heads;
+
+    if (src->accel) {
+        if (VIR_ALLOC(def->accel) < 0) {
+            virReportOOMError();
+            goto error;
+        }
+        *def->accel = *src->accel;
+    }
+
+    if (virDomainDeviceInfoCopy(&def->info, &src->info) < 0)
+        goto error;
+
+    return def;
+
+error:
+    virDomainVideoDefFree(def);
+    return NULL;
+}
+
+static virDomainWatchdogDefPtr
+virDomainWatchdogDefCopy(virDomainWatchdogDefPtr src)
+{
+    virDomainWatchdogDefPtr def;
+
+    if (VIR_ALLOC(def) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    def->model = src->model;
+    def->action = src->action;
+
+    if (virDomainDeviceInfoCopy(&def->info, &src->info) < 0) {
+        virDomainWatchdogDefFree(def);
+        return NULL;
+    }
+
+    return def;
+}
+
+static int
+virDomainGraphicsAuthDefCopy(virDomainGraphicsAuthDefPtr dst,
+                             const virDomainGraphicsAuthDef *src)
+{
+    dst->expires = src->expires;
+    dst->validTo = src->validTo;
+    dst->connected = src->connected;
+
+    return virDomainCopyString(&dst->passwd, src->passwd);
+}
+
+static virDomainGraphicsDefPtr
+virDomainGraphicsDefCopy(virDomainGraphicsDefPtr src)
+{
+    virDomainGraphicsDefPtr def;
+    size_t i;
+
+    if (VIR_ALLOC(def) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    def->type = src->type;
+
+    switch (src->type) {
+    case VIR_DOMAIN_GRAPHICS_TYPE_VNC:
+        def->data.vnc.autoport = src->data.vnc.autoport;
+        /* Automatic ports are picked again on start */
+        if (!src->data.vnc.autoport)
+            def->data.vnc.port = src->data.vnc.port;
+        if (virDomainCopyString(&def->data.vnc.keymap,
+                                src->data.vnc.keymap) < 0 ||
+            virDomainCopyString(&def->data.vnc.socket,
+                                src->data.vnc.socket) < 0 ||
+            virDomainGraphicsAuthDefCopy(&def->data.vnc.auth,
+                                         &src->data.vnc.auth) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_GRAPHICS_TYPE_SDL:
+        def->data.sdl.fullscreen = src->data.sdl.fullscreen;
+        if (virDomainCopyString(&def->data.sdl.display,
+                                src->data.sdl.display) < 0 ||
+            virDomainCopyString(&def->data.sdl.xauth,
+                                src->data.sdl.xauth) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_GRAPHICS_TYPE_RDP:
+        def->data.rdp = src->data.rdp;
+        if (src->data.rdp.autoport)
+            def->data.rdp.port = 0;
+        break;
+
+    case VIR_DOMAIN_GRAPHICS_TYPE_DESKTOP:
+        def->data.desktop.fullscreen = src->data.desktop.fullscreen;
+        if (virDomainCopyString(&def->data.desktop.display,
+                                src->data.desktop.display) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_GRAPHICS_TYPE_SPICE:
+        def->data.spice = src->data.spice;
+        def->data.spice.keymap = NULL;
+        def->data.spice.auth.passwd = NULL;
+        if (src->data.spice.autoport) {
+            def->data.spice.port = 0;
+            def->data.spice.tlsPort = 0;
+        }
+        if (virDomainCopyString(&def->data.spice.keymap,
+                                src->data.spice.keymap) < 0 ||
+            virDomainGraphicsAuthDefCopy(&def->data.spice.auth,
+                                         &src->data.spice.auth) < 0)
+            goto error;
+        break;
+    }
+
+    if (src->nListens) {
+        if (VIR_ALLOC_N(def->listens, src->nListens) < 0) {
+            virReportOOMError();
+            goto error;
+        }
+        for (i = 0; i < src->nListens; i++) {
+            virDomainGraphicsListenDefPtr listen = &def->listens[i];
+
+            def->nListens++;
+            listen->type = src->listens[i].type;
+            if (virDomainCopyString(&listen->network,
+                                    src->listens[i].network) < 0)
+                goto error;
+            /* The address of a network is looked up on start */
+            if (listen->type != VIR_DOMAIN_GRAPHICS_LISTEN_TYPE_NETWORK &&
+                virDomainCopyString(&listen->address,
+                                    src->listens[i].address) < 0)
+                goto error;
+        }
+    }
+
+    return def;
+
+error:
+    virDomainGraphicsDefFree(def);
+    return NULL;
+}
+
+static virDomainHubDefPtr
+virDomainHubDefCopy(virDomainHubDefPtr src)
+{
+    virDomainHubDefPtr def;
+
+    if (VIR_ALLOC(def) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    def->type = src->type;
+
+    if (virDomainDeviceInfoCopy(&def->info, &src->info) < 0) {
+        virDomainHubDefFree(def);
+        return NULL;
+    }
+
+    return def;
+}
+
+static virDomainRedirdevDefPtr
+virDomainRedirdevDefCopy(virDomainRedirdevDefPtr src)
+{
+    virDomainRedirdevDefPtr def;
+
+    if (VIR_ALLOC(def) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    def->bus = src->bus;
+
+    if (virDomainChrSourceDefCopyInactive(&def->source.chr,
+                                          &src->source.chr) < 0 ||
+        virDomainDeviceInfoCopy(&def->info, &src->info) < 0) {
+        virDomainRedirdevDefFree(def);
+        return NULL;
+    }
+
+    return def;
+}
+
+static virDomainSmartcardDefPtr
+virDomainSmartcardDefCopy(virDomainSmartcardDefPtr src)
+{
+    virDomainSmartcardDefPtr def;
+    size_t i;
+
+    if (VIR_ALLOC(def) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    def->type = src->type;
+
+    switch (src->type) {
+    case VIR_DOMAIN_SMARTCARD_TYPE_HOST_CERTIFICATES:
+        for (i = 0; i < VIR_DOMAIN_SMARTCARD_NUM_CERTIFICATES; i++) {
+            if (virDomainCopyString(&def->data.cert.file[i],
+                                    src->data.cert.file[i]) < 0)
+                goto error;
+        }
+        if (virDomainCopyString(&def->data.cert.database,
+                                src->data.cert.database) < 0)
+            goto error;
+        break;
+
+    case VIR_DOMAIN_SMARTCARD_TYPE_PASSTHROUGH:
+        if (virDomainChrSourceDefCopyInactive(&def->data.passthru,
+                                              &src->data.passthru) < 0)
+            goto error;
+        break;
+    }
+
+    if (virDomainDeviceInfoCopy(&def->info, &src->info) < 0)
+        goto error;
+
+    return def;
+
+error:
+    virDomainSmartcardDefFree(def);
+    return NULL;
+}
+
+static virDomainChrDefPtr
+virDomainChrDefCopy(virDomainChrDefPtr src)
+{
+    virDomainChrDefPtr def;
+
+    if (VIR_ALLOC(def) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    def->deviceType = src->deviceType;
+    def->targetType = src->targetType;
+
+    if (src->deviceType == VIR_DOMAIN_CHR_DEVICE_TYPE_CHANNEL) {
+        switch (src->targetType) {
+        case VIR_DOMAIN_CHR_CHANNEL_TARGET_TYPE_GUESTFWD:
+            if (src->target.addr) {
+                if (VIR_ALLOC(def->target.addr) < 0) {
+                    virReportOOMError();
+                    goto error;
+                }
+                *def->target.addr = *src->target.addr;
+            }
+            break;
+
+        case VIR_DOMAIN_CHR_CHANNEL_TARGET_TYPE_VIRTIO:
+            if (virDomainCopyString(&def->target.name,
+                                    src->target.name) < 0)
+                goto error;
+            break;
+        }
+    } else {
+        def->target.port = src->target.port;
+    }
+
+    if (virDomainChrSourceDefCopyInactive(&def->source, &src->source) < 0 ||
+        virDomainDeviceInfoCopy(&def->info, &src->info) < 0)
+        goto error;
+
+    return def;
+
+error:
+    virDomainChrDefFree(def);
+    return NULL;
+}
+
+static virDomainMemballoonDefPtr
+virDomainMemballoonDefCopy(virDomainMemballoonDefPtr src)
+{
+    virDomainMemballoonDefPtr def;
+
+    if (VIR_ALLOC(def) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    def->model = src->model;
+
+    if (virDomainDeviceInfoCopy(&def->info, &src->info) < 0) {
+        virDomainMemballoonDefFree(def);
+        return NULL;
+    }
+
+    return def;
+}
+
+static virSysinfoDefPtr
+virSysinfoDefCopy(virSysinfoDefPtr src)
+{
+    virSysinfoDefPtr def;
+    size_t i;
+
+    if (VIR_ALLOC(def) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    def->type = src->type;
+
+    if (virDomainCopyString(&def->bios_vendor, src->bios_vendor) < 0 ||
+        virDomainCopyString(&def->bios_version, src->bios_version) < 0 ||
+        virDomainCopyString(&def->bios_date, src->bios_date) < 0 ||
+        virDomainCopyString(&def->bios_release, src->bios_release) < 0 ||
+        virDomainCopyString(&def->system_manufacturer,
+                            src->system_manufacturer) < 0 ||
+        virDomainCopyString(&def->system_product, src->system_product) < 0 ||
+        virDomainCopyString(&def->system_version, src->system_version) < 0 ||
+        virDomainCopyString(&def->system_serial, src->system_serial) < 0 ||
+        virDomainCopyString(&def->system_uuid, src->system_uuid) < 0 ||
+        virDomainCopyString(&def->system_sku, src->system_sku) < 0 ||
+        virDomainCopyString(&def->system_family, src->system_family) < 0)
+        goto error;
+
+    if (src->nprocessor) {
+        if (VIR_ALLOC_N(def->processor, src->nprocessor) < 0) {
+            virReportOOMError();
+            goto error;
+        }
+        for (i = 0; i < src->nprocessor; i++) {
+            virSysinfoProcessorDefPtr dst = &def->processor[i];
+            virSysinfoProcessorDefPtr proc = &src->processor[i];
+
+            def->nprocessor++;
+            if (virDomainCopyString(&dst->processor_socket_destination,
+                                    proc->processor_socket_destination) < 0 ||
+                virDomainCopyString(&dst->processor_type,
+                                    proc->processor_type) < 0 ||
+                virDomainCopyString(&dst->processor_family,
+                                    proc->processor_family) < 0 ||
+                virDomainCopyString(&dst->processor_manufacturer,
+                                    proc->processor_manufacturer) < 0 ||
+                virDomainCopyString(&dst->processor_signature,
+                                    proc->processor_signature) < 0 ||
+                virDomainCopyString(&dst->processor_version,
+                                    proc->processor_version) < 0 ||
+                virDomainCopyString(&dst->processor_external_clock,
+                                    proc->processor_external_clock) < 0 ||
+                virDomainCopyString(&dst->processor_max_speed,
+                                    proc->processor_max_speed) < 0 ||
+                virDomainCopyString(&dst->processor_status,
+                                    proc->processor_status) < 0 ||
+                virDomainCopyString(&dst->processor_serial_number,
+                                    proc->processor_serial_number) < 0 ||
+                virDomainCopyString(&dst->processor_part_number,
+                                    proc->processor_part_number) < 0)
+                goto error;
+        }
+    }
+
+    if (src->nmemory) {
+        if (VIR_ALLOC_N(def->memory, src->nmemory) < 0) {
+            virReportOOMError();
+            goto error;
+        }
+        for (i = 0; i < src->nmemory; i++) {
+            virSysinfoMemoryDefPtr dst = &def->memory[i];
+            virSysinfoMemoryDefPtr mem = &src->memory[i];
+
+            def->nmemory++;
+            if (virDomainCopyString(&dst->memory_size,
+                                    mem->memory_size) < 0 ||
+                virDomainCopyString(&dst->memory_form_factor,
+                                    mem->memory_form_factor) < 0 ||
+                virDomainCopyString(&dst->memory_locator,
+                                    mem->memory_locator) < 0 ||
+                virDomainCopyString(&dst->memory_bank_locator,
+                                    mem->memory_bank_locator) < 0 ||
+                virDomainCopyString(&dst->memory_type,
+                                    mem->memory_type) < 0 ||
+                virDomainCopyString(&dst->memory_type_detail,
+                                    mem->memory_type_detail) < 0 ||
+                virDomainCopyString(&dst->memory_speed,
+                                    mem->memory_speed) < 0 ||
+                virDomainCopyString(&dst->memory_manufacturer,
+                                    mem->memory_manufacturer) < 0 ||
+                virDomainCopyString(&dst->memory_serial_number,
+                                    mem->memory_serial_number) < 0 ||
+                virDomainCopyString(&dst->memory_part_number,
+                                    mem->memory_part_number) < 0)
+                goto error;
+        }
+    }
+
+    return def;
+
+error:
+    virSysinfoDefFree(def);
+    return NULL;
+}
+
+static int
+virDomainClockDefCopy(virDomainClockDefPtr dst,
+                      virDomainClockDefPtr src)
+{
+    int i;
+
+    dst->offset = src->offset;
+    if (src->offset == VIR_DOMAIN_CLOCK_OFFSET_TIMEZONE) {
+        if (virDomainCopyString(&dst->data.timezone,
+                                src->data.timezone) < 0)
+            return -1;
+    } else {
+        dst->data = src->data;
+    }
+
+    if (src->ntimers) {
+        if (VIR_ALLOC_N(dst->timers, src->ntimers) < 0)
+            goto no_memory;
+        for (i = 0; i < src->ntimers; i++) {
+            if (VIR_ALLOC(dst->timers[i]) < 0)
+                goto no_memory;
+            dst->ntimers++;
+            *dst->timers[i] = *src->timers[i];
+        }
+    }
+
+    return 0;
+
+no_memory:
+    virReportOOMError();
+    return -1;
+}
+
+/* Copies @count pointers to devices from @src with @copy into a newly
+ * allocated @dst, with @ndst kept to what needs to be freed */
+#define VIR_DOMAIN_COPY_DEVICES(dst, ndst, src, count, copy)           \
+    do {                                                                \
+        size_t _i;                                                      \
+        if ((count) && VIR_ALLOC_N(dst, count) < 0) {                   \
+            virReportOOMError();                                        \
+            goto error;                                                 \
+        }                                                               \
+        for (_i = 0; _i < (count); _i++) {                              \
+            if (!((dst)[_i] = copy((src)[_i])))                         \
+                goto error;                                             \
+            (ndst)++;                                                   \
+        }                                                               \
+    } while (0)
+
+/**
+ * virDomainDefCopy:
+ * @src: the definition to copy
+ *
+ * Makes a deep copy of the persistent configuration in @src. The
+ * result is the same as formatting @src with VIR_DOMAIN_XML_WRITE_FLAGS
+ * and parsing it back with VIR_DOMAIN_XML_READ_FLAGS, so runtime state
+ * (the domain ID, device aliases, automatic ports, actual network
+ * devices, ...) is left out.
+ *
+ * Returns the copy, or NULL with an error reported.
+ */
+virDomainDefPtr
+virDomainDefCopy(virDomainDefPtr src)
+{
+    virDomainDefPtr def;
+    int i, j;
 
-    if (VIR_ALLOC(domain) < 0) {
-        virReportOOMError();
+    if (src->namespaceData && !src->ns.copy) {
+        virDomainReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                             _("cannot copy the domain XML namespace data"));
         return NULL;
     }
 
-    if (caps->privateDataAllocFunc &&
-        !(domain->privateData = (caps->privateDataAllocFunc)())) {
+    if (VIR_ALLOC(def) < 0) {
         virReportOOMError();
-        VIR_FREE(domain);
         return NULL;
     }
-    domain->privateDataFreeFunc = caps->privateDataFreeFunc;
 
-    if (virMutexInit(&domain->lock) < 0) {
-        virDomainReportError(VIR_ERR_INTERNAL_ERROR,
-                             "%s", _("cannot initialize mutex"));
-        if (domain->privateDataFreeFunc)
-            (domain->privateDataFreeFunc)(domain->privateData);
-        VIR_FREE(domain);
-        return NULL;
-    }
+    def->virtType = src->virtType;
+    def->id = -1;
+    memcpy(def->uuid, src->uuid, VIR_UUID_BUFLEN);
+    def->blkio.weight = src->blkio.weight;
+    def->mem = src->mem;
+    def->vcpus = src->vcpus;
+    def->maxvcpus = src->maxvcpus;
+    def->placement_mode = src->placement_mode;
+    def->cputune.shares = src->cputune.shares;
+    def->cputune.period = src->cputune.period;
+    def->cputune.quota = src->cputune.quota;
+    def->numatune.memory.mode = src->numatune.memory.mode;
+    def->onReboot = src->onReboot;
+    def->onPoweroff = src->onPoweroff;
+    def->onCrash = src->onCrash;
+    def->features = src->features;
+    def->ns = src->ns;
+
+    if (virDomainCopyString(&def->name, src->name) < 0 ||
+        virDomainCopyString(&def->title, src->title) < 0 ||
+        virDomainCopyString(&def->description, src->description) < 0 ||
+        virDomainCopyString(&def->emulator, src->emulator) < 0)
+        goto error;
 
-    virDomainObjLock(domain);
-    virDomainObjSetState(domain, VIR_DOMAIN_SHUTOFF,
-                                 VIR_DOMAIN_SHUTOFF_UNKNOWN);
-    domain->refs = 1;
+    if (src->blkio.ndevices) {
+        if (VIR_ALLOC_N(def->blkio.devices, src->blkio.ndevices) < 0)
+            goto no_memory;
+        for (i = 0; i < src->blkio.ndevices; i++) {
+            def->blkio.ndevices++;
+            def->blkio.devices[i].weight = src->blkio.devices[i].weight;
+            if (virDomainCopyString(&def->blkio.devices[i].path,
+                                    src->blkio.devices[i].path) < 0)
+                goto error;
+        }
+    }
 
-    virDomainSnapshotObjListInit(&domain->snapshots);
+    if (src->cpumask) {
+        if (VIR_ALLOC_N(def->cpumask, src->cpumasklen) < 0)
+            goto no_memory;
+        memcpy(def->cpumask, src->cpumask, src->cpumasklen);
+    }
+    def->cpumasklen = src->cpumasklen;
 
-    VIR_DEBUG("obj=%p", domain);
-    return domain;
-}
+    if (src->cputune.nvcpupin) {
+        if (VIR_ALLOC_N(def->cputune.vcpupin, src->cputune.nvcpupin) < 0)
+            goto no_memory;
+        for (i = 0; i < src->cputune.nvcpupin; i++) {
+            virDomainVcpuPinDefPtr pin;
 
-void virDomainObjAssignDef(virDomainObjPtr domain,
-                           const virDomainDefPtr def,
-                           bool live)
-{
-    if (!virDomainObjIsActive(domain)) {
-        if (live) {
-            /* save current configuration to be restored on domain shutdown */
-            if (!domain->newDef)
-                domain->newDef = domain->def;
-            domain->def = def;
-        } else {
-            virDomainDefFree(domain->def);
-            domain->def = def;
+            if (VIR_ALLOC(pin) < 0)
+                goto no_memory;
+            def->cputune.vcpupin[def->cputune.nvcpupin++] = pin;
+            pin->vcpuid = src->cputune.vcpupin[i]->vcpuid;
+            if (src->cputune.vcpupin[i]->cpumask) {
+                if (VIR_ALLOC_N(pin->cpumask, VIR_DOMAIN_CPUMASK_LEN) < 0)
+                    goto no_memory;
+                memcpy(pin->cpumask, src->cputune.vcpupin[i]->cpumask,
+                       VIR_DOMAIN_CPUMASK_LEN);
+            }
         }
-    } else {
-        virDomainDefFree(domain->newDef);
-        domain->newDef = def;
     }
-}
 
-virDomainObjPtr virDomainAssignDef(virCapsPtr caps,
-                                   virDomainObjListPtr doms,
-                                   const virDomainDefPtr def,
-                                   bool live)
-{
-    virDomainObjPtr domain;
-    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    if (src->numatune.memory.nodemask) {
+        if (VIR_ALLOC_N(def->numatune.memory.nodemask,
+                        VIR_DOMAIN_CPUMASK_LEN) < 0)
+            goto no_memory;
+        memcpy(def->numatune.memory.nodemask, src->numatune.memory.nodemask,
+               VIR_DOMAIN_CPUMASK_LEN);
+    }
+
+    def->os.nBootDevs = src->os.nBootDevs;
+    memcpy(def->os.bootDevs, src->os.bootDevs, sizeof(src->os.bootDevs));
+    def->os.bootmenu = src->os.bootmenu;
+    def->os.smbios_mode = src->os.smbios_mode;
+    def->os.bios = src->os.bios;
+    if (virDomainCopyString(&def->os.type, src->os.type) < 0 ||
+        virDomainCopyString(&def->os.arch, src->os.arch) < 0 ||
+        virDomainCopyString(&def->os.machine, src->os.machine) < 0 ||
+        virDomainCopyString(&def->os.init, src->os.init) < 0 ||
+        virDomainCopyString(&def->os.kernel, src->os.kernel) < 0 ||
+        virDomainCopyString(&def->os.initrd, src->os.initrd) < 0 ||
+        virDomainCopyString(&def->os.cmdline, src->os.cmdline) < 0 ||
+        virDomainCopyString(&def->os.root, src->os.root) < 0 ||
+        virDomainCopyString(&def->os.loader, src->os.loader) < 0 ||
+        virDomainCopyString(&def->os.bootloader, src->os.bootloader) < 0 ||
+        virDomainCopyString(&def->os.bootloaderArgs,
+                            src->os.bootloaderArgs) < 0)
+        goto error;
 
-    if ((domain = virDomainFindByUUID(doms, def->uuid))) {
-        virDomainObjAssignDef(domain, def, live);
-        return domain;
+    if (src->os.initargv) {
+        for (i = 0; src->os.initargv[i]; i++)
+            ;
+        if (VIR_ALLOC_N(def->os.initargv, i + 1) < 0)
+            goto no_memory;
+        for (i = 0; src->os.initargv[i]; i++) {
+            if (virDomainCopyString(&def->os.initargv[i],
+                                    src->os.initargv[i]) < 0)
+                goto error;
+        }
     }
 
-    if (!(domain = virDomainObjNew(caps)))
-        return NULL;
-    domain->def = def;
+    if (virDomainClockDefCopy(&def->clock, &src->clock) < 0)
+        goto error;
 
-    virUUIDFormat(def->uuid, uuidstr);
-    if (virHashAddEntry(doms->objs, uuidstr, domain) < 0) {
-        VIR_FREE(domain);
-        return NULL;
+    VIR_DOMAIN_COPY_DEVICES(def->graphics, def->ngraphics,
+                            src->graphics, src->ngraphics,
+                            virDomainGraphicsDefCopy);
+    VIR_DOMAIN_COPY_DEVICES(def->disks, def->ndisks,
+                            src->disks, src->ndisks,
+                            virDomainDiskDefCopy);
+    VIR_DOMAIN_COPY_DEVICES(def->controllers, def->ncontrollers,
+                            src->controllers, src->ncontrollers,
+                            virDomainControllerDefCopy);
+    VIR_DOMAIN_COPY_DEVICES(def->fss, def->nfss,
+                            src->fss, src->nfss,
+                            virDomainFSDefCopy);
+    VIR_DOMAIN_COPY_DEVICES(def->nets, def->nnets,
+                            src->nets, src->nnets,
+                            virDomainNetDefCopy);
+    VIR_DOMAIN_COPY_DEVICES(def->inputs, def->ninputs,
+                            src->inputs, src->ninputs,
+                            virDomainInputDefCopy);
+    VIR_DOMAIN_COPY_DEVICES(def->sounds, def->nsounds,
+                            src->sounds, src->nsounds,
+                            virDomainSoundDefCopy);
+    VIR_DOMAIN_COPY_DEVICES(def->videos, def->nvideos,
+                            src->videos, src->nvideos,
+                            virDomainVideoDefCopy);
+    VIR_DOMAIN_COPY_DEVICES(def->redirdevs, def->nredirdevs,
+                            src->redirdevs, src->nredirdevs,
+                            virDomainRedirdevDefCopy);
+    VIR_DOMAIN_COPY_DEVICES(def->smartcards, def->nsmartcards,
+                            src->smartcards, src->nsmartcards,
+                            virDomainSmartcardDefCopy);
+    VIR_DOMAIN_COPY_DEVICES(def->serials, def->nserials,
+                            src->serials, src->nserials,
+                            virDomainChrDefCopy);
+    VIR_DOMAIN_COPY_DEVICES(def->parallels, def->nparallels,
+                            src->parallels, src->nparallels,
+                            virDomainChrDefCopy);
+    VIR_DOMAIN_COPY_DEVICES(def->channels, def->nchannels,
+                            src->channels, src->nchannels,
+                            virDomainChrDefCopy);
+    VIR_DOMAIN_COPY_DEVICES(def->consoles, def->nconsoles,
+                            src->consoles, src->nconsoles,
+                            virDomainChrDefCopy);
+    VIR_DOMAIN_COPY_DEVICES(def->leases, def->nleases,
+                            src->leases, src->nleases,
+                            virDomainLeaseDefCopy);
+    VIR_DOMAIN_COPY_DEVICES(def->hubs, def->nhubs,
+                            src->hubs, src->nhubs,
+                            virDomainHubDefCopy);
+
+    /* Hostdevs of <interface type='hostdev'> live in the copied nets,
+     * while those of actual network devices aren't copied at all */
+    if (src->nhostdevs && VIR_ALLOC_N(def->hostdevs, src->nhostdevs) < 0)
+        goto no_memory;
+    for (i = 0; i < src->nhostdevs; i++) {
+        virDomainHostdevDefPtr hostdev = src->hostdevs[i];
+
+        if (hostdev->parent.type == VIR_DOMAIN_DEVICE_NONE) {
+            if (!(def->hostdevs[def->nhostdevs] =
+                  virDomainHostdevDefCopy(hostdev)))
+                goto error;
+            def->nhostdevs++;
+            continue;
+        }
+
+        for (j = 0; j < src->nnets; j++) {
+            if (src->nets[j]->type == VIR_DOMAIN_NET_TYPE_HOSTDEV &&
+                hostdev == &src->nets[j]->data.hostdev.def) {
+                def->hostdevs[def->nhostdevs++] =
+                    &def->nets[j]->data.hostdev.def;
+                break;
+            }
+        }
     }
 
-    return domain;
+    if (virSecurityLabelDefCopy(&def->seclabel, &src->seclabel) < 0)
+        goto error;
+
+    if (src->watchdog &&
+        !(def->watchdog = virDomainWatchdogDefCopy(src->watchdog)))
+        goto error;
+
+    if (src->memballoon &&
+        !(def->memballoon = virDomainMemballoonDefCopy(src->memballoon)))
+        goto error;
+
+    if (src->cpu && !(def->cpu = virCPUDefCopy(src->cpu)))
+        goto error;
+
+    if (src->sysinfo && !(def->sysinfo = virSysinfoDefCopy(src->sysinfo)))
+        goto error;
+
+    if (src->namespaceData &&
+        !(def->namespaceData = (src->ns.copy)(src->namespaceData)))
+        goto error;
+
+    if (src->metadata && !(def->metadata = xmlCopyNode(src->metadata, 1)))
+        goto no_memory;
+
+    return def;
+
+no_memory:
+    virReportOOMError();
+error:
+    virDomainDefFree(def);
+    return NULL;
 }
 
+#undef VIR_DOMAIN_COPY_DEVICES
+
 /*
  * Mark the running VM config as transient. Ensures transient hotplug
  * operations do not persist past shutdown.
@@ -1747,14 +3012,10 @@ virDomainObjPtr virDomainAssignDef(virCapsPtr caps,
  * @return 0 on success, -1 on failure
  */
 int
-virDomainObjSetDefTransient(virCapsPtr caps,
+virDomainObjSetDefTransient(virCapsPtr caps ATTRIBUTE_UNUSED,
                             virDomainObjPtr domain,
                             bool live)
 {
-    int ret = -1;
-    char *xml = NULL;
-    virDomainDefPtr newDef = NULL;
-
     if (!virDomainObjIsActive(domain) && !live)
         return 0;
 
@@ -1764,18 +3025,10 @@ virDomainObjSetDefTransient(virCapsPtr caps,
     if (domain->newDef)
         return 0;
 
-    if (!(xml = virDomainDefFormat(domain->def, VIR_DOMAIN_XML_WRITE_FLAGS)))
-        goto out;
-
-    if (!(newDef = virDomainDefParseString(caps, xml, -1,
-                                           VIR_DOMAIN_XML_READ_FLAGS)))
-        goto out;
+    if (!(domain->newDef = virDomainDefCopy(domain->def)))
+        return -1;
 
-    domain->newDef = newDef;
-    ret = 0;
-out:
-    VIR_FREE(xml);
-    return ret;
+    return 0;
 }
 
 /*
@@ -1862,6 +3115,10 @@ void virDomainRemoveInactive(virDomainObjListPtr doms,
     char uuidstr[VIR_UUID_STRING_BUFLEN];
     virUUIDFormat(dom->def->uuid, uuidstr);
 
+    /* Drop index entries first, since they don't hold a reference */
+    virHashRemoveEntry(doms->names, dom->def->name);
+    virDomainObjListRemoveID(doms, dom);
+
     virDomainObjUnlock(dom);
 
     virHashRemoveEntry(doms->objs, uuidstr);
@@ -4439,7 +5696,7 @@ virDomainNetDefParseXML(virCapsPtr caps,
                 ifname = virXMLPropString(cur, "dev");
                 if (ifname &&
                     (flags & VIR_DOMAIN_XML_INACTIVE) &&
-                    STRPREFIX(ifname, VIR_NET_GENERATED_PREFIX)) {
+                    virDomainNetIfnameIsGenerated(def->type, ifname)) {
                     /* An auto-generated target name, blank it out */
                     VIR_FREE(ifname);
                 }
@@ -4629,10 +5886,6 @@ virDomainNetDefParseXML(virCapsPtr caps,
         virtPort = NULL;
         def->data.direct.linkdev = dev;
         dev = NULL;
-
-        if (flags & VIR_DOMAIN_XML_INACTIVE)
-            VIR_FREE(ifname);
-
         break;
 
     case VIR_DOMAIN_NET_TYPE_HOSTDEV:
@@ -11368,7 +12621,7 @@ virDomainNetDefFormat(virBufferPtr buf,
                           def->script);
     if (def->ifname &&
         !((flags & VIR_DOMAIN_XML_INACTIVE) &&
-          (STRPREFIX(def->ifname, VIR_NET_GENERATED_PREFIX)))) {
+          virDomainNetIfnameIsGenerated(def->type, def->ifname))) {
         /* Skip auto-generated target names for inactive config. */
         virBufferEscapeString(buf, "      <target dev='%s'/>\n",
                               def->ifname);
@@ -12934,38 +14187,82 @@ cleanup:
 }
 
 
+/* Parsing a config only takes CPU time, so there is no point in
+ * parsing more of them at once than there are CPUs online */
+#define VIR_DOMAIN_LOAD_WORKERS_MAX 16
+
+typedef struct _virDomainLoadJob virDomainLoadJob;
+typedef virDomainLoadJob *virDomainLoadJobPtr;
+struct _virDomainLoadJob {
+    char *name;
+    virDomainDefPtr def; /* persistent config */
+    virDomainObjPtr obj; /* live status */
+    int autostart;
+};
+
+typedef struct _virDomainLoad virDomainLoad;
+typedef virDomainLoad *virDomainLoadPtr;
+struct _virDomainLoad {
+    virMutex lock;
+    virCond done;
+    size_t pending;
+
+    virCapsPtr caps;
+    const char *configDir;
+    const char *autostartDir;
+    int liveStatus;
+    unsigned int expectedVirtTypes;
+};
+
+static int virDomainLoadConfigParse(virDomainLoadPtr load,
+                                    virDomainLoadJobPtr job)
+{
+    char *configFile = NULL, *autostartLink = NULL;
+    int ret = -1;
+
+    if ((configFile = virDomainConfigFile(load->configDir, job->name)) == NULL)
+        goto cleanup;
+    if (!(job->def = virDomainDefParseFile(load->caps, configFile,
+                                           load->expectedVirtTypes,
+                                           VIR_DOMAIN_XML_INACTIVE)))
+        goto cleanup;
+
+    if ((autostartLink = virDomainConfigFile(load->autostartDir,
+                                             job->name)) == NULL)
+        goto cleanup;
+
+    if ((job->autostart = virFileLinkPointsTo(autostartLink, configFile)) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    if (ret < 0) {
+        virDomainDefFree(job->def);
+        job->def = NULL;
+    }
+    VIR_FREE(configFile);
+    VIR_FREE(autostartLink);
+    return ret;
+}
+
 static virDomainObjPtr virDomainLoadConfig(virCapsPtr caps,
                                            virDomainObjListPtr doms,
-                                           const char *configDir,
-                                           const char *autostartDir,
-                                           const char *name,
-                                           unsigned int expectedVirtTypes,
+                                           virDomainLoadJobPtr job,
                                            virDomainLoadConfigNotify notify,
                                            void *opaque)
 {
-    char *configFile = NULL, *autostartLink = NULL;
-    virDomainDefPtr def = NULL;
+    virDomainDefPtr def = job->def;
     virDomainObjPtr dom;
-    int autostart;
     int newVM = 1;
 
-    if ((configFile = virDomainConfigFile(configDir, name)) == NULL)
-        goto error;
-    if (!(def = virDomainDefParseFile(caps, configFile, expectedVirtTypes,
-                                      VIR_DOMAIN_XML_INACTIVE)))
-        goto error;
-
-    if ((autostartLink = virDomainConfigFile(autostartDir, name)) == NULL)
-        goto error;
-
-    if ((autostart = virFileLinkPointsTo(autostartLink, configFile)) < 0)
-        goto error;
+    job->def = NULL;
 
     /* if the domain is already in our hashtable, we only need to
      * update the autostart flag
      */
     if ((dom = virDomainFindByUUID(doms, def->uuid))) {
-        dom->autostart = autostart;
+        dom->autostart = job->autostart;
 
         if (virDomainObjIsActive(dom) &&
             !dom->newDef) {
@@ -12974,77 +14271,180 @@ static virDomainObjPtr virDomainLoadConfig(virCapsPtr caps,
             virDomainDefFree(def);
         }
 
-        VIR_FREE(configFile);
-        VIR_FREE(autostartLink);
         return dom;
     }
 
     if (!(dom = virDomainAssignDef(caps, doms, def, false)))
         goto error;
 
-    dom->autostart = autostart;
+    dom->autostart = job->autostart;
 
     if (notify)
         (*notify)(dom, newVM, opaque);
 
-    VIR_FREE(configFile);
-    VIR_FREE(autostartLink);
     return dom;
 
 error:
-    VIR_FREE(configFile);
-    VIR_FREE(autostartLink);
     virDomainDefFree(def);
     return NULL;
 }
 
-static virDomainObjPtr virDomainLoadStatus(virCapsPtr caps,
-                                           virDomainObjListPtr doms,
-                                           const char *statusDir,
-                                           const char *name,
-                                           unsigned int expectedVirtTypes,
+static int virDomainLoadStatusParse(virDomainLoadPtr load,
+                                    virDomainLoadJobPtr job)
+{
+    char *statusFile = NULL;
+
+    if ((statusFile = virDomainConfigFile(load->configDir, job->name)) == NULL)
+        return -1;
+
+    job->obj = virDomainObjParseFile(load->caps, statusFile,
+                                     load->expectedVirtTypes,
+                                     VIR_DOMAIN_XML_INTERNAL_STATUS |
+                                     VIR_DOMAIN_XML_INTERNAL_ACTUAL_NET |
+                                     VIR_DOMAIN_XML_INTERNAL_PCI_ORIG_STATES);
+
+    VIR_FREE(statusFile);
+    if (!job->obj)
+        return -1;
+
+    /* Parsed objects are locked, which is left to the thread adding
+     * them to the list */
+    virDomainObjUnlock(job->obj);
+    return 0;
+}
+
+static virDomainObjPtr virDomainLoadStatus(virDomainObjListPtr doms,
+                                           virDomainLoadJobPtr job,
                                            virDomainLoadConfigNotify notify,
                                            void *opaque)
 {
-    char *statusFile = NULL;
-    virDomainObjPtr obj = NULL;
+    virDomainObjPtr obj = job->obj;
     char uuidstr[VIR_UUID_STRING_BUFLEN];
 
-    if ((statusFile = virDomainConfigFile(statusDir, name)) == NULL)
-        goto error;
-
-    if (!(obj = virDomainObjParseFile(caps, statusFile, expectedVirtTypes,
-                                      VIR_DOMAIN_XML_INTERNAL_STATUS |
-                                      VIR_DOMAIN_XML_INTERNAL_ACTUAL_NET |
-                                      VIR_DOMAIN_XML_INTERNAL_PCI_ORIG_STATES)))
-        goto error;
+    job->obj = NULL;
 
+    virDomainObjLock(obj);
     virUUIDFormat(obj->def->uuid, uuidstr);
 
-    if (virHashLookup(doms->objs, uuidstr) != NULL) {
+    if (virHashLookup(doms->objs, uuidstr) != NULL ||
+        virHashLookup(doms->names, obj->def->name) != NULL) {
         virDomainReportError(VIR_ERR_INTERNAL_ERROR,
                              _("unexpected domain %s already exists"),
                              obj->def->name);
         goto error;
     }
 
-    if (virHashAddEntry(doms->objs, uuidstr, obj) < 0)
+    if (virDomainObjListAdd(doms, obj) < 0)
         goto error;
 
     if (notify)
         (*notify)(obj, 1, opaque);
 
-    VIR_FREE(statusFile);
     return obj;
 
 error:
     /* obj was never shared, so unref should return 0 */
-    if (obj)
-        ignore_value(virDomainObjUnref(obj));
-    VIR_FREE(statusFile);
+    ignore_value(virDomainObjUnref(obj));
     return NULL;
 }
 
+static void virDomainLoadParse(virDomainLoadPtr load,
+                               virDomainLoadJobPtr job)
+{
+    VIR_INFO("Loading config file '%s.xml'", job->name);
+
+    /* NB: ignoring errors, so one malformed config doesn't
+       kill the whole process */
+    if (load->liveStatus)
+        ignore_value(virDomainLoadStatusParse(load, job));
+    else
+        ignore_value(virDomainLoadConfigParse(load, job));
+}
+
+static void virDomainLoadWorker(void *jobdata, void *opaque)
+{
+    virDomainLoadPtr load = opaque;
+
+    virDomainLoadParse(load, jobdata);
+
+    virMutexLock(&load->lock);
+    if (--load->pending == 0)
+        virCondSignal(&load->done);
+    virMutexUnlock(&load->lock);
+}
+
+static size_t virDomainLoadWorkers(size_t njobs)
+{
+    long ncpus = 1;
+
+#ifdef _SC_NPROCESSORS_ONLN
+    ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    if (ncpus < 1)
+        ncpus = 1;
+
+    return MIN(njobs, MIN(ncpus, VIR_DOMAIN_LOAD_WORKERS_MAX));
+}
+
+/*
+ * Hand @jobs over to @workers and wait for them to be parsed. Returns
+ * how many of them were handed over.
+ */
+static size_t virDomainLoadSendJobs(virDomainLoadPtr load,
+                                    virThreadPoolPtr workers,
+                                    virDomainLoadJobPtr jobs,
+                                    size_t njobs)
+{
+    size_t i;
+
+    virMutexLock(&load->lock);
+    for (i = 0; i < njobs; i++) {
+        if (virThreadPoolSendJob(workers, 0, &jobs[i]) < 0)
+            break;
+        load->pending++;
+    }
+
+    while (load->pending > 0)
+        ignore_value(virCondWait(&load->done, &load->lock));
+    virMutexUnlock(&load->lock);
+
+    virThreadPoolFree(workers);
+    return i;
+}
+
+/*
+ * Parse the files of @jobs, using a pool of worker threads when there
+ * is more than one file and more than one CPU
+ */
+static void virDomainLoadParseAll(virDomainLoadPtr load,
+                                  virDomainLoadJobPtr jobs,
+                                  size_t njobs)
+{
+    virThreadPoolPtr workers;
+    size_t nworkers = virDomainLoadWorkers(njobs);
+    size_t i = 0;
+
+    /* libxml2 sets itself up on first use, which mustn't be done by
+     * several threads at once */
+    if (nworkers > 1)
+        xmlInitParser();
+
+    if (nworkers > 1 &&
+        virMutexInit(&load->lock) == 0) {
+        if (virCondInit(&load->done) == 0) {
+            if ((workers = virThreadPoolNew(nworkers, nworkers, 0,
+                                            virDomainLoadWorker, load)))
+                i = virDomainLoadSendJobs(load, workers, jobs, njobs);
+            ignore_value(virCondDestroy(&load->done));
+        }
+        virMutexDestroy(&load->lock);
+    }
+
+    /* Whatever couldn't be handed over is parsed right here */
+    for (; i < njobs; i++)
+        virDomainLoadParse(load, &jobs[i]);
+}
+
 int virDomainLoadAllConfigs(virCapsPtr caps,
                             virDomainObjListPtr doms,
                             const char *configDir,
@@ -13056,6 +14456,12 @@ int virDomainLoadAllConfigs(virCapsPtr caps,
 {
     DIR *dir;
     struct dirent *entry;
+    virDomainLoad load;
+    virDomainLoadJobPtr jobs = NULL;
+    size_t njobs = 0;
+    unsigned long long start = 0, now = 0;
+    size_t i;
+    int ret = -1;
 
     VIR_INFO("Scanning for configs in %s", configDir);
 
@@ -13068,35 +14474,42 @@ int virDomainLoadAllConfigs(virCapsPtr caps,
         return -1;
     }
 
-    while ((entry = readdir(dir))) {
-        virDomainObjPtr dom;
+    ignore_value(virTimeMillisNow(&start));
 
+    while ((entry = readdir(dir))) {
         if (entry->d_name[0] == '.')
             continue;
 
         if (!virFileStripSuffix(entry->d_name, ".xml"))
             continue;
 
-        /* NB: ignoring errors, so one malformed config doesn't
-           kill the whole process */
-        VIR_INFO("Loading config file '%s.xml'", entry->d_name);
-        if (liveStatus)
-            dom = virDomainLoadStatus(caps,
-                                      doms,
-                                      configDir,
-                                      entry->d_name,
-                                      expectedVirtTypes,
-                                      notify,
-                                      opaque);
+        if (VIR_EXPAND_N(jobs, njobs, 1) < 0 ||
+            !(jobs[njobs - 1].name = strdup(entry->d_name))) {
+            virReportOOMError();
+            goto cleanup;
+        }
+    }
+
+    memset(&load, 0, sizeof(load));
+    load.caps = caps;
+    load.configDir = configDir;
+    load.autostartDir = autostartDir;
+    load.liveStatus = liveStatus;
+    load.expectedVirtTypes = expectedVirtTypes;
+
+    virDomainLoadParseAll(&load, jobs, njobs);
+
+    /* Add the domains in the order their files were found */
+    for (i = 0; i < njobs; i++) {
+        virDomainObjPtr dom;
+
+        if (jobs[i].obj)
+            dom = virDomainLoadStatus(doms, &jobs[i], notify, opaque);
+        else if (jobs[i].def)
+            dom = virDomainLoadConfig(caps, doms, &jobs[i], notify, opaque);
         else
-            dom = virDomainLoadConfig(caps,
-                                      doms,
-                                      configDir,
-                                      autostartDir,
-                                      entry->d_name,
-                                      expectedVirtTypes,
-                                      notify,
-                                      opaque);
+            continue;
+
         if (dom) {
             virDomainObjUnlock(dom);
             if (!liveStatus)
@@ -13104,9 +14517,22 @@ int virDomainLoadAllConfigs(virCapsPtr caps,
         }
     }
 
-    closedir(dir);
+    ignore_value(virTimeMillisNow(&now));
+    VIR_INFO("Loaded %zu configs from %s in %llums",
+             njobs, configDir, now - start);
 
-    return 0;
+    ret = 0;
+
+cleanup:
+    closedir(dir);
+    for (i = 0; i < njobs; i++) {
+        VIR_FREE(jobs[i].name);
+        virDomainDefFree(jobs[i].def);
+        if (jobs[i].obj)
+            ignore_value(virDomainObjUnref(jobs[i].obj));
+    }
+    VIR_FREE(jobs);
+    return ret;
 }
 
 int virDomainDeleteConfig(const char *configDir,
@@ -14482,19 +15908,12 @@ cleanup:
 virDomainDefPtr
 virDomainObjCopyPersistentDef(virCapsPtr caps, virDomainObjPtr dom)
 {
-    char *xml;
-    virDomainDefPtr cur, ret;
+    virDomainDefPtr cur;
 
-    cur = virDomainObjGetPersistentDef(caps, dom);
-
-    xml = virDomainDefFormat(cur, VIR_DOMAIN_XML_WRITE_FLAGS);
-    if (!xml)
+    if (!(cur = virDomainObjGetPersistentDef(caps, dom)))
         return NULL;
 
-    ret = virDomainDefParseString(caps, xml, -1, VIR_DOMAIN_XML_READ_FLAGS);
-
-    VIR_FREE(xml);
-    return ret;
+    return virDomainDefCopy(cur);
 }
 
 
@@ -835,6 +835,8 @@ struct _virDomainNetDef {
 /* Used for prefix of ifname of any network name generated dynamically
  * by libvirt, and cannot be used for a persistent network name.  */
 # define VIR_NET_GENERATED_PREFIX "vnet"
+/* Likewise for the macvtap devices created for type='direct' */
+# define VIR_NET_GENERATED_MACVTAP_PREFIX "macvtap"
 
 enum virDomainChrDeviceType {
     VIR_DOMAIN_CHR_DEVICE_TYPE_PARALLEL = 0,
@@ -1795,6 +1797,15 @@ struct _virDomainObjList {
     /* uuid string -> virDomainObj  mapping
      * for O(1), lockless lookup-by-uuid */
     virHashTable *objs;
+
+    /* name -> virDomainObj mapping, kept in sync with
+     * 'objs', for O(1), lockless lookup-by-name */
+    virHashTable *names;
+
+    /* id -> virDomainObj mapping of running domains for
+     * O(1) lookup-by-id, kept in sync by drivers changing
+     * IDs through virDomainObjListSetID */
+    virHashTable *ids;
 };
 
 static inline bool
@@ -1806,6 +1817,11 @@ virDomainObjIsActive(virDomainObjPtr dom)
 
 int virDomainObjListInit(virDomainObjListPtr objs);
 void virDomainObjListDeinit(virDomainObjListPtr objs);
+int virDomainObjListAdd(virDomainObjListPtr doms,
+                        virDomainObjPtr obj);
+int virDomainObjListSetID(virDomainObjListPtr doms,
+                          virDomainObjPtr obj,
+                          int id);
 
 virDomainObjPtr virDomainFindByID(const virDomainObjListPtr doms,
                                   int id);
@@ -1864,6 +1880,7 @@ int virDomainDeviceInfoIterate(virDomainDefPtr def,
                                void *opaque);
 
 void virDomainDefFree(virDomainDefPtr vm);
+virDomainDefPtr virDomainDefCopy(virDomainDefPtr src);
 void virDomainObjRef(virDomainObjPtr vm);
 /* Returns 1 if the object was freed, 0 if more refs exist */
 int virDomainObjUnref(virDomainObjPtr vm) ATTRIBUTE_RETURN_CHECK;
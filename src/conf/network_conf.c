@@ -60,33 +60,64 @@ VIR_ENUM_IMPL(virNetworkForward,
 virNetworkObjPtr virNetworkFindByUUID(const virNetworkObjListPtr nets,
                                       const unsigned char *uuid)
 {
-    unsigned int i;
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    virNetworkObjPtr net;
 
-    for (i = 0 ; i < nets->count ; i++) {
-        virNetworkObjLock(nets->objs[i]);
-        if (!memcmp(nets->objs[i]->def->uuid, uuid, VIR_UUID_BUFLEN))
-            return nets->objs[i];
-        virNetworkObjUnlock(nets->objs[i]);
-    }
+    virUUIDFormat(uuid, uuidstr);
+    if ((net = virHashLookup(nets->uuids, uuidstr)))
+        virNetworkObjLock(net);
 
-    return NULL;
+    return net;
 }
 
 virNetworkObjPtr virNetworkFindByName(const virNetworkObjListPtr nets,
                                       const char *name)
 {
-    unsigned int i;
+    virNetworkObjPtr net;
 
-    for (i = 0 ; i < nets->count ; i++) {
-        virNetworkObjLock(nets->objs[i]);
-        if (STREQ(nets->objs[i]->def->name, name))
-            return nets->objs[i];
-        virNetworkObjUnlock(nets->objs[i]);
+    if ((net = virHashLookup(nets->names, name)))
+        virNetworkObjLock(net);
+
+    return net;
+}
+
+/*
+ * Add @net to the indexes of @nets. The name and UUID of a network
+ * never change once it's in the list, which is enforced by the drivers
+ * rejecting definitions which only match one of them.
+ */
+static int virNetworkObjListIndex(virNetworkObjListPtr nets,
+                                  virNetworkObjPtr net)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+    if (!nets->uuids && !(nets->uuids = virHashCreate(50, NULL)))
+        return -1;
+    if (!nets->names && !(nets->names = virHashCreate(50, NULL)))
+        return -1;
+
+    virUUIDFormat(net->def->uuid, uuidstr);
+    if (virHashAddEntry(nets->uuids, uuidstr, net) < 0)
+        return -1;
+    if (virHashAddEntry(nets->names, net->def->name, net) < 0) {
+        virHashRemoveEntry(nets->uuids, uuidstr);
+        return -1;
     }
 
-    return NULL;
+    return 0;
 }
 
+static void virNetworkObjListUnindex(virNetworkObjListPtr nets,
+                                     virNetworkObjPtr net)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+    virUUIDFormat(net->def->uuid, uuidstr);
+    if (virHashLookup(nets->uuids, uuidstr) == net)
+        virHashRemoveEntry(nets->uuids, uuidstr);
+    if (virHashLookup(nets->names, net->def->name) == net)
+        virHashRemoveEntry(nets->names, net->def->name);
+}
 
 static void
 virPortGroupDefClear(virPortGroupDefPtr def)
@@ -213,6 +244,11 @@ void virNetworkObjListFree(virNetworkObjListPtr nets)
 
     VIR_FREE(nets->objs);
     nets->count = 0;
+
+    /* The indexes do not own the objects */
+    virHashFree(nets->uuids);
+    virHashFree(nets->names);
+    nets->uuids = nets->names = NULL;
 }
 
 virNetworkObjPtr virNetworkAssignDef(virNetworkObjListPtr nets,
@@ -251,6 +287,11 @@ virNetworkObjPtr virNetworkAssignDef(virNetworkObjListPtr nets,
         return NULL;
     }
 
+    if (virNetworkObjListIndex(nets, network) < 0) {
+        VIR_FREE(network);
+        return NULL;
+    }
+
     nets->objs[nets->count] = network;
     nets->count++;
 
@@ -265,9 +306,8 @@ void virNetworkRemoveInactive(virNetworkObjListPtr nets,
 
     virNetworkObjUnlock(net);
     for (i = 0 ; i < nets->count ; i++) {
-        virNetworkObjLock(nets->objs[i]);
         if (nets->objs[i] == net) {
-            virNetworkObjUnlock(nets->objs[i]);
+            virNetworkObjListUnindex(nets, net);
             virNetworkObjFree(nets->objs[i]);
 
             if (i < (nets->count - 1))
@@ -281,7 +321,6 @@ void virNetworkRemoveInactive(virNetworkObjListPtr nets,
 
             break;
         }
-        virNetworkObjUnlock(nets->objs[i]);
     }
 }
 
@@ -32,6 +32,7 @@
 
 # include "internal.h"
 # include "threads.h"
+# include "virhash.h"
 # include "virsocketaddr.h"
 # include "virnetdevbandwidth.h"
 # include "virnetdevvportprofile.h"
@@ -199,6 +200,11 @@ typedef virNetworkObjList *virNetworkObjListPtr;
 struct _virNetworkObjList {
     unsigned int count;
     virNetworkObjPtr *objs;
+
+    /* uuid string -> virNetworkObj and name -> virNetworkObj
+     * mappings, kept in sync with 'objs' for O(1) lookups */
+    virHashTablePtr uuids;
+    virHashTablePtr names;
 };
 
 static inline int
@@ -38,6 +38,8 @@
 #include "uuid.h"
 #include "pci.h"
 #include "virrandom.h"
+#include "logging.h"
+#include "ignore-value.h"
 
 #define VIR_FROM_THIS VIR_FROM_NODEDEV
 
@@ -91,37 +93,71 @@ virNodeDeviceObjPtr
 virNodeDeviceFindBySysfsPath(const virNodeDeviceObjListPtr devs,
                              const char *sysfs_path)
 {
-    unsigned int i;
+    virNodeDeviceObjPtr dev;
 
-    for (i = 0; i < devs->count; i++) {
-        virNodeDeviceObjLock(devs->objs[i]);
-        if ((devs->objs[i]->def->sysfs_path != NULL) &&
-            (STREQ(devs->objs[i]->def->sysfs_path, sysfs_path))) {
-            return devs->objs[i];
-        }
-        virNodeDeviceObjUnlock(devs->objs[i]);
-    }
+    if ((dev = virHashLookup(devs->sysfsPaths, sysfs_path)))
+        virNodeDeviceObjLock(dev);
 
-    return NULL;
+    return dev;
 }
 
 
 virNodeDeviceObjPtr virNodeDeviceFindByName(const virNodeDeviceObjListPtr devs,
                                             const char *name)
 {
+    virNodeDeviceObjPtr dev;
+
+    if ((dev = virHashLookup(devs->names, name)))
+        virNodeDeviceObjLock(dev);
+
+    return dev;
+}
+
+
+/*
+ * Index @dev by its sysfs path, unless another device has the same
+ * one: the first one wins, as it would with a linear search
+ */
+static int virNodeDeviceObjListIndexSysfsPath(virNodeDeviceObjListPtr devs,
+                                              virNodeDeviceObjPtr dev)
+{
+    const char *path = dev->def->sysfs_path;
+
+    if (!path)
+        return 0;
+
+    if (!devs->sysfsPaths && !(devs->sysfsPaths = virHashCreate(50, NULL)))
+        return -1;
+
+    if (virHashLookup(devs->sysfsPaths, path))
+        return 0;
+
+    return virHashAddEntry(devs->sysfsPaths, path, dev);
+}
+
+static void virNodeDeviceObjListUnindexSysfsPath(virNodeDeviceObjListPtr devs,
+                                                 virNodeDeviceObjPtr dev)
+{
+    const char *path = dev->def->sysfs_path;
     unsigned int i;
 
+    if (!path || virHashLookup(devs->sysfsPaths, path) != dev)
+        return;
+
+    virHashRemoveEntry(devs->sysfsPaths, path);
+
+    /* Let another device with the same path take over, failing
+     * to do so only hides it from lookups */
     for (i = 0; i < devs->count; i++) {
-        virNodeDeviceObjLock(devs->objs[i]);
-        if (STREQ(devs->objs[i]->def->name, name))
-            return devs->objs[i];
-        virNodeDeviceObjUnlock(devs->objs[i]);
+        if (devs->objs[i] != dev &&
+            STREQ_NULLABLE(devs->objs[i]->def->sysfs_path, path)) {
+            ignore_value(virNodeDeviceObjListIndexSysfsPath(devs,
+                                                            devs->objs[i]));
+            break;
+        }
     }
-
-    return NULL;
 }
 
-
 void virNodeDeviceDefFree(virNodeDeviceDefPtr def)
 {
     virNodeDevCapsDefPtr caps;
@@ -166,6 +202,11 @@ void virNodeDeviceObjListFree(virNodeDeviceObjListPtr devs)
         virNodeDeviceObjFree(devs->objs[i]);
     VIR_FREE(devs->objs);
     devs->count = 0;
+
+    /* The indexes do not own the objects */
+    virHashFree(devs->names);
+    virHashFree(devs->sysfsPaths);
+    devs->names = devs->sysfsPaths = NULL;
 }
 
 virNodeDeviceObjPtr virNodeDeviceAssignDef(virNodeDeviceObjListPtr devs,
@@ -174,8 +215,13 @@ virNodeDeviceObjPtr virNodeDeviceAssignDef(virNodeDeviceObjListPtr devs,
     virNodeDeviceObjPtr device;
 
     if ((device = virNodeDeviceFindByName(devs, def->name))) {
+        /* The sysfs path may differ in the new definition */
+        virNodeDeviceObjListUnindexSysfsPath(devs, device);
         virNodeDeviceDefFree(device->def);
         device->def = def;
+        if (virNodeDeviceObjListIndexSysfsPath(devs, device) < 0)
+            VIR_WARN("Failed to index device %s by its sysfs path",
+                     def->name);
         return device;
     }
 
@@ -200,6 +246,17 @@ virNodeDeviceObjPtr virNodeDeviceAssignDef(virNodeDeviceObjListPtr devs,
         virReportOOMError();
         return NULL;
     }
+
+    if ((!devs->names && !(devs->names = virHashCreate(50, NULL))) ||
+        virHashAddEntry(devs->names, def->name, device) < 0 ||
+        virNodeDeviceObjListIndexSysfsPath(devs, device) < 0) {
+        if (virHashLookup(devs->names, def->name) == device)
+            virHashRemoveEntry(devs->names, def->name);
+        device->def = NULL;
+        virNodeDeviceObjUnlock(device);
+        virNodeDeviceObjFree(device);
+        return NULL;
+    }
     devs->objs[devs->count++] = device;
 
     return device;
@@ -214,9 +271,10 @@ void virNodeDeviceObjRemove(virNodeDeviceObjListPtr devs,
     virNodeDeviceObjUnlock(dev);
 
     for (i = 0; i < devs->count; i++) {
-        virNodeDeviceObjLock(dev);
         if (devs->objs[i] == dev) {
-            virNodeDeviceObjUnlock(dev);
+            if (virHashLookup(devs->names, dev->def->name) == dev)
+                virHashRemoveEntry(devs->names, dev->def->name);
+            virNodeDeviceObjListUnindexSysfsPath(devs, dev);
             virNodeDeviceObjFree(devs->objs[i]);
 
             if (i < (devs->count - 1))
@@ -230,7 +288,6 @@ void virNodeDeviceObjRemove(virNodeDeviceObjListPtr devs,
 
             break;
         }
-        virNodeDeviceObjUnlock(dev);
     }
 }
 
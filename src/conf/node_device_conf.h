@@ -28,6 +28,7 @@
 # include "internal.h"
 # include "util.h"
 # include "threads.h"
+# include "virhash.h"
 
 # include <libxml/tree.h>
 
@@ -201,6 +202,11 @@ typedef virNodeDeviceObjList *virNodeDeviceObjListPtr;
 struct _virNodeDeviceObjList {
     unsigned int count;
     virNodeDeviceObjPtr *objs;
+
+    /* name -> virNodeDeviceObj and sysfs path -> virNodeDeviceObj
+     * mappings, kept in sync with 'objs' for O(1) lookups */
+    virHashTablePtr names;
+    virHashTablePtr sysfsPaths;
 };
 
 typedef struct _virDeviceMonitorState virDeviceMonitorState;
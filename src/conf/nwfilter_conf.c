@@ -47,6 +47,7 @@
 #include "domain_conf.h"
 #include "c-ctype.h"
 #include "virfile.h"
+#include "logging.h"
 
 
 #define VIR_FROM_THIS VIR_FROM_NWFILTER
@@ -349,6 +350,82 @@ virNWFilterObjListFree(virNWFilterObjListPtr nwfilters)
         virNWFilterObjFree(nwfilters->objs[i]);
     VIR_FREE(nwfilters->objs);
     nwfilters->count = 0;
+
+    /* The indexes do not own the objects */
+    virHashFree(nwfilters->uuids);
+    virHashFree(nwfilters->names);
+    nwfilters->uuids = nwfilters->names = NULL;
+}
+
+
+/*
+ * Add @nwfilter to the indexes of @nwfilters. The name of a filter never
+ * changes once it's in the list, but its UUID may when it is redefined,
+ * so the UUID index has to be updated along with the definition.
+ */
+static int
+virNWFilterObjListIndexUUID(virNWFilterObjListPtr nwfilters,
+                            virNWFilterObjPtr nwfilter)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+    if (!nwfilters->uuids && !(nwfilters->uuids = virHashCreate(50, NULL)))
+        return -1;
+
+    virUUIDFormat(nwfilter->def->uuid, uuidstr);
+    return virHashUpdateEntry(nwfilters->uuids, uuidstr, nwfilter);
+}
+
+static void
+virNWFilterObjListUnindexUUID(virNWFilterObjListPtr nwfilters,
+                              virNWFilterObjPtr nwfilter)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+    virUUIDFormat(nwfilter->def->uuid, uuidstr);
+    if (virHashLookup(nwfilters->uuids, uuidstr) == nwfilter)
+        virHashRemoveEntry(nwfilters->uuids, uuidstr);
+}
+
+static int
+virNWFilterObjListIndex(virNWFilterObjListPtr nwfilters,
+                        virNWFilterObjPtr nwfilter)
+{
+    if (!nwfilters->names && !(nwfilters->names = virHashCreate(50, NULL)))
+        return -1;
+
+    if (virHashAddEntry(nwfilters->names, nwfilter->def->name, nwfilter) < 0)
+        return -1;
+    if (virNWFilterObjListIndexUUID(nwfilters, nwfilter) < 0) {
+        virHashRemoveEntry(nwfilters->names, nwfilter->def->name);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+virNWFilterObjListUnindex(virNWFilterObjListPtr nwfilters,
+                          virNWFilterObjPtr nwfilter)
+{
+    virNWFilterObjListUnindexUUID(nwfilters, nwfilter);
+    if (virHashLookup(nwfilters->names, nwfilter->def->name) == nwfilter)
+        virHashRemoveEntry(nwfilters->names, nwfilter->def->name);
+}
+
+/*
+ * Replace the definition of @nwfilter by @def, which has the same name
+ */
+static void
+virNWFilterObjReplaceDef(virNWFilterObjListPtr nwfilters,
+                         virNWFilterObjPtr nwfilter,
+                         virNWFilterDefPtr def)
+{
+    virNWFilterObjListUnindexUUID(nwfilters, nwfilter);
+    virNWFilterDefFree(nwfilter->def);
+    nwfilter->def = def;
+    if (virNWFilterObjListIndexUUID(nwfilters, nwfilter) < 0)
+        VIR_WARN("Failed to index filter %s by its UUID", def->name);
 }
 
 
@@ -417,9 +494,8 @@ virNWFilterObjRemove(virNWFilterObjListPtr nwfilters,
     virNWFilterObjUnlock(nwfilter);
 
     for (i = 0 ; i < nwfilters->count ; i++) {
-        virNWFilterObjLock(nwfilters->objs[i]);
         if (nwfilters->objs[i] == nwfilter) {
-            virNWFilterObjUnlock(nwfilters->objs[i]);
+            virNWFilterObjListUnindex(nwfilters, nwfilter);
             virNWFilterObjFree(nwfilters->objs[i]);
 
             if (i < (nwfilters->count - 1))
@@ -433,7 +509,6 @@ virNWFilterObjRemove(virNWFilterObjListPtr nwfilters,
 
             break;
         }
-        virNWFilterObjUnlock(nwfilters->objs[i]);
     }
 }
 
@@ -2558,32 +2633,26 @@ virNWFilterObjPtr
 virNWFilterObjFindByUUID(virNWFilterObjListPtr nwfilters,
                          const unsigned char *uuid)
 {
-    unsigned int i;
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    virNWFilterObjPtr nwfilter;
 
-    for (i = 0 ; i < nwfilters->count ; i++) {
-        virNWFilterObjLock(nwfilters->objs[i]);
-        if (!memcmp(nwfilters->objs[i]->def->uuid, uuid, VIR_UUID_BUFLEN))
-            return nwfilters->objs[i];
-        virNWFilterObjUnlock(nwfilters->objs[i]);
-    }
+    virUUIDFormat(uuid, uuidstr);
+    if ((nwfilter = virHashLookup(nwfilters->uuids, uuidstr)))
+        virNWFilterObjLock(nwfilter);
 
-    return NULL;
+    return nwfilter;
 }
 
 
 virNWFilterObjPtr
 virNWFilterObjFindByName(virNWFilterObjListPtr nwfilters, const char *name)
 {
-    unsigned int i;
+    virNWFilterObjPtr nwfilter;
 
-    for (i = 0 ; i < nwfilters->count ; i++) {
-        virNWFilterObjLock(nwfilters->objs[i]);
-        if (STREQ(nwfilters->objs[i]->def->name, name))
-            return nwfilters->objs[i];
-        virNWFilterObjUnlock(nwfilters->objs[i]);
-    }
+    if ((nwfilter = virHashLookup(nwfilters->names, name)))
+        virNWFilterObjLock(nwfilter);
 
-    return NULL;
+    return nwfilter;
 }
 
 
@@ -2690,6 +2759,91 @@ virNWFilterDefLoopDetect(virConnectPtr conn,
     return _virNWFilterDefLoopDetect(conn, nwfilters, def, def->name);
 }
 
+
+/*
+ * virNWFilterObjListFindReferrers:
+ * @nwfilters : the nwfilters to search
+ * @filtername : name of the filter that is about to change
+ *
+ * Collect the names of all filters referencing the given filter, either
+ * directly or through other filters, along with the name of the filter
+ * itself. Only interfaces using one of these filters are affected by a
+ * change of the filter.
+ *
+ * Returns a hash table with the filter names as keys, NULL on error.
+ */
+static virHashTablePtr
+virNWFilterObjListFindReferrers(virNWFilterObjListPtr nwfilters,
+                                const char *filtername)
+{
+    virHashTablePtr referrers;
+    virNWFilterObjPtr obj;
+    virNWFilterIncludeDefPtr inc;
+    bool added = true;
+    unsigned int i;
+    int j;
+
+    if (!(referrers = virHashCreate(0, NULL)))
+        return NULL;
+
+    if (virHashAddEntry(referrers, filtername, (void *)~0) < 0)
+        goto error;
+
+    /* filters are rarely nested more than a few levels deep, so keep
+       adding the filters referencing any of those found so far until
+       nothing changes anymore */
+    while (added) {
+        added = false;
+
+        for (i = 0; i < nwfilters->count; i++) {
+            obj = nwfilters->objs[i];
+            virNWFilterObjLock(obj);
+
+            if (virHashLookup(referrers, obj->def->name)) {
+                virNWFilterObjUnlock(obj);
+                continue;
+            }
+
+            for (j = 0; j < obj->def->nentries; j++) {
+                inc = obj->def->filterEntries[j]->include;
+                if (!inc || !virHashLookup(referrers, inc->filterref))
+                    continue;
+
+                if (virHashAddEntry(referrers, obj->def->name,
+                                    (void *)~0) < 0) {
+                    virNWFilterObjUnlock(obj);
+                    goto error;
+                }
+                added = true;
+                break;
+            }
+
+            virNWFilterObjUnlock(obj);
+        }
+    }
+
+    return referrers;
+
+error:
+    virHashFree(referrers);
+    return NULL;
+}
+
+/*
+ * virNWFilterUpdateAffects:
+ * @cb : the update in progress
+ * @filtername : name of the filter an interface uses
+ *
+ * Returns true if the interface using the given filter is to be updated,
+ * false if it doesn't reference the changed filter in any way.
+ */
+bool
+virNWFilterUpdateAffects(const struct domUpdateCBStruct *cb,
+                         const char *filtername)
+{
+    return !cb->filters || virHashLookup(cb->filters, filtername) != NULL;
+}
+
 int nCallbackDriver;
 #define MAX_CALLBACK_DRIVER 10
 static virNWFilterCallbackDriverPtr callbackDrvArray[MAX_CALLBACK_DRIVER];
@@ -2737,6 +2891,7 @@ virNWFilterInstFiltersOnAllVMs(virConnectPtr conn)
         .err = 0, /* ignored here */
         .step = STEP_APPLY_CURRENT,
         .skipInterfaces = NULL, /* not needed */
+        .filters = NULL, /* all of them */
     };
 
     for (i = 0; i < nCallbackDriver; i++)
@@ -2747,8 +2902,15 @@ virNWFilterInstFiltersOnAllVMs(virConnectPtr conn)
     return 0;
 }
 
+/*
+ * Rebuild the filters of the interfaces of all running VMs affected by
+ * a change of the filter with the given name; the interfaces using
+ * unrelated filters are left alone.
+ */
 static int
-virNWFilterTriggerVMFilterRebuild(virConnectPtr conn)
+virNWFilterTriggerVMFilterRebuild(virConnectPtr conn,
+                                  virNWFilterObjListPtr nwfilters,
+                                  const char *filtername)
 {
     int i;
     int err;
@@ -2757,10 +2919,14 @@ virNWFilterTriggerVMFilterRebuild(virConnectPtr conn)
         .err = 0,
         .step = STEP_APPLY_NEW,
         .skipInterfaces = virHashCreate(0, NULL),
+        .filters = virNWFilterObjListFindReferrers(nwfilters, filtername),
     };
 
-    if (!cb.skipInterfaces)
+    if (!cb.skipInterfaces || !cb.filters) {
+        virHashFree(cb.skipInterfaces);
+        virHashFree(cb.filters);
         return -1;
+    }
 
     for (i = 0; i < nCallbackDriver; i++) {
         callbackDrvArray[i]->vmFilterRebuild(conn,
@@ -2788,6 +2954,7 @@ virNWFilterTriggerVMFilterRebuild(virConnectPtr conn)
     }
 
     virHashFree(cb.skipInterfaces);
+    virHashFree(cb.filters);
 
     return err;
 }
@@ -2795,13 +2962,15 @@ virNWFilterTriggerVMFilterRebuild(virConnectPtr conn)
 
 int
 virNWFilterTestUnassignDef(virConnectPtr conn,
+                           virNWFilterObjListPtr nwfilters,
                            virNWFilterObjPtr nwfilter)
 {
     int rc = 0;
 
     nwfilter->wantRemoved = 1;
     /* trigger the update on VMs referencing the filter */
-    if (virNWFilterTriggerVMFilterRebuild(conn))
+    if (virNWFilterTriggerVMFilterRebuild(conn, nwfilters,
+                                          nwfilter->def->name))
         rc = -1;
 
     nwfilter->wantRemoved = 0;
@@ -2871,23 +3040,21 @@ virNWFilterObjAssignDef(virConnectPtr conn,
     if ((nwfilter = virNWFilterObjFindByName(nwfilters, def->name))) {
 
         if (virNWFilterDefEqual(def, nwfilter->def, false)) {
-            virNWFilterDefFree(nwfilter->def);
-            nwfilter->def = def;
+            virNWFilterObjReplaceDef(nwfilters, nwfilter, def);
             virNWFilterUnlockFilterUpdates();
             return nwfilter;
         }
 
         nwfilter->newDef = def;
         /* trigger the update on VMs referencing the filter */
-        if (virNWFilterTriggerVMFilterRebuild(conn)) {
+        if (virNWFilterTriggerVMFilterRebuild(conn, nwfilters, def->name)) {
             nwfilter->newDef = NULL;
             virNWFilterUnlockFilterUpdates();
             virNWFilterObjUnlock(nwfilter);
             return NULL;
         }
 
-        virNWFilterDefFree(nwfilter->def);
-        nwfilter->def = def;
+        virNWFilterObjReplaceDef(nwfilters, nwfilter, def);
         nwfilter->newDef = NULL;
         virNWFilterUnlockFilterUpdates();
         return nwfilter;
@@ -2917,6 +3084,13 @@ virNWFilterObjAssignDef(virConnectPtr conn,
         virReportOOMError();
         return NULL;
     }
+
+    if (virNWFilterObjListIndex(nwfilters, nwfilter) < 0) {
+        nwfilter->def = NULL;
+        virNWFilterObjUnlock(nwfilter);
+        virNWFilterObjFree(nwfilter);
+        return NULL;
+    }
     nwfilters->objs[nwfilters->count++] = nwfilter;
 
     return nwfilter;
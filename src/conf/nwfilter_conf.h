@@ -546,6 +546,11 @@ typedef virNWFilterObjList *virNWFilterObjListPtr;
 struct _virNWFilterObjList {
     unsigned int count;
     virNWFilterObjPtr *objs;
+
+    /* uuid string -> virNWFilterObj and name -> virNWFilterObj
+     * mappings, kept in sync with 'objs' for O(1) lookups */
+    virHashTablePtr uuids;
+    virHashTablePtr names;
 };
 
 
@@ -585,8 +590,12 @@ struct domUpdateCBStruct {
     enum UpdateStep step;
     int err;
     virHashTablePtr skipInterfaces;
+    virHashTablePtr filters; /* names of the filters to update, NULL: all */
 };
 
+bool virNWFilterUpdateAffects(const struct domUpdateCBStruct *cb,
+                              const char *filtername);
+
 
 typedef int (*virNWFilterTechDrvInit)(bool privileged);
 typedef void (*virNWFilterTechDrvShutdown)(void);
@@ -688,6 +697,7 @@ virNWFilterObjPtr virNWFilterObjAssignDef(virConnectPtr conn,
                                           virNWFilterDefPtr def);
 
 int virNWFilterTestUnassignDef(virConnectPtr conn,
+                               virNWFilterObjListPtr nwfilters,
                                virNWFilterObjPtr nwfilter);
 
 virNWFilterDefPtr virNWFilterDefParseNode(xmlDocPtr xml,
@@ -44,6 +44,7 @@
 #include "util.h"
 #include "memory.h"
 #include "virfile.h"
+#include "ignore-value.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -345,6 +346,9 @@ virStoragePoolObjFree(virStoragePoolObjPtr obj) {
 
     virStoragePoolObjClearVols(obj);
 
+    if (obj->privateFree)
+        (*obj->privateFree)(obj->privateData);
+
     virStoragePoolDefFree(obj->def);
     virStoragePoolDefFree(obj->newDef);
 
@@ -363,6 +367,51 @@ void virStoragePoolObjListFree(virStoragePoolObjListPtr pools)
         virStoragePoolObjFree(pools->objs[i]);
     VIR_FREE(pools->objs);
     pools->count = 0;
+
+    /* The indexes do not own the objects */
+    virHashFree(pools->uuids);
+    virHashFree(pools->names);
+    pools->uuids = pools->names = NULL;
+}
+
+/*
+ * Add @pool to the indexes of @pools. The name and UUID of a pool
+ * never change once it's in the list, which is enforced by the driver
+ * rejecting definitions which only match one of them.
+ */
+static int
+virStoragePoolObjListIndex(virStoragePoolObjListPtr pools,
+                           virStoragePoolObjPtr pool)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+    if (!pools->uuids && !(pools->uuids = virHashCreate(50, NULL)))
+        return -1;
+    if (!pools->names && !(pools->names = virHashCreate(50, NULL)))
+        return -1;
+
+    virUUIDFormat(pool->def->uuid, uuidstr);
+    if (virHashAddEntry(pools->uuids, uuidstr, pool) < 0)
+        return -1;
+    if (virHashAddEntry(pools->names, pool->def->name, pool) < 0) {
+        virHashRemoveEntry(pools->uuids, uuidstr);
+        return -1;
+    }
+
+    return 0;
+}
+
+static void
+virStoragePoolObjListUnindex(virStoragePoolObjListPtr pools,
+                             virStoragePoolObjPtr pool)
+{
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+
+    virUUIDFormat(pool->def->uuid, uuidstr);
+    if (virHashLookup(pools->uuids, uuidstr) == pool)
+        virHashRemoveEntry(pools->uuids, uuidstr);
+    if (virHashLookup(pools->names, pool->def->name) == pool)
+        virHashRemoveEntry(pools->names, pool->def->name);
 }
 
 void
@@ -374,9 +423,8 @@ virStoragePoolObjRemove(virStoragePoolObjListPtr pools,
     virStoragePoolObjUnlock(pool);
 
     for (i = 0 ; i < pools->count ; i++) {
-        virStoragePoolObjLock(pools->objs[i]);
         if (pools->objs[i] == pool) {
-            virStoragePoolObjUnlock(pools->objs[i]);
+            virStoragePoolObjListUnindex(pools, pool);
             virStoragePoolObjFree(pools->objs[i]);
 
             if (i < (pools->count - 1))
@@ -390,7 +438,6 @@ virStoragePoolObjRemove(virStoragePoolObjListPtr pools,
 
             break;
         }
-        virStoragePoolObjUnlock(pools->objs[i]);
     }
 }
 
@@ -1353,31 +1400,25 @@ virStorageVolDefFormat(virStoragePoolDefPtr pool,
 virStoragePoolObjPtr
 virStoragePoolObjFindByUUID(virStoragePoolObjListPtr pools,
                             const unsigned char *uuid) {
-    unsigned int i;
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
+    virStoragePoolObjPtr pool;
 
-    for (i = 0 ; i < pools->count ; i++) {
-        virStoragePoolObjLock(pools->objs[i]);
-        if (!memcmp(pools->objs[i]->def->uuid, uuid, VIR_UUID_BUFLEN))
-            return pools->objs[i];
-        virStoragePoolObjUnlock(pools->objs[i]);
-    }
+    virUUIDFormat(uuid, uuidstr);
+    if ((pool = virHashLookup(pools->uuids, uuidstr)))
+        virStoragePoolObjLock(pool);
 
-    return NULL;
+    return pool;
 }
 
 virStoragePoolObjPtr
 virStoragePoolObjFindByName(virStoragePoolObjListPtr pools,
                             const char *name) {
-    unsigned int i;
+    virStoragePoolObjPtr pool;
 
-    for (i = 0 ; i < pools->count ; i++) {
-        virStoragePoolObjLock(pools->objs[i]);
-        if (STREQ(pools->objs[i]->def->name, name))
-            return pools->objs[i];
-        virStoragePoolObjUnlock(pools->objs[i]);
-    }
+    if ((pool = virHashLookup(pools->names, name)))
+        virStoragePoolObjLock(pool);
 
-    return NULL;
+    return pool;
 }
 
 virStoragePoolObjPtr
@@ -1404,42 +1445,149 @@ virStoragePoolObjClearVols(virStoragePoolObjPtr pool)
 
     VIR_FREE(pool->volumes.objs);
     pool->volumes.count = 0;
+
+    virHashFree(pool->volumes.names);
+    virHashFree(pool->volumes.keys);
+    virHashFree(pool->volumes.paths);
+    pool->volumes.names = pool->volumes.keys = pool->volumes.paths = NULL;
 }
 
-virStorageVolDefPtr
-virStorageVolDefFindByKey(virStoragePoolObjPtr pool,
-                          const char *key) {
+/*
+ * Index @vol by @name in @table, unless another volume has the
+ * same name: the first one wins, as it would with a linear search
+ */
+static int
+virStorageVolDefListIndex(virHashTablePtr *table,
+                          const char *name,
+                          virStorageVolDefPtr vol)
+{
+    if (!name)
+        return 0;
+
+    if (!*table && !(*table = virHashCreate(50, NULL)))
+        return -1;
+
+    if (virHashLookup(*table, name))
+        return 0;
+
+    return virHashAddEntry(*table, name, vol);
+}
+
+static bool
+virStorageVolDefListUnindex(virHashTablePtr table,
+                            const char *name,
+                            virStorageVolDefPtr vol)
+{
+    if (!name || virHashLookup(table, name) != vol)
+        return false;
+
+    virHashRemoveEntry(table, name);
+    return true;
+}
+
+/**
+ * virStoragePoolObjAddVol:
+ * @pool: the pool object
+ * @vol: the volume definition
+ *
+ * Append @vol to the volumes of @pool. The name, key and path of
+ * the volume must not change as long as it's in the pool.
+ *
+ * Returns 0 on success, -1 with an error reported otherwise.
+ */
+int
+virStoragePoolObjAddVol(virStoragePoolObjPtr pool,
+                        virStorageVolDefPtr vol)
+{
+    virStorageVolDefListPtr vols = &pool->volumes;
+
+    if (VIR_REALLOC_N(vols->objs, vols->count + 1) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (virStorageVolDefListIndex(&vols->names, vol->name, vol) < 0 ||
+        virStorageVolDefListIndex(&vols->keys, vol->key, vol) < 0 ||
+        virStorageVolDefListIndex(&vols->paths, vol->target.path, vol) < 0) {
+        virStorageVolDefListUnindex(vols->names, vol->name, vol);
+        virStorageVolDefListUnindex(vols->keys, vol->key, vol);
+        virStorageVolDefListUnindex(vols->paths, vol->target.path, vol);
+        return -1;
+    }
+
+    vols->objs[vols->count++] = vol;
+    return 0;
+}
+
+/**
+ * virStoragePoolObjRemoveVol:
+ * @pool: the pool object
+ * @vol: the volume definition
+ *
+ * Remove @vol from the volumes of @pool, without freeing it.
+ */
+void
+virStoragePoolObjRemoveVol(virStoragePoolObjPtr pool,
+                           virStorageVolDefPtr vol)
+{
+    virStorageVolDefListPtr vols = &pool->volumes;
+    bool name, key, path;
     unsigned int i;
 
-    for (i = 0 ; i < pool->volumes.count ; i++)
-        if (STREQ(pool->volumes.objs[i]->key, key))
-            return pool->volumes.objs[i];
+    for (i = 0 ; i < vols->count ; i++) {
+        if (vols->objs[i] == vol)
+            break;
+    }
+    if (i == vols->count)
+        return;
 
-    return NULL;
+    if (i < (vols->count - 1))
+        memmove(vols->objs + i, vols->objs + i + 1,
+                sizeof(*(vols->objs)) * (vols->count - (i + 1)));
+
+    if (VIR_REALLOC_N(vols->objs, vols->count - 1) < 0) {
+        ; /* Failure to reduce memory allocation isn't fatal */
+    }
+    vols->count--;
+
+    name = virStorageVolDefListUnindex(vols->names, vol->name, vol);
+    key = virStorageVolDefListUnindex(vols->keys, vol->key, vol);
+    path = virStorageVolDefListUnindex(vols->paths, vol->target.path, vol);
+
+    /* Let another volume with the same key or path take over, failing
+     * to do so only hides it from lookups */
+    for (i = 0 ; (name || key || path) && i < vols->count ; i++) {
+        virStorageVolDefPtr other = vols->objs[i];
+
+        if (name && STREQ(other->name, vol->name))
+            ignore_value(virStorageVolDefListIndex(&vols->names,
+                                                   other->name, other));
+        if (key && STREQ_NULLABLE(other->key, vol->key))
+            ignore_value(virStorageVolDefListIndex(&vols->keys,
+                                                   other->key, other));
+        if (path && STREQ_NULLABLE(other->target.path, vol->target.path))
+            ignore_value(virStorageVolDefListIndex(&vols->paths,
+                                                   other->target.path,
+                                                   other));
+    }
+}
+
+virStorageVolDefPtr
+virStorageVolDefFindByKey(virStoragePoolObjPtr pool,
+                          const char *key) {
+    return virHashLookup(pool->volumes.keys, key);
 }
 
 virStorageVolDefPtr
 virStorageVolDefFindByPath(virStoragePoolObjPtr pool,
                            const char *path) {
-    unsigned int i;
-
-    for (i = 0 ; i < pool->volumes.count ; i++)
-        if (STREQ(pool->volumes.objs[i]->target.path, path))
-            return pool->volumes.objs[i];
-
-    return NULL;
+    return virHashLookup(pool->volumes.paths, path);
 }
 
 virStorageVolDefPtr
 virStorageVolDefFindByName(virStoragePoolObjPtr pool,
                            const char *name) {
-    unsigned int i;
-
-    for (i = 0 ; i < pool->volumes.count ; i++)
-        if (STREQ(pool->volumes.objs[i]->name, name))
-            return pool->volumes.objs[i];
-
-    return NULL;
+    return virHashLookup(pool->volumes.names, name);
 }
 
 virStoragePoolObjPtr
@@ -1480,6 +1628,13 @@ virStoragePoolObjAssignDef(virStoragePoolObjListPtr pools,
         virReportOOMError();
         return NULL;
     }
+
+    if (virStoragePoolObjListIndex(pools, pool) < 0) {
+        pool->def = NULL;
+        virStoragePoolObjUnlock(pool);
+        virStoragePoolObjFree(pool);
+        return NULL;
+    }
     pools->objs[pools->count++] = pool;
 
     return pool;
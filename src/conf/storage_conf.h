@@ -28,6 +28,7 @@
 # include "util.h"
 # include "storage_encryption_conf.h"
 # include "threads.h"
+# include "virhash.h"
 
 # include <libxml/tree.h>
 
@@ -91,6 +92,9 @@ struct _virStorageVolDef {
     int type; /* virStorageVolType enum */
 
     unsigned int building;
+    unsigned int wiping;
+    unsigned long long wipeProcessed; /* bytes, while wiping */
+    unsigned long long wipeTotal; /* bytes, 0 if not known */
 
     unsigned long long allocation; /* bytes */
     unsigned long long capacity; /* bytes */
@@ -105,6 +109,13 @@ typedef virStorageVolDefList *virStorageVolDefListPtr;
 struct _virStorageVolDefList {
     unsigned int count;
     virStorageVolDefPtr *objs;
+
+    /* name, key and path -> virStorageVolDef mappings, kept
+     * in sync with 'objs' for O(1) lookups. Volumes without
+     * a key or path are left out of the respective index. */
+    virHashTablePtr names;
+    virHashTablePtr keys;
+    virHashTablePtr paths;
 };
 
 
@@ -299,6 +310,9 @@ struct _virStoragePoolObj {
     virStoragePoolDefPtr newDef;
 
     virStorageVolDefList volumes;
+
+    void *privateData;                  /* backend-specific private data */
+    void (*privateFree)(void *data);    /* destructor for private data */
 };
 
 typedef struct _virStoragePoolObjList virStoragePoolObjList;
@@ -306,6 +320,11 @@ typedef virStoragePoolObjList *virStoragePoolObjListPtr;
 struct _virStoragePoolObjList {
     unsigned int count;
     virStoragePoolObjPtr *objs;
+
+    /* uuid string -> virStoragePoolObj and name -> virStoragePoolObj
+     * mappings, kept in sync with 'objs' for O(1) lookups */
+    virHashTablePtr uuids;
+    virHashTablePtr names;
 };
 
 
@@ -358,6 +377,10 @@ virStorageVolDefPtr virStorageVolDefFindByPath(virStoragePoolObjPtr pool,
 virStorageVolDefPtr virStorageVolDefFindByName(virStoragePoolObjPtr pool,
                                                const char *name);
 
+int virStoragePoolObjAddVol(virStoragePoolObjPtr pool,
+                            virStorageVolDefPtr vol);
+void virStoragePoolObjRemoveVol(virStoragePoolObjPtr pool,
+                                virStorageVolDefPtr vol);
 void virStoragePoolObjClearVols(virStoragePoolObjPtr pool);
 
 virStoragePoolDefPtr virStoragePoolDefParseString(const char *xml);
@@ -68,6 +68,36 @@ virStorageEncryptionFree(virStorageEncryptionPtr enc)
     VIR_FREE(enc);
 }
 
+virStorageEncryptionPtr
+virStorageEncryptionCopy(virStorageEncryptionPtr src)
+{
+    virStorageEncryptionPtr enc;
+    size_t i;
+
+    if (VIR_ALLOC(enc) < 0)
+        goto no_memory;
+
+    enc->format = src->format;
+
+    if (src->nsecrets &&
+        VIR_ALLOC_N(enc->secrets, src->nsecrets) < 0)
+        goto no_memory;
+
+    for (i = 0; i < src->nsecrets; i++) {
+        if (VIR_ALLOC(enc->secrets[i]) < 0)
+            goto no_memory;
+        enc->nsecrets++;
+        *enc->secrets[i] = *src->secrets[i];
+    }
+
+    return enc;
+
+no_memory:
+    virReportOOMError();
+    virStorageEncryptionFree(enc);
+    return NULL;
+}
+
 static virStorageEncryptionSecretPtr
 virStorageEncryptionSecretParse(xmlXPathContextPtr ctxt,
                                 xmlNodePtr node)
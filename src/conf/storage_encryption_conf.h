@@ -62,6 +62,7 @@ struct _virStorageEncryption {
 };
 
 void virStorageEncryptionFree(virStorageEncryptionPtr enc);
+virStorageEncryptionPtr virStorageEncryptionCopy(virStorageEncryptionPtr src);
 
 virStorageEncryptionPtr virStorageEncryptionParseNode(xmlDocPtr xml,
                                                       xmlNodePtr root);
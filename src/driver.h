@@ -838,6 +838,12 @@ typedef char *
                                const char *uri,
                                unsigned int flags);
 
+typedef int
+    (*virDrvConnectGetAllDomainStats)(virConnectPtr conn,
+                                      unsigned int stats,
+                                      virDomainStatsRecordPtr **retStats,
+                                      unsigned int flags);
+
 /**
  * _virDriver:
  *
@@ -1014,6 +1020,7 @@ struct _virDriver {
     virDrvDomainGetDiskErrors domainGetDiskErrors;
     virDrvDomainSetMetadata domainSetMetadata;
     virDrvDomainGetMetadata domainGetMetadata;
+    virDrvConnectGetAllDomainStats connectGetAllDomainStats;
 };
 
 typedef int
@@ -1312,6 +1319,10 @@ typedef int
         (*virDrvStorageVolResize) (virStorageVolPtr vol,
                                    unsigned long long capacity,
                                    unsigned int flags);
+typedef int
+        (*virDrvStorageVolGetWipeInfo) (virStorageVolPtr vol,
+                                        virStorageVolWipeInfoPtr info,
+                                        unsigned int flags);
 
 typedef int
         (*virDrvStoragePoolIsActive)(virStoragePoolPtr pool);
@@ -1375,6 +1386,7 @@ struct _virStorageDriver {
     virDrvStorageVolGetXMLDesc volGetXMLDesc;
     virDrvStorageVolGetPath volGetPath;
     virDrvStorageVolResize volResize;
+    virDrvStorageVolGetWipeInfo volGetWipeInfo;
     virDrvStoragePoolIsActive   poolIsActive;
     virDrvStoragePoolIsPersistent   poolIsPersistent;
 };
@@ -1384,6 +1396,7 @@ typedef int (*virDrvStateInitialize) (int privileged);
 typedef int (*virDrvStateCleanup) (void);
 typedef int (*virDrvStateReload) (void);
 typedef int (*virDrvStateActive) (void);
+typedef void (*virDrvStateAutoStart) (void);
 
 typedef struct _virStateDriver virStateDriver;
 typedef virStateDriver *virStateDriverPtr;
@@ -1394,6 +1407,7 @@ struct _virStateDriver {
     virDrvStateCleanup     cleanup;
     virDrvStateReload      reload;
     virDrvStateActive      active;
+    virDrvStateAutoStart   autoStart;
 };
 # endif
 
@@ -634,6 +634,13 @@ virFDStreamOpenFileInternal(virStreamPtr st,
             goto error;
         }
 
+#ifdef F_SETPIPE_SZ
+        /* The default pipe only holds 64 KiB, which is then all the
+         * data of a stream packet. Allow for full packets and the
+         * 1 MiB writes of the helper, if the system lets us */
+        ignore_value(fcntl(fds[0], F_SETPIPE_SZ, 1024 * 1024));
+#endif
+
         cmd = virCommandNewArgList(LIBEXECDIR "/libvirt_iohelper",
                                    path,
                                    NULL);
@@ -44,6 +44,9 @@
 #include "virnodesuspend.h"
 #include "virrandom.h"
 #include "viruri.h"
+#include "virtypedparam.h"
+#include "virtime.h"
+#include "ignore-value.h"
 
 #ifndef WITH_DRIVER_MODULES
 # ifdef WITH_TEST
@@ -837,7 +840,8 @@ virRegisterStateDriver(virStateDriverPtr driver)
  * virStateInitialize:
  * @privileged: set to 1 if running with root privilege, 0 otherwise
  *
- * Initialize all virtualization drivers.
+ * Initialize all virtualization drivers. The objects marked for
+ * autostart are left alone until virStateAutoStart is called.
  *
  * Returns 0 if all succeed, -1 upon any failure.
  */
@@ -848,16 +852,49 @@ int virStateInitialize(int privileged) {
         return -1;
 
     for (i = 0 ; i < virStateDriverTabCount ; i++) {
-        if (virStateDriverTab[i]->initialize &&
-            virStateDriverTab[i]->initialize(privileged) < 0) {
+        unsigned long long start = 0, now = 0;
+
+        if (!virStateDriverTab[i]->initialize)
+            continue;
+
+        ignore_value(virTimeMillisNow(&start));
+        if (virStateDriverTab[i]->initialize(privileged) < 0) {
             VIR_ERROR(_("Initialization of %s state driver failed"),
                       virStateDriverTab[i]->name);
             ret = -1;
         }
+        ignore_value(virTimeMillisNow(&now));
+        VIR_INFO("%s state driver initialized in %llums",
+                 virStateDriverTab[i]->name, now - start);
     }
     return ret;
 }
 
+/**
+ * virStateAutoStart:
+ *
+ * Run each virtualization driver's autostart method, once all of them
+ * are initialized. As guests may need the networks and storage pools
+ * of other drivers, those are started in the order the drivers were
+ * registered.
+ */
+void virStateAutoStart(void) {
+    int i;
+
+    for (i = 0 ; i < virStateDriverTabCount ; i++) {
+        unsigned long long start = 0, now = 0;
+
+        if (!virStateDriverTab[i]->autoStart)
+            continue;
+
+        ignore_value(virTimeMillisNow(&start));
+        virStateDriverTab[i]->autoStart();
+        ignore_value(virTimeMillisNow(&now));
+        VIR_INFO("%s state driver autostarted in %llums",
+                 virStateDriverTab[i]->name, now - start);
+    }
+}
+
 /**
  * virStateCleanup:
  *
@@ -13220,6 +13257,60 @@ error:
 }
 
 
+/**
+ * virStorageVolGetWipeInfo:
+ * @vol: pointer to storage volume
+ * @info: pointer at which to store the progress of the wipe
+ * @flags: future flags, use 0 for now
+ *
+ * Fetches the progress of a wipe of the storage volume started by
+ * virStorageVolWipe or virStorageVolWipePattern, which may be running
+ * in another thread or client. @info->active is 0 if the volume is not
+ * being wiped. @info->total is 0 if the amount of data to wipe is not
+ * known, as for algorithms other than VIR_STORAGE_VOL_WIPE_ALG_ZERO.
+ *
+ * Returns 0 on success, or -1 on failure
+ */
+int
+virStorageVolGetWipeInfo(virStorageVolPtr vol,
+                         virStorageVolWipeInfoPtr info,
+                         unsigned int flags)
+{
+    virConnectPtr conn;
+    VIR_DEBUG("vol=%p, info=%p, flags=%x", vol, info, flags);
+
+    virResetLastError();
+
+    if (!VIR_IS_CONNECTED_STORAGE_VOL(vol)) {
+        virLibStorageVolError(VIR_ERR_INVALID_STORAGE_VOL, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+    if (info == NULL) {
+        virLibStorageVolError(VIR_ERR_INVALID_ARG, __FUNCTION__);
+        goto error;
+    }
+
+    memset(info, 0, sizeof(virStorageVolWipeInfo));
+
+    conn = vol->conn;
+
+    if (conn->storageDriver && conn->storageDriver->volGetWipeInfo) {
+        int ret;
+        ret = conn->storageDriver->volGetWipeInfo(vol, info, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+
+error:
+    virDispatchError(vol->conn);
+    return -1;
+}
+
+
 /**
  * virStorageVolGetXMLDesc:
  * @vol: pointer to storage volume
@@ -18864,3 +18955,169 @@ error:
     virDispatchError(dom->conn);
     return -1;
 }
+
+/**
+ * virConnectGetAllDomainStats:
+ * @conn: pointer to the hypervisor connection
+ * @stats: stats to return, binary-OR of virDomainStatsTypes
+ * @retStats: Pointer that will be filled with the array of returned stats
+ * @flags: extra flags; binary-OR of virConnectGetAllDomainStatsFlags
+ *
+ * Query statistics for all domains on a given connection in a single
+ * call, instead of issuing virDomainGetInfo(), virDomainBlockStats(),
+ * virDomainInterfaceStats() and friends once per domain.
+ *
+ * Report statistics of various parameters for a running VM according to @stats
+ * field. The statistics are returned as an array of structures for each queried
+ * domain. The structure contains an array of typed parameters containing the
+ * individual statistics. The typed parameter name for each statistic field
+ * consists of a dot-separated string containing name of the requested group
+ * followed by a group specific description of the statistic value.
+ *
+ * The statistic groups are enabled using the @stats parameter which is a
+ * binary-OR of enum virDomainStatsTypes. The following groups are available
+ * (although not necessarily implemented for each hypervisor):
+ *
+ * VIR_DOMAIN_STATS_STATE: Return domain state and reason for entering that
+ * state. The typed parameter keys are in this format:
+ * "state.state" - state of the VM, returned as int from virDomainState enum
+ * "state.reason" - reason for entering given state, returned as int from
+ *                  virDomain*Reason enum corresponding to given state.
+ *
+ * VIR_DOMAIN_STATS_CPU_TOTAL: Return CPU usage of the whole domain, in
+ * nanoseconds, as unsigned long long:
+ * "cpu.time" - total cpu time spent by the domain
+ * "cpu.user" - user cpu time spent
+ * "cpu.system" - system cpu time spent
+ *
+ * VIR_DOMAIN_STATS_BALLOON: Return memory balloon information, in kibibytes,
+ * as unsigned long long:
+ * "balloon.current" - the memory currently used by the domain
+ * "balloon.maximum" - the maximum memory allowed
+ *
+ * VIR_DOMAIN_STATS_VCPU: Return virtual CPU information:
+ * "vcpu.current" - current number of online virtual CPUs as unsigned int
+ * "vcpu.maximum" - maximum number of online virtual CPUs as unsigned int
+ * "vcpu.<num>.state" - state of the virtual CPU <num>, as int
+ *                      from virVcpuState enum
+ * "vcpu.<num>.time" - virtual cpu time spent by virtual CPU <num>
+ *                     as unsigned long long
+ *
+ * VIR_DOMAIN_STATS_INTERFACE: Return network interface statistics, counters
+ * being returned as unsigned long long:
+ * "net.count" - number of network interfaces on this domain
+ *               as unsigned int
+ * "net.<num>.name" - name of the interface <num> as string
+ * "net.<num>.rx.bytes" - bytes received
+ * "net.<num>.rx.pkts" - packets received
+ * "net.<num>.rx.errs" - receive errors
+ * "net.<num>.rx.drop" - receive packets dropped
+ * "net.<num>.tx.bytes" - bytes transmitted
+ * "net.<num>.tx.pkts" - packets transmitted
+ * "net.<num>.tx.errs" - transmission errors
+ * "net.<num>.tx.drop" - transmit packets dropped
+ *
+ * VIR_DOMAIN_STATS_BLOCK: Return block device statistics, counters being
+ * returned as unsigned long long:
+ * "block.count" - number of block devices on this domain
+ *                 as unsigned int
+ * "block.<num>.name" - name of the block device <num> as string,
+ *                      matching the target name (vda/sda/hda) of the
+ *                      block device
+ * "block.<num>.rd.reqs" - number of read requests
+ * "block.<num>.rd.bytes" - number of read bytes
+ * "block.<num>.rd.times" - total time (ns) spent on reads
+ * "block.<num>.wr.reqs" - number of write requests
+ * "block.<num>.wr.bytes" - number of written bytes
+ * "block.<num>.wr.times" - total time (ns) spent on writes
+ * "block.<num>.fl.reqs" - total flush requests
+ * "block.<num>.fl.times" - total time (ns) spent on cache flushing
+ *
+ * Statistics of an individual domain which cannot be gathered, for
+ * instance because the domain is shut off or the hypervisor does not
+ * provide them, are silently omitted from its record. Using 0 for
+ * @stats returns all stats groups supported by the given hypervisor.
+ *
+ * Specifying VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS as @flags makes
+ * the function return error in case some of the stat types in @stats were
+ * not recognized by the hypervisor.
+ *
+ * The domains returned can be limited to running or shut off ones using
+ * VIR_CONNECT_GET_ALL_DOMAINS_STATS_ACTIVE and
+ * VIR_CONNECT_GET_ALL_DOMAINS_STATS_INACTIVE in @flags.
+ *
+ * Note that any of the domain list filtering flags in @flags may be rejected
+ * by the hypervisor driver, in which case an error is returned.
+ *
+ * Returns the count of returned statistics structures on success, -1 on error.
+ * The requested data are returned in the @retStats parameter. The returned
+ * array should be freed by the caller using virDomainStatsRecordListFree.
+ */
+int
+virConnectGetAllDomainStats(virConnectPtr conn,
+                            unsigned int stats,
+                            virDomainStatsRecordPtr **retStats,
+                            unsigned int flags)
+{
+    VIR_DEBUG("conn=%p, stats=0x%x, retStats=%p, flags=0x%x",
+              conn, stats, retStats, flags);
+
+    virResetLastError();
+
+    if (retStats)
+        *retStats = NULL;
+
+    if (!VIR_IS_CONNECT(conn)) {
+        virLibConnError(VIR_ERR_INVALID_CONN, __FUNCTION__);
+        virDispatchError(NULL);
+        return -1;
+    }
+
+    if (!retStats) {
+        virLibConnError(VIR_ERR_INVALID_ARG, __FUNCTION__);
+        goto error;
+    }
+
+    if (VIR_DRV_SUPPORTS_FEATURE(conn->driver, conn,
+                                 VIR_DRV_FEATURE_TYPED_PARAM_STRING))
+        flags |= VIR_TYPED_PARAM_STRING_OKAY;
+
+    if (conn->driver->connectGetAllDomainStats) {
+        int ret = conn->driver->connectGetAllDomainStats(conn, stats,
+                                                         retStats, flags);
+        if (ret < 0)
+            goto error;
+        return ret;
+    }
+
+    virLibConnError(VIR_ERR_NO_SUPPORT, __FUNCTION__);
+error:
+    virDispatchError(conn);
+    return -1;
+}
+
+/**
+ * virDomainStatsRecordListFree:
+ * @stats: NULL terminated array of virDomainStatsRecords to free
+ *
+ * Convenience function to free a NULL terminated list of domain stats
+ * returned by virConnectGetAllDomainStats.
+ */
+void
+virDomainStatsRecordListFree(virDomainStatsRecordPtr *stats)
+{
+    virDomainStatsRecordPtr *next;
+
+    if (!stats)
+        return;
+
+    for (next = stats; *next; next++) {
+        virTypedParameterArrayClear((*next)->params, (*next)->nparams);
+        VIR_FREE((*next)->params);
+        if ((*next)->dom)
+            virDomainFree((*next)->dom);
+        VIR_FREE(*next);
+    }
+
+    VIR_FREE(stats);
+}
@@ -29,6 +29,7 @@
 
 # ifdef WITH_LIBVIRTD
 int virStateInitialize(int privileged);
+void virStateAutoStart(void);
 int virStateCleanup(void);
 int virStateReload(void);
 int virStateActive(void);
@@ -95,6 +96,18 @@ enum {
      * messages).
      */
     VIR_DRV_FEATURE_PROGRAM_KEEPALIVE = 10,
+
+    /*
+     * Remote party can split large replies in VIR_NET_REPLY_CHUNK
+     * messages. Asking the server enables it for the connection.
+     */
+    VIR_DRV_FEATURE_REPLY_CHUNKS = 11,
+
+    /*
+     * Remote party can replace zeroes in streams by VIR_NET_STREAM_HOLE
+     * messages. Asking the server enables it for the connection.
+     */
+    VIR_DRV_FEATURE_STREAM_HOLES = 12,
 };
 
 
@@ -303,7 +303,7 @@ libxlVmCleanup(libxlDriverPrivatePtr driver,
     }
 
     if (vm->persistent) {
-        vm->def->id = -1;
+        virDomainObjListSetID(&driver->domains, vm, -1);
         virDomainObjSetState(vm, VIR_DOMAIN_SHUTOFF, reason);
     }
 
@@ -335,6 +335,7 @@ libxlVmCleanup(libxlDriverPrivatePtr driver,
     }
 
     if (vm->newDef) {
+        virDomainObjListSetID(&driver->domains, vm, -1);
         virDomainDefFree(vm->def);
         vm->def = vm->newDef;
         vm->def->id = -1;
@@ -380,9 +381,9 @@ static void libxlEventHandler(int watch,
     libxl_event event;
     libxl_dominfo info;
 
+    /* Keep the driver locked, the domain may lose its ID */
     libxlDriverLock(driver);
     virDomainObjLock(vm);
-    libxlDriverUnlock(driver);
 
     priv = vm->privateData;
 
@@ -444,11 +445,9 @@ static void libxlEventHandler(int watch,
 cleanup:
     if (vm)
         virDomainObjUnlock(vm);
-    if (dom_event) {
-        libxlDriverLock(driver);
+    if (dom_event)
         libxlDomainEventQueue(driver, dom_event);
-        libxlDriverUnlock(driver);
-    }
+    libxlDriverUnlock(driver);
     libxl_free_event(&event);
 }
 
@@ -683,7 +682,8 @@ libxlVmStart(libxlDriverPrivatePtr driver, virDomainObjPtr vm,
         goto error;
     }
 
-    vm->def->id = domid;
+    if (virDomainObjListSetID(&driver->domains, vm, domid) < 0)
+        goto error;
     if ((dom_xml = virDomainDefFormat(vm->def, 0)) == NULL)
         goto error;
 
@@ -725,7 +725,7 @@ libxlVmStart(libxlDriverPrivatePtr driver, virDomainObjPtr vm,
 error:
     if (domid > 0) {
         libxl_domain_destroy(&priv->ctx, domid, 0);
-        vm->def->id = -1;
+        virDomainObjListSetID(&driver->domains, vm, -1);
         virDomainObjSetState(vm, VIR_DOMAIN_SHUTOFF, VIR_DOMAIN_SHUTOFF_FAILED);
     }
     libxl_domain_config_destroy(&d_config);
@@ -773,7 +773,8 @@ libxlReconnectDomain(void *payload,
     }
 
     /* Update domid in case it changed (e.g. reboot) while we were gone? */
-    vm->def->id = d_info.domid;
+    if (virDomainObjListSetID(&driver->domains, vm, d_info.domid) < 0)
+        goto out;
     virDomainObjSetState(vm, VIR_DOMAIN_RUNNING, VIR_DOMAIN_RUNNING_UNKNOWN);
 
     /* Recreate domain death et. al. events */
@@ -980,9 +981,6 @@ libxlStartup(int privileged) {
                                 NULL, NULL) < 0)
         goto error;
 
-    virHashForEach(libxl_driver->domains.objs, libxlAutostartDomain,
-                   libxl_driver);
-
     libxlDriverUnlock(libxl_driver);
 
     return 0;
@@ -999,6 +997,18 @@ fail:
     return ret;
 }
 
+static void
+libxlAutoStart(void)
+{
+    if (!libxl_driver)
+        return;
+
+    libxlDriverLock(libxl_driver);
+    virHashForEach(libxl_driver->domains.objs, libxlAutostartDomain,
+                   libxl_driver);
+    libxlDriverUnlock(libxl_driver);
+}
+
 static int
 libxlReload(void)
 {
@@ -3921,6 +3931,7 @@ static virStateDriver libxlStateDriver = {
     .cleanup = libxlShutdown,
     .reload = libxlReload,
     .active = libxlActive,
+    .autoStart = libxlAutoStart,
 };
 
 
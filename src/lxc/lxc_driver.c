@@ -1130,7 +1130,7 @@ static void lxcVmCleanup(lxc_driver_t *driver,
 
     virDomainObjSetState(vm, VIR_DOMAIN_SHUTOFF, reason);
     vm->pid = -1;
-    vm->def->id = -1;
+    virDomainObjListSetID(&driver->domains, vm, -1);
     priv->monitor = -1;
     priv->monitorWatch = -1;
 
@@ -1524,9 +1524,9 @@ static void lxcMonitorEvent(int watch,
     virDomainEventPtr event = NULL;
     lxcDomainObjPrivatePtr priv;
 
+    /* Keep the driver locked, the domain loses its ID */
     lxcDriverLock(driver);
     virDomainObjLock(vm);
-    lxcDriverUnlock(driver);
 
     priv = vm->privateData;
 
@@ -1551,11 +1551,9 @@ static void lxcMonitorEvent(int watch,
 cleanup:
     if (vm)
         virDomainObjUnlock(vm);
-    if (event) {
-        lxcDriverLock(driver);
+    if (event)
         lxcDomainEventQueue(driver, event);
-        lxcDriverUnlock(driver);
-    }
+    lxcDriverUnlock(driver);
 }
 
 
@@ -1929,7 +1927,8 @@ static int lxcVmStart(virConnectPtr conn,
         goto cleanup;
     }
 
-    vm->def->id = vm->pid;
+    if (virDomainObjListSetID(&driver->domains, vm, vm->pid) < 0)
+        goto error;
     virDomainObjSetState(vm, VIR_DOMAIN_RUNNING, reason);
 
     if (lxcContainerWaitForContinue(handshakefds[0]) < 0) {
@@ -2497,7 +2496,8 @@ lxcReconnectVM(void *payload, const void *name ATTRIBUTE_UNUSED, void *opaque)
     priv = vm->privateData;
 
     if (vm->pid != 0) {
-        vm->def->id = vm->pid;
+        if (virDomainObjListSetID(&driver->domains, vm, vm->pid) < 0)
+            goto error;
         virDomainObjSetState(vm, VIR_DOMAIN_RUNNING,
                              VIR_DOMAIN_RUNNING_UNKNOWN);
 
@@ -2515,7 +2515,7 @@ lxcReconnectVM(void *payload, const void *name ATTRIBUTE_UNUSED, void *opaque)
                                            vm->def, vm->pid) < 0)
             goto error;
     } else {
-        vm->def->id = -1;
+        virDomainObjListSetID(&driver->domains, vm, -1);
         VIR_FORCE_CLOSE(priv->monitor);
     }
 
@@ -2645,8 +2645,6 @@ static int lxcStartup(int privileged)
 
     lxcDriverUnlock(lxc_driver);
 
-    lxcAutostartConfigs(lxc_driver);
-
     return 0;
 
 cleanup:
@@ -2655,6 +2653,13 @@ cleanup:
     return -1;
 }
 
+static void
+lxcAutoStart(void)
+{
+    if (lxc_driver)
+        lxcAutostartConfigs(lxc_driver);
+}
+
 static void lxcNotifyLoadDomain(virDomainObjPtr vm, int newVM, void *opaque)
 {
     lxc_driver_t *driver = opaque;
@@ -3920,6 +3925,7 @@ static virStateDriver lxcStateDriver = {
     .cleanup = lxcShutdown,
     .active = lxcActive,
     .reload = lxcReload,
+    .autoStart = lxcAutoStart,
 };
 
 int lxcRegister(void)
@@ -322,7 +322,6 @@ networkStartup(int privileged) {
 
     networkFindActiveConfigs(driverState);
     networkReloadIptablesRules(driverState);
-    networkAutostartConfigs(driverState);
 
     networkDriverUnlock(driverState);
 
@@ -340,6 +339,21 @@ error:
     return -1;
 }
 
+/**
+ * networkAutoStart:
+ *
+ * Start the networks marked for autostart
+ */
+static void
+networkAutoStart(void) {
+    if (!driverState)
+        return;
+
+    networkDriverLock(driverState);
+    networkAutostartConfigs(driverState);
+    networkDriverUnlock(driverState);
+}
+
 /**
  * networkReload:
  *
@@ -2706,6 +2720,7 @@ static virStateDriver networkStateDriver = {
     networkShutdown,
     networkReload,
     networkActive,
+    networkAutoStart,
 };
 
 int networkRegister(void) {
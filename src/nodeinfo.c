@@ -48,6 +48,7 @@
 #include "count-one-bits.h"
 #include "intprops.h"
 #include "virfile.h"
+#include "virprocstat.h"
 
 
 #define VIR_FROM_THIS VIR_FROM_NONE
@@ -376,8 +377,9 @@ int linuxNodeGetCPUStats(FILE *procstat,
     int ret = -1;
     char line[1024];
     unsigned long long usr, ni, sys, idle, iowait;
-    unsigned long long irq, softirq, steal, guest, guest_nice;
+    unsigned long long irq, softirq;
     char cpu_header[3 + INT_BUFSIZE_BOUND(cpuNum)];
+    size_t cpu_header_len;
 
     if ((*nparams) == 0) {
         /* Current number of cpu stats supported by linux */
@@ -397,20 +399,31 @@ int linuxNodeGetCPUStats(FILE *procstat,
     } else {
         snprintf(cpu_header, sizeof(cpu_header), "cpu%d", cpuNum);
     }
+    cpu_header_len = strlen(cpu_header);
 
     while (fgets(line, sizeof(line), procstat) != NULL) {
         char *buf = line;
 
-        if (STRPREFIX(buf, cpu_header)) { /* aka logical CPU time */
+        /* The header must be followed by a blank, or "cpu1" would
+         * also match the "cpu10" line */
+        if (STRPREFIX(buf, cpu_header) &&
+            (buf[cpu_header_len] == ' ' ||
+             buf[cpu_header_len] == '\t')) { /* aka logical CPU time */
+            /* user, nice, system, idle, iowait, irq, softirq, ... */
+            unsigned long long values[7] = { 0 };
             int i;
 
-            if (sscanf(buf,
-                       "%*s %llu %llu %llu %llu %llu" // user ~ iowait
-                       "%llu %llu %llu %llu %llu",    // irq  ~ guest_nice
-                       &usr, &ni, &sys, &idle, &iowait,
-                       &irq, &softirq, &steal, &guest, &guest_nice) < 4) {
+            if (virProcStatParseFields(buf + cpu_header_len, NULL,
+                                       values, ARRAY_CARDINALITY(values)) < 4)
                 continue;
-            }
+
+            usr = values[0];
+            ni = values[1];
+            sys = values[2];
+            idle = values[3];
+            iowait = values[4];
+            irq = values[5];
+            softirq = values[6];
 
             for (i = 0; i < *nparams; i++) {
                 virNodeCPUStatsPtr param = &params[i];
@@ -86,6 +86,13 @@ static char *ip6tables_cmd_path;
 static char *grep_cmd_path;
 static char *gawk_cmd_path;
 
+/* If available, the iptables rules of a filter are applied with a
+ * single call of these tools, instead of one process per rule. There's
+ * no equivalent for ebtables, whose restore tool always flushes the
+ * table first. */
+static char *iptables_restore_cmd_path;
+static char *ip6tables_restore_cmd_path;
+
 #define PRINT_ROOT_CHAIN(buf, prefix, ifname) \
     snprintf(buf, sizeof(buf), "libvirt-%c-%s", prefix, ifname)
 #define PRINT_CHAIN(buf, prefix, ifname, suffix) \
@@ -2726,6 +2733,55 @@ ebiptablesExecCLI(virBufferPtr buf,
 }
 
 
+/**
+ * ebiptablesExecRestore:
+ * @path: path of one of the *tables-restore tools
+ * @buf: input for the tool, emptied by this function
+ * @errbuf: pointer to buffer for the error output of the tool, or NULL
+ *
+ * Apply a batch of rules created with ebiptablesInstBatchCommand within
+ * a single transaction. The existing rules are kept.
+ *
+ * Returns 0 on success, -1 on failure
+ */
+static int
+ebiptablesExecRestore(const char *path,
+                      virBufferPtr buf,
+                      char **errbuf)
+{
+    int rc;
+    char *input;
+    virCommandPtr cmd;
+
+    if (virBufferError(buf)) {
+        virReportOOMError();
+        virBufferFreeAndReset(buf);
+        return -1;
+    }
+
+    input = virBufferContentAndReset(buf);
+
+    if (errbuf)
+        VIR_FREE(*errbuf);
+
+    cmd = virCommandNewArgList(path, "--noflush", NULL);
+    virCommandSetInputBuffer(cmd, input);
+    if (errbuf)
+        virCommandSetErrorBuffer(cmd, errbuf);
+
+    virMutexLock(&execCLIMutex);
+
+    rc = virCommandRun(cmd, NULL);
+
+    virMutexUnlock(&execCLIMutex);
+
+    virCommandFree(cmd);
+    VIR_FREE(input);
+
+    return rc;
+}
+
+
 static int
 ebtablesCreateTmpRootChain(virBufferPtr buf,
                            int incoming, const char *ifname,
@@ -3089,6 +3145,135 @@ ebiptablesInstCommand(virBufferPtr buf,
 }
 
 
+/* Appends the value of a comment variable set by printCommentVar to
+ * @buf, quoted the way the *tables-restore tools expect it. Returns
+ * a pointer behind the variable assignment, NULL if it's malformed. */
+static const char *
+ebiptablesBatchComment(virBufferPtr buf, const char *p)
+{
+    virBufferAddChar(buf, '"');
+
+    for (;;) {
+        if (STRPREFIX(p, "'\\''")) {
+            virBufferAddChar(buf, '\'');
+            p += strlen("'\\''");
+        } else if (STRPREFIX(p, "'" CMD_SEPARATOR)) {
+            p += strlen("'" CMD_SEPARATOR);
+            break;
+        } else if (!*p) {
+            return NULL;
+        } else {
+            if (*p == '"' || *p == '\\')
+                virBufferAddChar(buf, '\\');
+            virBufferAddChar(buf, *p++);
+        }
+    }
+
+    virBufferAddChar(buf, '"');
+    return p;
+}
+
+
+/**
+ * ebiptablesInstBatchCommand:
+ * @buf: buffer to append the rules to
+ * @templ: command template, as passed to ebiptablesInstCommand
+ * @cmd: the command to instantiate the template with, e.g. 'A'
+ *
+ * Convert the commands of a template into lines understood by the
+ * *tables-restore tools, which apply all of them in one go. Commands
+ * whose failure would be ignored by the shell script are left out, since
+ * a single failure aborts the whole transaction; those only remove chains
+ * that were cleaned up before the rules are applied.
+ *
+ * Returns the number of lines appended to @buf, -1 if the template
+ * contains something that has no equivalent in a restore file
+ */
+static int
+ebiptablesInstBatchCommand(virBufferPtr buf,
+                           const char *templ, char cmd)
+{
+    virBuffer script = VIR_BUFFER_INITIALIZER;
+    virBuffer comment = VIR_BUFFER_INITIALIZER;
+    static const char cmd_end[] = CMD_DEF_POST CMD_SEPARATOR CMD_EXEC;
+    static const char comment_ref[] = "\"$" COMMENT_VARNAME "\"";
+    const char *stoponerr = CMD_STOPONERR(1);
+    char *commentstr = NULL;
+    char *text;
+    const char *p;
+    int lines = 0;
+
+    ebiptablesInstCommand(&script, templ, cmd, -1, 1);
+    if (virBufferError(&script)) {
+        virReportOOMError();
+        virBufferFreeAndReset(&script);
+        return -1;
+    }
+    p = text = virBufferContentAndReset(&script);
+
+    while (*p) {
+        const char *end;
+        const char *ref;
+
+        if (STRPREFIX(p, COMMENT_VARNAME "='")) {
+            p += strlen(COMMENT_VARNAME "='");
+            if (!(p = ebiptablesBatchComment(&comment, p)))
+                goto error;
+            VIR_FREE(commentstr);
+            if (virBufferError(&comment)) {
+                virReportOOMError();
+                goto error;
+            }
+            commentstr = virBufferContentAndReset(&comment);
+            continue;
+        }
+
+        if (!STRPREFIX(p, CMD_DEF_PRE))
+            goto error;
+        p += strlen(CMD_DEF_PRE);
+
+        if (!STRPREFIX(p, "$IPT ") ||
+            !(end = strstr(p, cmd_end)))
+            goto error;
+        p += strlen("$IPT ");
+
+        /* Commands without error check are followed by the next one */
+        if (STRPREFIX(end + strlen(cmd_end), CMD_DEF_PRE)) {
+            p = end + strlen(cmd_end);
+            continue;
+        }
+
+        /* The value of the comment variable replaces its reference */
+        if ((ref = strstr(p, comment_ref)) && ref < end) {
+            if (!commentstr)
+                goto error;
+            virBufferAdd(buf, p, ref - p);
+            virBufferAdd(buf, commentstr, -1);
+            p = ref + strlen(comment_ref);
+        }
+        virBufferAdd(buf, p, end - p);
+        virBufferAddChar(buf, '\n');
+        lines++;
+
+        p = end + strlen(cmd_end);
+        if (STRPREFIX(p, CMD_SEPARATOR))
+            p += strlen(CMD_SEPARATOR);
+        if (STRPREFIX(p, stoponerr))
+            p += strlen(stoponerr);
+    }
+
+    VIR_FREE(commentstr);
+    VIR_FREE(text);
+    return lines;
+
+error:
+    virBufferFreeAndReset(&comment);
+    VIR_FREE(commentstr);
+    VIR_FREE(text);
+    return -1;
+}
+
+
 /**
  * ebiptablesCanApplyBasicRules
  *
@@ -3573,6 +3758,60 @@ ebtablesCreateTmpRootAndSubChains(virBufferPtr buf,
     return rc;
 }
 
+/*
+ * Add the commands of a template to the shell script in @buf and, as
+ * long as *@nbatch isn't negative, to the input for a restore tool in
+ * @batch. *@nbatch counts the lines in @batch and is set to -1 if a
+ * template can't be converted, in which case the script must be used.
+ */
+static void
+ebiptablesInstBatchCommands(virBufferPtr buf,
+                            virBufferPtr batch,
+                            int *nbatch,
+                            const char *templ)
+{
+    int n;
+
+    ebiptablesInstCommand(buf, templ, 'A', -1, 1);
+
+    if (*nbatch < 0)
+        return;
+
+    if ((n = ebiptablesInstBatchCommand(batch, templ, 'A')) < 0) {
+        VIR_DEBUG("Falling back to the shell for template %s", templ);
+        virBufferFreeAndReset(batch);
+        *nbatch = -1;
+    } else {
+        *nbatch += n;
+    }
+}
+
+/*
+ * Execute the commands collected by ebiptablesInstBatchCommands, with
+ * a single call of the restore tool at @path if possible.
+ */
+static int
+ebiptablesExecBatch(const char *path,
+                    virBufferPtr buf,
+                    virBufferPtr batch,
+                    int nbatch,
+                    char **errbuf)
+{
+    if (nbatch < 0) {
+        virBufferFreeAndReset(batch);
+        return ebiptablesExecCLI(buf, NULL, errbuf);
+    }
+
+    virBufferFreeAndReset(buf);
+
+    if (nbatch == 0) {
+        virBufferFreeAndReset(batch);
+        return 0;
+    }
+
+    return ebiptablesExecRestore(path, batch, errbuf);
+}
+
 static int
 ebiptablesApplyNewRules(const char *ifname,
                         int nruleInstances,
@@ -3589,6 +3828,8 @@ ebiptablesApplyNewRules(const char *ifname,
     ebiptablesRuleInstPtr ebtChains = NULL;
     int nEbtChains = 0;
     char *errmsg = NULL;
+    virBuffer batch = VIR_BUFFER_INITIALIZER;
+    int nbatch;
 
     if (inst == NULL)
         nruleInstances = 0;
@@ -3718,15 +3959,20 @@ ebiptablesApplyNewRules(const char *ifname,
 
         NWFILTER_SET_IPTABLES_SHELLVAR(&buf);
 
+        nbatch = iptables_restore_cmd_path ? 0 : -1;
+        if (nbatch == 0)
+            virBufferAddLit(&batch, "*filter\n");
         for (i = 0; i < nruleInstances; i++) {
             sa_assert (inst);
             if (inst[i]->ruleType == RT_IPTABLES)
-                iptablesInstCommand(&buf,
-                                    inst[i]->commandTemplate,
-                                    'A', -1, 1);
+                ebiptablesInstBatchCommands(&buf, &batch, &nbatch,
+                                            inst[i]->commandTemplate);
         }
+        if (nbatch > 0)
+            virBufferAddLit(&batch, "COMMIT\n");
 
-        if (ebiptablesExecCLI(&buf, NULL, &errmsg) < 0)
+        if (ebiptablesExecBatch(iptables_restore_cmd_path,
+                                &buf, &batch, nbatch, &errmsg) < 0)
            goto tear_down_tmpiptchains;
 
         iptablesCheckBridgeNFCallEnabled(false);
@@ -3759,14 +4005,19 @@ ebiptablesApplyNewRules(const char *ifname,
 
         NWFILTER_SET_IP6TABLES_SHELLVAR(&buf);
 
+        nbatch = ip6tables_restore_cmd_path ? 0 : -1;
+        if (nbatch == 0)
+            virBufferAddLit(&batch, "*filter\n");
         for (i = 0; i < nruleInstances; i++) {
             if (inst[i]->ruleType == RT_IP6TABLES)
-                iptablesInstCommand(&buf,
-                                    inst[i]->commandTemplate,
-                                    'A', -1, 1);
+                ebiptablesInstBatchCommands(&buf, &batch, &nbatch,
+                                            inst[i]->commandTemplate);
         }
+        if (nbatch > 0)
+            virBufferAddLit(&batch, "COMMIT\n");
 
-        if (ebiptablesExecCLI(&buf, NULL, &errmsg) < 0)
+        if (ebiptablesExecBatch(ip6tables_restore_cmd_path,
+                                &buf, &batch, nbatch, &errmsg) < 0)
            goto tear_down_tmpip6tchains;
 
         iptablesCheckBridgeNFCallEnabled(true);
@@ -4133,6 +4384,11 @@ ebiptablesDriverInit(bool privileged)
 
     VIR_FREE(errmsg);
 
+    if (iptables_cmd_path)
+        iptables_restore_cmd_path = virFindFileInPath("iptables-restore");
+    if (ip6tables_cmd_path)
+        ip6tables_restore_cmd_path = virFindFileInPath("ip6tables-restore");
+
     if (!ebtables_cmd_path && !iptables_cmd_path && !ip6tables_cmd_path) {
         VIR_ERROR(_("firewall tools were not found or cannot be used"));
         ebiptablesDriverShutdown();
@@ -4153,5 +4409,7 @@ ebiptablesDriverShutdown(void)
     VIR_FREE(ebtables_cmd_path);
     VIR_FREE(iptables_cmd_path);
     VIR_FREE(ip6tables_cmd_path);
+    VIR_FREE(iptables_restore_cmd_path);
+    VIR_FREE(ip6tables_restore_cmd_path);
     ebiptables_driver.flags = 0;
 }
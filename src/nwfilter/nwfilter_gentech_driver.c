@@ -1131,6 +1131,10 @@ virNWFilterDomainFWUpdateCB(void *payload,
         for (i = 0; i < vm->nnets; i++) {
             virDomainNetDefPtr net = vm->nets[i];
             if ((net->filter) && (net->ifname)) {
+                /* interface not affected by the filter being changed */
+                if (!virNWFilterUpdateAffects(cb, net->filter))
+                    continue;
+
                 switch (cb->step) {
                 case STEP_APPLY_NEW:
                     cb->err = virNWFilterUpdateInstantiateFilter(cb->conn,
@@ -30,6 +30,7 @@
 #endif
 
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 
 #include <arpa/inet.h>
@@ -48,6 +49,9 @@
 #include "virnetdev.h"
 #include "virterror_internal.h"
 #include "threads.h"
+#include "virfile.h"
+#include "virtime.h"
+#include "ignore-value.h"
 #include "conf/nwfilter_params.h"
 #include "conf/domain_conf.h"
 #include "nwfilter_gentech_driver.h"
@@ -135,6 +139,20 @@ struct _virNWFilterIfaceLock {
 
 static bool threadsTerminate = false;
 
+#ifdef HAVE_LIBPCAP
+/* requests registered but not yet picked up by the learner thread;
+   protected by pendingLearnReqLock like the state of the thread */
+static virNWFilterIPAddrLearnReqPtr *learnerQueue;
+static size_t nlearnerQueue;
+
+static virThread learnerThread;
+static bool learnerStarted;
+static bool learnerQuit;
+static int learnerWakeupFD[2] = { -1, -1 };
+
+static void learnIPAddressWakeup(void);
+#endif
+
 
 int
 virNWFilterLockIface(const char *ifname) {
@@ -265,6 +283,9 @@ virNWFilterTerminateLearnReq(const char *ifname) {
     if (req) {
         rc = 0;
         req->terminate = true;
+#ifdef HAVE_LIBPCAP
+        learnIPAddressWakeup();
+#endif
     }
 
     virMutexUnlock(&pendingLearnReqLock);
@@ -417,8 +438,6 @@ virNWFilterGetIpAddrForIfname(const char *ifname)
 }
 
 
-#ifdef HAVE_LIBPCAP
-
 static void
 procDHCPOpts(struct dhcp *dhcp, int dhcp_opts_len,
              uint32_t *vmaddr, uint32_t *bcastaddr,
@@ -455,44 +474,208 @@ procDHCPOpts(struct dhcp *dhcp, int dhcp_opts_len,
 
 
 /**
- * learnIPAddressThread
- * arg: pointer to virNWFilterIPAddrLearnReq structure
+ * virNWFilterLearnIPAddressFromPacket:
+ * @macaddr: the MAC address of the VM's interface
+ * @howDetect: the methods the IP address may be detected with
+ * @packet: the packet captured on the interface, starting with the
+ *          ethernet header
+ * @len: the number of bytes captured
+ * @vmaddr: pointer to store the IPv4 address in, in network byte order
+ *
+ * Check a single packet seen on the interface of a VM for the IP address
+ * the VM is using. Use ARP Request and Reply messages, DHCP offers and the
+ * first IP packet being sent from the VM to detect the IP address it is
+ * using. DETECT_DHCP will require that the IP address is detected from a
+ * DHCP OFFER, DETECT_STATIC will require that the IP address was taken
+ * from an ARP packet or an IPv4 packet. Both flags can be set at the same
+ * time.
  *
- * Learn the IP address being used on an interface. Use ARP Request and
- * Reply messages, DHCP offers and the first IP packet being sent from
- * the VM to detect the IP address it is using. Detects only one IP address
- * per interface (IP aliasing not supported). The method on how the
- * IP address is detected can be chosen through flags. DETECT_DHCP will
- * require that the IP address is detected from a DHCP OFFER, DETECT_STATIC
- * will require that the IP address was taken from an ARP packet or an IPv4
- * packet. Both flags can be set at the same time.
+ * Returns true if the IP address was found, false otherwise.
  */
-static void *
-learnIPAddressThread(void *arg)
+bool
+virNWFilterLearnIPAddressFromPacket(const unsigned char *macaddr,
+                                    enum howDetect howDetect,
+                                    const unsigned char *packet,
+                                    size_t len,
+                                    uint32_t *vmaddr)
 {
-    char errbuf[PCAP_ERRBUF_SIZE] = {0};
-    pcap_t *handle = NULL;
-    struct bpf_program fp;
-    struct pcap_pkthdr header;
-    const u_char *packet;
     struct ether_header *ether_hdr;
     struct ether_vlan_header *vlan_hdr;
-    virNWFilterIPAddrLearnReqPtr req = arg;
-    uint32_t vmaddr = 0, bcastaddr = 0;
+    uint32_t addr = 0, bcastaddr = 0;
     unsigned int ethHdrSize;
-    char *listen_if = (strlen(req->linkdev) != 0) ? req->linkdev
-                                                  : req->ifname;
     int dhcp_opts_len;
+    uint16_t etherType;
+    enum howDetect howDetected = 0;
+
+    if (len < sizeof(struct ether_header))
+        return false;
+
+    ether_hdr = (struct ether_header*)packet;
+
+    switch (ntohs(ether_hdr->ether_type)) {
+
+    case ETHERTYPE_IP:
+    case ETHERTYPE_ARP:
+        ethHdrSize = sizeof(struct ether_header);
+        etherType = ntohs(ether_hdr->ether_type);
+        break;
+
+    case ETHERTYPE_VLAN:
+        ethHdrSize = sizeof(struct ether_vlan_header);
+        vlan_hdr = (struct ether_vlan_header *)packet;
+        if ((ntohs(vlan_hdr->ether_type) != ETHERTYPE_IP &&
+             ntohs(vlan_hdr->ether_type) != ETHERTYPE_ARP) ||
+            len < ethHdrSize)
+            return false;
+        etherType = ntohs(vlan_hdr->ether_type);
+        break;
+
+    default:
+        return false;
+    }
+
+    if (memcmp(ether_hdr->ether_shost,
+               macaddr,
+               VIR_MAC_BUFLEN) == 0) {
+        /* packets from the VM */
+
+        if (etherType == ETHERTYPE_IP &&
+            (len >= ethHdrSize +
+                    sizeof(struct iphdr))) {
+            struct iphdr *iphdr = (struct iphdr*)(packet +
+                                                  ethHdrSize);
+            addr = iphdr->saddr;
+            /* skip mcast addresses (224.0.0.0 - 239.255.255.255),
+             * class E (240.0.0.0 - 255.255.255.255, includes eth.
+             * bcast) and zero address in DHCP Requests */
+            if ( (ntohl(addr) & 0xe0000000) == 0xe0000000 ||
+                 addr == 0)
+                return false;
+
+            howDetected = DETECT_STATIC;
+        } else if (etherType == ETHERTYPE_ARP &&
+                   (len >= ethHdrSize +
+                           sizeof(struct f_arphdr))) {
+            struct f_arphdr *arphdr = (struct f_arphdr*)(packet +
+                                                 ethHdrSize);
+            switch (ntohs(arphdr->arphdr.ar_op)) {
+            case ARPOP_REPLY:
+                addr = arphdr->ar_sip;
+                howDetected = DETECT_STATIC;
+            break;
+            case ARPOP_REQUEST:
+                /* The target of a request is the address asked for,
+                 * usually the gateway, except for a probe sent with
+                 * no sender address before taking the target one */
+                addr = arphdr->ar_sip;
+                if (addr == 0)
+                    addr = arphdr->ar_tip;
+                howDetected = DETECT_STATIC;
+            break;
+            }
+            /* skip mcast and class E addresses as for IP packets */
+            if ((ntohl(addr) & 0xe0000000) == 0xe0000000)
+                return false;
+        }
+    } else if (memcmp(ether_hdr->ether_dhost,
+                      macaddr,
+                      VIR_MAC_BUFLEN) == 0) {
+        /* packets to the VM */
+        if (etherType == ETHERTYPE_IP &&
+            (len >= ethHdrSize +
+                    sizeof(struct iphdr))) {
+            struct iphdr *iphdr = (struct iphdr*)(packet +
+                                                  ethHdrSize);
+            if ((iphdr->protocol == IPPROTO_UDP) &&
+                (len >= ethHdrSize +
+                        iphdr->ihl * 4 +
+                        sizeof(struct udphdr))) {
+                struct udphdr *udphdr= (struct udphdr *)
+                                  ((char *)iphdr + iphdr->ihl * 4);
+                if (ntohs(udphdr->source) == 67 &&
+                    ntohs(udphdr->dest)   == 68 &&
+                    len >= ethHdrSize +
+                           iphdr->ihl * 4 +
+                           sizeof(struct udphdr) +
+                           sizeof(struct dhcp)) {
+                    struct dhcp *dhcp = (struct dhcp *)
+                                ((char *)udphdr + sizeof(udphdr));
+                    if (dhcp->op == 2 /* BOOTREPLY */ &&
+                        !memcmp(&dhcp->chaddr[0],
+                                macaddr,
+                                6)) {
+                        dhcp_opts_len = len -
+                            (ethHdrSize + iphdr->ihl * 4 +
+                             sizeof(struct udphdr) +
+                             sizeof(struct dhcp));
+                        procDHCPOpts(dhcp, dhcp_opts_len,
+                                     &addr,
+                                     &bcastaddr,
+                                     &howDetected);
+                    }
+                }
+            }
+        }
+    }
+
+    if (addr == 0 || (howDetect & howDetected) == 0)
+        return false;
+
+    *vmaddr = addr;
+    return true;
+}
+
+
+#ifdef HAVE_LIBPCAP
+
+/* A request whose packets are being looked at by the learner thread */
+typedef struct _learnIPAddressWatch learnIPAddressWatch;
+typedef learnIPAddressWatch *learnIPAddressWatchPtr;
+struct _learnIPAddressWatch {
+    virNWFilterIPAddrLearnReqPtr req;
+    pcap_t *handle;
+    bool locked;
+    bool showError;
+    uint32_t vmaddr;
+};
+
+
+static void
+learnIPAddressWakeup(void)
+{
+    char c = '\0';
+
+    /* the pipe is full if the thread hasn't woken up yet */
+    ignore_value(write(learnerWakeupFD[1], &c, 1));
+}
+
+
+/*
+ * Lock the interface of a new request, open the capture handle on it
+ * and apply the rules letting through the traffic the address is
+ * learned from.
+ *
+ * Returns 0 if the learner thread can start listening for the packets
+ * of the request, -1 if the request is done already.
+ */
+static int
+learnIPAddressStart(learnIPAddressWatchPtr watch)
+{
+    char errbuf[PCAP_ERRBUF_SIZE] = {0};
+    struct bpf_program fp;
+    virNWFilterIPAddrLearnReqPtr req = watch->req;
+    const char *listen_if = (strlen(req->linkdev) != 0) ? req->linkdev
+                                                        : req->ifname;
     char macaddr[VIR_MAC_STRING_BUFLEN];
     virBuffer buf = VIR_BUFFER_INITIALIZER;
     char *filter = NULL;
-    uint16_t etherType;
-    bool showError = true;
-    enum howDetect howDetected = 0;
     virNWFilterTechDriverPtr techdriver = req->techdriver;
 
+    watch->showError = true;
+
     if (virNWFilterLockIface(req->ifname) < 0)
-       goto err_no_lock;
+        return -1;
+    watch->locked = true;
 
     req->status = 0;
 
@@ -500,15 +683,23 @@ learnIPAddressThread(void *arg)
     if (virNetDevValidateConfig(req->ifname, NULL, req->ifindex) <= 0) {
         virResetLastError();
         req->status = ENODEV;
-        goto done;
+        goto error;
     }
 
-    handle = pcap_open_live(listen_if, BUFSIZ, 0, PKT_TIMEOUT_MS, errbuf);
+    watch->handle = pcap_open_live(listen_if, BUFSIZ, 0, PKT_TIMEOUT_MS,
+                                   errbuf);
 
-    if (handle == NULL) {
+    if (watch->handle == NULL) {
         VIR_DEBUG("Couldn't open device %s: %s\n", listen_if, errbuf);
         req->status = ENODEV;
-        goto done;
+        goto error;
+    }
+
+    if (pcap_setnonblock(watch->handle, 1, errbuf) < 0) {
+        VIR_DEBUG("Couldn't make device %s non-blocking: %s\n",
+                  listen_if, errbuf);
+        req->status = EINVAL;
+        goto error;
     }
 
     virMacAddrFormat(req->macaddr, macaddr);
@@ -519,7 +710,7 @@ learnIPAddressThread(void *arg)
                                            req->macaddr,
                                            NULL, false) < 0) {
             req->status = EINVAL;
-            goto done;
+            goto error;
         }
         virBufferAsprintf(&buf, " ether dst %s"
                                 " and src port 67 and dst port 68",
@@ -529,173 +720,67 @@ learnIPAddressThread(void *arg)
         if (techdriver->applyBasicRules(req->ifname,
                                         req->macaddr) < 0) {
             req->status = EINVAL;
-            goto done;
+            goto error;
         }
         virBufferAsprintf(&buf, "ether host %s", macaddr);
     }
 
     if (virBufferError(&buf)) {
         req->status = ENOMEM;
-        goto done;
+        goto error;
     }
 
     filter = virBufferContentAndReset(&buf);
 
-    if (pcap_compile(handle, &fp, filter, 1, 0) != 0) {
+    if (pcap_compile(watch->handle, &fp, filter, 1, 0) != 0) {
         VIR_DEBUG("Couldn't compile filter '%s'.\n", filter);
         req->status = EINVAL;
-        goto done;
+        goto error;
     }
 
-    if (pcap_setfilter(handle, &fp) != 0) {
+    if (pcap_setfilter(watch->handle, &fp) != 0) {
         VIR_DEBUG("Couldn't set filter '%s'.\n", filter);
         req->status = EINVAL;
         pcap_freecode(&fp);
-        goto done;
+        goto error;
     }
 
     pcap_freecode(&fp);
+    VIR_FREE(filter);
 
-    while (req->status == 0 && vmaddr == 0) {
-        packet = pcap_next(handle, &header);
-
-        if (!packet) {
-
-            if (threadsTerminate || req->terminate) {
-                req->status = ECANCELED;
-                showError = false;
-                break;
-            }
-
-            /* check whether VM's dev is still there */
-            if (virNetDevValidateConfig(req->ifname, NULL, req->ifindex) <= 0) {
-                virResetLastError();
-                req->status = ENODEV;
-                showError = false;
-                break;
-            }
-            continue;
-        }
-
-        if (header.len >= sizeof(struct ether_header)) {
-            ether_hdr = (struct ether_header*)packet;
-
-            switch (ntohs(ether_hdr->ether_type)) {
-
-            case ETHERTYPE_IP:
-                ethHdrSize = sizeof(struct ether_header);
-                etherType = ntohs(ether_hdr->ether_type);
-                break;
+    VIR_DEBUG("learning IP address on interface %s", req->ifname);
 
-            case ETHERTYPE_VLAN:
-                ethHdrSize = sizeof(struct ether_vlan_header);
-                vlan_hdr = (struct ether_vlan_header *)packet;
-                if (ntohs(vlan_hdr->ether_type) != ETHERTYPE_IP ||
-                    header.len < ethHdrSize)
-                    continue;
-                etherType = ntohs(vlan_hdr->ether_type);
-                break;
+    return 0;
 
-            default:
-                continue;
-            }
+error:
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(filter);
+    return -1;
+}
 
-            if (memcmp(ether_hdr->ether_shost,
-                       req->macaddr,
-                       VIR_MAC_BUFLEN) == 0) {
-                /* packets from the VM */
-
-                if (etherType == ETHERTYPE_IP &&
-                    (header.len >= ethHdrSize +
-                                   sizeof(struct iphdr))) {
-                    struct iphdr *iphdr = (struct iphdr*)(packet +
-                                                          ethHdrSize);
-                    vmaddr = iphdr->saddr;
-                    /* skip mcast addresses (224.0.0.0 - 239.255.255.255),
-                     * class E (240.0.0.0 - 255.255.255.255, includes eth.
-                     * bcast) and zero address in DHCP Requests */
-                    if ( (ntohl(vmaddr) & 0xe0000000) == 0xe0000000 ||
-                         vmaddr == 0) {
-                        vmaddr = 0;
-                        continue;
-                    }
 
-                    howDetected = DETECT_STATIC;
-                } else if (etherType == ETHERTYPE_ARP &&
-                           (header.len >= ethHdrSize +
-                                          sizeof(struct f_arphdr))) {
-                    struct f_arphdr *arphdr = (struct f_arphdr*)(packet +
-                                                         ethHdrSize);
-                    switch (ntohs(arphdr->arphdr.ar_op)) {
-                    case ARPOP_REPLY:
-                        vmaddr = arphdr->ar_sip;
-                        howDetected = DETECT_STATIC;
-                    break;
-                    case ARPOP_REQUEST:
-                        vmaddr = arphdr->ar_tip;
-                        howDetected = DETECT_STATIC;
-                    break;
-                    }
-                }
-            } else if (memcmp(ether_hdr->ether_dhost,
-                              req->macaddr,
-                              VIR_MAC_BUFLEN) == 0) {
-                /* packets to the VM */
-                if (etherType == ETHERTYPE_IP &&
-                    (header.len >= ethHdrSize +
-                                   sizeof(struct iphdr))) {
-                    struct iphdr *iphdr = (struct iphdr*)(packet +
-                                                          ethHdrSize);
-                    if ((iphdr->protocol == IPPROTO_UDP) &&
-                        (header.len >= ethHdrSize +
-                                       iphdr->ihl * 4 +
-                                       sizeof(struct udphdr))) {
-                        struct udphdr *udphdr= (struct udphdr *)
-                                          ((char *)iphdr + iphdr->ihl * 4);
-                        if (ntohs(udphdr->source) == 67 &&
-                            ntohs(udphdr->dest)   == 68 &&
-                            header.len >= ethHdrSize +
-                                          iphdr->ihl * 4 +
-                                          sizeof(struct udphdr) +
-                                          sizeof(struct dhcp)) {
-                            struct dhcp *dhcp = (struct dhcp *)
-                                        ((char *)udphdr + sizeof(udphdr));
-                            if (dhcp->op == 2 /* BOOTREPLY */ &&
-                                !memcmp(&dhcp->chaddr[0],
-                                        req->macaddr,
-                                        6)) {
-                                dhcp_opts_len = header.len -
-                                    (ethHdrSize + iphdr->ihl * 4 +
-                                     sizeof(struct udphdr) +
-                                     sizeof(struct dhcp));
-                                procDHCPOpts(dhcp, dhcp_opts_len,
-                                             &vmaddr,
-                                             &bcastaddr,
-                                             &howDetected);
-                            }
-                        }
-                    }
-                }
-            }
-        }
-        if (vmaddr && (req->howDetect & howDetected) == 0) {
-            vmaddr = 0;
-            howDetected = 0;
-        }
-    } /* while */
+/*
+ * Apply the filter with the learned IP address, or drop all traffic of
+ * the interface if learning failed, and get rid of the request.
+ */
+static void
+learnIPAddressFinish(learnIPAddressWatchPtr watch)
+{
+    virNWFilterIPAddrLearnReqPtr req = watch->req;
+    virNWFilterTechDriverPtr techdriver = req->techdriver;
 
- done:
-    VIR_FREE(filter);
+    if (watch->handle)
+        pcap_close(watch->handle);
 
-    if (handle)
-        pcap_close(handle);
+    if (!watch->locked)
+        goto err_no_lock;
 
     if (req->status == 0) {
         int ret;
         virSocketAddr sa;
         sa.len = sizeof(sa.data.inet4);
         sa.data.inet4.sin_family = AF_INET;
-        sa.data.inet4.sin_addr.s_addr = vmaddr;
+        sa.data.inet4.sin_addr.s_addr = watch->vmaddr;
         char *inetaddr;
 
         if ((inetaddr = virSocketAddrFormat(&sa)) != NULL) {
@@ -717,7 +802,7 @@ learnIPAddressThread(void *arg)
                       "%s with IP addr %s : %d\n", req->ifname, inetaddr, ret);
         }
     } else {
-        if (showError)
+        if (watch->showError)
             virReportSystemError(req->status,
                                  _("encountered an error on interface %s "
                                    "index %d"),
@@ -726,9 +811,7 @@ learnIPAddressThread(void *arg)
         techdriver->applyDropAllRules(req->ifname);
     }
 
-    memset(&req->thread, 0x0, sizeof(req->thread));
-
-    VIR_DEBUG("pcap thread terminating for interface %s\n",req->ifname);
+    VIR_DEBUG("stopped learning IP address on interface %s\n", req->ifname);
 
     virNWFilterUnlockIface(req->ifname);
 
@@ -737,7 +820,220 @@ learnIPAddressThread(void *arg)
 
     virNWFilterIPAddrLearnReqFree(req);
 
-    return 0;
+    VIR_FREE(watch);
+}
+
+
+static void
+learnIPAddressHandlePacket(u_char *opaque,
+                           const struct pcap_pkthdr *header,
+                           const u_char *packet)
+{
+    learnIPAddressWatchPtr watch = (learnIPAddressWatchPtr)opaque;
+
+    /* ignore whatever else was captured along with the packet that
+       revealed the address */
+    if (watch->vmaddr)
+        return;
+
+    virNWFilterLearnIPAddressFromPacket(watch->req->macaddr,
+                                        watch->req->howDetect,
+                                        packet, header->caplen,
+                                        &watch->vmaddr);
+}
+
+
+/**
+ * learnIPAddressThread
+ *
+ * Learn the IP addresses being used on the interfaces of all pending
+ * requests. A single thread waits for the packets captured on any of the
+ * interfaces, so a storm of VMs starting up doesn't result in as many
+ * threads sniffing on their interfaces. The thread is started with the
+ * first request and runs until the driver is shut down; it sleeps while
+ * there is nothing to do.
+ */
+static void
+learnIPAddressThread(void *opaque ATTRIBUTE_UNUSED)
+{
+    learnIPAddressWatchPtr *watches = NULL;
+    size_t nwatches = 0;
+    struct pollfd *fds = NULL;
+    unsigned long long now, lastCheck = 0;
+    char c;
+
+    for (;;) {
+        virNWFilterIPAddrLearnReqPtr *queue;
+        size_t nqueue;
+        bool quit, check;
+        size_t i;
+        int n;
+
+        virMutexLock(&pendingLearnReqLock);
+        while (read(learnerWakeupFD[0], &c, 1) == 1)
+            ;
+        queue = learnerQueue;
+        nqueue = nlearnerQueue;
+        learnerQueue = NULL;
+        nlearnerQueue = 0;
+        quit = learnerQuit;
+        virMutexUnlock(&pendingLearnReqLock);
+
+        for (i = 0; i < nqueue; i++) {
+            learnIPAddressWatchPtr watch;
+
+            if (VIR_ALLOC(watch) < 0) {
+                virReportOOMError();
+                virNWFilterDeregisterLearnReq(queue[i]->ifindex);
+                virNWFilterIPAddrLearnReqFree(queue[i]);
+                continue;
+            }
+            watch->req = queue[i];
+
+            if (learnIPAddressStart(watch) < 0 ||
+                VIR_EXPAND_N(watches, nwatches, 1) < 0) {
+                learnIPAddressFinish(watch);
+                continue;
+            }
+            watches[nwatches - 1] = watch;
+        }
+        VIR_FREE(queue);
+
+        if (quit && nwatches == 0)
+            break;
+
+        /* check whether VMs' devs are still there only as often as
+           a single request used to when no packets arrived */
+        if (virTimeMillisNow(&now) < 0)
+            now = lastCheck + PKT_TIMEOUT_MS;
+        check = now - lastCheck >= PKT_TIMEOUT_MS;
+        if (check)
+            lastCheck = now;
+
+        for (i = 0; i < nwatches; ) {
+            learnIPAddressWatchPtr watch = watches[i];
+            virNWFilterIPAddrLearnReqPtr req = watch->req;
+
+            if (req->status == 0 && !watch->vmaddr) {
+                if (threadsTerminate || req->terminate) {
+                    req->status = ECANCELED;
+                    watch->showError = false;
+                } else if (check &&
+                           virNetDevValidateConfig(req->ifname, NULL,
+                                                   req->ifindex) <= 0) {
+                    virResetLastError();
+                    req->status = ENODEV;
+                    watch->showError = false;
+                }
+            }
+
+            if (req->status == 0 && !watch->vmaddr) {
+                i++;
+                continue;
+            }
+
+            learnIPAddressFinish(watch);
+            memmove(watches + i, watches + i + 1,
+                    sizeof(*watches) * (nwatches - i - 1));
+            VIR_SHRINK_N(watches, nwatches, 1);
+        }
+
+        if (VIR_REALLOC_N(fds, nwatches + 1) < 0) {
+            virReportOOMError();
+            for (i = 0; i < nwatches; i++)
+                watches[i]->req->status = ENOMEM;
+            continue;
+        }
+
+        fds[0].fd = learnerWakeupFD[0];
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        for (i = 0; i < nwatches; i++) {
+            fds[i + 1].fd = pcap_get_selectable_fd(watches[i]->handle);
+            fds[i + 1].events = POLLIN;
+            fds[i + 1].revents = 0;
+        }
+
+        n = poll(fds, nwatches + 1, nwatches ? PKT_TIMEOUT_MS : -1);
+        if (n < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            virReportSystemError(errno, "%s",
+                                 _("Unable to poll on capture handles"));
+            for (i = 0; i < nwatches; i++)
+                watches[i]->req->status = errno;
+            continue;
+        }
+
+        for (i = 0; n > 0 && i < nwatches; i++) {
+            if (!fds[i + 1].revents)
+                continue;
+
+            if (fds[i + 1].revents & POLLIN) {
+                if (pcap_dispatch(watches[i]->handle, -1,
+                                  learnIPAddressHandlePacket,
+                                  (u_char *)watches[i]) < 0) {
+                    VIR_DEBUG("Couldn't read from device %s: %s\n",
+                              watches[i]->req->ifname,
+                              pcap_geterr(watches[i]->handle));
+                    watches[i]->req->status = ENODEV;
+                }
+            } else {
+                watches[i]->req->status = ENODEV;
+                watches[i]->showError = false;
+            }
+        }
+    }
+
+    VIR_FREE(watches);
+    VIR_FREE(fds);
+}
+
+
+/*
+ * Hand over a registered request to the learner thread, starting the
+ * thread if needed.
+ */
+static int
+learnIPAddressQueue(virNWFilterIPAddrLearnReqPtr req)
+{
+    int ret = -1;
+
+    virMutexLock(&pendingLearnReqLock);
+
+    if (!learnerStarted) {
+        if (pipe2(learnerWakeupFD, O_CLOEXEC | O_NONBLOCK) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to create wakeup pipe"));
+            goto cleanup;
+        }
+
+        if (virThreadCreate(&learnerThread, true,
+                            learnIPAddressThread, NULL) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("Unable to create IP address "
+                                   "learning thread"));
+            VIR_FORCE_CLOSE(learnerWakeupFD[0]);
+            VIR_FORCE_CLOSE(learnerWakeupFD[1]);
+            goto cleanup;
+        }
+        learnerStarted = true;
+    }
+
+    if (VIR_EXPAND_N(learnerQueue, nlearnerQueue, 1) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+    learnerQueue[nlearnerQueue - 1] = req;
+
+    learnIPAddressWakeup();
+
+    ret = 0;
+
+cleanup:
+    virMutexUnlock(&pendingLearnReqLock);
+
+    return ret;
 }
 
 
@@ -757,11 +1053,10 @@ learnIPAddressThread(void *arg)
  *              IP address; must choose any of the available flags
  *
  * Instruct to learn the IP address being used on a given interface (ifname).
- * Unless there already is a thread attempting to learn the IP address
- * being used on the interface, a thread is started that will listen on
- * the traffic being sent on the interface (or link device) with the
- * MAC address that is provided. Will then launch the application of the
- * firewall rules on the interface.
+ * Unless there already is a request to learn the IP address being used on
+ * the interface, the learner thread will listen on the traffic being sent
+ * on the interface (or link device) with the MAC address that is provided.
+ * Will then launch the application of the firewall rules on the interface.
  */
 int
 virNWFilterLearnIPAddress(virNWFilterTechDriverPtr techdriver,
@@ -839,10 +1134,7 @@ virNWFilterLearnIPAddress(virNWFilterTechDriverPtr techdriver,
     if (rc < 0)
         goto err_free_req;
 
-    if (pthread_create(&req->thread,
-                       NULL,
-                       learnIPAddressThread,
-                       req) != 0)
+    if (learnIPAddressQueue(req) < 0)
         goto err_dereg_req;
 
     return 0;
@@ -932,6 +1224,13 @@ void
 virNWFilterLearnThreadsTerminate(bool allowNewThreads) {
     threadsTerminate = true;
 
+#ifdef HAVE_LIBPCAP
+    virMutexLock(&pendingLearnReqLock);
+    if (learnerStarted)
+        learnIPAddressWakeup();
+    virMutexUnlock(&pendingLearnReqLock);
+#endif
+
     while (virHashSize(pendingLearnReq) != 0)
         usleep((PKT_TIMEOUT_MS * 1000) / 3);
 
@@ -951,6 +1250,22 @@ virNWFilterLearnShutdown(void)
 
     virNWFilterLearnThreadsTerminate(false);
 
+#ifdef HAVE_LIBPCAP
+    virMutexLock(&pendingLearnReqLock);
+    learnerQuit = true;
+    if (learnerStarted)
+        learnIPAddressWakeup();
+    virMutexUnlock(&pendingLearnReqLock);
+
+    if (learnerStarted) {
+        virThreadJoin(&learnerThread);
+        VIR_FORCE_CLOSE(learnerWakeupFD[0]);
+        VIR_FORCE_CLOSE(learnerWakeupFD[1]);
+        learnerStarted = false;
+    }
+    learnerQuit = false;
+#endif
+
     virHashFree(pendingLearnReq);
     pendingLearnReq = NULL;
 
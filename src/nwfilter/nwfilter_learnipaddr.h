@@ -47,7 +47,6 @@ struct _virNWFilterIPAddrLearnReq {
     enum howDetect howDetect;
 
     int status;
-    pthread_t thread;
     volatile bool terminate;
 };
 
@@ -62,6 +61,12 @@ int virNWFilterLearnIPAddress(virNWFilterTechDriverPtr techdriver,
                               virNWFilterDriverStatePtr driver,
                               enum howDetect howDetect);
 
+bool virNWFilterLearnIPAddressFromPacket(const unsigned char *macaddr,
+                                         enum howDetect howDetect,
+                                         const unsigned char *packet,
+                                         size_t len,
+                                         uint32_t *vmaddr);
+
 virNWFilterIPAddrLearnReqPtr virNWFilterLookupLearnReq(int ifindex);
 int virNWFilterTerminateLearnReq(const char *ifname);
 
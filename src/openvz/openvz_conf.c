@@ -536,8 +536,7 @@ int openvzLoadDomains(struct openvz_driver *driver) {
         openvzReadNetworkConf(dom->def, veid);
         openvzReadFSConf(dom->def, veid);
 
-        virUUIDFormat(dom->def->uuid, uuidstr);
-        if (virHashAddEntry(driver->domains.objs, uuidstr, dom) < 0)
+        if (virDomainObjListAdd(&driver->domains, dom) < 0)
             goto cleanup;
 
         virDomainObjUnlock(dom);
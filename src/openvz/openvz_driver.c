@@ -591,9 +591,9 @@ openvzDomainShutdownFlags(virDomainPtr dom,
 
     virCheckFlags(0, -1);
 
+    /* Keep the driver locked, as the domain loses its ID */
     openvzDriverLock(driver);
     vm = virDomainFindByUUID(&driver->domains, dom->uuid);
-    openvzDriverUnlock(driver);
 
     if (!vm) {
         openvzError(VIR_ERR_NO_DOMAIN, "%s",
@@ -614,7 +614,7 @@ openvzDomainShutdownFlags(virDomainPtr dom,
     if (virRun(prog, NULL) < 0)
         goto cleanup;
 
-    vm->def->id = -1;
+    virDomainObjListSetID(&driver->domains, vm, -1);
     virDomainObjSetState(vm, VIR_DOMAIN_SHUTOFF, VIR_DOMAIN_SHUTOFF_SHUTDOWN);
     dom->id = -1;
     ret = 0;
@@ -622,6 +622,7 @@ openvzDomainShutdownFlags(virDomainPtr dom,
 cleanup:
     if (vm)
         virDomainObjUnlock(vm);
+    openvzDriverUnlock(driver);
     return ret;
 }
 
@@ -1033,7 +1034,8 @@ openvzDomainCreateXML(virConnectPtr conn, const char *xml,
     }
 
     vm->pid = strtoI(vm->def->name);
-    vm->def->id = vm->pid;
+    if (virDomainObjListSetID(&driver->domains, vm, vm->pid) < 0)
+        goto cleanup;
     virDomainObjSetState(vm, VIR_DOMAIN_RUNNING, VIR_DOMAIN_RUNNING_BOOTED);
 
     if (vm->def->maxvcpus > 0) {
@@ -1067,9 +1069,9 @@ openvzDomainCreateWithFlags(virDomainPtr dom, unsigned int flags)
 
     virCheckFlags(0, -1);
 
+    /* Keep the driver locked, as the domain gets an ID */
     openvzDriverLock(driver);
     vm = virDomainFindByName(&driver->domains, dom->name);
-    openvzDriverUnlock(driver);
 
     if (!vm) {
         openvzError(VIR_ERR_NO_DOMAIN, "%s",
@@ -1092,7 +1094,8 @@ openvzDomainCreateWithFlags(virDomainPtr dom, unsigned int flags)
     }
 
     vm->pid = strtoI(vm->def->name);
-    vm->def->id = vm->pid;
+    if (virDomainObjListSetID(&driver->domains, vm, vm->pid) < 0)
+        goto cleanup;
     dom->id = vm->pid;
     virDomainObjSetState(vm, VIR_DOMAIN_RUNNING, VIR_DOMAIN_RUNNING_BOOTED);
     ret = 0;
@@ -1100,6 +1103,7 @@ openvzDomainCreateWithFlags(virDomainPtr dom, unsigned int flags)
 cleanup:
     if (vm)
         virDomainObjUnlock(vm);
+    openvzDriverUnlock(driver);
     return ret;
 }
 
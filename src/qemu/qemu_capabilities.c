@@ -35,6 +35,10 @@
 #include "qemu_conf.h"
 #include "command.h"
 #include "virnodesuspend.h"
+#include "virhash.h"
+#include "threads.h"
+#include "xml.h"
+#include "buf.h"
 
 #include <sys/stat.h>
 #include <unistd.h>
@@ -1459,9 +1463,14 @@ qemuCapsParseDeviceStr(const char *str, virBitmapPtr flags)
     return 0;
 }
 
-int qemuCapsExtractVersionInfo(const char *qemu, const char *arch,
-                               unsigned int *retversion,
-                               virBitmapPtr *retflags)
+/*
+ * Run @qemu to discover its version and capability flags. The
+ * result only depends on the binary itself, not on the guest arch.
+ */
+static int
+qemuCapsProbeVersionInfo(const char *qemu,
+                         unsigned int *retversion,
+                         virBitmapPtr *retflags)
 {
     int ret = -1;
     unsigned int version, is_kvm, kvm_version;
@@ -1469,20 +1478,6 @@ int qemuCapsExtractVersionInfo(const char *qemu, const char *arch,
     char *help = NULL;
     virCommandPtr cmd;
 
-    if (retflags)
-        *retflags = NULL;
-    if (retversion)
-        *retversion = 0;
-
-    /* Make sure the binary we are about to try exec'ing exists.
-     * Technically we could catch the exec() failure, but that's
-     * in a sub-process so it's hard to feed back a useful error.
-     */
-    if (!virFileIsExecutable(qemu)) {
-        virReportSystemError(errno, _("Cannot find QEMU binary %s"), qemu);
-        return -1;
-    }
-
     cmd = qemuCapsProbeCommand(qemu, NULL);
     virCommandAddArgList(cmd, "-help", NULL);
     virCommandSetOutputBuffer(cmd, &help);
@@ -1495,12 +1490,6 @@ int qemuCapsExtractVersionInfo(const char *qemu, const char *arch,
                              &version, &is_kvm, &kvm_version, true) == -1)
         goto cleanup;
 
-    /* Currently only x86_64 and i686 support PCI-multibus. */
-    if (STREQLEN(arch, "x86_64", 6) ||
-        STREQLEN(arch, "i686", 4)) {
-        qemuCapsSet(flags, QEMU_CAPS_PCI_MULTIBUS);
-    }
-
     /* qemuCapsExtractDeviceStr will only set additional flags if qemu
      * understands the 0.13.0+ notion of "-device driver,".  */
     if (qemuCapsGet(flags, QEMU_CAPS_DEVICE) &&
@@ -1508,12 +1497,9 @@ int qemuCapsExtractVersionInfo(const char *qemu, const char *arch,
         qemuCapsExtractDeviceStr(qemu, flags) < 0)
         goto cleanup;
 
-    if (retversion)
-        *retversion = version;
-    if (retflags) {
-        *retflags = flags;
-        flags = NULL;
-    }
+    *retversion = version;
+    *retflags = flags;
+    flags = NULL;
 
     ret = 0;
 
@@ -1525,6 +1511,528 @@ cleanup:
     return ret;
 }
 
+
+/*
+ * Probing a binary costs several fork+exec of a large program,
+ * which dominates the time needed to start a guest. The result
+ * is therefore cached in memory, and on disk so that it survives
+ * daemon restarts, keyed on the binary path. An entry is only
+ * trusted as long as the stat() identity of the binary is
+ * unchanged, and, on disk, as long as the build of libvirt and the
+ * environment the probes run with are those which wrote it.
+ */
+typedef struct _qemuCapsCacheEntry qemuCapsCacheEntry;
+typedef qemuCapsCacheEntry *qemuCapsCacheEntryPtr;
+struct _qemuCapsCacheEntry {
+    char *binary;
+    unsigned long long dev;
+    unsigned long long ino;
+    unsigned long long size;
+    long long mtime;
+    long long ctime;
+
+    unsigned int version;
+    virBitmapPtr flags;
+};
+
+static virMutex qemuCapsCacheLock;
+static virHashTablePtr qemuCapsCache = NULL;
+static char *qemuCapsCacheDir = NULL;
+static char *qemuCapsCacheBuild = NULL;
+
+
+static void
+qemuCapsCacheEntryFree(qemuCapsCacheEntryPtr entry)
+{
+    if (!entry)
+        return;
+
+    VIR_FREE(entry->binary);
+    qemuCapsFree(entry->flags);
+    VIR_FREE(entry);
+}
+
+static void
+qemuCapsCacheEntryDataFree(void *payload, const void *name ATTRIBUTE_UNUSED)
+{
+    qemuCapsCacheEntryFree(payload);
+}
+
+static qemuCapsCacheEntryPtr
+qemuCapsCacheEntryNew(const char *binary,
+                      const struct stat *sb)
+{
+    qemuCapsCacheEntryPtr entry;
+
+    if (VIR_ALLOC(entry) < 0 ||
+        !(entry->binary = strdup(binary))) {
+        virReportOOMError();
+        qemuCapsCacheEntryFree(entry);
+        return NULL;
+    }
+
+    entry->dev = sb->st_dev;
+    entry->ino = sb->st_ino;
+    entry->size = sb->st_size;
+    entry->mtime = sb->st_mtime;
+    entry->ctime = sb->st_ctime;
+
+    return entry;
+}
+
+static bool
+qemuCapsCacheEntryIsValid(qemuCapsCacheEntryPtr entry,
+                          const struct stat *sb)
+{
+    return entry->dev == sb->st_dev &&
+        entry->ino == sb->st_ino &&
+        entry->size == sb->st_size &&
+        entry->mtime == sb->st_mtime &&
+        entry->ctime == sb->st_ctime;
+}
+
+static char *
+qemuCapsCacheEntryPath(const char *binary)
+{
+    char *path;
+    char *p;
+
+    if (virAsprintf(&path, "%s/%s.xml", qemuCapsCacheDir, binary) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    /* Flatten the binary path into a single file name; clashes
+     * are harmless since the binary is recorded in the file too */
+    for (p = path + strlen(qemuCapsCacheDir) + 1 ; *p ; p++) {
+        if (*p == '/')
+            *p = '_';
+    }
+
+    return path;
+}
+
+
+/*
+ * Load the entry for @binary from disk, returning NULL if there
+ * is none or if it is out of date with respect to @sb.
+ */
+static qemuCapsCacheEntryPtr
+qemuCapsCacheEntryLoad(const char *binary,
+                       const struct stat *sb)
+{
+    qemuCapsCacheEntryPtr entry = NULL;
+    xmlDocPtr xml = NULL;
+    xmlXPathContextPtr ctxt = NULL;
+    xmlNodePtr *nodes = NULL;
+    char *path = NULL;
+    char *str = NULL;
+    unsigned long long version;
+    virErrorPtr err;
+    int n, i;
+
+    if (!(path = qemuCapsCacheEntryPath(binary)))
+        goto error;
+
+    if (!virFileExists(path))
+        goto cleanup;
+
+    if (!(xml = virXMLParseFileCtxt(path, &ctxt)))
+        goto error;
+
+    if (!xmlStrEqual(ctxt->node->name, BAD_CAST "qemuCaps")) {
+        qemuReportError(VIR_ERR_INTERNAL_ERROR,
+                        _("unexpected root element <%s> in %s"),
+                        ctxt->node->name, path);
+        goto error;
+    }
+
+    str = virXPathString("string(./@libvirtBuild)", ctxt);
+    if (STRNEQ_NULLABLE(str, qemuCapsCacheBuild)) {
+        VIR_DEBUG("Ignoring %s written by libvirt build %s",
+                  path, NULLSTR(str));
+        goto cleanup;
+    }
+    VIR_FREE(str);
+
+    str = virXPathString("string(./@binary)", ctxt);
+    if (STRNEQ_NULLABLE(str, binary)) {
+        VIR_DEBUG("Ignoring %s describing binary %s", path, NULLSTR(str));
+        goto cleanup;
+    }
+    VIR_FREE(str);
+
+    if (VIR_ALLOC(entry) < 0 ||
+        !(entry->binary = strdup(binary))) {
+        virReportOOMError();
+        goto error;
+    }
+
+    if (virXPathULongLong("string(./stat/@dev)", ctxt, &entry->dev) < 0 ||
+        virXPathULongLong("string(./stat/@ino)", ctxt, &entry->ino) < 0 ||
+        virXPathULongLong("string(./stat/@size)", ctxt, &entry->size) < 0 ||
+        virXPathLongLong("string(./stat/@mtime)", ctxt, &entry->mtime) < 0 ||
+        virXPathLongLong("string(./stat/@ctime)", ctxt, &entry->ctime) < 0 ||
+        virXPathULongLong("string(./version)", ctxt, &version) < 0) {
+        qemuReportError(VIR_ERR_INTERNAL_ERROR,
+                        _("malformed capabilities cache file %s"), path);
+        goto error;
+    }
+    entry->version = version;
+
+    if (!qemuCapsCacheEntryIsValid(entry, sb)) {
+        VIR_DEBUG("Binary %s changed since %s was written", binary, path);
+        qemuCapsCacheEntryFree(entry);
+        entry = NULL;
+        goto cleanup;
+    }
+
+    if (!(entry->flags = qemuCapsNew()))
+        goto error;
+
+    if ((n = virXPathNodeSet("./flag", ctxt, &nodes)) < 0)
+        goto error;
+
+    for (i = 0 ; i < n ; i++) {
+        int flag;
+
+        if (!(str = virXMLPropString(nodes[i], "name")) ||
+            (flag = qemuCapsTypeFromString(str)) < 0) {
+            qemuReportError(VIR_ERR_INTERNAL_ERROR,
+                            _("Unknown qemu capabilities flag %s in %s"),
+                            NULLSTR(str), path);
+            goto error;
+        }
+        VIR_FREE(str);
+        qemuCapsSet(entry->flags, flag);
+    }
+
+cleanup:
+    VIR_FREE(nodes);
+    VIR_FREE(str);
+    VIR_FREE(path);
+    xmlXPathFreeContext(ctxt);
+    xmlFreeDoc(xml);
+    return entry;
+
+error:
+    /* A broken cache file only means we have to probe again */
+    err = virGetLastError();
+    VIR_WARN("Unable to load cached capabilities for %s: %s",
+             binary, err ? err->message : _("unknown error"));
+    virResetLastError();
+    qemuCapsCacheEntryFree(entry);
+    entry = NULL;
+    goto cleanup;
+}
+
+
+static void
+qemuCapsCacheEntrySave(qemuCapsCacheEntryPtr entry)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *path = NULL;
+    char *xml = NULL;
+    virErrorPtr err;
+    int i;
+
+    virBufferEscapeString(&buf, "<qemuCaps binary='%s'", entry->binary);
+    virBufferEscapeString(&buf, " libvirtBuild='%s'>\n", qemuCapsCacheBuild);
+    virBufferAsprintf(&buf,
+                      "  <stat dev='%llu' ino='%llu' size='%llu'"
+                      " mtime='%lld' ctime='%lld'/>\n",
+                      entry->dev, entry->ino, entry->size,
+                      entry->mtime, entry->ctime);
+    virBufferAsprintf(&buf, "  <version>%u</version>\n", entry->version);
+    for (i = 0 ; i < QEMU_CAPS_LAST ; i++) {
+        if (qemuCapsGet(entry->flags, i))
+            virBufferAsprintf(&buf, "  <flag name='%s'/>\n",
+                              qemuCapsTypeToString(i));
+    }
+    virBufferAddLit(&buf, "</qemuCaps>\n");
+
+    if (virBufferError(&buf)) {
+        virBufferFreeAndReset(&buf);
+        virReportOOMError();
+        goto error;
+    }
+    xml = virBufferContentAndReset(&buf);
+
+    if (!(path = qemuCapsCacheEntryPath(entry->binary)))
+        goto error;
+
+    if (virXMLSaveFile(path, NULL, NULL, xml) < 0) {
+        virReportSystemError(errno, _("cannot write %s"), path);
+        goto error;
+    }
+
+cleanup:
+    VIR_FREE(path);
+    VIR_FREE(xml);
+    return;
+
+error:
+    /* Not fatal, the entry is still cached in memory */
+    err = virGetLastError();
+    VIR_WARN("Unable to save cached capabilities for %s: %s",
+             entry->binary, err ? err->message : _("unknown error"));
+    virResetLastError();
+    goto cleanup;
+}
+
+
+/*
+ * Return the entry cached for @qemu, loading it from disk if needed,
+ * or NULL if there is none up to date with respect to @sb. The cache
+ * lock must be held.
+ */
+static qemuCapsCacheEntryPtr
+qemuCapsCacheGetLocked(const char *qemu,
+                       const struct stat *sb)
+{
+    qemuCapsCacheEntryPtr entry;
+
+    entry = virHashLookup(qemuCapsCache, qemu);
+    if (entry && !qemuCapsCacheEntryIsValid(entry, sb)) {
+        VIR_DEBUG("Binary %s changed, discarding cached capabilities", qemu);
+        virHashRemoveEntry(qemuCapsCache, qemu);
+        entry = NULL;
+    }
+
+    if (!entry && qemuCapsCacheDir &&
+        (entry = qemuCapsCacheEntryLoad(qemu, sb))) {
+        if (virHashAddEntry(qemuCapsCache, qemu, entry) < 0) {
+            qemuCapsCacheEntryFree(entry);
+            virResetLastError();
+            return NULL;
+        }
+    }
+
+    return entry;
+}
+
+static int
+qemuCapsCacheEntryGet(qemuCapsCacheEntryPtr entry,
+                      unsigned int *retversion,
+                      virBitmapPtr *retflags)
+{
+    virBitmapPtr flags;
+    int i;
+
+    /* Callers are free to modify the flags they get */
+    if (!(flags = qemuCapsNew()))
+        return -1;
+    for (i = 0 ; i < QEMU_CAPS_LAST ; i++) {
+        if (qemuCapsGet(entry->flags, i))
+            qemuCapsSet(flags, i);
+    }
+
+    *retversion = entry->version;
+    *retflags = flags;
+    return 0;
+}
+
+/*
+ * Fill @retversion and @retflags for @qemu, from the cache if
+ * it holds up to date data, probing the binary otherwise.
+ */
+static int
+qemuCapsCacheLookup(const char *qemu,
+                    unsigned int *retversion,
+                    virBitmapPtr *retflags)
+{
+    qemuCapsCacheEntryPtr entry;
+    qemuCapsCacheEntryPtr probed = NULL;
+    struct stat sb;
+    int ret = -1;
+
+    if (!qemuCapsCache || stat(qemu, &sb) < 0)
+        return qemuCapsProbeVersionInfo(qemu, retversion, retflags);
+
+    virMutexLock(&qemuCapsCacheLock);
+    if ((entry = qemuCapsCacheGetLocked(qemu, &sb))) {
+        VIR_DEBUG("Using cached capabilities for %s", qemu);
+        ret = qemuCapsCacheEntryGet(entry, retversion, retflags);
+    }
+    virMutexUnlock(&qemuCapsCacheLock);
+
+    if (entry)
+        return ret;
+
+    /* Probing takes a while, so it's done without the lock, not to
+     * hold up guests using other binaries. Guests starting at once
+     * with the same binary may then each probe it, the first result
+     * to come back is kept */
+    if (!(probed = qemuCapsCacheEntryNew(qemu, &sb)) ||
+        qemuCapsProbeVersionInfo(qemu, &probed->version,
+                                 &probed->flags) < 0) {
+        qemuCapsCacheEntryFree(probed);
+        return -1;
+    }
+
+    virMutexLock(&qemuCapsCacheLock);
+
+    entry = virHashLookup(qemuCapsCache, qemu);
+    if (entry && qemuCapsCacheEntryIsValid(entry, &sb)) {
+        qemuCapsCacheEntryFree(probed);
+    } else if (virHashUpdateEntry(qemuCapsCache, qemu, probed) < 0) {
+        /* Not fatal, the binary just gets probed again next time */
+        virResetLastError();
+        entry = probed;
+    } else {
+        entry = probed;
+        probed = NULL;
+        if (qemuCapsCacheDir)
+            qemuCapsCacheEntrySave(entry);
+    }
+
+    ret = qemuCapsCacheEntryGet(entry, retversion, retflags);
+
+    virMutexUnlock(&qemuCapsCacheLock);
+    qemuCapsCacheEntryFree(probed);
+    return ret;
+}
+
+
+/*
+ * Describe what, besides the binary, determines the result of
+ * probing it: the libvirt build doing the parsing, down to its
+ * compile time options, and the libraries the probes may load.
+ */
+static char *
+qemuCapsCacheBuildID(void)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    struct stat sb;
+
+    virBufferAsprintf(&buf, "%s-%d", VERSION, QEMU_CAPS_LAST);
+#if HAVE_YAJL
+    virBufferAddLit(&buf, "-yajl");
+#endif
+
+    /* Rebuilds of the same version, with patches applied */
+    if (stat("/proc/self/exe", &sb) == 0)
+        virBufferAsprintf(&buf, "-%lld", (long long)sb.st_ctime);
+
+    /* As passed on to the probes by qemuCapsProbeCommand */
+    virBufferAsprintf(&buf, "-%s-%s",
+                      NULLSTR(getenv("LD_PRELOAD")),
+                      NULLSTR(getenv("LD_LIBRARY_PATH")));
+
+    if (virBufferError(&buf)) {
+        virBufferFreeAndReset(&buf);
+        virReportOOMError();
+        return NULL;
+    }
+
+    return virBufferContentAndReset(&buf);
+}
+
+
+/**
+ * qemuCapsCacheInit:
+ * @cacheDir: directory to persist probed capabilities in, or NULL
+ *
+ * Enable caching of the results of qemuCapsExtractVersionInfo,
+ * in memory and, if @cacheDir is not NULL, on disk.
+ *
+ * Returns 0 on success, -1 on error
+ */
+int
+qemuCapsCacheInit(const char *cacheDir)
+{
+    if (virMutexInit(&qemuCapsCacheLock) < 0) {
+        qemuReportError(VIR_ERR_INTERNAL_ERROR,
+                        "%s", _("cannot initialize mutex"));
+        return -1;
+    }
+
+    if (!(qemuCapsCache = virHashCreate(10, qemuCapsCacheEntryDataFree)))
+        goto error;
+
+    if (cacheDir) {
+        if (!(qemuCapsCacheBuild = qemuCapsCacheBuildID()))
+            goto error;
+
+        if (virAsprintf(&qemuCapsCacheDir, "%s/capabilities", cacheDir) < 0) {
+            virReportOOMError();
+            goto error;
+        }
+
+        if (virFileMakePath(qemuCapsCacheDir) < 0) {
+            /* Keep going with an in-memory only cache */
+            char ebuf[1024];
+            VIR_WARN("Failed to create capabilities cache dir '%s': %s",
+                     qemuCapsCacheDir, virStrerror(errno, ebuf, sizeof(ebuf)));
+            VIR_FREE(qemuCapsCacheDir);
+        }
+    }
+
+    return 0;
+
+error:
+    qemuCapsCacheFree();
+    return -1;
+}
+
+
+/**
+ * qemuCapsCacheFree:
+ *
+ * Release all data cached by qemuCapsCacheInit. Persisted
+ * data is kept on disk.
+ */
+void
+qemuCapsCacheFree(void)
+{
+    virHashFree(qemuCapsCache);
+    qemuCapsCache = NULL;
+    VIR_FREE(qemuCapsCacheDir);
+    VIR_FREE(qemuCapsCacheBuild);
+    virMutexDestroy(&qemuCapsCacheLock);
+}
+
+
+int qemuCapsExtractVersionInfo(const char *qemu, const char *arch,
+                               unsigned int *retversion,
+                               virBitmapPtr *retflags)
+{
+    unsigned int version;
+    virBitmapPtr flags = NULL;
+
+    if (retflags)
+        *retflags = NULL;
+    if (retversion)
+        *retversion = 0;
+
+    /* Make sure the binary we are about to try exec'ing exists.
+     * Technically we could catch the exec() failure, but that's
+     * in a sub-process so it's hard to feed back a useful error.
+     */
+    if (!virFileIsExecutable(qemu)) {
+        virReportSystemError(errno, _("Cannot find QEMU binary %s"), qemu);
+        return -1;
+    }
+
+    if (qemuCapsCacheLookup(qemu, &version, &flags) < 0)
+        return -1;
+
+    /* Currently only x86_64 and i686 support PCI-multibus. */
+    if (STREQLEN(arch, "x86_64", 6) ||
+        STREQLEN(arch, "i686", 4)) {
+        qemuCapsSet(flags, QEMU_CAPS_PCI_MULTIBUS);
+    }
+
+    if (retversion)
+        *retversion = version;
+    if (retflags)
+        *retflags = flags;
+    else
+        qemuCapsFree(flags);
+
+    return 0;
+}
+
 static void
 uname_normalize (struct utsname *ut)
 {
@@ -161,6 +161,9 @@ int qemuCapsProbeCPUModels(const char *qemu,
                            unsigned int *count,
                            const char ***cpus);
 
+int qemuCapsCacheInit(const char *cacheDir);
+void qemuCapsCacheFree(void);
+
 int qemuCapsExtractVersion(virCapsPtr caps,
                            unsigned int *version);
 int qemuCapsExtractVersionInfo(const char *qemu, const char *arch,
@@ -193,9 +193,42 @@ int qemuSetupHostUsbDeviceCgroup(usbDevice *dev ATTRIBUTE_UNUSED,
     return 0;
 }
 
+/*
+ * Looks up the cgroup of @vm once and keeps it in its private data
+ * until qemuRemoveCgroup, rather than detecting the group again for
+ * every API call. The group in @cgroup belongs to @vm and is not to
+ * be freed by the caller. Nor is it to be used after entering the
+ * monitor, which lets the domain stop and its cgroup be freed: code
+ * spanning a monitor call is to look up a group of its own with
+ * virCgroupForDomain.
+ *
+ * Returns 0 on success, -errno like virCgroupForDomain otherwise.
+ */
+int qemuGetCgroup(struct qemud_driver *driver,
+                  virDomainObjPtr vm,
+                  virCgroupPtr *cgroup)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    int rc;
+
+    *cgroup = NULL;
+
+    if (driver->cgroup == NULL)
+        return -ENXIO;
+
+    if (!priv->cgroup &&
+        (rc = virCgroupForDomain(driver->cgroup, vm->def->name,
+                                 &priv->cgroup, 0)) != 0)
+        return rc;
+
+    *cgroup = priv->cgroup;
+    return 0;
+}
+
 int qemuSetupCgroup(struct qemud_driver *driver,
                     virDomainObjPtr vm)
 {
+    qemuDomainObjPrivatePtr priv = vm->privateData;
     virCgroupPtr cgroup = NULL;
     int rc;
     unsigned int i;
@@ -411,7 +444,8 @@ int qemuSetupCgroup(struct qemud_driver *driver,
         }
     }
 done:
-    virCgroupFree(&cgroup);
+    virCgroupFree(&priv->cgroup);
+    priv->cgroup = cgroup;
     return 0;
 
 cleanup:
@@ -485,7 +519,7 @@ int qemuSetupCgroupForVcpu(struct qemud_driver *driver, virDomainObjPtr vm)
     if (driver->cgroup == NULL)
         return 0; /* Not supported, so claim success */
 
-    rc = virCgroupForDomain(driver->cgroup, vm->def->name, &cgroup, 0);
+    rc = qemuGetCgroup(driver, vm, &cgroup);
     if (rc != 0) {
         virReportSystemError(-rc,
                              _("Unable to find cgroup for %s"),
@@ -517,7 +551,6 @@ int qemuSetupCgroupForVcpu(struct qemud_driver *driver, virDomainObjPtr vm)
         /* If we does not know VCPU<->PID mapping or all vcpu runs in the same
          * thread, we cannot control each vcpu.
          */
-        virCgroupFree(&cgroup);
         return 0;
     }
 
@@ -551,14 +584,13 @@ int qemuSetupCgroupForVcpu(struct qemud_driver *driver, virDomainObjPtr vm)
     }
 
     virCgroupFree(&cgroup_vcpu);
-    virCgroupFree(&cgroup);
     return 0;
 
 cleanup:
     virCgroupFree(&cgroup_vcpu);
     if (cgroup) {
         virCgroupRemove(cgroup);
-        virCgroupFree(&cgroup);
+        virCgroupFree(&priv->cgroup);
     }
 
     return -1;
@@ -569,13 +601,14 @@ int qemuRemoveCgroup(struct qemud_driver *driver,
                      virDomainObjPtr vm,
                      int quiet)
 {
+    qemuDomainObjPrivatePtr priv = vm->privateData;
     virCgroupPtr cgroup;
     int rc;
 
     if (driver->cgroup == NULL)
         return 0; /* Not supported, so claim success */
 
-    rc = virCgroupForDomain(driver->cgroup, vm->def->name, &cgroup, 0);
+    rc = qemuGetCgroup(driver, vm, &cgroup);
     if (rc != 0) {
         if (!quiet)
             qemuReportError(VIR_ERR_INTERNAL_ERROR,
@@ -585,39 +618,39 @@ int qemuRemoveCgroup(struct qemud_driver *driver,
     }
 
     rc = virCgroupRemove(cgroup);
-    virCgroupFree(&cgroup);
+    virCgroupFree(&priv->cgroup);
     return rc;
 }
 
+/*
+ * Runs in the child forked for QEMU, which must not look the group
+ * up again: the cache of cgroup mounts may have been locked by another
+ * thread of the daemon at fork time. qemuSetupCgroup already left the
+ * group in the private data of @vm, which the child inherits.
+ */
 int qemuAddToCgroup(struct qemud_driver *driver,
-                    virDomainDefPtr def)
+                    virDomainObjPtr vm)
 {
-    virCgroupPtr cgroup = NULL;
-    int ret = -1;
+    qemuDomainObjPrivatePtr priv = vm->privateData;
     int rc;
 
     if (driver->cgroup == NULL)
         return 0; /* Not supported, so claim success */
 
-    rc = virCgroupForDomain(driver->cgroup, def->name, &cgroup, 0);
-    if (rc != 0) {
-        virReportSystemError(-rc,
-                             _("unable to find cgroup for domain %s"),
-                             def->name);
-        goto cleanup;
+    if (!priv->cgroup) {
+        qemuReportError(VIR_ERR_INTERNAL_ERROR,
+                        _("cgroup for domain %s was not set up"),
+                        vm->def->name);
+        return -1;
     }
 
-    rc = virCgroupAddTask(cgroup, getpid());
+    rc = virCgroupAddTask(priv->cgroup, getpid());
     if (rc != 0) {
         virReportSystemError(-rc,
                              _("unable to add domain %s task %d to cgroup"),
-                             def->name, getpid());
-        goto cleanup;
+                             vm->def->name, getpid());
+        return -1;
     }
 
-    ret = 0;
-
-cleanup:
-    virCgroupFree(&cgroup);
-    return ret;
+    return 0;
 }
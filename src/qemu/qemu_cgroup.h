@@ -47,6 +47,9 @@ int qemuTeardownDiskCgroup(struct qemud_driver *driver,
 int qemuSetupHostUsbDeviceCgroup(usbDevice *dev,
                                  const char *path,
                                  void *opaque);
+int qemuGetCgroup(struct qemud_driver *driver,
+                  virDomainObjPtr vm,
+                  virCgroupPtr *cgroup);
 int qemuSetupCgroup(struct qemud_driver *driver,
                     virDomainObjPtr vm);
 int qemuSetupCgroupVcpuBW(virCgroupPtr cgroup,
@@ -57,6 +60,6 @@ int qemuRemoveCgroup(struct qemud_driver *driver,
                      virDomainObjPtr vm,
                      int quiet);
 int qemuAddToCgroup(struct qemud_driver *driver,
-                    virDomainDefPtr def);
+                    virDomainObjPtr vm);
 
 #endif /* __QEMU_CGROUP_H__ */
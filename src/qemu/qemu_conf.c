@@ -124,6 +124,9 @@ int qemudLoadDriverConfig(struct qemud_driver *driver,
 
     driver->keepAliveInterval = 5;
     driver->keepAliveCount = 5;
+    driver->migrationPollInterval = 500;
+    driver->maxStartupWorkers = 4;
+    driver->statsCacheTime = 1000;
 
     /* Just check the file is readable before opening it, otherwise
      * libvirt emits an error.
@@ -492,6 +495,42 @@ int qemudLoadDriverConfig(struct qemud_driver *driver,
     CHECK_TYPE("keepalive_count", VIR_CONF_LONG);
     if (p) driver->keepAliveCount = p->l;
 
+    p = virConfGetValue(conf, "migration_poll_interval");
+    CHECK_TYPE("migration_poll_interval", VIR_CONF_LONG);
+    if (p) {
+        if (p->l <= 0) {
+            qemuReportError(VIR_ERR_CONF_SYNTAX, "%s",
+                            _("migration_poll_interval must be positive"));
+            virConfFree(conf);
+            return -1;
+        }
+        driver->migrationPollInterval = p->l;
+    }
+
+    p = virConfGetValue(conf, "max_startup_workers");
+    CHECK_TYPE("max_startup_workers", VIR_CONF_LONG);
+    if (p) {
+        if (p->l <= 0) {
+            qemuReportError(VIR_ERR_CONF_SYNTAX, "%s",
+                            _("max_startup_workers must be positive"));
+            virConfFree(conf);
+            return -1;
+        }
+        driver->maxStartupWorkers = p->l;
+    }
+
+    p = virConfGetValue(conf, "stats_cache_time");
+    CHECK_TYPE("stats_cache_time", VIR_CONF_LONG);
+    if (p) {
+        if (p->l < 0) {
+            qemuReportError(VIR_ERR_CONF_SYNTAX, "%s",
+                            _("stats_cache_time must not be negative"));
+            virConfFree(conf);
+            return -1;
+        }
+        driver->statsCacheTime = p->l;
+    }
+
     virConfFree (conf);
     return 0;
 }
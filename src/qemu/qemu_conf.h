@@ -150,6 +150,19 @@ struct qemud_driver {
 
     int keepAliveInterval;
     unsigned int keepAliveCount;
+
+    /* Longest interval between migration status queries, in ms */
+    unsigned int migrationPollInterval;
+
+    /* Most domains autostarted at once */
+    unsigned int maxStartupWorkers;
+
+    /* How long statistics queried from QEMU are reused, in ms */
+    unsigned int statsCacheTime;
+
+    /* Domains still reconnecting since reconnectStart, in ms */
+    size_t reconnecting;
+    unsigned long long reconnectStart;
 };
 
 typedef struct _qemuDomainCmdlineDef qemuDomainCmdlineDef;
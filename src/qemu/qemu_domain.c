@@ -37,6 +37,7 @@
 #include "virfile.h"
 #include "domain_event.h"
 #include "virtime.h"
+#include "virprocstat.h"
 
 #include <sys/time.h>
 #include <fcntl.h>
@@ -138,6 +139,12 @@ qemuDomainObjInitJob(qemuDomainObjPrivatePtr priv)
         return -1;
     }
 
+    if (virCondInit(&priv->job.signalCond) < 0) {
+        ignore_value(virCondDestroy(&priv->job.cond));
+        ignore_value(virCondDestroy(&priv->job.asyncCond));
+        return -1;
+    }
+
     return 0;
 }
 
@@ -161,6 +168,7 @@ qemuDomainObjResetAsyncJob(qemuDomainObjPrivatePtr priv)
     job->mask = DEFAULT_JOB_MASK;
     job->start = 0;
     memset(&job->info, 0, sizeof(job->info));
+    job->signalled = false;
 }
 
 void
@@ -195,6 +203,7 @@ qemuDomainObjFreeJob(qemuDomainObjPrivatePtr priv)
 {
     ignore_value(virCondDestroy(&priv->job.cond));
     ignore_value(virCondDestroy(&priv->job.asyncCond));
+    ignore_value(virCondDestroy(&priv->job.signalCond));
 }
 
 static bool
@@ -218,6 +227,8 @@ static void *qemuDomainObjPrivateAlloc(void)
         goto error;
 
     priv->migMaxBandwidth = QEMU_DOMAIN_DEFAULT_MIG_BANDWIDTH_MAX;
+    priv->stats.balloonRet = -1;
+    priv->procStatFD = -1;
 
     return priv;
 
@@ -240,6 +251,9 @@ static void qemuDomainObjPrivateFree(void *data)
     VIR_FREE(priv->origname);
 
     virConsoleFree(priv->cons);
+    qemuDomainStatsCacheClear(priv);
+    qemuDomainProcStatClose(priv);
+    virCgroupFree(&priv->cgroup);
 
     /* This should never be non-NULL if we get here, but just in case... */
     if (priv->mon) {
@@ -639,6 +653,47 @@ qemuDomainDefNamespaceHref(void)
     return "xmlns:qemu='" QEMU_NAMESPACE_HREF "'";
 }
 
+static void *
+qemuDomainDefNamespaceCopy(void *nsdata)
+{
+    qemuDomainCmdlineDefPtr src = nsdata;
+    qemuDomainCmdlineDefPtr cmd = NULL;
+    unsigned int i;
+
+    if (VIR_ALLOC(cmd) < 0)
+        goto no_memory;
+
+    if (src->num_args && VIR_ALLOC_N(cmd->args, src->num_args) < 0)
+        goto no_memory;
+
+    for (i = 0; i < src->num_args; i++) {
+        if (!(cmd->args[i] = strdup(src->args[i])))
+            goto no_memory;
+        cmd->num_args++;
+    }
+
+    if (src->num_env &&
+        (VIR_ALLOC_N(cmd->env_name, src->num_env) < 0 ||
+         VIR_ALLOC_N(cmd->env_value, src->num_env) < 0))
+        goto no_memory;
+
+    for (i = 0; i < src->num_env; i++) {
+        cmd->num_env++;
+        if (!(cmd->env_name[i] = strdup(src->env_name[i])))
+            goto no_memory;
+        if (src->env_value[i] &&
+            !(cmd->env_value[i] = strdup(src->env_value[i])))
+            goto no_memory;
+    }
+
+    return cmd;
+
+no_memory:
+    virReportOOMError();
+    qemuDomainDefNamespaceFree(cmd);
+    return NULL;
+}
+
 
 void qemuDomainSetPrivateDataHooks(virCapsPtr caps)
 {
@@ -657,6 +712,7 @@ void qemuDomainSetNamespaceHooks(virCapsPtr caps)
     caps->ns.free = qemuDomainDefNamespaceFree;
     caps->ns.format = qemuDomainDefNamespaceFormatXML;
     caps->ns.href = qemuDomainDefNamespaceHref;
+    caps->ns.copy = qemuDomainDefNamespaceCopy;
 }
 
 static void
@@ -737,6 +793,75 @@ qemuDomainObjReleaseAsyncJob(virDomainObjPtr obj)
     priv->job.asyncOwner = 0;
 }
 
+/*
+ * obj must be locked before calling
+ *
+ * Wakes up the thread running an async job if it's waiting in
+ * qemuDomainObjWaitAsyncJobSignal, or makes its next wait return
+ * immediately. Used for events which may end the job, such as
+ * QEMU stopping guest CPUs at the end of a migration.
+ */
+void
+qemuDomainObjSignalAsyncJob(virDomainObjPtr obj)
+{
+    qemuDomainObjPrivatePtr priv = obj->privateData;
+
+    if (!priv->job.asyncJob)
+        return;
+
+    VIR_DEBUG("Signalling '%s' async job",
+              qemuDomainAsyncJobTypeToString(priv->job.asyncJob));
+    priv->job.signalled = true;
+    virCondSignal(&priv->job.signalCond);
+}
+
+/*
+ * obj and qemu_driver must be locked before calling, and are locked
+ * again upon return
+ *
+ * Waits for qemuDomainObjSignalAsyncJob to be called, for at
+ * most @timeout milliseconds.
+ *
+ * Returns 1 if signalled, 0 on timeout and -1 on error
+ */
+int
+qemuDomainObjWaitAsyncJobSignal(struct qemud_driver *driver,
+                                virDomainObjPtr obj,
+                                unsigned long long timeout)
+{
+    qemuDomainObjPrivatePtr priv = obj->privateData;
+    unsigned long long then;
+    int ret = 0;
+
+    if (virTimeMillisNow(&then) < 0)
+        return -1;
+    then += timeout;
+
+    qemuDriverUnlock(driver);
+
+    while (!priv->job.signalled) {
+        if (virCondWaitUntil(&priv->job.signalCond, &obj->lock, then) < 0) {
+            if (errno != ETIMEDOUT) {
+                virReportSystemError(errno, "%s",
+                                     _("cannot wait for job signal"));
+                ret = -1;
+            }
+            break;
+        }
+    }
+
+    if (priv->job.signalled) {
+        priv->job.signalled = false;
+        ret = 1;
+    }
+
+    virDomainObjUnlock(obj);
+    qemuDriverLock(driver);
+    virDomainObjLock(obj);
+
+    return ret;
+}
+
 static bool
 qemuDomainNestedJobAllowed(qemuDomainObjPrivatePtr priv, enum qemuDomainJob job)
 {
@@ -941,6 +1066,10 @@ int qemuDomainObjEndJob(struct qemud_driver *driver, virDomainObjPtr obj)
         qemuDomainObjSaveJob(driver, obj);
     virCondSignal(&priv->job.cond);
 
+    /* Anything but a query may have changed the devices or memory */
+    if (job != QEMU_JOB_QUERY)
+        qemuDomainStatsCacheClear(priv);
+
     return virDomainObjUnref(obj);
 }
 
@@ -958,6 +1087,8 @@ qemuDomainObjEndAsyncJob(struct qemud_driver *driver, virDomainObjPtr obj)
     qemuDomainObjSaveJob(driver, obj);
     virCondBroadcast(&priv->job.asyncCond);
 
+    qemuDomainStatsCacheClear(priv);
+
     return virDomainObjUnref(obj);
 }
 
@@ -1112,6 +1243,209 @@ void qemuDomainObjExitMonitorWithDriver(struct qemud_driver *driver,
 }
 
 
+/*
+ * Forget the statistics of the domain, so that they are queried from
+ * QEMU again the next time they are needed. obj must be locked.
+ */
+void
+qemuDomainStatsCacheClear(qemuDomainObjPrivatePtr priv)
+{
+    qemuDomainStatsCachePtr cache = &priv->stats;
+
+    cache->balloonTime = 0;
+    cache->balloonRet = -1;
+    cache->balloon = 0;
+
+    cache->blockStatsTime = 0;
+    virHashFree(cache->blockStats);
+    cache->blockStats = NULL;
+
+    cache->blockInfoTime = 0;
+    virHashFree(cache->blockInfo);
+    cache->blockInfo = NULL;
+}
+
+
+/*
+ * Returns where the /proc stat file of the domain's process is kept
+ * open, or of its vCPU thread @vcpu if not -1, for passing to
+ * virProcStatReadCached. Returns NULL if there's no memory to keep
+ * it. obj must be locked.
+ */
+int *
+qemuDomainProcStatFD(qemuDomainObjPrivatePtr priv, int vcpu)
+{
+    int i;
+
+    if (vcpu < 0)
+        return &priv->procStatFD;
+
+    if (vcpu >= priv->nvcpuStatFDs) {
+        if (VIR_REALLOC_N(priv->vcpuStatFDs, vcpu + 1) < 0)
+            return NULL;
+        for (i = priv->nvcpuStatFDs; i <= vcpu; i++)
+            priv->vcpuStatFDs[i] = -1;
+        priv->nvcpuStatFDs = vcpu + 1;
+    }
+
+    return &priv->vcpuStatFDs[vcpu];
+}
+
+/*
+ * Close the /proc stat files kept open, once the process or its vCPU
+ * threads are gone. obj must be locked.
+ */
+void
+qemuDomainProcStatClose(qemuDomainObjPrivatePtr priv)
+{
+    int i;
+
+    virProcStatClose(&priv->procStatFD);
+    for (i = 0; i < priv->nvcpuStatFDs; i++)
+        virProcStatClose(&priv->vcpuStatFDs[i]);
+    VIR_FREE(priv->vcpuStatFDs);
+    priv->nvcpuStatFDs = 0;
+}
+
+/* Whether the group queried at @when can still be used at @now */
+static bool
+qemuDomainStatsCacheValid(struct qemud_driver *driver,
+                          unsigned long long when,
+                          unsigned long long now)
+{
+    return when != 0 && now - when < driver->statsCacheTime;
+}
+
+static int
+qemuDomainUpdateStatsCacheInternal(struct qemud_driver *driver,
+                                   bool driver_locked,
+                                   virDomainObjPtr obj,
+                                   unsigned int groups)
+{
+    qemuDomainObjPrivatePtr priv = obj->privateData;
+    qemuDomainStatsCachePtr cache = &priv->stats;
+    unsigned long long now;
+    bool balloon = false;
+    bool blockStats = false;
+    bool blockInfo = false;
+    int balloonRet = -1;
+    unsigned long long currmem = 0;
+    virHashTablePtr stats = NULL;
+    virHashTablePtr info = NULL;
+    int ret = 0;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    if (groups & QEMU_DOMAIN_STATS_CACHE_BALLOON) {
+        if (qemuDomainStatsCacheValid(driver, cache->balloonTime, now)) {
+            cache->hits++;
+        } else {
+            cache->misses++;
+            balloon = true;
+        }
+    }
+    if (groups & QEMU_DOMAIN_STATS_CACHE_BLOCKSTATS) {
+        if (qemuDomainStatsCacheValid(driver, cache->blockStatsTime, now)) {
+            cache->hits++;
+        } else {
+            cache->misses++;
+            blockStats = true;
+        }
+    }
+    if (groups & QEMU_DOMAIN_STATS_CACHE_BLOCKINFO) {
+        if (qemuDomainStatsCacheValid(driver, cache->blockInfoTime, now)) {
+            cache->hits++;
+        } else {
+            cache->misses++;
+            blockInfo = true;
+        }
+    }
+
+    VIR_DEBUG("vm=%s groups=%x balloon=%d blockstats=%d blockinfo=%d "
+              "hits=%llu misses=%llu",
+              obj->def->name, groups, balloon, blockStats, blockInfo,
+              cache->hits, cache->misses);
+
+    if (!balloon && !blockStats && !blockInfo)
+        return 0;
+
+    ignore_value(qemuDomainObjEnterMonitorInternal(driver, driver_locked, obj,
+                                                   QEMU_ASYNC_JOB_NONE));
+    if ((balloon || blockStats) &&
+        qemuMonitorGetAllStatsInfo(priv->mon, &balloonRet,
+                                   balloon ? &currmem : NULL,
+                                   blockStats ? &stats : NULL) < 0)
+        ret = -1;
+    if (blockInfo && !(info = qemuMonitorGetBlockInfo(priv->mon)))
+        ret = -1;
+    qemuDomainObjExitMonitorInternal(driver, driver_locked, obj);
+
+    /* The results of a domain which died meanwhile are no use */
+    if (!virDomainObjIsActive(obj)) {
+        if (ret == 0)
+            qemuReportError(VIR_ERR_OPERATION_INVALID, "%s",
+                            _("domain is not running"));
+        virHashFree(stats);
+        virHashFree(info);
+        return -1;
+    }
+
+    /* Failures are not cached, the groups which couldn't be queried
+     * are left empty and asked for again next time */
+    if (balloon) {
+        cache->balloonTime = balloonRet < 0 ? 0 : now;
+        cache->balloonRet = balloonRet;
+        cache->balloon = currmem;
+    }
+    if (blockStats) {
+        virHashFree(cache->blockStats);
+        cache->blockStats = stats;
+        cache->blockStatsTime = stats ? now : 0;
+    }
+    if (blockInfo) {
+        virHashFree(cache->blockInfo);
+        cache->blockInfo = info;
+        cache->blockInfoTime = info ? now : 0;
+    }
+
+    return ret;
+}
+
+/*
+ * obj must be locked and active, with a job started using
+ * qemuDomainObjBeginJob(), and qemud_driver must be unlocked
+ *
+ * Makes sure the statistics @groups, a mask of qemuDomainStatsCacheGroup,
+ * in priv->stats are at most driver->statsCacheTime ms old, querying
+ * QEMU for the ones which are too old.
+ *
+ * Returns 0 on success, or -1 if any of the groups couldn't be queried,
+ * in which case it is left empty in the cache.
+ */
+int
+qemuDomainUpdateStatsCache(struct qemud_driver *driver,
+                           virDomainObjPtr obj,
+                           unsigned int groups)
+{
+    return qemuDomainUpdateStatsCacheInternal(driver, false, obj, groups);
+}
+
+/*
+ * obj and qemud_driver must be locked, obj must be active with a job
+ * started using qemuDomainObjBeginJobWithDriver()
+ *
+ * Same as qemuDomainUpdateStatsCache()
+ */
+int
+qemuDomainUpdateStatsCacheWithDriver(struct qemud_driver *driver,
+                                     virDomainObjPtr obj,
+                                     unsigned int groups)
+{
+    return qemuDomainUpdateStatsCacheInternal(driver, true, obj, groups);
+}
+
+
 
 static int
 qemuDomainObjEnterAgentInternal(struct qemud_driver *driver,
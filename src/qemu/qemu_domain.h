@@ -105,6 +105,33 @@ struct qemuDomainJobObj {
     unsigned long long mask;            /* Jobs allowed during async job */
     unsigned long long start;           /* When the async job started */
     virDomainJobInfo info;              /* Async job progress data */
+    virCond signalCond;                 /* Wakes up the async job thread */
+    bool signalled;                     /* signalCond was signalled */
+};
+
+/* Groups of statistics kept in qemuDomainStatsCache */
+enum qemuDomainStatsCacheGroup {
+    QEMU_DOMAIN_STATS_CACHE_BALLOON    = (1 << 0), /* query-balloon */
+    QEMU_DOMAIN_STATS_CACHE_BLOCKSTATS = (1 << 1), /* query-blockstats */
+    QEMU_DOMAIN_STATS_CACHE_BLOCKINFO  = (1 << 2), /* query-block */
+};
+
+/* Statistics last queried from the monitor, reused for
+ * driver->statsCacheTime ms by every API asking for them */
+typedef struct _qemuDomainStatsCache qemuDomainStatsCache;
+typedef qemuDomainStatsCache *qemuDomainStatsCachePtr;
+struct _qemuDomainStatsCache {
+    unsigned long long balloonTime;     /* When each group was queried, */
+    unsigned long long blockStatsTime;  /* 0 if it is not cached */
+    unsigned long long blockInfoTime;
+
+    int balloonRet;                     /* qemuMonitorGetBalloonInfo() */
+    unsigned long long balloon;
+    virHashTablePtr blockStats;         /* alias -> qemuBlockStats */
+    virHashTablePtr blockInfo;          /* alias -> qemuDomainDiskInfo */
+
+    unsigned long long hits;            /* Groups served from the cache */
+    unsigned long long misses;          /* Groups queried from QEMU */
 };
 
 typedef struct _qemuDomainPCIAddressSet qemuDomainPCIAddressSet;
@@ -135,6 +162,12 @@ struct _qemuDomainObjPrivate {
     int nvcpupids;
     int *vcpupids;
 
+    /* /proc stat files of the process and of its vCPU threads, kept
+     * open between samples by qemuDomainProcStatFD */
+    int procStatFD;
+    int nvcpuStatFDs;
+    int *vcpuStatFDs;
+
     qemuDomainPCIAddressSetPtr pciaddrs;
     int persistentAddrs;
 
@@ -153,6 +186,11 @@ struct _qemuDomainObjPrivate {
     qemuDomainCleanupCallback *cleanupCallbacks;
     size_t ncleanupCallbacks;
     size_t ncleanupCallbacks_max;
+
+    qemuDomainStatsCache stats;
+
+    /* Cgroup of the running domain, see qemuGetCgroup */
+    virCgroupPtr cgroup;
 };
 
 struct qemuDomainWatchdogEvent
@@ -209,6 +247,10 @@ void qemuDomainObjTransferJob(virDomainObjPtr obj);
 void qemuDomainObjDiscardAsyncJob(struct qemud_driver *driver,
                                   virDomainObjPtr obj);
 void qemuDomainObjReleaseAsyncJob(virDomainObjPtr obj);
+void qemuDomainObjSignalAsyncJob(virDomainObjPtr obj);
+int qemuDomainObjWaitAsyncJobSignal(struct qemud_driver *driver,
+                                    virDomainObjPtr obj,
+                                    unsigned long long timeout);
 
 void qemuDomainObjEnterMonitor(struct qemud_driver *driver,
                                virDomainObjPtr obj)
@@ -227,6 +269,22 @@ void qemuDomainObjExitMonitorWithDriver(struct qemud_driver *driver,
                                         virDomainObjPtr obj)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
 
+int qemuDomainUpdateStatsCache(struct qemud_driver *driver,
+                               virDomainObjPtr obj,
+                               unsigned int groups)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+int qemuDomainUpdateStatsCacheWithDriver(struct qemud_driver *driver,
+                                         virDomainObjPtr obj,
+                                         unsigned int groups)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+void qemuDomainStatsCacheClear(qemuDomainObjPrivatePtr priv)
+    ATTRIBUTE_NONNULL(1);
+
+int *qemuDomainProcStatFD(qemuDomainObjPrivatePtr priv, int vcpu)
+    ATTRIBUTE_NONNULL(1);
+void qemuDomainProcStatClose(qemuDomainObjPrivatePtr priv)
+    ATTRIBUTE_NONNULL(1);
+
 
 void qemuDomainObjEnterAgent(struct qemud_driver *driver,
                              virDomainObjPtr obj)
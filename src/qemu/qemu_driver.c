@@ -89,7 +89,9 @@
 #include "locking/lock_manager.h"
 #include "locking/domain_lock.h"
 #include "virkeycode.h"
+#include "virlz4.h"
 #include "virnodesuspend.h"
+#include "virprocstat.h"
 #include "virtime.h"
 #include "virtypedparam.h"
 
@@ -143,22 +145,37 @@ struct qemud_driver *qemu_driver = NULL;
 struct qemuAutostartData {
     struct qemud_driver *driver;
     virConnectPtr conn;
+
+    /* Domains to start, each with a reference held */
+    virDomainObjPtr *vms;
+    size_t nvms;
+
+    virMutex lock;
+    virCond done;
+    size_t pending;
 };
 
 static void
-qemuAutostartDomain(void *payload, const void *name ATTRIBUTE_UNUSED,
-                    void *opaque)
+qemuAutostartDomain(void *jobdata, void *opaque)
 {
-    virDomainObjPtr vm = payload;
+    virDomainObjPtr vm = jobdata;
     struct qemuAutostartData *data = opaque;
+    char uuidstr[VIR_UUID_STRING_BUFLEN];
     virErrorPtr err;
     int flags = 0;
 
     if (data->driver->autoStartBypassCache)
         flags |= VIR_DOMAIN_START_BYPASS_CACHE;
 
+    qemuDriverLock(data->driver);
     virDomainObjLock(vm);
     virResetLastError();
+
+    /* The domain may have been undefined while queued */
+    virUUIDFormat(vm->def->uuid, uuidstr);
+    if (virHashLookup(data->driver->domains.objs, uuidstr) != vm)
+        goto cleanup;
+
     if (vm->autostart &&
         !virDomainObjIsActive(vm)) {
         if (qemuDomainObjBeginJobWithDriver(data->driver, vm,
@@ -182,11 +199,41 @@ qemuAutostartDomain(void *payload, const void *name ATTRIBUTE_UNUSED,
     }
 
 cleanup:
-    if (vm)
+    if (vm && virDomainObjUnref(vm) > 0)
         virDomainObjUnlock(vm);
+    qemuDriverUnlock(data->driver);
+
+    virMutexLock(&data->lock);
+    if (--data->pending == 0)
+        virCondSignal(&data->done);
+    virMutexUnlock(&data->lock);
 }
 
+static void
+qemuAutostartCollect(void *payload, const void *name ATTRIBUTE_UNUSED,
+                     void *opaque)
+{
+    virDomainObjPtr vm = payload;
+    struct qemuAutostartData *data = opaque;
 
+    virDomainObjLock(vm);
+    if (vm->autostart &&
+        !virDomainObjIsActive(vm)) {
+        if (VIR_EXPAND_N(data->vms, data->nvms, 1) < 0) {
+            virReportOOMError();
+        } else {
+            virDomainObjRef(vm);
+            data->vms[data->nvms - 1] = vm;
+        }
+    }
+    virDomainObjUnlock(vm);
+}
+
+/*
+ * Start the domains marked for autostart, up to maxStartupWorkers of
+ * them at once. Starting a domain mostly waits for its QEMU process,
+ * during which the driver lock is released for the others to go on.
+ */
 static void
 qemuAutostartDomains(struct qemud_driver *driver)
 {
@@ -199,12 +246,70 @@ qemuAutostartDomains(struct qemud_driver *driver)
                                         "qemu:///system" :
                                         "qemu:///session");
     /* Ignoring NULL conn which is mostly harmless here */
-    struct qemuAutostartData data = { driver, conn };
+    struct qemuAutostartData data;
+    virThreadPoolPtr workers = NULL;
+    size_t i = 0;
 
+    memset(&data, 0, sizeof(data));
+    data.driver = driver;
+    data.conn = conn;
+
+    qemuDriverLock(driver);
+    virHashForEach(driver->domains.objs, qemuAutostartCollect, &data);
+    qemuDriverUnlock(driver);
+
+    if (data.nvms == 0)
+        goto cleanup;
+
+    if (virMutexInit(&data.lock) < 0) {
+        VIR_ERROR(_("Unable to initialize mutex"));
+        goto release;
+    }
+    if (virCondInit(&data.done) < 0) {
+        VIR_ERROR(_("Unable to initialize condition variable"));
+        virMutexDestroy(&data.lock);
+        goto release;
+    }
+
+    workers = virThreadPoolNew(0, MIN(data.nvms, driver->maxStartupWorkers),
+                               0, qemuAutostartDomain, &data);
+
+    virMutexLock(&data.lock);
+    for (; workers && i < data.nvms; i++) {
+        if (virThreadPoolSendJob(workers, 0, data.vms[i]) < 0)
+            break;
+        data.pending++;
+    }
+
+    /* Whatever couldn't be handed over is started right here */
+    for (; i < data.nvms; i++) {
+        data.pending++;
+        virMutexUnlock(&data.lock);
+        qemuAutostartDomain(data.vms[i], &data);
+        virMutexLock(&data.lock);
+    }
+
+    while (data.pending > 0)
+        ignore_value(virCondWait(&data.done, &data.lock));
+    virMutexUnlock(&data.lock);
+
+    virThreadPoolFree(workers);
+    ignore_value(virCondDestroy(&data.done));
+    virMutexDestroy(&data.lock);
+    i = data.nvms;
+
+release:
+    /* Drop the references of the domains which weren't started */
     qemuDriverLock(driver);
-    virHashForEach(driver->domains.objs, qemuAutostartDomain, &data);
+    for (; i < data.nvms; i++) {
+        virDomainObjLock(data.vms[i]);
+        if (virDomainObjUnref(data.vms[i]) > 0)
+            virDomainObjUnlock(data.vms[i]);
+    }
     qemuDriverUnlock(driver);
 
+cleanup:
+    VIR_FREE(data.vms);
     if (conn)
         virConnectClose(conn);
 }
@@ -565,6 +670,8 @@ qemudStartup(int privileged) {
                   qemu_driver->cacheDir, virStrerror(errno, ebuf, sizeof(ebuf)));
         goto error;
     }
+    if (qemuCapsCacheInit(qemu_driver->cacheDir) < 0)
+        goto error;
     if (virFileMakePath(qemu_driver->saveDir) < 0) {
         VIR_ERROR(_("Failed to create save dir '%s': %s"),
                   qemu_driver->saveDir, virStrerror(errno, ebuf, sizeof(ebuf)));
@@ -726,8 +833,6 @@ qemudStartup(int privileged) {
 
     qemuDriverUnlock(qemu_driver);
 
-    qemuAutostartDomains(qemu_driver);
-
     if (conn)
         virConnectClose(conn);
 
@@ -748,6 +853,18 @@ error:
     return -1;
 }
 
+/**
+ * qemudAutoStart:
+ *
+ * Start the domains marked for autostart, once the other drivers have
+ * set up the networks and storage pools they may need
+ */
+static void
+qemudAutoStart(void) {
+    if (qemu_driver)
+        qemuAutostartDomains(qemu_driver);
+}
+
 static void qemudNotifyLoadDomain(virDomainObjPtr vm, int newVM, void *opaque)
 {
     struct qemud_driver *driver = opaque;
@@ -834,6 +951,8 @@ qemudShutdown(void) {
 
     qemuDriverCloseCallbackShutdown(qemu_driver);
 
+    qemuCapsCacheFree();
+
     VIR_FREE(qemu_driver->configDir);
     VIR_FREE(qemu_driver->autostartDir);
     VIR_FREE(qemu_driver->logDir);
@@ -1086,27 +1205,26 @@ cleanup:
 }
 
 
+/* Samples the process, or its thread @tid if non-zero, through the
+ * stat file kept open in @statfd unless NULL */
 static int
 qemudGetProcessInfo(unsigned long long *cpuTime, int *lastCpu, long *vm_rss,
-                    pid_t pid, int tid)
+                    pid_t pid, int tid, int *statfd)
 {
-    char *proc;
-    FILE *pidinfo;
-    unsigned long long usertime, systime;
-    long rss;
-    int cpu;
-    int ret;
+    virProcStat info;
+    int rc;
 
-    /* In general, we cannot assume pid_t fits in int; but /proc parsing
-     * is specific to Linux where int works fine.  */
-    if (tid)
-        ret = virAsprintf(&proc, "/proc/%d/task/%d/stat", (int) pid, tid);
+    if (statfd)
+        rc = virProcStatReadCached(statfd, pid, tid, &info);
     else
-        ret = virAsprintf(&proc, "/proc/%d/stat", (int) pid);
-    if (ret < 0)
-        return -1;
+        rc = virProcStatRead(pid, tid, &info);
+
+    if (rc < 0) {
+        if (errno == EINVAL) {
+            VIR_WARN("cannot parse process status data");
+            return -1;
+        }
 
-    if (!(pidinfo = fopen(proc, "r"))) {
         /* VM probably shut down, so fake 0 */
         if (cpuTime)
             *cpuTime = 0;
@@ -1114,26 +1232,8 @@ qemudGetProcessInfo(unsigned long long *cpuTime, int *lastCpu, long *vm_rss,
             *lastCpu = 0;
         if (vm_rss)
             *vm_rss = 0;
-        VIR_FREE(proc);
         return 0;
     }
-    VIR_FREE(proc);
-
-    /* See 'man proc' for information about what all these fields are. We're
-     * only interested in a very few of them */
-    if (fscanf(pidinfo,
-               /* pid -> stime */
-               "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu"
-               /* cutime -> endcode */
-               "%*d %*d %*d %*d %*d %*d %*u %*u %ld %*u %*u %*u"
-               /* startstack -> processor */
-               "%*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*d %d",
-               &usertime, &systime, &rss, &cpu) != 4) {
-        VIR_FORCE_FCLOSE(pidinfo);
-        VIR_WARN("cannot parse process status data");
-        errno = -EINVAL;
-        return -1;
-    }
 
     /* We got jiffies
      * We want nanoseconds
@@ -1141,22 +1241,20 @@ qemudGetProcessInfo(unsigned long long *cpuTime, int *lastCpu, long *vm_rss,
      * So calulate thus....
      */
     if (cpuTime)
-        *cpuTime = 1000ull * 1000ull * 1000ull * (usertime + systime) / (unsigned long long)sysconf(_SC_CLK_TCK);
+        *cpuTime = 1000ull * 1000ull * 1000ull * (info.utime + info.stime) / (unsigned long long)sysconf(_SC_CLK_TCK);
     if (lastCpu)
-        *lastCpu = cpu;
+        *lastCpu = info.processor;
 
     /* We got pages
      * We want kiloBytes
      * _SC_PAGESIZE is page size in Bytes
      * So calculate, but first lower the pagesize so we don't get overflow */
     if (vm_rss)
-        *vm_rss = rss * (sysconf(_SC_PAGESIZE) >> 10);
+        *vm_rss = info.rss * (sysconf(_SC_PAGESIZE) >> 10);
 
 
     VIR_DEBUG("Got status for %d/%d user=%llu sys=%llu cpu=%d rss=%ld",
-              (int) pid, tid, usertime, systime, cpu, rss);
-
-    VIR_FORCE_FCLOSE(pidinfo);
+              (int) pid, tid, info.utime, info.stime, info.processor, info.rss);
 
     return 0;
 }
@@ -2197,7 +2295,9 @@ static int qemudDomainGetInfo(virDomainPtr dom,
     if (!virDomainObjIsActive(vm)) {
         info->cpuTime = 0;
     } else {
-        if (qemudGetProcessInfo(&(info->cpuTime), NULL, NULL, vm->pid, 0) < 0) {
+        if (qemudGetProcessInfo(&(info->cpuTime), NULL, NULL, vm->pid, 0,
+                                qemuDomainProcStatFD(vm->privateData,
+                                                     -1)) < 0) {
             qemuReportError(VIR_ERR_OPERATION_FAILED, "%s",
                             _("cannot read cputime for domain"));
             goto cleanup;
@@ -2217,10 +2317,12 @@ static int qemudDomainGetInfo(virDomainPtr dom,
                 goto cleanup;
             if (!virDomainObjIsActive(vm))
                 err = 0;
+            else if (qemuDomainUpdateStatsCache(driver, vm,
+                                                QEMU_DOMAIN_STATS_CACHE_BALLOON) < 0)
+                err = -1;
             else {
-                qemuDomainObjEnterMonitor(driver, vm);
-                err = qemuMonitorGetBalloonInfo(priv->mon, &balloon);
-                qemuDomainObjExitMonitor(driver, vm);
+                err = priv->stats.balloonRet;
+                balloon = priv->stats.balloon;
             }
             if (qemuDomainObjEndJob(driver, vm) == 0) {
                 vm = NULL;
@@ -2365,6 +2467,7 @@ enum qemud_save_formats {
      */
     QEMUD_SAVE_FORMAT_XZ = 3,
     QEMUD_SAVE_FORMAT_LZOP = 4,
+    QEMUD_SAVE_FORMAT_LZ4 = 5,
     /* Note: add new members only at the end.
        These values are used in the on-disk format.
        Do not change or re-use numbers. */
@@ -2378,7 +2481,8 @@ VIR_ENUM_IMPL(qemudSaveCompression, QEMUD_SAVE_FORMAT_LAST,
               "gzip",
               "bzip2",
               "xz",
-              "lzop")
+              "lzop",
+              "lz4")
 
 struct qemud_save_header {
     char magic[sizeof(QEMUD_SAVE_MAGIC)-1];
@@ -2766,6 +2870,11 @@ static bool qemudCompressProgramAvailable(enum qemud_save_formats compress)
 
     if (compress == QEMUD_SAVE_FORMAT_RAW)
         return true;
+    /* Compressed in process with liblz4, only QEMU too old to migrate
+     * to an fd needs the program then, which qemuMigrationToFile
+     * checks for */
+    if (compress == QEMUD_SAVE_FORMAT_LZ4 && virLZ4StreamAvailable())
+        return true;
     prog = qemudSaveCompressionTypeToString(compress);
     c = virFindFileInPath(prog);
     if (!c)
@@ -3785,7 +3894,8 @@ qemudDomainGetVcpus(virDomainPtr dom,
                                         &(info[i].cpu),
                                         NULL,
                                         vm->pid,
-                                        priv->vcpupids[i]) < 0) {
+                                        priv->vcpupids[i],
+                                        qemuDomainProcStatFD(priv, i)) < 0) {
                     virReportSystemError(errno, "%s",
                                          _("cannot get vCPU placement & pCPU time"));
                     goto cleanup;
@@ -4124,6 +4234,7 @@ qemuDomainSaveImageStartVM(virConnectPtr conn,
     virDomainEventPtr event;
     int intermediatefd = -1;
     virCommandPtr cmd = NULL;
+    virLZ4StreamPtr lz4 = NULL;
 
     if (header->version == 2) {
         const char *prog = qemudSaveCompressionTypeToString(header->compressed);
@@ -4134,7 +4245,25 @@ qemuDomainSaveImageStartVM(virConnectPtr conn,
             goto out;
         }
 
-        if (header->compressed != QEMUD_SAVE_FORMAT_RAW) {
+        if (header->compressed == QEMUD_SAVE_FORMAT_LZ4 &&
+            virLZ4StreamAvailable()) {
+            int pipefd[2];
+
+            if (pipe2(pipefd, O_CLOEXEC) < 0) {
+                virReportSystemError(errno, "%s",
+                                     _("unable to create pipe"));
+                goto out;
+            }
+            lz4 = virLZ4StreamNew(*fd, pipefd[1], 0,
+                                  VIR_LZ4_STREAM_DECOMPRESS);
+            VIR_FORCE_CLOSE(pipefd[1]);
+            if (!lz4) {
+                VIR_FORCE_CLOSE(pipefd[0]);
+                goto out;
+            }
+            intermediatefd = *fd;
+            *fd = pipefd[0];
+        } else if (header->compressed != QEMUD_SAVE_FORMAT_RAW) {
             cmd = virCommandNewArgList(prog, "-dc", NULL);
             intermediatefd = *fd;
             *fd = -1;
@@ -4167,7 +4296,9 @@ qemuDomainSaveImageStartVM(virConnectPtr conn,
             VIR_FORCE_CLOSE(*fd);
         }
 
-        if (virCommandWait(cmd, NULL) < 0)
+        if (cmd && virCommandWait(cmd, NULL) < 0)
+            ret = -1;
+        if (lz4 && ret == 0 && virLZ4StreamWait(lz4) < 0)
             ret = -1;
     }
     VIR_FORCE_CLOSE(intermediatefd);
@@ -4218,6 +4349,7 @@ qemuDomainSaveImageStartVM(virConnectPtr conn,
 
 out:
     virCommandFree(cmd);
+    virLZ4StreamFree(lz4);
     if (virSecurityManagerRestoreSavedStateLabel(driver->securityManager,
                                                  vm->def, path) < 0)
         VIR_WARN("failed to restore save state label on %s", path);
@@ -4494,9 +4626,13 @@ static char *qemuDomainGetXMLDesc(virDomainPtr dom,
                 goto endjob;
             }
 
-            qemuDomainObjEnterMonitorWithDriver(driver, vm);
-            err = qemuMonitorGetBalloonInfo(priv->mon, &balloon);
-            qemuDomainObjExitMonitorWithDriver(driver, vm);
+            if (qemuDomainUpdateStatsCacheWithDriver(driver, vm,
+                                                     QEMU_DOMAIN_STATS_CACHE_BALLOON) < 0) {
+                err = -1;
+            } else {
+                err = priv->stats.balloonRet;
+                balloon = priv->stats.balloon;
+            }
 
 endjob:
             if (qemuDomainObjEndJob(driver, vm) == 0) {
@@ -5175,8 +5311,7 @@ qemuDomainAttachDeviceDiskLive(virConnectPtr conn,
                      NULLSTR(disk->src));
     }
 end:
-    if (cgroup)
-        virCgroupFree(&cgroup);
+    virCgroupFree(&cgroup);
     return ret;
 }
 
@@ -5356,8 +5491,7 @@ qemuDomainChangeDiskMediaLive(virDomainObjPtr vm,
     int ret = -1;
 
     if (qemuCgroupControllerActive(driver, VIR_CGROUP_CONTROLLER_DEVICES)) {
-        if (virCgroupForDomain(driver->cgroup,
-                               vm->def->name, &cgroup, 0) != 0) {
+        if (virCgroupForDomain(driver->cgroup, vm->def->name, &cgroup, 0) != 0) {
             qemuReportError(VIR_ERR_INTERNAL_ERROR,
                             _("Unable to find cgroup for %s"),
                             vm->def->name);
@@ -5387,8 +5521,7 @@ qemuDomainChangeDiskMediaLive(virDomainObjPtr vm,
                       NULLSTR(disk->src));
     }
 end:
-    if (cgroup)
-        virCgroupFree(&cgroup);
+    virCgroupFree(&cgroup);
     return ret;
 }
 
@@ -6170,7 +6303,7 @@ qemuDomainSetBlkioParameters(virDomainPtr dom,
             goto cleanup;
         }
 
-        if (virCgroupForDomain(driver->cgroup, vm->def->name, &group, 0) != 0) {
+        if (qemuGetCgroup(driver, vm, &group) != 0) {
             qemuReportError(VIR_ERR_INTERNAL_ERROR,
                             _("cannot find cgroup for domain %s"),
                             vm->def->name);
@@ -6273,7 +6406,6 @@ qemuDomainSetBlkioParameters(virDomainPtr dom,
     }
 
 cleanup:
-    virCgroupFree(&group);
     if (vm)
         virDomainObjUnlock(vm);
     qemuDriverUnlock(driver);
@@ -6330,7 +6462,7 @@ qemuDomainGetBlkioParameters(virDomainPtr dom,
             goto cleanup;
         }
 
-        if (virCgroupForDomain(driver->cgroup, vm->def->name, &group, 0) != 0) {
+        if (qemuGetCgroup(driver, vm, &group) != 0) {
             qemuReportError(VIR_ERR_INTERNAL_ERROR,
                             _("cannot find cgroup for domain %s"), vm->def->name);
             goto cleanup;
@@ -6457,8 +6589,6 @@ qemuDomainGetBlkioParameters(virDomainPtr dom,
     ret = 0;
 
 cleanup:
-    if (group)
-        virCgroupFree(&group);
     if (vm)
         virDomainObjUnlock(vm);
     qemuDriverUnlock(driver);
@@ -6512,7 +6642,7 @@ qemuDomainSetMemoryParameters(virDomainPtr dom,
             goto cleanup;
         }
 
-        if (virCgroupForDomain(driver->cgroup, vm->def->name, &group, 0) != 0) {
+        if (qemuGetCgroup(driver, vm, &group) != 0) {
             qemuReportError(VIR_ERR_INTERNAL_ERROR,
                             _("cannot find cgroup for domain %s"), vm->def->name);
             goto cleanup;
@@ -6570,7 +6700,6 @@ qemuDomainSetMemoryParameters(virDomainPtr dom,
     }
 
 cleanup:
-    virCgroupFree(&group);
     if (vm)
         virDomainObjUnlock(vm);
     qemuDriverUnlock(driver);
@@ -6619,7 +6748,7 @@ qemuDomainGetMemoryParameters(virDomainPtr dom,
             goto cleanup;
         }
 
-        if (virCgroupForDomain(driver->cgroup, vm->def->name, &group, 0) != 0) {
+        if (qemuGetCgroup(driver, vm, &group) != 0) {
             qemuReportError(VIR_ERR_INTERNAL_ERROR,
                             _("cannot find cgroup for domain %s"), vm->def->name);
             goto cleanup;
@@ -6729,8 +6858,6 @@ out:
     ret = 0;
 
 cleanup:
-    if (group)
-        virCgroupFree(&group);
     if (vm)
         virDomainObjUnlock(vm);
     qemuDriverUnlock(driver);
@@ -6781,7 +6908,7 @@ qemuDomainSetNumaParameters(virDomainPtr dom,
             goto cleanup;
         }
 
-        if (virCgroupForDomain(driver->cgroup, vm->def->name, &group, 0) != 0) {
+        if (qemuGetCgroup(driver, vm, &group) != 0) {
             qemuReportError(VIR_ERR_INTERNAL_ERROR,
                             _("cannot find cgroup for domain %s"),
                             vm->def->name);
@@ -6892,7 +7019,6 @@ qemuDomainSetNumaParameters(virDomainPtr dom,
     }
 
 cleanup:
-    virCgroupFree(&group);
     if (vm)
         virDomainObjUnlock(vm);
     qemuDriverUnlock(driver);
@@ -6950,7 +7076,7 @@ qemuDomainGetNumaParameters(virDomainPtr dom,
             goto cleanup;
         }
 
-        if (virCgroupForDomain(driver->cgroup, vm->def->name, &group, 0) != 0) {
+        if (qemuGetCgroup(driver, vm, &group) != 0) {
             qemuReportError(VIR_ERR_INTERNAL_ERROR,
                             _("cannot find cgroup for domain %s"),
                             vm->def->name);
@@ -7004,7 +7130,6 @@ qemuDomainGetNumaParameters(virDomainPtr dom,
     ret = 0;
 
 cleanup:
-    virCgroupFree(&group);
     if (vm)
         virDomainObjUnlock(vm);
     qemuDriverUnlock(driver);
@@ -7171,7 +7296,7 @@ qemuSetSchedulerParametersFlags(virDomainPtr dom,
                             "%s", _("cgroup CPU controller is not mounted"));
             goto cleanup;
         }
-        if (virCgroupForDomain(driver->cgroup, vm->def->name, &group, 0) != 0) {
+        if (qemuGetCgroup(driver, vm, &group) != 0) {
             qemuReportError(VIR_ERR_INTERNAL_ERROR,
                             _("cannot find cgroup for domain %s"),
                             vm->def->name);
@@ -7243,7 +7368,6 @@ qemuSetSchedulerParametersFlags(virDomainPtr dom,
 
 cleanup:
     virDomainDefFree(vmdef);
-    virCgroupFree(&group);
     if (vm)
         virDomainObjUnlock(vm);
     qemuDriverUnlock(driver);
@@ -7387,7 +7511,7 @@ qemuGetSchedulerParametersFlags(virDomainPtr dom,
         goto cleanup;
     }
 
-    if (virCgroupForDomain(driver->cgroup, vm->def->name, &group, 0) != 0) {
+    if (qemuGetCgroup(driver, vm, &group) != 0) {
         qemuReportError(VIR_ERR_INTERNAL_ERROR,
                         _("cannot find cgroup for domain %s"), vm->def->name);
         goto cleanup;
@@ -7434,7 +7558,6 @@ out:
     ret = 0;
 
 cleanup:
-    virCgroupFree(&group);
     if (vm)
         virDomainObjUnlock(vm);
     qemuDriverUnlock(driver);
@@ -7544,9 +7667,52 @@ cleanup:
     return ret;
 }
 
+/* Statistics of the disk with @alias in the stats cache, which must
+ * have been filled with QEMU_DOMAIN_STATS_CACHE_BLOCKSTATS */
+static qemuBlockStatsPtr
+qemuDomainBlockStatsLookup(qemuDomainObjPrivatePtr priv,
+                           const char *alias)
+{
+    qemuBlockStatsPtr stats;
+
+    if (!(stats = virHashLookup(priv->stats.blockStats, alias)))
+        qemuReportError(VIR_ERR_INTERNAL_ERROR,
+                        _("cannot find statistics for device '%s'"), alias);
+    return stats;
+}
+
+/* Number of the statistics QEMU gives for each disk */
+static int
+qemuDomainBlockStatsCount(qemuBlockStatsPtr stats)
+{
+    long long fields[] = {
+        stats->rd_req, stats->rd_bytes, stats->rd_total_times,
+        stats->wr_req, stats->wr_bytes, stats->wr_total_times,
+        stats->flush_req, stats->flush_total_times,
+    };
+    size_t i;
+    int n = 0;
+
+    for (i = 0; i < ARRAY_CARDINALITY(fields); i++) {
+        if (fields[i] != -1)
+            n++;
+    }
+    return n;
+}
+
+static int
+qemuDomainBlockStatsAny(const void *payload ATTRIBUTE_UNUSED,
+                        const void *name ATTRIBUTE_UNUSED,
+                        const void *data ATTRIBUTE_UNUSED)
+{
+    return 1;
+}
+
 /* This uses the 'info blockstats' monitor command which was
  * integrated into both qemu & kvm in late 2007.  If the command is
  * not supported we detect this and return the appropriate error.
+ * The statistics of all the disks are queried at once and cached, so
+ * that asking for each disk in turn doesn't query them each time.
  */
 static int
 qemuDomainBlockStats(virDomainPtr dom,
@@ -7558,6 +7724,7 @@ qemuDomainBlockStats(virDomainPtr dom,
     virDomainObjPtr vm;
     virDomainDiskDefPtr disk = NULL;
     qemuDomainObjPrivatePtr priv;
+    qemuBlockStatsPtr entry;
 
     qemuDriverLock(driver);
     vm = virDomainFindByUUID(&driver->domains, dom->uuid);
@@ -7599,19 +7766,17 @@ qemuDomainBlockStats(virDomainPtr dom,
         goto endjob;
     }
 
-    qemuDomainObjEnterMonitor(driver, vm);
-    ret = qemuMonitorGetBlockStatsInfo(priv->mon,
-                                       disk->info.alias,
-                                       &stats->rd_req,
-                                       &stats->rd_bytes,
-                                       NULL,
-                                       &stats->wr_req,
-                                       &stats->wr_bytes,
-                                       NULL,
-                                       NULL,
-                                       NULL,
-                                       &stats->errs);
-    qemuDomainObjExitMonitor(driver, vm);
+    if (qemuDomainUpdateStatsCache(driver, vm,
+                                   QEMU_DOMAIN_STATS_CACHE_BLOCKSTATS) < 0 ||
+        !(entry = qemuDomainBlockStatsLookup(priv, disk->info.alias)))
+        goto endjob;
+
+    stats->rd_req = entry->rd_req;
+    stats->rd_bytes = entry->rd_bytes;
+    stats->wr_req = entry->wr_req;
+    stats->wr_bytes = entry->wr_bytes;
+    stats->errs = -1;
+    ret = 0;
 
 endjob:
     if (qemuDomainObjEndJob(driver, vm) == 0)
@@ -7635,8 +7800,9 @@ qemuDomainBlockStatsFlags(virDomainPtr dom,
     virDomainObjPtr vm;
     virDomainDiskDefPtr disk = NULL;
     qemuDomainObjPrivatePtr priv;
+    qemuBlockStatsPtr entry;
     long long rd_req, rd_bytes, wr_req, wr_bytes, rd_total_times;
-    long long wr_total_times, flush_req, flush_total_times, errs;
+    long long wr_total_times, flush_req, flush_total_times;
     virTypedParameterPtr param;
 
     virCheckFlags(VIR_TYPED_PARAM_STRING_OKAY, -1);
@@ -7689,34 +7855,32 @@ qemuDomainBlockStatsFlags(virDomainPtr dom,
         goto endjob;
     }
 
-    qemuDomainObjEnterMonitor(driver, vm);
-    tmp = *nparams;
-    ret = qemuMonitorGetBlockStatsParamsNumber(priv->mon, nparams);
+    if (qemuDomainUpdateStatsCache(driver, vm,
+                                   QEMU_DOMAIN_STATS_CACHE_BLOCKSTATS) < 0)
+        goto endjob;
 
-    if (tmp == 0 || ret < 0) {
-        qemuDomainObjExitMonitor(driver, vm);
+    /* All the disks have the same statistics, count those of any */
+    if (*nparams == 0) {
+        entry = virHashSearch(priv->stats.blockStats,
+                              qemuDomainBlockStatsAny, NULL);
+        *nparams = entry ? qemuDomainBlockStatsCount(entry) : 0;
+        ret = 0;
         goto endjob;
     }
 
-    ret = qemuMonitorGetBlockStatsInfo(priv->mon,
-                                       disk->info.alias,
-                                       &rd_req,
-                                       &rd_bytes,
-                                       &rd_total_times,
-                                       &wr_req,
-                                       &wr_bytes,
-                                       &wr_total_times,
-                                       &flush_req,
-                                       &flush_total_times,
-                                       &errs);
-
-    qemuDomainObjExitMonitor(driver, vm);
-
-    if (ret < 0)
+    if (!(entry = qemuDomainBlockStatsLookup(priv, disk->info.alias)))
         goto endjob;
 
+    rd_req = entry->rd_req;
+    rd_bytes = entry->rd_bytes;
+    rd_total_times = entry->rd_total_times;
+    wr_req = entry->wr_req;
+    wr_bytes = entry->wr_bytes;
+    wr_total_times = entry->wr_total_times;
+    flush_req = entry->flush_req;
+    flush_total_times = entry->flush_total_times;
+
     tmp = 0;
-    ret = -1;
 
     if (tmp < *nparams && wr_bytes != -1) {
         param = &params[tmp];
@@ -8196,7 +8360,8 @@ qemudDomainMemoryStats (virDomainPtr dom,
 
         if (ret >= 0 && ret < nr_stats) {
             long rss;
-            if (qemudGetProcessInfo(NULL, NULL, &rss, vm->pid, 0) < 0) {
+            if (qemudGetProcessInfo(NULL, NULL, &rss, vm->pid, 0,
+                                    qemuDomainProcStatFD(priv, -1)) < 0) {
                 qemuReportError(VIR_ERR_OPERATION_FAILED, "%s",
                             _("cannot get RSS for domain"));
             } else {
@@ -9436,6 +9601,7 @@ static int qemuDomainAbortJob(virDomainPtr dom) {
     qemuDomainObjEnterMonitor(driver, vm);
     ret = qemuMonitorMigrateCancel(priv->mon);
     qemuDomainObjExitMonitor(driver, vm);
+    qemuDomainObjSignalAsyncJob(vm);
 
 endjob:
     if (qemuDomainObjEndJob(driver, vm) == 0)
@@ -12195,7 +12361,7 @@ qemuDomainGetDiskErrors(virDomainPtr dom,
     virDomainObjPtr vm = NULL;
     qemuDomainObjPrivatePtr priv;
     char uuidstr[VIR_UUID_STRING_BUFLEN];
-    virHashTablePtr table = NULL;
+    virHashTablePtr table;
     int ret = -1;
     int i;
     int n = 0;
@@ -12229,11 +12395,10 @@ qemuDomainGetDiskErrors(virDomainPtr dom,
         goto endjob;
     }
 
-    qemuDomainObjEnterMonitor(driver, vm);
-    table = qemuMonitorGetBlockInfo(priv->mon);
-    qemuDomainObjExitMonitor(driver, vm);
-    if (!table)
+    if (qemuDomainUpdateStatsCache(driver, vm,
+                                   QEMU_DOMAIN_STATS_CACHE_BLOCKINFO) < 0)
         goto endjob;
+    table = priv->stats.blockInfo;
 
     for (i = n = 0; i < vm->def->ndisks; i++) {
         struct qemuDomainDiskInfo *info;
@@ -12262,7 +12427,6 @@ endjob:
 cleanup:
     if (vm)
         virDomainObjUnlock(vm);
-    virHashFree(table);
     if (ret < 0) {
         for (i = 0; i < n; i++)
             VIR_FREE(errors[i].disk);
@@ -12602,7 +12766,7 @@ qemuDomainGetCPUStats(virDomainPtr domain,
         goto cleanup;
     }
 
-    if (virCgroupForDomain(driver->cgroup, vm->def->name, &group, 0) != 0) {
+    if (qemuGetCgroup(driver, vm, &group) != 0) {
         qemuReportError(VIR_ERR_INTERNAL_ERROR,
                         _("cannot find cgroup for domain %s"), vm->def->name);
         goto cleanup;
@@ -12614,7 +12778,6 @@ qemuDomainGetCPUStats(virDomainPtr domain,
         ret = qemuDomainGetPercpuStats(domain, group, params, nparams,
                                        start_cpu, ncpus);
 cleanup:
-    virCgroupFree(&group);
     if (vm)
         virDomainObjUnlock(vm);
     qemuDriverUnlock(driver);
@@ -12768,6 +12931,644 @@ cleanup:
     return ret;
 }
 
+/* Data gathered from the monitor once per domain and shared by all
+ * the stats groups which need it */
+typedef struct _qemuDomainStatsMonitorData qemuDomainStatsMonitorData;
+typedef qemuDomainStatsMonitorData *qemuDomainStatsMonitorDataPtr;
+struct _qemuDomainStatsMonitorData {
+    bool valid;           /* monitor data were fetched */
+    int balloonRet;       /* qemuMonitorGetBalloonInfo() return value */
+    unsigned long long balloon;
+    virHashTablePtr blockstats;   /* owned by the stats cache */
+};
+
+typedef int
+(*qemuDomainGetStatsFunc)(struct qemud_driver *driver,
+                          virDomainObjPtr dom,
+                          qemuDomainStatsMonitorDataPtr mondata,
+                          virDomainStatsRecordPtr record,
+                          size_t *maxparams);
+
+struct qemuDomainGetStatsWorker {
+    qemuDomainGetStatsFunc func;
+    unsigned int stats;
+    bool monitor;
+};
+
+
+static virTypedParameterPtr
+qemuDomainStatsNextParam(virDomainStatsRecordPtr record,
+                         size_t *maxparams)
+{
+    if (VIR_RESIZE_N(record->params, *maxparams, record->nparams, 1) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    return &record->params[record->nparams];
+}
+
+static int
+qemuDomainStatsAddInt(virDomainStatsRecordPtr record,
+                      size_t *maxparams,
+                      const char *name,
+                      int value)
+{
+    virTypedParameterPtr param;
+
+    if (!(param = qemuDomainStatsNextParam(record, maxparams)) ||
+        virTypedParameterAssign(param, name, VIR_TYPED_PARAM_INT, value) < 0)
+        return -1;
+
+    record->nparams++;
+    return 0;
+}
+
+static int
+qemuDomainStatsAddUInt(virDomainStatsRecordPtr record,
+                       size_t *maxparams,
+                       const char *name,
+                       unsigned int value)
+{
+    virTypedParameterPtr param;
+
+    if (!(param = qemuDomainStatsNextParam(record, maxparams)) ||
+        virTypedParameterAssign(param, name, VIR_TYPED_PARAM_UINT, value) < 0)
+        return -1;
+
+    record->nparams++;
+    return 0;
+}
+
+static int
+qemuDomainStatsAddULLong(virDomainStatsRecordPtr record,
+                         size_t *maxparams,
+                         const char *name,
+                         unsigned long long value)
+{
+    virTypedParameterPtr param;
+
+    if (!(param = qemuDomainStatsNextParam(record, maxparams)) ||
+        virTypedParameterAssign(param, name, VIR_TYPED_PARAM_ULLONG,
+                                value) < 0)
+        return -1;
+
+    record->nparams++;
+    return 0;
+}
+
+static int
+qemuDomainStatsAddString(virDomainStatsRecordPtr record,
+                         size_t *maxparams,
+                         const char *name,
+                         const char *value)
+{
+    virTypedParameterPtr param;
+    char *tmp;
+
+    if (!(param = qemuDomainStatsNextParam(record, maxparams)))
+        return -1;
+
+    if (!(tmp = strdup(value))) {
+        virReportOOMError();
+        return -1;
+    }
+
+    if (virTypedParameterAssign(param, name, VIR_TYPED_PARAM_STRING,
+                                tmp) < 0) {
+        VIR_FREE(tmp);
+        param->type = 0;
+        return -1;
+    }
+
+    record->nparams++;
+    return 0;
+}
+
+
+static int
+qemuDomainGetStatsState(struct qemud_driver *driver ATTRIBUTE_UNUSED,
+                        virDomainObjPtr dom,
+                        qemuDomainStatsMonitorDataPtr mondata ATTRIBUTE_UNUSED,
+                        virDomainStatsRecordPtr record,
+                        size_t *maxparams)
+{
+    int state;
+    int reason;
+
+    state = virDomainObjGetState(dom, &reason);
+
+    if (qemuDomainStatsAddInt(record, maxparams, "state.state", state) < 0 ||
+        qemuDomainStatsAddInt(record, maxparams, "state.reason", reason) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static int
+qemuDomainGetStatsCpu(struct qemud_driver *driver,
+                      virDomainObjPtr dom,
+                      qemuDomainStatsMonitorDataPtr mondata ATTRIBUTE_UNUSED,
+                      virDomainStatsRecordPtr record,
+                      size_t *maxparams)
+{
+    virCgroupPtr group = NULL;
+    unsigned long long cpu_time;
+    unsigned long long user;
+    unsigned long long sys;
+
+    if (!virDomainObjIsActive(dom))
+        return 0;
+
+    /* Stats which cannot be gathered are silently left out */
+    if (!qemuCgroupControllerActive(driver, VIR_CGROUP_CONTROLLER_CPUACCT) ||
+        qemuGetCgroup(driver, dom, &group) != 0)
+        return 0;
+
+    if (virCgroupGetCpuacctUsage(group, &cpu_time) == 0 &&
+        qemuDomainStatsAddULLong(record, maxparams, "cpu.time",
+                                 cpu_time) < 0)
+        return -1;
+
+    if (virCgroupGetCpuacctStat(group, &user, &sys) == 0 &&
+        (qemuDomainStatsAddULLong(record, maxparams, "cpu.user", user) < 0 ||
+         qemuDomainStatsAddULLong(record, maxparams, "cpu.system", sys) < 0))
+        return -1;
+
+    return 0;
+}
+
+
+static int
+qemuDomainGetStatsBalloon(struct qemud_driver *driver ATTRIBUTE_UNUSED,
+                          virDomainObjPtr dom,
+                          qemuDomainStatsMonitorDataPtr mondata,
+                          virDomainStatsRecordPtr record,
+                          size_t *maxparams)
+{
+    unsigned long long cur_balloon = dom->def->mem.cur_balloon;
+
+    if (dom->def->memballoon &&
+        dom->def->memballoon->model == VIR_DOMAIN_MEMBALLOON_MODEL_NONE) {
+        cur_balloon = dom->def->mem.max_balloon;
+    } else if (virDomainObjIsActive(dom) && mondata->valid) {
+        if (mondata->balloonRet > 0)
+            cur_balloon = mondata->balloon;
+        else if (mondata->balloonRet == 0)
+            /* Balloon not supported, so maxmem is always the allocation */
+            cur_balloon = dom->def->mem.max_balloon;
+    }
+
+    if (qemuDomainStatsAddULLong(record, maxparams, "balloon.current",
+                                 cur_balloon) < 0 ||
+        qemuDomainStatsAddULLong(record, maxparams, "balloon.maximum",
+                                 dom->def->mem.max_balloon) < 0)
+        return -1;
+
+    return 0;
+}
+
+
+static int
+qemuDomainGetStatsVcpu(struct qemud_driver *driver ATTRIBUTE_UNUSED,
+                       virDomainObjPtr dom,
+                       qemuDomainStatsMonitorDataPtr mondata ATTRIBUTE_UNUSED,
+                       virDomainStatsRecordPtr record,
+                       size_t *maxparams)
+{
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    char param_name[VIR_TYPED_PARAM_FIELD_LENGTH];
+    int i;
+
+    if (qemuDomainStatsAddUInt(record, maxparams, "vcpu.current",
+                               dom->def->vcpus) < 0 ||
+        qemuDomainStatsAddUInt(record, maxparams, "vcpu.maximum",
+                               dom->def->maxvcpus) < 0)
+        return -1;
+
+    if (!virDomainObjIsActive(dom))
+        return 0;
+
+    for (i = 0; i < priv->nvcpupids; i++) {
+        unsigned long long cpuTime;
+
+        if (qemudGetProcessInfo(&cpuTime, NULL, NULL,
+                                dom->pid, priv->vcpupids[i],
+                                qemuDomainProcStatFD(priv, i)) < 0) {
+            virResetLastError();
+            continue;
+        }
+
+        snprintf(param_name, sizeof(param_name), "vcpu.%d.state", i);
+        if (qemuDomainStatsAddInt(record, maxparams, param_name,
+                                  VIR_VCPU_RUNNING) < 0)
+            return -1;
+
+        snprintf(param_name, sizeof(param_name), "vcpu.%d.time", i);
+        if (qemuDomainStatsAddULLong(record, maxparams, param_name,
+                                     cpuTime) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+#define QEMU_ADD_COUNT_PARAM(record, maxparams, type, count)                 \
+    do {                                                                     \
+        char param_name[VIR_TYPED_PARAM_FIELD_LENGTH];                       \
+        snprintf(param_name, sizeof(param_name), "%s.count", type);          \
+        if (qemuDomainStatsAddUInt(record, maxparams, param_name,            \
+                                   count) < 0)                               \
+            return -1;                                                       \
+    } while (0)
+
+#define QEMU_ADD_NAME_PARAM(record, maxparams, type, num, name)              \
+    do {                                                                     \
+        char param_name[VIR_TYPED_PARAM_FIELD_LENGTH];                       \
+        snprintf(param_name, sizeof(param_name), "%s.%d.name", type, num);   \
+        if (qemuDomainStatsAddString(record, maxparams, param_name,          \
+                                     name) < 0)                              \
+            return -1;                                                       \
+    } while (0)
+
+/* Negative values mean QEMU doesn't provide the counter */
+#define QEMU_ADD_COUNTER_PARAM(record, maxparams, type, num, name, value)    \
+    do {                                                                     \
+        char param_name[VIR_TYPED_PARAM_FIELD_LENGTH];                       \
+        snprintf(param_name, sizeof(param_name), "%s.%d.%s",                 \
+                 type, num, name);                                           \
+        if (value >= 0 &&                                                    \
+            qemuDomainStatsAddULLong(record, maxparams, param_name,          \
+                                     value) < 0)                             \
+            return -1;                                                       \
+    } while (0)
+
+#ifdef __linux__
+static int
+qemuDomainGetStatsInterface(struct qemud_driver *driver ATTRIBUTE_UNUSED,
+                            virDomainObjPtr dom,
+                            qemuDomainStatsMonitorDataPtr mondata ATTRIBUTE_UNUSED,
+                            virDomainStatsRecordPtr record,
+                            size_t *maxparams)
+{
+    int i;
+
+    if (!virDomainObjIsActive(dom))
+        return 0;
+
+    QEMU_ADD_COUNT_PARAM(record, maxparams, "net", dom->def->nnets);
+
+    for (i = 0; i < dom->def->nnets; i++) {
+        virDomainNetDefPtr net = dom->def->nets[i];
+        struct _virDomainInterfaceStats tmp;
+
+        if (!net->ifname)
+            continue;
+
+        QEMU_ADD_NAME_PARAM(record, maxparams, "net", i, net->ifname);
+
+        if (linuxDomainInterfaceStats(net->ifname, &tmp) < 0) {
+            virResetLastError();
+            continue;
+        }
+
+        QEMU_ADD_COUNTER_PARAM(record, maxparams, "net", i,
+                               "rx.bytes", tmp.rx_bytes);
+        QEMU_ADD_COUNTER_PARAM(record, maxparams, "net", i,
+                               "rx.pkts", tmp.rx_packets);
+        QEMU_ADD_COUNTER_PARAM(record, maxparams, "net", i,
+                               "rx.errs", tmp.rx_errs);
+        QEMU_ADD_COUNTER_PARAM(record, maxparams, "net", i,
+                               "rx.drop", tmp.rx_drop);
+        QEMU_ADD_COUNTER_PARAM(record, maxparams, "net", i,
+                               "tx.bytes", tmp.tx_bytes);
+        QEMU_ADD_COUNTER_PARAM(record, maxparams, "net", i,
+                               "tx.pkts", tmp.tx_packets);
+        QEMU_ADD_COUNTER_PARAM(record, maxparams, "net", i,
+                               "tx.errs", tmp.tx_errs);
+        QEMU_ADD_COUNTER_PARAM(record, maxparams, "net", i,
+                               "tx.drop", tmp.tx_drop);
+    }
+
+    return 0;
+}
+#else
+static int
+qemuDomainGetStatsInterface(struct qemud_driver *driver ATTRIBUTE_UNUSED,
+                            virDomainObjPtr dom ATTRIBUTE_UNUSED,
+                            qemuDomainStatsMonitorDataPtr mondata ATTRIBUTE_UNUSED,
+                            virDomainStatsRecordPtr record ATTRIBUTE_UNUSED,
+                            size_t *maxparams ATTRIBUTE_UNUSED)
+{
+    /* interface stats not implemented on this platform */
+    return 0;
+}
+#endif
+
+
+static int
+qemuDomainGetStatsBlock(struct qemud_driver *driver ATTRIBUTE_UNUSED,
+                        virDomainObjPtr dom,
+                        qemuDomainStatsMonitorDataPtr mondata,
+                        virDomainStatsRecordPtr record,
+                        size_t *maxparams)
+{
+    int i;
+
+    if (!virDomainObjIsActive(dom) || !mondata->blockstats)
+        return 0;
+
+    QEMU_ADD_COUNT_PARAM(record, maxparams, "block", dom->def->ndisks);
+
+    for (i = 0; i < dom->def->ndisks; i++) {
+        virDomainDiskDefPtr disk = dom->def->disks[i];
+        qemuBlockStatsPtr entry;
+
+        QEMU_ADD_NAME_PARAM(record, maxparams, "block", i, disk->dst);
+
+        if (!disk->info.alias ||
+            !(entry = virHashLookup(mondata->blockstats, disk->info.alias)))
+            continue;
+
+        QEMU_ADD_COUNTER_PARAM(record, maxparams, "block", i,
+                               "rd.reqs", entry->rd_req);
+        QEMU_ADD_COUNTER_PARAM(record, maxparams, "block", i,
+                               "rd.bytes", entry->rd_bytes);
+        QEMU_ADD_COUNTER_PARAM(record, maxparams, "block", i,
+                               "rd.times", entry->rd_total_times);
+        QEMU_ADD_COUNTER_PARAM(record, maxparams, "block", i,
+                               "wr.reqs", entry->wr_req);
+        QEMU_ADD_COUNTER_PARAM(record, maxparams, "block", i,
+                               "wr.bytes", entry->wr_bytes);
+        QEMU_ADD_COUNTER_PARAM(record, maxparams, "block", i,
+                               "wr.times", entry->wr_total_times);
+        QEMU_ADD_COUNTER_PARAM(record, maxparams, "block", i,
+                               "fl.reqs", entry->flush_req);
+        QEMU_ADD_COUNTER_PARAM(record, maxparams, "block", i,
+                               "fl.times", entry->flush_total_times);
+    }
+
+    return 0;
+}
+
+#undef QEMU_ADD_COUNTER_PARAM
+#undef QEMU_ADD_NAME_PARAM
+#undef QEMU_ADD_COUNT_PARAM
+
+
+static struct qemuDomainGetStatsWorker qemuDomainGetStatsWorkers[] = {
+    { qemuDomainGetStatsState, VIR_DOMAIN_STATS_STATE, false },
+    { qemuDomainGetStatsCpu, VIR_DOMAIN_STATS_CPU_TOTAL, false },
+    { qemuDomainGetStatsBalloon, VIR_DOMAIN_STATS_BALLOON, true },
+    { qemuDomainGetStatsVcpu, VIR_DOMAIN_STATS_VCPU, false },
+    { qemuDomainGetStatsInterface, VIR_DOMAIN_STATS_INTERFACE, false },
+    { qemuDomainGetStatsBlock, VIR_DOMAIN_STATS_BLOCK, true },
+    { NULL, 0, false }
+};
+
+
+static int
+qemuDomainGetStatsCheckSupport(unsigned int *stats,
+                               bool enforce)
+{
+    unsigned int supportedstats = 0;
+    int i;
+
+    for (i = 0; qemuDomainGetStatsWorkers[i].func; i++)
+        supportedstats |= qemuDomainGetStatsWorkers[i].stats;
+
+    if (*stats == 0) {
+        *stats = supportedstats;
+        return 0;
+    }
+
+    if (enforce &&
+        *stats & ~supportedstats) {
+        qemuReportError(VIR_ERR_ARGUMENT_UNSUPPORTED,
+                        _("Stats types bits 0x%x are not supported by this daemon"),
+                        *stats & ~supportedstats);
+        return -1;
+    }
+
+    *stats &= supportedstats;
+    return 0;
+}
+
+
+/* Query everything the requested stats groups need from the monitor
+ * in a single job, so that each domain is entered only once. Failing
+ * to do so is not fatal: the affected stats are left out, or filled
+ * in from the domain definition. */
+static void
+qemuDomainGetStatsMonitor(struct qemud_driver *driver,
+                          virDomainObjPtr dom,
+                          unsigned int stats,
+                          qemuDomainStatsMonitorDataPtr mondata)
+{
+    qemuDomainObjPrivatePtr priv = dom->privateData;
+    bool balloon = (stats & VIR_DOMAIN_STATS_BALLOON) &&
+        !(dom->def->memballoon &&
+          dom->def->memballoon->model == VIR_DOMAIN_MEMBALLOON_MODEL_NONE);
+    bool block = !!(stats & VIR_DOMAIN_STATS_BLOCK);
+
+    if (!balloon && !block)
+        return;
+
+    /* Don't wait for other jobs to finish, that would hold up the
+     * statistics of all the remaining domains */
+    if (!qemuDomainJobAllowed(priv, QEMU_JOB_QUERY) ||
+        qemuDomainObjBeginJob(driver, dom, QEMU_JOB_QUERY) < 0) {
+        virResetLastError();
+        return;
+    }
+
+    if (virDomainObjIsActive(dom)) {
+        unsigned int groups = 0;
+
+        if (balloon)
+            groups |= QEMU_DOMAIN_STATS_CACHE_BALLOON;
+        if (block)
+            groups |= QEMU_DOMAIN_STATS_CACHE_BLOCKSTATS;
+        ignore_value(qemuDomainUpdateStatsCache(driver, dom, groups));
+
+        /* The cache is only cleared by other jobs or when the domain
+         * stops, neither of which happens while @dom stays locked */
+        mondata->balloonRet = priv->stats.balloonRet;
+        mondata->balloon = priv->stats.balloon;
+        mondata->blockstats = priv->stats.blockStats;
+        mondata->valid = true;
+        virResetLastError();
+    }
+
+    /* The caller holds a reference, so @dom can't go away */
+    ignore_value(qemuDomainObjEndJob(driver, dom));
+}
+
+
+static int
+qemuDomainGetStats(virConnectPtr conn,
+                   struct qemud_driver *driver,
+                   virDomainObjPtr dom,
+                   unsigned int stats,
+                   virDomainStatsRecordPtr *record)
+{
+    size_t maxparams = 0;
+    virDomainStatsRecordPtr tmp;
+    qemuDomainStatsMonitorData mondata;
+    int ret = -1;
+    int i;
+
+    memset(&mondata, 0, sizeof(mondata));
+    mondata.balloonRet = -1;
+
+    if (VIR_ALLOC(tmp) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    if (virDomainObjIsActive(dom))
+        qemuDomainGetStatsMonitor(driver, dom, stats, &mondata);
+
+    for (i = 0; qemuDomainGetStatsWorkers[i].func; i++) {
+        if (stats & qemuDomainGetStatsWorkers[i].stats) {
+            if (qemuDomainGetStatsWorkers[i].func(driver, dom, &mondata,
+                                                  tmp, &maxparams) < 0)
+                goto cleanup;
+        }
+    }
+
+    if (!(tmp->dom = virGetDomain(conn, dom->def->name, dom->def->uuid)))
+        goto cleanup;
+    tmp->dom->id = dom->def->id;
+
+    *record = tmp;
+    tmp = NULL;
+    ret = 0;
+
+cleanup:
+    if (tmp) {
+        virTypedParameterArrayClear(tmp->params, tmp->nparams);
+        VIR_FREE(tmp->params);
+        VIR_FREE(tmp);
+    }
+    return ret;
+}
+
+
+struct qemuConnectGetAllDomainStatsData {
+    virDomainObjPtr *doms;
+    size_t ndoms;
+    unsigned int flags;
+};
+
+static bool
+qemuConnectGetAllDomainStatsFilter(virDomainObjPtr dom,
+                                   unsigned int flags)
+{
+    bool active = virDomainObjIsActive(dom);
+
+    if ((flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_ACTIVE) &&
+        !(flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_INACTIVE))
+        return active;
+
+    if ((flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_INACTIVE) &&
+        !(flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_ACTIVE))
+        return !active;
+
+    return true;
+}
+
+static void
+qemuConnectGetAllDomainStatsCollect(void *payload,
+                                    const void *name ATTRIBUTE_UNUSED,
+                                    void *opaque)
+{
+    virDomainObjPtr dom = payload;
+    struct qemuConnectGetAllDomainStatsData *data = opaque;
+
+    virDomainObjLock(dom);
+    if (qemuConnectGetAllDomainStatsFilter(dom, data->flags)) {
+        virDomainObjRef(dom);
+        data->doms[data->ndoms++] = dom;
+    }
+    virDomainObjUnlock(dom);
+}
+
+static int
+qemuConnectGetAllDomainStats(virConnectPtr conn,
+                             unsigned int stats,
+                             virDomainStatsRecordPtr **retStats,
+                             unsigned int flags)
+{
+    struct qemud_driver *driver = conn->privateData;
+    struct qemuConnectGetAllDomainStatsData data = { NULL, 0, flags };
+    virDomainStatsRecordPtr *tmpstats = NULL;
+    int nstats = 0;
+    int ret = -1;
+    int i;
+
+    virCheckFlags(VIR_CONNECT_GET_ALL_DOMAINS_STATS_ACTIVE |
+                  VIR_CONNECT_GET_ALL_DOMAINS_STATS_INACTIVE |
+                  VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS |
+                  VIR_TYPED_PARAM_STRING_OKAY, -1);
+
+    if (qemuDomainGetStatsCheckSupport(&stats,
+                                       !!(flags & VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS)) < 0)
+        return -1;
+
+    /* Grab a reference on every matching domain and drop the driver
+     * lock before gathering any stats, as that may take a while */
+    qemuDriverLock(driver);
+    if (VIR_ALLOC_N(data.doms, virHashSize(driver->domains.objs) + 1) < 0) {
+        qemuDriverUnlock(driver);
+        virReportOOMError();
+        return -1;
+    }
+    virHashForEach(driver->domains.objs,
+                   qemuConnectGetAllDomainStatsCollect, &data);
+    qemuDriverUnlock(driver);
+
+    if (VIR_ALLOC_N(tmpstats, data.ndoms + 1) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    for (i = 0; i < data.ndoms; i++) {
+        virDomainObjPtr dom = data.doms[i];
+        virDomainStatsRecordPtr tmp = NULL;
+        int rc = 0;
+
+        virDomainObjLock(dom);
+        /* The domain may have been started or stopped meanwhile */
+        if (qemuConnectGetAllDomainStatsFilter(dom, flags))
+            rc = qemuDomainGetStats(conn, driver, dom, stats, &tmp);
+        virDomainObjUnlock(dom);
+
+        if (rc < 0)
+            goto cleanup;
+
+        if (tmp)
+            tmpstats[nstats++] = tmp;
+    }
+
+    *retStats = tmpstats;
+    tmpstats = NULL;
+    ret = nstats;
+
+cleanup:
+    for (i = 0; i < data.ndoms; i++) {
+        virDomainObjLock(data.doms[i]);
+        if (virDomainObjUnref(data.doms[i]) > 0)
+            virDomainObjUnlock(data.doms[i]);
+    }
+    VIR_FREE(data.doms);
+    virDomainStatsRecordListFree(tmpstats);
+    return ret;
+}
+
+
 static virDriver qemuDriver = {
     .no = VIR_DRV_QEMU,
     .name = "QEMU",
@@ -12925,6 +13726,7 @@ static virDriver qemuDriver = {
     .domainGetDiskErrors = qemuDomainGetDiskErrors, /* 0.9.10 */
     .domainSetMetadata = qemuDomainSetMetadata, /* 0.9.10 */
     .domainGetMetadata = qemuDomainGetMetadata, /* 0.9.10 */
+    .connectGetAllDomainStats = qemuConnectGetAllDomainStats, /* 0.9.12 */
     .domainPMSuspendForDuration = qemuDomainPMSuspendForDuration, /* 0.9.11 */
     .domainPMWakeup = qemuDomainPMWakeup, /* 0.9.11 */
     .domainGetCPUStats = qemuDomainGetCPUStats, /* 0.9.11 */
@@ -12937,6 +13739,7 @@ static virStateDriver qemuStateDriver = {
     .cleanup = qemudShutdown,
     .reload = qemudReload,
     .active = qemudActive,
+    .autoStart = qemudAutoStart,
 };
 
 static void
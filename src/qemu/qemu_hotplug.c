@@ -1076,7 +1076,9 @@ int qemuDomainAttachHostUsbDevice(struct qemud_driver *driver,
         usbDevice *usb;
         qemuCgroupData data;
 
-        if (virCgroupForDomain(driver->cgroup, vm->def->name, &cgroup, 0) !=0 ) {
+        /* The group is not used past the monitor call below, which
+         * may see the domain stop and its cgroup go away */
+        if (qemuGetCgroup(driver, vm, &cgroup) != 0) {
             qemuReportError(VIR_ERR_INTERNAL_ERROR,
                             _("Unable to find cgroup for %s"),
                             vm->def->name);
@@ -40,12 +40,14 @@
 #include "memory.h"
 #include "util.h"
 #include "virfile.h"
+#include "virlz4.h"
 #include "datatypes.h"
 #include "fdstream.h"
 #include "uuid.h"
 #include "virtime.h"
 #include "locking/domain_lock.h"
 #include "rpc/virnetsocket.h"
+#include "rpc/virnetprotocol.h"
 #include "storage_file.h"
 #include "viruri.h"
 #include "hooks.h"
@@ -53,6 +55,9 @@
 
 #define VIR_FROM_THIS VIR_FROM_QEMU
 
+/* Shortest interval between migration status queries, in ms */
+#define QEMU_MIGRATION_POLL_MIN 50
+
 VIR_ENUM_IMPL(qemuMigrationJobPhase, QEMU_MIGRATION_PHASE_LAST,
               "none",
               "perform2",
@@ -956,6 +961,7 @@ qemuMigrationWaitForCompletion(struct qemud_driver *driver, virDomainObjPtr vm,
 {
     qemuDomainObjPrivatePtr priv = vm->privateData;
     const char *job;
+    unsigned long long interval = QEMU_MIGRATION_POLL_MIN;
 
     switch (priv->job.asyncJob) {
     case QEMU_ASYNC_JOB_MIGRATION_OUT:
@@ -973,26 +979,43 @@ qemuMigrationWaitForCompletion(struct qemud_driver *driver, virDomainObjPtr vm,
 
     priv->job.info.type = VIR_DOMAIN_JOB_UNBOUNDED;
 
-    while (priv->job.info.type == VIR_DOMAIN_JOB_UNBOUNDED) {
-        /* Poll every 50ms for progress & to allow cancellation */
-        struct timespec ts = { .tv_sec = 0, .tv_nsec = 50 * 1000 * 1000ull };
+    while (1) {
+        unsigned long long maxInterval;
+        int rc;
 
         if (qemuMigrationUpdateJobStatus(driver, vm, job, asyncJob) < 0)
             goto cleanup;
 
+        if (priv->job.info.type != VIR_DOMAIN_JOB_UNBOUNDED)
+            break;
+
         if (dconn && virConnectIsAlive(dconn) <= 0) {
             qemuReportError(VIR_ERR_OPERATION_FAILED, "%s",
                             _("Lost connection to destination host"));
             goto cleanup;
         }
 
-        virDomainObjUnlock(vm);
-        qemuDriverUnlock(driver);
+        /* QEMU stopping the guest CPUs at the end of a live migration,
+         * the job being cancelled or QEMU going away wake us up early,
+         * so while the guest runs, the status is only polled for
+         * progress reporting, less and less often, up to
+         * migration_poll_interval. Nothing tells when the job of a
+         * paused guest (save, dump, offline migration) ends, so that
+         * one keeps being polled every QEMU_MIGRATION_POLL_MIN ms */
+        if (virDomainObjGetState(vm, NULL) == VIR_DOMAIN_RUNNING)
+            maxInterval = driver->migrationPollInterval;
+        else
+            maxInterval = QEMU_MIGRATION_POLL_MIN;
 
-        nanosleep(&ts, NULL);
+        if ((rc = qemuDomainObjWaitAsyncJobSignal(driver, vm, interval)) < 0)
+            goto cleanup;
 
-        qemuDriverLock(driver);
-        virDomainObjLock(vm);
+        if (rc > 0)
+            interval = QEMU_MIGRATION_POLL_MIN;
+        else if (interval < maxInterval)
+            interval *= 2;
+        if (interval > maxInterval)
+            interval = maxInterval;
     }
 
 cleanup:
@@ -1293,7 +1316,7 @@ qemuMigrationPrepareAny(struct qemud_driver *driver,
     qemuMigrationJobSetPhase(driver, vm, QEMU_MIGRATION_PHASE_PREPARE);
 
     /* Domain starts inactive, even if the domain XML had an id field. */
-    vm->def->id = -1;
+    virDomainObjListSetID(&driver->domains, vm, -1);
 
     if (tunnel &&
         (pipe(dataFD) < 0 || virSetCloseExec(dataFD[1]) < 0)) {
@@ -1577,10 +1600,11 @@ struct _qemuMigrationSpec {
     } fwd;
 };
 
-#define TUNNEL_SEND_BUF_SIZE 65536
+/* A single stream packet can carry up to VIR_NET_MESSAGE_PAYLOAD_MAX
+ * bytes; sending full packets keeps the per message overhead low. */
+#define TUNNEL_SEND_BUF_SIZE VIR_NET_MESSAGE_PAYLOAD_MAX
+#define TUNNEL_SEND_BUF_COUNT 4
 
-typedef struct _qemuMigrationIOThread qemuMigrationIOThread;
-typedef qemuMigrationIOThread *qemuMigrationIOThreadPtr;
 struct _qemuMigrationIOThread {
     virThread thread;
     virStreamPtr st;
@@ -1588,23 +1612,145 @@ struct _qemuMigrationIOThread {
     virError err;
     int wakeupRecvFD;
     int wakeupSendFD;
+
+    /* Data read from QEMU is queued in a ring of buffers and sent to
+     * the stream by a separate thread, so that reading from QEMU and
+     * sending to the destination overlap. All fields below are
+     * protected by lock. */
+    virMutex lock;
+    virCond cond;
+    virThread sendThread;
+    char *buffers[TUNNEL_SEND_BUF_COUNT];
+    size_t lengths[TUNNEL_SEND_BUF_COUNT];
+    size_t head;                /* Next buffer to send */
+    size_t count;               /* Number of buffers queued */
+    bool eof;                   /* No more data will be queued */
+    bool abort;                 /* Stop without sending queued data */
+    bool failed;                /* Sending failed, see sendErr */
+    virError sendErr;
 };
 
+static void qemuMigrationIOSendFunc(void *arg)
+{
+    qemuMigrationIOThreadPtr data = arg;
+
+    virMutexLock(&data->lock);
+
+    for (;;) {
+        char *buffer;
+        size_t len;
+        size_t sent = 0;
+        int rv = 0;
+
+        while (!data->count && !data->eof && !data->abort)
+            ignore_value(virCondWait(&data->cond, &data->lock));
+
+        if (data->abort || !data->count)
+            break;
+
+        buffer = data->buffers[data->head];
+        len = data->lengths[data->head];
+        virMutexUnlock(&data->lock);
+
+        while (sent < len) {
+            if ((rv = virStreamSend(data->st, buffer + sent, len - sent)) < 0)
+                break;
+            sent += rv;
+        }
+
+        virMutexLock(&data->lock);
+
+        if (rv < 0) {
+            data->failed = true;
+            virCopyLastError(&data->sendErr);
+            virResetLastError();
+            virCondBroadcast(&data->cond);
+            break;
+        }
+
+        data->head = (data->head + 1) % TUNNEL_SEND_BUF_COUNT;
+        data->count--;
+        virCondBroadcast(&data->cond);
+    }
+
+    virMutexUnlock(&data->lock);
+}
+
+/* Returns the buffer to fill next, waiting for the sender thread to
+ * release one if all of them are queued, or NULL if sending failed */
+static char *
+qemuMigrationIOGetBuffer(qemuMigrationIOThreadPtr data)
+{
+    char *buffer = NULL;
+
+    virMutexLock(&data->lock);
+    while (data->count == TUNNEL_SEND_BUF_COUNT && !data->failed)
+        ignore_value(virCondWait(&data->cond, &data->lock));
+    if (!data->failed)
+        buffer = data->buffers[(data->head + data->count) %
+                               TUNNEL_SEND_BUF_COUNT];
+    virMutexUnlock(&data->lock);
+
+    return buffer;
+}
+
+/* Queues the buffer returned by qemuMigrationIOGetBuffer */
+static void
+qemuMigrationIOPutBuffer(qemuMigrationIOThreadPtr data,
+                         size_t len)
+{
+    virMutexLock(&data->lock);
+    data->lengths[(data->head + data->count) % TUNNEL_SEND_BUF_COUNT] = len;
+    data->count++;
+    virCondBroadcast(&data->cond);
+    virMutexUnlock(&data->lock);
+}
+
+/* Tells the sender thread to stop, once the queue is empty unless
+ * @abort is true, and waits for it */
+static void
+qemuMigrationIOStopSender(qemuMigrationIOThreadPtr data,
+                          bool abort)
+{
+    virMutexLock(&data->lock);
+    if (abort)
+        data->abort = true;
+    else
+        data->eof = true;
+    virCondBroadcast(&data->cond);
+    virMutexUnlock(&data->lock);
+
+    virThreadJoin(&data->sendThread);
+}
+
 static void qemuMigrationIOFunc(void *arg)
 {
     qemuMigrationIOThreadPtr data = arg;
     char *buffer = NULL;
+    size_t len = 0;
+    bool sending = false;
     struct pollfd fds[2];
     int timeout = -1;
     virErrorPtr err = NULL;
+    int i;
 
     VIR_DEBUG("Running migration tunnel; stream=%p, sock=%d",
               data->st, data->sock);
 
-    if (VIR_ALLOC_N(buffer, TUNNEL_SEND_BUF_SIZE) < 0) {
-        virReportOOMError();
+    for (i = 0 ; i < TUNNEL_SEND_BUF_COUNT ; i++) {
+        if (VIR_ALLOC_N(data->buffers[i], TUNNEL_SEND_BUF_SIZE) < 0) {
+            virReportOOMError();
+            goto abrt;
+        }
+    }
+
+    if (virThreadCreate(&data->sendThread, true,
+                        qemuMigrationIOSendFunc, data) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create migration send thread"));
         goto abrt;
     }
+    sending = true;
 
     fds[0].fd = data->sock;
     fds[1].fd = data->wakeupRecvFD;
@@ -1612,10 +1758,15 @@ static void qemuMigrationIOFunc(void *arg)
     for (;;) {
         int ret;
 
+        if (!buffer && !(buffer = qemuMigrationIOGetBuffer(data)))
+            goto send_error;
+
         fds[0].events = fds[1].events = POLLIN;
         fds[0].revents = fds[1].revents = 0;
 
-        ret = poll(fds, ARRAY_CARDINALITY(fds), timeout);
+        /* Don't keep partially filled buffers while QEMU is slower
+         * than us; just check if there's more data to batch up */
+        ret = poll(fds, ARRAY_CARDINALITY(fds), len ? 0 : timeout);
 
         if (ret < 0) {
             if (errno == EAGAIN || errno == EINTR)
@@ -1626,6 +1777,13 @@ static void qemuMigrationIOFunc(void *arg)
         }
 
         if (ret == 0) {
+            if (len && timeout != 0) {
+                qemuMigrationIOPutBuffer(data, len);
+                buffer = NULL;
+                len = 0;
+                continue;
+            }
+
             /* We were asked to gracefully stop but reading would block. This
              * can only happen if qemu told us migration finished but didn't
              * close the migration fd. We handle this in the same way as EOF.
@@ -1653,13 +1811,19 @@ static void qemuMigrationIOFunc(void *arg)
         }
 
         if (fds[0].revents & (POLLIN | POLLERR | POLLHUP)) {
-            int nbytes;
+            ssize_t nbytes;
 
-            nbytes = saferead(data->sock, buffer, TUNNEL_SEND_BUF_SIZE);
+            nbytes = read(data->sock, buffer + len, TUNNEL_SEND_BUF_SIZE - len);
             if (nbytes > 0) {
-                if (virStreamSend(data->st, buffer, nbytes) < 0)
-                    goto error;
+                len += nbytes;
+                if (len == TUNNEL_SEND_BUF_SIZE) {
+                    qemuMigrationIOPutBuffer(data, len);
+                    buffer = NULL;
+                    len = 0;
+                }
             } else if (nbytes < 0) {
+                if (errno == EAGAIN || errno == EINTR)
+                    continue;
                 virReportSystemError(errno, "%s",
                         _("tunnelled migration failed to read from qemu"));
                 goto abrt;
@@ -1670,14 +1834,29 @@ static void qemuMigrationIOFunc(void *arg)
         }
     }
 
+    if (len)
+        qemuMigrationIOPutBuffer(data, len);
+
+    qemuMigrationIOStopSender(data, false);
+    sending = false;
+    if (data->failed)
+        goto send_error;
+
     if (virStreamFinish(data->st) < 0)
         goto error;
 
-    VIR_FREE(buffer);
+    goto cleanup;
 
-    return;
+send_error:
+    if (sending)
+        qemuMigrationIOStopSender(data, true);
+    virSetError(&data->sendErr);
+    virResetError(&data->sendErr);
+    goto error;
 
 abrt:
+    if (sending)
+        qemuMigrationIOStopSender(data, true);
     err = virSaveLastError();
     if (err && err->code == VIR_ERR_OK) {
         virFreeError(err);
@@ -1692,11 +1871,14 @@ abrt:
 error:
     virCopyLastError(&data->err);
     virResetLastError();
-    VIR_FREE(buffer);
+
+cleanup:
+    for (i = 0 ; i < TUNNEL_SEND_BUF_COUNT ; i++)
+        VIR_FREE(data->buffers[i]);
 }
 
 
-static qemuMigrationIOThreadPtr
+qemuMigrationIOThreadPtr
 qemuMigrationStartTunnel(virStreamPtr st,
                          int sock)
 {
@@ -1712,6 +1894,21 @@ qemuMigrationStartTunnel(virStreamPtr st,
     if (VIR_ALLOC(io) < 0)
         goto no_memory;
 
+    if (virMutexInit(&io->lock) < 0) {
+        VIR_FREE(io);
+        qemuReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                        _("Unable to initialize mutex"));
+        goto error;
+    }
+
+    if (virCondInit(&io->cond) < 0) {
+        virMutexDestroy(&io->lock);
+        VIR_FREE(io);
+        qemuReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                        _("Unable to initialize condition variable"));
+        goto error;
+    }
+
     io->st = st;
     io->sock = sock;
     io->wakeupRecvFD = wakeupFD[0];
@@ -1722,6 +1919,8 @@ qemuMigrationStartTunnel(virStreamPtr st,
                         io) < 0) {
         virReportSystemError(errno, "%s",
                              _("Unable to create migration thread"));
+        ignore_value(virCondDestroy(&io->cond));
+        virMutexDestroy(&io->lock);
         goto error;
     }
 
@@ -1736,7 +1935,7 @@ error:
     return NULL;
 }
 
-static int
+int
 qemuMigrationStopTunnel(qemuMigrationIOThreadPtr io, bool error)
 {
     int rv = -1;
@@ -1764,6 +1963,8 @@ qemuMigrationStopTunnel(qemuMigrationIOThreadPtr io, bool error)
     rv = 0;
 
 cleanup:
+    ignore_value(virCondDestroy(&io->cond));
+    virMutexDestroy(&io->lock);
     VIR_FORCE_CLOSE(io->wakeupSendFD);
     VIR_FORCE_CLOSE(io->wakeupRecvFD);
     VIR_FREE(io);
@@ -3161,6 +3362,8 @@ qemuMigrationToFile(struct qemud_driver *driver, virDomainObjPtr vm,
     int rc;
     bool restoreLabel = false;
     virCommandPtr cmd = NULL;
+    virLZ4StreamPtr lz4 = NULL;
+    bool useLZ4Stream = false;
     int pipeFD[2] = { -1, -1 };
     unsigned long saveMigBandwidth = priv->migMaxBandwidth;
 
@@ -3218,6 +3421,24 @@ qemuMigrationToFile(struct qemud_driver *driver, virDomainObjPtr vm,
         restoreLabel = true;
     }
 
+    /* LZ4 is compressed in process when QEMU migrates to a pipe and
+     * libvirt was built with liblz4, otherwise by the program, which
+     * QEMU would only fail to run after the migration started */
+    if (compressor && STREQ(compressor, VIR_LZ4_PROGRAM)) {
+        useLZ4Stream = pipeFD[0] != -1 && virLZ4StreamAvailable();
+        if (!useLZ4Stream) {
+            char *prog = virFindFileInPath(compressor);
+
+            if (!prog) {
+                qemuReportError(VIR_ERR_OPERATION_FAILED,
+                                _("Compression program '%s' is not available"),
+                                compressor);
+                goto cleanup;
+            }
+            VIR_FREE(prog);
+        }
+    }
+
     if (qemuDomainObjEnterMonitorAsync(driver, vm, asyncJob) < 0)
         goto cleanup;
 
@@ -3241,7 +3462,20 @@ qemuMigrationToFile(struct qemud_driver *driver, virDomainObjPtr vm,
             "-c",
             NULL
         };
-        if (pipeFD[0] != -1) {
+        if (useLZ4Stream) {
+            /* Rather than by a single threaded program, LZ4 is
+             * compressed in process, by a thread per CPU */
+            if (!(lz4 = virLZ4StreamNew(pipeFD[0], fd, 0, 0))) {
+                qemuDomainObjExitMonitorWithDriver(driver, vm);
+                goto cleanup;
+            }
+            rc = qemuMonitorMigrateToFd(priv->mon,
+                                        QEMU_MONITOR_MIGRATE_BACKGROUND,
+                                        pipeFD[1]);
+            if (VIR_CLOSE(pipeFD[0]) < 0 ||
+                VIR_CLOSE(pipeFD[1]) < 0)
+                VIR_WARN("failed to close intermediate pipe");
+        } else if (pipeFD[0] != -1) {
             cmd = virCommandNewArgs(args);
             virCommandSetInputFD(cmd, pipeFD[0]);
             virCommandSetOutputFD(cmd, &fd);
@@ -3280,6 +3514,9 @@ qemuMigrationToFile(struct qemud_driver *driver, virDomainObjPtr vm,
     if (cmd && virCommandWait(cmd, NULL) < 0)
         goto cleanup;
 
+    if (lz4 && virLZ4StreamWait(lz4) < 0)
+        goto cleanup;
+
     ret = 0;
 
 cleanup:
@@ -3293,6 +3530,7 @@ cleanup:
     VIR_FORCE_CLOSE(pipeFD[0]);
     VIR_FORCE_CLOSE(pipeFD[1]);
     virCommandFree(cmd);
+    virLZ4StreamFree(lz4);
     if (restoreLabel && (!bypassSecurityDriver) &&
         virSecurityManagerRestoreSavedStateLabel(driver->securityManager,
                                                  vm->def, path) < 0)
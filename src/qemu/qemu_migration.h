@@ -153,4 +153,15 @@ int qemuMigrationToFile(struct qemud_driver *driver, virDomainObjPtr vm,
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(5)
     ATTRIBUTE_RETURN_CHECK;
 
+/* Forwarding of QEMU's migration data over a stream, for tunnelled
+ * migration */
+typedef struct _qemuMigrationIOThread qemuMigrationIOThread;
+typedef qemuMigrationIOThread *qemuMigrationIOThreadPtr;
+
+qemuMigrationIOThreadPtr qemuMigrationStartTunnel(virStreamPtr st,
+                                                  int sock)
+    ATTRIBUTE_NONNULL(1);
+int qemuMigrationStopTunnel(qemuMigrationIOThreadPtr io, bool error)
+    ATTRIBUTE_NONNULL(1);
+
 #endif /* __QEMU_MIGRATION_H__ */
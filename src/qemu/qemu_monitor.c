@@ -56,15 +56,19 @@ struct _qemuMonitor {
 
     qemuMonitorCallbacksPtr cb;
 
-    /* If there's a command being processed this will be
-     * non-NULL */
-    qemuMonitorMessagePtr msg;
+    /* Commands submitted and not completed yet, oldest first.
+     * The JSON monitor can have all of them in flight at once,
+     * the text one only sends a command once the previous one
+     * got its reply */
+    qemuMonitorMessagePtr msgs;
 
     /* Buffer incoming data ready for Text/QMP monitor
      * code to process & find message boundaries */
     size_t bufferOffset;
     size_t bufferLength;
     char *buffer;
+    /* Bytes at the start of buffer known not to end any QMP line */
+    size_t bufferScanned;
 
     /* If anything went wrong, this will be fed back
      * the next monitor msg */
@@ -339,6 +343,56 @@ qemuMonitorOpenPty(const char *monitor)
 }
 
 
+/* Return the first message which was not completely written
+ * out yet, or NULL if there's nothing more to send for now */
+static qemuMonitorMessagePtr
+qemuMonitorNextTxMessage(qemuMonitorPtr mon)
+{
+    qemuMonitorMessagePtr msg;
+
+    for (msg = mon->msgs; msg; msg = msg->next) {
+        if (msg->txOffset < msg->txLength)
+            return msg;
+        /* Text replies can't be told apart, so wait for this one */
+        if (!mon->json && !msg->finished)
+            return NULL;
+    }
+
+    return NULL;
+}
+
+
+/* Return the message awaiting the reply tagged with @id, or the
+ * oldest message awaiting a reply if @id is NULL */
+qemuMonitorMessagePtr
+qemuMonitorFindReply(qemuMonitorPtr mon,
+                     const char *id)
+{
+    qemuMonitorMessagePtr msg;
+
+    for (msg = mon->msgs; msg; msg = msg->next) {
+        if (msg->finished || msg->txOffset < msg->txLength)
+            continue;
+        if (!id || STREQ_NULLABLE(msg->id, id))
+            return msg;
+    }
+
+    return NULL;
+}
+
+
+/* Wake up everyone waiting for a reply, which is never going to come */
+static void
+qemuMonitorAbortMessages(qemuMonitorPtr mon)
+{
+    qemuMonitorMessagePtr msg;
+
+    for (msg = mon->msgs; msg; msg = msg->next)
+        msg->finished = 1;
+    virCondBroadcast(&mon->notify);
+}
+
+
 /* This method processes data that has been received
  * from the monitor. Looking for async events and
  * replies/errors.
@@ -347,18 +401,17 @@ static int
 qemuMonitorIOProcess(qemuMonitorPtr mon)
 {
     int len;
-    qemuMonitorMessagePtr msg = NULL;
+    qemuMonitorMessagePtr msg;
 
     /* See if there's a message & whether its ready for its reply
      * ie whether its completed writing all its data */
-    if (mon->msg && mon->msg->txOffset == mon->msg->txLength)
-        msg = mon->msg;
+    msg = qemuMonitorFindReply(mon, NULL);
 
 #if DEBUG_IO
 # if DEBUG_RAW_IO
     char *str1 = qemuMonitorEscapeNonPrintable(msg ? msg->txBuffer : "");
     char *str2 = qemuMonitorEscapeNonPrintable(mon->buffer);
-    VIR_ERROR(_("Process %d %p %p [[[[%s]]][[[%s]]]"), (int)mon->bufferOffset, mon->msg, msg, str1, str2);
+    VIR_ERROR(_("Process %d %p %p [[[[%s]]][[[%s]]]"), (int)mon->bufferOffset, mon->msgs, msg, str1, str2);
     VIR_FREE(str1);
     VIR_FREE(str2);
 # else
@@ -369,30 +422,44 @@ qemuMonitorIOProcess(qemuMonitorPtr mon)
     PROBE(QEMU_MONITOR_IO_PROCESS,
           "mon=%p buf=%s len=%zu", mon, mon->buffer, mon->bufferOffset);
 
-    if (mon->json)
-        len = qemuMonitorJSONIOProcess(mon,
-                                       mon->buffer, mon->bufferOffset,
-                                       msg);
-    else
+    /* Replies to JSON commands are matched by their id. Large replies
+     * come in many reads, so only look for the end of a line in the
+     * data read since last time rather than from the start again. */
+    if (mon->json) {
+        if (memchr(mon->buffer + mon->bufferScanned, '\n',
+                   mon->bufferOffset - mon->bufferScanned))
+            len = qemuMonitorJSONIOProcess(mon,
+                                           mon->buffer, mon->bufferOffset);
+        else
+            len = 0;
+    } else {
         len = qemuMonitorTextIOProcess(mon,
                                        mon->buffer, mon->bufferOffset,
                                        msg);
+    }
 
     if (len < 0)
         return -1;
 
     if (len < mon->bufferOffset) {
-        memmove(mon->buffer, mon->buffer + len, mon->bufferOffset - len);
-        mon->bufferOffset -= len;
+        if (len > 0) {
+            memmove(mon->buffer, mon->buffer + len, mon->bufferOffset - len);
+            mon->bufferOffset -= len;
+        }
+        mon->bufferScanned = mon->bufferOffset;
     } else {
         VIR_FREE(mon->buffer);
-        mon->bufferOffset = mon->bufferLength = 0;
+        mon->bufferOffset = mon->bufferLength = mon->bufferScanned = 0;
     }
 #if DEBUG_IO
     VIR_DEBUG("Process done %d used %d", (int)mon->bufferOffset, len);
 #endif
-    if (msg && msg->finished)
-        virCondBroadcast(&mon->notify);
+    for (msg = mon->msgs; msg; msg = msg->next) {
+        if (msg->finished) {
+            virCondBroadcast(&mon->notify);
+            break;
+        }
+    }
     return len;
 }
 
@@ -441,54 +508,59 @@ qemuMonitorIOWriteWithFD(qemuMonitorPtr mon,
 /*
  * Called when the monitor is able to write data
  * Call this function while holding the monitor lock.
+ *
+ * Writes out as many of the queued messages as the
+ * monitor accepts, without waiting for replies
  */
 static int
 qemuMonitorIOWrite(qemuMonitorPtr mon)
 {
+    qemuMonitorMessagePtr msg;
     int done;
+    int ret = 0;
 
-    /* If no active message, or fully transmitted, the no-op */
-    if (!mon->msg || mon->msg->txOffset == mon->msg->txLength)
-        return 0;
-
-    if (mon->msg->txFD != -1 && !mon->hasSendFD) {
-        qemuReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                        _("Monitor does not support sending of file descriptors"));
-        return -1;
-    }
-
-    if (mon->msg->txFD == -1)
-        done = write(mon->fd,
-                     mon->msg->txBuffer + mon->msg->txOffset,
-                     mon->msg->txLength - mon->msg->txOffset);
-    else
-        done = qemuMonitorIOWriteWithFD(mon,
-                                        mon->msg->txBuffer + mon->msg->txOffset,
-                                        mon->msg->txLength - mon->msg->txOffset,
-                                        mon->msg->txFD);
-
-    PROBE(QEMU_MONITOR_IO_WRITE,
-          "mon=%p buf=%s len=%d ret=%d errno=%d",
-          mon,
-          mon->msg->txBuffer + mon->msg->txOffset,
-          mon->msg->txLength - mon->msg->txOffset,
-          done, errno);
-
-    if (mon->msg->txFD != -1)
-        PROBE(QEMU_MONITOR_IO_SEND_FD,
-              "mon=%p fd=%d ret=%d errno=%d",
-              mon, mon->msg->txFD, done, errno);
+    while ((msg = qemuMonitorNextTxMessage(mon))) {
+        if (msg->txFD != -1 && !mon->hasSendFD) {
+            qemuReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                            _("Monitor does not support sending of file descriptors"));
+            return -1;
+        }
 
-    if (done < 0) {
-        if (errno == EAGAIN)
-            return 0;
+        if (msg->txFD == -1)
+            done = write(mon->fd,
+                         msg->txBuffer + msg->txOffset,
+                         msg->txLength - msg->txOffset);
+        else
+            done = qemuMonitorIOWriteWithFD(mon,
+                                            msg->txBuffer + msg->txOffset,
+                                            msg->txLength - msg->txOffset,
+                                            msg->txFD);
+
+        PROBE(QEMU_MONITOR_IO_WRITE,
+              "mon=%p buf=%s len=%d ret=%d errno=%d",
+              mon,
+              msg->txBuffer + msg->txOffset,
+              msg->txLength - msg->txOffset,
+              done, errno);
+
+        if (msg->txFD != -1)
+            PROBE(QEMU_MONITOR_IO_SEND_FD,
+                  "mon=%p fd=%d ret=%d errno=%d",
+                  mon, msg->txFD, done, errno);
+
+        if (done < 0) {
+            if (errno == EAGAIN)
+                break;
 
-        virReportSystemError(errno, "%s",
-                             _("Unable to write to monitor"));
-        return -1;
+            virReportSystemError(errno, "%s",
+                                 _("Unable to write to monitor"));
+            return -1;
+        }
+        msg->txOffset += done;
+        ret += done;
     }
-    mon->msg->txOffset += done;
-    return done;
+
+    return ret;
 }
 
 /*
@@ -503,14 +575,18 @@ qemuMonitorIORead(qemuMonitorPtr mon)
     size_t avail = mon->bufferLength - mon->bufferOffset;
     int ret = 0;
 
+    /* Grow geometrically, large replies would be copied over and
+     * over otherwise */
     if (avail < 1024) {
+        size_t grow = mon->bufferLength < 1024 ? 1024 : mon->bufferLength;
+
         if (VIR_REALLOC_N(mon->buffer,
-                          mon->bufferLength + 1024) < 0) {
+                          mon->bufferLength + grow) < 0) {
             virReportOOMError();
             return -1;
         }
-        mon->bufferLength += 1024;
-        avail += 1024;
+        mon->bufferLength += grow;
+        avail += grow;
     }
 
     /* Read as much as we can get into our buffer,
@@ -554,7 +630,7 @@ static void qemuMonitorUpdateWatch(qemuMonitorPtr mon)
     if (mon->lastError.code == VIR_ERR_OK) {
         events |= VIR_EVENT_HANDLE_READABLE;
 
-        if (mon->msg && mon->msg->txOffset < mon->msg->txLength)
+        if (qemuMonitorNextTxMessage(mon))
             events |= VIR_EVENT_HANDLE_WRITABLE;
     }
 
@@ -648,12 +724,10 @@ qemuMonitorIO(int watch, int fd, int events, void *opaque) {
         }
 
         VIR_DEBUG("Error on monitor %s", NULLSTR(mon->lastError.message));
-        /* If IO process resulted in an error & we have a message,
-         * then wakeup that waiter */
-        if (mon->msg && !mon->msg->finished) {
-            mon->msg->finished = 1;
-            virCondSignal(&mon->notify);
-        }
+        /* If IO process resulted in an error & we have messages,
+         * then wakeup their waiters */
+        if (mon->msgs)
+            qemuMonitorAbortMessages(mon);
     }
 
     qemuMonitorUpdateWatch(mon);
@@ -667,7 +741,7 @@ qemuMonitorIO(int watch, int fd, int events, void *opaque) {
         virDomainObjPtr vm = mon->vm;
 
         /* Make sure anyone waiting wakes up now */
-        virCondSignal(&mon->notify);
+        virCondBroadcast(&mon->notify);
         if (qemuMonitorUnref(mon) > 0)
             qemuMonitorUnlock(mon);
         VIR_DEBUG("Triggering EOF callback");
@@ -678,7 +752,7 @@ qemuMonitorIO(int watch, int fd, int events, void *opaque) {
         virDomainObjPtr vm = mon->vm;
 
         /* Make sure anyone waiting wakes up now */
-        virCondSignal(&mon->notify);
+        virCondBroadcast(&mon->notify);
         if (qemuMonitorUnref(mon) > 0)
             qemuMonitorUnlock(mon);
         VIR_DEBUG("Triggering error callback");
@@ -807,10 +881,10 @@ void qemuMonitorClose(qemuMonitorPtr mon)
         VIR_FORCE_CLOSE(mon->fd);
     }
 
-    /* In case another thread is waiting for its monitor command to be
-     * processed, we need to wake it up with appropriate error set.
+    /* In case other threads are waiting for their monitor commands to
+     * be processed, we need to wake them up with appropriate error set.
      */
-    if (mon->msg) {
+    if (mon->msgs) {
         if (mon->lastError.code == VIR_ERR_OK) {
             virErrorPtr err = virSaveLastError();
 
@@ -824,8 +898,7 @@ void qemuMonitorClose(qemuMonitorPtr mon)
                 virResetLastError();
             }
         }
-        mon->msg->finished = 1;
-        virCondSignal(&mon->notify);
+        qemuMonitorAbortMessages(mon);
     }
 
     if (qemuMonitorUnref(mon) > 0)
@@ -845,10 +918,14 @@ char *qemuMonitorNextCommandID(qemuMonitorPtr mon)
 }
 
 
-int qemuMonitorSend(qemuMonitorPtr mon,
-                    qemuMonitorMessagePtr msg)
+/* Queue @msg for sending to QEMU, without waiting for its reply.
+ * Each message successfully submitted must be passed on to
+ * qemuMonitorComplete, before its memory can be released.
+ */
+int qemuMonitorSubmit(qemuMonitorPtr mon,
+                      qemuMonitorMessagePtr msg)
 {
-    int ret = -1;
+    qemuMonitorMessagePtr *tail = &mon->msgs;
 
     /* Check whether qemu quited unexpectedly */
     if (mon->lastError.code != VIR_ERR_OK) {
@@ -858,14 +935,32 @@ int qemuMonitorSend(qemuMonitorPtr mon,
         return -1;
     }
 
-    mon->msg = msg;
+    while (*tail)
+        tail = &(*tail)->next;
+    msg->next = NULL;
+    *tail = msg;
     qemuMonitorUpdateWatch(mon);
 
     PROBE(QEMU_MONITOR_SEND_MSG,
           "mon=%p msg=%s fd=%d",
-          mon, mon->msg->txBuffer, mon->msg->txFD);
+          mon, msg->txBuffer, msg->txFD);
 
-    while (!mon->msg->finished) {
+    return 0;
+}
+
+
+/* Wait for the reply to @msg, previously passed to qemuMonitorSubmit,
+ * and remove it from the queue of the monitor. Replies to other
+ * messages may arrive first, they don't need to be completed in
+ * the order they were submitted.
+ */
+int qemuMonitorComplete(qemuMonitorPtr mon,
+                        qemuMonitorMessagePtr msg)
+{
+    qemuMonitorMessagePtr *tmp;
+    int ret = -1;
+
+    while (!msg->finished) {
         if (virCondWait(&mon->notify, &mon->lock) < 0) {
             qemuReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                             _("Unable to wait on monitor condition"));
@@ -883,13 +978,29 @@ int qemuMonitorSend(qemuMonitorPtr mon,
     ret = 0;
 
 cleanup:
-    mon->msg = NULL;
+    for (tmp = &mon->msgs; *tmp; tmp = &(*tmp)->next) {
+        if (*tmp == msg) {
+            *tmp = msg->next;
+            break;
+        }
+    }
+    msg->next = NULL;
     qemuMonitorUpdateWatch(mon);
 
     return ret;
 }
 
 
+int qemuMonitorSend(qemuMonitorPtr mon,
+                    qemuMonitorMessagePtr msg)
+{
+    if (qemuMonitorSubmit(mon, msg) < 0)
+        return -1;
+
+    return qemuMonitorComplete(mon, msg);
+}
+
+
 int qemuMonitorHMPCommandWithFd(qemuMonitorPtr mon,
                                 const char *cmd,
                                 int scm_fd,
@@ -1447,6 +1558,101 @@ int qemuMonitorGetBlockStatsInfo(qemuMonitorPtr mon,
     return ret;
 }
 
+/* Return a hash table of qemuBlockStats keyed by the guest side
+ * device alias, covering all block devices of the domain with a
+ * single monitor command. Fields QEMU does not report are set to -1.
+ */
+virHashTablePtr
+qemuMonitorGetAllBlockStatsInfo(qemuMonitorPtr mon)
+{
+    int ret;
+    virHashTablePtr table;
+
+    VIR_DEBUG("mon=%p", mon);
+
+    if (!mon) {
+        qemuReportError(VIR_ERR_INVALID_ARG, "%s",
+                        _("monitor must not be NULL"));
+        return NULL;
+    }
+
+    if (!(table = virHashCreate(32, (virHashDataFree) free)))
+        return NULL;
+
+    if (mon->json)
+        ret = qemuMonitorJSONGetAllBlockStatsInfo(mon, table);
+    else
+        ret = qemuMonitorTextGetAllBlockStatsInfo(mon, table);
+
+    if (ret < 0) {
+        virHashFree(table);
+        return NULL;
+    }
+
+    return table;
+}
+
+/* Fetch the current balloon size into @currmem, storing what
+ * qemuMonitorGetBalloonInfo would return in @balloonRet, and the
+ * stats of all block devices into @blockstats, as returned by
+ * qemuMonitorGetAllBlockStatsInfo. Either group is skipped if its
+ * pointers are NULL. The JSON monitor sends all the queries before
+ * waiting for the first reply. Returns 0 if all the requested stats
+ * were fetched, -1 otherwise.
+ */
+int
+qemuMonitorGetAllStatsInfo(qemuMonitorPtr mon,
+                           int *balloonRet,
+                           unsigned long long *currmem,
+                           virHashTablePtr *blockstats)
+{
+    int ret = 0;
+    int blockRet = -1;
+    virHashTablePtr table = NULL;
+
+    VIR_DEBUG("mon=%p balloon=%d block=%d",
+              mon, currmem != NULL, blockstats != NULL);
+
+    if (currmem)
+        *balloonRet = -1;
+    if (blockstats)
+        *blockstats = NULL;
+
+    if (!mon) {
+        qemuReportError(VIR_ERR_INVALID_ARG, "%s",
+                        _("monitor must not be NULL"));
+        return -1;
+    }
+
+    if (blockstats &&
+        !(table = virHashCreate(32, (virHashDataFree) free)))
+        return -1;
+
+    if (mon->json) {
+        ret = qemuMonitorJSONGetAllStatsInfo(mon, currmem, balloonRet,
+                                             table, &blockRet);
+    } else {
+        if (currmem)
+            *balloonRet = qemuMonitorTextGetBalloonInfo(mon, currmem);
+        if (table)
+            blockRet = qemuMonitorTextGetAllBlockStatsInfo(mon, table);
+    }
+
+    if (currmem && *balloonRet < 0)
+        ret = -1;
+
+    if (table) {
+        if (blockRet < 0) {
+            virHashFree(table);
+            ret = -1;
+        } else {
+            *blockstats = table;
+        }
+    }
+
+    return ret;
+}
+
 /* Return 0 and update @nparams with the number of block stats
  * QEMU supports if success. Return -1 if failure.
  */
@@ -57,6 +57,8 @@ struct _qemuMonitorMessage {
     int rxLength;
     /* Used by the JSON monitor to hold reply / error */
     void *rxObject;
+    /* Used by the JSON monitor to match the reply to the command */
+    char *id;
 
     /* True if rxBuffer / rxObject are ready, or a
      * fatal error occurred on the monitor channel
@@ -65,6 +67,9 @@ struct _qemuMonitorMessage {
 
     qemuMonitorPasswordHandler passwordHandler;
     void *passwordOpaque;
+
+    /* Next message submitted to the same monitor */
+    qemuMonitorMessagePtr next;
 };
 
 typedef struct _qemuMonitorCallbacks qemuMonitorCallbacks;
@@ -164,6 +169,12 @@ int qemuMonitorSetLink(qemuMonitorPtr mon,
 char *qemuMonitorNextCommandID(qemuMonitorPtr mon);
 int qemuMonitorSend(qemuMonitorPtr mon,
                     qemuMonitorMessagePtr msg);
+int qemuMonitorSubmit(qemuMonitorPtr mon,
+                      qemuMonitorMessagePtr msg);
+int qemuMonitorComplete(qemuMonitorPtr mon,
+                        qemuMonitorMessagePtr msg);
+qemuMonitorMessagePtr qemuMonitorFindReply(qemuMonitorPtr mon,
+                                           const char *id);
 int qemuMonitorHMPCommandWithFd(qemuMonitorPtr mon,
                                 const char *cmd,
                                 int scm_fd,
@@ -270,6 +281,25 @@ int qemuMonitorGetBlockStatsInfo(qemuMonitorPtr mon,
 int qemuMonitorGetBlockStatsParamsNumber(qemuMonitorPtr mon,
                                          int *nparams);
 
+typedef struct _qemuBlockStats qemuBlockStats;
+typedef qemuBlockStats *qemuBlockStatsPtr;
+struct _qemuBlockStats {
+    long long rd_req;
+    long long rd_bytes;
+    long long rd_total_times;
+    long long wr_req;
+    long long wr_bytes;
+    long long wr_total_times;
+    long long flush_req;
+    long long flush_total_times;
+};
+
+virHashTablePtr qemuMonitorGetAllBlockStatsInfo(qemuMonitorPtr mon);
+int qemuMonitorGetAllStatsInfo(qemuMonitorPtr mon,
+                               int *balloonRet,
+                               unsigned long long *currmem,
+                               virHashTablePtr *blockstats);
+
 int qemuMonitorGetBlockExtent(qemuMonitorPtr mon,
                               const char *dev_name,
                               unsigned long long *extent);
@@ -46,8 +46,6 @@
 #define VIR_FROM_THIS VIR_FROM_QEMU
 
 
-#define LINE_ENDING "\r\n"
-
 static void qemuMonitorJSONHandleShutdown(qemuMonitorPtr mon, virJSONValuePtr data);
 static void qemuMonitorJSONHandleReset(qemuMonitorPtr mon, virJSONValuePtr data);
 static void qemuMonitorJSONHandlePowerdown(qemuMonitorPtr mon, virJSONValuePtr data);
@@ -130,10 +128,10 @@ qemuMonitorJSONIOProcessEvent(qemuMonitorPtr mon,
 
 static int
 qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
-                             const char *line,
-                             qemuMonitorMessagePtr msg)
+                             const char *line)
 {
     virJSONValuePtr obj = NULL;
+    qemuMonitorMessagePtr msg;
     int ret = -1;
 
     VIR_DEBUG("Line [%s]", line);
@@ -157,6 +155,10 @@ qemuMonitorJSONIOProcessLine(qemuMonitorPtr mon,
                virJSONValueObjectHasKey(obj, "return") == 1) {
         PROBE(QEMU_MONITOR_RECV_REPLY,
               "mon=%p reply=%s", mon, line);
+        /* Replies come without an id only if QEMU couldn't
+         * parse the command, which is the oldest one sent */
+        msg = qemuMonitorFindReply(mon,
+                                   virJSONValueObjectGetString(obj, "id"));
         if (msg) {
             msg->rxObject = obj;
             msg->finished = 1;
@@ -176,62 +178,77 @@ cleanup:
     return ret;
 }
 
+/*
+ * Each line ending with \r\n in @data is parsed right where it is in
+ * the monitor buffer, the line ending being overwritten to terminate
+ * it, since the caller drops all the lines used anyway.
+ */
 int qemuMonitorJSONIOProcess(qemuMonitorPtr mon,
-                             const char *data,
-                             size_t len,
-                             qemuMonitorMessagePtr msg)
+                             char *data,
+                             size_t len)
 {
-    int used = 0;
+    char *line = data;
+    char *nl = data;
+    int used;
     /*VIR_DEBUG("Data %d bytes [%s]", len, data);*/
 
-    while (used < len) {
-        char *nl = strstr(data + used, LINE_ENDING);
+    while ((nl = memchr(nl, '\n', data + len - nl))) {
+        if (nl == line || nl[-1] != '\r') {
+            nl++;
+            continue;
+        }
 
-        if (nl) {
-            int got = nl - (data + used);
-            char *line = strndup(data + used, got);
-            if (!line) {
-                virReportOOMError();
-                return -1;
-            }
-            used += got + strlen(LINE_ENDING);
-            line[got] = '\0'; /* kill \n */
-            if (qemuMonitorJSONIOProcessLine(mon, line, msg) < 0) {
-                VIR_FREE(line);
-                return -1;
-            }
+        nl[-1] = '\0'; /* kill \r\n */
+        if (qemuMonitorJSONIOProcessLine(mon, line) < 0)
+            return -1;
 
-            VIR_FREE(line);
-        } else {
-            break;
-        }
+        line = ++nl;
     }
 
+    used = line - data;
     VIR_DEBUG("Total used %d bytes out of %zd available in buffer", used, len);
     return used;
 }
 
-static int
-qemuMonitorJSONCommandWithFd(qemuMonitorPtr mon,
+static void
+qemuMonitorJSONMessageFree(qemuMonitorMessagePtr msg)
+{
+    if (!msg)
+        return;
+
+    virJSONValueFree(msg->rxObject);
+    VIR_FREE(msg->id);
+    VIR_FREE(msg->txBuffer);
+    VIR_FREE(msg);
+}
+
+/* Queue @cmd for sending to QEMU without waiting for its reply,
+ * which is then collected by passing @msg to
+ * qemuMonitorJSONCommandComplete.
+ */
+int
+qemuMonitorJSONCommandSubmit(qemuMonitorPtr mon,
                              virJSONValuePtr cmd,
                              int scm_fd,
-                             virJSONValuePtr *reply)
+                             qemuMonitorMessagePtr *msg)
 {
     int ret = -1;
-    qemuMonitorMessage msg;
+    qemuMonitorMessagePtr tmp = NULL;
     char *cmdstr = NULL;
-    char *id = NULL;
     virJSONValuePtr exe;
 
-    *reply = NULL;
+    *msg = NULL;
 
-    memset(&msg, 0, sizeof(msg));
+    if (VIR_ALLOC(tmp) < 0) {
+        virReportOOMError();
+        return -1;
+    }
 
     exe = virJSONValueObjectGet(cmd, "execute");
     if (exe) {
-        if (!(id = qemuMonitorNextCommandID(mon)))
+        if (!(tmp->id = qemuMonitorNextCommandID(mon)))
             goto cleanup;
-        if (virJSONValueObjectAppendString(cmd, "id", id) < 0) {
+        if (virJSONValueObjectAppendString(cmd, "id", tmp->id) < 0) {
             qemuReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                             _("Unable to append command 'id' string"));
             goto cleanup;
@@ -242,39 +259,127 @@ qemuMonitorJSONCommandWithFd(qemuMonitorPtr mon,
         virReportOOMError();
         goto cleanup;
     }
-    if (virAsprintf(&msg.txBuffer, "%s\r\n", cmdstr) < 0) {
+    if (virAsprintf(&tmp->txBuffer, "%s\r\n", cmdstr) < 0) {
         virReportOOMError();
         goto cleanup;
     }
-    msg.txLength = strlen(msg.txBuffer);
-    msg.txFD = scm_fd;
+    tmp->txLength = strlen(tmp->txBuffer);
+    tmp->txFD = scm_fd;
 
     VIR_DEBUG("Send command '%s' for write with FD %d", cmdstr, scm_fd);
 
-    ret = qemuMonitorSend(mon, &msg);
+    if (qemuMonitorSubmit(mon, tmp) < 0)
+        goto cleanup;
+
+    *msg = tmp;
+    tmp = NULL;
+    ret = 0;
+
+cleanup:
+    qemuMonitorJSONMessageFree(tmp);
+    VIR_FREE(cmdstr);
+
+    return ret;
+}
+
+/* Wait for the reply to a command queued by qemuMonitorJSONCommandSubmit
+ * and store it in @reply. @msg is freed in any case.
+ */
+int
+qemuMonitorJSONCommandComplete(qemuMonitorPtr mon,
+                               qemuMonitorMessagePtr msg,
+                               virJSONValuePtr *reply)
+{
+    int ret;
+
+    *reply = NULL;
+
+    ret = qemuMonitorComplete(mon, msg);
 
     VIR_DEBUG("Receive command reply ret=%d rxObject=%p",
-              ret, msg.rxObject);
+              ret, msg->rxObject);
 
 
     if (ret == 0) {
-        if (!msg.rxObject) {
+        if (!msg->rxObject) {
             qemuReportError(VIR_ERR_INTERNAL_ERROR, "%s",
                             _("Missing monitor reply object"));
             ret = -1;
         } else {
-            *reply = msg.rxObject;
+            *reply = msg->rxObject;
+            msg->rxObject = NULL;
         }
     }
 
-cleanup:
-    VIR_FREE(id);
-    VIR_FREE(cmdstr);
-    VIR_FREE(msg.txBuffer);
+    qemuMonitorJSONMessageFree(msg);
 
     return ret;
 }
 
+/* Send all of @cmds to QEMU before waiting for any reply, so that
+ * they cost a single round trip instead of one each. On success
+ * @replies holds the reply to each command, which still has to be
+ * checked for errors reported by QEMU.
+ */
+int
+qemuMonitorJSONCommandBatch(qemuMonitorPtr mon,
+                            virJSONValuePtr *cmds,
+                            size_t ncmds,
+                            virJSONValuePtr *replies)
+{
+    int ret = 0;
+    qemuMonitorMessagePtr *msgs = NULL;
+    size_t nsubmitted;
+    size_t i;
+
+    memset(replies, 0, sizeof(*replies) * ncmds);
+
+    if (VIR_ALLOC_N(msgs, ncmds) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    for (nsubmitted = 0; nsubmitted < ncmds; nsubmitted++) {
+        if (qemuMonitorJSONCommandSubmit(mon, cmds[nsubmitted], -1,
+                                         &msgs[nsubmitted]) < 0) {
+            ret = -1;
+            break;
+        }
+    }
+
+    /* Whatever was submitted must be completed, even on failure */
+    for (i = 0; i < nsubmitted; i++) {
+        if (qemuMonitorJSONCommandComplete(mon, msgs[i], &replies[i]) < 0)
+            ret = -1;
+    }
+
+    if (ret < 0) {
+        for (i = 0; i < ncmds; i++) {
+            virJSONValueFree(replies[i]);
+            replies[i] = NULL;
+        }
+    }
+
+    VIR_FREE(msgs);
+    return ret;
+}
+
+static int
+qemuMonitorJSONCommandWithFd(qemuMonitorPtr mon,
+                             virJSONValuePtr cmd,
+                             int scm_fd,
+                             virJSONValuePtr *reply)
+{
+    qemuMonitorMessagePtr msg;
+
+    *reply = NULL;
+
+    if (qemuMonitorJSONCommandSubmit(mon, cmd, scm_fd, &msg) < 0)
+        return -1;
+
+    return qemuMonitorJSONCommandComplete(mon, msg, reply);
+}
+
 
 static int
 qemuMonitorJSONCommand(qemuMonitorPtr mon,
@@ -1328,6 +1433,39 @@ cleanup:
  * Returns: 0 if balloon not supported, +1 if balloon query worked
  * or -1 on failure
  */
+static int
+qemuMonitorJSONParseBalloonInfo(virJSONValuePtr cmd,
+                                virJSONValuePtr reply,
+                                unsigned long long *currmem)
+{
+    virJSONValuePtr data;
+    unsigned long long mem;
+
+    /* See if balloon soft-failed */
+    if (qemuMonitorJSONHasError(reply, "DeviceNotActive") ||
+        qemuMonitorJSONHasError(reply, "KVMMissingCap"))
+        return 0;
+
+    /* See if any other fatal error occurred */
+    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
+        return -1;
+
+    if (!(data = virJSONValueObjectGet(reply, "return"))) {
+        qemuReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                        _("info balloon reply was missing return data"));
+        return -1;
+    }
+
+    if (virJSONValueObjectGetNumberUlong(data, "actual", &mem) < 0) {
+        qemuReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                        _("info balloon reply was missing balloon data"));
+        return -1;
+    }
+
+    *currmem = (mem/1024);
+    return 1;
+}
+
 int qemuMonitorJSONGetBalloonInfo(qemuMonitorPtr mon,
                                   unsigned long long *currmem)
 {
@@ -1343,40 +1481,9 @@ int qemuMonitorJSONGetBalloonInfo(qemuMonitorPtr mon,
 
     ret = qemuMonitorJSONCommand(mon, cmd, &reply);
 
-    if (ret == 0) {
-        /* See if balloon soft-failed */
-        if (qemuMonitorJSONHasError(reply, "DeviceNotActive") ||
-            qemuMonitorJSONHasError(reply, "KVMMissingCap"))
-            goto cleanup;
-
-        /* See if any other fatal error occurred */
-        ret = qemuMonitorJSONCheckError(cmd, reply);
-
-        /* Success */
-        if (ret == 0) {
-            virJSONValuePtr data;
-            unsigned long long mem;
-
-            if (!(data = virJSONValueObjectGet(reply, "return"))) {
-                qemuReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                                _("info balloon reply was missing return data"));
-                ret = -1;
-                goto cleanup;
-            }
-
-            if (virJSONValueObjectGetNumberUlong(data, "actual", &mem) < 0) {
-                qemuReportError(VIR_ERR_INTERNAL_ERROR, "%s",
-                                _("info balloon reply was missing balloon data"));
-                ret = -1;
-                goto cleanup;
-            }
-
-            *currmem = (mem/1024);
-            ret = 1;
-        }
-    }
+    if (ret == 0)
+        ret = qemuMonitorJSONParseBalloonInfo(cmd, reply, currmem);
 
-cleanup:
     virJSONValueFree(cmd);
     virJSONValueFree(reply);
     return ret;
@@ -1839,6 +1946,187 @@ cleanup:
     return ret;
 }
 
+
+static int
+qemuMonitorJSONGetBlockStatsField(virJSONValuePtr stats,
+                                  const char *key,
+                                  bool optional,
+                                  long long *value)
+{
+    *value = -1;
+
+    if (optional && !virJSONValueObjectHasKey(stats, key))
+        return 0;
+
+    if (virJSONValueObjectGetNumberLong(stats, key, value) < 0) {
+        qemuReportError(VIR_ERR_INTERNAL_ERROR,
+                        _("cannot read %s statistic"), key);
+        return -1;
+    }
+
+    return 0;
+}
+
+
+static int
+qemuMonitorJSONParseAllBlockStatsInfo(virJSONValuePtr cmd,
+                                      virJSONValuePtr reply,
+                                      virHashTablePtr table)
+{
+    int i;
+    virJSONValuePtr devices;
+
+    if (qemuMonitorJSONCheckError(cmd, reply) < 0)
+        return -1;
+
+    devices = virJSONValueObjectGet(reply, "return");
+    if (!devices || devices->type != VIR_JSON_TYPE_ARRAY) {
+        qemuReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                        _("blockstats reply was missing device list"));
+        return -1;
+    }
+
+    for (i = 0 ; i < virJSONValueArraySize(devices) ; i++) {
+        virJSONValuePtr dev = virJSONValueArrayGet(devices, i);
+        virJSONValuePtr stats;
+        qemuBlockStatsPtr bstats;
+        const char *thisdev;
+
+        if (!dev || dev->type != VIR_JSON_TYPE_OBJECT ||
+            (thisdev = virJSONValueObjectGetString(dev, "device")) == NULL) {
+            qemuReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                            _("blockstats device entry was not in expected format"));
+            return -1;
+        }
+
+        if ((stats = virJSONValueObjectGet(dev, "stats")) == NULL ||
+            stats->type != VIR_JSON_TYPE_OBJECT) {
+            qemuReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                            _("blockstats stats entry was not in expected format"));
+            return -1;
+        }
+
+        /* Strip the host side 'drive-' prefix, as callers look up
+         * devices by their guest side alias */
+        if (STRPREFIX(thisdev, QEMU_DRIVE_HOST_PREFIX))
+            thisdev += strlen(QEMU_DRIVE_HOST_PREFIX);
+
+        if (VIR_ALLOC(bstats) < 0) {
+            virReportOOMError();
+            return -1;
+        }
+
+        if (virHashAddEntry(table, thisdev, bstats) < 0) {
+            VIR_FREE(bstats);
+            return -1;
+        }
+
+        if (qemuMonitorJSONGetBlockStatsField(stats, "rd_bytes", false,
+                                              &bstats->rd_bytes) < 0 ||
+            qemuMonitorJSONGetBlockStatsField(stats, "rd_operations", false,
+                                              &bstats->rd_req) < 0 ||
+            qemuMonitorJSONGetBlockStatsField(stats, "rd_total_times_ns", true,
+                                              &bstats->rd_total_times) < 0 ||
+            qemuMonitorJSONGetBlockStatsField(stats, "wr_bytes", false,
+                                              &bstats->wr_bytes) < 0 ||
+            qemuMonitorJSONGetBlockStatsField(stats, "wr_operations", false,
+                                              &bstats->wr_req) < 0 ||
+            qemuMonitorJSONGetBlockStatsField(stats, "wr_total_times_ns", true,
+                                              &bstats->wr_total_times) < 0 ||
+            qemuMonitorJSONGetBlockStatsField(stats, "flush_operations", true,
+                                              &bstats->flush_req) < 0 ||
+            qemuMonitorJSONGetBlockStatsField(stats, "flush_total_times_ns", true,
+                                              &bstats->flush_total_times) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+
+int qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorPtr mon,
+                                        virHashTablePtr table)
+{
+    int ret;
+    virJSONValuePtr cmd = qemuMonitorJSONMakeCommand("query-blockstats",
+                                                     NULL);
+    virJSONValuePtr reply = NULL;
+
+    if (!cmd)
+        return -1;
+
+    ret = qemuMonitorJSONCommand(mon, cmd, &reply);
+
+    if (ret == 0)
+        ret = qemuMonitorJSONParseAllBlockStatsInfo(cmd, reply, table);
+
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
+
+
+/* Send query-balloon, if @currmem is non-NULL, and query-blockstats,
+ * if @table is non-NULL, in a single batch. What the balloon query
+ * and the blockstats one would return on their own is stored in
+ * @balloonRet and @blockRet respectively.
+ */
+int qemuMonitorJSONGetAllStatsInfo(qemuMonitorPtr mon,
+                                   unsigned long long *currmem,
+                                   int *balloonRet,
+                                   virHashTablePtr table,
+                                   int *blockRet)
+{
+    int ret = -1;
+    virJSONValuePtr cmds[2];
+    virJSONValuePtr replies[2];
+    int balloon = -1;
+    int block = -1;
+    size_t ncmds = 0;
+    size_t i;
+
+    memset(replies, 0, sizeof(replies));
+
+    if (currmem) {
+        *currmem = 0;
+        *balloonRet = -1;
+        if (!(cmds[ncmds] = qemuMonitorJSONMakeCommand("query-balloon",
+                                                       NULL)))
+            goto cleanup;
+        balloon = ncmds++;
+    }
+
+    if (table) {
+        *blockRet = -1;
+        if (!(cmds[ncmds] = qemuMonitorJSONMakeCommand("query-blockstats",
+                                                       NULL)))
+            goto cleanup;
+        block = ncmds++;
+    }
+
+    if (qemuMonitorJSONCommandBatch(mon, cmds, ncmds, replies) < 0)
+        goto cleanup;
+
+    if (balloon >= 0)
+        *balloonRet = qemuMonitorJSONParseBalloonInfo(cmds[balloon],
+                                                      replies[balloon],
+                                                      currmem);
+    if (block >= 0)
+        *blockRet = qemuMonitorJSONParseAllBlockStatsInfo(cmds[block],
+                                                          replies[block],
+                                                          table);
+
+    ret = 0;
+
+cleanup:
+    for (i = 0; i < ncmds; i++) {
+        virJSONValueFree(cmds[i]);
+        virJSONValueFree(replies[i]);
+    }
+    return ret;
+}
+
+
 int qemuMonitorJSONGetBlockExtent(qemuMonitorPtr mon,
                                   const char *dev_name,
                                   unsigned long long *extent)
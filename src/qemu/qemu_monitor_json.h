@@ -29,11 +29,23 @@
 
 # include "qemu_monitor.h"
 # include "bitmap.h"
+# include "json.h"
 
 int qemuMonitorJSONIOProcess(qemuMonitorPtr mon,
-                             const char *data,
-                             size_t len,
-                             qemuMonitorMessagePtr msg);
+                             char *data,
+                             size_t len);
+
+int qemuMonitorJSONCommandSubmit(qemuMonitorPtr mon,
+                                 virJSONValuePtr cmd,
+                                 int scm_fd,
+                                 qemuMonitorMessagePtr *msg);
+int qemuMonitorJSONCommandComplete(qemuMonitorPtr mon,
+                                   qemuMonitorMessagePtr msg,
+                                   virJSONValuePtr *reply);
+int qemuMonitorJSONCommandBatch(qemuMonitorPtr mon,
+                                virJSONValuePtr *cmds,
+                                size_t ncmds,
+                                virJSONValuePtr *replies);
 
 int qemuMonitorJSONHumanCommandWithFd(qemuMonitorPtr mon,
                                       const char *cmd,
@@ -80,6 +92,13 @@ int qemuMonitorJSONGetBlockStatsInfo(qemuMonitorPtr mon,
                                      long long *errs);
 int qemuMonitorJSONGetBlockStatsParamsNumber(qemuMonitorPtr mon,
                                              int *nparams);
+int qemuMonitorJSONGetAllBlockStatsInfo(qemuMonitorPtr mon,
+                                        virHashTablePtr table);
+int qemuMonitorJSONGetAllStatsInfo(qemuMonitorPtr mon,
+                                   unsigned long long *currmem,
+                                   int *balloonRet,
+                                   virHashTablePtr table,
+                                   int *blockRet);
 int qemuMonitorJSONGetBlockExtent(qemuMonitorPtr mon,
                                   const char *dev_name,
                                   unsigned long long *extent);
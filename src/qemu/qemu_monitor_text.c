@@ -1088,6 +1088,131 @@ int qemuMonitorTextGetBlockStatsParamsNumber(qemuMonitorPtr mon,
     return ret;
 }
 
+int qemuMonitorTextGetAllBlockStatsInfo(qemuMonitorPtr mon,
+                                        virHashTablePtr table)
+{
+    char *info = NULL;
+    int ret = -1;
+    char *dummy;
+    char *p, *eol, *colon;
+
+    if (qemuMonitorHMPCommand (mon, "info blockstats", &info) < 0) {
+        qemuReportError(VIR_ERR_OPERATION_FAILED,
+                        "%s", _("'info blockstats' command failed"));
+        goto cleanup;
+    }
+
+    /* If the command isn't supported then qemu prints the supported
+     * info commands, so the output starts "info ".  Since this is
+     * unlikely to be the name of a block device, we can use this
+     * to detect if qemu supports the command.
+     */
+    if (strstr(info, "\ninfo ")) {
+        qemuReportError(VIR_ERR_OPERATION_INVALID,
+                        "%s",
+                        _("'info blockstats' not supported by this qemu"));
+        goto cleanup;
+    }
+
+    /* The output format for both qemu & KVM is:
+     *   blockdevice: rd_bytes=% wr_bytes=% rd_operations=% wr_operations=%
+     *   (repeated for each block device)
+     * where '%' is a 64 bit number.
+     */
+    p = info;
+
+    while (*p) {
+        qemuBlockStatsPtr bstats;
+
+        if ((eol = strchr(p, '\n')))
+            *eol = '\0';
+        else
+            eol = p + strlen(p);
+
+        if (!(colon = strstr(p, ": ")))
+            goto next;
+        *colon = '\0';
+
+        /* New QEMU has separate names for host & guest side of the disk
+         * and libvirt gives the host side a 'drive-' prefix. Callers
+         * look devices up by the guest side name though
+         */
+        if (STRPREFIX(p, QEMU_DRIVE_HOST_PREFIX))
+            p += strlen(QEMU_DRIVE_HOST_PREFIX);
+
+        if (VIR_ALLOC(bstats) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        bstats->rd_req = bstats->rd_bytes = bstats->rd_total_times = -1;
+        bstats->wr_req = bstats->wr_bytes = bstats->wr_total_times = -1;
+        bstats->flush_req = bstats->flush_total_times = -1;
+
+        if (virHashAddEntry(table, p, bstats) < 0) {
+            VIR_FREE(bstats);
+            goto cleanup;
+        }
+
+        p = colon + 2;         /* Skip to first label. */
+
+        while (p && *p) {
+            if (STRPREFIX (p, "rd_bytes=")) {
+                p += strlen("rd_bytes=");
+                if (virStrToLong_ll (p, &dummy, 10, &bstats->rd_bytes) == -1)
+                    VIR_DEBUG ("error reading rd_bytes: %s", p);
+            } else if (STRPREFIX (p, "wr_bytes=")) {
+                p += strlen("wr_bytes=");
+                if (virStrToLong_ll (p, &dummy, 10, &bstats->wr_bytes) == -1)
+                    VIR_DEBUG ("error reading wr_bytes: %s", p);
+            } else if (STRPREFIX (p, "rd_operations=")) {
+                p += strlen("rd_operations=");
+                if (virStrToLong_ll (p, &dummy, 10, &bstats->rd_req) == -1)
+                    VIR_DEBUG ("error reading rd_req: %s", p);
+            } else if (STRPREFIX (p, "wr_operations=")) {
+                p += strlen("wr_operations=");
+                if (virStrToLong_ll (p, &dummy, 10, &bstats->wr_req) == -1)
+                    VIR_DEBUG ("error reading wr_req: %s", p);
+            } else if (STRPREFIX (p, "rd_total_times_ns=")) {
+                p += strlen("rd_total_times_ns=");
+                if (virStrToLong_ll (p, &dummy, 10,
+                                     &bstats->rd_total_times) == -1)
+                    VIR_DEBUG ("error reading rd_total_times: %s", p);
+            } else if (STRPREFIX (p, "wr_total_times_ns=")) {
+                p += strlen("wr_total_times_ns=");
+                if (virStrToLong_ll (p, &dummy, 10,
+                                     &bstats->wr_total_times) == -1)
+                    VIR_DEBUG ("error reading wr_total_times: %s", p);
+            } else if (STRPREFIX (p, "flush_operations=")) {
+                p += strlen("flush_operations=");
+                if (virStrToLong_ll (p, &dummy, 10, &bstats->flush_req) == -1)
+                    VIR_DEBUG ("error reading flush_req: %s", p);
+            } else if (STRPREFIX (p, "flush_total_times_ns=")) {
+                p += strlen("flush_total_times_ns=");
+                if (virStrToLong_ll (p, &dummy, 10,
+                                     &bstats->flush_total_times) == -1)
+                    VIR_DEBUG ("error reading flush_total_times: %s", p);
+            } else {
+                VIR_DEBUG ("unknown block stat near %s", p);
+            }
+
+            /* Skip to next label. */
+            if ((p = strchr (p, ' ')))
+                p++;
+        }
+
+ next:
+        if (!*eol)
+            break;
+        p = eol + 1;
+    }
+
+    ret = 0;
+
+ cleanup:
+    VIR_FREE(info);
+    return ret;
+}
+
 int qemuMonitorTextGetBlockExtent(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
                                   const char *dev_name ATTRIBUTE_UNUSED,
                                   unsigned long long *extent ATTRIBUTE_UNUSED)
@@ -686,6 +686,11 @@ qemuProcessHandleStop(qemuMonitorPtr mon ATTRIBUTE_UNUSED,
     virDomainEventPtr event = NULL;
 
     virDomainObjLock(vm);
+
+    /* QEMU stops guest CPUs at the end of migration, so let anyone waiting
+     * for it to complete check the status right away */
+    qemuDomainObjSignalAsyncJob(vm);
+
     if (virDomainObjGetState(vm, NULL) == VIR_DOMAIN_RUNNING) {
         qemuDomainObjPrivatePtr priv = vm->privateData;
 
@@ -2594,7 +2599,7 @@ static int qemuProcessHook(void *data)
      * memory allocation is on the correct NUMA node
      */
     VIR_DEBUG("Moving procss to cgroup");
-    if (qemuAddToCgroup(h->driver, h->vm->def) < 0)
+    if (qemuAddToCgroup(h->driver, h->vm) < 0)
         goto cleanup;
 
     /* This must be done after cgroup placement to avoid resetting CPU
@@ -3011,6 +3016,64 @@ struct qemuProcessReconnectData {
     void *payload;
     struct qemuDomainJobObj oldjob;
 };
+
+/* Called with the driver locked whenever a domain is done reconnecting */
+static void
+qemuProcessReconnectDone(struct qemud_driver *driver)
+{
+    unsigned long long now;
+
+    if (--driver->reconnecting == 0 &&
+        virTimeMillisNow(&now) == 0)
+        VIR_INFO("Reconnected to running domains in %llums",
+                 now - driver->reconnectStart);
+}
+
+/*
+ * Query the capabilities of the emulator of @obj, which takes long
+ * enough for the other domains reconnecting not to wait for it; the
+ * job held on @obj keeps it to us meanwhile, but the def may still be
+ * replaced if QEMU goes away.
+ */
+static int
+qemuProcessReconnectCaps(struct qemud_driver *driver,
+                         virDomainObjPtr obj)
+{
+    qemuDomainObjPrivatePtr priv = obj->privateData;
+    char *emulator = NULL;
+    char *arch = NULL;
+    virBitmapPtr qemuCaps = NULL;
+    int ret = -1;
+
+    if (!(emulator = strdup(obj->def->emulator)) ||
+        !(arch = strdup(obj->def->os.arch))) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    virDomainObjUnlock(obj);
+    qemuDriverUnlock(driver);
+
+    ret = qemuCapsExtractVersionInfo(emulator, arch, NULL, &qemuCaps);
+
+    qemuDriverLock(driver);
+    virDomainObjLock(obj);
+
+    if (ret == 0 && !virDomainObjIsActive(obj))
+        ret = -1;
+
+    if (ret == 0) {
+        priv->qemuCaps = qemuCaps;
+        qemuCaps = NULL;
+    }
+
+cleanup:
+    qemuCapsFree(qemuCaps);
+    VIR_FREE(emulator);
+    VIR_FREE(arch);
+    return ret;
+}
+
 /*
  * Open an existing VM's monitor, re-detect VCPU threads
  * and re-reserve the security labels in use
@@ -3083,9 +3146,7 @@ qemuProcessReconnect(void *opaque)
      * caps in the domain status, so re-query them
      */
     if (!priv->qemuCaps &&
-        qemuCapsExtractVersionInfo(obj->def->emulator, obj->def->os.arch,
-                                   NULL,
-                                   &priv->qemuCaps) < 0)
+        qemuProcessReconnectCaps(driver, obj) < 0)
         goto error;
 
     /* In case the domain shutdown while we were not running,
@@ -3138,6 +3199,7 @@ endjob:
     if (obj && virDomainObjUnref(obj) > 0)
         virDomainObjUnlock(obj);
 
+    qemuProcessReconnectDone(driver);
     qemuDriverUnlock(driver);
 
     virConnectClose(conn);
@@ -3152,6 +3214,7 @@ error:
         if (!virDomainObjIsActive(obj)) {
             if (virDomainObjUnref(obj) > 0)
                 virDomainObjUnlock(obj);
+            qemuProcessReconnectDone(driver);
             qemuDriverUnlock(driver);
             return;
         }
@@ -3168,6 +3231,7 @@ error:
                 virDomainObjUnlock(obj);
         }
     }
+    qemuProcessReconnectDone(driver);
     qemuDriverUnlock(driver);
 
     virConnectClose(conn);
@@ -3248,6 +3312,9 @@ qemuProcessReconnectHelper(void *payload,
         goto error;
     }
 
+    /* The thread can't be done before we unlock the driver */
+    src->driver->reconnecting++;
+
     virDomainObjUnlock(obj);
 
     return;
@@ -3266,6 +3333,8 @@ void
 qemuProcessReconnectAll(virConnectPtr conn, struct qemud_driver *driver)
 {
     struct qemuProcessReconnectData data = {.conn = conn, .driver = driver};
+
+    ignore_value(virTimeMillisNow(&driver->reconnectStart));
     virHashForEach(driver->domains.objs, qemuProcessReconnectHelper, &data);
 }
 
@@ -3316,7 +3385,8 @@ int qemuProcessStart(virConnectPtr conn,
     if (virDomainObjSetDefTransient(driver->caps, vm, true) < 0)
         goto cleanup;
 
-    vm->def->id = driver->nextvmid++;
+    if (virDomainObjListSetID(&driver->domains, vm, driver->nextvmid++) < 0)
+        goto cleanup;
     qemuDomainSetFakeReboot(driver, vm, false);
     virDomainObjSetState(vm, VIR_DOMAIN_SHUTOFF, VIR_DOMAIN_SHUTOFF_UNKNOWN);
 
@@ -3882,7 +3952,10 @@ void qemuProcessStop(struct qemud_driver *driver,
      * can lock driver and vm, and then call qemuProcessStop(). So we should
      * set vm->def->id to -1 here to avoid qemuProcessStop() to be called twice.
      */
-    vm->def->id = -1;
+    virDomainObjListSetID(&driver->domains, vm, -1);
+
+    /* Don't leave an async job waiting for a process which is gone */
+    qemuDomainObjSignalAsyncJob(vm);
 
     if ((logfile = qemuDomainCreateLog(driver, vm, true)) < 0) {
         /* To not break the normal domain shutdown process, skip the
@@ -3945,6 +4018,8 @@ void qemuProcessStop(struct qemud_driver *driver,
         priv->monConfig = NULL;
     }
 
+    qemuDomainStatsCacheClear(priv);
+
     /* shut it off for sure */
     ignore_value(qemuProcessKill(driver, vm, VIR_QEMU_PROCESS_KILL_FORCE|
                                              VIR_QEMU_PROCESS_KILL_NOCHECK));
@@ -4043,6 +4118,7 @@ retry:
     virDomainObjSetState(vm, VIR_DOMAIN_SHUTOFF, reason);
     VIR_FREE(priv->vcpupids);
     priv->nvcpupids = 0;
+    qemuDomainProcStatClose(priv);
     qemuCapsFree(priv->qemuCaps);
     priv->qemuCaps = NULL;
     VIR_FREE(priv->pidfile);
@@ -4104,7 +4180,8 @@ int qemuProcessAttach(virConnectPtr conn ATTRIBUTE_UNUSED,
     if (virDomainObjSetDefTransient(driver->caps, vm, true) < 0)
         goto cleanup;
 
-    vm->def->id = driver->nextvmid++;
+    if (virDomainObjListSetID(&driver->domains, vm, driver->nextvmid++) < 0)
+        goto cleanup;
 
     if (virFileMakePath(driver->logDir) < 0) {
         virReportSystemError(errno,
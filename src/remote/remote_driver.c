@@ -87,6 +87,7 @@ struct private_data {
     int localUses;              /* Ref count for private data */
     char *hostname;             /* Original hostname */
     bool serverKeepAlive;       /* Does server support keepalive protocol? */
+    bool streamHolesChecked;    /* Asked the server about holes in streams? */
 
     virDomainEventStatePtr domainEventState;
 };
@@ -714,6 +715,25 @@ doRemoteOpen (virConnectPtr conn,
             goto failed;
     }
 
+    /* Let the server split replies which don't fit in one message, the
+     * client reassembles them. Done after opening the connection so
+     * that older servers simply report the feature as unsupported.
+     * Holes in streams are only negotiated once a stream is opened,
+     * see remoteNegotiateStreamHoles */
+    {
+        remote_supports_feature_args args =
+            { VIR_DRV_FEATURE_REPLY_CHUNKS };
+        remote_supports_feature_ret ret = { 0 };
+
+        if (call(conn, priv, 0, REMOTE_PROC_SUPPORTS_FEATURE,
+                 (xdrproc_t)xdr_remote_supports_feature_args, (char *) &args,
+                 (xdrproc_t)xdr_remote_supports_feature_ret, (char *) &ret) == -1)
+            goto failed;
+
+        if (!ret.supported)
+            VIR_DEBUG("Server can't split large replies");
+    }
+
     /* Now try and find out what URI the daemon used */
     if (conn->uri == NULL) {
         remote_get_uri_ret uriret;
@@ -788,6 +808,34 @@ remoteAllocPrivateData(void)
     return priv;
 }
 
+/*
+ * Asks the server to send zeroes in streams as holes, and lets the
+ * client do the same if it can, the first time a stream is opened on
+ * the connection. Must be called with the driver locked.
+ */
+static int
+remoteNegotiateStreamHoles(virConnectPtr conn, struct private_data *priv)
+{
+    remote_supports_feature_args args = { VIR_DRV_FEATURE_STREAM_HOLES };
+    remote_supports_feature_ret ret = { 0 };
+
+    if (priv->streamHolesChecked)
+        return 0;
+
+    if (call(conn, priv, 0, REMOTE_PROC_SUPPORTS_FEATURE,
+             (xdrproc_t)xdr_remote_supports_feature_args, (char *) &args,
+             (xdrproc_t)xdr_remote_supports_feature_ret, (char *) &ret) == -1)
+        return -1;
+
+    if (ret.supported)
+        virNetClientEnableStreamHoles(priv->client);
+    else
+        VIR_DEBUG("Server can't handle holes in streams");
+
+    priv->streamHolesChecked = true;
+    return 0;
+}
+
 static int
 remoteOpenSecondaryDriver(virConnectPtr conn,
                           virConnectAuthPtr auth,
@@ -4376,6 +4424,9 @@ remoteDomainMigratePrepareTunnel3(virConnectPtr dconn,
     memset(&args, 0, sizeof(args));
     memset(&ret, 0, sizeof(ret));
 
+    if (remoteNegotiateStreamHoles(dconn, priv) < 0)
+        goto done;
+
     if (!(netst = virNetClientStreamNew(priv->remoteProgram,
                                         REMOTE_PROC_DOMAIN_MIGRATE_PREPARE_TUNNEL3,
                                         priv->counter)))
@@ -4704,6 +4755,95 @@ done:
     return rv;
 }
 
+static int
+remoteConnectGetAllDomainStats(virConnectPtr conn,
+                               unsigned int stats,
+                               virDomainStatsRecordPtr **retStats,
+                               unsigned int flags)
+{
+    struct private_data *priv = conn->privateData;
+    int rv = -1;
+    int i;
+    remote_connect_get_all_domain_stats_args args;
+    remote_connect_get_all_domain_stats_ret ret;
+    virDomainStatsRecordPtr elem = NULL;
+    virDomainStatsRecordPtr *tmpret = NULL;
+
+    remoteDriverLock(priv);
+
+    args.stats = stats;
+    args.flags = flags;
+
+    memset(&ret, 0, sizeof(ret));
+
+    if (call(conn, priv, 0, REMOTE_PROC_CONNECT_GET_ALL_DOMAIN_STATS,
+             (xdrproc_t) xdr_remote_connect_get_all_domain_stats_args,
+             (char *) &args,
+             (xdrproc_t) xdr_remote_connect_get_all_domain_stats_ret,
+             (char *) &ret) == -1)
+        goto done;
+
+    if (ret.retStats.retStats_len > REMOTE_DOMAIN_LIST_MAX) {
+        remoteError(VIR_ERR_RPC,
+                    _("Too many domain stats records: %d for limit %d"),
+                    ret.retStats.retStats_len, REMOTE_DOMAIN_LIST_MAX);
+        goto cleanup;
+    }
+
+    if (VIR_ALLOC_N(tmpret, ret.retStats.retStats_len + 1) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+
+    for (i = 0; i < ret.retStats.retStats_len; i++) {
+        remote_domain_stats_record *rec = ret.retStats.retStats_val + i;
+
+        if (VIR_ALLOC(elem) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+
+        if (!(elem->dom = get_nonnull_domain(conn, rec->dom)))
+            goto cleanup;
+
+        if (rec->params.params_len &&
+            VIR_ALLOC_N(elem->params, rec->params.params_len) < 0) {
+            virReportOOMError();
+            goto cleanup;
+        }
+        elem->nparams = rec->params.params_len;
+
+        if (remoteDeserializeTypedParameters(rec->params.params_val,
+                                             rec->params.params_len,
+                                             REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX,
+                                             elem->params,
+                                             &elem->nparams) < 0)
+            goto cleanup;
+
+        tmpret[i] = elem;
+        elem = NULL;
+    }
+
+    *retStats = tmpret;
+    tmpret = NULL;
+    rv = ret.retStats.retStats_len;
+
+cleanup:
+    if (elem) {
+        if (elem->dom)
+            virDomainFree(elem->dom);
+        VIR_FREE(elem->params);
+        VIR_FREE(elem);
+    }
+    virDomainStatsRecordListFree(tmpret);
+    xdr_free((xdrproc_t) xdr_remote_connect_get_all_domain_stats_ret,
+             (char *) &ret);
+
+done:
+    remoteDriverUnlock(priv);
+    return rv;
+}
+
 #include "remote_client_bodies.h"
 #include "qemu_client_bodies.h"
 
@@ -5111,6 +5251,7 @@ static virDriver remote_driver = {
     .domainGetDiskErrors = remoteDomainGetDiskErrors, /* 0.9.10 */
     .domainSetMetadata = remoteDomainSetMetadata, /* 0.9.10 */
     .domainGetMetadata = remoteDomainGetMetadata, /* 0.9.10 */
+    .connectGetAllDomainStats = remoteConnectGetAllDomainStats, /* 0.9.12 */
 };
 
 static virNetworkDriver network_driver = {
@@ -5198,6 +5339,7 @@ static virStorageDriver storage_driver = {
     .volGetXMLDesc = remoteStorageVolGetXMLDesc, /* 0.4.1 */
     .volGetPath = remoteStorageVolGetPath, /* 0.4.1 */
     .volResize = remoteStorageVolResize, /* 0.9.10 */
+    .volGetWipeInfo = remoteStorageVolGetWipeInfo, /* 0.9.12 */
     .poolIsActive = remoteStoragePoolIsActive, /* 0.7.3 */
     .poolIsPersistent = remoteStoragePoolIsPersistent, /* 0.7.3 */
 };
@@ -64,8 +64,10 @@
 /* Length of long, but not unbounded, strings.
  * This is an arbitrary limit designed to stop the decoder from trying
  * to allocate unbounded amounts of memory when fed with a bad message.
+ * Strings larger than a single message only make it through in replies
+ * split in VIR_NET_REPLY_CHUNK messages.
  */
-const REMOTE_STRING_MAX = 65536;
+const REMOTE_STRING_MAX = 4194304;
 
 /* A long string, which may NOT be NULL. */
 typedef string remote_nonnull_string<REMOTE_STRING_MAX>;
@@ -79,7 +81,7 @@ typedef remote_nonnull_string *remote_string;
 const REMOTE_DOMAIN_ID_LIST_MAX = 16384;
 
 /* Upper limit on lists of domain names. */
-const REMOTE_DOMAIN_NAME_LIST_MAX = 1024;
+const REMOTE_DOMAIN_NAME_LIST_MAX = 16384;
 
 /* Upper limit on cpumap (bytes) passed to virDomainPinVcpu. */
 const REMOTE_CPUMAP_MAX = 256;
@@ -224,6 +226,17 @@ const REMOTE_DOMAIN_GET_CPU_STATS_MAX = 2048;
  */
 const REMOTE_DOMAIN_DISK_ERRORS_MAX = 256;
 
+/*
+ * Upper limit on number of typed parameters in a single domain
+ * statistics record
+ */
+const REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX = 4096;
+
+/*
+ * Upper limit on number of domain statistics records
+ */
+const REMOTE_DOMAIN_LIST_MAX = 16384;
+
 /* UUID.  VIR_UUID_BUFLEN definition comes from libvirt.h */
 typedef opaque remote_uuid[VIR_UUID_BUFLEN];
 
@@ -399,6 +412,12 @@ struct remote_open_args {
     unsigned int flags;
 };
 
+/* Asking about some features also turns them on for the connection,
+ * as that's how the client tells the server it understands them:
+ * VIR_DRV_FEATURE_PROGRAM_KEEPALIVE starts sending keepalive messages,
+ * VIR_DRV_FEATURE_REPLY_CHUNKS lets the server split large replies and
+ * VIR_DRV_FEATURE_STREAM_HOLES lets it send holes in streams. These
+ * three may be asked about before REMOTE_PROC_OPEN. */
 struct remote_supports_feature_args {
     int feature;
 };
@@ -1754,6 +1773,17 @@ struct remote_storage_vol_resize_args {
     unsigned int flags;
 };
 
+struct remote_storage_vol_get_wipe_info_args {
+    remote_nonnull_storage_vol vol;
+    unsigned int flags;
+};
+
+struct remote_storage_vol_get_wipe_info_ret { /* insert@1 */
+    int active;
+    unsigned hyper processed;
+    unsigned hyper total;
+};
+
 /* Node driver calls: */
 
 struct remote_node_num_of_devices_args {
@@ -2463,6 +2493,20 @@ struct remote_domain_get_disk_errors_ret {
     int nerrors;
 };
 
+struct remote_domain_stats_record {
+    remote_nonnull_domain dom;
+    remote_typed_param params<REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX>;
+};
+
+struct remote_connect_get_all_domain_stats_args {
+    unsigned int stats;
+    unsigned int flags;
+};
+
+struct remote_connect_get_all_domain_stats_ret {
+    remote_domain_stats_record retStats<REMOTE_DOMAIN_LIST_MAX>;
+};
+
 
 /*----- Protocol. -----*/
 
@@ -2782,7 +2826,10 @@ enum remote_procedure {
     REMOTE_PROC_DOMAIN_PM_WAKEUP = 267, /* autogen autogen */
     REMOTE_PROC_DOMAIN_EVENT_TRAY_CHANGE = 268, /* autogen autogen */
     REMOTE_PROC_DOMAIN_EVENT_PMWAKEUP = 269, /* autogen autogen */
-    REMOTE_PROC_DOMAIN_EVENT_PMSUSPEND = 270 /* autogen autogen */
+    REMOTE_PROC_DOMAIN_EVENT_PMSUSPEND = 270, /* autogen autogen */
+
+    REMOTE_PROC_CONNECT_GET_ALL_DOMAIN_STATS = 271, /* skipgen skipgen */
+    REMOTE_PROC_STORAGE_VOL_GET_WIPE_INFO = 272 /* autogen autogen */
 
     /*
      * Notice how the entries are grouped in sets of 10 ?
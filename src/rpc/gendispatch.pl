@@ -1399,6 +1399,9 @@ elsif ($opt_k) {
         print "    remoteDriverLock(priv);\n";
 
         if ($call->{streamflag} ne "none") {
+            print "\n";
+            print "    if (remoteNegotiateStreamHoles($priv_src, priv) < 0)\n";
+            print "        goto done;\n";
             print "\n";
             print "    if (!(netst = virNetClientStreamNew(priv->remoteProgram, REMOTE_PROC_$call->{UC_NAME}, priv->counter)))\n";
             print "        goto done;\n";
@@ -59,6 +59,7 @@ struct _virNetClientCall {
     bool nonBlock;
     bool haveThread;
     bool sentSomeData;
+    bool chunked; /* Reply is being reassembled in msg */
 
     virCond cond;
 
@@ -105,6 +106,9 @@ struct _virNetClient {
 
     virKeepAlivePtr keepalive;
     bool wantClose;
+
+    /* Whether the server accepts zeroes in streams as holes */
+    bool streamHoles;
 };
 
 
@@ -467,6 +471,9 @@ void virNetClientFree(virNetClientPtr client)
 
     VIR_FREE(client->hostname);
 
+    virNetMessageClear(&client->msg);
+    VIR_FREE(client->msg.buffer);
+
     if (client->sock)
         virNetSocketRemoveIOCallback(client->sock);
     virNetSocketFree(client->sock);
@@ -675,6 +682,24 @@ bool virNetClientIsEncrypted(virNetClientPtr client)
 }
 
 
+void virNetClientEnableStreamHoles(virNetClientPtr client)
+{
+    virNetClientLock(client);
+    client->streamHoles = true;
+    virNetClientUnlock(client);
+}
+
+
+bool virNetClientHasStreamHoles(virNetClientPtr client)
+{
+    bool enabled;
+    virNetClientLock(client);
+    enabled = client->streamHoles;
+    virNetClientUnlock(client);
+    return enabled;
+}
+
+
 bool virNetClientIsOpen(virNetClientPtr client)
 {
     bool ret;
@@ -780,8 +805,8 @@ int virNetClientGetTLSKeySize(virNetClientPtr client)
     return ret;
 }
 
-static int
-virNetClientCallDispatchReply(virNetClientPtr client)
+static virNetClientCallPtr
+virNetClientCallFindReply(virNetClientPtr client)
 {
     virNetClientCallPtr thecall;
 
@@ -794,14 +819,72 @@ virNetClientCallDispatchReply(virNetClientPtr client)
              thecall->msg->header.serial == client->msg.header.serial))
         thecall = thecall->next;
 
-    if (!thecall) {
+    if (!thecall)
         virNetError(VIR_ERR_RPC,
                     _("no call waiting for reply with prog %d vers %d serial %d"),
                     client->msg.header.prog, client->msg.header.vers, client->msg.header.serial);
+
+    return thecall;
+}
+
+static int
+virNetClientCallDispatchReplyChunk(virNetClientPtr client)
+{
+    virNetClientCallPtr thecall;
+
+    if (!(thecall = virNetClientCallFindReply(client)))
         return -1;
+
+    if (client->msg.header.status != VIR_NET_CONTINUE) {
+        virNetError(VIR_ERR_RPC,
+                    _("unexpected status %d of reply chunk for serial %d"),
+                    client->msg.header.status, client->msg.header.serial);
+        return -1;
+    }
+
+    /* The request has been sent, so its message can now
+     * accumulate the reply */
+    if (!thecall->chunked) {
+        thecall->msg->bufferLength = 0;
+        thecall->chunked = true;
+    }
+
+    return virNetMessageAppendPayload(thecall->msg, &client->msg);
+}
+
+static int
+virNetClientCallDispatchReply(virNetClientPtr client)
+{
+    virNetClientCallPtr thecall;
+    char *buffer;
+    size_t bufferSize;
+
+    if (!(thecall = virNetClientCallFindReply(client)))
+        return -1;
+
+    if (thecall->chunked) {
+        /* Append the last part of a split reply */
+        if (client->msg.header.status != VIR_NET_OK) {
+            virNetError(VIR_ERR_RPC,
+                        _("unexpected status %d of split reply for serial %d"),
+                        client->msg.header.status, client->msg.header.serial);
+            return -1;
+        }
+        if (virNetMessageAppendPayload(thecall->msg, &client->msg) < 0)
+            return -1;
+        thecall->mode = VIR_NET_CLIENT_MODE_COMPLETE;
+        return 0;
     }
 
-    memcpy(thecall->msg->buffer, client->msg.buffer, sizeof(client->msg.buffer));
+    /* Hand the reply buffer over to the call and take the buffer of
+     * its (already sent) request to read the next message into */
+    buffer = thecall->msg->buffer;
+    bufferSize = thecall->msg->bufferSize;
+    thecall->msg->buffer = client->msg.buffer;
+    thecall->msg->bufferSize = client->msg.bufferSize;
+    client->msg.buffer = buffer;
+    client->msg.bufferSize = bufferSize;
+
     memcpy(&thecall->msg->header, &client->msg.header, sizeof(client->msg.header));
     thecall->msg->bufferLength = client->msg.bufferLength;
     thecall->msg->bufferOffset = client->msg.bufferOffset;
@@ -941,10 +1024,14 @@ virNetClientCallDispatch(virNetClientPtr client)
     case VIR_NET_REPLY_WITH_FDS: /* Normal RPC replies with FDs */
         return virNetClientCallDispatchReply(client);
 
+    case VIR_NET_REPLY_CHUNK: /* Leading parts of large RPC replies */
+        return virNetClientCallDispatchReplyChunk(client);
+
     case VIR_NET_MESSAGE: /* Async notifications */
         return virNetClientCallDispatchMessage(client);
 
     case VIR_NET_STREAM: /* Stream protocol */
+    case VIR_NET_STREAM_HOLE: /* Zeroes in streams */
         return virNetClientCallDispatchStream(client);
 
     default:
@@ -1030,8 +1117,12 @@ virNetClientIOReadMessage(virNetClientPtr client)
     ssize_t ret;
 
     /* Start by reading length word */
-    if (client->msg.bufferLength == 0)
+    if (client->msg.bufferLength == 0) {
         client->msg.bufferLength = 4;
+        if (virNetMessageEnsureBuffer(&client->msg,
+                                      client->msg.bufferLength) < 0)
+            return -1;
+    }
 
     wantData = client->msg.bufferLength - client->msg.bufferOffset;
 
@@ -91,6 +91,9 @@ int virNetClientSetTLSSession(virNetClientPtr client,
 bool virNetClientIsEncrypted(virNetClientPtr client);
 bool virNetClientIsOpen(virNetClientPtr client);
 
+void virNetClientEnableStreamHoles(virNetClientPtr client);
+bool virNetClientHasStreamHoles(virNetClientPtr client);
+
 const char *virNetClientLocalAddrString(virNetClientPtr client);
 const char *virNetClientRemoteAddrString(virNetClientPtr client);
 
@@ -29,12 +29,21 @@
 #include "logging.h"
 #include "event.h"
 #include "threads.h"
+#include "util.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 #define virNetError(code, ...)                                    \
     virReportErrorHelper(VIR_FROM_THIS, code, __FILE__,           \
                          __FUNCTION__, __LINE__, __VA_ARGS__)
 
+typedef struct _virNetClientStreamHole virNetClientStreamHole;
+typedef virNetClientStreamHole *virNetClientStreamHolePtr;
+
+struct _virNetClientStreamHole {
+    size_t offset;              /* Incoming data the hole comes before */
+    unsigned long long length;  /* Number of zero bytes it stands for */
+};
+
 struct _virNetClientStream {
     virMutex lock;
 
@@ -57,6 +66,10 @@ struct _virNetClientStream {
     size_t incomingLength;
     bool incomingEOF;
 
+    /* Holes received in between the incoming data */
+    virNetClientStreamHolePtr holes;
+    size_t nholes;
+
     virNetClientStreamEventCallback cb;
     void *cbOpaque;
     virFreeCallback cbFree;
@@ -74,7 +87,7 @@ virNetClientStreamEventTimerUpdate(virNetClientStreamPtr st)
 
     VIR_DEBUG("Check timer offset=%zu %d", st->incomingOffset, st->cbEvents);
 
-    if (((st->incomingOffset || st->incomingEOF) &&
+    if (((st->incomingOffset || st->nholes || st->incomingEOF) &&
          (st->cbEvents & VIR_STREAM_EVENT_READABLE)) ||
         (st->cbEvents & VIR_STREAM_EVENT_WRITABLE)) {
         VIR_DEBUG("Enabling event timer");
@@ -97,7 +110,7 @@ virNetClientStreamEventTimer(int timer ATTRIBUTE_UNUSED, void *opaque)
 
     if (st->cb &&
         (st->cbEvents & VIR_STREAM_EVENT_READABLE) &&
-        (st->incomingOffset || st->incomingEOF))
+        (st->incomingOffset || st->nholes || st->incomingEOF))
         events |= VIR_STREAM_EVENT_READABLE;
     if (st->cb &&
         (st->cbEvents & VIR_STREAM_EVENT_WRITABLE))
@@ -179,6 +192,7 @@ void virNetClientStreamFree(virNetClientStreamPtr st)
 
     virResetError(&st->err);
     VIR_FREE(st->incoming);
+    VIR_FREE(st->holes);
     virMutexDestroy(&st->lock);
     virNetClientProgramFree(st->prog);
     VIR_FREE(st);
@@ -280,6 +294,39 @@ cleanup:
 }
 
 
+static int
+virNetClientStreamQueueHole(virNetClientStreamPtr st,
+                            virNetMessagePtr msg)
+{
+    virNetStreamHole hole;
+    virNetClientStreamHolePtr last = NULL;
+
+    memset(&hole, 0, sizeof(hole));
+    if (virNetMessageDecodePayload(msg, (xdrproc_t)xdr_virNetStreamHole,
+                                   &hole) < 0)
+        return -1;
+
+    if (st->nholes)
+        last = &st->holes[st->nholes - 1];
+
+    /* Holes without data in between add up */
+    if (last && last->offset == st->incomingOffset) {
+        last->length += hole.length;
+    } else if (hole.length) {
+        if (VIR_EXPAND_N(st->holes, st->nholes, 1) < 0) {
+            VIR_DEBUG("Out of memory handling stream hole");
+            return -1;
+        }
+        st->holes[st->nholes - 1].offset = st->incomingOffset;
+        st->holes[st->nholes - 1].length = hole.length;
+    }
+
+    VIR_DEBUG("Stream incoming hole of %llu bytes after offset %zu",
+              hole.length, st->incomingOffset);
+    return 0;
+}
+
+
 int virNetClientStreamQueuePacket(virNetClientStreamPtr st,
                                   virNetMessagePtr msg)
 {
@@ -288,7 +335,10 @@ int virNetClientStreamQueuePacket(virNetClientStreamPtr st,
 
     virMutexLock(&st->lock);
     need = msg->bufferLength - msg->bufferOffset;
-    if (need) {
+    if (msg->header.type == VIR_NET_STREAM_HOLE) {
+        if (virNetClientStreamQueueHole(st, msg) < 0)
+            goto cleanup;
+    } else if (need) {
         size_t avail = st->incomingLength - st->incomingOffset;
         if (need > avail) {
             size_t extra = need - avail;
@@ -328,8 +378,16 @@ int virNetClientStreamSendPacket(virNetClientStreamPtr st,
                                  size_t nbytes)
 {
     virNetMessagePtr msg;
+    bool hole = false;
     VIR_DEBUG("st=%p status=%d data=%p nbytes=%zu", st, status, data, nbytes);
 
+    /* Zeroes, typically read from a hole in a sparse file, are
+     * only sent by their number to servers that know */
+    if (status == VIR_NET_CONTINUE && nbytes &&
+        virNetClientHasStreamHoles(client) &&
+        virMemIsZero(data, nbytes))
+        hole = true;
+
     if (!(msg = virNetMessageNew(false)))
         return -1;
 
@@ -338,7 +396,7 @@ int virNetClientStreamSendPacket(virNetClientStreamPtr st,
     msg->header.prog = virNetClientProgramGetProgram(st->prog);
     msg->header.vers = virNetClientProgramGetVersion(st->prog);
     msg->header.status = status;
-    msg->header.type = VIR_NET_STREAM;
+    msg->header.type = hole ? VIR_NET_STREAM_HOLE : VIR_NET_STREAM;
     msg->header.serial = st->serial;
     msg->header.proc = st->proc;
 
@@ -351,8 +409,17 @@ int virNetClientStreamSendPacket(virNetClientStreamPtr st,
      * need a synchronous confirmation
      */
     if (status == VIR_NET_CONTINUE) {
-        if (virNetMessageEncodePayloadRaw(msg, data, nbytes) < 0)
-            goto error;
+        if (hole) {
+            virNetStreamHole payload = { nbytes };
+
+            if (virNetMessageEncodePayload(msg,
+                                           (xdrproc_t)xdr_virNetStreamHole,
+                                           &payload) < 0)
+                goto error;
+        } else {
+            if (virNetMessageEncodePayloadRaw(msg, data, nbytes) < 0)
+                goto error;
+        }
 
         if (virNetClientSendNoReply(client, msg) < 0)
             goto error;
@@ -384,7 +451,7 @@ int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
     VIR_DEBUG("st=%p client=%p data=%p nbytes=%zu nonblock=%d",
               st, client, data, nbytes, nonblock);
     virMutexLock(&st->lock);
-    if (!st->incomingOffset && !st->incomingEOF) {
+    if (!st->incomingOffset && !st->nholes && !st->incomingEOF) {
         virNetMessagePtr msg;
         int ret;
 
@@ -416,11 +483,29 @@ int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
             goto cleanup;
     }
 
-    VIR_DEBUG("After IO %zu", st->incomingOffset);
-    if (st->incomingOffset) {
+    VIR_DEBUG("After IO %zu holes %zu", st->incomingOffset, st->nholes);
+    if (st->nholes && st->holes[0].offset == 0) {
+        /* Hand out zeroes in place of the hole */
+        virNetClientStreamHolePtr hole = &st->holes[0];
+        size_t want = nbytes;
+        if (want > hole->length)
+            want = hole->length;
+        memset(data, 0, want);
+        hole->length -= want;
+        if (!hole->length) {
+            memmove(st->holes, st->holes + 1,
+                    sizeof(*st->holes) * (st->nholes - 1));
+            VIR_SHRINK_N(st->holes, st->nholes, 1);
+        }
+        rv = want;
+    } else if (st->incomingOffset) {
         int want = st->incomingOffset;
+        size_t i;
         if (want > nbytes)
             want = nbytes;
+        /* The data after the next hole has to wait for it */
+        if (st->nholes && want > st->holes[0].offset)
+            want = st->holes[0].offset;
         memcpy(data, st->incoming, want);
         if (want < st->incomingOffset) {
             memmove(st->incoming, st->incoming + want, st->incomingOffset - want);
@@ -429,6 +514,8 @@ int virNetClientStreamRecvPacket(virNetClientStreamPtr st,
             VIR_FREE(st->incoming);
             st->incomingOffset = st->incomingLength = 0;
         }
+        for (i = 0 ; i < st->nholes ; i++)
+            st->holes[i].offset -= want;
         rv = want;
     } else {
         rv = 0;
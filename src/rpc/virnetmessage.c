@@ -29,12 +29,178 @@
 #include "logging.h"
 #include "virfile.h"
 #include "util.h"
+#include "threads.h"
 
 #define VIR_FROM_THIS VIR_FROM_RPC
 #define virNetError(code, ...)                                    \
     virReportErrorHelper(VIR_FROM_THIS, code, __FILE__,           \
                          __FUNCTION__, __LINE__, __VA_ARGS__)
 
+/*
+ * Message buffers come in a few size classes. The buffers of freed
+ * messages are kept on a per-class free list, up to a limit, so that
+ * busy clients and servers recycle them instead of going back to the
+ * allocator for every call. Nearly all calls and replies fit in the
+ * smallest class; the largest one holds any message the protocol
+ * allows.
+ */
+#define VIR_NET_MESSAGE_POOL_MAX 32
+
+typedef struct _virNetMessageBufferPool virNetMessageBufferPool;
+typedef virNetMessageBufferPool *virNetMessageBufferPoolPtr;
+struct _virNetMessageBufferPool {
+    size_t size;
+    size_t nfreeMax;
+    size_t nfree;
+    char *free[VIR_NET_MESSAGE_POOL_MAX];
+};
+
+static virNetMessageBufferPool virNetMessageBufferPools[] = {
+    { VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX, 32, 0, { NULL } },
+    { 16 * VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX, 8, 0, { NULL } },
+    { VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX, 2, 0, { NULL } },
+};
+
+static virOnceControl virNetMessageBufferOnce = VIR_ONCE_CONTROL_INITIALIZER;
+static virMutex virNetMessageBufferLock;
+static bool virNetMessageBufferPooling;
+
+static void virNetMessageBufferPoolInit(void)
+{
+    if (virMutexInit(&virNetMessageBufferLock) == 0)
+        virNetMessageBufferPooling = true;
+}
+
+
+static char *virNetMessageBufferGet(size_t len, size_t *size)
+{
+    virNetMessageBufferPoolPtr pool = NULL;
+    char *buf = NULL;
+    size_t i;
+
+    for (i = 0 ; i < ARRAY_CARDINALITY(virNetMessageBufferPools) ; i++) {
+        if (virNetMessageBufferPools[i].size >= len) {
+            pool = &virNetMessageBufferPools[i];
+            break;
+        }
+    }
+
+    /* Replies split in VIR_NET_REPLY_CHUNK messages are encoded, or
+     * reassembled, in a single buffer larger than any class. They are
+     * rare enough not to bother recycling those */
+    if (!pool) {
+        if (len > VIR_NET_MESSAGE_REPLY_MAX + VIR_NET_MESSAGE_LEN_MAX) {
+            virNetError(VIR_ERR_RPC,
+                        _("message buffer of %zu bytes is too large, want %d"),
+                        len, VIR_NET_MESSAGE_REPLY_MAX + VIR_NET_MESSAGE_LEN_MAX);
+            return NULL;
+        }
+
+        if (VIR_ALLOC_N(buf, len) < 0) {
+            virReportOOMError();
+            return NULL;
+        }
+
+        *size = len;
+        return buf;
+    }
+
+    /* Pooling is only an optimization, so carry on without it if the
+     * lock couldn't be initialized */
+    if (virOnce(&virNetMessageBufferOnce, virNetMessageBufferPoolInit) == 0 &&
+        virNetMessageBufferPooling) {
+        virMutexLock(&virNetMessageBufferLock);
+        if (pool->nfree)
+            buf = pool->free[--pool->nfree];
+        virMutexUnlock(&virNetMessageBufferLock);
+    }
+
+    if (!buf && VIR_ALLOC_N(buf, pool->size) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    *size = pool->size;
+    return buf;
+}
+
+
+static void virNetMessageBufferPut(char *buf, size_t size)
+{
+    size_t i;
+
+    if (!buf)
+        return;
+
+    /* Since we got a buffer, virNetMessageBufferPoolInit has run */
+    if (virNetMessageBufferPooling) {
+        for (i = 0 ; i < ARRAY_CARDINALITY(virNetMessageBufferPools) ; i++) {
+            virNetMessageBufferPoolPtr pool = &virNetMessageBufferPools[i];
+
+            if (pool->size != size)
+                continue;
+
+            virMutexLock(&virNetMessageBufferLock);
+            if (pool->nfree < pool->nfreeMax) {
+                pool->free[pool->nfree++] = buf;
+                buf = NULL;
+            }
+            virMutexUnlock(&virNetMessageBufferLock);
+            break;
+        }
+    }
+
+    VIR_FREE(buf);
+}
+
+
+/*
+ * @msg: the message whose buffer to grow
+ * @len: the number of bytes the buffer must be able to hold
+ *
+ * Makes sure the buffer of @msg is at least @len bytes long,
+ * preserving the first bufferOffset bytes of its contents.
+ * Does not change bufferLength.
+ *
+ * returns 0 on success, -1 upon fatal error
+ */
+int virNetMessageEnsureBuffer(virNetMessagePtr msg,
+                              size_t len)
+{
+    char *buf;
+    size_t size;
+
+    if (msg->buffer && msg->bufferSize >= len)
+        return 0;
+
+    /* Past the largest class, buffers are filled a piece at a time,
+     * so grow them geometrically */
+    if (len > VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX) {
+        size_t want = msg->bufferSize * 2;
+
+        if (want > VIR_NET_MESSAGE_REPLY_MAX + VIR_NET_MESSAGE_LEN_MAX)
+            want = VIR_NET_MESSAGE_REPLY_MAX + VIR_NET_MESSAGE_LEN_MAX;
+        if (want > len)
+            len = want;
+    }
+
+    if (!(buf = virNetMessageBufferGet(len, &size)))
+        return -1;
+
+    VIR_DEBUG("msg=%p buffer %zu -> %zu bytes", msg, msg->bufferSize, size);
+
+    if (msg->buffer) {
+        memcpy(buf, msg->buffer, msg->bufferOffset);
+        virNetMessageBufferPut(msg->buffer, msg->bufferSize);
+    }
+
+    msg->buffer = buf;
+    msg->bufferSize = size;
+
+    return 0;
+}
+
+
 virNetMessagePtr virNetMessageNew(bool tracked)
 {
     virNetMessagePtr msg;
@@ -44,6 +210,12 @@ virNetMessagePtr virNetMessageNew(bool tracked)
         return NULL;
     }
 
+    if (virNetMessageEnsureBuffer(msg, VIR_NET_MESSAGE_INITIAL +
+                                  VIR_NET_MESSAGE_LEN_MAX) < 0) {
+        VIR_FREE(msg);
+        return NULL;
+    }
+
     msg->tracked = tracked;
     VIR_DEBUG("msg=%p tracked=%d", msg, tracked);
 
@@ -54,6 +226,8 @@ virNetMessagePtr virNetMessageNew(bool tracked)
 void virNetMessageClear(virNetMessagePtr msg)
 {
     bool tracked = msg->tracked;
+    char *buffer = msg->buffer;
+    size_t bufferSize = msg->bufferSize;
     size_t i;
 
     VIR_DEBUG("msg=%p nfds=%zu", msg, msg->nfds);
@@ -63,6 +237,9 @@ void virNetMessageClear(virNetMessagePtr msg)
     VIR_FREE(msg->fds);
     memset(msg, 0, sizeof(*msg));
     msg->tracked = tracked;
+    /* Keep the buffer, the message is about to be reused */
+    msg->buffer = buffer;
+    msg->bufferSize = bufferSize;
 }
 
 
@@ -80,6 +257,7 @@ void virNetMessageFree(virNetMessagePtr msg)
     for (i = 0 ; i < msg->nfds ; i++)
         VIR_FORCE_CLOSE(msg->fds[i]);
     VIR_FREE(msg->fds);
+    virNetMessageBufferPut(msg->buffer, msg->bufferSize);
     VIR_FREE(msg);
 }
 
@@ -144,6 +322,8 @@ int virNetMessageDecodeLength(virNetMessagePtr msg)
     /* Extend our declared buffer length and carry
        on reading the header + payload */
     msg->bufferLength += len;
+    if (virNetMessageEnsureBuffer(msg, msg->bufferLength) < 0)
+        goto cleanup;
 
     VIR_DEBUG("Got length, now need %zu total (%u more)",
               msg->bufferLength, len);
@@ -212,8 +392,11 @@ int virNetMessageEncodeHeader(virNetMessagePtr msg)
     int ret = -1;
     unsigned int len = 0;
 
-    msg->bufferLength = sizeof(msg->buffer);
     msg->bufferOffset = 0;
+    if (virNetMessageEnsureBuffer(msg, VIR_NET_MESSAGE_INITIAL +
+                                  VIR_NET_MESSAGE_LEN_MAX) < 0)
+        return -1;
+    msg->bufferLength = msg->bufferSize;
 
     /* Format the header. */
     xdrmem_create(&xdr,
@@ -325,9 +508,10 @@ cleanup:
 }
 
 
-int virNetMessageEncodePayload(virNetMessagePtr msg,
-                               xdrproc_t filter,
-                               void *data)
+static int virNetMessageEncodePayloadMax(virNetMessagePtr msg,
+                                         xdrproc_t filter,
+                                         void *data,
+                                         size_t maxlen)
 {
     XDR xdr;
     unsigned int msglen;
@@ -338,15 +522,37 @@ int virNetMessageEncodePayload(virNetMessagePtr msg,
     xdrmem_create(&xdr, msg->buffer + msg->bufferOffset,
                   msg->bufferLength - msg->bufferOffset, XDR_ENCODE);
 
-    if (!(*filter)(&xdr, data)) {
-        virNetError(VIR_ERR_RPC, "%s", _("Unable to encode message payload"));
-        goto error;
+    /* Grow the buffer to the next size and start over until the
+     * payload fits, or we reach the largest message allowed */
+    while (!(*filter)(&xdr, data)) {
+        if (msg->bufferSize >= maxlen) {
+            virNetError(VIR_ERR_RPC, "%s", _("Unable to encode message payload"));
+            goto error;
+        }
+
+        xdr_destroy(&xdr);
+
+        if (virNetMessageEnsureBuffer(msg, msg->bufferSize + 1) < 0)
+            return -1;
+        msg->bufferLength = msg->bufferSize;
+
+        xdrmem_create(&xdr, msg->buffer + msg->bufferOffset,
+                      msg->bufferLength - msg->bufferOffset, XDR_ENCODE);
     }
 
     /* Get the length stored in buffer. */
     msg->bufferOffset += xdr_getpos(&xdr);
     xdr_destroy(&xdr);
 
+    /* A buffer recycled from a larger message may have let the
+     * payload grow past the limit */
+    if (msg->bufferOffset > maxlen) {
+        virNetError(VIR_ERR_RPC,
+                    _("message payload of %zu bytes is too large, want %zu"),
+                    msg->bufferOffset, maxlen);
+        return -1;
+    }
+
     /* Re-encode the length word. */
     VIR_DEBUG("Encode length as %zu", msg->bufferOffset);
     xdrmem_create(&xdr, msg->buffer, VIR_NET_MESSAGE_HEADER_XDR_LEN, XDR_ENCODE);
@@ -367,6 +573,154 @@ error:
 }
 
 
+int virNetMessageEncodePayload(virNetMessagePtr msg,
+                               xdrproc_t filter,
+                               void *data)
+{
+    return virNetMessageEncodePayloadMax(msg, filter, data,
+                                         VIR_NET_MESSAGE_MAX +
+                                         VIR_NET_MESSAGE_LEN_MAX);
+}
+
+
+/*
+ * @msg: the outgoing VIR_NET_REPLY, whose header to encode
+ * @filter: XDR filter of the reply
+ * @data: the reply
+ * @chunks: filled with the messages to send before @msg
+ *
+ * Like virNetMessageEncodePayload, but accepts payloads of up to
+ * VIR_NET_MESSAGE_REPLY_MAX bytes. If the payload doesn't fit in a
+ * single message, its leading parts are moved into a queue of new
+ * VIR_NET_REPLY_CHUNK messages, and @msg keeps the last part.
+ *
+ * returns 0 if successfully encoded, -1 upon fatal error
+ */
+int virNetMessageEncodePayloadChunks(virNetMessagePtr msg,
+                                     xdrproc_t filter,
+                                     void *data,
+                                     virNetMessagePtr *chunks)
+{
+    virNetMessagePtr chunk = NULL;
+    size_t start = msg->bufferOffset;
+    size_t piece = VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX - start;
+    size_t offset;
+    XDR xdr;
+    unsigned int msglen;
+
+    *chunks = NULL;
+
+    if (msg->header.type != VIR_NET_REPLY)
+        return virNetMessageEncodePayload(msg, filter, data);
+
+    if (virNetMessageEncodePayloadMax(msg, filter, data,
+                                      VIR_NET_MESSAGE_REPLY_MAX +
+                                      VIR_NET_MESSAGE_LEN_MAX) < 0)
+        return -1;
+
+    if (msg->bufferLength <= VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX)
+        return 0;
+
+    for (offset = start ;
+         msg->bufferLength - offset > piece ;
+         offset += piece) {
+        if (!(chunk = virNetMessageNew(false)))
+            goto error;
+
+        chunk->header = msg->header;
+        chunk->header.type = VIR_NET_REPLY_CHUNK;
+        chunk->header.status = VIR_NET_CONTINUE;
+
+        if (virNetMessageEncodeHeader(chunk) < 0 ||
+            virNetMessageEncodePayloadRaw(chunk, msg->buffer + offset,
+                                          piece) < 0)
+            goto error;
+
+        virNetMessageQueuePush(chunks, chunk);
+        chunk = NULL;
+    }
+
+    VIR_DEBUG("Split %zu bytes reply in chunks of %zu bytes",
+              msg->bufferLength - start, piece);
+
+    /* Keep the header, followed by the last part of the payload */
+    memmove(msg->buffer + start, msg->buffer + offset,
+            msg->bufferLength - offset);
+    msg->bufferLength -= offset - start;
+
+    xdrmem_create(&xdr, msg->buffer, VIR_NET_MESSAGE_HEADER_XDR_LEN, XDR_ENCODE);
+    msglen = msg->bufferLength;
+    if (!xdr_u_int(&xdr, &msglen)) {
+        virNetError(VIR_ERR_RPC, "%s", _("Unable to encode message length"));
+        xdr_destroy(&xdr);
+        goto error;
+    }
+    xdr_destroy(&xdr);
+
+    return 0;
+
+error:
+    virNetMessageFree(chunk);
+    while ((chunk = virNetMessageQueueServe(chunks)))
+        virNetMessageFree(chunk);
+    return -1;
+}
+
+
+/*
+ * @msg: the reply being reassembled
+ * @chunk: a decoded VIR_NET_REPLY_CHUNK, or the final VIR_NET_REPLY
+ *
+ * Appends the payload of @chunk to @msg, which must have a zero
+ * bufferLength before the first chunk. The header of @msg is
+ * replaced by the one of @chunk, so once the final reply has been
+ * appended, @msg can be given to virNetMessageDecodePayload.
+ *
+ * returns 0 on success, -1 upon fatal error
+ */
+int virNetMessageAppendPayload(virNetMessagePtr msg,
+                               virNetMessagePtr chunk)
+{
+    size_t len = chunk->bufferLength - chunk->bufferOffset;
+    size_t offset;
+
+    if (msg->bufferLength == 0) {
+        /* Take the length word and header along with the payload */
+        msg->bufferOffset = 0;
+        if (virNetMessageEnsureBuffer(msg, chunk->bufferLength) < 0)
+            return -1;
+
+        memcpy(msg->buffer, chunk->buffer, chunk->bufferLength);
+        msg->bufferLength = chunk->bufferLength;
+        msg->bufferOffset = chunk->bufferOffset;
+    } else {
+        if (len > VIR_NET_MESSAGE_REPLY_MAX + VIR_NET_MESSAGE_LEN_MAX -
+            msg->bufferLength) {
+            virNetError(VIR_ERR_RPC,
+                        _("reply of more than %zu bytes too large, want %d"),
+                        msg->bufferLength + len,
+                        VIR_NET_MESSAGE_REPLY_MAX + VIR_NET_MESSAGE_LEN_MAX);
+            return -1;
+        }
+
+        /* Preserve everything received so far */
+        offset = msg->bufferOffset;
+        msg->bufferOffset = msg->bufferLength;
+        if (virNetMessageEnsureBuffer(msg, msg->bufferLength + len) < 0)
+            return -1;
+        msg->bufferOffset = offset;
+
+        memcpy(msg->buffer + msg->bufferLength,
+               chunk->buffer + chunk->bufferOffset, len);
+        msg->bufferLength += len;
+    }
+
+    msg->header = chunk->header;
+
+    return 0;
+}
+
+
 int virNetMessageDecodePayload(virNetMessagePtr msg,
                                xdrproc_t filter,
                                void *data)
@@ -402,13 +756,16 @@ int virNetMessageEncodePayloadRaw(virNetMessagePtr msg,
     XDR xdr;
     unsigned int msglen;
 
-    if ((msg->bufferLength - msg->bufferOffset) < len) {
+    if ((VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX - msg->bufferOffset) < len) {
         virNetError(VIR_ERR_RPC,
                     _("Stream data too long to send (%zu bytes needed, %zu bytes available)"),
-                    len, (msg->bufferLength - msg->bufferOffset));
+                    len, (VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX - msg->bufferOffset));
         return -1;
     }
 
+    if (virNetMessageEnsureBuffer(msg, msg->bufferOffset + len) < 0)
+        return -1;
+
     memcpy(msg->buffer + msg->bufferOffset, data, len);
     msg->bufferOffset += len;
 
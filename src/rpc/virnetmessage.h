@@ -31,13 +31,20 @@ typedef virNetMessage *virNetMessagePtr;
 
 typedef void (*virNetMessageFreeCallback)(virNetMessagePtr msg, void *opaque);
 
-/* Never allocate this (huge) buffer on the stack. Always
- * use virNetMessageNew() to allocate on the heap
+/* Size of the payload that fits in the buffer given to new messages.
+ * Larger messages get their buffer grown on demand, up to
+ * VIR_NET_MESSAGE_MAX, or VIR_NET_MESSAGE_REPLY_MAX for replies
+ * split in chunks */
+# define VIR_NET_MESSAGE_INITIAL 4096
+
+/* Always use virNetMessageNew() to allocate messages, so
+ * they get a buffer from the shared pool
  */
 struct _virNetMessage {
     bool tracked;
 
-    char buffer[VIR_NET_MESSAGE_MAX + VIR_NET_MESSAGE_LEN_MAX];
+    char *buffer;
+    size_t bufferSize; /* Allocated size of buffer */
     size_t bufferLength;
     size_t bufferOffset;
 
@@ -66,6 +73,10 @@ void virNetMessageQueuePush(virNetMessagePtr *queue,
                             virNetMessagePtr msg)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
 
+int virNetMessageEnsureBuffer(virNetMessagePtr msg,
+                              size_t len)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
+
 int virNetMessageEncodeHeader(virNetMessagePtr msg)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_RETURN_CHECK;
 int virNetMessageDecodeLength(virNetMessagePtr msg)
@@ -77,6 +88,15 @@ int virNetMessageEncodePayload(virNetMessagePtr msg,
                                xdrproc_t filter,
                                void *data)
     ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+int virNetMessageEncodePayloadChunks(virNetMessagePtr msg,
+                                     xdrproc_t filter,
+                                     void *data,
+                                     virNetMessagePtr *chunks)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(4)
+    ATTRIBUTE_RETURN_CHECK;
+int virNetMessageAppendPayload(virNetMessagePtr msg,
+                               virNetMessagePtr chunk)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
 int virNetMessageDecodePayload(virNetMessagePtr msg,
                                xdrproc_t filter,
                                void *data)
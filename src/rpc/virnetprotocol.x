@@ -56,6 +56,12 @@ const VIR_NET_MESSAGE_PAYLOAD_MAX = 262120;
 /* Size of message length field. Not counted in VIR_NET_MESSAGE_MAX */
 const VIR_NET_MESSAGE_LEN_MAX = 4;
 
+/* Maximum total size of a reply payload split across several
+ * VIR_NET_REPLY_CHUNK messages, each of which still obeys
+ * VIR_NET_MESSAGE_MAX.
+ */
+const VIR_NET_MESSAGE_REPLY_MAX = 16777216;
+
 /* Length of long, but not unbounded, strings.
  * This is an arbitrary limit designed to stop the decoder from trying
  * to allocate unbounded amounts of memory when fed with a bad message.
@@ -92,6 +98,12 @@ const VIR_NET_MESSAGE_NUM_FDS_MAX = 32;
  *  - type == VIR_NET_STREAM
  *      * serial matches that from the corresponding VIR_NET_CALL
  *
+ *  - type == VIR_NET_REPLY_CHUNK
+ *      * serial matches that from the corresponding VIR_NET_CALL
+ *
+ *  - type == VIR_NET_STREAM_HOLE
+ *      * serial matches that from the corresponding VIR_NET_CALL
+ *
  * and the 'status' field varies according to:
  *
  *  - type == VIR_NET_CALL
@@ -109,6 +121,12 @@ const VIR_NET_MESSAGE_NUM_FDS_MAX = 32;
  *     * VIR_NET_OK if stream is complete
  *     * VIR_NET_ERROR if stream had an error
  *
+ *  - type == VIR_NET_REPLY_CHUNK
+ *     * VIR_NET_CONTINUE always
+ *
+ *  - type == VIR_NET_STREAM_HOLE
+ *     * VIR_NET_CONTINUE always
+ *
  * Payload varies according to type and status:
  *
  *  - type == VIR_NET_CALL
@@ -143,6 +161,25 @@ const VIR_NET_MESSAGE_NUM_FDS_MAX = 32;
  *     * status == VIR_NET_ERROR
  *          remote_error    Error information
  *
+ *  - type == VIR_NET_REPLY_CHUNK
+ *          byte[]    leading part of the XXX_ret of a VIR_NET_REPLY
+ *
+ * Replies with status VIR_NET_OK whose payload doesn't fit in
+ * VIR_NET_MESSAGE_MAX may be split: the leading parts of the payload
+ * are sent in VIR_NET_REPLY_CHUNK messages and the last one in the
+ * VIR_NET_REPLY message, the receiver concatenates them. Servers only
+ * do this for clients which asked whether the remote party supports
+ * VIR_DRV_FEATURE_REPLY_CHUNKS.
+ *
+ *  - type == VIR_NET_STREAM_HOLE
+ *          virNetStreamHole   number of zero bytes in the stream
+ *
+ * A VIR_NET_STREAM_HOLE message stands for as many zero bytes of
+ * stream data, which the receiver passes on in place of the hole.
+ * Servers only send them to clients which asked whether the remote
+ * party supports VIR_DRV_FEATURE_STREAM_HOLES, and clients only send
+ * them to servers which said so.
+ *
  */
 enum virNetMessageType {
     /* client -> server. args from a method call */
@@ -156,7 +193,11 @@ enum virNetMessageType {
     /* client -> server. args from a method call, with passed FDs */
     VIR_NET_CALL_WITH_FDS = 4,
     /* server -> client. reply/error from a method call, with passed FDs */
-    VIR_NET_REPLY_WITH_FDS = 5
+    VIR_NET_REPLY_WITH_FDS = 5,
+    /* server -> client. leading part of a reply split in several messages */
+    VIR_NET_REPLY_CHUNK = 6,
+    /* either direction. zero bytes of stream data, by their number */
+    VIR_NET_STREAM_HOLE = 7
 };
 
 enum virNetMessageStatus {
@@ -236,3 +277,8 @@ struct virNetMessageError {
     int int2;
     virNetMessageNetwork net; /* unused */
 };
+
+/* Payload of VIR_NET_STREAM_HOLE messages */
+struct virNetStreamHole {
+    unsigned hyper length;
+};
@@ -74,6 +74,7 @@ struct _virNetServer {
     virMutex lock;
 
     virThreadPoolPtr workers;
+    size_t backlogWarn; /* Calls waiting for a worker to warn about */
 
     bool privileged;
 
@@ -181,6 +182,25 @@ error:
     VIR_FREE(job);
 }
 
+/* Warn when calls wait because all workers are busy, and again each
+ * time their number doubles, so that max_workers can be raised */
+static void
+virNetServerCheckBacklog(virNetServerPtr srv)
+{
+    virThreadPoolStats stats;
+
+    virThreadPoolGetStats(srv->workers, &stats);
+
+    if (stats.workers < stats.maxWorkers ||
+        stats.queueDepth < srv->backlogWarn)
+        return;
+
+    VIR_WARN("%zu calls are waiting for one of the %zu workers, the "
+             "longest wait so far was %llums; consider raising max_workers",
+             stats.queueDepth, stats.workers, stats.waitMax);
+    srv->backlogWarn *= 2;
+}
+
 static int virNetServerDispatchNewMessage(virNetServerClientPtr client,
                                           virNetMessagePtr msg,
                                           void *opaque)
@@ -217,11 +237,16 @@ static int virNetServerDispatchNewMessage(virNetServerClientPtr client,
         priority = virNetServerProgramGetPriority(prog, msg->header.proc);
     }
 
-    ret = virThreadPoolSendJob(srv->workers, priority, job);
+    /* Queue per client, so that a client sending many calls only
+     * delays its own ones. How many calls a client may have in flight
+     * is bounded by its max_client_requests quota already */
+    ret = virThreadPoolSendOwnedJob(srv->workers, client, priority, job);
 
     if (ret < 0) {
         VIR_FREE(job);
         virNetServerProgramFree(prog);
+    } else {
+        virNetServerCheckBacklog(srv);
     }
     virNetServerUnlock(srv);
 
@@ -328,6 +353,7 @@ virNetServerPtr virNetServerNew(size_t min_workers,
                                           srv)))
         goto error;
 
+    srv->backlogWarn = MAX(max_workers, 1);
     srv->nclients_max = max_clients;
     srv->keepaliveInterval = keepaliveInterval;
     srv->keepaliveCount = keepaliveCount;
@@ -663,6 +689,22 @@ void virNetServerUpdateServices(virNetServerPtr srv,
 }
 
 
+/* Like virNetServerUpdateServices, for the read-only services only */
+void virNetServerUpdateReadonlyServices(virNetServerPtr srv,
+                                        bool enabled)
+{
+    int i;
+
+    virNetServerLock(srv);
+    for (i = 0 ; i < srv->nservices ; i++) {
+        if (virNetServerServiceIsReadonly(srv->services[i]))
+            virNetServerServiceToggle(srv->services[i], enabled);
+    }
+
+    virNetServerUnlock(srv);
+}
+
+
 void virNetServerRun(virNetServerPtr srv)
 {
     int timerid = -1;
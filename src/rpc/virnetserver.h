@@ -74,6 +74,8 @@ int virNetServerSetTLSContext(virNetServerPtr srv,
 
 void virNetServerUpdateServices(virNetServerPtr srv,
                                 bool enabled);
+void virNetServerUpdateReadonlyServices(virNetServerPtr srv,
+                                        bool enabled);
 
 void virNetServerRun(virNetServerPtr srv);
 
@@ -104,6 +104,11 @@ struct _virNetServerClient
 
     virKeepAlivePtr keepalive;
     int keepaliveFilter;
+
+    /* Whether replies too large for one message may be split */
+    bool replyChunks;
+    /* Whether zeroes in streams may be sent as holes */
+    bool streamHoles;
 };
 
 
@@ -417,6 +422,38 @@ bool virNetServerClientGetReadonly(virNetServerClientPtr client)
     return readonly;
 }
 
+void virNetServerClientEnableReplyChunks(virNetServerClientPtr client)
+{
+    virNetServerClientLock(client);
+    client->replyChunks = true;
+    virNetServerClientUnlock(client);
+}
+
+bool virNetServerClientHasReplyChunks(virNetServerClientPtr client)
+{
+    bool enabled;
+    virNetServerClientLock(client);
+    enabled = client->replyChunks;
+    virNetServerClientUnlock(client);
+    return enabled;
+}
+
+void virNetServerClientEnableStreamHoles(virNetServerClientPtr client)
+{
+    virNetServerClientLock(client);
+    client->streamHoles = true;
+    virNetServerClientUnlock(client);
+}
+
+bool virNetServerClientHasStreamHoles(virNetServerClientPtr client)
+{
+    bool enabled;
+    virNetServerClientLock(client);
+    enabled = client->streamHoles;
+    virNetServerClientUnlock(client);
+    return enabled;
+}
+
 
 bool virNetServerClientHasTLSSession(virNetServerClientPtr client)
 {
@@ -54,6 +54,12 @@ void virNetServerClientRemoveFilter(virNetServerClientPtr client,
 int virNetServerClientGetAuth(virNetServerClientPtr client);
 bool virNetServerClientGetReadonly(virNetServerClientPtr client);
 
+void virNetServerClientEnableReplyChunks(virNetServerClientPtr client);
+bool virNetServerClientHasReplyChunks(virNetServerClientPtr client);
+
+void virNetServerClientEnableStreamHoles(virNetServerClientPtr client);
+bool virNetServerClientHasStreamHoles(virNetServerClientPtr client);
+
 bool virNetServerClientHasTLSSession(virNetServerClientPtr client);
 int virNetServerClientGetTLSKeySize(virNetServerClientPtr client);
 
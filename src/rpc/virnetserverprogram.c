@@ -183,13 +183,16 @@ virNetServerProgramSendReplyError(virNetServerProgramPtr prog,
      * For data streams, errors are sent back as data streams
      * For method calls, errors are sent back as method replies
      */
+    bool stream = req->type == VIR_NET_STREAM ||
+                  req->type == VIR_NET_STREAM_HOLE;
+
     return virNetServerProgramSendError(prog->program,
                                         prog->version,
                                         client,
                                         msg,
                                         rerr,
                                         req->proc,
-                                        req->type == VIR_NET_STREAM ? VIR_NET_STREAM : VIR_NET_REPLY,
+                                        stream ? VIR_NET_STREAM : VIR_NET_REPLY,
                                         req->serial);
 }
 
@@ -290,6 +293,7 @@ int virNetServerProgramDispatch(virNetServerProgramPtr prog,
         break;
 
     case VIR_NET_STREAM:
+    case VIR_NET_STREAM_HOLE:
         /* Since stream data is non-acked, async, we may continue to receive
          * stream packets after we closed down a stream. Just drop & ignore
          * these.
@@ -358,6 +362,8 @@ virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
     int rv = -1;
     virNetServerProgramProcPtr dispatcher;
     virNetMessageError rerr;
+    virNetMessagePtr chunks = NULL;
+    virNetMessagePtr chunk;
     size_t i;
 
     memset(&rerr, 0, sizeof(rerr));
@@ -453,7 +459,15 @@ virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
         goto error;
     }
 
-    if (virNetMessageEncodePayload(msg, dispatcher->ret_filter, ret) < 0) {
+    /* Clients which negotiated it can get replies larger than
+     * a single message */
+    if (virNetServerClientHasReplyChunks(client)) {
+        if (virNetMessageEncodePayloadChunks(msg, dispatcher->ret_filter,
+                                             ret, &chunks) < 0) {
+            xdr_free(dispatcher->ret_filter, ret);
+            goto error;
+        }
+    } else if (virNetMessageEncodePayload(msg, dispatcher->ret_filter, ret) < 0) {
         xdr_free(dispatcher->ret_filter, ret);
         goto error;
     }
@@ -462,6 +476,16 @@ virNetServerProgramDispatchCall(virNetServerProgramPtr prog,
     VIR_FREE(arg);
     VIR_FREE(ret);
 
+    /* The leading parts of a split reply must go out first */
+    while ((chunk = virNetMessageQueueServe(&chunks))) {
+        if (virNetServerClientSendMessage(client, chunk) < 0) {
+            virNetMessageFree(chunk);
+            while ((chunk = virNetMessageQueueServe(&chunks)))
+                virNetMessageFree(chunk);
+            return -1;
+        }
+    }
+
     /* Put reply on end of tx queue to send out  */
     return virNetServerClientSendMessage(client, msg);
 
@@ -519,6 +543,36 @@ int virNetServerProgramSendStreamData(virNetServerProgramPtr prog,
 }
 
 
+int virNetServerProgramSendStreamHole(virNetServerProgramPtr prog,
+                                      virNetServerClientPtr client,
+                                      virNetMessagePtr msg,
+                                      int procedure,
+                                      int serial,
+                                      unsigned long long length)
+{
+    virNetStreamHole hole;
+
+    VIR_DEBUG("client=%p msg=%p length=%llu", client, msg, length);
+
+    msg->header.prog = prog->program;
+    msg->header.vers = prog->version;
+    msg->header.proc = procedure;
+    msg->header.type = VIR_NET_STREAM_HOLE;
+    msg->header.serial = serial;
+    msg->header.status = VIR_NET_CONTINUE;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        return -1;
+
+    hole.length = length;
+    if (virNetMessageEncodePayload(msg, (xdrproc_t)xdr_virNetStreamHole,
+                                   &hole) < 0)
+        return -1;
+
+    return virNetServerClientSendMessage(client, msg);
+}
+
+
 void virNetServerProgramFree(virNetServerProgramPtr prog)
 {
     if (!prog)
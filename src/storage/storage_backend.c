@@ -1408,6 +1408,268 @@ virStorageBackendStablePath(virStoragePoolObjPtr pool,
 }
 
 
+/* If the volume we're wiping is already a sparse file, we simply
+ * truncate and extend it to its original size, filling it with
+ * zeroes.  This behavior is guaranteed by POSIX:
+ *
+ * http://www.opengroup.org/onlinepubs/9699919799/functions/ftruncate.html
+ *
+ * If fildes refers to a regular file, the ftruncate() function shall
+ * cause the size of the file to be truncated to length. If the size
+ * of the file previously exceeded length, the extra data shall no
+ * longer be available to reads on the file. If the file previously
+ * was smaller than this size, ftruncate() shall increase the size of
+ * the file. If the file size is increased, the extended area shall
+ * appear as if it were zero-filled.
+ */
+static int
+virStorageBackendZeroSparseFile(virStorageVolDefPtr vol,
+                                off_t size,
+                                int fd)
+{
+    int ret = -1;
+
+    ret = ftruncate(fd, 0);
+    if (ret == -1) {
+        virReportSystemError(errno,
+                             _("Failed to truncate volume with "
+                               "path '%s' to 0 bytes"),
+                             vol->target.path);
+        goto out;
+    }
+
+    ret = ftruncate(fd, size);
+    if (ret == -1) {
+        virReportSystemError(errno,
+                             _("Failed to truncate volume with "
+                               "path '%s' to %ju bytes"),
+                             vol->target.path, (uintmax_t)size);
+    }
+
+out:
+    return ret;
+}
+
+
+static int
+virStorageBackendWipeExtent(virStoragePoolObjPtr pool,
+                            virStorageVolDefPtr vol,
+                            int fd,
+                            off_t extent_start,
+                            off_t extent_length,
+                            char *writebuf,
+                            size_t writebuf_length,
+                            size_t *bytes_wiped)
+{
+    int ret = -1, written = 0;
+    off_t remaining = 0;
+    size_t write_size = 0;
+
+    VIR_DEBUG("extent logical start: %ju len: %ju",
+              (uintmax_t)extent_start, (uintmax_t)extent_length);
+
+    if ((ret = lseek(fd, extent_start, SEEK_SET)) < 0) {
+        virReportSystemError(errno,
+                             _("Failed to seek to position %ju in volume "
+                               "with path '%s'"),
+                             (uintmax_t)extent_start, vol->target.path);
+        goto out;
+    }
+
+    remaining = extent_length;
+    while (remaining > 0) {
+
+        write_size = (writebuf_length < remaining) ? writebuf_length : remaining;
+        written = safewrite(fd, writebuf, write_size);
+        if (written < 0) {
+            virReportSystemError(errno,
+                                 _("Failed to write %zu bytes to "
+                                   "storage volume with path '%s'"),
+                                 write_size, vol->target.path);
+
+            goto out;
+        }
+
+        *bytes_wiped += written;
+        remaining -= written;
+
+        /* The pool is not locked while wiping, so that the progress
+         * can be queried */
+        virStoragePoolObjLock(pool);
+        vol->wipeProcessed = *bytes_wiped;
+        virStoragePoolObjUnlock(pool);
+    }
+
+    if (fdatasync(fd) < 0) {
+        ret = -errno;
+        virReportSystemError(errno,
+                             _("cannot sync data to volume with path '%s'"),
+                             vol->target.path);
+        goto out;
+    }
+
+    VIR_DEBUG("Wrote %zu bytes to volume with path '%s'",
+              *bytes_wiped, vol->target.path);
+
+    ret = 0;
+
+out:
+    return ret;
+}
+
+
+/* Size of the writes used to zero a volume, and the alignment of the
+ * buffer, which is enough for O_DIRECT */
+#define WIPE_WRITE_SIZE (1024 * 1024)
+#define WIPE_WRITE_ALIGN (64 * 1024)
+
+/*
+ * Have the kernel zero a block device with BLKZEROOUT, which writes
+ * zeroes to the device, or has it do so, without passing them through
+ * here. Returns 0 on success, 1 if the device can't do it and -1 on
+ * error.
+ *
+ * Discarding the device would be faster still, but leaves the data on
+ * the media, and devices claiming with BLKDISCARDZEROES that discarded
+ * blocks read back as zeroes are known to lie, so it isn't used.
+ */
+static int
+virStorageBackendZeroBlockDevice(virStorageVolDefPtr vol ATTRIBUTE_UNUSED,
+                                 int fd ATTRIBUTE_UNUSED,
+                                 off_t size ATTRIBUTE_UNUSED)
+{
+#ifdef BLKZEROOUT
+    uint64_t range[2] = { 0, size };
+
+    if (ioctl(fd, BLKZEROOUT, range) == 0) {
+        VIR_DEBUG("Zeroed out volume with path '%s'", vol->target.path);
+        return 0;
+    }
+    if (errno != ENOTTY && errno != EOPNOTSUPP && errno != EINVAL) {
+        virReportSystemError(errno,
+                             _("Failed to zero out volume with path '%s'"),
+                             vol->target.path);
+        return -1;
+    }
+#endif
+
+    return 1;
+}
+
+/*
+ * Zero a volume by writing zeroes to it, bypassing the page cache
+ * when possible so that the writes go at the speed of the storage
+ */
+static int
+virStorageBackendZeroWrite(virStoragePoolObjPtr pool,
+                           virStorageVolDefPtr vol,
+                           int fd,
+                           off_t size)
+{
+    char *base = NULL;
+    char *buf;
+    int directfd = -1;
+    off_t directsize = 0;
+    size_t bytes_wiped = 0;
+    int ret = -1;
+
+#if HAVE_POSIX_MEMALIGN
+    if (posix_memalign((void **)&base, WIPE_WRITE_ALIGN, WIPE_WRITE_SIZE)) {
+        virReportOOMError();
+        goto cleanup;
+    }
+    buf = base;
+    memset(buf, 0, WIPE_WRITE_SIZE);
+#else
+    if (VIR_ALLOC_N(base, WIPE_WRITE_SIZE + WIPE_WRITE_ALIGN - 1) < 0) {
+        virReportOOMError();
+        goto cleanup;
+    }
+    buf = (char *) (((intptr_t) base + WIPE_WRITE_ALIGN - 1) &
+                    ~((intptr_t) WIPE_WRITE_ALIGN - 1));
+#endif
+
+    /* O_DIRECT needs aligned writes, so the end of the volume is
+     * written through the page cache */
+    if (O_DIRECT &&
+        (directfd = open(vol->target.path, O_WRONLY | O_DIRECT)) >= 0)
+        directsize = size & ~((off_t) WIPE_WRITE_ALIGN - 1);
+    else
+        VIR_DEBUG("Cannot bypass the page cache for volume with path '%s'",
+                  vol->target.path);
+
+    if (directsize > 0 &&
+        virStorageBackendWipeExtent(pool, vol, directfd, 0, directsize,
+                                    buf, WIPE_WRITE_SIZE, &bytes_wiped) < 0)
+        goto cleanup;
+
+    if (directsize < size &&
+        virStorageBackendWipeExtent(pool, vol, fd,
+                                    directsize, size - directsize,
+                                    buf, WIPE_WRITE_SIZE, &bytes_wiped) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    VIR_FORCE_CLOSE(directfd);
+#if HAVE_POSIX_MEMALIGN
+    free(base);
+#else
+    VIR_FREE(base);
+#endif
+    return ret;
+}
+
+
+/**
+ * virStorageBackendVolZeroLocal:
+ * @pool: the pool of @vol, which the caller must not have locked
+ * @vol: the volume to zero
+ * @fd: the volume, opened for writing
+ * @st: the result of fstat() on @fd
+ *
+ * Zero a local volume for the zero wipe algorithm. Sparse files are
+ * truncated, as before they were ever written to. Anything else is
+ * overwritten with zeroes, by the kernel for block devices which can do
+ * it, otherwise bypassing the page cache where possible. Punching a hole
+ * in files, or discarding devices, would be faster, but leave the data
+ * on the media.
+ *
+ * The amount of data to write, and how much of it has been written,
+ * is kept in @vol while it is overwritten.
+ *
+ * Returns 0 on success, -1 on error.
+ */
+int
+virStorageBackendVolZeroLocal(virStoragePoolObjPtr pool,
+                              virStorageVolDefPtr vol,
+                              int fd,
+                              struct stat *st)
+{
+    off_t size;
+    int ret = 1;
+
+    virStoragePoolObjLock(pool);
+    /* The allocation of a file is rounded up to its blocks, don't make
+     * it grow */
+    size = S_ISREG(st->st_mode) ? st->st_size : vol->allocation;
+    vol->wipeTotal = size;
+    virStoragePoolObjUnlock(pool);
+
+    if (S_ISREG(st->st_mode) && st->st_blocks < (st->st_size / DEV_BSIZE))
+        return virStorageBackendZeroSparseFile(vol, st->st_size, fd);
+
+    if (S_ISBLK(st->st_mode))
+        ret = virStorageBackendZeroBlockDevice(vol, fd, size);
+
+    if (ret > 0)
+        ret = virStorageBackendZeroWrite(pool, vol, fd, size);
+
+    return ret;
+}
+
+
 #ifndef WIN32
 /*
  * Run an external program.
@@ -25,6 +25,7 @@
 # define __VIR_STORAGE_BACKEND_H__
 
 # include <stdint.h>
+# include <sys/stat.h>
 # include "internal.h"
 # include "storage_conf.h"
 
@@ -132,6 +133,13 @@ virStorageBackendDetectBlockVolFormatFD(virStorageVolTargetPtr target,
 char *virStorageBackendStablePath(virStoragePoolObjPtr pool,
                                   const char *devpath);
 
+int virStorageBackendVolZeroLocal(virStoragePoolObjPtr pool,
+                                  virStorageVolDefPtr vol,
+                                  int fd,
+                                  struct stat *st)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2) ATTRIBUTE_NONNULL(4)
+    ATTRIBUTE_RETURN_CHECK;
+
 typedef int (*virStorageBackendListVolRegexFunc)(virStoragePoolObjPtr pool,
                                                  char **const groups,
                                                  void *data);
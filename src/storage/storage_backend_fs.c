@@ -32,6 +32,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 
 #include <libxml/parser.h>
 #include <libxml/tree.h>
@@ -50,6 +51,9 @@
 #include "xml.h"
 #include "virfile.h"
 #include "logging.h"
+#include "threadpool.h"
+#include "virhash.h"
+#include "ignore-value.h"
 
 #define VIR_FROM_THIS VIR_FROM_STORAGE
 
@@ -825,9 +829,315 @@ error:
 }
 
 
+/* Number of volumes probed in parallel while refreshing a pool; as
+ * probing mostly waits for the storage, especially with NFS, there
+ * may be more of them than CPUs */
+#define VIR_STORAGE_FS_REFRESH_WORKERS 16
+
+/*
+ * What probing a volume found out, which remains valid as long as the
+ * file is left alone. Any change to its content or attributes updates
+ * its ctime, so it is enough to check that the file is the same, with
+ * the same size and times as when it was probed.
+ */
+typedef struct _virStorageBackendFSVolCache virStorageBackendFSVolCache;
+typedef virStorageBackendFSVolCache *virStorageBackendFSVolCachePtr;
+struct _virStorageBackendFSVolCache {
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    time_t mtime;
+    time_t ctime;
+
+    int type;
+    int format;
+    virStoragePerms perms;
+    unsigned long long allocation;
+    unsigned long long capacity;
+    int encryptionFormat; /* -1 if not encrypted */
+    char *backingStore;
+    int backingStoreFormat;
+};
+
+static void
+virStorageBackendFSVolCacheFree(void *payload,
+                                const void *name ATTRIBUTE_UNUSED)
+{
+    virStorageBackendFSVolCachePtr entry = payload;
+
+    if (!entry)
+        return;
+
+    VIR_FREE(entry->perms.label);
+    VIR_FREE(entry->backingStore);
+    VIR_FREE(entry);
+}
+
+static void
+virStorageBackendFSPoolCacheFree(void *data)
+{
+    virHashFree(data);
+}
+
+static bool
+virStorageBackendFSVolCacheMatch(virStorageBackendFSVolCachePtr entry,
+                                 struct stat *sb)
+{
+    return entry->dev == sb->st_dev &&
+        entry->ino == sb->st_ino &&
+        entry->size == sb->st_size &&
+        entry->mtime == sb->st_mtime &&
+        entry->ctime == sb->st_ctime;
+}
+
+/* Fill in @vol with what was found when it was last probed */
+static int
+virStorageBackendFSVolCacheLoad(virStorageBackendFSVolCachePtr entry,
+                                virStorageVolDefPtr vol)
+{
+    vol->type = entry->type;
+    vol->target.format = entry->format;
+    vol->target.perms.mode = entry->perms.mode;
+    vol->target.perms.uid = entry->perms.uid;
+    vol->target.perms.gid = entry->perms.gid;
+    vol->allocation = entry->allocation;
+    vol->capacity = entry->capacity;
+
+    if (entry->perms.label &&
+        !(vol->target.perms.label = strdup(entry->perms.label)))
+        goto no_memory;
+
+    if (entry->encryptionFormat >= 0) {
+        if (VIR_ALLOC(vol->target.encryption) < 0)
+            goto no_memory;
+        vol->target.encryption->format = entry->encryptionFormat;
+    }
+
+    if (entry->backingStore) {
+        if (!(vol->backingStore.path = strdup(entry->backingStore)))
+            goto no_memory;
+        vol->backingStore.format = entry->backingStoreFormat;
+    }
+
+    return 0;
+
+no_memory:
+    virReportOOMError();
+    return -1;
+}
+
+static virStorageBackendFSVolCachePtr
+virStorageBackendFSVolCacheNew(virStorageVolDefPtr vol,
+                               struct stat *sb)
+{
+    virStorageBackendFSVolCachePtr entry;
+
+    if (VIR_ALLOC(entry) < 0)
+        goto no_memory;
+
+    entry->dev = sb->st_dev;
+    entry->ino = sb->st_ino;
+    entry->size = sb->st_size;
+    entry->mtime = sb->st_mtime;
+    entry->ctime = sb->st_ctime;
+
+    entry->type = vol->type;
+    entry->format = vol->target.format;
+    entry->perms.mode = vol->target.perms.mode;
+    entry->perms.uid = vol->target.perms.uid;
+    entry->perms.gid = vol->target.perms.gid;
+    entry->allocation = vol->allocation;
+    entry->capacity = vol->capacity;
+    entry->encryptionFormat = vol->target.encryption ?
+        vol->target.encryption->format : -1;
+    entry->backingStoreFormat = vol->backingStore.format;
+
+    if (vol->target.perms.label &&
+        !(entry->perms.label = strdup(vol->target.perms.label)))
+        goto no_memory;
+    if (vol->backingStore.path &&
+        !(entry->backingStore = strdup(vol->backingStore.path)))
+        goto no_memory;
+
+    return entry;
+
+no_memory:
+    virReportOOMError();
+    virStorageBackendFSVolCacheFree(entry, NULL);
+    return NULL;
+}
+
+typedef struct _virStorageBackendFSRefreshJob virStorageBackendFSRefreshJob;
+typedef virStorageBackendFSRefreshJob *virStorageBackendFSRefreshJobPtr;
+struct _virStorageBackendFSRefreshJob {
+    virStorageVolDefPtr vol;
+    virStorageBackendFSVolCachePtr entry; /* to be cached, if any */
+    int ret;
+    virErrorPtr err;
+};
+
+typedef struct _virStorageBackendFSRefresh virStorageBackendFSRefresh;
+typedef virStorageBackendFSRefresh *virStorageBackendFSRefreshPtr;
+struct _virStorageBackendFSRefresh {
+    virMutex lock;
+    virCond done;
+    size_t pending;
+
+    /* Only read while the volumes are probed */
+    virHashTablePtr cache;
+};
+
+/*
+ * Probe the volume of @job, unless it was probed before and hasn't
+ * changed since. Returns 0 on success, -2 if the volume is to be
+ * ignored and -1 on error, like virStorageBackendProbeTarget.
+ */
+static int
+virStorageBackendFSRefreshVol(virStorageBackendFSRefreshJobPtr job,
+                              virHashTablePtr cache)
+{
+    virStorageVolDefPtr vol = job->vol;
+    virStorageBackendFSVolCachePtr entry;
+    struct stat sb;
+    bool cacheable;
+    time_t now;
+    int ret;
+    char *backingStore;
+    int backingStoreFormat;
+
+    /* A file changed within the current second may be changed again
+     * without its times changing, so only older ones are cached */
+    now = time(NULL);
+    cacheable = stat(vol->target.path, &sb) == 0 &&
+        sb.st_mtime < now && sb.st_ctime < now;
+
+    if (cacheable &&
+        (entry = virHashLookup(cache, vol->target.path)) &&
+        virStorageBackendFSVolCacheMatch(entry, &sb)) {
+        if (virStorageBackendFSVolCacheLoad(entry, vol) < 0)
+            return -1;
+        goto backing;
+    }
+
+    if ((ret = virStorageBackendProbeTarget(&vol->target,
+                                            &backingStore,
+                                            &backingStoreFormat,
+                                            &vol->allocation,
+                                            &vol->capacity,
+                                            &vol->target.encryption)) < 0) {
+        if (ret == -2) {
+            /* Silently ignore non-regular files,
+             * eg '.' '..', 'lost+found', dangling symbolic link */
+            return -2;
+        } else if (ret == -3) {
+            /* The backing file is currently unavailable, its format is not
+             * explicitly specified, the probe to auto detect the format
+             * failed: continue with faked RAW format, since AUTO will
+             * break virStorageVolTargetDefFormat() generating the line
+             * <format type='...'/>. Probe again next time. */
+            backingStoreFormat = VIR_STORAGE_FILE_RAW;
+            cacheable = false;
+        } else
+            return -1;
+    }
+
+    /* directory based volume */
+    if (vol->target.format == VIR_STORAGE_FILE_DIR)
+        vol->type = VIR_STORAGE_VOL_DIR;
+
+    if (backingStore != NULL) {
+        vol->backingStore.path = backingStore;
+        vol->backingStore.format = backingStoreFormat;
+    }
+
+    /* Failing to cache only means probing again next time */
+    if (cacheable)
+        job->entry = virStorageBackendFSVolCacheNew(vol, &sb);
+
+backing:
+    if (vol->backingStore.path &&
+        virStorageBackendUpdateVolTargetInfo(&vol->backingStore,
+                                             NULL, NULL,
+                                             VIR_STORAGE_VOL_OPEN_DEFAULT) < 0) {
+        /* The backing file is currently unavailable, the capacity,
+         * allocation, owner, group and mode are unknown. Just log the
+         * error and continue.
+         * Unfortunately virStorageBackendProbeTarget() might already
+         * have logged a similar message for the same problem, but only
+         * if AUTO format detection was used. */
+        virStorageReportError(VIR_ERR_INTERNAL_ERROR,
+                              _("cannot probe backing volume info: %s"),
+                              vol->backingStore.path);
+    }
+
+    return 0;
+}
+
+static void
+virStorageBackendFSRefreshWorker(void *jobdata, void *opaque)
+{
+    virStorageBackendFSRefreshJobPtr job = jobdata;
+    virStorageBackendFSRefreshPtr refresh = opaque;
+
+    /* Errors are per thread, so hand them over to the refreshing one */
+    if ((job->ret = virStorageBackendFSRefreshVol(job, refresh->cache)) == -1)
+        job->err = virSaveLastError();
+
+    virMutexLock(&refresh->lock);
+    if (--refresh->pending == 0)
+        virCondSignal(&refresh->done);
+    virMutexUnlock(&refresh->lock);
+}
+
+/*
+ * Probe the volumes of @jobs using a pool of worker threads, and wait
+ * for all of them to be done
+ */
+static int
+virStorageBackendFSRefreshJobs(virStorageBackendFSRefreshPtr refresh,
+                               virStorageBackendFSRefreshJobPtr jobs,
+                               size_t njobs)
+{
+    virThreadPoolPtr workers;
+    size_t nworkers = MIN(njobs, VIR_STORAGE_FS_REFRESH_WORKERS);
+    size_t i;
+    int ret = 0;
+
+    if (!(workers = virThreadPoolNew(nworkers, nworkers, 0,
+                                     virStorageBackendFSRefreshWorker,
+                                     refresh)))
+        return -1;
+
+    virMutexLock(&refresh->lock);
+    for (i = 0; i < njobs; i++) {
+        if (virThreadPoolSendJob(workers, 0, &jobs[i]) < 0) {
+            ret = -1;
+            break;
+        }
+        refresh->pending++;
+    }
+
+    while (refresh->pending > 0) {
+        if (virCondWait(&refresh->done, &refresh->lock) < 0) {
+            virReportSystemError(errno, "%s",
+                                 _("failed to wait for volume probes"));
+            ret = -1;
+            break;
+        }
+    }
+    virMutexUnlock(&refresh->lock);
+
+    virThreadPoolFree(workers);
+    return ret;
+}
+
 /**
  * Iterate over the pool's directory and enumerate all disk images
  * within it. This is non-recursive.
+ *
+ * The volumes are probed in parallel, and what was found out about
+ * them is kept along with the pool, so that the volumes which haven't
+ * changed since the previous refresh need not be probed again.
  */
 static int
 virStorageBackendFileSystemRefresh(virConnectPtr conn ATTRIBUTE_UNUSED,
@@ -837,6 +1147,15 @@ virStorageBackendFileSystemRefresh(virConnectPtr conn ATTRIBUTE_UNUSED,
     struct dirent *ent;
     struct statvfs sb;
     virStorageVolDefPtr vol = NULL;
+    virStorageBackendFSRefreshJobPtr jobs = NULL;
+    size_t njobs = 0;
+    virStorageBackendFSRefresh refresh;
+    bool refreshInit = false;
+    virHashTablePtr cache = NULL;
+    size_t i;
+    int ret = -1;
+
+    memset(&refresh, 0, sizeof(refresh));
 
     if (!(dir = opendir(pool->def->target.path))) {
         virReportSystemError(errno,
@@ -846,10 +1165,6 @@ virStorageBackendFileSystemRefresh(virConnectPtr conn ATTRIBUTE_UNUSED,
     }
 
     while ((ent = readdir(dir)) != NULL) {
-        int ret;
-        char *backingStore;
-        int backingStoreFormat;
-
         if (VIR_ALLOC(vol) < 0)
             goto no_memory;
 
@@ -866,67 +1181,66 @@ virStorageBackendFileSystemRefresh(virConnectPtr conn ATTRIBUTE_UNUSED,
         if ((vol->key = strdup(vol->target.path)) == NULL)
             goto no_memory;
 
-        if ((ret = virStorageBackendProbeTarget(&vol->target,
-                                                &backingStore,
-                                                &backingStoreFormat,
-                                                &vol->allocation,
-                                                &vol->capacity,
-                                                &vol->target.encryption)) < 0) {
-            if (ret == -2) {
-                /* Silently ignore non-regular files,
-                 * eg '.' '..', 'lost+found', dangling symbolic link */
-                virStorageVolDefFree(vol);
-                vol = NULL;
-                continue;
-            } else if (ret == -3) {
-                /* The backing file is currently unavailable, its format is not
-                 * explicitly specified, the probe to auto detect the format
-                 * failed: continue with faked RAW format, since AUTO will
-                 * break virStorageVolTargetDefFormat() generating the line
-                 * <format type='...'/>. */
-                backingStoreFormat = VIR_STORAGE_FILE_RAW;
-            } else
-                goto cleanup;
-        }
+        if (VIR_EXPAND_N(jobs, njobs, 1) < 0)
+            goto no_memory;
+        jobs[njobs - 1].vol = vol;
+        vol = NULL;
+    }
+    closedir(dir);
+    dir = NULL;
 
-        /* directory based volume */
-        if (vol->target.format == VIR_STORAGE_FILE_DIR)
-            vol->type = VIR_STORAGE_VOL_DIR;
-
-        if (backingStore != NULL) {
-            vol->backingStore.path = backingStore;
-            vol->backingStore.format = backingStoreFormat;
-
-            if (virStorageBackendUpdateVolTargetInfo(&vol->backingStore,
-                                        NULL, NULL,
-                                        VIR_STORAGE_VOL_OPEN_DEFAULT) < 0) {
-                /* The backing file is currently unavailable, the capacity,
-                 * allocation, owner, group and mode are unknown. Just log the
-                 * error and continue.
-                 * Unfortunately virStorageBackendProbeTarget() might already
-                 * have logged a similar message for the same problem, but only
-                 * if AUTO format detection was used. */
-                virStorageReportError(VIR_ERR_INTERNAL_ERROR,
-                                      _("cannot probe backing volume info: %s"),
-                                      vol->backingStore.path);
-            }
+    if (virMutexInit(&refresh.lock) < 0 ||
+        virCondInit(&refresh.done) < 0) {
+        virStorageReportError(VIR_ERR_INTERNAL_ERROR, "%s",
+                              _("cannot initialize mutex"));
+        goto cleanup;
+    }
+    refreshInit = true;
+    /* The pool may have been of another type before */
+    if (pool->privateFree == virStorageBackendFSPoolCacheFree)
+        refresh.cache = pool->privateData;
+
+    if (njobs > 0 &&
+        virStorageBackendFSRefreshJobs(&refresh, jobs, njobs) < 0)
+        goto cleanup;
+
+    /* What was found out is only kept for the volumes still around */
+    if (!(cache = virHashCreate(njobs, virStorageBackendFSVolCacheFree)))
+        goto cleanup;
+
+    /* Add the volumes in the order they were found in the directory */
+    for (i = 0; i < njobs; i++) {
+        virStorageBackendFSRefreshJobPtr job = &jobs[i];
+
+        if (job->ret == -2)
+            continue;
+
+        if (job->ret < 0) {
+            if (job->err)
+                virSetError(job->err);
+            goto cleanup;
         }
 
+        if (job->entry &&
+            virHashAddEntry(cache, job->vol->target.path, job->entry) == 0)
+            job->entry = NULL;
 
-        if (VIR_REALLOC_N(pool->volumes.objs,
-                          pool->volumes.count+1) < 0)
-            goto no_memory;
-        pool->volumes.objs[pool->volumes.count++] = vol;
-        vol = NULL;
+        if (virStoragePoolObjAddVol(pool, job->vol) < 0)
+            goto cleanup;
+        job->vol = NULL;
     }
-    closedir(dir);
 
+    if (pool->privateFree)
+        (*pool->privateFree)(pool->privateData);
+    pool->privateData = cache;
+    pool->privateFree = virStorageBackendFSPoolCacheFree;
+    cache = NULL;
 
     if (statvfs(pool->def->target.path, &sb) < 0) {
         virReportSystemError(errno,
                              _("cannot statvfs path '%s'"),
                              pool->def->target.path);
-        return -1;
+        goto cleanup;
     }
     pool->def->capacity = ((unsigned long long)sb.f_frsize *
                            (unsigned long long)sb.f_blocks);
@@ -934,7 +1248,8 @@ virStorageBackendFileSystemRefresh(virConnectPtr conn ATTRIBUTE_UNUSED,
                             (unsigned long long)sb.f_bsize);
     pool->def->allocation = pool->def->capacity - pool->def->available;
 
-    return 0;
+    ret = 0;
+    goto cleanup;
 
 no_memory:
     virReportOOMError();
@@ -944,8 +1259,20 @@ no_memory:
     if (dir)
         closedir(dir);
     virStorageVolDefFree(vol);
-    virStoragePoolObjClearVols(pool);
-    return -1;
+    for (i = 0; i < njobs; i++) {
+        virStorageVolDefFree(jobs[i].vol);
+        virStorageBackendFSVolCacheFree(jobs[i].entry, NULL);
+        virFreeError(jobs[i].err);
+    }
+    VIR_FREE(jobs);
+    if (refreshInit) {
+        ignore_value(virCondDestroy(&refresh.done));
+        virMutexDestroy(&refresh.lock);
+    }
+    virHashFree(cache);
+    if (ret < 0)
+        virStoragePoolObjClearVols(pool);
+    return ret;
 }
 
 
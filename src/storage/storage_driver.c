@@ -175,7 +175,6 @@ storageDriverStartup(int privileged)
                                      driverState->configDir,
                                      driverState->autostartDir) < 0)
         goto error;
-    storageDriverAutostart(driverState);
 
     storageDriverUnlock(driverState);
     return 0;
@@ -189,6 +188,22 @@ error:
     return -1;
 }
 
+/**
+ * storageDriverAutoStart:
+ *
+ * Start the pools marked for autostart, and refresh those found to be
+ * already started
+ */
+static void
+storageDriverAutoStart(void) {
+    if (!driverState)
+        return;
+
+    storageDriverLock(driverState);
+    storageDriverAutostart(driverState);
+    storageDriverUnlock(driverState);
+}
+
 /**
  * virStorageReload:
  *
@@ -1281,6 +1296,33 @@ storageVolumeLookupByPath(virConnectPtr conn,
 
 static int storageVolumeDelete(virStorageVolPtr obj, unsigned int flags);
 
+/*
+ * Undo backend->createVol for @vol, which could not be added to @pool.
+ * Backends building volumes separately only define them in createVol,
+ * and deleting a volume of theirs could remove a file of the same name
+ * which the pool doesn't know about, so they are left alone.
+ */
+static void
+storageVolumeCreateUndo(virConnectPtr conn,
+                        virStorageBackendPtr backend,
+                        virStoragePoolObjPtr pool,
+                        virStorageVolDefPtr vol)
+{
+    virErrorPtr orig_err;
+
+    if (backend->buildVol || !backend->deleteVol)
+        return;
+
+    orig_err = virSaveLastError();
+    if (backend->deleteVol(conn, pool, vol, 0) < 0)
+        VIR_WARN("Failed to delete volume '%s' left out of storage pool '%s'",
+                 vol->name, pool->def->name);
+    if (orig_err) {
+        virSetError(orig_err);
+        virFreeError(orig_err);
+    }
+}
+
 static virStorageVolPtr
 storageVolumeCreateXML(virStoragePoolPtr obj,
                        const char *xmldesc,
@@ -1323,12 +1365,6 @@ storageVolumeCreateXML(virStoragePoolPtr obj,
         goto cleanup;
     }
 
-    if (VIR_REALLOC_N(pool->volumes.objs,
-                      pool->volumes.count+1) < 0) {
-        virReportOOMError();
-        goto cleanup;
-    }
-
     if (!backend->createVol) {
         virStorageReportError(VIR_ERR_NO_SUPPORT,
                               "%s", _("storage pool does not support volume "
@@ -1340,11 +1376,15 @@ storageVolumeCreateXML(virStoragePoolPtr obj,
         goto cleanup;
     }
 
-    pool->volumes.objs[pool->volumes.count++] = voldef;
+    if (virStoragePoolObjAddVol(pool, voldef) < 0) {
+        storageVolumeCreateUndo(obj->conn, backend, pool, voldef);
+        goto cleanup;
+    }
     volobj = virGetStorageVol(obj->conn, pool->def->name, voldef->name,
                               voldef->key);
     if (!volobj) {
-        pool->volumes.count--;
+        virStoragePoolObjRemoveVol(pool, voldef);
+        storageVolumeCreateUndo(obj->conn, backend, pool, voldef);
         goto cleanup;
     }
 
@@ -1497,24 +1537,33 @@ storageVolumeCreateXMLFrom(virStoragePoolPtr obj,
         goto cleanup;
     }
 
-    if (backend->refreshVol &&
-        backend->refreshVol(obj->conn, pool, origvol) < 0)
+    if (origvol->wiping) {
+        virStorageReportError(VIR_ERR_OPERATION_INVALID,
+                              _("volume '%s' is being wiped."),
+                              origvol->name);
         goto cleanup;
+    }
 
-    if (VIR_REALLOC_N(pool->volumes.objs,
-                      pool->volumes.count+1) < 0) {
-        virReportOOMError();
+    if (backend->refreshVol &&
+        backend->refreshVol(obj->conn, pool, origvol) < 0)
         goto cleanup;
-    }
 
     /* 'Define' the new volume so we get async progress reporting */
     if (backend->createVol(obj->conn, pool, newvol) < 0) {
         goto cleanup;
     }
 
-    pool->volumes.objs[pool->volumes.count++] = newvol;
+    if (virStoragePoolObjAddVol(pool, newvol) < 0) {
+        storageVolumeCreateUndo(obj->conn, backend, pool, newvol);
+        goto cleanup;
+    }
     volobj = virGetStorageVol(obj->conn, pool->def->name, newvol->name,
                               newvol->key);
+    if (!volobj) {
+        virStoragePoolObjRemoveVol(pool, newvol);
+        storageVolumeCreateUndo(obj->conn, backend, pool, newvol);
+        goto cleanup;
+    }
 
     /* Drop the pool lock during volume allocation */
     pool->asyncjobs++;
@@ -1616,6 +1665,13 @@ storageVolumeDownload(virStorageVolPtr obj,
         goto out;
     }
 
+    if (vol->wiping) {
+        virStorageReportError(VIR_ERR_OPERATION_INVALID,
+                              _("volume '%s' is being wiped."),
+                              vol->name);
+        goto out;
+    }
+
     if (virFDStreamOpenFile(stream,
                             vol->target.path,
                             offset, length,
@@ -1678,6 +1734,13 @@ storageVolumeUpload(virStorageVolPtr obj,
         goto out;
     }
 
+    if (vol->wiping) {
+        virStorageReportError(VIR_ERR_OPERATION_INVALID,
+                              _("volume '%s' is being wiped."),
+                              vol->name);
+        goto out;
+    }
+
     /* Not using O_CREAT because the file is required to
      * already exist at this point */
     if (virFDStreamOpenFile(stream,
@@ -1744,6 +1807,13 @@ storageVolumeResize(virStorageVolPtr obj,
         goto out;
     }
 
+    if (vol->wiping) {
+        virStorageReportError(VIR_ERR_OPERATION_INVALID,
+                              _("volume '%s' is being wiped."),
+                              vol->name);
+        goto out;
+    }
+
     if (flags & VIR_STORAGE_VOL_RESIZE_DELTA) {
         abs_capacity = vol->capacity + capacity;
         flags &= ~VIR_STORAGE_VOL_RESIZE_DELTA;
@@ -1784,117 +1854,13 @@ out:
     return ret;
 }
 
-/* If the volume we're wiping is already a sparse file, we simply
- * truncate and extend it to its original size, filling it with
- * zeroes.  This behavior is guaranteed by POSIX:
- *
- * http://www.opengroup.org/onlinepubs/9699919799/functions/ftruncate.html
- *
- * If fildes refers to a regular file, the ftruncate() function shall
- * cause the size of the file to be truncated to length. If the size
- * of the file previously exceeded length, the extra data shall no
- * longer be available to reads on the file. If the file previously
- * was smaller than this size, ftruncate() shall increase the size of
- * the file. If the file size is increased, the extended area shall
- * appear as if it were zero-filled.
- */
-static int
-storageVolumeZeroSparseFile(virStorageVolDefPtr vol,
-                            off_t size,
-                            int fd)
-{
-    int ret = -1;
-
-    ret = ftruncate(fd, 0);
-    if (ret == -1) {
-        virReportSystemError(errno,
-                             _("Failed to truncate volume with "
-                               "path '%s' to 0 bytes"),
-                             vol->target.path);
-        goto out;
-    }
-
-    ret = ftruncate(fd, size);
-    if (ret == -1) {
-        virReportSystemError(errno,
-                             _("Failed to truncate volume with "
-                               "path '%s' to %ju bytes"),
-                             vol->target.path, (uintmax_t)size);
-    }
-
-out:
-    return ret;
-}
-
-
-static int
-storageWipeExtent(virStorageVolDefPtr vol,
-                  int fd,
-                  off_t extent_start,
-                  off_t extent_length,
-                  char *writebuf,
-                  size_t writebuf_length,
-                  size_t *bytes_wiped)
-{
-    int ret = -1, written = 0;
-    off_t remaining = 0;
-    size_t write_size = 0;
-
-    VIR_DEBUG("extent logical start: %ju len: %ju",
-              (uintmax_t)extent_start, (uintmax_t)extent_length);
-
-    if ((ret = lseek(fd, extent_start, SEEK_SET)) < 0) {
-        virReportSystemError(errno,
-                             _("Failed to seek to position %ju in volume "
-                               "with path '%s'"),
-                             (uintmax_t)extent_start, vol->target.path);
-        goto out;
-    }
-
-    remaining = extent_length;
-    while (remaining > 0) {
-
-        write_size = (writebuf_length < remaining) ? writebuf_length : remaining;
-        written = safewrite(fd, writebuf, write_size);
-        if (written < 0) {
-            virReportSystemError(errno,
-                                 _("Failed to write %zu bytes to "
-                                   "storage volume with path '%s'"),
-                                 write_size, vol->target.path);
-
-            goto out;
-        }
-
-        *bytes_wiped += written;
-        remaining -= written;
-    }
-
-    if (fdatasync(fd) < 0) {
-        ret = -errno;
-        virReportSystemError(errno,
-                             _("cannot sync data to volume with path '%s'"),
-                             vol->target.path);
-        goto out;
-    }
-
-    VIR_DEBUG("Wrote %zu bytes to volume with path '%s'",
-              *bytes_wiped, vol->target.path);
-
-    ret = 0;
-
-out:
-    return ret;
-}
-
-
 static int
-storageVolumeWipeInternal(virStorageVolDefPtr def,
+storageVolumeWipeInternal(virStoragePoolObjPtr pool,
+                          virStorageVolDefPtr def,
                           unsigned int algorithm)
 {
     int ret = -1, fd = -1;
     struct stat st;
-    char *writebuf = NULL;
-    size_t bytes_wiped = 0;
     virCommandPtr cmd = NULL;
 
     VIR_DEBUG("Wiping volume with path '%s' and algorithm %u",
@@ -1957,28 +1923,11 @@ storageVolumeWipeInternal(virStorageVolDefPtr def,
         ret = 0;
         goto out;
     } else {
-        if (S_ISREG(st.st_mode) && st.st_blocks < (st.st_size / DEV_BSIZE)) {
-            ret = storageVolumeZeroSparseFile(def, st.st_size, fd);
-        } else {
-
-            if (VIR_ALLOC_N(writebuf, st.st_blksize) != 0) {
-                virReportOOMError();
-                goto out;
-            }
-
-            ret = storageWipeExtent(def,
-                                    fd,
-                                    0,
-                                    def->allocation,
-                                    writebuf,
-                                    st.st_blksize,
-                                    &bytes_wiped);
-        }
+        ret = virStorageBackendVolZeroLocal(pool, def, fd, &st);
     }
 
 out:
     virCommandFree(cmd);
-    VIR_FREE(writebuf);
     VIR_FORCE_CLOSE(fd);
     return ret;
 }
@@ -2035,11 +1984,29 @@ storageVolumeWipePattern(virStorageVolPtr obj,
         goto out;
     }
 
-    if (storageVolumeWipeInternal(vol, algorithm) == -1) {
+    if (vol->wiping) {
+        virStorageReportError(VIR_ERR_OPERATION_INVALID,
+                              _("volume '%s' is being wiped."),
+                              vol->name);
         goto out;
     }
 
-    ret = 0;
+    /* Drop the pool lock while wiping, so that the progress of the
+     * wipe can be queried */
+    pool->asyncjobs++;
+    vol->wiping = 1;
+    vol->wipeProcessed = 0;
+    vol->wipeTotal = 0;
+    virStoragePoolObjUnlock(pool);
+
+    ret = storageVolumeWipeInternal(pool, vol, algorithm);
+
+    storageDriverLock(driver);
+    virStoragePoolObjLock(pool);
+    storageDriverUnlock(driver);
+
+    vol->wiping = 0;
+    pool->asyncjobs--;
 
 out:
     if (pool) {
@@ -2064,7 +2031,6 @@ storageVolumeDelete(virStorageVolPtr obj,
     virStoragePoolObjPtr pool;
     virStorageBackendPtr backend;
     virStorageVolDefPtr vol = NULL;
-    unsigned int i;
     int ret = -1;
 
     storageDriverLock(driver);
@@ -2102,6 +2068,13 @@ storageVolumeDelete(virStorageVolPtr obj,
         goto cleanup;
     }
 
+    if (vol->wiping) {
+        virStorageReportError(VIR_ERR_OPERATION_INVALID,
+                              _("volume '%s' is being wiped."),
+                              vol->name);
+        goto cleanup;
+    }
+
     if (!backend->deleteVol) {
         virStorageReportError(VIR_ERR_NO_SUPPORT,
                               "%s", _("storage pool does not support vol deletion"));
@@ -2112,25 +2085,11 @@ storageVolumeDelete(virStorageVolPtr obj,
     if (backend->deleteVol(obj->conn, pool, vol, flags) < 0)
         goto cleanup;
 
-    for (i = 0 ; i < pool->volumes.count ; i++) {
-        if (pool->volumes.objs[i] == vol) {
-            VIR_INFO("Deleting volume '%s' from storage pool '%s'",
-                     vol->name, pool->def->name);
-            virStorageVolDefFree(vol);
-            vol = NULL;
-
-            if (i < (pool->volumes.count - 1))
-                memmove(pool->volumes.objs + i, pool->volumes.objs + i + 1,
-                        sizeof(*(pool->volumes.objs)) * (pool->volumes.count - (i + 1)));
-
-            if (VIR_REALLOC_N(pool->volumes.objs, pool->volumes.count - 1) < 0) {
-                ; /* Failure to reduce memory allocation isn't fatal */
-            }
-            pool->volumes.count--;
-
-            break;
-        }
-    }
+    VIR_INFO("Deleting volume '%s' from storage pool '%s'",
+             vol->name, pool->def->name);
+    virStoragePoolObjRemoveVol(pool, vol);
+    virStorageVolDefFree(vol);
+    vol = NULL;
     ret = 0;
 
 cleanup:
@@ -2192,6 +2151,57 @@ cleanup:
     return ret;
 }
 
+static int
+storageVolumeGetWipeInfo(virStorageVolPtr obj,
+                         virStorageVolWipeInfoPtr info,
+                         unsigned int flags)
+{
+    virStorageDriverStatePtr driver = obj->conn->storagePrivateData;
+    virStoragePoolObjPtr pool;
+    virStorageVolDefPtr vol;
+    int ret = -1;
+
+    virCheckFlags(0, -1);
+
+    storageDriverLock(driver);
+    pool = virStoragePoolObjFindByName(&driver->pools, obj->pool);
+    storageDriverUnlock(driver);
+
+    if (!pool) {
+        virStorageReportError(VIR_ERR_NO_STORAGE_POOL,
+                              "%s", _("no storage pool with matching uuid"));
+        goto cleanup;
+    }
+
+    if (!virStoragePoolObjIsActive(pool)) {
+        virStorageReportError(VIR_ERR_OPERATION_INVALID,
+                              "%s", _("storage pool is not active"));
+        goto cleanup;
+    }
+
+    vol = virStorageVolDefFindByName(pool, obj->name);
+
+    if (!vol) {
+        virStorageReportError(VIR_ERR_NO_STORAGE_VOL,
+                              _("no storage vol with matching name '%s'"),
+                              obj->name);
+        goto cleanup;
+    }
+
+    memset(info, 0, sizeof(*info));
+    if (vol->wiping) {
+        info->active = 1;
+        info->processed = vol->wipeProcessed;
+        info->total = vol->wipeTotal;
+    }
+    ret = 0;
+
+cleanup:
+    if (pool)
+        virStoragePoolObjUnlock(pool);
+    return ret;
+}
+
 static char *
 storageVolumeGetXMLDesc(virStorageVolPtr obj,
                         unsigned int flags)
@@ -2327,6 +2337,7 @@ static virStorageDriver storageDriver = {
     .volGetXMLDesc = storageVolumeGetXMLDesc, /* 0.4.0 */
     .volGetPath = storageVolumeGetPath, /* 0.4.0 */
     .volResize = storageVolumeResize, /* 0.9.10 */
+    .volGetWipeInfo = storageVolumeGetWipeInfo, /* 0.9.12 */
 
     .poolIsActive = storagePoolIsActive, /* 0.7.3 */
     .poolIsPersistent = storagePoolIsPersistent, /* 0.7.3 */
@@ -2339,6 +2350,7 @@ static virStateDriver stateDriver = {
     .cleanup = storageDriverShutdown,
     .reload = storageDriverReload,
     .active = storageDriverActive,
+    .autoStart = storageDriverAutoStart,
 };
 
 int storageRegister(void) {
@@ -465,10 +465,13 @@ cleanup:
 }
 
 static void
-testDomainShutdownState(virDomainPtr domain,
+testDomainShutdownState(testConnPtr privconn,
+                        virDomainPtr domain,
                         virDomainObjPtr privdom,
                         virDomainShutoffReason reason)
 {
+    virDomainObjListSetID(&privconn->domains, privdom, -1);
+
     if (privdom->newDef) {
         virDomainDefFree(privdom->def);
         privdom->def = privdom->newDef;
@@ -494,7 +497,9 @@ testDomainStartState(virConnectPtr conn,
         goto cleanup;
 
     virDomainObjSetState(dom, VIR_DOMAIN_RUNNING, reason);
-    dom->def->id = privconn->nextDomID++;
+    if (virDomainObjListSetID(&privconn->domains, dom,
+                              privconn->nextDomID++) < 0)
+        goto cleanup;
 
     if (virDomainObjSetDefTransient(privconn->caps, dom, false) < 0) {
         goto cleanup;
@@ -503,7 +508,7 @@ testDomainStartState(virConnectPtr conn,
     ret = 0;
 cleanup:
     if (ret < 0)
-        testDomainShutdownState(NULL, dom, VIR_DOMAIN_SHUTOFF_FAILED);
+        testDomainShutdownState(privconn, NULL, dom, VIR_DOMAIN_SHUTOFF_FAILED);
     return ret;
 }
 
@@ -709,12 +714,6 @@ static int testOpenVolumesForPool(xmlDocPtr xml,
             }
         }
 
-        if (VIR_REALLOC_N(pool->volumes.objs,
-                          pool->volumes.count+1) < 0) {
-            virReportOOMError();
-            goto error;
-        }
-
         if (def->target.path == NULL) {
             if (virAsprintf(&def->target.path, "%s/%s",
                             pool->def->target.path,
@@ -732,11 +731,13 @@ static int testOpenVolumesForPool(xmlDocPtr xml,
             }
         }
 
+        if (virStoragePoolObjAddVol(pool, def) < 0)
+            goto error;
+
         pool->def->allocation += def->allocation;
         pool->def->available = (pool->def->capacity -
                                 pool->def->allocation);
 
-        pool->volumes.objs[pool->volumes.count++] = def;
         def = NULL;
     }
 
@@ -1441,7 +1442,7 @@ static int testDestroyDomain (virDomainPtr domain)
         goto cleanup;
     }
 
-    testDomainShutdownState(domain, privdom, VIR_DOMAIN_SHUTOFF_DESTROYED);
+    testDomainShutdownState(privconn, domain, privdom, VIR_DOMAIN_SHUTOFF_DESTROYED);
     event = virDomainEventNewFromObj(privdom,
                                      VIR_DOMAIN_EVENT_STOPPED,
                                      VIR_DOMAIN_EVENT_STOPPED_DESTROYED);
@@ -1571,7 +1572,7 @@ static int testShutdownDomainFlags(virDomainPtr domain,
         goto cleanup;
     }
 
-    testDomainShutdownState(domain, privdom, VIR_DOMAIN_SHUTOFF_SHUTDOWN);
+    testDomainShutdownState(privconn, domain, privdom, VIR_DOMAIN_SHUTOFF_SHUTDOWN);
     event = virDomainEventNewFromObj(privdom,
                                      VIR_DOMAIN_EVENT_STOPPED,
                                      VIR_DOMAIN_EVENT_STOPPED_SHUTDOWN);
@@ -1646,7 +1647,7 @@ static int testRebootDomain (virDomainPtr domain,
     }
 
     if (virDomainObjGetState(privdom, NULL) == VIR_DOMAIN_SHUTOFF) {
-        testDomainShutdownState(domain, privdom, VIR_DOMAIN_SHUTOFF_SHUTDOWN);
+        testDomainShutdownState(privconn, domain, privdom, VIR_DOMAIN_SHUTOFF_SHUTDOWN);
         event = virDomainEventNewFromObj(privdom,
                                          VIR_DOMAIN_EVENT_STOPPED,
                                          VIR_DOMAIN_EVENT_STOPPED_SHUTDOWN);
@@ -1810,7 +1811,7 @@ testDomainSaveFlags(virDomainPtr domain, const char *path,
     }
     fd = -1;
 
-    testDomainShutdownState(domain, privdom, VIR_DOMAIN_SHUTOFF_SAVED);
+    testDomainShutdownState(privconn, domain, privdom, VIR_DOMAIN_SHUTOFF_SAVED);
     event = virDomainEventNewFromObj(privdom,
                                      VIR_DOMAIN_EVENT_STOPPED,
                                      VIR_DOMAIN_EVENT_STOPPED_SAVED);
@@ -1995,7 +1996,7 @@ static int testDomainCoreDump(virDomainPtr domain,
     }
 
     if (flags & VIR_DUMP_CRASH) {
-        testDomainShutdownState(domain, privdom, VIR_DOMAIN_SHUTOFF_CRASHED);
+        testDomainShutdownState(privconn, domain, privdom, VIR_DOMAIN_SHUTOFF_CRASHED);
         event = virDomainEventNewFromObj(privdom,
                                          VIR_DOMAIN_EVENT_STOPPED,
                                          VIR_DOMAIN_EVENT_STOPPED_CRASHED);
@@ -4693,12 +4694,6 @@ testStorageVolumeCreateXML(virStoragePoolPtr pool,
         goto cleanup;
     }
 
-    if (VIR_REALLOC_N(privpool->volumes.objs,
-                      privpool->volumes.count+1) < 0) {
-        virReportOOMError();
-        goto cleanup;
-    }
-
     if (virAsprintf(&privvol->target.path, "%s/%s",
                     privpool->def->target.path,
                     privvol->name) == -1) {
@@ -4712,12 +4707,13 @@ testStorageVolumeCreateXML(virStoragePoolPtr pool,
         goto cleanup;
     }
 
+    if (virStoragePoolObjAddVol(privpool, privvol) < 0)
+        goto cleanup;
+
     privpool->def->allocation += privvol->allocation;
     privpool->def->available = (privpool->def->capacity -
                                 privpool->def->allocation);
 
-    privpool->volumes.objs[privpool->volumes.count++] = privvol;
-
     ret = virGetStorageVol(pool->conn, privpool->def->name,
                            privvol->name, privvol->key);
     privvol = NULL;
@@ -4787,12 +4783,6 @@ testStorageVolumeCreateXMLFrom(virStoragePoolPtr pool,
     privpool->def->available = (privpool->def->capacity -
                                 privpool->def->allocation);
 
-    if (VIR_REALLOC_N(privpool->volumes.objs,
-                      privpool->volumes.count+1) < 0) {
-        virReportOOMError();
-        goto cleanup;
-    }
-
     if (virAsprintf(&privvol->target.path, "%s/%s",
                     privpool->def->target.path,
                     privvol->name) == -1) {
@@ -4806,12 +4796,13 @@ testStorageVolumeCreateXMLFrom(virStoragePoolPtr pool,
         goto cleanup;
     }
 
+    if (virStoragePoolObjAddVol(privpool, privvol) < 0)
+        goto cleanup;
+
     privpool->def->allocation += privvol->allocation;
     privpool->def->available = (privpool->def->capacity -
                                 privpool->def->allocation);
 
-    privpool->volumes.objs[privpool->volumes.count++] = privvol;
-
     ret = virGetStorageVol(pool->conn, privpool->def->name,
                            privvol->name, privvol->key);
     privvol = NULL;
@@ -4830,7 +4821,6 @@ testStorageVolumeDelete(virStorageVolPtr vol,
     testConnPtr privconn = vol->conn->privateData;
     virStoragePoolObjPtr privpool;
     virStorageVolDefPtr privvol;
-    int i;
     int ret = -1;
 
     virCheckFlags(0, -1);
@@ -4866,25 +4856,8 @@ testStorageVolumeDelete(virStorageVolPtr vol,
     privpool->def->available = (privpool->def->capacity -
                                 privpool->def->allocation);
 
-    for (i = 0 ; i < privpool->volumes.count ; i++) {
-        if (privpool->volumes.objs[i] == privvol) {
-            virStorageVolDefFree(privvol);
-
-            if (i < (privpool->volumes.count - 1))
-                memmove(privpool->volumes.objs + i,
-                        privpool->volumes.objs + i + 1,
-                        sizeof(*(privpool->volumes.objs)) *
-                                (privpool->volumes.count - (i + 1)));
-
-            if (VIR_REALLOC_N(privpool->volumes.objs,
-                              privpool->volumes.count - 1) < 0) {
-                ; /* Failure to reduce memory allocation isn't fatal */
-            }
-            privpool->volumes.count--;
-
-            break;
-        }
-    }
+    virStoragePoolObjRemoveVol(privpool, privvol);
+    virStorageVolDefFree(privvol);
     ret = 0;
 
 cleanup:
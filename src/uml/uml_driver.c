@@ -63,6 +63,7 @@
 #include "configmake.h"
 #include "virnetdevtap.h"
 #include "virnodesuspend.h"
+#include "virprocstat.h"
 #include "viruri.h"
 
 #define VIR_FROM_THIS VIR_FROM_UML
@@ -337,12 +338,13 @@ reread:
                 continue;
             }
 
-            if (umlReadPidFile(driver, dom) < 0) {
+            if (umlReadPidFile(driver, dom) < 0 ||
+                virDomainObjListSetID(&driver->domains, dom,
+                                      driver->nextvmid++) < 0) {
                 virDomainObjUnlock(dom);
                 continue;
             }
 
-            dom->def->id = driver->nextvmid++;
             virDomainObjSetState(dom, VIR_DOMAIN_RUNNING,
                                  VIR_DOMAIN_RUNNING_BOOTED);
 
@@ -501,8 +503,6 @@ umlStartup(int privileged)
 
     umlDriverUnlock(uml_driver);
 
-    umlAutostartConfigs(uml_driver);
-
     VIR_FREE(userdir);
 
     return 0;
@@ -518,6 +518,13 @@ error:
     return -1;
 }
 
+static void
+umlAutoStart(void)
+{
+    if (uml_driver)
+        umlAutostartConfigs(uml_driver);
+}
+
 static void umlNotifyLoadDomain(virDomainObjPtr vm, int newVM, void *opaque)
 {
     struct uml_driver *driver = opaque;
@@ -1111,7 +1118,7 @@ static void umlShutdownVMDaemon(struct uml_driver *driver,
     }
 
     vm->pid = -1;
-    vm->def->id = -1;
+    virDomainObjListSetID(&driver->domains, vm, -1);
     virDomainObjSetState(vm, VIR_DOMAIN_SHUTOFF, reason);
 
     virDomainConfVMNWFilterTeardown(vm);
@@ -1239,39 +1246,27 @@ static char *umlGetCapabilities(virConnectPtr conn) {
 
 static int umlGetProcessInfo(unsigned long long *cpuTime, pid_t pid)
 {
-    char *proc;
-    FILE *pidinfo;
-    unsigned long long usertime, systime;
+    virProcStat info;
 
-    if (virAsprintf(&proc, "/proc/%lld/stat", (long long) pid) < 0) {
-        return -1;
-    }
+    if (virProcStatRead(pid, 0, &info) < 0) {
+        if (errno == EINVAL) {
+            umlDebug("not enough arg");
+            return -1;
+        }
 
-    if (!(pidinfo = fopen(proc, "r"))) {
         /* VM probably shut down, so fake 0 */
         *cpuTime = 0;
-        VIR_FREE(proc);
         return 0;
     }
 
-    VIR_FREE(proc);
-
-    if (fscanf(pidinfo, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &usertime, &systime) != 2) {
-        umlDebug("not enough arg");
-        VIR_FORCE_FCLOSE(pidinfo);
-        return -1;
-    }
-
     /* We got jiffies
      * We want nanoseconds
      * _SC_CLK_TCK is jiffies per second
      * So calulate thus....
      */
-    *cpuTime = 1000ull * 1000ull * 1000ull * (usertime + systime) / (unsigned long long)sysconf(_SC_CLK_TCK);
-
-    umlDebug("Got %llu %llu %llu", usertime, systime, *cpuTime);
+    *cpuTime = 1000ull * 1000ull * 1000ull * (info.utime + info.stime) / (unsigned long long)sysconf(_SC_CLK_TCK);
 
-    VIR_FORCE_FCLOSE(pidinfo);
+    umlDebug("Got %llu %llu %llu", info.utime, info.stime, *cpuTime);
 
     return 0;
 }
@@ -2598,6 +2593,7 @@ static virStateDriver umlStateDriver = {
     .cleanup = umlShutdown,
     .reload = umlReload,
     .active = umlActive,
+    .autoStart = umlAutoStart,
 };
 
 static void
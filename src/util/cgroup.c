@@ -17,6 +17,7 @@
 # include <mntent.h>
 #endif
 #include <fcntl.h>
+#include <poll.h>
 #include <string.h>
 #include <errno.h>
 #include <stdlib.h>
@@ -34,6 +35,8 @@
 #include "virfile.h"
 #include "virhash.h"
 #include "virhashcode.h"
+#include "threads.h"
+#include "viratomic.h"
 
 #define CGROUP_MAX_VAL 512
 
@@ -47,10 +50,45 @@ struct virCgroupController {
     char *placement;
 };
 
+/* Statistics files which are read over and over again, by every
+ * monitoring call of every domain */
+enum {
+    VIR_CGROUP_STAT_CPUACCT_USAGE,
+    VIR_CGROUP_STAT_CPUACCT_USAGE_PERCPU,
+    VIR_CGROUP_STAT_CPUACCT_STAT,
+    VIR_CGROUP_STAT_MEMORY_USAGE,
+
+    VIR_CGROUP_STAT_LAST
+};
+
+static const struct {
+    int controller;
+    const char *key;
+} virCgroupStatFiles[VIR_CGROUP_STAT_LAST] = {
+    { VIR_CGROUP_CONTROLLER_CPUACCT, "cpuacct.usage" },
+    { VIR_CGROUP_CONTROLLER_CPUACCT, "cpuacct.usage_percpu" },
+    { VIR_CGROUP_CONTROLLER_CPUACCT, "cpuacct.stat" },
+    { VIR_CGROUP_CONTROLLER_MEMORY, "memory.usage_in_bytes" },
+};
+
+/* Descriptors of statistics files kept open by all groups together,
+ * well below the default limit of 1024 open files of the daemon.
+ * Past it, statistics files are opened for every read again */
+#define VIR_CGROUP_STAT_FDS_MAX 256
+
+static virAtomicInt virCgroupStatFDs;
+static virOnceControl virCgroupStatFDsOnce = VIR_ONCE_CONTROL_INITIALIZER;
+static bool virCgroupStatFDsReady;
+
 struct virCgroup {
     char *path;
 
     struct virCgroupController controllers[VIR_CGROUP_CONTROLLER_LAST];
+
+    /* Statistics files opened on their first read and kept open until
+     * the group is freed, as long as VIR_CGROUP_STAT_FDS_MAX allows,
+     * so a group is not to be read from several threads at once */
+    int statfds[VIR_CGROUP_STAT_LAST];
 };
 
 typedef enum {
@@ -63,6 +101,38 @@ typedef enum {
                                * cpuacct and cpuset if possible. */
 } virCgroupFlags;
 
+static void virCgroupStatFDsInit(void)
+{
+    if (virAtomicIntInit(&virCgroupStatFDs) < 0)
+        return;
+
+    virCgroupStatFDsReady = true;
+}
+
+/* Tells whether one more statistics file may be kept open */
+static bool virCgroupStatFDReserve(void)
+{
+    if (virOnce(&virCgroupStatFDsOnce, virCgroupStatFDsInit) < 0 ||
+        !virCgroupStatFDsReady)
+        return false;
+
+    if (virAtomicIntInc(&virCgroupStatFDs) > VIR_CGROUP_STAT_FDS_MAX) {
+        virAtomicIntDec(&virCgroupStatFDs);
+        return false;
+    }
+
+    return true;
+}
+
+static void virCgroupStatFDClose(int *fd)
+{
+    if (*fd < 0)
+        return;
+
+    VIR_FORCE_CLOSE(*fd);
+    virAtomicIntDec(&virCgroupStatFDs);
+}
+
 /**
  * virCgroupFree:
  *
@@ -80,6 +150,9 @@ void virCgroupFree(virCgroupPtr *group)
         VIR_FREE((*group)->controllers[i].placement);
     }
 
+    for (i = 0 ; i < VIR_CGROUP_STAT_LAST ; i++)
+        virCgroupStatFDClose(&(*group)->statfds[i]);
+
     VIR_FREE((*group)->path);
     VIR_FREE(*group);
 }
@@ -219,7 +292,7 @@ no_memory:
 
 }
 
-static int virCgroupDetect(virCgroupPtr group)
+static int virCgroupDetectAll(virCgroupPtr group)
 {
     int any = 0;
     int rc;
@@ -267,6 +340,97 @@ static int virCgroupDetect(virCgroupPtr group)
 
     return rc;
 }
+
+
+/*
+ * Controllers are mounted once when the host boots, so where they are
+ * and where this process is placed in them is only detected again
+ * after the mount table changed, instead of for every new group.
+ * As this takes a lock, groups are not to be looked up in a child
+ * forked by a threaded process before it execs.
+ */
+static virMutex virCgroupMountsLock;
+static virOnceControl virCgroupMountsOnce = VIR_ONCE_CONTROL_INITIALIZER;
+static bool virCgroupMountsLockReady;
+static int virCgroupMountsFD = -1;
+static bool virCgroupMountsDetected;
+static int virCgroupMountsResult;
+static struct virCgroup virCgroupMounts;
+
+static void virCgroupMountsInit(void)
+{
+    if (virMutexInit(&virCgroupMountsLock) < 0)
+        return;
+
+    virCgroupMountsLockReady = true;
+}
+
+/*
+ * The kernel reports changes of the mount table as an exceptional
+ * condition on any open /proc/self/mounts, until it is polled.
+ */
+static bool virCgroupMountsChanged(void)
+{
+    struct pollfd fd;
+
+    if (virCgroupMountsFD < 0 &&
+        (virCgroupMountsFD = open("/proc/self/mounts",
+                                  O_RDONLY | O_CLOEXEC)) < 0)
+        return true;
+
+    fd.fd = virCgroupMountsFD;
+    fd.events = POLLPRI;
+    fd.revents = 0;
+
+    if (poll(&fd, 1, 0) < 0)
+        return true;
+
+    return (fd.revents & (POLLPRI | POLLERR)) != 0;
+}
+
+static int virCgroupDetect(virCgroupPtr group)
+{
+    bool changed;
+    int rc;
+    int i;
+
+    if (virOnce(&virCgroupMountsOnce, virCgroupMountsInit) < 0 ||
+        !virCgroupMountsLockReady)
+        return virCgroupDetectAll(group);
+
+    virMutexLock(&virCgroupMountsLock);
+
+    changed = virCgroupMountsChanged();
+    if (changed || !virCgroupMountsDetected) {
+        for (i = 0 ; i < VIR_CGROUP_CONTROLLER_LAST ; i++) {
+            VIR_FREE(virCgroupMounts.controllers[i].mountPoint);
+            VIR_FREE(virCgroupMounts.controllers[i].placement);
+        }
+
+        /* The path is only used in error messages */
+        virCgroupMounts.path = group->path;
+        virCgroupMountsResult = virCgroupDetectAll(&virCgroupMounts);
+        virCgroupMounts.path = NULL;
+        virCgroupMountsDetected = true;
+    }
+
+    rc = virCgroupMountsResult;
+    for (i = 0 ; rc == 0 && i < VIR_CGROUP_CONTROLLER_LAST ; i++) {
+        struct virCgroupController *mounted = &virCgroupMounts.controllers[i];
+
+        if ((mounted->mountPoint &&
+             !(group->controllers[i].mountPoint =
+               strdup(mounted->mountPoint))) ||
+            (mounted->placement &&
+             !(group->controllers[i].placement =
+               strdup(mounted->placement))))
+            rc = -ENOMEM;
+    }
+
+    virMutexUnlock(&virCgroupMountsLock);
+
+    return rc;
+}
 #endif
 
 
@@ -331,6 +495,84 @@ static int virCgroupSetValueStr(virCgroupPtr group,
     return rc;
 }
 
+/*
+ * Reads a statistics file through the descriptor kept open for it,
+ * opening it again once in case it went stale.
+ */
+static int virCgroupGetStatStr(virCgroupPtr group,
+                               int stat,
+                               char **value)
+{
+    int *kept = &group->statfds[stat];
+    int fd;
+    char *keypath = NULL;
+    char *buf = NULL;
+    ssize_t got = -1;
+    int attempt;
+    int rc;
+
+    rc = virCgroupPathOfController(group,
+                                   virCgroupStatFiles[stat].controller,
+                                   virCgroupStatFiles[stat].key,
+                                   &keypath);
+    if (rc != 0) {
+        VIR_DEBUG("No path of %s, %s",
+                  group->path, virCgroupStatFiles[stat].key);
+        return rc;
+    }
+
+    /* Room to tell a file too large to read from one of 1024 bytes */
+    if (VIR_ALLOC_N(buf, 1024 + 2) < 0) {
+        rc = -ENOMEM;
+        goto cleanup;
+    }
+
+    for (attempt = 0; got < 0 && attempt < 2; attempt++) {
+        if (attempt)
+            virCgroupStatFDClose(kept);
+
+        if ((fd = *kept) < 0) {
+            if ((fd = open(keypath, O_RDONLY | O_CLOEXEC)) < 0)
+                break;
+            if (virCgroupStatFDReserve())
+                *kept = fd;
+        }
+
+        VIR_DEBUG("Get value %s", keypath);
+        got = pread(fd, buf, 1024 + 1, 0);
+
+        /* Too many files kept open by other groups already */
+        if (fd != *kept)
+            VIR_FORCE_CLOSE(fd);
+    }
+
+    if (got < 0) {
+        rc = -errno;
+        VIR_DEBUG("Failed to read %s: %m", keypath);
+        virCgroupStatFDClose(kept);
+        goto cleanup;
+    }
+    if (got > 1024) {
+        rc = -EFBIG;
+        VIR_DEBUG("Too much data in %s", keypath);
+        goto cleanup;
+    }
+
+    /* Terminated with '\n' has sometimes harmful effects to the caller */
+    if (got > 0 && buf[got - 1] == '\n')
+        got--;
+    buf[got] = '\0';
+
+    *value = buf;
+    buf = NULL;
+    rc = 0;
+
+cleanup:
+    VIR_FREE(keypath);
+    VIR_FREE(buf);
+    return rc;
+}
+
 static int virCgroupGetValueStr(virCgroupPtr group,
                                 int controller,
                                 const char *key,
@@ -338,9 +580,16 @@ static int virCgroupGetValueStr(virCgroupPtr group,
 {
     int rc;
     char *keypath = NULL;
+    int i;
 
     *value = NULL;
 
+    for (i = 0 ; i < VIR_CGROUP_STAT_LAST ; i++) {
+        if (controller == virCgroupStatFiles[i].controller &&
+            STREQ(key, virCgroupStatFiles[i].key))
+            return virCgroupGetStatStr(group, i, value);
+    }
+
     rc = virCgroupPathOfController(group, controller, key, &keypath);
     if (rc != 0) {
         VIR_DEBUG("No path of %s, %s", group->path, key);
@@ -599,6 +848,7 @@ static int virCgroupNew(const char *path,
 {
     int rc = 0;
     char *typpath = NULL;
+    int i;
 
     VIR_DEBUG("New group %s", path);
     *group = NULL;
@@ -608,6 +858,9 @@ static int virCgroupNew(const char *path,
         goto err;
     }
 
+    for (i = 0 ; i < VIR_CGROUP_STAT_LAST ; i++)
+        (*group)->statfds[i] = -1;
+
     if (!((*group)->path = strdup(path))) {
         rc = -ENOMEM;
         goto err;
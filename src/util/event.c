@@ -25,6 +25,7 @@
 
 #include "event.h"
 #include "event_poll.h"
+#include "event_epoll.h"
 #include "logging.h"
 #include "virterror_internal.h"
 
@@ -37,6 +38,9 @@ static virEventAddTimeoutFunc addTimeoutImpl = NULL;
 static virEventUpdateTimeoutFunc updateTimeoutImpl = NULL;
 static virEventRemoveTimeoutFunc removeTimeoutImpl = NULL;
 
+/* Whether the default implementation is backed by epoll() */
+static bool defaultImplEpoll = false;
+
 /**
  * virEventAddHandle: register a callback for monitoring file handle events
  *
@@ -188,7 +192,8 @@ void virEventRegisterImpl(virEventAddHandleFunc addHandle,
  * virEventRegisterDefaultImpl:
  *
  * Registers a default event implementation based on the
- * poll() system call. This is a generic implementation
+ * epoll() system call where available, falling back to the
+ * poll() system call otherwise. This is a generic implementation
  * that can be used by any client application which does
  * not have a need to integrate with an external event
  * loop impl.
@@ -205,6 +210,26 @@ int virEventRegisterDefaultImpl(void)
 
     virResetLastError();
 
+#if WITH_EPOLL
+    if (virEventEpollInit() == 0) {
+        defaultImplEpoll = true;
+        virEventRegisterImpl(
+            virEventEpollAddHandle,
+            virEventEpollUpdateHandle,
+            virEventEpollRemoveHandle,
+            virEventEpollAddTimeout,
+            virEventEpollUpdateTimeout,
+            virEventEpollRemoveTimeout
+            );
+        return 0;
+    }
+
+    /* epoll may be unsupported by the running kernel even
+     * though it was available at build time */
+    VIR_WARN("Unable to initialize epoll event loop, falling back to poll");
+    virResetLastError();
+#endif
+
     if (virEventPollInit() < 0) {
         virDispatchError(NULL);
         return -1;
@@ -244,7 +269,9 @@ int virEventRunDefaultImpl(void)
     VIR_DEBUG("running default event implementation");
     virResetLastError();
 
-    if (virEventPollRunOnce() < 0) {
+    if ((defaultImplEpoll ?
+         virEventEpollRunOnce() :
+         virEventPollRunOnce()) < 0) {
         virDispatchError(NULL);
         return -1;
     }
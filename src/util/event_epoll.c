@@ -0,0 +1,1149 @@
+/*
+ * event_epoll.c: epoll() based event loop for monitoring file handles
+ *
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <limits.h>
+#if WITH_EPOLL
+# include <sys/epoll.h>
+#endif
+
+#include "threads.h"
+#include "logging.h"
+#include "event_epoll.h"
+#include "memory.h"
+#include "util.h"
+#include "virfile.h"
+#include "virhash.h"
+#include "virhashcode.h"
+#include "ignore-value.h"
+#include "virterror_internal.h"
+#include "virtime.h"
+
+#define EVENT_DEBUG(fmt, ...) VIR_DEBUG(fmt, __VA_ARGS__)
+
+#define VIR_FROM_THIS VIR_FROM_EVENT
+
+#define virEventError(code, ...)                                    \
+    virReportErrorHelper(VIR_FROM_EVENT, code, __FILE__,            \
+                         __FUNCTION__, __LINE__, __VA_ARGS__)
+
+#if WITH_EPOLL
+
+static int virEventEpollInterruptLocked(void);
+
+typedef struct virEventEpollFD virEventEpollFD;
+typedef virEventEpollFD *virEventEpollFDPtr;
+
+typedef struct virEventEpollHandle virEventEpollHandle;
+typedef virEventEpollHandle *virEventEpollHandlePtr;
+
+typedef struct virEventEpollTimeout virEventEpollTimeout;
+typedef virEventEpollTimeout *virEventEpollTimeoutPtr;
+
+/* State for a single file handle being monitored */
+struct virEventEpollHandle {
+    int watch;
+    int fd;
+    int events; /* EPOLLnnn bitset */
+    virEventHandleCallback cb;
+    virFreeCallback ff;
+    void *opaque;
+    bool deleted;
+
+    /* Next watch registered against the same file descriptor */
+    virEventEpollHandlePtr next;
+};
+
+/* State for a file descriptor registered with epoll. Since epoll
+ * only allows one registration per file descriptor, all watches
+ * sharing the same fd hang off a single record, and the kernel is
+ * given the union of their event masks */
+struct virEventEpollFD {
+    int fd;
+    int events; /* EPOLLnnn bitset currently registered with the kernel */
+    bool alwaysReady; /* epoll refused the fd, see virEventEpollSyncFDLocked */
+    virEventEpollHandlePtr handles;
+};
+
+/* State for a single timer being generated */
+struct virEventEpollTimeout {
+    int timer;
+    int frequency;
+    unsigned long long expiresAt;
+    virEventTimeoutCallback cb;
+    virFreeCallback ff;
+    void *opaque;
+    bool deleted;
+
+    /* Position in the expiry heap, or -1 if the timer is not armed */
+    ssize_t heapIndex;
+};
+
+/* Allocate extra slots for the various arrays in this multiple */
+# define EVENT_ALLOC_EXTENT 10
+
+/* Maximum number of ready file descriptors collected per iteration.
+ * Anything beyond this stays pending and is reported on the next one */
+# define EVENT_EPOLL_MAX_EVENTS 128
+
+/* State for the main event loop */
+struct virEventEpollLoop {
+    virMutex lock;
+    int running;
+    virThread leader;
+    int wakeupfd[2];
+    int epollfd;
+
+    /* watch -> virEventEpollHandlePtr */
+    virHashTablePtr handles;
+    /* fd -> virEventEpollFDPtr, indexed directly by fd number */
+    size_t fdsAlloc;
+    virEventEpollFDPtr *fds;
+    /* Always ready fds with events wanted */
+    size_t alwaysReadyCount;
+
+    /* timer -> virEventEpollTimeoutPtr */
+    virHashTablePtr timeouts;
+    /* Armed timers, as a binary min-heap ordered by expiry */
+    size_t heapCount;
+    size_t heapAlloc;
+    virEventEpollTimeoutPtr *heap;
+    /* Scratch space used while dispatching expired timers */
+    size_t expiredAlloc;
+    virEventEpollTimeoutPtr *expired;
+
+    /* Entries marked as deleted, waiting to be purged */
+    size_t deletedHandlesCount;
+    size_t deletedHandlesAlloc;
+    virEventEpollHandlePtr *deletedHandles;
+    size_t deletedTimeoutsCount;
+    size_t deletedTimeoutsAlloc;
+    virEventEpollTimeoutPtr *deletedTimeouts;
+};
+
+/* Only have one event loop */
+static struct virEventEpollLoop eventLoop = { .epollfd = -1 };
+
+/* Unique ID for the next FD watch to be registered */
+static int nextWatch = 1;
+
+/* Unique ID for the next timer to be registered */
+static int nextTimer = 1;
+
+
+static uint32_t virEventEpollIDCode(const void *name, uint32_t seed)
+{
+    int id = (int)(intptr_t)name;
+    return virHashCodeGen(&id, sizeof(id), seed);
+}
+static bool virEventEpollIDEqual(const void *namea, const void *nameb)
+{
+    return namea == nameb;
+}
+static void *virEventEpollIDCopy(const void *name)
+{
+    return (void *)name;
+}
+
+static virHashTablePtr virEventEpollIDTableNew(void)
+{
+    return virHashCreateFull(EVENT_ALLOC_EXTENT * 10,
+                             NULL,
+                             virEventEpollIDCode,
+                             virEventEpollIDEqual,
+                             virEventEpollIDCopy,
+                             NULL);
+}
+
+
+static int
+virEventEpollToNativeEvents(int events)
+{
+    int ret = 0;
+    if (events & VIR_EVENT_HANDLE_READABLE)
+        ret |= EPOLLIN;
+    if (events & VIR_EVENT_HANDLE_WRITABLE)
+        ret |= EPOLLOUT;
+    if (events & VIR_EVENT_HANDLE_ERROR)
+        ret |= EPOLLERR;
+    if (events & VIR_EVENT_HANDLE_HANGUP)
+        ret |= EPOLLHUP;
+    return ret;
+}
+
+static int
+virEventEpollFromNativeEvents(int events)
+{
+    int ret = 0;
+    if (events & EPOLLIN)
+        ret |= VIR_EVENT_HANDLE_READABLE;
+    if (events & EPOLLOUT)
+        ret |= VIR_EVENT_HANDLE_WRITABLE;
+    if (events & EPOLLERR)
+        ret |= VIR_EVENT_HANDLE_ERROR;
+    if (events & EPOLLHUP)
+        ret |= VIR_EVENT_HANDLE_HANGUP;
+    return ret;
+}
+
+
+/*
+ * Push the union of the event masks of all live watches on
+ * @info into the kernel, adding, modifying or removing the
+ * epoll registration as required.
+ *
+ * returns 0 on success, -1 with errno set on failure
+ */
+static int virEventEpollSyncFDLocked(virEventEpollFDPtr info)
+{
+    virEventEpollHandlePtr handle;
+    struct epoll_event ev;
+    int events = 0;
+    int op;
+
+    for (handle = info->handles ; handle ; handle = handle->next) {
+        if (!handle->deleted)
+            events |= handle->events;
+    }
+
+    if (events == info->events)
+        return 0;
+
+    if (info->alwaysReady) {
+        if (!events != !info->events)
+            eventLoop.alwaysReadyCount += events ? 1 : -1;
+        info->events = events;
+        return 0;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = events;
+    ev.data.fd = info->fd;
+
+    if (events == 0)
+        op = EPOLL_CTL_DEL;
+    else if (info->events == 0)
+        op = EPOLL_CTL_ADD;
+    else
+        op = EPOLL_CTL_MOD;
+
+    EVENT_DEBUG("Sync fd=%d op=%d events=%d old=%d",
+                info->fd, op, events, info->events);
+
+    if (epoll_ctl(eventLoop.epollfd, op, info->fd, &ev) < 0) {
+        /* The kernel drops registrations by itself when the last
+         * reference to a file is closed, and the fd number may since
+         * have been reused, so fix up the operation as needed. */
+        if (op == EPOLL_CTL_DEL) {
+            EVENT_DEBUG("Ignoring failure to unregister fd=%d: %d",
+                        info->fd, errno);
+        } else if (op == EPOLL_CTL_MOD && errno == ENOENT) {
+            if (epoll_ctl(eventLoop.epollfd, EPOLL_CTL_ADD, info->fd, &ev) < 0)
+                return -1;
+        } else if (op == EPOLL_CTL_ADD && errno == EEXIST) {
+            if (epoll_ctl(eventLoop.epollfd, EPOLL_CTL_MOD, info->fd, &ev) < 0)
+                return -1;
+        } else if (op == EPOLL_CTL_ADD && errno == EPERM) {
+            /* Regular files and some devices can't be watched with
+             * epoll. poll() always reports them as ready, and so does
+             * virEventEpollRunOnce, without asking the kernel */
+            EVENT_DEBUG("Treating fd=%d as always ready", info->fd);
+            info->alwaysReady = true;
+            eventLoop.alwaysReadyCount++;
+        } else {
+            return -1;
+        }
+    }
+
+    info->events = events;
+    return 0;
+}
+
+
+/*
+ * Register a callback for monitoring file handle events.
+ * NB, it *must* be safe to call this from within a callback
+ * For this reason new watches are only ever prepended to
+ * the per-fd list.
+ */
+int virEventEpollAddHandle(int fd, int events,
+                           virEventHandleCallback cb,
+                           void *opaque,
+                           virFreeCallback ff)
+{
+    virEventEpollHandlePtr handle = NULL;
+    virEventEpollFDPtr info;
+    bool newInfo = false;
+    int watch;
+
+    if (fd < 0) {
+        virEventError(VIR_ERR_INTERNAL_ERROR,
+                      _("Invalid file handle %d"), fd);
+        return -1;
+    }
+
+    virMutexLock(&eventLoop.lock);
+    if (fd >= eventLoop.fdsAlloc &&
+        VIR_RESIZE_N(eventLoop.fds, eventLoop.fdsAlloc,
+                     eventLoop.fdsAlloc, fd + 1 - eventLoop.fdsAlloc) < 0)
+        goto no_memory;
+
+    if (!(info = eventLoop.fds[fd])) {
+        if (VIR_ALLOC(info) < 0)
+            goto no_memory;
+        info->fd = fd;
+        eventLoop.fds[fd] = info;
+        newInfo = true;
+    }
+
+    if (VIR_ALLOC(handle) < 0)
+        goto no_memory;
+
+    watch = nextWatch++;
+
+    handle->watch = watch;
+    handle->fd = fd;
+    handle->events = virEventEpollToNativeEvents(events);
+    handle->cb = cb;
+    handle->ff = ff;
+    handle->opaque = opaque;
+
+    if (virHashAddEntry(eventLoop.handles, (void *)(intptr_t)watch,
+                        handle) < 0)
+        goto error;
+
+    handle->next = info->handles;
+    info->handles = handle;
+
+    if (virEventEpollSyncFDLocked(info) < 0) {
+        virReportSystemError(errno,
+                             _("Unable to watch file handle %d"), fd);
+        info->handles = handle->next;
+        virHashRemoveEntry(eventLoop.handles, (void *)(intptr_t)watch);
+        goto error;
+    }
+
+    virEventEpollInterruptLocked();
+    virMutexUnlock(&eventLoop.lock);
+
+    return watch;
+
+no_memory:
+    virReportOOMError();
+error:
+    if (newInfo) {
+        eventLoop.fds[fd] = NULL;
+        VIR_FREE(info);
+    }
+    VIR_FREE(handle);
+    virMutexUnlock(&eventLoop.lock);
+    return -1;
+}
+
+void virEventEpollUpdateHandle(int watch, int events)
+{
+    virEventEpollHandlePtr handle;
+
+    if (watch <= 0) {
+        VIR_WARN("Ignoring invalid update watch %d", watch);
+        return;
+    }
+
+    virMutexLock(&eventLoop.lock);
+    if ((handle = virHashLookup(eventLoop.handles,
+                                (void *)(intptr_t)watch))) {
+        handle->events = virEventEpollToNativeEvents(events);
+        if (virEventEpollSyncFDLocked(eventLoop.fds[handle->fd]) < 0) {
+            char ebuf[1024];
+            VIR_WARN("Unable to update events for watch %d fd %d: %s",
+                     watch, handle->fd,
+                     virStrerror(errno, ebuf, sizeof(ebuf)));
+        }
+        virEventEpollInterruptLocked();
+    }
+    virMutexUnlock(&eventLoop.lock);
+}
+
+/*
+ * Unregister a callback from a file handle
+ * NB, it *must* be safe to call this from within a callback
+ * For this reason we only ever set a flag on the watch and
+ * queue it for deletion. Actual deletion will be done out-of-band
+ */
+int virEventEpollRemoveHandle(int watch)
+{
+    virEventEpollHandlePtr handle;
+
+    if (watch <= 0) {
+        VIR_WARN("Ignoring invalid remove watch %d", watch);
+        return -1;
+    }
+
+    virMutexLock(&eventLoop.lock);
+    if (!(handle = virHashSteal(eventLoop.handles,
+                                (void *)(intptr_t)watch))) {
+        virMutexUnlock(&eventLoop.lock);
+        return -1;
+    }
+
+    EVENT_DEBUG("mark delete %d %d", watch, handle->fd);
+    handle->deleted = true;
+    ignore_value(virEventEpollSyncFDLocked(eventLoop.fds[handle->fd]));
+
+    if (eventLoop.deletedHandlesCount == eventLoop.deletedHandlesAlloc &&
+        VIR_RESIZE_N(eventLoop.deletedHandles, eventLoop.deletedHandlesAlloc,
+                     eventLoop.deletedHandlesCount, EVENT_ALLOC_EXTENT) < 0) {
+        /* Leak the watch rather than risk freeing it under
+         * the feet of a dispatch in progress */
+        VIR_WARN("Unable to queue watch %d for deletion", watch);
+    } else {
+        eventLoop.deletedHandles[eventLoop.deletedHandlesCount++] = handle;
+    }
+
+    virEventEpollInterruptLocked();
+    virMutexUnlock(&eventLoop.lock);
+    return 0;
+}
+
+
+/*
+ * Helpers for maintaining the heap of armed timers. Timers
+ * expiring at the same time are ordered by their ID, so that
+ * they fire in registration order like with the poll() loop.
+ */
+static bool
+virEventEpollTimeoutBefore(virEventEpollTimeoutPtr a,
+                           virEventEpollTimeoutPtr b)
+{
+    if (a->expiresAt != b->expiresAt)
+        return a->expiresAt < b->expiresAt;
+    return a->timer < b->timer;
+}
+
+static void
+virEventEpollHeapSet(size_t i, virEventEpollTimeoutPtr t)
+{
+    eventLoop.heap[i] = t;
+    t->heapIndex = i;
+}
+
+static void
+virEventEpollHeapSiftUp(size_t i)
+{
+    virEventEpollTimeoutPtr t = eventLoop.heap[i];
+
+    while (i > 0) {
+        size_t parent = (i - 1) / 2;
+        if (!virEventEpollTimeoutBefore(t, eventLoop.heap[parent]))
+            break;
+        virEventEpollHeapSet(i, eventLoop.heap[parent]);
+        i = parent;
+    }
+    virEventEpollHeapSet(i, t);
+}
+
+static void
+virEventEpollHeapSiftDown(size_t i)
+{
+    virEventEpollTimeoutPtr t = eventLoop.heap[i];
+
+    for (;;) {
+        size_t child = 2 * i + 1;
+        if (child >= eventLoop.heapCount)
+            break;
+        if (child + 1 < eventLoop.heapCount &&
+            virEventEpollTimeoutBefore(eventLoop.heap[child + 1],
+                                       eventLoop.heap[child]))
+            child++;
+        if (!virEventEpollTimeoutBefore(eventLoop.heap[child], t))
+            break;
+        virEventEpollHeapSet(i, eventLoop.heap[child]);
+        i = child;
+    }
+    virEventEpollHeapSet(i, t);
+}
+
+static int
+virEventEpollHeapPush(virEventEpollTimeoutPtr t)
+{
+    if (eventLoop.heapCount == eventLoop.heapAlloc &&
+        VIR_RESIZE_N(eventLoop.heap, eventLoop.heapAlloc,
+                     eventLoop.heapCount, EVENT_ALLOC_EXTENT) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    virEventEpollHeapSet(eventLoop.heapCount++, t);
+    virEventEpollHeapSiftUp(t->heapIndex);
+    return 0;
+}
+
+static void
+virEventEpollHeapRemove(virEventEpollTimeoutPtr t)
+{
+    virEventEpollTimeoutPtr last;
+    size_t i;
+
+    if (t->heapIndex < 0)
+        return;
+
+    i = t->heapIndex;
+    t->heapIndex = -1;
+    last = eventLoop.heap[--eventLoop.heapCount];
+    if (i == eventLoop.heapCount)
+        return;
+
+    virEventEpollHeapSet(i, last);
+    virEventEpollHeapSiftUp(i);
+    virEventEpollHeapSiftDown(last->heapIndex);
+}
+
+/*
+ * (Re)arm, re-position or disarm @t according to its
+ * current frequency and expiry time
+ */
+static int
+virEventEpollHeapUpdate(virEventEpollTimeoutPtr t)
+{
+    if (t->frequency < 0 || t->deleted) {
+        virEventEpollHeapRemove(t);
+        return 0;
+    }
+
+    if (t->heapIndex < 0)
+        return virEventEpollHeapPush(t);
+
+    virEventEpollHeapSiftUp(t->heapIndex);
+    virEventEpollHeapSiftDown(t->heapIndex);
+    return 0;
+}
+
+
+/*
+ * Register a callback for a timer event
+ * NB, it *must* be safe to call this from within a callback
+ */
+int virEventEpollAddTimeout(int frequency,
+                            virEventTimeoutCallback cb,
+                            void *opaque,
+                            virFreeCallback ff)
+{
+    virEventEpollTimeoutPtr t;
+    unsigned long long now;
+    int ret;
+
+    if (virTimeMillisNow(&now) < 0) {
+        return -1;
+    }
+
+    if (VIR_ALLOC(t) < 0) {
+        virReportOOMError();
+        return -1;
+    }
+
+    virMutexLock(&eventLoop.lock);
+    t->timer = nextTimer++;
+    t->frequency = frequency;
+    t->cb = cb;
+    t->ff = ff;
+    t->opaque = opaque;
+    t->heapIndex = -1;
+    t->expiresAt = frequency >= 0 ? frequency + now : 0;
+
+    if (virHashAddEntry(eventLoop.timeouts, (void *)(intptr_t)t->timer,
+                        t) < 0)
+        goto error;
+
+    if (virEventEpollHeapUpdate(t) < 0) {
+        virHashRemoveEntry(eventLoop.timeouts, (void *)(intptr_t)t->timer);
+        goto error;
+    }
+
+    ret = t->timer;
+    virEventEpollInterruptLocked();
+    virMutexUnlock(&eventLoop.lock);
+    return ret;
+
+error:
+    virMutexUnlock(&eventLoop.lock);
+    VIR_FREE(t);
+    return -1;
+}
+
+void virEventEpollUpdateTimeout(int timer, int frequency)
+{
+    virEventEpollTimeoutPtr t;
+    unsigned long long now;
+
+    if (timer <= 0) {
+        VIR_WARN("Ignoring invalid update timer %d", timer);
+        return;
+    }
+
+    if (virTimeMillisNow(&now) < 0) {
+        return;
+    }
+
+    virMutexLock(&eventLoop.lock);
+    if ((t = virHashLookup(eventLoop.timeouts, (void *)(intptr_t)timer))) {
+        t->frequency = frequency;
+        t->expiresAt = frequency >= 0 ? frequency + now : 0;
+        if (virEventEpollHeapUpdate(t) < 0)
+            VIR_WARN("Unable to re-arm timer %d", timer);
+        virEventEpollInterruptLocked();
+    }
+    virMutexUnlock(&eventLoop.lock);
+}
+
+/*
+ * Unregister a callback for a timer
+ * NB, it *must* be safe to call this from within a callback
+ * For this reason we only ever set a flag on the timer and
+ * queue it for deletion. Actual deletion will be done out-of-band
+ */
+int virEventEpollRemoveTimeout(int timer)
+{
+    virEventEpollTimeoutPtr t;
+
+    if (timer <= 0) {
+        VIR_WARN("Ignoring invalid remove timer %d", timer);
+        return -1;
+    }
+
+    virMutexLock(&eventLoop.lock);
+    if (!(t = virHashSteal(eventLoop.timeouts, (void *)(intptr_t)timer))) {
+        virMutexUnlock(&eventLoop.lock);
+        return -1;
+    }
+
+    t->deleted = true;
+    virEventEpollHeapRemove(t);
+
+    if (eventLoop.deletedTimeoutsCount == eventLoop.deletedTimeoutsAlloc &&
+        VIR_RESIZE_N(eventLoop.deletedTimeouts, eventLoop.deletedTimeoutsAlloc,
+                     eventLoop.deletedTimeoutsCount, EVENT_ALLOC_EXTENT) < 0) {
+        VIR_WARN("Unable to queue timer %d for deletion", timer);
+    } else {
+        eventLoop.deletedTimeouts[eventLoop.deletedTimeoutsCount++] = t;
+    }
+
+    virEventEpollInterruptLocked();
+    virMutexUnlock(&eventLoop.lock);
+    return 0;
+}
+
+/* Determine when the first armed timer will expire
+ * @timeout: filled with expiry time of soonest timer, or -1 if
+ *           no timeout is pending
+ * returns: 0 on success, -1 on error
+ */
+static int virEventEpollCalculateTimeout(int *timeout)
+{
+    unsigned long long then = 0;
+    unsigned long long now;
+
+    if (eventLoop.heapCount == 0) {
+        *timeout = -1;
+        EVENT_DEBUG("No timer armed, timeout %d", *timeout);
+        return 0;
+    }
+
+    then = eventLoop.heap[0]->expiresAt;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    if (then <= now)
+        *timeout = 0;
+    else if (then - now > INT_MAX)
+        *timeout = INT_MAX;
+    else
+        *timeout = then - now;
+
+    EVENT_DEBUG("Timeout at %llu due in %d ms", then, *timeout);
+
+    return 0;
+}
+
+
+/*
+ * Pop all timers whose expiry time is met off the heap, then
+ * invoke the user supplied callback for each of them and schedule
+ * the next timeout. Does not try to 'catch up' on time if the
+ * actual expiry time was later than the requested time.
+ *
+ * This method must cope with timers being registered, updated
+ * or deleted by a callback.
+ *
+ * Returns 0 upon success, -1 if an error occurred
+ */
+static int virEventEpollDispatchTimeouts(void)
+{
+    unsigned long long now;
+    size_t nexpired = 0;
+    size_t i;
+
+    if (eventLoop.heapCount == 0)
+        return 0;
+
+    if (virTimeMillisNow(&now) < 0)
+        return -1;
+
+    /* Add 20ms fuzz so we don't pointlessly spin doing
+     * <10ms sleeps, particularly on kernels with low HZ
+     * it is fine that a timer expires 20ms earlier than
+     * requested
+     */
+    while (eventLoop.heapCount > 0 &&
+           eventLoop.heap[0]->expiresAt <= (now + 20)) {
+        virEventEpollTimeoutPtr t = eventLoop.heap[0];
+
+        if (nexpired == eventLoop.expiredAlloc &&
+            VIR_RESIZE_N(eventLoop.expired, eventLoop.expiredAlloc,
+                         nexpired, EVENT_ALLOC_EXTENT) < 0) {
+            virReportOOMError();
+            return -1;
+        }
+        virEventEpollHeapRemove(t);
+        eventLoop.expired[nexpired++] = t;
+    }
+
+    VIR_DEBUG("Dispatch %zu", nexpired);
+
+    for (i = 0 ; i < nexpired ; i++) {
+        virEventEpollTimeoutPtr t = eventLoop.expired[i];
+        virEventTimeoutCallback cb;
+        int timer;
+        void *opaque;
+
+        /* An earlier callback may have deleted, disabled or
+         * re-scheduled this timer meanwhile */
+        if (t->deleted || t->frequency < 0 ||
+            t->expiresAt > (now + 20))
+            continue;
+
+        cb = t->cb;
+        timer = t->timer;
+        opaque = t->opaque;
+        t->expiresAt = now + t->frequency;
+        if (virEventEpollHeapUpdate(t) < 0)
+            return -1;
+
+        virMutexUnlock(&eventLoop.lock);
+        (cb)(timer, opaque);
+        virMutexLock(&eventLoop.lock);
+    }
+    return 0;
+}
+
+
+/* Dispatch the ready file descriptors reported by epoll_wait()
+ * to every watch registered against them, invoking the user
+ * supplied callback for each watch interested in the events.
+ *
+ * This method must cope with new handles being registered
+ * by a callback, and must skip any handles marked as deleted.
+ * Watches added after the wait began (ID >= @firstNewWatch)
+ * are not dispatched in this iteration.
+ *
+ * Returns 0 upon success, -1 if an error occurred
+ */
+static int virEventEpollDispatchHandles(int nevents,
+                                        struct epoll_event *events,
+                                        int firstNewWatch)
+{
+    int i;
+    VIR_DEBUG("Dispatch %d", nevents);
+
+    for (i = 0 ; i < nevents ; i++) {
+        int fd = events[i].data.fd;
+        virEventEpollHandlePtr handle;
+
+        if (fd >= eventLoop.fdsAlloc || !eventLoop.fds[fd]) {
+            EVENT_DEBUG("Skip stale event on fd=%d", fd);
+            continue;
+        }
+
+        /* NB, new watches are prepended, so those added by a callback
+         * are never reached by this walk, and deleted ones are only
+         * unlinked during cleanup, so following 'next' is safe even
+         * though the lock is dropped while running callbacks */
+        for (handle = eventLoop.fds[fd]->handles ; handle ;
+             handle = handle->next) {
+            virEventHandleCallback cb;
+            int watch;
+            void *opaque;
+            int revents;
+
+            if (handle->deleted || handle->watch >= firstNewWatch) {
+                EVENT_DEBUG("Skip w=%d f=%d d=%d", handle->watch, fd,
+                            handle->deleted);
+                continue;
+            }
+            if (!handle->events)
+                continue;
+
+            revents = events[i].events &
+                (handle->events | EPOLLERR | EPOLLHUP);
+            if (!revents)
+                continue;
+
+            cb = handle->cb;
+            watch = handle->watch;
+            opaque = handle->opaque;
+            virMutexUnlock(&eventLoop.lock);
+            (cb)(watch, fd, virEventEpollFromNativeEvents(revents), opaque);
+            virMutexLock(&eventLoop.lock);
+        }
+    }
+
+    return 0;
+}
+
+
+/* Add an event to @events for each always ready fd with events wanted,
+ * up to @maxevents in total, as poll() would report them.
+ *
+ * Returns the new number of events
+ */
+static int virEventEpollCollectAlwaysReady(int nevents,
+                                           struct epoll_event *events,
+                                           int maxevents)
+{
+    size_t fd;
+
+    for (fd = 0 ; fd < eventLoop.fdsAlloc && nevents < maxevents ; fd++) {
+        virEventEpollFDPtr info = eventLoop.fds[fd];
+
+        if (!info || !info->alwaysReady ||
+            !(info->events & (EPOLLIN | EPOLLOUT)))
+            continue;
+
+        events[nevents].events = info->events & (EPOLLIN | EPOLLOUT);
+        events[nevents].data.fd = fd;
+        nevents++;
+    }
+
+    return nevents;
+}
+
+
+/* Used post dispatch to actually remove any timers that
+ * were previously marked as deleted. This asynchronous
+ * cleanup is needed to make dispatch re-entrant safe.
+ */
+static void virEventEpollCleanupTimeouts(void)
+{
+    virEventEpollTimeoutPtr *deleted = eventLoop.deletedTimeouts;
+    size_t ndeleted = eventLoop.deletedTimeoutsCount;
+    size_t i;
+
+    if (!ndeleted)
+        return;
+
+    VIR_DEBUG("Cleanup %zu", ndeleted);
+
+    /* Detach the queue, since free callbacks run unlocked
+     * and may well delete further timers */
+    eventLoop.deletedTimeouts = NULL;
+    eventLoop.deletedTimeoutsCount = eventLoop.deletedTimeoutsAlloc = 0;
+
+    for (i = 0 ; i < ndeleted ; i++) {
+        virEventEpollTimeoutPtr t = deleted[i];
+
+        if (t->ff) {
+            virFreeCallback ff = t->ff;
+            void *opaque = t->opaque;
+            virMutexUnlock(&eventLoop.lock);
+            ff(opaque);
+            virMutexLock(&eventLoop.lock);
+        }
+        VIR_FREE(t);
+    }
+    VIR_FREE(deleted);
+}
+
+/* Used post dispatch to actually remove any handles that
+ * were previously marked as deleted. This asynchronous
+ * cleanup is needed to make dispatch re-entrant safe.
+ */
+static void virEventEpollCleanupHandles(void)
+{
+    virEventEpollHandlePtr *deleted = eventLoop.deletedHandles;
+    size_t ndeleted = eventLoop.deletedHandlesCount;
+    size_t i;
+
+    if (!ndeleted)
+        return;
+
+    VIR_DEBUG("Cleanup %zu", ndeleted);
+
+    /* Detach the queue, since free callbacks run unlocked
+     * and may well delete further watches */
+    eventLoop.deletedHandles = NULL;
+    eventLoop.deletedHandlesCount = eventLoop.deletedHandlesAlloc = 0;
+
+    for (i = 0 ; i < ndeleted ; i++) {
+        virEventEpollHandlePtr handle = deleted[i];
+        virEventEpollFDPtr info = eventLoop.fds[handle->fd];
+        virEventEpollHandlePtr *prev = &info->handles;
+
+        while (*prev != handle)
+            prev = &(*prev)->next;
+        *prev = handle->next;
+
+        if (!info->handles) {
+            /* Registration was already dropped when the
+             * last live watch went away */
+            eventLoop.fds[handle->fd] = NULL;
+            VIR_FREE(info);
+        }
+
+        if (handle->ff) {
+            virFreeCallback ff = handle->ff;
+            void *opaque = handle->opaque;
+            virMutexUnlock(&eventLoop.lock);
+            ff(opaque);
+            virMutexLock(&eventLoop.lock);
+        }
+        VIR_FREE(handle);
+    }
+    VIR_FREE(deleted);
+}
+
+/*
+ * Run a single iteration of the event loop, blocking until
+ * at least one file handle has an event, or a timer expires
+ */
+int virEventEpollRunOnce(void)
+{
+    struct epoll_event events[EVENT_EPOLL_MAX_EVENTS];
+    int ret, timeout, firstNewWatch;
+    int maxevents = EVENT_EPOLL_MAX_EVENTS;
+
+    virMutexLock(&eventLoop.lock);
+    eventLoop.running = 1;
+    virThreadSelf(&eventLoop.leader);
+
+    virEventEpollCleanupTimeouts();
+    virEventEpollCleanupHandles();
+
+    if (virEventEpollCalculateTimeout(&timeout) < 0)
+        goto error;
+
+    /* Leave room for the always ready fds, and don't wait for them */
+    if (eventLoop.alwaysReadyCount) {
+        maxevents /= 2;
+        timeout = 0;
+    }
+
+    firstNewWatch = nextWatch;
+    virMutexUnlock(&eventLoop.lock);
+
+ retry:
+    EVENT_DEBUG("Waiting on %zd handles, timeout %d",
+                virHashSize(eventLoop.handles), timeout);
+    ret = epoll_wait(eventLoop.epollfd, events, maxevents, timeout);
+    if (ret < 0) {
+        EVENT_DEBUG("Poll got error event %d", errno);
+        if (errno == EINTR) {
+            goto retry;
+        }
+        virReportSystemError(errno, "%s",
+                             _("Unable to poll on file handles"));
+        goto error_unlocked;
+    }
+    EVENT_DEBUG("Poll got %d event(s)", ret);
+
+    virMutexLock(&eventLoop.lock);
+    if (eventLoop.alwaysReadyCount)
+        ret = virEventEpollCollectAlwaysReady(ret, events,
+                                              EVENT_EPOLL_MAX_EVENTS);
+
+    if (virEventEpollDispatchTimeouts() < 0)
+        goto error;
+
+    if (ret > 0 &&
+        virEventEpollDispatchHandles(ret, events, firstNewWatch) < 0)
+        goto error;
+
+    virEventEpollCleanupTimeouts();
+    virEventEpollCleanupHandles();
+
+    eventLoop.running = 0;
+    virMutexUnlock(&eventLoop.lock);
+    return 0;
+
+error:
+    eventLoop.running = 0;
+    virMutexUnlock(&eventLoop.lock);
+error_unlocked:
+    return -1;
+}
+
+
+static void virEventEpollHandleWakeup(int watch ATTRIBUTE_UNUSED,
+                                      int fd,
+                                      int events ATTRIBUTE_UNUSED,
+                                      void *opaque ATTRIBUTE_UNUSED)
+{
+    char c;
+    virMutexLock(&eventLoop.lock);
+    ignore_value(saferead(fd, &c, sizeof(c)));
+    virMutexUnlock(&eventLoop.lock);
+}
+
+int virEventEpollInit(void)
+{
+    if (virMutexInit(&eventLoop.lock) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to initialize mutex"));
+        return -1;
+    }
+
+    if ((eventLoop.epollfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to create epoll instance"));
+        return -1;
+    }
+
+    if (!(eventLoop.handles = virEventEpollIDTableNew()) ||
+        !(eventLoop.timeouts = virEventEpollIDTableNew()))
+        goto error;
+
+    if (pipe2(eventLoop.wakeupfd, O_CLOEXEC | O_NONBLOCK) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("Unable to setup wakeup pipe"));
+        goto error;
+    }
+
+    if (virEventEpollAddHandle(eventLoop.wakeupfd[0],
+                               VIR_EVENT_HANDLE_READABLE,
+                               virEventEpollHandleWakeup, NULL, NULL) < 0) {
+        virEventError(VIR_ERR_INTERNAL_ERROR,
+                      _("Unable to add handle %d to event loop"),
+                      eventLoop.wakeupfd[0]);
+        VIR_FORCE_CLOSE(eventLoop.wakeupfd[0]);
+        VIR_FORCE_CLOSE(eventLoop.wakeupfd[1]);
+        goto error;
+    }
+
+    return 0;
+
+error:
+    virHashFree(eventLoop.handles);
+    virHashFree(eventLoop.timeouts);
+    eventLoop.handles = eventLoop.timeouts = NULL;
+    VIR_FORCE_CLOSE(eventLoop.epollfd);
+    return -1;
+}
+
+static int virEventEpollInterruptLocked(void)
+{
+    char c = '\0';
+
+    if (!eventLoop.running ||
+        virThreadIsSelf(&eventLoop.leader)) {
+        VIR_DEBUG("Skip interrupt, %d %d", eventLoop.running,
+                  virThreadID(&eventLoop.leader));
+        return 0;
+    }
+
+    VIR_DEBUG("Interrupting");
+    if (safewrite(eventLoop.wakeupfd[1], &c, sizeof(c)) != sizeof(c))
+        return -1;
+    return 0;
+}
+
+int virEventEpollInterrupt(void)
+{
+    int ret;
+    virMutexLock(&eventLoop.lock);
+    ret = virEventEpollInterruptLocked();
+    virMutexUnlock(&eventLoop.lock);
+    return ret;
+}
+
+#else /* ! WITH_EPOLL */
+
+int virEventEpollAddHandle(int fd ATTRIBUTE_UNUSED,
+                           int events ATTRIBUTE_UNUSED,
+                           virEventHandleCallback cb ATTRIBUTE_UNUSED,
+                           void *opaque ATTRIBUTE_UNUSED,
+                           virFreeCallback ff ATTRIBUTE_UNUSED)
+{
+    return -1;
+}
+
+void virEventEpollUpdateHandle(int watch ATTRIBUTE_UNUSED,
+                               int events ATTRIBUTE_UNUSED)
+{
+}
+
+int virEventEpollRemoveHandle(int watch ATTRIBUTE_UNUSED)
+{
+    return -1;
+}
+
+int virEventEpollAddTimeout(int frequency ATTRIBUTE_UNUSED,
+                            virEventTimeoutCallback cb ATTRIBUTE_UNUSED,
+                            void *opaque ATTRIBUTE_UNUSED,
+                            virFreeCallback ff ATTRIBUTE_UNUSED)
+{
+    return -1;
+}
+
+void virEventEpollUpdateTimeout(int timer ATTRIBUTE_UNUSED,
+                                int frequency ATTRIBUTE_UNUSED)
+{
+}
+
+int virEventEpollRemoveTimeout(int timer ATTRIBUTE_UNUSED)
+{
+    return -1;
+}
+
+int virEventEpollInit(void)
+{
+    virEventError(VIR_ERR_NO_SUPPORT, "%s",
+                  _("epoll event loop was not available at build time"));
+    return -1;
+}
+
+int virEventEpollRunOnce(void)
+{
+    virEventError(VIR_ERR_NO_SUPPORT, "%s",
+                  _("epoll event loop was not available at build time"));
+    return -1;
+}
+
+int virEventEpollInterrupt(void)
+{
+    return -1;
+}
+
+#endif /* ! WITH_EPOLL */
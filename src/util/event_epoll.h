@@ -0,0 +1,137 @@
+/*
+ * event_epoll.h: epoll() based event loop for monitoring file handles
+ *
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#ifndef __VIR_EVENT_EPOLL_H__
+# define __VIR_EVENT_EPOLL_H__
+
+# include "internal.h"
+
+/*
+ * The functions below follow the exact same contract as their
+ * virEventPoll counterparts in event_poll.h, so the two implementations
+ * can be used interchangeably through virEventRegisterImpl. The epoll
+ * flavour keeps a persistent kernel registration per file descriptor,
+ * indexes watches and timers by ID and keeps armed timers in a min-heap,
+ * so the cost of an iteration depends on the number of ready handles and
+ * expired timers rather than on the number of registered ones.
+ */
+
+/**
+ * virEventEpollAddHandle: register a callback for monitoring file handle events
+ *
+ * @fd: file handle to monitor for events
+ * @events: bitset of events to watch from VIR_EVENT_HANDLE_* constants
+ * @cb: callback to invoke when an event occurs
+ * @opaque: user data to pass to callback
+ *
+ * returns -1 if the file handle cannot be registered, the watch
+ * number upon success
+ */
+int virEventEpollAddHandle(int fd, int events,
+                           virEventHandleCallback cb,
+                           void *opaque,
+                           virFreeCallback ff);
+
+/**
+ * virEventEpollUpdateHandle: change event set for a monitored file handle
+ *
+ * @watch: watch whose handle to update
+ * @events: bitset of events to watch from VIR_EVENT_HANDLE_* constants
+ *
+ * Will not fail if fd exists
+ */
+void virEventEpollUpdateHandle(int watch, int events);
+
+/**
+ * virEventEpollRemoveHandle: unregister a callback from a file handle
+ *
+ * @watch: watch whose handle to remove
+ *
+ * returns -1 if the file handle was not registered, 0 upon success
+ */
+int virEventEpollRemoveHandle(int watch);
+
+/**
+ * virEventEpollAddTimeout: register a callback for a timer event
+ *
+ * @frequency: time between events in milliseconds
+ * @cb: callback to invoke when an event occurs
+ * @opaque: user data to pass to callback
+ *
+ * Setting frequency to -1 will disable the timer. Setting the frequency
+ * to zero will cause it to fire on every event loop iteration.
+ *
+ * returns -1 if the timer cannot be registered, a positive
+ * integer timer id upon success
+ */
+int virEventEpollAddTimeout(int frequency,
+                            virEventTimeoutCallback cb,
+                            void *opaque,
+                            virFreeCallback ff);
+
+/**
+ * virEventEpollUpdateTimeout: change frequency for a timer
+ *
+ * @timer: timer id to change
+ * @frequency: time between events in milliseconds
+ *
+ * Setting frequency to -1 will disable the timer. Setting the frequency
+ * to zero will cause it to fire on every event loop iteration.
+ *
+ * Will not fail if timer exists
+ */
+void virEventEpollUpdateTimeout(int timer, int frequency);
+
+/**
+ * virEventEpollRemoveTimeout: unregister a callback for a timer
+ *
+ * @timer: the timer id to remove
+ *
+ * returns -1 if the timer was not registered, 0 upon success
+ */
+int virEventEpollRemoveTimeout(int timer);
+
+/**
+ * virEventEpollInit: Initialize the event loop
+ *
+ * returns -1 if initialization failed, or if epoll is not
+ * available on this platform
+ */
+int virEventEpollInit(void);
+
+/**
+ * virEventEpollRunOnce: run a single iteration of the event loop.
+ *
+ * Blocks the caller until at least one file handle has an
+ * event or the first timer expires.
+ *
+ * returns -1 if the event monitoring failed
+ */
+int virEventEpollRunOnce(void);
+
+/**
+ * virEventEpollInterrupt: wakeup any thread waiting in epoll_wait()
+ *
+ * return -1 if wakup failed
+ */
+int virEventEpollInterrupt(void);
+
+#endif /* __VIR_EVENT_EPOLL_H__ */
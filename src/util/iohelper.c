@@ -32,6 +32,7 @@
 #include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 
 #include "util.h"
 #include "threads.h"
@@ -86,6 +87,10 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
     bool direct = O_DIRECT && ((oflags & O_DIRECT) != 0);
     bool shortRead = false; /* true if we hit a short read */
     off_t end = 0;
+    bool sparse = false; /* true if holes of the file are skipped */
+    off_t pos = 0; /* Position in the file, and its size, when sparse */
+    off_t size = 0;
+    struct stat sb;
 
 #if HAVE_POSIX_MEMALIGN
     if (posix_memalign(&base, alignMask + 1, buflen)) {
@@ -138,8 +143,17 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
         goto cleanup;
     }
 
+    /* Holes of regular files are neither read nor written: reading
+     * them just gives zeroes, and zeroes are written as holes */
+    if (!direct && fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode) &&
+        (pos = lseek(fd, 0, SEEK_CUR)) >= 0) {
+        sparse = true;
+        size = sb.st_size;
+    }
+
     while (1) {
         ssize_t got;
+        size_t want;
 
         if (length &&
             (length - total) < buflen)
@@ -148,7 +162,34 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
         if (buflen == 0)
             break; /* End of requested data from client */
 
-        if ((got = saferead(fdin, buf, buflen)) < 0) {
+        want = buflen;
+        if (sparse && fdin == fd) {
+            bool inData;
+            unsigned long long seg;
+
+            if (virFileInData(fd, &inData, &seg) < 0)
+                goto cleanup;
+            if (seg && seg < want)
+                want = seg;
+
+            if (!inData) {
+                memset(buf, 0, want);
+                if (lseek(fd, want, SEEK_CUR) < 0) {
+                    virReportSystemError(errno, _("Unable to seek %s"),
+                                         fdinname);
+                    goto cleanup;
+                }
+                total += want;
+                if (safewrite(fdout, buf, want) < 0) {
+                    virReportSystemError(errno, _("Unable to write %s"),
+                                         fdoutname);
+                    goto cleanup;
+                }
+                continue;
+            }
+        }
+
+        if ((got = saferead(fdin, buf, want)) < 0) {
             virReportSystemError(errno, _("Unable to read %s"), fdinname);
             goto cleanup;
         }
@@ -169,6 +210,34 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
             memset(buf + got, 0, buflen - got);
             got = (got + alignMask) & ~alignMask;
         }
+        if (sparse && fdout == fd) {
+            if (virMemIsZero(buf, got)) {
+                /* Deallocate what overwrites the old content, then
+                 * skip over the hole */
+                int rc = 0;
+
+                if (pos < size)
+                    rc = virFilePunchHole(fd, pos, MIN(got, size - pos));
+                if (rc == -ENOSYS || rc == -EOPNOTSUPP) {
+                    sparse = false;
+                } else if (rc < 0) {
+                    virReportSystemError(-rc, _("Unable to punch hole in %s"),
+                                         fdoutname);
+                    goto cleanup;
+                } else {
+                    if (lseek(fd, got, SEEK_CUR) < 0) {
+                        virReportSystemError(errno, _("Unable to seek %s"),
+                                             fdoutname);
+                        goto cleanup;
+                    }
+                    pos += got;
+                    continue;
+                }
+            }
+            pos += got;
+            if (pos > size)
+                size = pos;
+        }
         if (safewrite(fdout, buf, got) < 0) {
             virReportSystemError(errno, _("Unable to write %s"), fdoutname);
             goto cleanup;
@@ -179,6 +248,13 @@ runIO(const char *path, int fd, int oflags, unsigned long long length)
         }
     }
 
+    /* A hole at the end is only there once the file is extended */
+    if (sparse && fdout == fd && pos > size &&
+        ftruncate(fd, pos) < 0) {
+        virReportSystemError(errno, _("Unable to truncate %s"), fdoutname);
+        goto cleanup;
+    }
+
     ret = 0;
 
 cleanup:
@@ -47,6 +47,10 @@
     virReportErrorHelper(VIR_FROM_NONE, code, __FILE__,                 \
                          __FUNCTION__, __LINE__, __VA_ARGS__)
 
+/* Objects with at least this many keys get a hash table to look them
+ * up, instead of comparing the key with all the others */
+#define VIR_JSON_OBJECT_INDEX_MIN 16
+
 
 typedef struct _virJSONParserState virJSONParserState;
 typedef virJSONParserState *virJSONParserStatePtr;
@@ -60,7 +64,8 @@ typedef virJSONParser *virJSONParserPtr;
 struct _virJSONParser {
     virJSONValuePtr head;
     virJSONParserStatePtr state;
-    unsigned int nstate;
+    size_t nstate;
+    size_t nstate_max;
 };
 
 
@@ -77,6 +82,7 @@ void virJSONValueFree(virJSONValuePtr value)
             virJSONValueFree(value->data.object.pairs[i].value);
         }
         VIR_FREE(value->data.object.pairs);
+        virHashFree(value->data.object.index);
         break;
     case VIR_JSON_TYPE_ARRAY:
         for (i = 0 ; i < value->data.array.nvalues ; i++)
@@ -136,79 +142,64 @@ virJSONValuePtr virJSONValueNewStringLen(const char *data, size_t length)
     return val;
 }
 
-static virJSONValuePtr virJSONValueNewNumber(const char *data)
+/* Takes ownership of @data, which is freed on failure */
+static virJSONValuePtr virJSONValueNewNumber(char *data)
 {
     virJSONValuePtr val;
 
-    if (VIR_ALLOC(val) < 0)
+    if (VIR_ALLOC(val) < 0) {
+        VIR_FREE(data);
         return NULL;
+    }
 
     val->type = VIR_JSON_TYPE_NUMBER;
-    if (!(val->data.number = strdup(data))) {
-        VIR_FREE(val);
-        return NULL;
-    }
+    val->data.number = data;
 
     return val;
 }
 
 virJSONValuePtr virJSONValueNewNumberInt(int data)
 {
-    virJSONValuePtr val = NULL;
     char *str;
     if (virAsprintf(&str, "%i", data) < 0)
         return NULL;
-    val = virJSONValueNewNumber(str);
-    VIR_FREE(str);
-    return val;
+    return virJSONValueNewNumber(str);
 }
 
 
 virJSONValuePtr virJSONValueNewNumberUint(unsigned int data)
 {
-    virJSONValuePtr val = NULL;
     char *str;
     if (virAsprintf(&str, "%u", data) < 0)
         return NULL;
-    val = virJSONValueNewNumber(str);
-    VIR_FREE(str);
-    return val;
+    return virJSONValueNewNumber(str);
 }
 
 
 virJSONValuePtr virJSONValueNewNumberLong(long long data)
 {
-    virJSONValuePtr val = NULL;
     char *str;
     if (virAsprintf(&str, "%lld", data) < 0)
         return NULL;
-    val = virJSONValueNewNumber(str);
-    VIR_FREE(str);
-    return val;
+    return virJSONValueNewNumber(str);
 }
 
 
 virJSONValuePtr virJSONValueNewNumberUlong(unsigned long long data)
 {
-    virJSONValuePtr val = NULL;
     char *str;
     if (virAsprintf(&str, "%llu", data) < 0)
         return NULL;
-    val = virJSONValueNewNumber(str);
-    VIR_FREE(str);
-    return val;
+    return virJSONValueNewNumber(str);
 }
 
 
 virJSONValuePtr virJSONValueNewNumberDouble(double data)
 {
-    virJSONValuePtr val = NULL;
     char *str;
     if (virAsprintf(&str, "%lf", data) < 0)
         return NULL;
-    val = virJSONValueNewNumber(str);
-    VIR_FREE(str);
-    return val;
+    return virJSONValueNewNumber(str);
 }
 
 
@@ -261,6 +252,71 @@ virJSONValuePtr virJSONValueNewObject(void)
     return val;
 }
 
+/* Position of @key in the pairs of @object, or -1 */
+static int virJSONValueObjectFind(virJSONValuePtr object, const char *key)
+{
+    virJSONObjectPtr obj = &object->data.object;
+    int i;
+
+    if (obj->index)
+        return (intptr_t)virHashLookup(obj->index, key) - 1;
+
+    for (i = 0 ; i < obj->npairs ; i++) {
+        if (STREQ(obj->pairs[i].key, key))
+            return i;
+    }
+
+    return -1;
+}
+
+static int virJSONValueObjectIndex(virJSONValuePtr object)
+{
+    virJSONObjectPtr obj = &object->data.object;
+    int i;
+
+    if (!(obj->index = virHashCreate(VIR_JSON_OBJECT_INDEX_MIN * 2, NULL)))
+        return -1;
+
+    for (i = 0 ; i < obj->npairs ; i++) {
+        if (virHashAddEntry(obj->index, obj->pairs[i].key,
+                            (void *)(intptr_t)(i + 1)) < 0) {
+            virHashFree(obj->index);
+            obj->index = NULL;
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/* Takes ownership of @key on success */
+static int virJSONValueObjectAppendKey(virJSONValuePtr object, char *key,
+                                       virJSONValuePtr value)
+{
+    virJSONObjectPtr obj = &object->data.object;
+
+    if (virJSONValueObjectFind(object, key) >= 0)
+        return -1;
+
+    if (VIR_RESIZE_N(obj->pairs, obj->npairs_max, obj->npairs, 1) < 0)
+        return -1;
+
+    if (!obj->index && obj->npairs + 1 >= VIR_JSON_OBJECT_INDEX_MIN &&
+        virJSONValueObjectIndex(object) < 0)
+        return -1;
+
+    if (obj->index &&
+        virHashAddEntry(obj->index, key,
+                        (void *)(intptr_t)(obj->npairs + 1)) < 0)
+        return -1;
+
+    obj->pairs[obj->npairs].key = key;
+    obj->pairs[obj->npairs].value = value;
+    obj->npairs++;
+
+    return 0;
+}
+
 int virJSONValueObjectAppend(virJSONValuePtr object, const char *key, virJSONValuePtr value)
 {
     char *newkey;
@@ -268,22 +324,14 @@ int virJSONValueObjectAppend(virJSONValuePtr object, const char *key, virJSONVal
     if (object->type != VIR_JSON_TYPE_OBJECT)
         return -1;
 
-    if (virJSONValueObjectHasKey(object, key))
-        return -1;
-
     if (!(newkey = strdup(key)))
         return -1;
 
-    if (VIR_REALLOC_N(object->data.object.pairs,
-                      object->data.object.npairs + 1) < 0) {
+    if (virJSONValueObjectAppendKey(object, newkey, value) < 0) {
         VIR_FREE(newkey);
         return -1;
     }
 
-    object->data.object.pairs[object->data.object.npairs].key = newkey;
-    object->data.object.pairs[object->data.object.npairs].value = value;
-    object->data.object.npairs++;
-
     return 0;
 }
 
@@ -391,8 +439,9 @@ int virJSONValueArrayAppend(virJSONValuePtr array, virJSONValuePtr value)
     if (array->type != VIR_JSON_TYPE_ARRAY)
         return -1;
 
-    if (VIR_REALLOC_N(array->data.array.values,
-                      array->data.array.nvalues + 1) < 0)
+    if (VIR_RESIZE_N(array->data.array.values,
+                     array->data.array.nvalues_max,
+                     array->data.array.nvalues, 1) < 0)
         return -1;
 
     array->data.array.values[array->data.array.nvalues] = value;
@@ -403,17 +452,10 @@ int virJSONValueArrayAppend(virJSONValuePtr array, virJSONValuePtr value)
 
 int virJSONValueObjectHasKey(virJSONValuePtr object, const char *key)
 {
-    int i;
-
     if (object->type != VIR_JSON_TYPE_OBJECT)
         return -1;
 
-    for (i = 0 ; i < object->data.object.npairs ; i++) {
-        if (STREQ(object->data.object.pairs[i].key, key))
-            return 1;
-    }
-
-    return 0;
+    return virJSONValueObjectFind(object, key) >= 0;
 }
 
 virJSONValuePtr virJSONValueObjectGet(virJSONValuePtr object, const char *key)
@@ -423,12 +465,10 @@ virJSONValuePtr virJSONValueObjectGet(virJSONValuePtr object, const char *key)
     if (object->type != VIR_JSON_TYPE_OBJECT)
         return NULL;
 
-    for (i = 0 ; i < object->data.object.npairs ; i++) {
-        if (STREQ(object->data.object.pairs[i].key, key))
-            return object->data.object.pairs[i].value;
-    }
+    if ((i = virJSONValueObjectFind(object, key)) < 0)
+        return NULL;
 
-    return NULL;
+    return object->data.object.pairs[i].value;
 }
 
 int virJSONValueArraySize(virJSONValuePtr array)
@@ -654,12 +694,13 @@ static int virJSONParserInsertValue(virJSONParserPtr parser,
                 return -1;
             }
 
-            if (virJSONValueObjectAppend(state->value,
-                                         state->key,
-                                         value) < 0)
+            /* The key is handed over rather than copied again */
+            if (virJSONValueObjectAppendKey(state->value,
+                                            state->key,
+                                            value) < 0)
                 return -1;
 
-            VIR_FREE(state->key);
+            state->key = NULL;
         }   break;
 
         case VIR_JSON_TYPE_ARRAY: {
@@ -687,8 +728,6 @@ static int virJSONParserHandleNull(void *ctx)
     virJSONParserPtr parser = ctx;
     virJSONValuePtr value = virJSONValueNewNull();
 
-    VIR_DEBUG("parser=%p", parser);
-
     if (!value)
         return 0;
 
@@ -705,8 +744,6 @@ static int virJSONParserHandleBoolean(void *ctx, int boolean_)
     virJSONParserPtr parser = ctx;
     virJSONValuePtr value = virJSONValueNewBoolean(boolean_);
 
-    VIR_DEBUG("parser=%p boolean=%d", parser, boolean_);
-
     if (!value)
         return 0;
 
@@ -727,13 +764,9 @@ static int virJSONParserHandleNumber(void *ctx,
     virJSONValuePtr value;
 
     if (!str)
-        return -1;
-    value = virJSONValueNewNumber(str);
-    VIR_FREE(str);
-
-    VIR_DEBUG("parser=%p str=%s", parser, str);
+        return 0;
 
-    if (!value)
+    if (!(value = virJSONValueNewNumber(str)))
         return 0;
 
     if (virJSONParserInsertValue(parser, value) < 0) {
@@ -752,8 +785,6 @@ static int virJSONParserHandleString(void *ctx,
     virJSONValuePtr value = virJSONValueNewStringLen((const char *)stringVal,
                                                      stringLen);
 
-    VIR_DEBUG("parser=%p str=%p", parser, (const char *)stringVal);
-
     if (!value)
         return 0;
 
@@ -772,8 +803,6 @@ static int virJSONParserHandleMapKey(void *ctx,
     virJSONParserPtr parser = ctx;
     virJSONParserStatePtr state;
 
-    VIR_DEBUG("parser=%p key=%p", parser, (const char *)stringVal);
-
     if (!parser->nstate)
         return 0;
 
@@ -791,8 +820,6 @@ static int virJSONParserHandleStartMap(void *ctx)
     virJSONParserPtr parser = ctx;
     virJSONValuePtr value = virJSONValueNewObject();
 
-    VIR_DEBUG("parser=%p", parser);
-
     if (!value)
         return 0;
 
@@ -801,11 +828,9 @@ static int virJSONParserHandleStartMap(void *ctx)
         return 0;
     }
 
-    if (VIR_REALLOC_N(parser->state,
-                      parser->nstate + 1) < 0) {
-        virJSONValueFree(value);
+    if (VIR_RESIZE_N(parser->state, parser->nstate_max,
+                     parser->nstate, 1) < 0)
         return 0;
-    }
 
     parser->state[parser->nstate].value = value;
     parser->state[parser->nstate].key = NULL;
@@ -820,8 +845,6 @@ static int virJSONParserHandleEndMap(void *ctx)
     virJSONParserPtr parser = ctx;
     virJSONParserStatePtr state;
 
-    VIR_DEBUG("parser=%p", parser);
-
     if (!parser->nstate)
         return 0;
 
@@ -831,9 +854,6 @@ static int virJSONParserHandleEndMap(void *ctx)
         return 0;
     }
 
-    if (VIR_REALLOC_N(parser->state,
-                      parser->nstate - 1) < 0)
-        return 0;
     parser->nstate--;
 
     return 1;
@@ -844,8 +864,6 @@ static int virJSONParserHandleStartArray(void *ctx)
     virJSONParserPtr parser = ctx;
     virJSONValuePtr value = virJSONValueNewArray();
 
-    VIR_DEBUG("parser=%p", parser);
-
     if (!value)
         return 0;
 
@@ -854,8 +872,8 @@ static int virJSONParserHandleStartArray(void *ctx)
         return 0;
     }
 
-    if (VIR_REALLOC_N(parser->state,
-                      parser->nstate + 1) < 0)
+    if (VIR_RESIZE_N(parser->state, parser->nstate_max,
+                     parser->nstate, 1) < 0)
         return 0;
 
     parser->state[parser->nstate].value = value;
@@ -870,8 +888,6 @@ static int virJSONParserHandleEndArray(void *ctx)
     virJSONParserPtr parser = ctx;
     virJSONParserStatePtr state;
 
-    VIR_DEBUG("parser=%p", parser);
-
     if (!parser->nstate)
         return 0;
 
@@ -881,9 +897,6 @@ static int virJSONParserHandleEndArray(void *ctx)
         return 0;
     }
 
-    if (VIR_REALLOC_N(parser->state,
-                      parser->nstate - 1) < 0)
-        return 0;
     parser->nstate--;
 
     return 1;
@@ -908,7 +921,7 @@ static const yajl_callbacks parserCallbacks = {
 virJSONValuePtr virJSONValueFromString(const char *jsonstring)
 {
     yajl_handle hand;
-    virJSONParser parser = { NULL, NULL, 0 };
+    virJSONParser parser = { NULL, NULL, 0, 0 };
     virJSONValuePtr ret = NULL;
 # ifndef HAVE_YAJL2
     yajl_parser_config cfg = { 1, 1 };
@@ -957,6 +970,7 @@ cleanup:
             VIR_FREE(parser.state[i].key);
         }
     }
+    VIR_FREE(parser.state);
 
     VIR_DEBUG("result=%p", parser.head);
 
@@ -969,8 +983,6 @@ static int virJSONValueToStringOne(virJSONValuePtr object,
 {
     int i;
 
-    VIR_DEBUG("object=%p type=%d gen=%p", object, object->type, g);
-
     switch (object->type) {
     case VIR_JSON_TYPE_OBJECT:
         if (yajl_gen_map_open(g) != yajl_gen_status_ok)
@@ -25,6 +25,7 @@
 # define __VIR_JSON_H_
 
 # include "internal.h"
+# include "virhash.h"
 
 
 typedef enum {
@@ -56,11 +57,14 @@ struct _virJSONObjectPair {
 
 struct _virJSONObject {
     unsigned int npairs;
+    size_t npairs_max;
     virJSONObjectPairPtr pairs;
+    virHashTablePtr index; /* key -> position in pairs + 1, large objects */
 };
 
 struct _virJSONArray {
     unsigned int nvalues;
+    size_t nvalues_max;
     virJSONValuePtr *values;
 };
 
@@ -44,6 +44,7 @@
 #include "threads.h"
 #include "virfile.h"
 #include "virtime.h"
+#include "viratomic.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
 
@@ -71,6 +72,26 @@ typedef virLogFilter *virLogFilterPtr;
 static virLogFilterPtr virLogFilters = NULL;
 static int virLogNbFilters = 0;
 
+/*
+ * Checking the filters for each message is costly, and messages are
+ * usually rejected, so the outcome is cached per category. A cached
+ * value is only valid as long as it carries the current filter serial,
+ * which changes whenever the filters do. The category of a slot never
+ * changes once set, which allows to look up the cache without locking.
+ */
+#define VIR_LOG_FILTER_CACHE_SIZE 1024
+#define VIR_LOG_FILTER_CACHE_BITS 3 /* room for the priority */
+
+struct _virLogFilterCacheEntry {
+    char *category;
+    unsigned int value; /* serial << VIR_LOG_FILTER_CACHE_BITS | priority */
+};
+typedef struct _virLogFilterCacheEntry virLogFilterCacheEntry;
+typedef virLogFilterCacheEntry *virLogFilterCacheEntryPtr;
+
+static virLogFilterCacheEntry virLogFilterCache[VIR_LOG_FILTER_CACHE_SIZE];
+static unsigned int virLogFiltersSerial = 1;
+
 /*
  * Outputs are used to emit the messages retained
  * after filtering, multiple output can be used simultaneously
@@ -90,6 +111,42 @@ typedef virLogOutput *virLogOutputPtr;
 static virLogOutputPtr virLogOutputs = NULL;
 static int virLogNbOutputs = 0;
 
+/*
+ * In asynchronous mode, messages are queued by the threads logging them
+ * and written to the buffer and outputs by a dedicated thread, so that
+ * slow outputs don't hold up the whole process. The queue is a stack
+ * which producers push to without locking; the writer takes all the
+ * records at once and reverses them. The lock only serves waking up the
+ * writer, and producers waiting for room in the queue.
+ */
+#define VIR_LOG_QUEUE_MAX 10000
+
+typedef struct _virLogRecord virLogRecord;
+typedef virLogRecord *virLogRecordPtr;
+struct _virLogRecord {
+    virLogRecordPtr next;
+    const char *category;
+    int priority;
+    const char *funcname;
+    long long linenr;
+    unsigned int flags;
+    bool emit;
+    char *msg;
+    char timestamp[VIR_TIME_STRING_BUFLEN];
+};
+
+static bool virLogAsync = false;
+static bool virLogWriterQuit = false;
+static pid_t virLogWriterPid;
+static virThread virLogWriterThread;
+static virLogRecordPtr virLogQueueHead = NULL;
+static int virLogQueueLen = 0;
+static virMutex virLogQueueLock;
+static virCond virLogQueueCond;
+static virCond virLogQueueDrained;
+
+static void virLogStopWriter(void);
+
 /*
  * Default priorities
  */
@@ -159,6 +216,17 @@ int virLogStartup(void) {
 
     if (virMutexInit(&virLogMutex) < 0)
         return -1;
+    if (virMutexInit(&virLogQueueLock) < 0) {
+        virMutexDestroy(&virLogMutex);
+        return -1;
+    }
+    if (virCondInit(&virLogQueueCond) < 0 ||
+        virCondInit(&virLogQueueDrained) < 0) {
+        ignore_value(virCondDestroy(&virLogQueueCond));
+        virMutexDestroy(&virLogQueueLock);
+        virMutexDestroy(&virLogMutex);
+        return -1;
+    }
 
     virLogInitialized = 1;
     virLogLock();
@@ -251,6 +319,7 @@ int virLogReset(void) {
     if (!virLogInitialized)
         return virLogStartup();
 
+    virLogStopWriter();
     virLogLock();
     virLogResetFilters();
     virLogResetOutputs();
@@ -267,16 +336,26 @@ int virLogReset(void) {
  * Shutdown the logging module
  */
 void virLogShutdown(void) {
+    int i;
+
     if (!virLogInitialized)
         return;
+    virLogStopWriter();
     virLogLock();
     virLogResetFilters();
     virLogResetOutputs();
+    for (i = 0; i < VIR_LOG_FILTER_CACHE_SIZE; i++) {
+        VIR_FREE(virLogFilterCache[i].category);
+        virLogFilterCache[i].value = 0;
+    }
     virLogLen = 0;
     virLogStart = 0;
     virLogEnd = 0;
     VIR_FREE(virLogBuffer);
     virLogUnlock();
+    ignore_value(virCondDestroy(&virLogQueueDrained));
+    ignore_value(virCondDestroy(&virLogQueueCond));
+    virMutexDestroy(&virLogQueueLock);
     virMutexDestroy(&virLogMutex);
     virLogInitialized = 0;
 }
@@ -465,6 +544,7 @@ static int virLogResetFilters(void) {
         VIR_FREE(virLogFilters[i].match);
     VIR_FREE(virLogFilters);
     virLogNbFilters = 0;
+    virLogFiltersSerial++;
     return i;
 }
 
@@ -497,6 +577,7 @@ int virLogDefineFilter(const char *match, int priority,
     for (i = 0;i < virLogNbFilters;i++) {
         if (STREQ(virLogFilters[i].match, match)) {
             virLogFilters[i].priority = priority;
+            virLogFiltersSerial++;
             goto cleanup;
         }
     }
@@ -515,32 +596,88 @@ int virLogDefineFilter(const char *match, int priority,
     virLogFilters[i].match = mdup;
     virLogFilters[i].priority = priority;
     virLogNbFilters++;
+    virLogFiltersSerial++;
 cleanup:
     virLogUnlock();
     return i;
 }
 
+static unsigned int virLogFilterCacheSlot(const char *category) {
+    unsigned int h = 5381;
+
+    while (*category)
+        h = h * 33 + (unsigned char) *category++;
+    return h % VIR_LOG_FILTER_CACHE_SIZE;
+}
+
+/*
+ * Look up the cached filter priority for @category, returns -1 if the
+ * filters have to be checked. Can be called without holding the lock.
+ */
+static int virLogFilterCacheLookup(virLogFilterCacheEntryPtr entry,
+                                   const char *category) {
+    unsigned int serial = *(volatile unsigned int *)&virLogFiltersSerial;
+    const char *cached = *(char * volatile *)&entry->category;
+    unsigned int value;
+
+    if (cached == NULL || STRNEQ(cached, category))
+        return -1;
+
+    value = *(volatile unsigned int *)&entry->value;
+    if ((value >> VIR_LOG_FILTER_CACHE_BITS) !=
+        (serial & (UINT_MAX >> VIR_LOG_FILTER_CACHE_BITS)))
+        return -1;
+    return value & ((1 << VIR_LOG_FILTER_CACHE_BITS) - 1);
+}
+
 /**
  * virLogFiltersCheck:
  * @input: the input string
  *
  * Check the input of the message against the existing filters. Currently
  * the match is just a substring check of the category used as the input
- * string, a more subtle approach could be used instead
+ * string, a more subtle approach could be used instead. The outcome is
+ * cached, so that the check is mostly a lookup without locking.
  *
  * Returns 0 if not matched or the new priority if found.
  */
 static int virLogFiltersCheck(const char *input) {
+    virLogFilterCacheEntryPtr entry;
+    char *category;
     int ret = 0;
     int i;
 
+    entry = &virLogFilterCache[virLogFilterCacheSlot(input)];
+#ifndef __VIR_ATOMIC_USES_LOCK
+    if ((ret = virLogFilterCacheLookup(entry, input)) >= 0)
+        return ret;
+#endif
+
     virLogLock();
+    if ((ret = virLogFilterCacheLookup(entry, input)) >= 0)
+        goto cleanup;
+
+    ret = 0;
     for (i = 0;i < virLogNbFilters;i++) {
         if (strstr(input, virLogFilters[i].match)) {
             ret = virLogFilters[i].priority;
             break;
         }
     }
+
+    /* The first category using a slot keeps it, others sharing the slot
+     * go through the filters every time */
+    if (entry->category == NULL && (category = strdup(input)) != NULL) {
+#ifndef __VIR_ATOMIC_USES_LOCK
+        /* The string must be complete before anyone can see it */
+        __sync_synchronize();
+#endif
+        entry->category = category;
+    }
+    if (entry->category != NULL && STREQ(entry->category, input))
+        entry->value = (virLogFiltersSerial << VIR_LOG_FILTER_CACHE_BITS) | ret;
+
+cleanup:
     virLogUnlock();
     return ret;
 }
@@ -667,6 +804,267 @@ virLogVersionString(char **msg)
     return virLogFormatString(msg, NULL, 0, VIR_LOG_INFO, LOG_VERSION_STRING);
 }
 
+/*
+ * Store a message in the history buffer, then if it is to be emitted
+ * push it on the outputs defined, if none use stderr.
+ * Must be called with the lock held.
+ */
+static void virLogEmitRecord(virLogRecordPtr rec)
+{
+    static bool logVersionStderr = true;
+    int i;
+
+    virLogStr(rec->timestamp);
+    virLogStr(rec->msg);
+    if (!rec->emit)
+        return;
+
+    for (i = 0; i < virLogNbOutputs; i++) {
+        if (rec->priority >= virLogOutputs[i].priority) {
+            if (virLogOutputs[i].logVersion) {
+                char *ver = NULL;
+                if (virLogVersionString(&ver) >= 0)
+                    virLogOutputs[i].f(rec->category, VIR_LOG_INFO,
+                                       __func__, __LINE__,
+                                       rec->timestamp, ver,
+                                       virLogOutputs[i].data);
+                VIR_FREE(ver);
+                virLogOutputs[i].logVersion = false;
+            }
+            virLogOutputs[i].f(rec->category, rec->priority,
+                               rec->funcname, rec->linenr,
+                               rec->timestamp, rec->msg,
+                               virLogOutputs[i].data);
+        }
+    }
+    if ((virLogNbOutputs == 0) && (rec->flags != 1)) {
+        if (logVersionStderr) {
+            char *ver = NULL;
+            if (virLogVersionString(&ver) >= 0)
+                virLogOutputToFd(rec->category, VIR_LOG_INFO,
+                                 __func__, __LINE__,
+                                 rec->timestamp, ver,
+                                 (void *) STDERR_FILENO);
+            VIR_FREE(ver);
+            logVersionStderr = false;
+        }
+        virLogOutputToFd(rec->category, rec->priority,
+                         rec->funcname, rec->linenr,
+                         rec->timestamp, rec->msg, (void *) STDERR_FILENO);
+    }
+}
+
+/*
+ * Take all the records queued so far, in the order they were queued
+ */
+static virLogRecordPtr virLogQueueTake(void)
+{
+    virLogRecordPtr list, prev = NULL;
+
+#ifdef __VIR_ATOMIC_USES_LOCK
+    virMutexLock(&virLogQueueLock);
+    list = virLogQueueHead;
+    virLogQueueHead = NULL;
+    virMutexUnlock(&virLogQueueLock);
+#else
+    list = __sync_lock_test_and_set(&virLogQueueHead, NULL);
+#endif
+
+    while (list) {
+        virLogRecordPtr next = list->next;
+        list->next = prev;
+        prev = list;
+        list = next;
+    }
+    return prev;
+}
+
+/*
+ * Emit all the queued records, returns how many there were
+ */
+static int virLogQueueFlush(void)
+{
+    virLogRecordPtr rec = virLogQueueTake();
+    int n = 0;
+
+    if (!rec)
+        return 0;
+
+    virLogLock();
+    while (rec) {
+        virLogRecordPtr next = rec->next;
+        virLogEmitRecord(rec);
+        VIR_FREE(rec->msg);
+        VIR_FREE(rec);
+        rec = next;
+        n++;
+    }
+    virLogUnlock();
+
+#ifdef __VIR_ATOMIC_USES_LOCK
+    virMutexLock(&virLogQueueLock);
+    virLogQueueLen -= n;
+    virMutexUnlock(&virLogQueueLock);
+#else
+    __sync_sub_and_fetch(&virLogQueueLen, n);
+#endif
+    return n;
+}
+
+/*
+ * Queue a record for the writer thread, returns -1 if the writer is
+ * gone and the record has to be emitted by the caller.
+ */
+static int virLogQueuePush(virLogRecordPtr rec)
+{
+    virLogRecordPtr head;
+    int len;
+
+#ifdef __VIR_ATOMIC_USES_LOCK
+    virMutexLock(&virLogQueueLock);
+    len = ++virLogQueueLen;
+#else
+    /* Announce the record before checking the writer is still there,
+     * virLogStopWriter() waits for announced records */
+    len = __sync_add_and_fetch(&virLogQueueLen, 1);
+    if (len > VIR_LOG_QUEUE_MAX)
+        virMutexLock(&virLogQueueLock);
+#endif
+
+    /* Don't let the queue grow forever if the outputs can't keep up.
+     * The writer itself can't wait for room, should an output log. */
+    if (len > VIR_LOG_QUEUE_MAX &&
+        !virThreadIsSelf(&virLogWriterThread)) {
+        while (virLogAsync && virLogQueueLen > VIR_LOG_QUEUE_MAX)
+            ignore_value(virCondWait(&virLogQueueDrained, &virLogQueueLock));
+    }
+
+#ifdef __VIR_ATOMIC_USES_LOCK
+    if (!virLogAsync) {
+        virLogQueueLen--;
+        virMutexUnlock(&virLogQueueLock);
+        return -1;
+    }
+    head = virLogQueueHead;
+    rec->next = head;
+    virLogQueueHead = rec;
+#else
+    if (len > VIR_LOG_QUEUE_MAX)
+        virMutexUnlock(&virLogQueueLock);
+
+    if (!*(volatile bool *)&virLogAsync) {
+        __sync_sub_and_fetch(&virLogQueueLen, 1);
+        return -1;
+    }
+    do {
+        head = *(virLogRecordPtr volatile *)&virLogQueueHead;
+        rec->next = head;
+    } while (!__sync_bool_compare_and_swap(&virLogQueueHead, head, rec));
+
+    /* The writer only needs a wakeup when it may have seen the queue
+     * empty, and it only checks that with the lock held */
+    if (head)
+        return 0;
+    virMutexLock(&virLogQueueLock);
+#endif
+    if (!head)
+        virCondSignal(&virLogQueueCond);
+    virMutexUnlock(&virLogQueueLock);
+    return 0;
+}
+
+static void virLogWriter(void *opaque ATTRIBUTE_UNUSED)
+{
+    virMutexLock(&virLogQueueLock);
+    for (;;) {
+        while (!virLogQueueHead && !virLogWriterQuit)
+            ignore_value(virCondWait(&virLogQueueCond, &virLogQueueLock));
+        if (!virLogQueueHead)
+            break;
+        virMutexUnlock(&virLogQueueLock);
+
+        virLogQueueFlush();
+
+        virMutexLock(&virLogQueueLock);
+        virCondBroadcast(&virLogQueueDrained);
+    }
+    virMutexUnlock(&virLogQueueLock);
+}
+
+/*
+ * Go back to emitting messages synchronously, once all the queued
+ * ones are emitted
+ */
+static void virLogStopWriter(void)
+{
+    if (!virLogAsync)
+        return;
+
+    /* In a child process, the writer thread doesn't exist and the
+     * locks may have been held by threads of the parent */
+    if (getpid() != virLogWriterPid) {
+        virLogAsync = false;
+        virLogQueueHead = NULL;
+        virLogQueueLen = 0;
+        return;
+    }
+
+    virMutexLock(&virLogQueueLock);
+    virLogAsync = false;
+    virLogWriterQuit = true;
+    virCondSignal(&virLogQueueCond);
+    virCondBroadcast(&virLogQueueDrained);
+    virMutexUnlock(&virLogQueueLock);
+#ifndef __VIR_ATOMIC_USES_LOCK
+    __sync_synchronize();
+#endif
+
+    virThreadJoin(&virLogWriterThread);
+
+    /* Records of threads which saw the writer still running */
+    while (*(volatile int *)&virLogQueueLen > 0) {
+        if (virLogQueueFlush() == 0)
+            usleep(100);
+    }
+}
+
+/**
+ * virLogSetAsync:
+ * @async: whether messages should be emitted asynchronously
+ *
+ * In asynchronous mode, messages are queued and stored in the buffer
+ * and emitted on the outputs by a dedicated thread, which spares the
+ * threads logging the cost of the outputs and of the lock serializing
+ * them. Messages still queued are lost in case of crash. The category
+ * and function name of a message must stay valid until it is emitted.
+ *
+ * Returns 0 if successful, and -1 in case or error
+ */
+int virLogSetAsync(bool async)
+{
+    if (!virLogInitialized)
+        virLogStartup();
+
+    if (async == virLogAsync)
+        return 0;
+
+    if (!async) {
+        virLogStopWriter();
+        return 0;
+    }
+
+    virMutexLock(&virLogQueueLock);
+    virLogWriterQuit = false;
+    if (virThreadCreate(&virLogWriterThread, true, virLogWriter, NULL) < 0) {
+        virMutexUnlock(&virLogQueueLock);
+        return -1;
+    }
+    virLogWriterPid = getpid();
+    virLogAsync = true;
+    virMutexUnlock(&virLogQueueLock);
+    return 0;
+}
+
 /**
  * virLogMessage:
  * @category: where is that message coming from
@@ -683,13 +1081,12 @@ virLogVersionString(char **msg)
 void virLogMessage(const char *category, int priority, const char *funcname,
                    long long linenr, unsigned int flags, const char *fmt, ...)
 {
-    static bool logVersionStderr = true;
+    virLogRecord sync = { .msg = NULL };
+    virLogRecordPtr rec = &sync;
     char *str = NULL;
-    char *msg = NULL;
-    char timestamp[VIR_TIME_STRING_BUFLEN];
-    int fprio, i, ret;
+    int fprio, ret;
     int saved_errno = errno;
-    int emit = 1;
+    bool emit = true;
     va_list ap;
 
     if (!virLogInitialized)
@@ -704,14 +1101,19 @@ void virLogMessage(const char *category, int priority, const char *funcname,
     fprio = virLogFiltersCheck(category);
     if (fprio == 0) {
         if (priority < virLogDefaultPriority)
-            emit = 0;
+            emit = false;
     } else if (priority < fprio) {
-        emit = 0;
+        emit = false;
     }
 
-    if ((emit == 0) && ((virLogBuffer == NULL) || (virLogSize <= 0)))
+    if (!emit && ((virLogBuffer == NULL) || (virLogSize <= 0)))
         goto cleanup;
 
+    if (*(volatile bool *)&virLogAsync) {
+        if (VIR_ALLOC(rec) < 0)
+            rec = &sync;
+    }
+
     /*
      * serialize the error message, add level and timestamp
      */
@@ -722,64 +1124,41 @@ void virLogMessage(const char *category, int priority, const char *funcname,
     }
     va_end(ap);
 
-    ret = virLogFormatString(&msg, funcname, linenr, priority, str);
+    ret = virLogFormatString(&rec->msg, funcname, linenr, priority, str);
     VIR_FREE(str);
     if (ret < 0)
         goto cleanup;
 
-    if (virTimeStringNowRaw(timestamp) < 0)
-        timestamp[0] = '\0';
+    if (virTimeStringNowRaw(rec->timestamp) < 0)
+        rec->timestamp[0] = '\0';
+
+    rec->category = category;
+    rec->priority = priority;
+    rec->funcname = funcname;
+    rec->linenr = linenr;
+    rec->flags = flags;
+    rec->emit = emit;
+
+    if (rec != &sync) {
+        if (virLogQueuePush(rec) == 0) {
+            rec = &sync;
+            goto cleanup;
+        }
+    }
 
     /*
-     * Log based on defaults, first store in the history buffer,
-     * then if emit push the message on the outputs defined, if none
-     * use stderr.
      * NOTE: the locking is a single point of contention for multiple
-     *       threads, but avoid intermixing. Maybe set up locks per output
-     *       to improve paralellism.
+     *       threads, but avoid intermixing. The asynchronous mode
+     *       moves it off the threads logging.
      */
     virLogLock();
-    virLogStr(timestamp);
-    virLogStr(msg);
-    virLogUnlock();
-    if (emit == 0)
-        goto cleanup;
-
-    virLogLock();
-    for (i = 0; i < virLogNbOutputs; i++) {
-        if (priority >= virLogOutputs[i].priority) {
-            if (virLogOutputs[i].logVersion) {
-                char *ver = NULL;
-                if (virLogVersionString(&ver) >= 0)
-                    virLogOutputs[i].f(category, VIR_LOG_INFO,
-                                       __func__, __LINE__,
-                                       timestamp, ver,
-                                       virLogOutputs[i].data);
-                VIR_FREE(ver);
-                virLogOutputs[i].logVersion = false;
-            }
-            virLogOutputs[i].f(category, priority, funcname, linenr,
-                               timestamp, msg, virLogOutputs[i].data);
-        }
-    }
-    if ((virLogNbOutputs == 0) && (flags != 1)) {
-        if (logVersionStderr) {
-            char *ver = NULL;
-            if (virLogVersionString(&ver) >= 0)
-                virLogOutputToFd(category, VIR_LOG_INFO,
-                                 __func__, __LINE__,
-                                 timestamp, ver,
-                                 (void *) STDERR_FILENO);
-            VIR_FREE(ver);
-            logVersionStderr = false;
-        }
-        virLogOutputToFd(category, priority, funcname, linenr,
-                         timestamp, msg, (void *) STDERR_FILENO);
-    }
+    virLogEmitRecord(rec);
     virLogUnlock();
 
 cleanup:
-    VIR_FREE(msg);
+    VIR_FREE(rec->msg);
+    if (rec != &sync)
+        VIR_FREE(rec);
     errno = saved_errno;
 }
 
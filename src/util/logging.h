@@ -129,5 +129,6 @@ extern void virLogMessage(const char *category, int priority,
                           unsigned int flags,
                           const char *fmt, ...) ATTRIBUTE_FMT_PRINTF(6, 7);
 extern int virLogSetBufferSize(int size);
+extern int virLogSetAsync(bool async);
 extern void virLogEmergencyDumpAll(int signum);
 #endif
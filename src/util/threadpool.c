@@ -30,27 +30,53 @@
 #include "threads.h"
 #include "virterror_internal.h"
 #include "ignore-value.h"
+#include "virtime.h"
+#include "virhash.h"
+#include "virhashcode.h"
 
 #define VIR_FROM_THIS VIR_FROM_NONE
+#define virThreadPoolError(code, ...)                             \
+    virReportErrorHelper(VIR_FROM_THIS, code, __FILE__,           \
+                         __FUNCTION__, __LINE__, __VA_ARGS__)
 
 typedef struct _virThreadPoolJob virThreadPoolJob;
 typedef virThreadPoolJob *virThreadPoolJobPtr;
 
+typedef struct _virThreadPoolOwner virThreadPoolOwner;
+typedef virThreadPoolOwner *virThreadPoolOwnerPtr;
+
 struct _virThreadPoolJob {
+    /* Jobs of the same owner, oldest first */
     virThreadPoolJobPtr prev;
     virThreadPoolJobPtr next;
+    /* Priority jobs of all owners, oldest first */
+    virThreadPoolJobPtr prevPrio;
+    virThreadPoolJobPtr nextPrio;
+
+    virThreadPoolOwnerPtr owner;
     unsigned int priority;
+    unsigned long long queued;
 
     void *data;
 };
 
-typedef struct _virThreadPoolJobList virThreadPoolJobList;
-typedef virThreadPoolJobList *virThreadPoolJobListPtr;
+/*
+ * Jobs are queued per owner, and the owners having queued jobs
+ * are kept in rings, one for each number of jobs they have running.
+ * Workers pick the next job from the first owner of the lowest ring,
+ * which then moves to the end of the next ring, so that an owner
+ * queueing lots of jobs can't starve the others.
+ */
+struct _virThreadPoolOwner {
+    const void *id;
+    size_t running;
 
-struct _virThreadPoolJobList {
     virThreadPoolJobPtr head;
     virThreadPoolJobPtr tail;
-    virThreadPoolJobPtr firstPrio;
+
+    /* Ring of owners with queued jobs and as many running */
+    virThreadPoolOwnerPtr prev;
+    virThreadPoolOwnerPtr next;
 };
 
 
@@ -59,7 +85,19 @@ struct _virThreadPool {
 
     virThreadPoolJobFunc jobFunc;
     void *jobOpaque;
-    virThreadPoolJobList jobList;
+
+    /* Owners with queued or running jobs, by id. Jobs sent without
+     * an owner share anonOwner, since hash keys can't be NULL */
+    virHashTablePtr owners;
+    virThreadPoolOwnerPtr anonOwner;
+
+    /* Rings of owners with queued jobs, indexed by the number of jobs
+     * they have running, which is at most the number of workers */
+    virThreadPoolOwnerPtr *rings;
+    size_t nrings;
+
+    virThreadPoolJobPtr prioHead;
+    virThreadPoolJobPtr prioTail;
     size_t jobQueueDepth;
 
     virMutex mutex;
@@ -74,6 +112,12 @@ struct _virThreadPool {
     size_t nPrioWorkers;
     virThreadPtr prioWorkers;
     virCond prioCond;
+
+    /* Counters reported by virThreadPoolGetStats */
+    size_t maxQueueDepth;
+    unsigned long long jobsDone;
+    unsigned long long waitTotal;
+    unsigned long long waitMax;
 };
 
 struct virThreadPoolWorkerData {
@@ -82,6 +126,212 @@ struct virThreadPoolWorkerData {
     bool priority;
 };
 
+
+/* Owners are hashed by the address identifying them */
+static uint32_t
+virThreadPoolOwnerCode(const void *id, uint32_t seed)
+{
+    return virHashCodeGen(&id, sizeof(id), seed);
+}
+
+static bool
+virThreadPoolOwnerEqual(const void *ida, const void *idb)
+{
+    return ida == idb;
+}
+
+static void *
+virThreadPoolOwnerCopy(const void *id)
+{
+    return (void *)id;
+}
+
+static void
+virThreadPoolOwnerFree(void *payload,
+                       const void *id ATTRIBUTE_UNUSED)
+{
+    virThreadPoolOwnerPtr owner = payload;
+    virThreadPoolJobPtr job;
+
+    while ((job = owner->head)) {
+        owner->head = job->next;
+        VIR_FREE(job);
+    }
+    VIR_FREE(owner);
+}
+
+static virThreadPoolOwnerPtr
+virThreadPoolOwnerGet(virThreadPoolPtr pool,
+                      const void *id)
+{
+    virThreadPoolOwnerPtr owner;
+
+    if (id)
+        owner = virHashLookup(pool->owners, id);
+    else
+        owner = pool->anonOwner;
+    if (owner)
+        return owner;
+
+    if (VIR_ALLOC(owner) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    owner->id = id;
+
+    if (!id) {
+        pool->anonOwner = owner;
+    } else if (virHashAddEntry(pool->owners, id, owner) < 0) {
+        VIR_FREE(owner);
+        return NULL;
+    }
+
+    return owner;
+}
+
+/* Free @owner once it has no job left */
+static void
+virThreadPoolOwnerRelease(virThreadPoolPtr pool,
+                          virThreadPoolOwnerPtr owner)
+{
+    if (owner->head || owner->running)
+        return;
+
+    if (owner->id) {
+        virHashRemoveEntry(pool->owners, owner->id);
+    } else {
+        pool->anonOwner = NULL;
+        virThreadPoolOwnerFree(owner, NULL);
+    }
+}
+
+/* Add @owner at the end of the ring for its number of running jobs */
+static void
+virThreadPoolOwnerQueue(virThreadPoolPtr pool,
+                        virThreadPoolOwnerPtr owner)
+{
+    virThreadPoolOwnerPtr *ring = &pool->rings[owner->running];
+
+    if (*ring) {
+        owner->next = *ring;
+        owner->prev = (*ring)->prev;
+        owner->prev->next = owner;
+        (*ring)->prev = owner;
+    } else {
+        *ring = owner->next = owner->prev = owner;
+    }
+}
+
+static void
+virThreadPoolOwnerUnqueue(virThreadPoolPtr pool,
+                          virThreadPoolOwnerPtr owner)
+{
+    virThreadPoolOwnerPtr *ring = &pool->rings[owner->running];
+
+    if (owner->next == owner) {
+        *ring = NULL;
+    } else {
+        owner->prev->next = owner->next;
+        owner->next->prev = owner->prev;
+        if (*ring == owner)
+            *ring = owner->next;
+    }
+    owner->next = owner->prev = NULL;
+}
+
+/* Account for a job of @owner starting if @delta is 1, or
+ * ending if it is -1, moving it to the matching ring */
+static void
+virThreadPoolOwnerRunning(virThreadPoolPtr pool,
+                          virThreadPoolOwnerPtr owner,
+                          int delta)
+{
+    if (owner->head)
+        virThreadPoolOwnerUnqueue(pool, owner);
+    owner->running += delta;
+    if (owner->head)
+        virThreadPoolOwnerQueue(pool, owner);
+}
+
+static void
+virThreadPoolJobAppend(virThreadPoolPtr pool,
+                       virThreadPoolJobPtr job)
+{
+    virThreadPoolOwnerPtr owner = job->owner;
+
+    job->prev = owner->tail;
+    if (owner->tail)
+        owner->tail->next = job;
+    owner->tail = job;
+
+    if (!owner->head) {
+        owner->head = job;
+
+        /* New owners get their turn after everyone else's */
+        virThreadPoolOwnerQueue(pool, owner);
+    }
+
+    if (job->priority) {
+        job->prevPrio = pool->prioTail;
+        if (pool->prioTail)
+            pool->prioTail->nextPrio = job;
+        pool->prioTail = job;
+        if (!pool->prioHead)
+            pool->prioHead = job;
+    }
+}
+
+static void
+virThreadPoolJobRemove(virThreadPoolPtr pool,
+                       virThreadPoolJobPtr job)
+{
+    virThreadPoolOwnerPtr owner = job->owner;
+
+    if (job->prev)
+        job->prev->next = job->next;
+    else
+        owner->head = job->next;
+    if (job->next)
+        job->next->prev = job->prev;
+    else
+        owner->tail = job->prev;
+
+    if (!owner->head)
+        virThreadPoolOwnerUnqueue(pool, owner);
+
+    if (job->priority) {
+        if (job->prevPrio)
+            job->prevPrio->nextPrio = job->nextPrio;
+        else
+            pool->prioHead = job->nextPrio;
+        if (job->nextPrio)
+            job->nextPrio->prevPrio = job->prevPrio;
+        else
+            pool->prioTail = job->prevPrio;
+    }
+}
+
+/* Pick the oldest job of the owner with the fewest jobs running.
+ * Owners on par are served in turn, since each one leaves its ring
+ * for the end of the next one once the job starts. Only as many rings
+ * as there are workers are looked at, whatever the number of owners */
+static virThreadPoolJobPtr
+virThreadPoolJobNext(virThreadPoolPtr pool)
+{
+    size_t i;
+
+    for (i = 0; i < pool->nrings; i++) {
+        if (pool->rings[i])
+            return pool->rings[i]->head;
+    }
+
+    virThreadPoolError(VIR_ERR_INTERNAL_ERROR,
+                       _("%zu jobs queued but no owner has any"),
+                       pool->jobQueueDepth);
+    return NULL;
+}
+
 static void virThreadPoolWorker(void *opaque)
 {
     struct virThreadPoolWorkerData *data = opaque;
@@ -89,6 +339,8 @@ static void virThreadPoolWorker(void *opaque)
     virCondPtr cond = data->cond;
     bool priority = data->priority;
     virThreadPoolJobPtr job = NULL;
+    virThreadPoolOwnerPtr owner;
+    unsigned long long now;
 
     VIR_FREE(data);
 
@@ -96,8 +348,8 @@ static void virThreadPoolWorker(void *opaque)
 
     while (1) {
         while (!pool->quit &&
-               ((!priority && !pool->jobList.head) ||
-                (priority && !pool->jobList.firstPrio))) {
+               ((!priority && !pool->jobQueueDepth) ||
+                (priority && !pool->prioHead))) {
             if (!priority)
                 pool->freeWorkers++;
             if (virCondWait(cond, &pool->mutex) < 0) {
@@ -112,38 +364,30 @@ static void virThreadPoolWorker(void *opaque)
         if (pool->quit)
             break;
 
-        if (priority) {
-            job = pool->jobList.firstPrio;
-        } else {
-            job = pool->jobList.head;
-        }
+        if (priority)
+            job = pool->prioHead;
+        else if (!(job = virThreadPoolJobNext(pool)))
+            goto out;
 
-        if (job == pool->jobList.firstPrio) {
-            virThreadPoolJobPtr tmp = job->next;
-            while (tmp) {
-                if (tmp->priority) {
-                    break;
-                }
-                tmp = tmp->next;
-            }
-            pool->jobList.firstPrio = tmp;
-        }
-
-        if (job->prev)
-            job->prev->next = job->next;
-        else
-            pool->jobList.head = job->next;
-        if (job->next)
-            job->next->prev = job->prev;
-        else
-            pool->jobList.tail = job->prev;
+        owner = job->owner;
+        virThreadPoolJobRemove(pool, job);
+        virThreadPoolOwnerRunning(pool, owner, 1);
 
         pool->jobQueueDepth--;
+        if (virTimeMillisNowRaw(&now) == 0 && now > job->queued) {
+            pool->waitTotal += now - job->queued;
+            if (now - job->queued > pool->waitMax)
+                pool->waitMax = now - job->queued;
+        }
 
         virMutexUnlock(&pool->mutex);
         (pool->jobFunc)(job->data, pool->jobOpaque);
         VIR_FREE(job);
         virMutexLock(&pool->mutex);
+
+        pool->jobsDone++;
+        virThreadPoolOwnerRunning(pool, owner, -1);
+        virThreadPoolOwnerRelease(pool, owner);
     }
 
 out:
@@ -174,8 +418,6 @@ virThreadPoolPtr virThreadPoolNew(size_t minWorkers,
         return NULL;
     }
 
-    pool->jobList.tail = pool->jobList.head = NULL;
-
     pool->jobFunc = func;
     pool->jobOpaque = opaque;
 
@@ -186,6 +428,17 @@ virThreadPoolPtr virThreadPoolNew(size_t minWorkers,
     if (virCondInit(&pool->quit_cond) < 0)
         goto error;
 
+    if (!(pool->owners = virHashCreateFull(50, virThreadPoolOwnerFree,
+                                           virThreadPoolOwnerCode,
+                                           virThreadPoolOwnerEqual,
+                                           virThreadPoolOwnerCopy,
+                                           NULL)))
+        goto error;
+
+    pool->nrings = maxWorkers + prioWorkers + 1;
+    if (VIR_ALLOC_N(pool->rings, pool->nrings) < 0)
+        goto error;
+
     if (VIR_ALLOC_N(pool->workers, minWorkers) < 0)
         goto error;
 
@@ -243,7 +496,6 @@ error:
 
 void virThreadPoolFree(virThreadPoolPtr pool)
 {
-    virThreadPoolJobPtr job;
     bool priority = false;
 
     if (!pool)
@@ -261,10 +513,10 @@ void virThreadPoolFree(virThreadPoolPtr pool)
     while (pool->nWorkers > 0 || pool->nPrioWorkers > 0)
         ignore_value(virCondWait(&pool->quit_cond, &pool->mutex));
 
-    while ((job = pool->jobList.head)) {
-        pool->jobList.head = pool->jobList.head->next;
-        VIR_FREE(job);
-    }
+    virHashFree(pool->owners);
+    if (pool->anonOwner)
+        virThreadPoolOwnerFree(pool->anonOwner, NULL);
+    VIR_FREE(pool->rings);
 
     VIR_FREE(pool->workers);
     virMutexUnlock(&pool->mutex);
@@ -285,6 +537,24 @@ void virThreadPoolFree(virThreadPoolPtr pool)
 int virThreadPoolSendJob(virThreadPoolPtr pool,
                          unsigned int priority,
                          void *jobData)
+{
+    return virThreadPoolSendOwnedJob(pool, NULL, priority, jobData);
+}
+
+/*
+ * @owner - opaque identifier of who the job is run for
+ * @priority - job priority
+ *
+ * Like virThreadPoolSendJob, but the job only competes in order with
+ * the other jobs of @owner. Idle workers take jobs from the owners
+ * with the fewest jobs running first, in turn.
+ *
+ * Return: 0 on success, -1 otherwise
+ */
+int virThreadPoolSendOwnedJob(virThreadPoolPtr pool,
+                              const void *owner,
+                              unsigned int priority,
+                              void *jobData)
 {
     virThreadPoolJobPtr job;
     struct virThreadPoolWorkerData *data = NULL;
@@ -324,23 +594,25 @@ int virThreadPoolSendJob(virThreadPoolPtr pool,
         goto error;
     }
 
+    if (!(job->owner = virThreadPoolOwnerGet(pool, owner))) {
+        VIR_FREE(job);
+        goto error;
+    }
+
     job->data = jobData;
     job->priority = priority;
+    if (virTimeMillisNowRaw(&job->queued) < 0)
+        job->queued = 0;
 
-    job->prev = pool->jobList.tail;
-    if (pool->jobList.tail)
-        pool->jobList.tail->next = job;
-    pool->jobList.tail = job;
-
-    if (!pool->jobList.head)
-        pool->jobList.head = job;
-
-    if (priority && !pool->jobList.firstPrio)
-        pool->jobList.firstPrio = job;
+    virThreadPoolJobAppend(pool, job);
 
     pool->jobQueueDepth++;
+    if (pool->jobQueueDepth > pool->maxQueueDepth)
+        pool->maxQueueDepth = pool->jobQueueDepth;
 
-    virCondSignal(&pool->cond);
+    /* Nobody to wake up if all the workers are busy */
+    if (pool->freeWorkers)
+        virCondSignal(&pool->cond);
     if (priority)
         virCondSignal(&pool->prioCond);
 
@@ -351,3 +623,19 @@ error:
     virMutexUnlock(&pool->mutex);
     return -1;
 }
+
+
+void virThreadPoolGetStats(virThreadPoolPtr pool,
+                           virThreadPoolStatsPtr stats)
+{
+    virMutexLock(&pool->mutex);
+    stats->workers = pool->nWorkers;
+    stats->maxWorkers = pool->maxWorkers;
+    stats->freeWorkers = pool->freeWorkers;
+    stats->queueDepth = pool->jobQueueDepth;
+    stats->maxQueueDepth = pool->maxQueueDepth;
+    stats->jobs = pool->jobsDone;
+    stats->waitTotal = pool->waitTotal;
+    stats->waitMax = pool->waitMax;
+    virMutexUnlock(&pool->mutex);
+}
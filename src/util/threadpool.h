@@ -33,6 +33,19 @@ typedef virThreadPool *virThreadPoolPtr;
 
 typedef void (*virThreadPoolJobFunc)(void *jobdata, void *opaque);
 
+typedef struct _virThreadPoolStats virThreadPoolStats;
+typedef virThreadPoolStats *virThreadPoolStatsPtr;
+struct _virThreadPoolStats {
+    size_t workers;             /* current number of workers */
+    size_t maxWorkers;          /* most workers the pool may start */
+    size_t freeWorkers;         /* workers waiting for a job */
+    size_t queueDepth;          /* jobs waiting for a worker */
+    size_t maxQueueDepth;       /* highest queueDepth so far */
+    unsigned long long jobs;    /* jobs completed */
+    unsigned long long waitTotal; /* time spent queued by all jobs, in ms */
+    unsigned long long waitMax; /* longest time a job spent queued, in ms */
+};
+
 virThreadPoolPtr virThreadPoolNew(size_t minWorkers,
                                   size_t maxWorkers,
                                   size_t prioWorkers,
@@ -46,4 +59,14 @@ int virThreadPoolSendJob(virThreadPoolPtr pool,
                          void *jobdata) ATTRIBUTE_NONNULL(1)
                                         ATTRIBUTE_RETURN_CHECK;
 
+int virThreadPoolSendOwnedJob(virThreadPoolPtr pool,
+                              const void *owner,
+                              unsigned int priority,
+                              void *jobdata) ATTRIBUTE_NONNULL(1)
+                                             ATTRIBUTE_RETURN_CHECK;
+
+void virThreadPoolGetStats(virThreadPoolPtr pool,
+                           virThreadPoolStatsPtr stats)
+    ATTRIBUTE_NONNULL(1) ATTRIBUTE_NONNULL(2);
+
 #endif
@@ -207,6 +207,25 @@ int safezero(int fd, off_t offset, off_t len)
 # endif /* HAVE_MMAP */
 #endif /* HAVE_POSIX_FALLOCATE */
 
+/* Whether all of the @len bytes at @buf are zero */
+bool
+virMemIsZero(const void *buf, size_t len)
+{
+    const char *p = buf;
+    size_t i;
+
+    /* Once the first bytes are known to be zero, comparing the buffer
+     * with itself shifted by as many bytes lets memcmp check the rest */
+    for (i = 0; i < 16; i++) {
+        if (i == len)
+            return true;
+        if (p[i])
+            return false;
+    }
+
+    return memcmp(p, p + 16, len - 16) == 0;
+}
+
 int virFileStripSuffix(char *str,
                        const char *suffix)
 {
@@ -361,6 +361,102 @@ int virFileUnlock(int fd ATTRIBUTE_UNUSED,
 }
 #endif
 
+
+/**
+ * virFileInData:
+ * @fd: file descriptor of a regular file
+ * @inData: set to whether the current position is in data
+ * @length: set to the number of bytes left in that data or hole
+ *
+ * Find out whether the current position of @fd is in data or in a
+ * hole of a sparse file, and up to where. At the end of the file,
+ * @inData is true and @length 0. Everything is data for platforms
+ * and filesystems which can't tell. The position is left unchanged.
+ *
+ * Returns 0 on success, or -1 with an error reported
+ */
+int virFileInData(int fd, bool *inData, unsigned long long *length)
+{
+    off_t cur, end;
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    off_t next;
+#endif
+
+    if ((cur = lseek(fd, 0, SEEK_CUR)) < 0 ||
+        (end = lseek(fd, 0, SEEK_END)) < 0) {
+        virReportSystemError(errno, "%s", _("unable to seek in file"));
+        return -1;
+    }
+
+    *inData = true;
+    *length = cur < end ? end - cur : 0;
+
+#if defined(SEEK_DATA) && defined(SEEK_HOLE)
+    if (*length) {
+        if ((next = lseek(fd, cur, SEEK_DATA)) < 0) {
+            /* ENXIO means the file ends with a hole */
+            if (errno == ENXIO) {
+                *inData = false;
+            } else if (errno != EINVAL) {
+                virReportSystemError(errno, "%s",
+                                     _("unable to find data in file"));
+                return -1;
+            }
+        } else if (next > cur) {
+            *inData = false;
+            *length = next - cur;
+        } else {
+            /* There's always a hole at the end of the file */
+            if ((next = lseek(fd, cur, SEEK_HOLE)) < 0) {
+                virReportSystemError(errno, "%s",
+                                     _("unable to find hole in file"));
+                return -1;
+            }
+            *length = next - cur;
+        }
+    }
+#endif
+
+    if (lseek(fd, cur, SEEK_SET) < 0) {
+        virReportSystemError(errno, "%s", _("unable to seek in file"));
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/**
+ * virFilePunchHole:
+ * @fd: file descriptor of a regular file
+ * @offset: start of the range to deallocate
+ * @len: length of the range
+ *
+ * Deallocate a range of a file, which then reads back as zeroes
+ * without taking any space. The size of the file doesn't change.
+ *
+ * Returns 0 on success, or -errno otherwise, -ENOSYS and
+ * -EOPNOTSUPP meaning that it isn't supported
+ */
+#if HAVE_FALLOCATE && defined(FALLOC_FL_PUNCH_HOLE) && \
+    defined(FALLOC_FL_KEEP_SIZE)
+int virFilePunchHole(int fd, off_t offset, off_t len)
+{
+    if (fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                  offset, len) < 0)
+        return -errno;
+
+    return 0;
+}
+#else
+int virFilePunchHole(int fd ATTRIBUTE_UNUSED,
+                     off_t offset ATTRIBUTE_UNUSED,
+                     off_t len ATTRIBUTE_UNUSED)
+{
+    return -ENOSYS;
+}
+#endif
+
 int
 virFileRewrite(const char *path,
                mode_t mode,
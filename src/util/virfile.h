@@ -75,6 +75,9 @@ void virFileWrapperFdFree(virFileWrapperFdPtr dfd);
 int virFileLock(int fd, bool shared, off_t start, off_t len);
 int virFileUnlock(int fd, off_t start, off_t len);
 
+int virFileInData(int fd, bool *inData, unsigned long long *length);
+int virFilePunchHole(int fd, off_t offset, off_t len);
+
 typedef int (*virFileRewriteFunc)(int fd, void *opaque);
 int virFileRewrite(const char *path,
                    mode_t mode,
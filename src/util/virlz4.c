@@ -0,0 +1,676 @@
+/*
+ * virlz4.c: multi-threaded LZ4 frame compression of fd streams
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#include <config.h>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+
+#ifdef HAVE_LZ4
+# include <lz4frame.h>
+#endif
+
+#include "virlz4.h"
+#include "logging.h"
+#include "memory.h"
+#include "threads.h"
+#include "util.h"
+#include "virfile.h"
+#include "virterror_internal.h"
+
+#define VIR_FROM_THIS VIR_FROM_NONE
+
+#define virLZ4Error(code, ...)                                         \
+    virReportErrorHelper(VIR_FROM_NONE, code, __FILE__,                 \
+                         __FUNCTION__, __LINE__, __VA_ARGS__)
+
+#ifdef HAVE_LZ4
+
+/*
+ * Streams are sequences of LZ4 frames, as the lz4 program writes one
+ * and reads any number of. When compressing, every block of the input
+ * is made a frame of its own, with a checksum of its content, so that
+ * worker threads can each take one while a reader and a writer thread
+ * keep them in order. Decompressing is much faster than compressing
+ * and done by the reader thread alone.
+ *
+ * A stream cut right between two frames still decompresses, to less
+ * than what was compressed. Save images and dumps are migration
+ * streams, which QEMU refuses to load when they miss their end.
+ */
+
+/* The matches of LZ4 can only reach 64 KiB back, so larger blocks
+ * hardly compress better and 256 KiB keeps the memory of the blocks
+ * in flight low */
+# define LZ4_STREAM_BLOCK_SIZE      (256 * 1024)
+
+/* Threads compressing by default, each with two blocks in flight */
+# define LZ4_STREAM_MAX_THREADS     4
+
+typedef enum {
+    VIR_LZ4_BLOCK_FREE,
+    VIR_LZ4_BLOCK_QUEUED,       /* Read, waiting for a worker */
+    VIR_LZ4_BLOCK_DONE,         /* Compressed, waiting for the writer */
+} virLZ4BlockState;
+
+typedef struct _virLZ4Block virLZ4Block;
+typedef virLZ4Block *virLZ4BlockPtr;
+
+struct _virLZ4Block {
+    virLZ4BlockState state;
+
+    unsigned char *in;
+    size_t inlen;
+    unsigned char *out;
+    size_t outlen;
+};
+
+struct _virLZ4Stream {
+    virMutex lock;
+    virCond cond;
+
+    bool decompress;
+    int infd;
+    int outfd;
+    /* Written to once the stream fails, to stop a waiting reader */
+    int wakeupfd[2];
+
+    LZ4F_preferences_t prefs;
+    size_t outSize;             /* Of a compressed block at most */
+
+    /* Ring of blocks, indexed by their number modulo nblocks */
+    virLZ4BlockPtr blocks;
+    size_t nblocks;
+    unsigned long long nread;
+    unsigned long long nworked;
+    unsigned long long nwritten;
+    bool eof;                   /* No more blocks to read */
+
+    unsigned long long inbytes;
+    unsigned long long outbytes;
+
+    /* Reader, writer and workers */
+    virThreadPtr threads;
+    size_t nthreads;
+    size_t nworkers;
+    bool joined;
+
+    /* The first failure */
+    int err;
+    const char *errmsg;
+};
+
+
+/* Called with the lock held */
+static void
+virLZ4StreamFail(virLZ4StreamPtr st, int err, const char *msg)
+{
+    char c = 0;
+
+    if (st->errmsg)
+        return;
+
+    st->err = err;
+    st->errmsg = msg;
+    virCondBroadcast(&st->cond);
+    ignore_value(safewrite(st->wakeupfd[1], &c, 1));
+}
+
+static void
+virLZ4StreamFailUnlocked(virLZ4StreamPtr st, int err, const char *msg)
+{
+    virMutexLock(&st->lock);
+    virLZ4StreamFail(st, err, msg);
+    virMutexUnlock(&st->lock);
+}
+
+/*
+ * Read up to @len bytes of input, less only at its end. Returns the
+ * number of bytes read, or -1 once the stream failed.
+ */
+static ssize_t
+virLZ4StreamRead(virLZ4StreamPtr st, void *buf, size_t len)
+{
+    size_t got = 0;
+
+    while (got < len) {
+        struct pollfd fds[2];
+        ssize_t rc;
+
+        fds[0].fd = st->infd;
+        fds[0].events = POLLIN;
+        fds[0].revents = 0;
+        fds[1].fd = st->wakeupfd[0];
+        fds[1].events = POLLIN;
+        fds[1].revents = 0;
+
+        if (poll(fds, ARRAY_CARDINALITY(fds), -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            virLZ4StreamFailUnlocked(st, errno, _("unable to poll stream"));
+            return -1;
+        }
+        if (fds[1].revents)
+            return -1;
+
+        if ((rc = read(st->infd, (char *)buf + got, len - got)) < 0) {
+            if (errno == EINTR || errno == EAGAIN)
+                continue;
+            virLZ4StreamFailUnlocked(st, errno, _("unable to read stream"));
+            return -1;
+        }
+        if (rc == 0)
+            break;
+        got += rc;
+    }
+
+    st->inbytes += got;
+    return got;
+}
+
+static int
+virLZ4StreamWrite(virLZ4StreamPtr st, const void *buf, size_t len)
+{
+    if (safewrite(st->outfd, buf, len) < 0) {
+        virLZ4StreamFailUnlocked(st, errno, _("unable to write stream"));
+        return -1;
+    }
+    st->outbytes += len;
+    return 0;
+}
+
+static int
+virLZ4StreamAllocBlocks(virLZ4StreamPtr st)
+{
+    size_t i;
+
+    for (i = 0; i < st->nblocks; i++) {
+        if (VIR_ALLOC_N(st->blocks[i].in, LZ4_STREAM_BLOCK_SIZE) < 0 ||
+            VIR_ALLOC_N(st->blocks[i].out, st->outSize) < 0) {
+            virLZ4StreamFailUnlocked(st, ENOMEM,
+                                     _("unable to allocate stream blocks"));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* Wait for the block to read next to be free. Returns NULL once the
+ * stream failed */
+static virLZ4BlockPtr
+virLZ4StreamNextFree(virLZ4StreamPtr st)
+{
+    virLZ4BlockPtr block;
+
+    virMutexLock(&st->lock);
+    block = &st->blocks[st->nread % st->nblocks];
+    while (!st->errmsg && block->state != VIR_LZ4_BLOCK_FREE)
+        ignore_value(virCondWait(&st->cond, &st->lock));
+    if (st->errmsg)
+        block = NULL;
+    virMutexUnlock(&st->lock);
+
+    return block;
+}
+
+static void
+virLZ4StreamQueue(virLZ4StreamPtr st, virLZ4BlockPtr block, bool eof)
+{
+    virMutexLock(&st->lock);
+    if (block) {
+        block->state = VIR_LZ4_BLOCK_QUEUED;
+        st->nread++;
+    }
+    st->eof = eof;
+    virCondBroadcast(&st->cond);
+    virMutexUnlock(&st->lock);
+}
+
+static void
+virLZ4StreamReadContent(virLZ4StreamPtr st)
+{
+    if (virLZ4StreamAllocBlocks(st) < 0)
+        return;
+
+    for (;;) {
+        virLZ4BlockPtr block;
+        ssize_t got;
+
+        if (!(block = virLZ4StreamNextFree(st)) ||
+            (got = virLZ4StreamRead(st, block->in,
+                                    LZ4_STREAM_BLOCK_SIZE)) < 0)
+            return;
+
+        block->inlen = got;
+        /* Reads are only short at the end. Even empty input makes a
+         * frame, which the lz4 program wants to see */
+        virLZ4StreamQueue(st, got || !st->nread ? block : NULL,
+                          got < LZ4_STREAM_BLOCK_SIZE);
+        if (got < LZ4_STREAM_BLOCK_SIZE)
+            return;
+    }
+}
+
+/* Decompress all frames of the input straight to the output */
+static void
+virLZ4StreamDecompress(virLZ4StreamPtr st)
+{
+    LZ4F_dctx *dctx = NULL;
+    unsigned char *in = NULL;
+    unsigned char *out = NULL;
+    /* What LZ4F_decompress expects next, 0 at the end of a frame */
+    size_t hint = 1;
+    LZ4F_errorCode_t rc;
+
+    if (VIR_ALLOC_N(in, LZ4_STREAM_BLOCK_SIZE) < 0 ||
+        VIR_ALLOC_N(out, LZ4_STREAM_BLOCK_SIZE) < 0) {
+        virLZ4StreamFailUnlocked(st, ENOMEM,
+                                 _("unable to allocate stream blocks"));
+        goto cleanup;
+    }
+
+    if (LZ4F_isError(rc = LZ4F_createDecompressionContext(&dctx,
+                                                          LZ4F_VERSION))) {
+        VIR_DEBUG("stream=%p %s", st, LZ4F_getErrorName(rc));
+        virLZ4StreamFailUnlocked(st, ENOMEM,
+                                 _("unable to allocate stream context"));
+        goto cleanup;
+    }
+
+    for (;;) {
+        size_t inpos = 0;
+        size_t outlen;
+        ssize_t got;
+
+        if ((got = virLZ4StreamRead(st, in, LZ4_STREAM_BLOCK_SIZE)) < 0)
+            goto cleanup;
+        if (got == 0)
+            break;
+
+        /* The output may not fit at once, and be left to flush after
+         * all of the input was taken, until nothing more comes out */
+        do {
+            size_t inlen = got - inpos;
+
+            outlen = LZ4_STREAM_BLOCK_SIZE;
+            rc = LZ4F_decompress(dctx, out, &outlen,
+                                 in + inpos, &inlen, NULL);
+            if (LZ4F_isError(rc)) {
+                VIR_DEBUG("stream=%p %s", st, LZ4F_getErrorName(rc));
+                virLZ4StreamFailUnlocked(st, 0, _("corrupt LZ4 stream"));
+                goto cleanup;
+            }
+            if (inlen == 0 && outlen == 0)
+                break;
+            inpos += inlen;
+            hint = rc;
+
+            if (outlen && virLZ4StreamWrite(st, out, outlen) < 0)
+                goto cleanup;
+        } while (inpos < got || outlen == LZ4_STREAM_BLOCK_SIZE);
+    }
+
+    if (hint != 0 || st->inbytes == 0) {
+        virLZ4StreamFailUnlocked(st, 0, _("LZ4 stream ends unexpectedly"));
+        goto cleanup;
+    }
+
+    VIR_DEBUG("stream=%p done, read=%llu written=%llu",
+              st, st->inbytes, st->outbytes);
+
+cleanup:
+    LZ4F_freeDecompressionContext(dctx);
+    VIR_FREE(in);
+    VIR_FREE(out);
+    /* Whoever reads the stream sees its end */
+    VIR_FORCE_CLOSE(st->outfd);
+}
+
+static void
+virLZ4StreamReader(void *opaque)
+{
+    virLZ4StreamPtr st = opaque;
+
+    if (st->decompress)
+        virLZ4StreamDecompress(st);
+    else
+        virLZ4StreamReadContent(st);
+
+    /* Whoever writes to the stream learns it's not read anymore */
+    VIR_FORCE_CLOSE(st->infd);
+}
+
+static void
+virLZ4StreamWorker(void *opaque)
+{
+    virLZ4StreamPtr st = opaque;
+
+    virMutexLock(&st->lock);
+    for (;;) {
+        virLZ4BlockPtr block;
+        size_t len;
+
+        while (!st->errmsg && st->nworked == st->nread && !st->eof)
+            ignore_value(virCondWait(&st->cond, &st->lock));
+        if (st->errmsg || st->nworked == st->nread)
+            break;
+
+        block = &st->blocks[st->nworked++ % st->nblocks];
+        virMutexUnlock(&st->lock);
+
+        len = LZ4F_compressFrame(block->out, st->outSize,
+                                 block->in, block->inlen, &st->prefs);
+
+        virMutexLock(&st->lock);
+        if (LZ4F_isError(len)) {
+            VIR_DEBUG("stream=%p %s", st, LZ4F_getErrorName(len));
+            virLZ4StreamFail(st, 0, _("unable to compress LZ4 stream"));
+            break;
+        }
+        block->outlen = len;
+        block->state = VIR_LZ4_BLOCK_DONE;
+        virCondBroadcast(&st->cond);
+    }
+    virMutexUnlock(&st->lock);
+}
+
+static void
+virLZ4StreamWriter(void *opaque)
+{
+    virLZ4StreamPtr st = opaque;
+
+    virMutexLock(&st->lock);
+    for (;;) {
+        virLZ4BlockPtr block = &st->blocks[st->nwritten % st->nblocks];
+        int rc;
+
+        while (!st->errmsg && block->state != VIR_LZ4_BLOCK_DONE &&
+               !(st->eof && st->nwritten == st->nread))
+            ignore_value(virCondWait(&st->cond, &st->lock));
+        if (st->errmsg)
+            break;
+
+        if (block->state != VIR_LZ4_BLOCK_DONE) {
+            VIR_DEBUG("stream=%p done, read=%llu written=%llu",
+                      st, st->inbytes, st->outbytes);
+            break;
+        }
+        virMutexUnlock(&st->lock);
+
+        rc = virLZ4StreamWrite(st, block->out, block->outlen);
+
+        virMutexLock(&st->lock);
+        if (rc < 0)
+            break;
+        block->state = VIR_LZ4_BLOCK_FREE;
+        st->nwritten++;
+        virCondBroadcast(&st->cond);
+    }
+    virMutexUnlock(&st->lock);
+
+    /* Whoever reads the stream sees its end */
+    VIR_FORCE_CLOSE(st->outfd);
+}
+
+
+static size_t
+virLZ4StreamDefaultThreads(void)
+{
+    long ncpus = -1;
+
+# ifdef _SC_NPROCESSORS_ONLN
+    ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+# endif
+
+    if (ncpus < 1)
+        return 1;
+    return MIN(ncpus, LZ4_STREAM_MAX_THREADS);
+}
+
+static void
+virLZ4StreamJoin(virLZ4StreamPtr st)
+{
+    size_t i;
+
+    if (st->joined)
+        return;
+
+    for (i = 0; i < st->nthreads; i++)
+        virThreadJoin(&st->threads[i]);
+    st->joined = true;
+}
+
+/**
+ * virLZ4StreamAvailable:
+ *
+ * Returns true if streams can be compressed in process, false if
+ * libvirt was built without liblz4.
+ */
+bool
+virLZ4StreamAvailable(void)
+{
+    return true;
+}
+
+/**
+ * virLZ4StreamNew:
+ * @infd: file descriptor to read from
+ * @outfd: file descriptor to write to
+ * @nthreads: number of threads compressing, 0 for one per CPU online
+ *            up to a few
+ * @flags: bitwise-OR of virLZ4StreamFlags
+ *
+ * Start compressing everything read from @infd until its end as LZ4
+ * frames written to @outfd, or with VIR_LZ4_STREAM_DECOMPRESS,
+ * decompressing LZ4 frames read from @infd by a single thread. The
+ * lz4 program reads and writes the same frames. This all happens in
+ * threads, using duplicates of @infd and @outfd, which are closed as
+ * soon as they aren't needed anymore, so that the caller may close its
+ * own.
+ *
+ * Returns the new stream, to be waited for with virLZ4StreamWait(),
+ * or NULL on failure with an error reported.
+ */
+virLZ4StreamPtr
+virLZ4StreamNew(int infd, int outfd, unsigned int nthreads,
+                unsigned int flags)
+{
+    virLZ4StreamPtr st;
+    size_t i;
+
+    virCheckFlags(VIR_LZ4_STREAM_DECOMPRESS, NULL);
+
+    if (VIR_ALLOC(st) < 0) {
+        virReportOOMError();
+        return NULL;
+    }
+
+    if (virMutexInit(&st->lock) < 0) {
+        VIR_FREE(st);
+        virLZ4Error(VIR_ERR_INTERNAL_ERROR, "%s",
+                    _("unable to init mutex"));
+        return NULL;
+    }
+    if (virCondInit(&st->cond) < 0) {
+        virMutexDestroy(&st->lock);
+        VIR_FREE(st);
+        virLZ4Error(VIR_ERR_INTERNAL_ERROR, "%s",
+                    _("unable to init condition variable"));
+        return NULL;
+    }
+
+    st->decompress = !!(flags & VIR_LZ4_STREAM_DECOMPRESS);
+    st->infd = st->outfd = st->wakeupfd[0] = st->wakeupfd[1] = -1;
+    if (!st->decompress) {
+        st->nworkers = nthreads ? nthreads : virLZ4StreamDefaultThreads();
+        st->nblocks = 2 * st->nworkers;
+    }
+
+    st->prefs.frameInfo.blockSizeID = LZ4F_max256KB;
+    st->prefs.frameInfo.blockMode = LZ4F_blockIndependent;
+    st->prefs.frameInfo.contentChecksumFlag = LZ4F_contentChecksumEnabled;
+    st->outSize = LZ4F_compressFrameBound(LZ4_STREAM_BLOCK_SIZE, &st->prefs);
+
+    if ((st->infd = dup(infd)) < 0 ||
+        virSetCloseExec(st->infd) < 0 ||
+        (st->outfd = dup(outfd)) < 0 ||
+        virSetCloseExec(st->outfd) < 0) {
+        virReportSystemError(errno, "%s",
+                             _("unable to duplicate stream file descriptor"));
+        goto error;
+    }
+    if (pipe2(st->wakeupfd, O_CLOEXEC) < 0) {
+        virReportSystemError(errno, "%s", _("unable to create pipe"));
+        goto error;
+    }
+
+    if ((st->nblocks && VIR_ALLOC_N(st->blocks, st->nblocks) < 0) ||
+        VIR_ALLOC_N(st->threads, st->nworkers + 2) < 0) {
+        virReportOOMError();
+        goto error;
+    }
+
+    VIR_DEBUG("stream=%p infd=%d outfd=%d workers=%zu decompress=%d",
+              st, infd, outfd, st->nworkers, st->decompress);
+
+    if (virThreadCreate(&st->threads[st->nthreads], true,
+                        virLZ4StreamReader, st) < 0)
+        goto thread_error;
+    st->nthreads++;
+    if (st->decompress)
+        return st;
+
+    if (virThreadCreate(&st->threads[st->nthreads], true,
+                        virLZ4StreamWriter, st) < 0)
+        goto thread_error;
+    st->nthreads++;
+    for (i = 0; i < st->nworkers; i++) {
+        if (virThreadCreate(&st->threads[st->nthreads], true,
+                            virLZ4StreamWorker, st) < 0)
+            goto thread_error;
+        st->nthreads++;
+    }
+
+    return st;
+
+thread_error:
+    virReportSystemError(errno, "%s", _("unable to create stream thread"));
+error:
+    virLZ4StreamFree(st);
+    return NULL;
+}
+
+/**
+ * virLZ4StreamWait:
+ * @st: the stream
+ *
+ * Wait until everything was read from the stream and written out.
+ *
+ * Returns 0 on success, or -1 on failure with an error reported.
+ */
+int
+virLZ4StreamWait(virLZ4StreamPtr st)
+{
+    virLZ4StreamJoin(st);
+
+    if (!st->errmsg)
+        return 0;
+
+    if (st->err)
+        virReportSystemError(st->err, "%s", st->errmsg);
+    else
+        virLZ4Error(VIR_ERR_OPERATION_FAILED, "%s", st->errmsg);
+    return -1;
+}
+
+/**
+ * virLZ4StreamFree:
+ * @st: the stream, or NULL
+ *
+ * Free the stream, stopping it if it wasn't waited for. Writes
+ * to a pipe which isn't read anymore must fail for that, so the
+ * other ends of pipes have to be closed before.
+ */
+void
+virLZ4StreamFree(virLZ4StreamPtr st)
+{
+    size_t i;
+
+    if (!st)
+        return;
+
+    if (!st->joined) {
+        virMutexLock(&st->lock);
+        virLZ4StreamFail(st, ECANCELED, _("stream was aborted"));
+        virMutexUnlock(&st->lock);
+        virLZ4StreamJoin(st);
+    }
+
+    for (i = 0; st->blocks && i < st->nblocks; i++) {
+        VIR_FREE(st->blocks[i].in);
+        VIR_FREE(st->blocks[i].out);
+    }
+    VIR_FREE(st->blocks);
+    VIR_FREE(st->threads);
+    VIR_FORCE_CLOSE(st->infd);
+    VIR_FORCE_CLOSE(st->outfd);
+    VIR_FORCE_CLOSE(st->wakeupfd[0]);
+    VIR_FORCE_CLOSE(st->wakeupfd[1]);
+    ignore_value(virCondDestroy(&st->cond));
+    virMutexDestroy(&st->lock);
+    VIR_FREE(st);
+}
+
+#else /* ! HAVE_LZ4 */
+
+bool
+virLZ4StreamAvailable(void)
+{
+    return false;
+}
+
+virLZ4StreamPtr
+virLZ4StreamNew(int infd ATTRIBUTE_UNUSED,
+                int outfd ATTRIBUTE_UNUSED,
+                unsigned int nthreads ATTRIBUTE_UNUSED,
+                unsigned int flags)
+{
+    virCheckFlags(VIR_LZ4_STREAM_DECOMPRESS, NULL);
+
+    virLZ4Error(VIR_ERR_NO_SUPPORT, "%s",
+                _("LZ4 compression is not available in this build"));
+    return NULL;
+}
+
+int
+virLZ4StreamWait(virLZ4StreamPtr st ATTRIBUTE_UNUSED)
+{
+    virLZ4Error(VIR_ERR_NO_SUPPORT, "%s",
+                _("LZ4 compression is not available in this build"));
+    return -1;
+}
+
+void
+virLZ4StreamFree(virLZ4StreamPtr st ATTRIBUTE_UNUSED)
+{
+}
+
+#endif /* ! HAVE_LZ4 */
@@ -0,0 +1,45 @@
+/*
+ * virlz4.h: multi-threaded LZ4 frame compression of fd streams
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#ifndef __VIR_LZ4_H__
+# define __VIR_LZ4_H__
+
+# include "internal.h"
+
+/* The program writing and reading the same format as the streams,
+ * for whenever compression can't be done in process, as without
+ * liblz4 or when QEMU can't migrate to a file descriptor */
+# define VIR_LZ4_PROGRAM "lz4"
+
+typedef struct _virLZ4Stream virLZ4Stream;
+typedef virLZ4Stream *virLZ4StreamPtr;
+
+typedef enum {
+    VIR_LZ4_STREAM_DECOMPRESS = (1 << 0),
+} virLZ4StreamFlags;
+
+bool virLZ4StreamAvailable(void);
+
+virLZ4StreamPtr virLZ4StreamNew(int infd, int outfd,
+                                unsigned int nthreads,
+                                unsigned int flags);
+int virLZ4StreamWait(virLZ4StreamPtr st);
+void virLZ4StreamFree(virLZ4StreamPtr st);
+
+#endif /* __VIR_LZ4_H__ */
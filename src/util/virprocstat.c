@@ -0,0 +1,345 @@
+/*
+ * virprocstat.c: allocation free parsing of /proc stat files
+ *
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#include <config.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "virprocstat.h"
+#include "c-ctype.h"
+#include "intprops.h"
+#include "threads.h"
+#include "viratomic.h"
+#include "virfile.h"
+
+/* See 'man proc' for the meaning of the fields; numbering starts at 1
+ * with the pid, followed by the command name and the state */
+#define VIR_PROC_STAT_FIELD_FIRST_NUMBER 4
+#define VIR_PROC_STAT_FIELD_UTIME 14
+#define VIR_PROC_STAT_FIELD_STIME 15
+#define VIR_PROC_STAT_FIELD_RSS 24
+#define VIR_PROC_STAT_FIELD_PROCESSOR 39
+
+/* Stat files kept open by virProcStatReadCached for all callers
+ * together, a vCPU thread each, below the default limit of 1024
+ * open files of the daemon. Past it, files are opened for every
+ * read again */
+#define VIR_PROC_STAT_FDS_MAX 256
+
+static virAtomicInt virProcStatFDs;
+static virOnceControl virProcStatFDsOnce = VIR_ONCE_CONTROL_INITIALIZER;
+static bool virProcStatFDsReady;
+
+
+/* Parse a possibly negative decimal number, skipping leading blanks.
+ * Returns a pointer to the first character after the number, or NULL
+ * if there's no number or it doesn't fit in 64 bits. */
+static const char *
+virProcStatParseNumber(const char *p,
+                       unsigned long long *value,
+                       bool *negative)
+{
+    unsigned long long v = 0;
+
+    while (*p == ' ' || *p == '\t')
+        p++;
+
+    *negative = false;
+    if (*p == '-') {
+        *negative = true;
+        p++;
+    }
+
+    if (!c_isdigit(*p))
+        return NULL;
+
+    while (c_isdigit(*p)) {
+        unsigned int digit = *p - '0';
+
+        if (v > (ULLONG_MAX - digit) / 10)
+            return NULL;
+        v = v * 10 + digit;
+        p++;
+    }
+
+    *value = v;
+    return p;
+}
+
+
+/**
+ * virProcStatParse:
+ * @buf: NUL terminated contents of a /proc/<pid>/stat file
+ * @info: filled with the parsed fields
+ *
+ * The command name is skipped by looking for the last closing parenthesis,
+ * so names containing blanks or parentheses are handled correctly.
+ *
+ * Returns 0 on success, -1 with errno set to EINVAL if @buf is malformed
+ */
+int
+virProcStatParse(const char *buf,
+                 virProcStatPtr info)
+{
+    const char *p;
+    int field;
+
+    if (!(p = strrchr(buf, ')')))
+        goto error;
+
+    /* Skip the state, which is a single character */
+    p++;
+    while (*p == ' ')
+        p++;
+    if (!*p)
+        goto error;
+    p++;
+
+    for (field = VIR_PROC_STAT_FIELD_FIRST_NUMBER;
+         field <= VIR_PROC_STAT_FIELD_PROCESSOR;
+         field++) {
+        unsigned long long value;
+        bool negative;
+
+        if (!(p = virProcStatParseNumber(p, &value, &negative)))
+            goto error;
+
+        switch (field) {
+        case VIR_PROC_STAT_FIELD_UTIME:
+            info->utime = value;
+            break;
+        case VIR_PROC_STAT_FIELD_STIME:
+            info->stime = value;
+            break;
+        case VIR_PROC_STAT_FIELD_RSS:
+            info->rss = negative ? -(long)value : (long)value;
+            break;
+        case VIR_PROC_STAT_FIELD_PROCESSOR:
+            info->processor = negative ? -(int)value : (int)value;
+            break;
+        }
+    }
+
+    return 0;
+
+error:
+    errno = EINVAL;
+    return -1;
+}
+
+
+/**
+ * virProcStatParseFields:
+ * @str: string holding blank separated unsigned numbers
+ * @end: if non-NULL, set to the first character that wasn't parsed
+ * @values: array to fill
+ * @nvalues: size of @values
+ *
+ * Parse up to @nvalues numbers from @str, stopping at the first thing
+ * which isn't an unsigned decimal number. This is meant for the lines
+ * of files such as /proc/stat, after the caller skipped their header.
+ *
+ * Returns the number of values parsed
+ */
+int
+virProcStatParseFields(const char *str,
+                       const char **end,
+                       unsigned long long *values,
+                       size_t nvalues)
+{
+    size_t i;
+
+    for (i = 0; i < nvalues; i++) {
+        const char *next;
+        bool negative;
+
+        if (!(next = virProcStatParseNumber(str, &values[i], &negative)) ||
+            negative)
+            break;
+        str = next;
+    }
+
+    if (end)
+        *end = str;
+    return i;
+}
+
+
+static void
+virProcStatFDsInit(void)
+{
+    if (virAtomicIntInit(&virProcStatFDs) < 0)
+        return;
+
+    virProcStatFDsReady = true;
+}
+
+/* Tells whether one more stat file may be kept open */
+static bool
+virProcStatFDReserve(void)
+{
+    if (virOnce(&virProcStatFDsOnce, virProcStatFDsInit) < 0 ||
+        !virProcStatFDsReady)
+        return false;
+
+    if (virAtomicIntInc(&virProcStatFDs) > VIR_PROC_STAT_FDS_MAX) {
+        virAtomicIntDec(&virProcStatFDs);
+        return false;
+    }
+
+    return true;
+}
+
+
+/* Returns a file descriptor for the stat file of @pid, or of its
+ * thread @tid if non-zero, or -1 with errno set */
+static int
+virProcStatOpen(pid_t pid, pid_t tid)
+{
+    char path[sizeof("/proc//task//stat") + 2 * INT_BUFSIZE_BOUND(pid_t)];
+
+    /* In general, we cannot assume pid_t fits in int; but /proc parsing
+     * is specific to Linux where int works fine.  */
+    if (tid)
+        snprintf(path, sizeof(path), "/proc/%d/task/%d/stat",
+                 (int) pid, (int) tid);
+    else
+        snprintf(path, sizeof(path), "/proc/%d/stat", (int) pid);
+
+    return open(path, O_RDONLY|O_CLOEXEC);
+}
+
+
+/* Re-reads the stat file open in @fd. Returns 0 on success, -1 with
+ * errno set on failure. ESRCH means the task went away since @fd was
+ * opened */
+static int
+virProcStatReadFD(int fd,
+                  virProcStatPtr info)
+{
+    char buf[VIR_PROC_STAT_BUFSIZE];
+    ssize_t got;
+
+    /* The kernel regenerates the contents whenever offset 0 is read */
+    if ((got = pread(fd, buf, sizeof(buf) - 1, 0)) < 0)
+        return -1;
+    buf[got] = '\0';
+
+    return virProcStatParse(buf, info);
+}
+
+
+/**
+ * virProcStatRead:
+ * @pid: process to sample
+ * @tid: thread of @pid, or 0 for the whole process
+ * @info: filled with the parsed fields
+ *
+ * Returns 0 on success, -1 with errno set on failure. ENOENT means
+ * the task doesn't exist (anymore).
+ */
+int
+virProcStatRead(pid_t pid,
+                pid_t tid,
+                virProcStatPtr info)
+{
+    int fd;
+    int ret;
+    int saved_errno;
+
+    if ((fd = virProcStatOpen(pid, tid)) < 0)
+        return -1;
+
+    ret = virProcStatReadFD(fd, info);
+
+    saved_errno = errno;
+    VIR_FORCE_CLOSE(fd);
+    errno = saved_errno;
+
+    return ret;
+}
+
+
+/**
+ * virProcStatReadCached:
+ * @fd: stat file kept open between calls, -1 before the first one
+ * @pid: process to sample
+ * @tid: thread of @pid, or 0 for the whole process
+ * @info: filled with the parsed fields
+ *
+ * Like virProcStatRead, but keeps the stat file open in @fd for the
+ * next sample of the same task, as long as not too many are open
+ * already. The file stays bound to the task it was opened for, even
+ * if its pid gets reused. @fd is to be closed with virProcStatClose.
+ *
+ * Returns 0 on success, -1 with errno set on failure. ENOENT or ESRCH
+ * mean the task doesn't exist (anymore), in which case @fd is closed.
+ */
+int
+virProcStatReadCached(int *fd,
+                      pid_t pid,
+                      pid_t tid,
+                      virProcStatPtr info)
+{
+    int tmpfd = *fd;
+    int ret;
+    int saved_errno;
+
+    if (tmpfd < 0) {
+        if ((tmpfd = virProcStatOpen(pid, tid)) < 0)
+            return -1;
+        if (virProcStatFDReserve())
+            *fd = tmpfd;
+    }
+
+    ret = virProcStatReadFD(tmpfd, info);
+
+    saved_errno = errno;
+    if (tmpfd != *fd)
+        VIR_FORCE_CLOSE(tmpfd);
+    else if (ret < 0 && errno == ESRCH)
+        virProcStatClose(fd);
+    errno = saved_errno;
+
+    return ret;
+}
+
+
+/**
+ * virProcStatClose:
+ * @fd: stat file kept open by virProcStatReadCached, or -1
+ *
+ * Closes @fd and sets it to -1.
+ */
+void
+virProcStatClose(int *fd)
+{
+    if (*fd < 0)
+        return;
+
+    VIR_FORCE_CLOSE(*fd);
+    virAtomicIntDec(&virProcStatFDs);
+}
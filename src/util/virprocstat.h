@@ -0,0 +1,70 @@
+/*
+ * virprocstat.h: allocation free parsing of /proc stat files
+ *
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ *
+ */
+
+#ifndef __VIR_PROC_STAT_H__
+# define __VIR_PROC_STAT_H__
+
+# include <sys/types.h>
+# include "internal.h"
+
+/* Large enough for any /proc/<pid>/stat line, which is a few hundred
+ * bytes at most even with a maximum length command name */
+# define VIR_PROC_STAT_BUFSIZE 1024
+
+typedef struct _virProcStat virProcStat;
+typedef virProcStat *virProcStatPtr;
+struct _virProcStat {
+    unsigned long long utime;   /* user time, in clock ticks */
+    unsigned long long stime;   /* system time, in clock ticks */
+    long rss;                   /* resident set size, in pages */
+    int processor;              /* CPU the task last ran on */
+};
+
+/*
+ * None of the functions below allocate memory or report errors; they
+ * return -1 and set errno on failure, so that callers sampling processes
+ * which may have just exited can tell ENOENT apart from parse failures.
+ */
+
+int virProcStatParse(const char *buf,
+                     virProcStatPtr info) ATTRIBUTE_NONNULL(1)
+    ATTRIBUTE_NONNULL(2) ATTRIBUTE_RETURN_CHECK;
+
+int virProcStatParseFields(const char *str,
+                           const char **end,
+                           unsigned long long *values,
+                           size_t nvalues) ATTRIBUTE_NONNULL(1)
+    ATTRIBUTE_NONNULL(3);
+
+int virProcStatRead(pid_t pid,
+                    pid_t tid,
+                    virProcStatPtr info) ATTRIBUTE_NONNULL(3)
+    ATTRIBUTE_RETURN_CHECK;
+
+int virProcStatReadCached(int *fd,
+                          pid_t pid,
+                          pid_t tid,
+                          virProcStatPtr info) ATTRIBUTE_NONNULL(1)
+    ATTRIBUTE_NONNULL(4) ATTRIBUTE_RETURN_CHECK;
+
+void virProcStatClose(int *fd) ATTRIBUTE_NONNULL(1);
+
+#endif /* __VIR_PROC_STAT_H__ */
@@ -197,7 +197,7 @@ vmwareStopVM(struct vmware_driver *driver,
         return -1;
     }
 
-    vm->def->id = -1;
+    virDomainObjListSetID(&driver->domains, vm, -1);
     virDomainObjSetState(vm, VIR_DOMAIN_SHUTOFF, reason);
 
     return 0;
@@ -211,6 +211,7 @@ vmwareStartVM(struct vmware_driver *driver, virDomainObjPtr vm)
         PROGRAM_SENTINAL, PROGRAM_SENTINAL, NULL
     };
     const char *vmxPath = ((vmwareDomainPtr) vm->privateData)->vmxPath;
+    int pid;
 
     if (virDomainObjGetState(vm, NULL) != VIR_DOMAIN_SHUTOFF) {
         vmwareError(VIR_ERR_OPERATION_INVALID, "%s",
@@ -229,7 +230,8 @@ vmwareStartVM(struct vmware_driver *driver, virDomainObjPtr vm)
         return -1;
     }
 
-    if ((vm->def->id = vmwareExtractPid(vmxPath)) < 0) {
+    if ((pid = vmwareExtractPid(vmxPath)) < 0 ||
+        virDomainObjListSetID(&driver->domains, vm, pid) < 0) {
         vmwareStopVM(driver, vm, VIR_DOMAIN_SHUTOFF_FAILED);
         return -1;
     }
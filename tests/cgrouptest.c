@@ -0,0 +1,227 @@
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/wait.h>
+
+#include "internal.h"
+#include "testutils.h"
+#include "memory.h"
+#include "util.h"
+#include "cgroup.h"
+#include "virtime.h"
+
+
+#define NCALLS 10000
+
+/* More groups than may keep their statistics files open */
+#define NGROUPS 300
+
+static virCgroupPtr driver;
+static virCgroupPtr domain;
+static const char *domainName = "cgrouptest-dom";
+
+/* Looks a value up as the drivers did for every call */
+static int
+testReadUncached(unsigned long long *usage)
+{
+    virCgroupPtr group = NULL;
+    int rc;
+
+    if ((rc = virCgroupForDomain(driver, domainName, &group, 0)) == 0)
+        rc = virCgroupGetCpuacctUsage(group, usage);
+
+    virCgroupFree(&group);
+    return rc;
+}
+
+/* Statistics read through a kept group follow what is being counted */
+static int
+testStatsFresh(const void *opaque ATTRIBUTE_UNUSED)
+{
+    unsigned long long before, after, uncached;
+    unsigned long long start, now;
+    pid_t pid;
+    int rc;
+    int ret = -1;
+
+    if (virCgroupGetCpuacctUsage(domain, &before) < 0)
+        return -1;
+
+    if ((pid = fork()) < 0)
+        return -1;
+    if (pid == 0) {
+        for (;;)
+            ;
+    }
+
+    if ((rc = virCgroupAddTask(domain, pid)) < 0) {
+        if (virTestGetVerbose())
+            testError("\ncannot add task: %s", strerror(-rc));
+        goto cleanup;
+    }
+
+    /* Spin for a while, not to depend on how often the child runs */
+    if (virTimeMillisNow(&start) < 0)
+        goto cleanup;
+    do {
+        if (virCgroupGetCpuacctUsage(domain, &after) < 0 ||
+            virTimeMillisNow(&now) < 0)
+            goto cleanup;
+    } while (after == before && now - start < 5000);
+
+    if (after <= before) {
+        if (virTestGetVerbose())
+            testError("\nusage stayed at %llu", before);
+        goto cleanup;
+    }
+
+    if (testReadUncached(&uncached) < 0)
+        goto cleanup;
+
+    if (uncached < after) {
+        if (virTestGetVerbose())
+            testError("\nusage %llu read before %llu", after, uncached);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return ret;
+}
+
+static int
+testCountFDs(void)
+{
+    DIR *dir;
+    struct dirent *ent;
+    int n = 0;
+
+    if (!(dir = opendir("/proc/self/fd")))
+        return -1;
+    while ((ent = readdir(dir)))
+        n++;
+    closedir(dir);
+
+    return n;
+}
+
+/* Many groups read at once do not keep a descriptor each open */
+static int
+testStatsFDs(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virCgroupPtr groups[NGROUPS] = { NULL };
+    unsigned long long usage;
+    int before, after;
+    int i;
+    int ret = -1;
+
+    if ((before = testCountFDs()) < 0)
+        return -1;
+
+    for (i = 0; i < NGROUPS; i++) {
+        if (virCgroupForDomain(driver, domainName, &groups[i], 0) != 0 ||
+            virCgroupGetCpuacctUsage(groups[i], &usage) < 0 ||
+            virCgroupGetCpuacctStat(groups[i], &usage, &usage) < 0)
+            goto cleanup;
+    }
+
+    if ((after = testCountFDs()) < 0)
+        goto cleanup;
+
+    /* Both files kept open for every group would take 2 * NGROUPS */
+    if (after - before >= NGROUPS) {
+        if (virTestGetVerbose())
+            testError("\n%d descriptors kept open by %d groups",
+                      after - before, NGROUPS);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    for (i = 0; i < NGROUPS; i++)
+        virCgroupFree(&groups[i]);
+    return ret;
+}
+
+/* With --debug, reports how long repeated statistics calls take */
+static int
+testStatsSpeed(const void *opaque ATTRIBUTE_UNUSED)
+{
+    unsigned long long start, uncached, end;
+    unsigned long long usage;
+    unsigned long kb;
+    int i;
+
+    if (virTimeMillisNow(&start) < 0)
+        return -1;
+    for (i = 0; i < NCALLS; i++) {
+        if (testReadUncached(&usage) < 0)
+            return -1;
+    }
+
+    if (virTimeMillisNow(&uncached) < 0)
+        return -1;
+    for (i = 0; i < NCALLS; i++) {
+        if (virCgroupGetCpuacctUsage(domain, &usage) < 0)
+            return -1;
+    }
+
+    if (virTimeMillisNow(&end) < 0)
+        return -1;
+
+    /* The memory controller need not be there */
+    if (virCgroupMounted(domain, VIR_CGROUP_CONTROLLER_MEMORY) &&
+        virCgroupGetMemoryUsage(domain, &kb) < 0)
+        return -1;
+
+    if (virTestGetDebug())
+        fprintf(stderr, "\n%d reads of cpuacct.usage in %llums, "
+                "%llums looking up the group\n%74s",
+                NCALLS, end - uncached, uncached - start, "... ");
+
+    return 0;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    /* Needs to be able to create groups, in mounted controllers */
+    if (getuid() != 0 ||
+        virCgroupForDriver("cgrouptest", &driver, 1, 1) != 0)
+        return EXIT_AM_SKIP;
+
+    if (!virCgroupMounted(driver, VIR_CGROUP_CONTROLLER_CPUACCT) ||
+        virCgroupForDomain(driver, domainName, &domain, 1) != 0) {
+        virCgroupRemove(driver);
+        virCgroupFree(&driver);
+        return EXIT_AM_SKIP;
+    }
+
+    if (virtTestRun("Stats fresh", 1, testStatsFresh, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Stats descriptors", 1, testStatsFDs, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Stats speed", 1, testStatsSpeed, NULL) < 0)
+        ret = -1;
+
+    virCgroupRemove(domain);
+    virCgroupFree(&domain);
+    virCgroupRemove(driver);
+    virCgroupFree(&driver);
+
+    return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -25,18 +25,53 @@
 #include <stdlib.h>
 #include <signal.h>
 #include <time.h>
+#include <fcntl.h>
 
 #include "testutils.h"
 #include "internal.h"
 #include "threads.h"
 #include "logging.h"
 #include "util.h"
+#include "memory.h"
+#include "virfile.h"
 #include "event.h"
 #include "event_poll.h"
+#include "event_epoll.h"
 
 #define NUM_FDS 31
 #define NUM_TIME 31
 
+/* Every event loop implementation must pass the same tests */
+static const struct eventImpl {
+    const char *name;
+    int (*init)(void);
+    int (*runOnce)(void);
+    int (*addHandle)(int fd, int events, virEventHandleCallback cb,
+                     void *opaque, virFreeCallback ff);
+    void (*updateHandle)(int watch, int events);
+    int (*removeHandle)(int watch);
+    int (*addTimeout)(int frequency, virEventTimeoutCallback cb,
+                      void *opaque, virFreeCallback ff);
+    void (*updateTimeout)(int timer, int frequency);
+    int (*removeTimeout)(int timer);
+} eventImpls[] = {
+    { "poll",
+      virEventPollInit, virEventPollRunOnce,
+      virEventPollAddHandle, virEventPollUpdateHandle,
+      virEventPollRemoveHandle, virEventPollAddTimeout,
+      virEventPollUpdateTimeout, virEventPollRemoveTimeout },
+#if WITH_EPOLL
+    { "epoll",
+      virEventEpollInit, virEventEpollRunOnce,
+      virEventEpollAddHandle, virEventEpollUpdateHandle,
+      virEventEpollRemoveHandle, virEventEpollAddTimeout,
+      virEventEpollUpdateTimeout, virEventEpollRemoveTimeout },
+#endif
+};
+
+/* The implementation currently under test */
+static const struct eventImpl *impl;
+
 static struct handleInfo {
     int pipeFD[2];
     int fired;
@@ -90,9 +125,35 @@ testPipeReader(int watch, int fd, int events, void *data)
     info->error = EV_ERROR_NONE;
 
     if (info->delete != -1)
-        virEventPollRemoveHandle(info->delete);
+        impl->removeHandle(info->delete);
 }
 
+/* Regular files are always readable, so the watch removes itself */
+static void
+testFileReader(int watch, int fd, int events, void *data)
+{
+    struct handleInfo *info = data;
+
+    info->fired = 1;
+
+    if (watch != info->watch) {
+        info->error = EV_ERROR_WATCH;
+        return;
+    }
+
+    if (fd != info->pipeFD[0]) {
+        info->error = EV_ERROR_FD;
+        return;
+    }
+
+    if (!(events & VIR_EVENT_HANDLE_READABLE)) {
+        info->error = EV_ERROR_EVENT;
+        return;
+    }
+    info->error = EV_ERROR_NONE;
+
+    impl->removeHandle(watch);
+}
 
 static void
 testTimer(int timer, void *data)
@@ -109,7 +170,7 @@ testTimer(int timer, void *data)
     info->error = EV_ERROR_NONE;
 
     if (info->delete != -1)
-        virEventPollRemoveTimeout(info->delete);
+        impl->removeTimeout(info->delete);
 }
 
 static pthread_mutex_t eventThreadMutex = PTHREAD_MUTEX_INITIALIZER;
@@ -128,7 +189,7 @@ ATTRIBUTE_NORETURN static void *eventThreadLoop(void *data ATTRIBUTE_UNUSED) {
         eventThreadRunOnce = 0;
         pthread_mutex_unlock(&eventThreadMutex);
 
-        virEventPollRunOnce();
+        impl->runOnce();
 
         pthread_mutex_lock(&eventThreadMutex);
         eventThreadJobDone = 1;
@@ -222,10 +283,12 @@ startJob(void)
 }
 
 static int
-finishJob(const char *name, int handle, int timer)
+finishJob(const char *testname, int handle, int timer)
 {
     struct timespec waitTime;
+    char name[100];
     int rc;
+    snprintf(name, sizeof(name), "%s: %s", impl->name, testname);
     clock_gettime(CLOCK_REALTIME, &waitTime);
     waitTime.tv_sec += 5;
     rc = 0;
@@ -259,11 +322,13 @@ resetAll(void)
 }
 
 static int
-mymain(void)
+testEventImpl(void)
 {
     int i;
-    pthread_t eventThread;
     char one = '1';
+    char *path = NULL;
+
+    resetAll();
 
     for (i = 0 ; i < NUM_FDS ; i++) {
         if (pipe(handles[i].pipeFD) < 0) {
@@ -272,38 +337,27 @@ mymain(void)
         }
     }
 
-    if (virThreadInitialize() < 0)
+    if (impl->init() < 0)
         return EXIT_FAILURE;
-    char *debugEnv = getenv("LIBVIRT_DEBUG");
-    if (debugEnv && *debugEnv && (virLogParseDefaultPriority(debugEnv) == -1)) {
-        fprintf(stderr, "Invalid log level setting.\n");
-        return EXIT_FAILURE;
-    }
-
-    virEventPollInit();
 
     for (i = 0 ; i < NUM_FDS ; i++) {
         handles[i].delete = -1;
         handles[i].watch =
-            virEventPollAddHandle(handles[i].pipeFD[0],
-                                  VIR_EVENT_HANDLE_READABLE,
-                                  testPipeReader,
-                                  &handles[i], NULL);
+            impl->addHandle(handles[i].pipeFD[0],
+                            VIR_EVENT_HANDLE_READABLE,
+                            testPipeReader,
+                            &handles[i], NULL);
     }
 
     for (i = 0 ; i < NUM_TIME ; i++) {
         timers[i].delete = -1;
         timers[i].timeout = -1;
         timers[i].timer =
-            virEventPollAddTimeout(timers[i].timeout,
-                                   testTimer,
-                                   &timers[i], NULL);
+            impl->addTimeout(timers[i].timeout,
+                             testTimer,
+                             &timers[i], NULL);
     }
 
-    pthread_create(&eventThread, NULL, eventThreadLoop, NULL);
-
-    pthread_mutex_lock(&eventThreadMutex);
-
     /* First time, is easy - just try triggering one of our
      * registered handles */
     startJob();
@@ -316,7 +370,7 @@ mymain(void)
 
     /* Now lets delete one before starting poll(), and
      * try triggering another handle */
-    virEventPollRemoveHandle(handles[0].watch);
+    impl->removeHandle(handles[0].watch);
     startJob();
     if (safewrite(handles[1].pipeFD[1], &one, 1) != 1)
         return EXIT_FAILURE;
@@ -336,7 +390,7 @@ mymain(void)
     sched_yield();
     usleep(100 * 1000);
     pthread_mutex_lock(&eventThreadMutex);
-    virEventPollRemoveHandle(handles[1].watch);
+    impl->removeHandle(handles[1].watch);
     if (finishJob("Interrupted during poll", -1, -1) != EXIT_SUCCESS)
         return EXIT_FAILURE;
 
@@ -372,22 +426,22 @@ mymain(void)
 
 
     /* Run a timer on its own */
-    virEventPollUpdateTimeout(timers[1].timer, 100);
+    impl->updateTimeout(timers[1].timer, 100);
     startJob();
     if (finishJob("Firing a timer", -1, 1) != EXIT_SUCCESS)
         return EXIT_FAILURE;
-    virEventPollUpdateTimeout(timers[1].timer, -1);
+    impl->updateTimeout(timers[1].timer, -1);
 
     resetAll();
 
     /* Now lets delete one before starting poll(), and
      * try triggering another timer */
-    virEventPollUpdateTimeout(timers[1].timer, 100);
-    virEventPollRemoveTimeout(timers[0].timer);
+    impl->updateTimeout(timers[1].timer, 100);
+    impl->removeTimeout(timers[0].timer);
     startJob();
     if (finishJob("Deleted before poll", -1, 1) != EXIT_SUCCESS)
         return EXIT_FAILURE;
-    virEventPollUpdateTimeout(timers[1].timer, -1);
+    impl->updateTimeout(timers[1].timer, -1);
 
     resetAll();
 
@@ -402,7 +456,7 @@ mymain(void)
     sched_yield();
     usleep(100 * 1000);
     pthread_mutex_lock(&eventThreadMutex);
-    virEventPollRemoveTimeout(timers[1].timer);
+    impl->removeTimeout(timers[1].timer);
     if (finishJob("Interrupted during poll", -1, -1) != EXIT_SUCCESS)
         return EXIT_FAILURE;
 
@@ -415,27 +469,27 @@ mymain(void)
      * before poll() exits for the first safewrite(). We don't
      * see a hard failure in other cases, so nothing to worry
      * about */
-    virEventPollUpdateTimeout(timers[2].timer, 100);
-    virEventPollUpdateTimeout(timers[3].timer, 100);
+    impl->updateTimeout(timers[2].timer, 100);
+    impl->updateTimeout(timers[3].timer, 100);
     startJob();
     timers[2].delete = timers[3].timer;
     if (finishJob("Deleted during dispatch", -1, 2) != EXIT_SUCCESS)
         return EXIT_FAILURE;
-    virEventPollUpdateTimeout(timers[2].timer, -1);
+    impl->updateTimeout(timers[2].timer, -1);
 
     resetAll();
 
     /* Extreme fun, lets delete ourselves during dispatch */
-    virEventPollUpdateTimeout(timers[2].timer, 100);
+    impl->updateTimeout(timers[2].timer, 100);
     startJob();
     timers[2].delete = timers[2].timer;
     if (finishJob("Deleted during dispatch", -1, 2) != EXIT_SUCCESS)
         return EXIT_FAILURE;
 
     for (i = 0 ; i < NUM_FDS - 1 ; i++)
-        virEventPollRemoveHandle(handles[i].watch);
+        impl->removeHandle(handles[i].watch);
     for (i = 0 ; i < NUM_TIME - 1 ; i++)
-        virEventPollRemoveTimeout(timers[i].timer);
+        impl->removeTimeout(timers[i].timer);
 
     resetAll();
 
@@ -451,25 +505,75 @@ mymain(void)
     }
 
 
+    /* epoll refuses regular files, which poll() reports as ready */
+    if (virAsprintf(&path, "%s/eventtest.c", abs_srcdir) < 0 ||
+        (handles[0].pipeFD[0] = open(path, O_RDONLY)) < 0) {
+        VIR_FREE(path);
+        return EXIT_FAILURE;
+    }
+    VIR_FREE(path);
+    handles[0].watch = impl->addHandle(handles[0].pipeFD[0],
+                                       VIR_EVENT_HANDLE_READABLE,
+                                       testFileReader,
+                                       &handles[0], NULL);
+    if (handles[0].watch < 0)
+        return EXIT_FAILURE;
+    startJob();
+    if (finishJob("Regular file", 0, -1) != EXIT_SUCCESS)
+        return EXIT_FAILURE;
+    VIR_FORCE_CLOSE(handles[0].pipeFD[0]);
+
+    resetAll();
+
     /* Final test, register same FD twice, once with no
      * events, and make sure the right callback runs */
     handles[0].pipeFD[0] = handles[1].pipeFD[0];
     handles[0].pipeFD[1] = handles[1].pipeFD[1];
 
-    handles[0].watch = virEventPollAddHandle(handles[0].pipeFD[0],
-                                             0,
-                                             testPipeReader,
-                                             &handles[0], NULL);
-    handles[1].watch = virEventPollAddHandle(handles[1].pipeFD[0],
-                                             VIR_EVENT_HANDLE_READABLE,
-                                             testPipeReader,
-                                             &handles[1], NULL);
+    handles[0].watch = impl->addHandle(handles[0].pipeFD[0],
+                                       0,
+                                       testPipeReader,
+                                       &handles[0], NULL);
+    handles[1].watch = impl->addHandle(handles[1].pipeFD[0],
+                                       VIR_EVENT_HANDLE_READABLE,
+                                       testPipeReader,
+                                       &handles[1], NULL);
     startJob();
     if (safewrite(handles[1].pipeFD[1], &one, 1) != 1)
         return EXIT_FAILURE;
     if (finishJob("Write duplicate", 1, -1) != EXIT_SUCCESS)
         return EXIT_FAILURE;
 
+    return EXIT_SUCCESS;
+}
+
+static int
+mymain(void)
+{
+    int i;
+    pthread_t eventThread;
+
+    if (virThreadInitialize() < 0)
+        return EXIT_FAILURE;
+    char *debugEnv = getenv("LIBVIRT_DEBUG");
+    if (debugEnv && *debugEnv && (virLogParseDefaultPriority(debugEnv) == -1)) {
+        fprintf(stderr, "Invalid log level setting.\n");
+        return EXIT_FAILURE;
+    }
+
+    /* The event thread only ever picks up the current
+     * implementation once it is told to run */
+    impl = &eventImpls[0];
+    pthread_create(&eventThread, NULL, eventThreadLoop, NULL);
+
+    pthread_mutex_lock(&eventThreadMutex);
+
+    for (i = 0 ; i < ARRAY_CARDINALITY(eventImpls) ; i++) {
+        impl = &eventImpls[i];
+        if (testEventImpl() != EXIT_SUCCESS)
+            return EXIT_FAILURE;
+    }
+
     //pthread_kill(eventThread, SIGTERM);
 
     return EXIT_SUCCESS;
@@ -7,6 +7,9 @@
 
 #include "internal.h"
 #include "json.h"
+#include "buf.h"
+#include "memory.h"
+#include "virtime.h"
 #include "testutils.h"
 
 struct testInfo {
@@ -54,6 +57,166 @@ cleanup:
 }
 
 
+/* An object of @nkeys numbers, "key<N>" being N */
+static char *
+testJSONObjectString(int nkeys, bool duplicate)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    int i;
+
+    virBufferAddChar(&buf, '{');
+    for (i = 0; i < nkeys; i++)
+        virBufferAsprintf(&buf, "%s\"key%d\": %d", i ? ", " : "", i, i);
+    if (duplicate)
+        virBufferAsprintf(&buf, ", \"key%d\": 0", nkeys / 2);
+    virBufferAddChar(&buf, '}');
+
+    if (virBufferError(&buf)) {
+        virBufferFreeAndReset(&buf);
+        return NULL;
+    }
+    return virBufferContentAndReset(&buf);
+}
+
+/* Keys of large objects are looked up through a hash table */
+static int
+testJSONLargeObject(const void *data ATTRIBUTE_UNUSED)
+{
+    const int nkeys = 100;
+    char *doc = NULL;
+    char key[20];
+    virJSONValuePtr json = NULL;
+    virJSONValuePtr dup = NULL;
+    int i, value;
+    int ret = -1;
+
+    if (!(doc = testJSONObjectString(nkeys, false)) ||
+        !(json = virJSONValueFromString(doc)))
+        goto cleanup;
+
+    for (i = 0; i < nkeys; i++) {
+        snprintf(key, sizeof(key), "key%d", i);
+        if (virJSONValueObjectGetNumberInt(json, key, &value) < 0 ||
+            value != i) {
+            if (virTestGetVerbose())
+                fprintf(stderr, "\n%s not found\n", key);
+            goto cleanup;
+        }
+    }
+
+    snprintf(key, sizeof(key), "key%d", nkeys);
+    if (virJSONValueObjectHasKey(json, key) != 0 ||
+        virJSONValueObjectAppendNumberInt(json, "key0", 0) == 0) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "\nunexpected key found\n");
+        goto cleanup;
+    }
+
+    if (virJSONValueObjectAppendNumberInt(json, key, nkeys) < 0 ||
+        virJSONValueObjectGetNumberInt(json, key, &value) < 0 ||
+        value != nkeys)
+        goto cleanup;
+
+    VIR_FREE(doc);
+    if (!(doc = testJSONObjectString(nkeys, true)))
+        goto cleanup;
+    if ((dup = virJSONValueFromString(doc))) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "\nduplicate key accepted\n");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(doc);
+    virJSONValueFree(json);
+    virJSONValueFree(dup);
+    return ret;
+}
+
+/* With --debug, reports how long parsing a query-blockstats reply of
+ * a guest with many disks takes */
+static int
+testJSONBlockStats(const void *data ATTRIBUTE_UNUSED)
+{
+    const int ndisks = 256;
+    const int nparses = 100;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *doc = NULL;
+    virJSONValuePtr json = NULL;
+    virJSONValuePtr devices;
+    unsigned long long start, end;
+    long long rd_bytes;
+    int i;
+    int ret = -1;
+
+    virBufferAddLit(&buf, "{\"return\": [");
+    for (i = 0; i < ndisks; i++) {
+        virBufferAsprintf(&buf,
+                          "%s{\"device\": \"drive-virtio-disk%d\", "
+                          "\"parent\": {\"stats\": {\"wr_highest_offset\": "
+                          "%d, \"wr_bytes\": 0, \"wr_operations\": 0, "
+                          "\"rd_bytes\": 0, \"rd_operations\": 0}}, "
+                          "\"stats\": {\"wr_highest_offset\": 0, "
+                          "\"wr_bytes\": 3395584, \"wr_operations\": 2131, "
+                          "\"flush_total_time_ns\": 0, "
+                          "\"wr_total_time_ns\": 4589300000, "
+                          "\"rd_total_time_ns\": 1039245000, "
+                          "\"rd_bytes\": %d, \"rd_operations\": 2031, "
+                          "\"flush_operations\": 0}}",
+                          i ? ", " : "", i, i * 512, i * 4096);
+    }
+    virBufferAddLit(&buf, "], \"id\": \"libvirt-12\"}");
+
+    if (virBufferError(&buf)) {
+        virBufferFreeAndReset(&buf);
+        goto cleanup;
+    }
+    doc = virBufferContentAndReset(&buf);
+
+    if (virTimeMillisNow(&start) < 0)
+        goto cleanup;
+    for (i = 0; i < nparses; i++) {
+        virJSONValueFree(json);
+        if (!(json = virJSONValueFromString(doc)))
+            goto cleanup;
+    }
+    if (virTimeMillisNow(&end) < 0)
+        goto cleanup;
+
+    if (!(devices = virJSONValueObjectGet(json, "return")) ||
+        virJSONValueArraySize(devices) != ndisks)
+        goto cleanup;
+
+    for (i = 0; i < ndisks; i++) {
+        virJSONValuePtr dev = virJSONValueArrayGet(devices, i);
+        virJSONValuePtr stats;
+
+        if (!dev ||
+            !(stats = virJSONValueObjectGet(dev, "stats")) ||
+            virJSONValueObjectGetNumberLong(stats, "rd_bytes",
+                                            &rd_bytes) < 0 ||
+            rd_bytes != i * 4096) {
+            if (virTestGetVerbose())
+                fprintf(stderr, "\nstats of disk %d not found\n", i);
+            goto cleanup;
+        }
+    }
+
+    if (virTestGetDebug())
+        fprintf(stderr, "\n%zu bytes parsed %d times in %llums\n%74s",
+                strlen(doc), nparses, end - start, "... ");
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(doc);
+    virJSONValueFree(json);
+    return ret;
+}
+
+
 static int
 mymain(void)
 {
@@ -105,6 +268,11 @@ mymain(void)
                   "\"query-uuid\"}, {\"name\": \"query-migrate\"}, {\"name\": "
                   "\"query-balloon\"}], \"id\": \"libvirt-2\"}");
 
+    if (virtTestRun("LargeObject", 1, testJSONLargeObject, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("BlockStats", 1, testJSONBlockStats, NULL) < 0)
+        ret = -1;
+
     return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
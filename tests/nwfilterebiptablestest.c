@@ -0,0 +1,329 @@
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "testutils.h"
+
+#if defined(WITH_NWFILTER) && defined(__linux__)
+
+# include "internal.h"
+# include "memory.h"
+# include "util.h"
+# include "xml.h"
+# include "threads.h"
+# include "domain_conf.h"
+# include "nwfilter_params.h"
+# include "nwfilter_conf.h"
+# include "nwfilter/nwfilter_ebiptables_driver.h"
+
+# define TEST_IFNAME "vnet0"
+
+/* Filters whose rules are instantiated for TEST_IFNAME */
+static const char *filters[] = { "root", "ipv4" };
+
+/* The firewall tools are replaced by scripts which log how they are
+ * called to $fakedir/calls; the restore tools log their input as well,
+ * to $fakedir/restore */
+static char *fakedir;
+static const char *tools[] = {
+    "ebtables", "iptables", "ip6tables", "grep", "gawk",
+};
+static const char *restoreTools[] = {
+    "iptables-restore", "ip6tables-restore",
+};
+
+/* Number of tool calls made while applying rules with the scripts */
+static int scriptCalls = -1;
+
+struct testApplyData {
+    bool restore;
+};
+
+static int
+testWriteTool(const char *name, const char *log, bool input)
+{
+    char *path = NULL;
+    char *script = NULL;
+    int ret = -1;
+
+    /* The tools are run from an unknown directory, so the logs are
+     * referred to by their absolute path */
+    if (virAsprintf(&path, "%s/%s", fakedir, name) < 0)
+        goto cleanup;
+    if (input) {
+        if (virAsprintf(&script,
+                        "#!/bin/sh\n"
+                        "echo \"${0##*/} $*\" >> %s/calls\n"
+                        "while IFS= read -r l; do\n"
+                        "  printf '%%s\\n' \"$l\"\n"
+                        "done >> %s/%s\n",
+                        fakedir, fakedir, log) < 0)
+            goto cleanup;
+    } else {
+        if (virAsprintf(&script,
+                        "#!/bin/sh\n"
+                        "echo \"${0##*/} $*\" >> %s/%s\n",
+                        fakedir, log) < 0)
+            goto cleanup;
+    }
+
+    if (virFileWriteStr(path, script, 0755) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(path);
+    VIR_FREE(script);
+    return ret;
+}
+
+static void
+testRemoveTool(const char *name)
+{
+    char *path;
+
+    if (virAsprintf(&path, "%s/%s", fakedir, name) < 0)
+        return;
+    unlink(path);
+    VIR_FREE(path);
+}
+
+static int
+testSetupTools(bool restore)
+{
+    size_t i;
+
+    for (i = 0; i < ARRAY_CARDINALITY(tools); i++) {
+        if (testWriteTool(tools[i], "calls", false) < 0)
+            return -1;
+    }
+
+    for (i = 0; i < ARRAY_CARDINALITY(restoreTools); i++) {
+        if (!restore)
+            testRemoveTool(restoreTools[i]);
+        else if (testWriteTool(restoreTools[i], "restore", true) < 0)
+            return -1;
+    }
+
+    return 0;
+}
+
+static int
+testReadLog(const char *name, char **content)
+{
+    char *path = NULL;
+    int ret = -1;
+
+    if (virAsprintf(&path, "%s/%s", fakedir, name) < 0)
+        return -1;
+
+    if (!virFileExists(path)) {
+        ret = 0;
+        if (!(*content = strdup("")))
+            ret = -1;
+    } else {
+        ret = virFileReadAll(path, 1024 * 1024, content) < 0 ? -1 : 0;
+    }
+
+    unlink(path);
+    VIR_FREE(path);
+    return ret;
+}
+
+static int
+testCountLines(const char *str)
+{
+    int n = 0;
+
+    while ((str = strchr(str, '\n'))) {
+        str++;
+        n++;
+    }
+
+    return n;
+}
+
+static int
+testApply(const void *opaque)
+{
+    const struct testApplyData *data = opaque;
+    virNWFilterDefPtr defs[ARRAY_CARDINALITY(filters)] = { NULL };
+    virNWFilterHashTablePtr vars = NULL;
+    virNWFilterRuleInstPtr *insts = NULL;
+    size_t ninsts = 0;
+    void **ptrs = NULL;
+    size_t nptrs = 0;
+    char *calls = NULL;
+    char *restore = NULL;
+    char *expected = NULL;
+    char *path = NULL;
+    bool initialized = false;
+    size_t i;
+    int j;
+    int ret = -1;
+
+    if (testSetupTools(data->restore) < 0)
+        goto cleanup;
+
+    if (ebiptables_driver.init(true) < 0)
+        goto cleanup;
+    initialized = true;
+
+    if (!(vars = virNWFilterHashTableCreate(0)))
+        goto cleanup;
+
+    for (i = 0; i < ARRAY_CARDINALITY(filters); i++) {
+        if (virAsprintf(&path, "%s/nwfilterebiptablesdata/%s.xml",
+                        abs_srcdir, filters[i]) < 0)
+            goto cleanup;
+        if (!(defs[i] = virNWFilterDefParseFile(NULL, path)))
+            goto cleanup;
+        VIR_FREE(path);
+
+        for (j = 0; j < defs[i]->nentries; j++) {
+            virNWFilterRuleInstPtr inst;
+
+            if (!defs[i]->filterEntries[j]->rule)
+                continue;
+
+            if (VIR_EXPAND_N(insts, ninsts, 1) < 0 ||
+                VIR_ALLOC(inst) < 0)
+                goto cleanup;
+            insts[ninsts - 1] = inst;
+
+            if (ebiptables_driver.createRuleInstance(
+                    VIR_DOMAIN_NET_TYPE_ETHERNET, defs[i],
+                    defs[i]->filterEntries[j]->rule,
+                    TEST_IFNAME, vars, inst) < 0)
+                goto cleanup;
+        }
+    }
+
+    for (i = 0; i < ninsts; i++) {
+        for (j = 0; j < insts[i]->ndata; j++) {
+            if (VIR_EXPAND_N(ptrs, nptrs, 1) < 0)
+                goto cleanup;
+            ptrs[nptrs - 1] = insts[i]->data[j];
+        }
+    }
+
+    /* Forget about the probing done by the driver */
+    if (testReadLog("calls", &calls) < 0)
+        goto cleanup;
+    VIR_FREE(calls);
+
+    if (ebiptables_driver.applyNewRules(TEST_IFNAME, nptrs, ptrs) < 0)
+        goto cleanup;
+
+    if (testReadLog("calls", &calls) < 0 ||
+        testReadLog("restore", &restore) < 0)
+        goto cleanup;
+
+    if (virTestGetDebug())
+        fprintf(stderr, "\n%d tool calls for %zu rules\n%74s",
+                testCountLines(calls), nptrs, "... ");
+
+    if (!data->restore) {
+        if (*restore) {
+            if (virTestGetVerbose())
+                testError("\nrestore tools used although missing");
+            goto cleanup;
+        }
+        scriptCalls = testCountLines(calls);
+    } else {
+        if (virAsprintf(&path, "%s/nwfilterebiptablesdata/%s.restore",
+                        abs_srcdir, TEST_IFNAME) < 0 ||
+            virtTestLoadFile(path, &expected) < 0)
+            goto cleanup;
+
+        if (STRNEQ(expected, restore)) {
+            virtTestDifference(stderr, expected, restore);
+            goto cleanup;
+        }
+
+        /* Each iptables rule used to cost a process */
+        if (scriptCalls >= 0 &&
+            testCountLines(calls) >= scriptCalls) {
+            if (virTestGetVerbose())
+                testError("\n%d tool calls with restore, %d without",
+                          testCountLines(calls), scriptCalls);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    for (i = 0; i < ninsts; i++) {
+        for (j = 0; j < insts[i]->ndata; j++)
+            ebiptables_driver.freeRuleInstance(insts[i]->data[j]);
+        VIR_FREE(insts[i]->data);
+        VIR_FREE(insts[i]);
+    }
+    VIR_FREE(insts);
+    VIR_FREE(ptrs);
+    for (i = 0; i < ARRAY_CARDINALITY(filters); i++)
+        virNWFilterDefFree(defs[i]);
+    virNWFilterHashTableFree(vars);
+    if (initialized)
+        ebiptables_driver.shutdown();
+    VIR_FREE(calls);
+    VIR_FREE(restore);
+    VIR_FREE(expected);
+    VIR_FREE(path);
+    return ret;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    char tmpdir[] = "/tmp/nwfilterebiptablestest-XXXXXX";
+    size_t i;
+
+    if (!mkdtemp(tmpdir)) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    fakedir = tmpdir;
+
+    /* Make sure none of the real tools are found */
+    if (setenv("PATH", fakedir, 1) < 0) {
+        ret = -1;
+        goto cleanup;
+    }
+
+# define DO_TEST(name, restore)                                         \
+    do {                                                                \
+        struct testApplyData data = { restore };                        \
+        if (virtTestRun("Apply " name, 1, testApply, &data) < 0)        \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST("with scripts", false);
+    DO_TEST("with restore tools", true);
+
+cleanup:
+    for (i = 0; i < ARRAY_CARDINALITY(tools); i++)
+        testRemoveTool(tools[i]);
+    for (i = 0; i < ARRAY_CARDINALITY(restoreTools); i++)
+        testRemoveTool(restoreTools[i]);
+    rmdir(fakedir);
+
+    return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
+
+#else
+
+int main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* WITH_NWFILTER && __linux__ */
@@ -0,0 +1,169 @@
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "testutils.h"
+
+#if defined(WITH_NWFILTER) && defined(__linux__)
+
+# include "internal.h"
+# include "memory.h"
+# include "util.h"
+# include "virfile.h"
+# include "domain_conf.h"
+# include "nwfilter_conf.h"
+# include "nwfilter/nwfilter_learnipaddr.h"
+
+/* Layout of the files written by tcpdump & co */
+# define PCAP_MAGIC         0xa1b2c3d4
+# define PCAP_MAGIC_SWAPPED 0xd4c3b2a1
+
+struct pcapFileHeader {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+};
+
+struct pcapRecordHeader {
+    uint32_t ts_sec;
+    uint32_t ts_usec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+};
+
+/* The MAC address of the VM the packets were recorded for */
+static const unsigned char vmmac[VIR_MAC_BUFLEN] = {
+    0x52, 0x54, 0x00, 0x12, 0x34, 0x56,
+};
+
+struct testLearnData {
+    const char *file;
+    enum howDetect howDetect;
+    const char *expect; /* NULL if no address must be learned */
+};
+
+static uint32_t
+testSwap32(uint32_t val, bool swapped)
+{
+    if (!swapped)
+        return val;
+    return ((val & 0xff) << 24) | ((val & 0xff00) << 8) |
+           ((val >> 8) & 0xff00) | (val >> 24);
+}
+
+/*
+ * Replay the packets of a recorded capture file, just like the learner
+ * thread gets them from the interface of a VM
+ */
+static int
+testLearn(const void *opaque)
+{
+    const struct testLearnData *data = opaque;
+    struct pcapFileHeader filehdr;
+    struct pcapRecordHeader rechdr;
+    char *path = NULL;
+    char *content = NULL;
+    char learned[INET_ADDRSTRLEN] = "";
+    uint32_t vmaddr;
+    bool swapped;
+    size_t offset;
+    int len;
+    int ret = -1;
+
+    if (virAsprintf(&path, "%s/nwfilterlearnipaddrdata/%s",
+                    abs_srcdir, data->file) < 0)
+        goto cleanup;
+
+    if ((len = virFileReadAll(path, 1024 * 1024, &content)) < 0)
+        goto cleanup;
+
+    if (len < sizeof(filehdr))
+        goto malformed;
+    memcpy(&filehdr, content, sizeof(filehdr));
+    if (filehdr.magic != PCAP_MAGIC && filehdr.magic != PCAP_MAGIC_SWAPPED)
+        goto malformed;
+    swapped = filehdr.magic == PCAP_MAGIC_SWAPPED;
+
+    for (offset = sizeof(filehdr); offset < len; ) {
+        if (len - offset < sizeof(rechdr))
+            goto malformed;
+        memcpy(&rechdr, content + offset, sizeof(rechdr));
+        offset += sizeof(rechdr);
+
+        rechdr.incl_len = testSwap32(rechdr.incl_len, swapped);
+        if (len - offset < rechdr.incl_len)
+            goto malformed;
+
+        if (virNWFilterLearnIPAddressFromPacket(vmmac, data->howDetect,
+                (const unsigned char *)content + offset,
+                rechdr.incl_len, &vmaddr)) {
+            if (!inet_ntop(AF_INET, &vmaddr, learned, sizeof(learned)))
+                goto cleanup;
+            break;
+        }
+        offset += rechdr.incl_len;
+    }
+
+    if (STRNEQ(learned, data->expect ? data->expect : "")) {
+        if (virTestGetVerbose())
+            testError("\nexpected to learn '%s', got '%s'",
+                      NULLSTR(data->expect), learned);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(path);
+    VIR_FREE(content);
+    return ret;
+
+malformed:
+    if (virTestGetVerbose())
+        testError("\nmalformed capture file %s", path);
+    goto cleanup;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+# define DO_TEST(file, howDetect, expect)                               \
+    do {                                                                \
+        struct testLearnData data = { file, howDetect, expect };        \
+        if (virtTestRun("Learn from " file " with " #howDetect,         \
+                        1, testLearn, &data) < 0)                       \
+            ret = -1;                                                   \
+    } while (0)
+
+    /* The DHCP offer for the VM, not the one for another host */
+    DO_TEST("dhcp.pcap", DETECT_DHCP, "192.168.122.50");
+    DO_TEST("dhcp.pcap", DETECT_STATIC, NULL);
+    /* The sender of the VM's own request, not the address it asks for */
+    DO_TEST("arp.pcap", DETECT_STATIC, "10.0.0.7");
+    DO_TEST("arp.pcap", DETECT_DHCP, NULL);
+    DO_TEST("arpprobe.pcap", DETECT_STATIC, "10.0.0.9");
+    /* VLAN tagged, skipping multicast and another host's traffic */
+    DO_TEST("vlan.pcap", DETECT_DHCP | DETECT_STATIC, "192.168.1.20");
+
+    return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
+
+#else
+
+int main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* WITH_NWFILTER && __linux__ */
@@ -0,0 +1,226 @@
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+#include "testutils.h"
+#include "buf.h"
+#include "memory.h"
+#include "threads.h"
+#include "xml.h"
+#include "nwfilter_params.h"
+#include "nwfilter_conf.h"
+
+/*
+ * Checks which interfaces get their filters rebuilt when a filter
+ * changes: those using the filter, or a filter including it directly
+ * or through others, but no unrelated ones.
+ */
+
+struct testInterface {
+    const char *filter;
+    int applied;
+};
+
+static struct testInterface interfaces[] = {
+    { "leaf", 0 },
+    { "direct", 0 },
+    { "transitive", 0 },
+    { "diamond", 0 },
+    { "unrelated", 0 },
+    { "other", 0 },
+};
+
+static virNWFilterObjList nwfilters;
+
+/* Stands in for virNWFilterDomainFWUpdateCB on a domain interface */
+static void
+testUpdateCB(void *payload,
+             const void *name ATTRIBUTE_UNUSED,
+             void *data)
+{
+    struct testInterface *iface = payload;
+    struct domUpdateCBStruct *cb = data;
+
+    if (!virNWFilterUpdateAffects(cb, iface->filter))
+        return;
+
+    if (cb->step == STEP_APPLY_NEW)
+        iface->applied++;
+}
+
+static int
+testFilterRebuild(virConnectPtr conn ATTRIBUTE_UNUSED,
+                  virHashIterator iter, void *data)
+{
+    int i;
+
+    for (i = 0; i < ARRAY_CARDINALITY(interfaces); i++)
+        iter(&interfaces[i], interfaces[i].filter, data);
+
+    return 0;
+}
+
+static void
+testDriverLock(void)
+{
+}
+
+static virNWFilterCallbackDriver testCallbackDriver = {
+    .name = "test",
+    .vmFilterRebuild = testFilterRebuild,
+    .vmDriverLock = testDriverLock,
+    .vmDriverUnlock = testDriverLock,
+};
+
+/* Defines the filter @name, with a rule of priority @priority if
+ * non-zero and including the filters in @refs */
+static int
+testDefineFilter(const char *name, int priority, const char **refs)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    virNWFilterDefPtr def = NULL;
+    virNWFilterObjPtr obj;
+    char *xml = NULL;
+    int ret = -1;
+
+    virBufferAsprintf(&buf, "<filter name='%s' chain='root'>\n", name);
+    if (priority)
+        virBufferAsprintf(&buf,
+                          "  <rule action='accept' direction='out' "
+                          "priority='%d'>\n"
+                          "    <all/>\n"
+                          "  </rule>\n", priority);
+    while (refs && *refs)
+        virBufferAsprintf(&buf, "  <filterref filter='%s'/>\n", *refs++);
+    virBufferAddLit(&buf, "</filter>\n");
+
+    if (virBufferError(&buf)) {
+        virBufferFreeAndReset(&buf);
+        return -1;
+    }
+    xml = virBufferContentAndReset(&buf);
+
+    if (!(def = virNWFilterDefParseString(NULL, xml)))
+        goto cleanup;
+
+    if (!(obj = virNWFilterObjAssignDef(NULL, &nwfilters, def)))
+        goto cleanup;
+    virNWFilterObjUnlock(obj);
+    def = NULL;
+
+    ret = 0;
+
+cleanup:
+    virNWFilterDefFree(def);
+    VIR_FREE(xml);
+    return ret;
+}
+
+struct testUpdateData {
+    const char *name;
+    int priority;
+    const char **refs;
+    bool fail;
+    const char *expect;         /* Filters of the interfaces rebuilt */
+};
+
+static int
+testUpdate(const void *opaque)
+{
+    const struct testUpdateData *data = opaque;
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *actual = NULL;
+    int i;
+    int ret = -1;
+
+    for (i = 0; i < ARRAY_CARDINALITY(interfaces); i++)
+        interfaces[i].applied = 0;
+
+    if ((testDefineFilter(data->name, data->priority,
+                          data->refs) < 0) != data->fail)
+        goto cleanup;
+
+    for (i = 0; i < ARRAY_CARDINALITY(interfaces); i++) {
+        if (interfaces[i].applied > 1)
+            goto cleanup;
+        if (interfaces[i].applied)
+            virBufferAsprintf(&buf, "%s%s", virBufferUse(&buf) ? " " : "",
+                              interfaces[i].filter);
+    }
+
+    if (virBufferError(&buf))
+        goto cleanup;
+    actual = virBufferContentAndReset(&buf);
+
+    if (STRNEQ(actual ? actual : "", data->expect)) {
+        virtTestDifference(stderr, data->expect, actual ? actual : "");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virBufferFreeAndReset(&buf);
+    VIR_FREE(actual);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    static const char *leaf[] = { "leaf", NULL };
+    static const char *direct[] = { "direct", NULL };
+    static const char *diamond[] = { "direct", "leaf", NULL };
+    static const char *unrelated[] = { "unrelated", NULL };
+    static const char *loop[] = { "transitive", NULL };
+
+    if (virNWFilterConfLayerInit(testUpdateCB) < 0)
+        return EXIT_FAILURE;
+    virNWFilterRegisterCallbackDriver(&testCallbackDriver);
+
+    /* None of the filters is used when defined the first time. Those
+     * including others come first, so that finding them all takes
+     * more than one pass over the list */
+    if (testDefineFilter("other", 0, unrelated) < 0 ||
+        testDefineFilter("transitive", 0, direct) < 0 ||
+        testDefineFilter("diamond", 0, diamond) < 0 ||
+        testDefineFilter("direct", 0, leaf) < 0 ||
+        testDefineFilter("leaf", 100, NULL) < 0 ||
+        testDefineFilter("unrelated", 100, NULL) < 0) {
+        ret = -1;
+        goto cleanup;
+    }
+
+#define DO_TEST(desc, name, priority, refs, fail, expect)               \
+    do {                                                                \
+        static struct testUpdateData data = {                           \
+            name, priority, refs, fail, expect                          \
+        };                                                              \
+        if (virtTestRun("Update " desc, 1, testUpdate, &data) < 0)      \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST("included filter", "leaf", 200, NULL, false,
+            "leaf direct transitive diamond");
+    DO_TEST("including filter", "direct", 200, leaf, false,
+            "direct transitive diamond");
+    DO_TEST("top filter", "diamond", 200, diamond, false, "diamond");
+    DO_TEST("unrelated filter", "unrelated", 200, NULL, false,
+            "unrelated other");
+    DO_TEST("unchanged filter", "unrelated", 200, NULL, false, "");
+    /* A loop is refused before any interface is touched */
+    DO_TEST("loop", "leaf", 300, loop, true, "");
+
+cleanup:
+    virNWFilterObjListFree(&nwfilters);
+    virNWFilterConfLayerShutdown();
+
+    return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
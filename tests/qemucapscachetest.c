@@ -0,0 +1,342 @@
+/*
+ * qemucapscachetest.c: Test the cache of probed QEMU capabilities
+ *
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#ifdef WITH_QEMU
+
+# include <stdio.h>
+# include <stdlib.h>
+# include <string.h>
+# include <unistd.h>
+# include <dirent.h>
+# include <sys/stat.h>
+
+# include "internal.h"
+# include "testutils.h"
+# include "qemu/qemu_capabilities.h"
+# include "memory.h"
+# include "util.h"
+# include "virfile.h"
+
+/*
+ * Checks when probing a QEMU binary is avoided by the capabilities
+ * cache, with a script standing in for the binary which counts how
+ * many times it is asked for its help text.
+ */
+
+static char *binary;
+static char *probesFile;
+static char *cacheDir;
+
+static unsigned int refVersion;
+static virBitmapPtr refFlags;
+
+/* Write the binary, failing if @fail, with @comment to tell
+ * versions of it apart */
+static int
+testWriteBinary(bool fail, const char *comment)
+{
+    char *script = NULL;
+    int ret = -1;
+
+    if (virAsprintf(&script,
+                    "#!/bin/sh\n"
+                    "# %s\n"
+                    "for arg ; do\n"
+                    "  if test \"$arg\" = -help ; then\n"
+                    "    printf x >> '%s'\n"
+                    "    %s\n"
+                    "    exec cat '%s/qemuhelpdata/qemu-kvm-0.13.0'\n"
+                    "  fi\n"
+                    "done\n"
+                    "exec cat '%s/qemuhelpdata/qemu-kvm-0.13.0-device' >&2\n",
+                    comment, probesFile, fail ? "exit 1" : "",
+                    abs_srcdir, abs_srcdir) < 0)
+        return -1;
+
+    if (virFileWriteStr(binary, script, 0755) < 0 ||
+        chmod(binary, 0755) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(script);
+    return ret;
+}
+
+static int
+testProbes(void)
+{
+    struct stat sb;
+
+    if (stat(probesFile, &sb) < 0)
+        return 0;
+    return sb.st_size;
+}
+
+/* Look the binary up, which must have been probed @probes times
+ * since the start, and give the same result as the first time */
+static int
+testLookup(int probes)
+{
+    unsigned int version;
+    virBitmapPtr flags = NULL;
+    int ret = -1;
+    int i;
+
+    if (qemuCapsExtractVersionInfo(binary, "x86_64", &version, &flags) < 0)
+        return -1;
+
+    if (testProbes() != probes) {
+        if (virTestGetVerbose())
+            testError("\nbinary probed %d times, expected %d",
+                      testProbes(), probes);
+        goto cleanup;
+    }
+
+    if (!refFlags) {
+        refVersion = version;
+        refFlags = flags;
+        return 0;
+    }
+
+    for (i = 0 ; i < QEMU_CAPS_LAST ; i++) {
+        if (qemuCapsGet(flags, i) != qemuCapsGet(refFlags, i)) {
+            if (virTestGetVerbose())
+                testError("\nflag %s differs", qemuCapsTypeToString(i));
+            goto cleanup;
+        }
+    }
+    if (version != refVersion)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    qemuCapsFree(flags);
+    return ret;
+}
+
+static int
+testCacheRestart(void)
+{
+    qemuCapsCacheFree();
+    return qemuCapsCacheInit(cacheDir);
+}
+
+static int
+testProbe(const void *data ATTRIBUTE_UNUSED)
+{
+    unsigned int version;
+    virBitmapPtr flags = NULL;
+    bool multibus;
+
+    if (testLookup(1) < 0 ||
+        !qemuCapsGet(refFlags, QEMU_CAPS_DEVICE) ||
+        !qemuCapsGet(refFlags, QEMU_CAPS_PCI_MULTIBUS))
+        return -1;
+
+    /* Neither the flags depending on the arch, nor the changes
+     * callers make to the flags they get, may end up in the cache */
+    if (qemuCapsExtractVersionInfo(binary, "ppc", &version, &flags) < 0)
+        return -1;
+    multibus = qemuCapsGet(flags, QEMU_CAPS_PCI_MULTIBUS);
+    qemuCapsClear(flags, QEMU_CAPS_DEVICE);
+    qemuCapsFree(flags);
+
+    if (multibus)
+        return -1;
+
+    return testLookup(1);
+}
+
+static int
+testChanged(const void *data ATTRIBUTE_UNUSED)
+{
+    if (testWriteBinary(false, "changed") < 0)
+        return -1;
+
+    if (testLookup(2) < 0 || testLookup(2) < 0)
+        return -1;
+
+    return 0;
+}
+
+static int
+testPersist(const void *data ATTRIBUTE_UNUSED)
+{
+    if (testCacheRestart() < 0)
+        return -1;
+
+    return testLookup(2);
+}
+
+static int
+testChangedPersist(const void *data ATTRIBUTE_UNUSED)
+{
+    /* Changed while the cache was not looking */
+    qemuCapsCacheFree();
+    if (testWriteBinary(false, "changed again") < 0 ||
+        qemuCapsCacheInit(cacheDir) < 0)
+        return -1;
+
+    return testLookup(3);
+}
+
+static int
+testOtherEnv(const void *data ATTRIBUTE_UNUSED)
+{
+    const char *old = getenv("LD_LIBRARY_PATH");
+    char *saved = NULL;
+    int ret = -1;
+
+    if (old && !(saved = strdup(old)))
+        return -1;
+
+    /* Probes might load other libraries */
+    if (setenv("LD_LIBRARY_PATH", "/nonexistent", 1) < 0 ||
+        testCacheRestart() < 0 ||
+        testLookup(4) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    if (saved)
+        setenv("LD_LIBRARY_PATH", saved, 1);
+    else
+        unsetenv("LD_LIBRARY_PATH");
+    VIR_FREE(saved);
+    return ret;
+}
+
+static int
+testFailure(const void *data ATTRIBUTE_UNUSED)
+{
+    unsigned int version;
+    virBitmapPtr flags = NULL;
+    int i;
+
+    if (testWriteBinary(true, "broken") < 0)
+        return -1;
+
+    /* Nothing is cached for a binary which can't be probed */
+    for (i = 0 ; i < 2 ; i++) {
+        if (qemuCapsExtractVersionInfo(binary, "x86_64",
+                                       &version, &flags) == 0) {
+            qemuCapsFree(flags);
+            return -1;
+        }
+        if (testProbes() != 5 + i)
+            return -1;
+    }
+
+    return 0;
+}
+
+static void
+testCleanupDir(const char *path)
+{
+    DIR *dir;
+    struct dirent *ent;
+    char *file;
+
+    if (!path || !(dir = opendir(path)))
+        return;
+
+    while ((ent = readdir(dir))) {
+        if (STREQ(ent->d_name, ".") || STREQ(ent->d_name, ".."))
+            continue;
+        if (virAsprintf(&file, "%s/%s", path, ent->d_name) < 0)
+            break;
+        if (ent->d_type == DT_DIR)
+            testCleanupDir(file);
+        else
+            unlink(file);
+        VIR_FREE(file);
+    }
+
+    closedir(dir);
+    rmdir(path);
+}
+
+static void
+testQuietError(void *userData ATTRIBUTE_UNUSED,
+               virErrorPtr error ATTRIBUTE_UNUSED)
+{
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    char tmpdir[] = "/tmp/qemucapscachetest-XXXXXX";
+
+    if (!mkdtemp(tmpdir)) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+
+    /* The broken binary is expected to fail probing */
+    if (!virTestGetDebug())
+        virSetErrorFunc(NULL, testQuietError);
+
+    if (virAsprintf(&binary, "%s/qemu", tmpdir) < 0 ||
+        virAsprintf(&probesFile, "%s/probes", tmpdir) < 0 ||
+        virAsprintf(&cacheDir, "%s/cache", tmpdir) < 0 ||
+        testWriteBinary(false, "original") < 0 ||
+        qemuCapsCacheInit(cacheDir) < 0) {
+        ret = -1;
+        goto cleanup;
+    }
+
+    /* Each test relies on what the previous ones cached */
+    if (virtTestRun("Probe", 1, testProbe, NULL) < 0 ||
+        virtTestRun("Binary changed", 1, testChanged, NULL) < 0 ||
+        virtTestRun("Persisted", 1, testPersist, NULL) < 0 ||
+        virtTestRun("Binary changed while stopped", 1,
+                    testChangedPersist, NULL) < 0 ||
+        virtTestRun("Other environment", 1, testOtherEnv, NULL) < 0 ||
+        virtTestRun("Failure", 1, testFailure, NULL) < 0)
+        ret = -1;
+
+cleanup:
+    qemuCapsCacheFree();
+    qemuCapsFree(refFlags);
+    testCleanupDir(tmpdir);
+    VIR_FREE(binary);
+    VIR_FREE(probesFile);
+    VIR_FREE(cacheDir);
+
+    return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
+
+#else
+
+int main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* WITH_QEMU */
@@ -0,0 +1,254 @@
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#ifdef WITH_QEMU
+
+# include "internal.h"
+# include "memory.h"
+# include "testutils.h"
+# include "util.h"
+# include "threads.h"
+# include "virfile.h"
+# include "virtime.h"
+# include "datatypes.h"
+# include "fdstream.h"
+# include "qemu/qemu_migration.h"
+
+/* QEMU writes its migration data in pieces of this size */
+# define QEMU_WRITE_SIZE 32768
+# define READ_SIZE 65536
+
+/* The data sent through the tunnel repeats with a period of 251 bytes,
+ * so that misplaced pieces are noticed; any offset into the data can be
+ * checked against pattern + offset % 251 */
+static char pattern[READ_SIZE + 251];
+
+struct testTunnelData {
+    size_t total;
+};
+
+struct testTunnelWriter {
+    int fd;
+    size_t total;
+    int ret;
+};
+
+/* Plays QEMU, writing @total bytes of migration data to the tunnel */
+static void
+testTunnelWrite(void *opaque)
+{
+    struct testTunnelWriter *writer = opaque;
+    char buf[QEMU_WRITE_SIZE];
+    size_t offset = 0;
+
+    while (offset < writer->total) {
+        size_t len = MIN(sizeof(buf), writer->total - offset);
+
+        memcpy(buf, pattern + offset % 251, len);
+        if (safewrite(writer->fd, buf, len) != len) {
+            writer->ret = -1;
+            break;
+        }
+        offset += len;
+    }
+
+    VIR_FORCE_CLOSE(writer->fd);
+}
+
+static int
+testTunnel(const void *opaque)
+{
+    const struct testTunnelData *data = opaque;
+    struct testTunnelWriter writer = { -1, data->total, 0 };
+    virConnectPtr conn = NULL;
+    virStreamPtr st = NULL;
+    qemuMigrationIOThreadPtr io = NULL;
+    virThread thread;
+    bool writing = false;
+    int qemufd[2] = { -1, -1 };
+    int sinkfd[2] = { -1, -1 };
+    char *buf = NULL;
+    size_t received = 0;
+    unsigned long long start, now;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(buf, READ_SIZE) < 0)
+        goto cleanup;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, qemufd) < 0 ||
+        socketpair(AF_UNIX, SOCK_STREAM, 0, sinkfd) < 0)
+        goto cleanup;
+
+    /* The stream to the destination host is replaced by a socket */
+    if (!(conn = virGetConnect()) ||
+        !(st = virGetStream(conn)) ||
+        virFDStreamOpen(st, sinkfd[0]) < 0)
+        goto cleanup;
+    sinkfd[0] = -1;
+
+    if (virTimeMillisNow(&start) < 0)
+        goto cleanup;
+
+    if (!(io = qemuMigrationStartTunnel(st, qemufd[0])))
+        goto cleanup;
+
+    writer.fd = qemufd[1];
+    qemufd[1] = -1;
+    if (virThreadCreate(&thread, true, testTunnelWrite, &writer) < 0) {
+        VIR_FORCE_CLOSE(writer.fd);
+        goto cleanup;
+    }
+    writing = true;
+
+    for (;;) {
+        ssize_t got = saferead(sinkfd[1], buf, READ_SIZE);
+
+        if (got < 0)
+            goto cleanup;
+        if (got == 0)
+            break;
+
+        if (memcmp(buf, pattern + received % 251, got) != 0) {
+            if (virTestGetVerbose())
+                testError("\ndata corrupted after offset %zu", received);
+            goto cleanup;
+        }
+        received += got;
+    }
+
+    if (virTimeMillisNow(&now) < 0)
+        goto cleanup;
+
+    if (received != data->total) {
+        if (virTestGetVerbose())
+            testError("\nexpected %zu bytes, got %zu",
+                      data->total, received);
+        goto cleanup;
+    }
+
+    if (virTestGetDebug())
+        fprintf(stderr, "\n%zu MiB in %llums\n%74s",
+                data->total / (1024 * 1024), now - start, "... ");
+
+    ret = 0;
+
+cleanup:
+    if (writing) {
+        virThreadJoin(&thread);
+        if (writer.ret < 0)
+            ret = -1;
+    }
+    if (io && qemuMigrationStopTunnel(io, ret < 0) < 0)
+        ret = -1;
+    VIR_FORCE_CLOSE(qemufd[0]);
+    VIR_FORCE_CLOSE(qemufd[1]);
+    VIR_FORCE_CLOSE(sinkfd[0]);
+    VIR_FORCE_CLOSE(sinkfd[1]);
+    if (st)
+        virUnrefStream(st);
+    if (conn)
+        virUnrefConnect(conn);
+    VIR_FREE(buf);
+    return ret;
+}
+
+static int
+testTunnelAbort(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virConnectPtr conn = NULL;
+    virStreamPtr st = NULL;
+    qemuMigrationIOThreadPtr io = NULL;
+    int qemufd[2] = { -1, -1 };
+    int sinkfd[2] = { -1, -1 };
+    char buf[8];
+    int ret = -1;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, qemufd) < 0 ||
+        socketpair(AF_UNIX, SOCK_STREAM, 0, sinkfd) < 0)
+        goto cleanup;
+
+    if (!(conn = virGetConnect()) ||
+        !(st = virGetStream(conn)) ||
+        virFDStreamOpen(st, sinkfd[0]) < 0)
+        goto cleanup;
+    sinkfd[0] = -1;
+
+    if (!(io = qemuMigrationStartTunnel(st, qemufd[0])))
+        goto cleanup;
+
+    /* QEMU is still connected, but migration failed */
+    if (safewrite(qemufd[1], "data", 4) != 4)
+        goto cleanup;
+    ret = qemuMigrationStopTunnel(io, true);
+    io = NULL;
+
+    /* The stream must have been closed, with at most the data QEMU
+     * sent before the abort */
+    if (ret == 0 &&
+        (saferead(sinkfd[1], buf, sizeof(buf)) > 4 ||
+         saferead(sinkfd[1], buf, sizeof(buf)) != 0)) {
+        if (virTestGetVerbose())
+            testError("\nstream wasn't closed");
+        ret = -1;
+    }
+
+cleanup:
+    if (io && qemuMigrationStopTunnel(io, true) < 0)
+        ret = -1;
+    VIR_FORCE_CLOSE(qemufd[0]);
+    VIR_FORCE_CLOSE(qemufd[1]);
+    VIR_FORCE_CLOSE(sinkfd[0]);
+    VIR_FORCE_CLOSE(sinkfd[1]);
+    if (st)
+        virUnrefStream(st);
+    if (conn)
+        virUnrefConnect(conn);
+    return ret;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    size_t i;
+
+    for (i = 0 ; i < sizeof(pattern) ; i++)
+        pattern[i] = i % 251;
+
+# define DO_TEST(name, total)                                           \
+    do {                                                                \
+        struct testTunnelData data = { total };                         \
+        if (virtTestRun("Tunnel " name, 1, testTunnel, &data) < 0)      \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST("empty", 0);
+    DO_TEST("small", 1000);
+    DO_TEST("unaligned", 3 * 1024 * 1024 + 17);
+    /* Sending 256 MiB takes a while, so only do it with --debug, which
+     * also reports the throughput of the tunnel */
+    if (virTestGetDebug())
+        DO_TEST("bulk", 256 * 1024 * 1024);
+
+    if (virtTestRun("Tunnel abort", 1, testTunnelAbort, NULL) < 0)
+        ret = -1;
+
+    return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
+
+#else
+# include "testutils.h"
+
+int main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* WITH_QEMU */
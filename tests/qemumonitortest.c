@@ -4,6 +4,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 
 #ifdef WITH_QEMU
 
@@ -11,7 +14,14 @@
 # include "memory.h"
 # include "testutils.h"
 # include "util.h"
+# include "buf.h"
+# include "json.h"
+# include "threads.h"
+# include "virfile.h"
+# include "virtime.h"
+# include "qemu/qemu_domain.h"
 # include "qemu/qemu_monitor.h"
+# include "qemu/qemu_monitor_json.h"
 
 struct testEscapeString
 {
@@ -86,10 +96,984 @@ static int testUnescapeArg(const void *data ATTRIBUTE_UNUSED)
     return 0;
 }
 
+
+/*
+ * A fake QEMU answering QMP commands on the monitor socket. It holds
+ * back the replies until it received 'batch' commands and then sends
+ * them in reverse order, with an event in between, so that they only
+ * come through if the monitor has all of the commands in flight at
+ * once and tells replies apart by their id. If no further command
+ * arrives for a while, the held ones are answered with errors.
+ */
+# define NHELD 16
+# define HOLD_TIMEOUT 5000 /* ms */
+# define BUFLEN (64 * 1024)
+
+struct testQemu {
+    virMutex lock;
+    virThread thread;
+    bool running;
+    char *path;
+    int listenfd;
+    int fd;
+
+    /* Protected by lock */
+    size_t batch;
+    virBuffer log; /* commands received, in order */
+    const char *fail; /* command answered with an error */
+    const char *blockstats; /* what query-blockstats returns, if set */
+
+    virJSONValuePtr held[NHELD];
+    size_t nheld;
+};
+
+static struct testQemu qemu;
+static qemuMonitorPtr mon;
+static bool eventQuit;
+
+static struct qemud_driver driver;
+static virCapsPtr caps;
+static virDomainObjList doms;
+
+static int
+testQemuSend(const char *fmt, ...)
+{
+    va_list args;
+    char *str = NULL;
+    int ret = -1;
+
+    va_start(args, fmt);
+    if (virVasprintf(&str, fmt, args) >= 0 &&
+        safewrite(qemu.fd, str, strlen(str)) >= 0 &&
+        safewrite(qemu.fd, "\r\n", 2) >= 0)
+        ret = 0;
+    va_end(args);
+
+    VIR_FREE(str);
+    return ret;
+}
+
+/* A reply of @n disks, long enough to come in many reads */
+static int
+testQemuReplyLarge(const char *id, int n)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    char *str;
+    int i;
+    int ret;
+
+    virBufferAddLit(&buf, "{\"return\": [");
+    for (i = 0; i < n; i++)
+        virBufferAsprintf(&buf, "%s{\"device\": \"drive-virtio-disk%d\", "
+                          "\"n\": %d}", i ? ", " : "", i, i);
+    virBufferAsprintf(&buf, "], \"id\": \"%s\"}", id);
+
+    if (!(str = virBufferContentAndReset(&buf)))
+        return -1;
+    ret = testQemuSend("%s", str);
+    VIR_FREE(str);
+    return ret;
+}
+
+static int
+testQemuReply(virJSONValuePtr cmd, bool timedout)
+{
+    const char *name = virJSONValueObjectGetString(cmd, "execute");
+    const char *id = virJSONValueObjectGetString(cmd, "id");
+    virJSONValuePtr args = virJSONValueObjectGet(cmd, "arguments");
+    int n;
+
+    bool fail;
+    const char *blockstats;
+
+    if (!name || !id)
+        return -1;
+
+    if (timedout)
+        return testQemuSend("{\"error\": {\"class\": \"GenericError\", "
+                            "\"desc\": \"timed out waiting for batch\"}, "
+                            "\"id\": \"%s\"}", id);
+
+    virMutexLock(&qemu.lock);
+    fail = STREQ_NULLABLE(name, qemu.fail);
+    blockstats = qemu.blockstats;
+    virMutexUnlock(&qemu.lock);
+    if (fail)
+        return testQemuSend("{\"error\": {\"class\": \"GenericError\", "
+                            "\"desc\": \"%s failed\"}, \"id\": \"%s\"}",
+                            name, id);
+
+    if (STREQ(name, "test-echo") && args &&
+        virJSONValueObjectGetNumberInt(args, "n", &n) == 0)
+        return testQemuSend("{\"return\": {\"n\": %d}, \"id\": \"%s\"}",
+                            n, id);
+
+    if (STREQ(name, "test-large") && args &&
+        virJSONValueObjectGetNumberInt(args, "n", &n) == 0)
+        return testQemuReplyLarge(id, n);
+
+    if (STREQ(name, "query-balloon"))
+        return testQemuSend("{\"return\": {\"actual\": 1073741824}, "
+                            "\"id\": \"%s\"}", id);
+
+    if (STREQ(name, "query-blockstats") && blockstats)
+        return testQemuSend("{\"return\": %s, \"id\": \"%s\"}",
+                            blockstats, id);
+
+    if (STREQ(name, "query-blockstats"))
+        return testQemuSend("{\"return\": [{\"device\": \"drive-virtio-disk0\", "
+                            "\"stats\": {\"rd_bytes\": 1, \"rd_operations\": 2, "
+                            "\"wr_bytes\": 3, \"wr_operations\": 4}}], "
+                            "\"id\": \"%s\"}", id);
+
+    if (STREQ(name, "query-block"))
+        return testQemuSend("{\"return\": [{\"device\": \"drive-virtio-disk0\", "
+                            "\"removable\": false, \"locked\": false}], "
+                            "\"id\": \"%s\"}", id);
+
+    return testQemuSend("{\"error\": {\"class\": \"CommandNotFound\", "
+                        "\"desc\": \"The command %s has not been found\"}, "
+                        "\"id\": \"%s\"}", name, id);
+}
+
+static int
+testQemuFlush(bool timedout)
+{
+    int ret = 0;
+
+    while (qemu.nheld > 0) {
+        qemu.nheld--;
+        if (testQemuReply(qemu.held[qemu.nheld], timedout) < 0)
+            ret = -1;
+        virJSONValueFree(qemu.held[qemu.nheld]);
+
+        if (qemu.nheld > 0 &&
+            testQemuSend("{\"event\": \"TEST\", \"data\": {}, "
+                         "\"timestamp\": {\"seconds\": 0, "
+                         "\"microseconds\": 0}}") < 0)
+            ret = -1;
+    }
+
+    return ret;
+}
+
+static int
+testQemuCommand(const char *line)
+{
+    virJSONValuePtr cmd;
+    const char *name;
+    int n;
+    size_t batch;
+
+    if (!(cmd = virJSONValueFromString(line)) ||
+        !(name = virJSONValueObjectGetString(cmd, "execute"))) {
+        virJSONValueFree(cmd);
+        return -1;
+    }
+
+    virMutexLock(&qemu.lock);
+    virBufferAdd(&qemu.log, name, -1);
+    if (virJSONValueObjectGet(cmd, "arguments") &&
+        virJSONValueObjectGetNumberInt(virJSONValueObjectGet(cmd, "arguments"),
+                                       "n", &n) == 0)
+        virBufferAsprintf(&qemu.log, " %d", n);
+    virBufferAddChar(&qemu.log, '\n');
+    batch = qemu.batch;
+    virMutexUnlock(&qemu.lock);
+
+    if (qemu.nheld == NHELD) {
+        virJSONValueFree(cmd);
+        return -1;
+    }
+    qemu.held[qemu.nheld++] = cmd;
+
+    if (qemu.nheld >= batch)
+        return testQemuFlush(false);
+
+    return 0;
+}
+
+static void
+testQemuServe(void *opaque ATTRIBUTE_UNUSED)
+{
+    char *buf = NULL;
+    size_t len = 0;
+
+    if ((qemu.fd = accept(qemu.listenfd, NULL, NULL)) < 0 ||
+        VIR_ALLOC_N(buf, BUFLEN) < 0)
+        goto cleanup;
+
+    if (testQemuSend("{\"QMP\": {\"version\": {\"qemu\": {\"micro\": 0, "
+                     "\"minor\": 0, \"major\": 1}, \"package\": \"\"}, "
+                     "\"capabilities\": []}}") < 0)
+        goto cleanup;
+
+    for (;;) {
+        struct pollfd fds = { .fd = qemu.fd, .events = POLLIN };
+        char *nl;
+        ssize_t got;
+        int rc;
+
+        rc = poll(&fds, 1, qemu.nheld ? HOLD_TIMEOUT : -1);
+        if (rc < 0 && errno == EINTR)
+            continue;
+        if (rc < 0)
+            break;
+        if (rc == 0) {
+            if (testQemuFlush(true) < 0)
+                break;
+            continue;
+        }
+
+        if ((got = read(qemu.fd, buf + len, BUFLEN - len - 1)) <= 0)
+            break;
+        len += got;
+        buf[len] = '\0';
+
+        while ((nl = strstr(buf, "\r\n"))) {
+            size_t used = nl - buf + 2;
+
+            *nl = '\0';
+            if (testQemuCommand(buf) < 0)
+                goto cleanup;
+            memmove(buf, buf + used, len - used + 1);
+            len -= used;
+        }
+    }
+
+cleanup:
+    while (qemu.nheld > 0)
+        virJSONValueFree(qemu.held[--qemu.nheld]);
+    VIR_FORCE_CLOSE(qemu.fd);
+    VIR_FREE(buf);
+}
+
+/* Set how many commands the fake QEMU waits for before replying and
+ * return what it received so far */
+static char *
+testQemuReset(size_t batch)
+{
+    char *log;
+
+    virMutexLock(&qemu.lock);
+    qemu.batch = batch;
+    log = virBufferContentAndReset(&qemu.log);
+    virMutexUnlock(&qemu.lock);
+
+    return log;
+}
+
+/* Make the fake QEMU fail the command @name, or none if NULL */
+static void
+testQemuFail(const char *name)
+{
+    virMutexLock(&qemu.lock);
+    qemu.fail = name;
+    virMutexUnlock(&qemu.lock);
+}
+
+/* Make the fake QEMU answer query-blockstats with @reply, or with its
+ * usual single disk if NULL */
+static void
+testQemuBlockStats(const char *reply)
+{
+    virMutexLock(&qemu.lock);
+    qemu.blockstats = reply;
+    virMutexUnlock(&qemu.lock);
+}
+
+static int
+testCheckLog(const char *expect)
+{
+    char *log = testQemuReset(1);
+    int ret = 0;
+
+    /* Nothing received leaves the log empty */
+    if (STRNEQ(expect, log ? log : "")) {
+        virtTestDifference(stderr, expect, log ? log : "");
+        ret = -1;
+    }
+
+    VIR_FREE(log);
+    return ret;
+}
+
+static void
+testEventLoop(void *opaque ATTRIBUTE_UNUSED)
+{
+    while (!eventQuit) {
+        if (virEventRunDefaultImpl() < 0)
+            break;
+    }
+}
+
+static void
+testEventQuit(int timer, void *opaque ATTRIBUTE_UNUSED)
+{
+    virEventRemoveTimeout(timer);
+    eventQuit = true;
+}
+
+static void
+testMonitorEOF(qemuMonitorPtr m ATTRIBUTE_UNUSED,
+               virDomainObjPtr vm ATTRIBUTE_UNUSED)
+{
+}
+
+static qemuMonitorCallbacks testCallbacks = {
+    .eofNotify = testMonitorEOF,
+    .errorNotify = testMonitorEOF,
+};
+
+static int
+testMonitorStart(const char *tmpdir,
+                 virDomainObjPtr vm)
+{
+    struct sockaddr_un addr;
+    virDomainChrSourceDef config;
+
+    if (virAsprintf(&qemu.path, "%s/monitor.sock", tmpdir) < 0)
+        return -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (!virStrcpyStatic(addr.sun_path, qemu.path) ||
+        (qemu.listenfd = socket(AF_UNIX, SOCK_STREAM, 0)) < 0 ||
+        bind(qemu.listenfd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(qemu.listenfd, 1) < 0)
+        return -1;
+
+    if (virThreadCreate(&qemu.thread, true, testQemuServe, NULL) < 0)
+        return -1;
+    qemu.running = true;
+
+    memset(&config, 0, sizeof(config));
+    config.type = VIR_DOMAIN_CHR_TYPE_UNIX;
+    config.data.nix.path = qemu.path;
+    vm->pid = getpid();
+
+    if (!(mon = qemuMonitorOpen(vm, &config, 1, &testCallbacks)))
+        return -1;
+
+    return 0;
+}
+
+/* Replies are matched to the commands sent back to back */
+static int
+testPipeline(const void *data ATTRIBUTE_UNUSED)
+{
+    virJSONValuePtr cmds[NHELD];
+    virJSONValuePtr replies[NHELD];
+    virBuffer expect = VIR_BUFFER_INITIALIZER;
+    char *expectstr = NULL;
+    char *cmdstr;
+    int n;
+    int i;
+    int ret = -1;
+
+    memset(cmds, 0, sizeof(cmds));
+    memset(replies, 0, sizeof(replies));
+
+    for (i = 0; i < NHELD; i++) {
+        if (virAsprintf(&cmdstr, "{\"execute\": \"test-echo\", "
+                        "\"arguments\": {\"n\": %d}}", i) < 0)
+            goto cleanup;
+        cmds[i] = virJSONValueFromString(cmdstr);
+        VIR_FREE(cmdstr);
+        if (!cmds[i])
+            goto cleanup;
+        virBufferAsprintf(&expect, "test-echo %d\n", i);
+    }
+    if (!(expectstr = virBufferContentAndReset(&expect)))
+        goto cleanup;
+
+    cmdstr = testQemuReset(NHELD);
+    VIR_FREE(cmdstr);
+
+    qemuMonitorLock(mon);
+    ret = qemuMonitorJSONCommandBatch(mon, cmds, NHELD, replies);
+    qemuMonitorUnlock(mon);
+    if (ret < 0)
+        goto cleanup;
+    ret = -1;
+
+    for (i = 0; i < NHELD; i++) {
+        virJSONValuePtr val = virJSONValueObjectGet(replies[i], "return");
+
+        if (!val || virJSONValueObjectGetNumberInt(val, "n", &n) < 0 ||
+            n != i) {
+            if (virTestGetVerbose())
+                testError("\nwrong reply to command %d", i);
+            goto cleanup;
+        }
+    }
+
+    ret = testCheckLog(expectstr);
+
+cleanup:
+    for (i = 0; i < NHELD; i++) {
+        virJSONValueFree(cmds[i]);
+        virJSONValueFree(replies[i]);
+    }
+    virBufferFreeAndReset(&expect);
+    VIR_FREE(expectstr);
+    return ret;
+}
+
+/* Commands may be completed in another order than submitted */
+static int
+testAsync(const void *data ATTRIBUTE_UNUSED)
+{
+    const char *names[] = { "query-balloon", "query-status", "query-blockstats" };
+    virJSONValuePtr cmds[ARRAY_CARDINALITY(names)];
+    qemuMonitorMessagePtr msgs[ARRAY_CARDINALITY(names)];
+    virJSONValuePtr reply;
+    char *cmdstr;
+    int i;
+    int ret = 0;
+
+    memset(cmds, 0, sizeof(cmds));
+    memset(msgs, 0, sizeof(msgs));
+
+    cmdstr = testQemuReset(ARRAY_CARDINALITY(names));
+    VIR_FREE(cmdstr);
+
+    qemuMonitorLock(mon);
+    for (i = 0; i < ARRAY_CARDINALITY(names); i++) {
+        if (virAsprintf(&cmdstr, "{\"execute\": \"%s\"}", names[i]) < 0 ||
+            !(cmds[i] = virJSONValueFromString(cmdstr)) ||
+            qemuMonitorJSONCommandSubmit(mon, cmds[i], -1, &msgs[i]) < 0)
+            ret = -1;
+        VIR_FREE(cmdstr);
+    }
+
+    for (i = ARRAY_CARDINALITY(names) - 1; i >= 0; i--) {
+        if (!msgs[i])
+            continue;
+        if (qemuMonitorJSONCommandComplete(mon, msgs[i], &reply) < 0) {
+            ret = -1;
+            continue;
+        }
+
+        /* query-status is unknown to the fake QEMU */
+        if (!!virJSONValueObjectHasKey(reply, "return") !=
+            STRNEQ(names[i], "query-status")) {
+            if (virTestGetVerbose())
+                testError("\nwrong reply to %s", names[i]);
+            ret = -1;
+        }
+        virJSONValueFree(reply);
+    }
+    qemuMonitorUnlock(mon);
+
+    for (i = 0; i < ARRAY_CARDINALITY(names); i++)
+        virJSONValueFree(cmds[i]);
+
+    if (testCheckLog("query-balloon\nquery-status\nquery-blockstats\n") < 0)
+        ret = -1;
+
+    return ret;
+}
+
+/* Balloon and block stats come from a single round trip */
+static int
+testAllStats(const void *data ATTRIBUTE_UNUSED)
+{
+    virHashTablePtr blockstats = NULL;
+    qemuBlockStatsPtr stats;
+    unsigned long long currmem;
+    int balloonRet;
+    char *cmdstr;
+    int ret = -1;
+
+    cmdstr = testQemuReset(2);
+    VIR_FREE(cmdstr);
+
+    qemuMonitorLock(mon);
+    ret = qemuMonitorGetAllStatsInfo(mon, &balloonRet, &currmem, &blockstats);
+    qemuMonitorUnlock(mon);
+    if (ret < 0)
+        goto cleanup;
+    ret = -1;
+
+    if (balloonRet != 1 || currmem != 1024 * 1024) {
+        if (virTestGetVerbose())
+            testError("\nwrong balloon size %llu", currmem);
+        goto cleanup;
+    }
+
+    if (!(stats = virHashLookup(blockstats, "virtio-disk0")) ||
+        stats->rd_bytes != 1 || stats->rd_req != 2 ||
+        stats->wr_bytes != 3 || stats->wr_req != 4 ||
+        stats->rd_total_times != -1) {
+        if (virTestGetVerbose())
+            testError("\nwrong block stats");
+        goto cleanup;
+    }
+
+    ret = testCheckLog("query-balloon\nquery-blockstats\n");
+
+cleanup:
+    virHashFree(blockstats);
+    return ret;
+}
+
+struct testBlockStatsData {
+    const char *name;
+    const char *reply; /* returned by query-blockstats */
+    bool fail;
+    size_t ndevices;
+    const char *device; /* whose stats are checked */
+    qemuBlockStats stats;
+};
+
+# define BLOCKSTATS_ALL                                                 \
+    "{\"rd_bytes\": 1, \"rd_operations\": 2, "                          \
+    "\"rd_total_times_ns\": 3, \"wr_bytes\": 4, "                       \
+    "\"wr_operations\": 5, \"wr_total_times_ns\": 6, "                  \
+    "\"flush_operations\": 7, \"flush_total_times_ns\": 8}"
+# define BLOCKSTATS_BASIC                                               \
+    "{\"rd_bytes\": 10, \"rd_operations\": 20, "                        \
+    "\"wr_bytes\": 30, \"wr_operations\": 40}"
+
+static const struct testBlockStatsData blockStatsData[] = {
+    { .name = "all fields",
+      .reply = "[{\"device\": \"drive-virtio-disk0\", "
+               "\"stats\": " BLOCKSTATS_ALL "}, "
+               "{\"device\": \"drive-ide0-0-0\", "
+               "\"stats\": " BLOCKSTATS_BASIC "}]",
+      .ndevices = 2, .device = "virtio-disk0",
+      .stats = { .rd_bytes = 1, .rd_req = 2, .rd_total_times = 3,
+                 .wr_bytes = 4, .wr_req = 5, .wr_total_times = 6,
+                 .flush_req = 7, .flush_total_times = 8 } },
+    { .name = "missing fields",
+      .reply = "[{\"device\": \"drive-virtio-disk0\", "
+               "\"stats\": " BLOCKSTATS_ALL "}, "
+               "{\"device\": \"drive-ide0-0-0\", "
+               "\"stats\": " BLOCKSTATS_BASIC "}]",
+      .ndevices = 2, .device = "ide0-0-0",
+      .stats = { .rd_bytes = 10, .rd_req = 20, .rd_total_times = -1,
+                 .wr_bytes = 30, .wr_req = 40, .wr_total_times = -1,
+                 .flush_req = -1, .flush_total_times = -1 } },
+    { .name = "no prefix",
+      .reply = "[{\"device\": \"ide0-hd0\", "
+               "\"stats\": " BLOCKSTATS_BASIC "}]",
+      .ndevices = 1, .device = "ide0-hd0",
+      .stats = { .rd_bytes = 10, .rd_req = 20, .rd_total_times = -1,
+                 .wr_bytes = 30, .wr_req = 40, .wr_total_times = -1,
+                 .flush_req = -1, .flush_total_times = -1 } },
+    { .name = "no devices",
+      .reply = "[]" },
+    { .name = "no stats",
+      .reply = "[{\"device\": \"drive-virtio-disk0\"}]",
+      .fail = true },
+    { .name = "no device name",
+      .reply = "[{\"stats\": " BLOCKSTATS_BASIC "}]",
+      .fail = true },
+    { .name = "missing required field",
+      .reply = "[{\"device\": \"drive-virtio-disk0\", "
+               "\"stats\": {\"rd_bytes\": 1, \"rd_operations\": 2, "
+               "\"wr_bytes\": 3}}]",
+      .fail = true },
+    { .name = "not a list",
+      .reply = "{}",
+      .fail = true },
+};
+
+/* The stats of all block devices come from a single query-blockstats,
+ * keyed by the guest side alias, with those QEMU leaves out set to -1 */
+static int
+testAllBlockStats(const void *opaque)
+{
+    const struct testBlockStatsData *data = opaque;
+    virHashTablePtr blockstats;
+    qemuBlockStatsPtr stats;
+    char *cmdstr;
+    int ret = -1;
+
+    cmdstr = testQemuReset(1);
+    VIR_FREE(cmdstr);
+    testQemuBlockStats(data->reply);
+
+    qemuMonitorLock(mon);
+    blockstats = qemuMonitorGetAllBlockStatsInfo(mon);
+    qemuMonitorUnlock(mon);
+
+    testQemuBlockStats(NULL);
+
+    if (!blockstats != data->fail) {
+        if (virTestGetVerbose())
+            testError("\nreply was %s", data->fail ? "accepted" : "rejected");
+        goto cleanup;
+    }
+
+    if (blockstats && virHashSize(blockstats) != data->ndevices) {
+        if (virTestGetVerbose())
+            testError("\nexpected %zu devices, got %zd",
+                      data->ndevices, virHashSize(blockstats));
+        goto cleanup;
+    }
+
+    if (data->device &&
+        (!(stats = virHashLookup(blockstats, data->device)) ||
+         memcmp(stats, &data->stats, sizeof(*stats)) != 0)) {
+        if (virTestGetVerbose())
+            testError("\nwrong stats for %s", data->device);
+        goto cleanup;
+    }
+
+    ret = testCheckLog("query-blockstats\n");
+
+cleanup:
+    virHashFree(blockstats);
+    return ret;
+}
+
+/* With --debug, reports how long a reply of a few MB takes to come
+ * through */
+static int
+testLargeReply(const void *data ATTRIBUTE_UNUSED)
+{
+    const int n = 50000;
+    virJSONValuePtr cmd = NULL;
+    virJSONValuePtr reply = NULL;
+    virJSONValuePtr disks;
+    unsigned long long start, end;
+    char *cmdstr;
+    int i, val;
+    int ret = -1;
+
+    cmdstr = testQemuReset(1);
+    VIR_FREE(cmdstr);
+
+    if (virAsprintf(&cmdstr, "{\"execute\": \"test-large\", "
+                    "\"arguments\": {\"n\": %d}}", n) < 0)
+        goto cleanup;
+    cmd = virJSONValueFromString(cmdstr);
+    VIR_FREE(cmdstr);
+    if (!cmd || virTimeMillisNow(&start) < 0)
+        goto cleanup;
+
+    qemuMonitorLock(mon);
+    ret = qemuMonitorJSONCommandBatch(mon, &cmd, 1, &reply);
+    qemuMonitorUnlock(mon);
+    if (ret < 0 || virTimeMillisNow(&end) < 0)
+        goto cleanup;
+    ret = -1;
+
+    if (!(disks = virJSONValueObjectGet(reply, "return")) ||
+        virJSONValueArraySize(disks) != n) {
+        if (virTestGetVerbose())
+            testError("\nwrong number of disks");
+        goto cleanup;
+    }
+
+    for (i = 0; i < n; i++) {
+        if (virJSONValueObjectGetNumberInt(virJSONValueArrayGet(disks, i),
+                                           "n", &val) < 0 || val != i) {
+            if (virTestGetVerbose())
+                testError("\nwrong disk %d", i);
+            goto cleanup;
+        }
+    }
+
+    if (virTestGetDebug())
+        fprintf(stderr, "\n%d disks received in %llums\n%74s",
+                n, end - start, "... ");
+
+    ret = testCheckLog("test-large 50000\n");
+
+cleanup:
+    virJSONValueFree(cmd);
+    virJSONValueFree(reply);
+    return ret;
+}
+
+/*
+ * The statistics cache of the domain, with the fake QEMU standing in
+ * for the monitor and its log telling which groups were queried.
+ * Time passing is simulated by making the cached groups older.
+ */
+# define ALL_STATS (QEMU_DOMAIN_STATS_CACHE_BALLOON |       \
+                    QEMU_DOMAIN_STATS_CACHE_BLOCKSTATS |    \
+                    QEMU_DOMAIN_STATS_CACHE_BLOCKINFO)
+
+/* Ask for @groups in a query job, as the APIs reporting statistics
+ * do, which must return @expectRet after sending the commands in
+ * @expectLog, one per group, and finding the other groups in the
+ * cache */
+static int
+testStatsCacheUpdate(virDomainObjPtr vm,
+                     unsigned int groups,
+                     int expectRet,
+                     const char *expectLog)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    unsigned long long hits = priv->stats.hits;
+    unsigned long long misses = priv->stats.misses;
+    unsigned long long expectHits = 0;
+    unsigned long long expectMisses = 0;
+    const char *p;
+    char *log;
+    int rc;
+    int ret = 0;
+
+    log = testQemuReset(1);
+    VIR_FREE(log);
+
+    for (p = expectLog; *p; p++) {
+        if (*p == '\n')
+            expectMisses++;
+    }
+    expectHits = !!(groups & QEMU_DOMAIN_STATS_CACHE_BALLOON) +
+                 !!(groups & QEMU_DOMAIN_STATS_CACHE_BLOCKSTATS) +
+                 !!(groups & QEMU_DOMAIN_STATS_CACHE_BLOCKINFO) -
+                 expectMisses;
+
+    virDomainObjLock(vm);
+    if (qemuDomainObjBeginJob(&driver, vm, QEMU_JOB_QUERY) < 0) {
+        virDomainObjUnlock(vm);
+        return -1;
+    }
+    rc = qemuDomainUpdateStatsCache(&driver, vm, groups);
+    ignore_value(qemuDomainObjEndJob(&driver, vm));
+    virDomainObjUnlock(vm);
+
+    if (rc != expectRet) {
+        if (virTestGetVerbose())
+            testError("\nupdating the cache returned %d, expected %d",
+                      rc, expectRet);
+        ret = -1;
+    }
+
+    if (testCheckLog(expectLog) < 0)
+        ret = -1;
+
+    if (priv->stats.hits - hits != expectHits ||
+        priv->stats.misses - misses != expectMisses) {
+        if (virTestGetVerbose())
+            testError("\n%llu hits and %llu misses, expected %llu and %llu",
+                      priv->stats.hits - hits, priv->stats.misses - misses,
+                      expectHits, expectMisses);
+        ret = -1;
+    }
+
+    return ret;
+}
+
+/* Make the cached groups @ms older */
+static void
+testStatsCacheAge(virDomainObjPtr vm, unsigned long long ms)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuDomainStatsCachePtr cache = &priv->stats;
+
+    if (cache->balloonTime)
+        cache->balloonTime -= ms;
+    if (cache->blockStatsTime)
+        cache->blockStatsTime -= ms;
+    if (cache->blockInfoTime)
+        cache->blockInfoTime -= ms;
+}
+
+static bool
+testStatsCacheEmpty(virDomainObjPtr vm)
+{
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuDomainStatsCachePtr cache = &priv->stats;
+
+    return !cache->balloonTime && !cache->blockStatsTime &&
+           !cache->blockInfoTime && !cache->blockStats && !cache->blockInfo;
+}
+
+/* Groups are served from the cache until they are statsCacheTime old */
+static int
+testStatsCacheTTL(const void *data)
+{
+    virDomainObjPtr vm = (virDomainObjPtr)data;
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuDomainStatsCachePtr cache = &priv->stats;
+    qemuBlockStatsPtr stats;
+
+    if (testStatsCacheUpdate(vm, QEMU_DOMAIN_STATS_CACHE_BALLOON |
+                             QEMU_DOMAIN_STATS_CACHE_BLOCKSTATS, 0,
+                             "query-balloon\nquery-blockstats\n") < 0 ||
+        testStatsCacheUpdate(vm, ALL_STATS, 0, "query-block\n") < 0)
+        return -1;
+
+    if (cache->balloonRet != 1 || cache->balloon != 1024 * 1024 ||
+        !(stats = virHashLookup(cache->blockStats, "virtio-disk0")) ||
+        stats->rd_bytes != 1 || stats->wr_req != 4 ||
+        !virHashLookup(cache->blockInfo, "virtio-disk0")) {
+        if (virTestGetVerbose())
+            testError("\nwrong statistics in the cache");
+        return -1;
+    }
+
+    /* Leave the test half of statsCacheTime to get there */
+    testStatsCacheAge(vm, driver.statsCacheTime / 2);
+    if (testStatsCacheUpdate(vm, ALL_STATS, 0, "") < 0)
+        return -1;
+
+    testStatsCacheAge(vm, driver.statsCacheTime / 2);
+    return testStatsCacheUpdate(vm, ALL_STATS, 0,
+                                "query-balloon\nquery-blockstats\n"
+                                "query-block\n");
+}
+
+/* Any job but a query may change what QEMU would report */
+static int
+testStatsCacheJob(const void *data)
+{
+    virDomainObjPtr vm = (virDomainObjPtr)data;
+    bool empty;
+
+    if (testStatsCacheUpdate(vm, ALL_STATS, 0, "") < 0)
+        return -1;
+
+    virDomainObjLock(vm);
+    if (qemuDomainObjBeginJob(&driver, vm, QEMU_JOB_MODIFY) < 0) {
+        virDomainObjUnlock(vm);
+        return -1;
+    }
+    ignore_value(qemuDomainObjEndJob(&driver, vm));
+    empty = testStatsCacheEmpty(vm);
+    virDomainObjUnlock(vm);
+
+    if (!empty) {
+        if (virTestGetVerbose())
+            testError("\nstatistics still cached after a modify job");
+        return -1;
+    }
+
+    return testStatsCacheUpdate(vm, ALL_STATS, 0,
+                                "query-balloon\nquery-blockstats\n"
+                                "query-block\n");
+}
+
+/* Nothing of the previous run of a domain may be reported */
+static int
+testStatsCacheStop(const void *data)
+{
+    virDomainObjPtr vm = (virDomainObjPtr)data;
+    bool empty;
+
+    if (testStatsCacheUpdate(vm, ALL_STATS, 0, "") < 0)
+        return -1;
+
+    /* What qemuProcessStop does to the cache */
+    virDomainObjLock(vm);
+    qemuDomainStatsCacheClear(vm->privateData);
+    empty = testStatsCacheEmpty(vm);
+    virDomainObjUnlock(vm);
+
+    if (!empty) {
+        if (virTestGetVerbose())
+            testError("\nstatistics still cached after stopping");
+        return -1;
+    }
+
+    return testStatsCacheUpdate(vm, ALL_STATS, 0,
+                                "query-balloon\nquery-blockstats\n"
+                                "query-block\n");
+}
+
+/* Groups which couldn't be queried are asked for again next time,
+ * while the others are still served from the cache */
+static int
+testStatsCacheFailure(const void *data)
+{
+    virDomainObjPtr vm = (virDomainObjPtr)data;
+    qemuDomainObjPrivatePtr priv = vm->privateData;
+    qemuDomainStatsCachePtr cache = &priv->stats;
+    int ret = -1;
+
+    testStatsCacheAge(vm, driver.statsCacheTime);
+
+    testQemuFail("query-blockstats");
+    if (testStatsCacheUpdate(vm, ALL_STATS, -1,
+                             "query-balloon\nquery-blockstats\n"
+                             "query-block\n") < 0)
+        goto cleanup;
+
+    if (cache->blockStatsTime || cache->blockStats ||
+        !cache->balloonTime || !cache->blockInfoTime) {
+        if (virTestGetVerbose())
+            testError("\nwrong groups cached after a failure");
+        goto cleanup;
+    }
+
+    if (testStatsCacheUpdate(vm, ALL_STATS, -1, "query-blockstats\n") < 0)
+        goto cleanup;
+
+    testQemuFail("query-block");
+    testStatsCacheAge(vm, driver.statsCacheTime);
+    if (testStatsCacheUpdate(vm, QEMU_DOMAIN_STATS_CACHE_BLOCKINFO, -1,
+                             "query-block\n") < 0 ||
+        cache->blockInfoTime || cache->blockInfo)
+        goto cleanup;
+
+    testQemuFail("query-balloon");
+    testStatsCacheAge(vm, driver.statsCacheTime);
+    if (testStatsCacheUpdate(vm, QEMU_DOMAIN_STATS_CACHE_BALLOON, -1,
+                             "query-balloon\n") < 0 ||
+        cache->balloonTime || cache->balloonRet >= 0)
+        goto cleanup;
+
+    testQemuFail(NULL);
+    if (testStatsCacheUpdate(vm, ALL_STATS, 0,
+                             "query-balloon\nquery-blockstats\n"
+                             "query-block\n") < 0 ||
+        testStatsCacheUpdate(vm, ALL_STATS, 0, "") < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    testQemuFail(NULL);
+    return ret;
+}
+
+static void
+testQuietError(void *userData ATTRIBUTE_UNUSED,
+               virErrorPtr error ATTRIBUTE_UNUSED)
+{
+}
+
+/* A running domain, with the private data of the QEMU driver */
+static virDomainObjPtr
+testDomainNew(void)
+{
+    virDomainDefPtr def;
+    virDomainObjPtr vm;
+
+    if (!(caps = virCapabilitiesNew("x86_64", 0, 0)))
+        return NULL;
+    qemuDomainSetPrivateDataHooks(caps);
+
+    if (virDomainObjListInit(&doms) < 0 ||
+        VIR_ALLOC(def) < 0)
+        return NULL;
+
+    if (!(def->name = strdup("test")) ||
+        !(vm = virDomainAssignDef(caps, &doms, def, false))) {
+        virDomainDefFree(def);
+        return NULL;
+    }
+    vm->def->id = 1;
+    virDomainObjUnlock(vm);
+
+    return vm;
+}
+
 static int
 mymain(void)
 {
     int result = 0;
+    char tmpdir[] = "/tmp/qemumonitortest-XXXXXX";
+    virThread eventThread;
+    virDomainObjPtr vm = NULL;
+    size_t i;
 
 # define DO_TEST(_name)                                                 \
     do {                                                                \
@@ -99,9 +1083,92 @@ mymain(void)
         }                                                               \
     } while (0)
 
+# define DO_TEST_VM(_name)                                              \
+    do {                                                                \
+        if (virtTestRun("qemu monitor "#_name, 1, test##_name,          \
+                        vm) < 0) {                                      \
+            result = -1;                                                \
+        }                                                               \
+    } while (0)
+
     DO_TEST(EscapeArg);
     DO_TEST(UnescapeArg);
 
+    if (!mkdtemp(tmpdir)) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+
+    qemu.listenfd = qemu.fd = -1;
+    qemu.batch = 1;
+    if (virMutexInit(&qemu.lock) < 0) {
+        result = -1;
+        goto cleanup;
+    }
+
+    if (virEventRegisterDefaultImpl() < 0 ||
+        virThreadCreate(&eventThread, true, testEventLoop, NULL) < 0) {
+        result = -1;
+        goto cleanup;
+    }
+
+    /* Some commands are made to fail */
+    if (!virTestGetDebug())
+        virSetErrorFunc(NULL, testQuietError);
+
+    if (!(vm = testDomainNew()) ||
+        testMonitorStart(tmpdir, vm) < 0) {
+        result = -1;
+    } else {
+        qemuDomainObjPrivatePtr priv = vm->privateData;
+
+        DO_TEST(Pipeline);
+        DO_TEST(Async);
+        DO_TEST(AllStats);
+        for (i = 0; i < ARRAY_CARDINALITY(blockStatsData); i++) {
+            char *name;
+
+            if (virAsprintf(&name, "qemu monitor AllBlockStats %s",
+                            blockStatsData[i].name) < 0 ||
+                virtTestRun(name, 1, testAllBlockStats,
+                            &blockStatsData[i]) < 0)
+                result = -1;
+            VIR_FREE(name);
+        }
+        DO_TEST(LargeReply);
+
+        /* Each relies on what the previous ones cached */
+        driver.statsCacheTime = 1000;
+        priv->mon = mon;
+        DO_TEST_VM(StatsCacheTTL);
+        DO_TEST_VM(StatsCacheJob);
+        DO_TEST_VM(StatsCacheStop);
+        DO_TEST_VM(StatsCacheFailure);
+        priv->mon = NULL;
+    }
+
+    if (mon) {
+        qemuMonitorClose(mon);
+    } else if (qemu.running) {
+        /* Unblock the fake QEMU, the monitor never connected */
+        shutdown(qemu.listenfd, SHUT_RDWR);
+    }
+    if (qemu.running)
+        virThreadJoin(&qemu.thread);
+
+    if (virEventAddTimeout(0, testEventQuit, NULL, NULL) >= 0)
+        virThreadJoin(&eventThread);
+
+cleanup:
+    VIR_FORCE_CLOSE(qemu.listenfd);
+    if (qemu.path)
+        unlink(qemu.path);
+    VIR_FREE(qemu.path);
+    virBufferFreeAndReset(&qemu.log);
+    virDomainObjListDeinit(&doms);
+    virCapabilitiesFree(caps);
+    rmdir(tmpdir);
+
     return result == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
@@ -176,6 +176,7 @@ mymain(void)
     DO_TEST("net-virtio-device");
     DO_TEST("net-eth");
     DO_TEST("net-eth-ifname");
+    DO_TEST("net-direct-ifname");
     DO_TEST("net-virtio-network-portgroup");
     DO_TEST("net-hostdev");
     DO_TEST("sound");
@@ -0,0 +1,331 @@
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <dirent.h>
+
+#ifdef WITH_QEMU
+
+# include "internal.h"
+# include "testutils.h"
+# include "memory.h"
+# include "util.h"
+# include "virtime.h"
+# include "qemu/qemu_conf.h"
+# include "qemu/qemu_domain.h"
+# include "testutilsqemu.h"
+
+# define NCOPIES 1000
+
+static struct qemud_driver driver;
+
+struct testInfo {
+    const char *dir;
+    const char *name;
+};
+
+static int
+testSetAlias(virDomainDefPtr def ATTRIBUTE_UNUSED,
+             virDomainDeviceDefPtr dev ATTRIBUTE_UNUSED,
+             virDomainDeviceInfoPtr info,
+             void *opaque)
+{
+    int *n = opaque;
+
+    /* The info of <interface type='hostdev'> is seen twice */
+    if (info->alias)
+        return 0;
+
+    return virAsprintf(&info->alias, "dev%d", (*n)++);
+}
+
+static int
+testSetPty(virDomainChrSourceDefPtr src, int n)
+{
+    if (src->type != VIR_DOMAIN_CHR_TYPE_PTY)
+        return 0;
+
+    VIR_FREE(src->data.file.path);
+    return virAsprintf(&src->data.file.path, "/dev/pts/%d", n);
+}
+
+/*
+ * Fills in what a started domain has on top of its configuration:
+ * an ID, device aliases, allocated ports, tap device names, ptys and
+ * labels.
+ */
+static int
+testMakeLive(virDomainDefPtr def)
+{
+    int n = 0;
+    int i;
+
+    def->id = 42;
+
+    if (virDomainDeviceInfoIterate(def, testSetAlias, &n) < 0)
+        return -1;
+
+    for (i = 0; i < def->ngraphics; i++) {
+        virDomainGraphicsDefPtr graphics = def->graphics[i];
+
+        if (graphics->type == VIR_DOMAIN_GRAPHICS_TYPE_VNC &&
+            graphics->data.vnc.autoport)
+            graphics->data.vnc.port = 5900 + i;
+        if (graphics->type == VIR_DOMAIN_GRAPHICS_TYPE_SPICE &&
+            graphics->data.spice.autoport) {
+            graphics->data.spice.port = 5900 + i;
+            graphics->data.spice.tlsPort = 5800 + i;
+        }
+    }
+
+    for (i = 0; i < def->nnets; i++) {
+        virDomainNetDefPtr net = def->nets[i];
+
+        if (net->ifname ||
+            net->type == VIR_DOMAIN_NET_TYPE_USER ||
+            net->type == VIR_DOMAIN_NET_TYPE_HOSTDEV)
+            continue;
+        if (virAsprintf(&net->ifname, "%s%d",
+                        net->type == VIR_DOMAIN_NET_TYPE_DIRECT ?
+                        VIR_NET_GENERATED_MACVTAP_PREFIX :
+                        VIR_NET_GENERATED_PREFIX, i) < 0)
+            return -1;
+    }
+
+    for (i = 0; i < def->nserials; i++)
+        if (testSetPty(&def->serials[i]->source, n++) < 0)
+            return -1;
+    for (i = 0; i < def->nparallels; i++)
+        if (testSetPty(&def->parallels[i]->source, n++) < 0)
+            return -1;
+    for (i = 0; i < def->nchannels; i++)
+        if (testSetPty(&def->channels[i]->source, n++) < 0)
+            return -1;
+    for (i = 0; i < def->nconsoles; i++)
+        if (testSetPty(&def->consoles[i]->source, n++) < 0)
+            return -1;
+
+    if (def->seclabel.type == VIR_DOMAIN_SECLABEL_DYNAMIC) {
+        VIR_FREE(def->seclabel.label);
+        VIR_FREE(def->seclabel.imagelabel);
+        if (!(def->seclabel.label = strdup("system_u:system_r:svirt_t:s0:c1")) ||
+            !(def->seclabel.imagelabel =
+              strdup("system_u:object_r:svirt_image_t:s0:c1")))
+            return -1;
+    }
+
+    return 0;
+}
+
+/* The way virDomainDefCopy is meant to replace */
+static virDomainDefPtr
+testCopyXML(virDomainDefPtr def)
+{
+    virDomainDefPtr ret;
+    char *xml;
+
+    if (!(xml = virDomainDefFormat(def, VIR_DOMAIN_XML_SECURE)))
+        return NULL;
+
+    ret = virDomainDefParseString(driver.caps, xml, QEMU_EXPECTED_VIRT_TYPES,
+                                  VIR_DOMAIN_XML_INACTIVE);
+    VIR_FREE(xml);
+    return ret;
+}
+
+static int
+testCompareCopy(const void *data)
+{
+    const struct testInfo *info = data;
+    char *path = NULL;
+    char *xml = NULL;
+    char *expected = NULL;
+    char *actual = NULL;
+    virDomainDefPtr def = NULL;
+    virDomainDefPtr viaXML = NULL;
+    virDomainDefPtr copy = NULL;
+    int ret = -1;
+
+    if (virAsprintf(&path, "%s/%s", info->dir, info->name) < 0 ||
+        virtTestLoadFile(path, &xml) < 0)
+        goto cleanup;
+
+    /* Some of the files are meant not to be accepted */
+    if (!(def = virDomainDefParseString(driver.caps, xml,
+                                        QEMU_EXPECTED_VIRT_TYPES,
+                                        VIR_DOMAIN_XML_INACTIVE))) {
+        virResetLastError();
+        ret = 0;
+        goto cleanup;
+    }
+
+    if (testMakeLive(def) < 0 ||
+        !(viaXML = testCopyXML(def)) ||
+        !(copy = virDomainDefCopy(def)))
+        goto cleanup;
+
+    if (copy->id != -1 || viaXML->id != -1) {
+        if (virTestGetVerbose())
+            testError("\ncopy has ID %d, expected %d", copy->id, viaXML->id);
+        goto cleanup;
+    }
+
+    /* Keep the formatting of both from being forced to inactive */
+    copy->id = viaXML->id = def->id;
+
+    if (!(expected = virDomainDefFormat(viaXML, VIR_DOMAIN_XML_SECURE)) ||
+        !(actual = virDomainDefFormat(copy, VIR_DOMAIN_XML_SECURE)))
+        goto cleanup;
+
+    if (STRNEQ(expected, actual)) {
+        virtTestDifference(stderr, expected, actual);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(path);
+    VIR_FREE(xml);
+    VIR_FREE(expected);
+    VIR_FREE(actual);
+    virDomainDefFree(def);
+    virDomainDefFree(viaXML);
+    virDomainDefFree(copy);
+    return ret;
+}
+
+/* With --debug, reports how long copying a large definition takes */
+static int
+testCopySpeed(const void *data)
+{
+    const struct testInfo *info = data;
+    char *path = NULL;
+    char *xml = NULL;
+    virDomainDefPtr def = NULL;
+    virDomainDefPtr copy;
+    unsigned long long start, native, end;
+    int i;
+    int ret = -1;
+
+    if (virAsprintf(&path, "%s/%s", info->dir, info->name) < 0 ||
+        virtTestLoadFile(path, &xml) < 0 ||
+        !(def = virDomainDefParseString(driver.caps, xml,
+                                        QEMU_EXPECTED_VIRT_TYPES,
+                                        VIR_DOMAIN_XML_INACTIVE)) ||
+        testMakeLive(def) < 0)
+        goto cleanup;
+
+    if (virTimeMillisNow(&start) < 0)
+        goto cleanup;
+    for (i = 0; i < NCOPIES; i++) {
+        if (!(copy = virDomainDefCopy(def)))
+            goto cleanup;
+        virDomainDefFree(copy);
+    }
+
+    if (virTimeMillisNow(&native) < 0)
+        goto cleanup;
+    for (i = 0; i < NCOPIES; i++) {
+        if (!(copy = testCopyXML(def)))
+            goto cleanup;
+        virDomainDefFree(copy);
+    }
+
+    if (virTimeMillisNow(&end) < 0)
+        goto cleanup;
+
+    if (virTestGetDebug())
+        fprintf(stderr, "\n%d copies in %llums, %llums through XML\n%74s",
+                NCOPIES, native - start, end - native, "... ");
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(path);
+    VIR_FREE(xml);
+    virDomainDefFree(def);
+    return ret;
+}
+
+static int
+testCompareDir(const char *dir)
+{
+    struct dirent **names = NULL;
+    int n, i;
+    int ret = 0;
+
+    if ((n = scandir(dir, &names, NULL, alphasort)) < 0) {
+        perror(dir);
+        return -1;
+    }
+
+    for (i = 0; i < n; i++) {
+        struct testInfo info = { dir, names[i]->d_name };
+        char *title;
+
+        if (!virFileHasSuffix(info.name, ".xml"))
+            continue;
+
+        if (virAsprintf(&title, "QEMU XML copy %s", info.name) < 0) {
+            ret = -1;
+            break;
+        }
+        if (virtTestRun(title, 1, testCompareCopy, &info) < 0)
+            ret = -1;
+        VIR_FREE(title);
+    }
+
+    for (i = 0; i < n; i++)
+        VIR_FREE(names[i]);
+    VIR_FREE(names);
+    return ret;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    char *argvdata = NULL;
+    char *nsdata = NULL;
+    struct testInfo speed = {
+        NULL, "qemuxml2argv-graphics-spice-timeout.xml"
+    };
+
+    if ((driver.caps = testQemuCapsInit()) == NULL)
+        return EXIT_FAILURE;
+
+    if (virAsprintf(&argvdata, "%s/qemuxml2argvdata", abs_srcdir) < 0 ||
+        virAsprintf(&nsdata, "%s/qemuxmlnsdata", abs_srcdir) < 0)
+        return EXIT_FAILURE;
+
+    if (testCompareDir(argvdata) < 0)
+        ret = -1;
+    if (testCompareDir(nsdata) < 0)
+        ret = -1;
+
+    speed.dir = argvdata;
+    if (virtTestRun("QEMU XML copy speed", 1, testCopySpeed, &speed) < 0)
+        ret = -1;
+
+    VIR_FREE(argvdata);
+    VIR_FREE(nsdata);
+    virCapabilitiesFree(driver.caps);
+
+    return ret==0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
+
+#else
+# include "testutils.h"
+
+int
+main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* WITH_QEMU */
@@ -0,0 +1,343 @@
+/*
+ * Copyright (C) 2012 Red Hat, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307  USA
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "testutils.h"
+#include "util.h"
+#include "memory.h"
+#include "virterror_internal.h"
+
+#include "rpc/virnetmessage.h"
+#include "remote/remote_protocol.h"
+
+#define VIR_FROM_THIS VIR_FROM_RPC
+
+/*
+ * The list of domain stats records is sent by the daemon as a
+ * remote_connect_get_all_domain_stats_ret and must come out of the
+ * client's end of the wire unchanged.
+ */
+
+static const unsigned char testUUID[VIR_UUID_BUFLEN] = {
+    0xc7, 0xa5, 0xfd, 0xbd, 0xed, 0xaf, 0x9e, 0x38,
+    0x31, 0x6b, 0x3c, 0x5e, 0x8e, 0x0b, 0x6a, 0x41,
+};
+
+/* Statistics of each type a record may hold */
+static remote_typed_param testParams[] = {
+    { (char *) "state.state",
+      { VIR_TYPED_PARAM_INT, { .i = 1 } } },
+    { (char *) "vcpu.current",
+      { VIR_TYPED_PARAM_UINT, { .ui = 4 } } },
+    { (char *) "block.0.rd.reqs",
+      { VIR_TYPED_PARAM_LLONG, { .l = -1 } } },
+    { (char *) "cpu.time",
+      { VIR_TYPED_PARAM_ULLONG, { .ul = 18446744073709551615ULL } } },
+    { (char *) "balloon.ratio",
+      { VIR_TYPED_PARAM_DOUBLE, { .d = 0.5 } } },
+    { (char *) "balloon.enabled",
+      { VIR_TYPED_PARAM_BOOLEAN, { .b = 1 } } },
+    { (char *) "block.0.name",
+      { VIR_TYPED_PARAM_STRING, { .s = (char *) "vda" } } },
+};
+
+static void
+testQuietError(void *userData ATTRIBUTE_UNUSED,
+               virErrorPtr error ATTRIBUTE_UNUSED)
+{
+}
+
+/* Encode @in as a reply and decode it into @out the way the client
+ * reads it off the wire */
+static int
+testRoundTrip(remote_connect_get_all_domain_stats_ret *in,
+              remote_connect_get_all_domain_stats_ret *out)
+{
+    virNetMessagePtr msg = virNetMessageNew(false);
+    virNetMessagePtr rx = virNetMessageNew(false);
+    int ret = -1;
+
+    memset(out, 0, sizeof(*out));
+
+    if (!msg || !rx)
+        goto cleanup;
+
+    msg->header.prog = REMOTE_PROGRAM;
+    msg->header.vers = REMOTE_PROTOCOL_VERSION;
+    msg->header.proc = REMOTE_PROC_CONNECT_GET_ALL_DOMAIN_STATS;
+    msg->header.type = VIR_NET_REPLY;
+    msg->header.serial = 1;
+    msg->header.status = VIR_NET_OK;
+
+    if (virNetMessageEncodeHeader(msg) < 0 ||
+        virNetMessageEncodePayload(msg,
+                                   (xdrproc_t)xdr_remote_connect_get_all_domain_stats_ret,
+                                   in) < 0)
+        goto cleanup;
+
+    rx->bufferLength = 4;
+    memcpy(rx->buffer, msg->buffer, 4);
+
+    if (virNetMessageDecodeLength(rx) < 0)
+        goto cleanup;
+
+    if (rx->bufferLength != msg->bufferLength) {
+        if (virTestGetVerbose())
+            testError("\nexpected length %zu, got %zu",
+                      msg->bufferLength, rx->bufferLength);
+        goto cleanup;
+    }
+
+    memcpy(rx->buffer + 4, msg->buffer + 4, rx->bufferLength - 4);
+
+    if (virNetMessageDecodeHeader(rx) < 0 ||
+        virNetMessageDecodePayload(rx,
+                                   (xdrproc_t)xdr_remote_connect_get_all_domain_stats_ret,
+                                   out) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    virNetMessageFree(msg);
+    virNetMessageFree(rx);
+    return ret;
+}
+
+static int
+testCompareParam(remote_typed_param *expect,
+                 remote_typed_param *got)
+{
+    remote_typed_param_value *a = &expect->value;
+    remote_typed_param_value *b = &got->value;
+    bool same;
+
+    if (STRNEQ(expect->field, got->field) || a->type != b->type)
+        return -1;
+
+    switch (a->type) {
+    case VIR_TYPED_PARAM_INT:
+        same = a->remote_typed_param_value_u.i == b->remote_typed_param_value_u.i;
+        break;
+    case VIR_TYPED_PARAM_UINT:
+        same = a->remote_typed_param_value_u.ui == b->remote_typed_param_value_u.ui;
+        break;
+    case VIR_TYPED_PARAM_LLONG:
+        same = a->remote_typed_param_value_u.l == b->remote_typed_param_value_u.l;
+        break;
+    case VIR_TYPED_PARAM_ULLONG:
+        same = a->remote_typed_param_value_u.ul == b->remote_typed_param_value_u.ul;
+        break;
+    case VIR_TYPED_PARAM_DOUBLE:
+        same = a->remote_typed_param_value_u.d == b->remote_typed_param_value_u.d;
+        break;
+    case VIR_TYPED_PARAM_BOOLEAN:
+        same = a->remote_typed_param_value_u.b == b->remote_typed_param_value_u.b;
+        break;
+    case VIR_TYPED_PARAM_STRING:
+        same = STREQ(a->remote_typed_param_value_u.s,
+                     b->remote_typed_param_value_u.s);
+        break;
+    default:
+        same = false;
+    }
+
+    return same ? 0 : -1;
+}
+
+static int
+testCompareRecords(remote_connect_get_all_domain_stats_ret *expect,
+                   remote_connect_get_all_domain_stats_ret *got)
+{
+    int i, j;
+
+    if (expect->retStats.retStats_len != got->retStats.retStats_len) {
+        if (virTestGetVerbose())
+            testError("\nexpected %u records, got %u",
+                      expect->retStats.retStats_len,
+                      got->retStats.retStats_len);
+        return -1;
+    }
+
+    for (i = 0; i < expect->retStats.retStats_len; i++) {
+        remote_domain_stats_record *a = expect->retStats.retStats_val + i;
+        remote_domain_stats_record *b = got->retStats.retStats_val + i;
+
+        if (STRNEQ(a->dom.name, b->dom.name) ||
+            memcmp(a->dom.uuid, b->dom.uuid, VIR_UUID_BUFLEN) != 0 ||
+            a->dom.id != b->dom.id ||
+            a->params.params_len != b->params.params_len) {
+            if (virTestGetVerbose())
+                testError("\nrecord %d differs", i);
+            return -1;
+        }
+
+        for (j = 0; j < a->params.params_len; j++) {
+            if (testCompareParam(a->params.params_val + j,
+                                 b->params.params_val + j) < 0) {
+                if (virTestGetVerbose())
+                    testError("\nstat %s of record %d differs",
+                              a->params.params_val[j].field, i);
+                return -1;
+            }
+        }
+    }
+
+    return 0;
+}
+
+static void
+testMakeRecord(remote_domain_stats_record *rec,
+               const char *name,
+               int id,
+               remote_typed_param *params,
+               u_int nparams)
+{
+    rec->dom.name = (char *) name;
+    memcpy(rec->dom.uuid, testUUID, VIR_UUID_BUFLEN);
+    rec->dom.id = id;
+    rec->params.params_val = params;
+    rec->params.params_len = nparams;
+}
+
+/* A running domain with stats of every type, and an inactive one
+ * whose stats were all left out */
+static int
+testDomainStatsRecords(const void *args ATTRIBUTE_UNUSED)
+{
+    remote_domain_stats_record records[2];
+    remote_connect_get_all_domain_stats_ret in;
+    remote_connect_get_all_domain_stats_ret out;
+    int ret = -1;
+
+    testMakeRecord(&records[0], "running", 1,
+                   testParams, ARRAY_CARDINALITY(testParams));
+    testMakeRecord(&records[1], "inactive", -1, NULL, 0);
+    in.retStats.retStats_val = records;
+    in.retStats.retStats_len = ARRAY_CARDINALITY(records);
+
+    if (testRoundTrip(&in, &out) < 0 ||
+        testCompareRecords(&in, &out) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    xdr_free((xdrproc_t)xdr_remote_connect_get_all_domain_stats_ret,
+             (char *)&out);
+    return ret;
+}
+
+static int
+testDomainStatsEmpty(const void *args ATTRIBUTE_UNUSED)
+{
+    remote_connect_get_all_domain_stats_ret in;
+    remote_connect_get_all_domain_stats_ret out;
+    int ret = -1;
+
+    in.retStats.retStats_val = NULL;
+    in.retStats.retStats_len = 0;
+
+    if (testRoundTrip(&in, &out) < 0 ||
+        testCompareRecords(&in, &out) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    xdr_free((xdrproc_t)xdr_remote_connect_get_all_domain_stats_ret,
+             (char *)&out);
+    return ret;
+}
+
+/* A record holds at most REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX
+ * stats, a longer one must not be sent */
+static int
+testDomainStatsLimit(const void *args ATTRIBUTE_UNUSED)
+{
+    remote_domain_stats_record record;
+    remote_connect_get_all_domain_stats_ret in;
+    remote_connect_get_all_domain_stats_ret out;
+    remote_typed_param *params = NULL;
+    int i;
+    int ret = -1;
+
+    memset(&out, 0, sizeof(out));
+
+    if (VIR_ALLOC_N(params, REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX + 1) < 0)
+        goto cleanup;
+
+    for (i = 0; i <= REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX; i++)
+        params[i] = testParams[i % ARRAY_CARDINALITY(testParams)];
+
+    testMakeRecord(&record, "busy", 1,
+                   params, REMOTE_CONNECT_GET_ALL_DOMAIN_STATS_MAX);
+    in.retStats.retStats_val = &record;
+    in.retStats.retStats_len = 1;
+
+    if (testRoundTrip(&in, &out) < 0 ||
+        testCompareRecords(&in, &out) < 0)
+        goto cleanup;
+
+    xdr_free((xdrproc_t)xdr_remote_connect_get_all_domain_stats_ret,
+             (char *)&out);
+
+    record.params.params_len++;
+    if (testRoundTrip(&in, &out) == 0) {
+        if (virTestGetVerbose())
+            testError("\nrecord of %u stats was sent",
+                      record.params.params_len);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    xdr_free((xdrproc_t)xdr_remote_connect_get_all_domain_stats_ret,
+             (char *)&out);
+    VIR_FREE(params);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    /* Records over the limit are made to fail */
+    if (!virTestGetDebug())
+        virSetErrorFunc(NULL, testQuietError);
+
+    if (virtTestRun("Domain Stats Records", 1, testDomainStatsRecords, NULL) < 0)
+        ret = -1;
+
+    if (virtTestRun("Domain Stats Empty", 1, testDomainStatsEmpty, NULL) < 0)
+        ret = -1;
+
+    if (virtTestRun("Domain Stats Limit", 1, testDomainStatsLimit, NULL) < 0)
+        ret = -1;
+
+    return ret==0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
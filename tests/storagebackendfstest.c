@@ -0,0 +1,458 @@
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/param.h>
+
+#include "testutils.h"
+
+#ifdef WITH_STORAGE_DIR
+
+# include "internal.h"
+# include "memory.h"
+# include "util.h"
+# include "buf.h"
+# include "virfile.h"
+# include "virtime.h"
+# include "storage_conf.h"
+# include "storage_file.h"
+# include "storage/storage_backend.h"
+# include "storage/storage_backend_fs.h"
+
+# define NRAW 500
+# define RAW_SIZE (1024 * 1024)
+
+static char *pooldir;
+static virStoragePoolObjPtr pool;
+
+/* The formatted volumes of the first refresh */
+static char *coldXML;
+
+/*
+ * Write a qcow2 header to @path, with a backing file if @backing is
+ * non-NULL. Only what's needed for probing is filled in.
+ */
+static int
+testWriteQcow2(const char *path, const char *backing, bool encrypted,
+               bool truncate)
+{
+    unsigned char buf[512];
+    size_t len = 72; /* version 2 header */
+    int fd;
+    int ret = -1;
+
+    memset(buf, 0, sizeof(buf));
+    memcpy(buf, "QFI\xfb", 4);
+    buf[7] = 2;
+    if (backing) {
+        buf[15] = len; /* backing_file_offset */
+        buf[19] = strlen(backing); /* backing_file_size */
+        memcpy(buf + len, backing, strlen(backing));
+        len += strlen(backing);
+    }
+    buf[28] = 0x40; /* 1GiB size */
+    if (encrypted)
+        buf[35] = 1; /* AES */
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | (truncate ? O_TRUNC : 0),
+                   0600)) < 0)
+        return -1;
+    if (safewrite(fd, buf, len) == len)
+        ret = 0;
+    if (VIR_CLOSE(fd) < 0)
+        ret = -1;
+    return ret;
+}
+
+static int
+testPoolPath(const char *name, char **path)
+{
+    return virAsprintf(path, "%s/%s", pooldir, name);
+}
+
+static int
+testPopulate(void)
+{
+    char *path = NULL;
+    char *base = NULL;
+    int fd;
+    int i;
+    int ret = -1;
+
+    for (i = 0; i < NRAW; i++) {
+        if (virAsprintf(&path, "%s/raw%d.img", pooldir, i) < 0)
+            goto cleanup;
+        if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+            goto cleanup;
+        if (ftruncate(fd, RAW_SIZE) < 0) {
+            VIR_FORCE_CLOSE(fd);
+            goto cleanup;
+        }
+        if (VIR_CLOSE(fd) < 0)
+            goto cleanup;
+        VIR_FREE(path);
+    }
+
+    if (testPoolPath("raw0.img", &base) < 0 ||
+        testPoolPath("overlay.qcow2", &path) < 0 ||
+        testWriteQcow2(path, base, false, true) < 0)
+        goto cleanup;
+    VIR_FREE(path);
+
+    if (testPoolPath("secret.qcow2", &path) < 0 ||
+        testWriteQcow2(path, NULL, true, true) < 0)
+        goto cleanup;
+    VIR_FREE(path);
+
+    if (testPoolPath("subdir", &path) < 0 ||
+        mkdir(path, 0700) < 0)
+        goto cleanup;
+    VIR_FREE(path);
+
+    /* Ignored */
+    if (testPoolPath("dangling", &path) < 0 ||
+        symlink("/nonexistent/libvirt", path) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(path);
+    VIR_FREE(base);
+    return ret;
+}
+
+static int
+testRefresh(char **xml)
+{
+    virBuffer buf = VIR_BUFFER_INITIALIZER;
+    unsigned long long start, now;
+    char *volxml;
+    unsigned int i;
+
+    virStoragePoolObjClearVols(pool);
+    if (virTimeMillisNow(&start) < 0 ||
+        virStorageBackendDirectory.refreshPool(NULL, pool) < 0 ||
+        virTimeMillisNow(&now) < 0)
+        return -1;
+
+    if (virTestGetDebug())
+        fprintf(stderr, "\n%u volumes refreshed in %llums\n%74s",
+                pool->volumes.count, now - start, "... ");
+
+    for (i = 0; i < pool->volumes.count; i++) {
+        if (!(volxml = virStorageVolDefFormat(pool->def,
+                                              pool->volumes.objs[i]))) {
+            virBufferFreeAndReset(&buf);
+            return -1;
+        }
+        virBufferAdd(&buf, volxml, -1);
+        VIR_FREE(volxml);
+    }
+
+    if (virBufferError(&buf)) {
+        virBufferFreeAndReset(&buf);
+        return -1;
+    }
+    *xml = virBufferContentAndReset(&buf);
+    return 0;
+}
+
+static int
+testCheckVol(const char *name, int type, int format,
+             const char *backing, bool encrypted)
+{
+    virStorageVolDefPtr vol = virStorageVolDefFindByName(pool, name);
+
+    if (!vol) {
+        if (virTestGetVerbose())
+            testError("\nvolume %s not found", name);
+        return -1;
+    }
+
+    if (vol->type != type ||
+        vol->target.format != format ||
+        !!vol->backingStore.path != !!backing ||
+        (backing && STRNEQ(vol->backingStore.path, backing)) ||
+        !!vol->target.encryption != encrypted) {
+        if (virTestGetVerbose())
+            testError("\nvolume %s wrongly probed", name);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+testRefreshCold(const void *data ATTRIBUTE_UNUSED)
+{
+    char *base = NULL;
+    int ret = -1;
+
+    if (testRefresh(&coldXML) < 0)
+        goto cleanup;
+
+    if (pool->volumes.count != NRAW + 3) {
+        if (virTestGetVerbose())
+            testError("\nexpected %d volumes, got %u",
+                      NRAW + 3, pool->volumes.count);
+        goto cleanup;
+    }
+
+    if (testPoolPath("raw0.img", &base) < 0 ||
+        testCheckVol("raw1.img", VIR_STORAGE_VOL_FILE,
+                     VIR_STORAGE_FILE_RAW, NULL, false) < 0 ||
+        testCheckVol("overlay.qcow2", VIR_STORAGE_VOL_FILE,
+                     VIR_STORAGE_FILE_QCOW2, base, false) < 0 ||
+        testCheckVol("secret.qcow2", VIR_STORAGE_VOL_FILE,
+                     VIR_STORAGE_FILE_QCOW2, NULL, true) < 0 ||
+        testCheckVol("subdir", VIR_STORAGE_VOL_DIR,
+                     VIR_STORAGE_FILE_DIR, NULL, false) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(base);
+    return ret;
+}
+
+/* Unchanged volumes must look the same when not probed again */
+static int
+testRefreshCached(const void *data ATTRIBUTE_UNUSED)
+{
+    char *xml = NULL;
+    int ret = -1;
+
+    if (!coldXML || testRefresh(&xml) < 0)
+        goto cleanup;
+
+    if (STRNEQ(coldXML, xml)) {
+        virtTestDifference(stderr, coldXML, xml);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(xml);
+    return ret;
+}
+
+/* Changed volumes must be probed again, even without changing size */
+static int
+testRefreshChanged(const void *data ATTRIBUTE_UNUSED)
+{
+    char *xml = NULL;
+    char *path = NULL;
+    int ret = -1;
+
+    if (testPoolPath("raw1.img", &path) < 0 ||
+        testWriteQcow2(path, NULL, false, false) < 0)
+        goto cleanup;
+    VIR_FREE(path);
+    if (testPoolPath("raw2.img", &path) < 0 ||
+        unlink(path) < 0)
+        goto cleanup;
+
+    if (testRefresh(&xml) < 0)
+        goto cleanup;
+
+    if (testCheckVol("raw1.img", VIR_STORAGE_VOL_FILE,
+                     VIR_STORAGE_FILE_QCOW2, NULL, false) < 0)
+        goto cleanup;
+
+    if (virStorageVolDefFindByName(pool, "raw2.img")) {
+        if (virTestGetVerbose())
+            testError("\nremoved volume still found");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(path);
+    VIR_FREE(xml);
+    return ret;
+}
+
+struct testWipeData {
+    size_t size;
+    bool sparse;
+};
+
+/* Zeroing a file volume must leave it reading back as zeroes, at its
+ * size, and allocated unless it was sparse, having written all of it
+ * in that case */
+static int
+testWipe(const void *opaque)
+{
+    const struct testWipeData *data = opaque;
+    virStorageVolDefPtr vol = NULL;
+    char *buf = NULL;
+    struct stat sb;
+    int fd = -1;
+    int len;
+    size_t i;
+    int ret = -1;
+
+    if (VIR_ALLOC(vol) < 0 ||
+        testPoolPath("wipe.img", &vol->target.path) < 0 ||
+        VIR_ALLOC_N(buf, data->size) < 0)
+        goto cleanup;
+
+    memset(buf, 0xaa, data->size);
+    if ((fd = open(vol->target.path,
+                   O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0 ||
+        safewrite(fd, buf, data->sparse ? 4096 : data->size) < 0 ||
+        ftruncate(fd, data->size) < 0 ||
+        fsync(fd) < 0 ||
+        fstat(fd, &sb) < 0)
+        goto cleanup;
+    vol->allocation = sb.st_blocks * DEV_BSIZE;
+    VIR_FREE(buf);
+
+    if (virStorageBackendVolZeroLocal(pool, vol, fd, &sb) < 0 ||
+        VIR_CLOSE(fd) < 0)
+        goto cleanup;
+
+    if ((len = virFileReadAll(vol->target.path, data->size + 1, &buf)) < 0 ||
+        stat(vol->target.path, &sb) < 0)
+        goto cleanup;
+
+    if (len != data->size) {
+        if (virTestGetVerbose())
+            testError("\nvolume of %zu bytes is now %d", data->size, len);
+        goto cleanup;
+    }
+    for (i = 0; i < len; i++) {
+        if (buf[i]) {
+            if (virTestGetVerbose())
+                testError("\nbyte %zu not zeroed", i);
+            goto cleanup;
+        }
+    }
+    if (!data->sparse && sb.st_blocks < data->size / DEV_BSIZE) {
+        if (virTestGetVerbose())
+            testError("\nvolume became sparse");
+        goto cleanup;
+    }
+    if (vol->wipeTotal != data->size ||
+        (!data->sparse && vol->wipeProcessed != data->size)) {
+        if (virTestGetVerbose())
+            testError("\nwiped %llu of %llu bytes",
+                      vol->wipeProcessed, vol->wipeTotal);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FORCE_CLOSE(fd);
+    if (vol && vol->target.path)
+        unlink(vol->target.path);
+    virStorageVolDefFree(vol);
+    VIR_FREE(buf);
+    return ret;
+}
+
+static void
+testCleanupDir(void)
+{
+    DIR *dir;
+    struct dirent *ent;
+    char *path;
+
+    if (!(dir = opendir(pooldir)))
+        return;
+
+    while ((ent = readdir(dir))) {
+        if (STREQ(ent->d_name, ".") || STREQ(ent->d_name, ".."))
+            continue;
+        if (testPoolPath(ent->d_name, &path) < 0)
+            break;
+        if (unlink(path) < 0)
+            rmdir(path);
+        VIR_FREE(path);
+    }
+
+    closedir(dir);
+    rmdir(pooldir);
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    char tmpdir[] = "/tmp/storagebackendfstest-XXXXXX";
+    time_t created;
+
+    if (!mkdtemp(tmpdir)) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    pooldir = tmpdir;
+
+    if (VIR_ALLOC(pool) < 0 ||
+        virMutexInit(&pool->lock) < 0 ||
+        VIR_ALLOC(pool->def) < 0 ||
+        !(pool->def->name = strdup("test")) ||
+        !(pool->def->target.path = strdup(pooldir))) {
+        ret = -1;
+        goto cleanup;
+    }
+    pool->def->type = VIR_STORAGE_POOL_DIR;
+
+    created = time(NULL);
+    if (testPopulate() < 0) {
+        ret = -1;
+        goto cleanup;
+    }
+
+    /* Files changed within the current second aren't cached */
+    while (time(NULL) <= created)
+        usleep(100 * 1000);
+
+    if (virtTestRun("Refresh", 1, testRefreshCold, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Refresh cached", 1, testRefreshCached, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Refresh changed", 1, testRefreshChanged, NULL) < 0)
+        ret = -1;
+
+# define DO_TEST_WIPE(name, size, sparse)                               \
+    do {                                                                \
+        static struct testWipeData data = { size, sparse };             \
+        if (virtTestRun("Wipe " name, 1, testWipe, &data) < 0)          \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST_WIPE("allocated", 4 * 1024 * 1024, false);
+    DO_TEST_WIPE("allocated unaligned", 3 * 1024 * 1024 + 4097, false);
+    DO_TEST_WIPE("small", 1000, false);
+    DO_TEST_WIPE("sparse", 4 * 1024 * 1024, true);
+
+cleanup:
+    virStoragePoolObjFree(pool);
+    VIR_FREE(coldXML);
+    testCleanupDir();
+
+    return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
+
+#else
+
+int main(void)
+{
+    return EXIT_AM_SKIP;
+}
+
+#endif /* WITH_STORAGE_DIR */
@@ -13,6 +13,7 @@
 
 # include <stdio.h>
 # include "memory.h"
+# include "util.h"
 
 # define EXIT_AM_SKIP 77 /* tell Automake we're skipping a test */
 # define EXIT_AM_HARDFAIL 99 /* tell Automake that the framework is broken */
@@ -48,6 +49,18 @@ unsigned int virTestGetVerbose(void);
 
 char *virtTestLogContentAndReset(void);
 
+/* Print a message to stderr from within a test, leaving the output
+ * lined up with the test name and "..." printed by virtTestRun */
+# define testError(...)                                         \
+    do {                                                        \
+        char *str;                                              \
+        if (virAsprintf(&str, __VA_ARGS__) >= 0) {              \
+            fprintf(stderr, "%s", str);                         \
+            VIR_FREE(str);                                      \
+        }                                                       \
+        fprintf(stderr, "%74s", "... ");                        \
+    } while (0)
+
 int virtTestMain(int argc,
                  char **argv,
                  int (*func)(void));
@@ -0,0 +1,263 @@
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+#include "testutils.h"
+#include "ignore-value.h"
+#include "threadpool.h"
+#include "threads.h"
+#include "util.h"
+
+
+#define MAX_JOBS 16
+
+/* Jobs are single characters, recorded in the order they run. The
+ * job 'G' is a gate which blocks its worker until opened. */
+struct testPoolState {
+    virMutex lock;
+    virCond cond;
+    bool gateRunning;
+    bool gateOpen;
+    char done[MAX_JOBS + 1];
+    size_t ndone;
+};
+
+static struct testPoolState state;
+
+static void
+testPoolJob(void *jobdata, void *opaque ATTRIBUTE_UNUSED)
+{
+    char job = *(char *)jobdata;
+
+    virMutexLock(&state.lock);
+    if (job == 'G') {
+        state.gateRunning = true;
+        virCondBroadcast(&state.cond);
+        while (!state.gateOpen)
+            ignore_value(virCondWait(&state.cond, &state.lock));
+    }
+    state.done[state.ndone++] = job;
+    virCondBroadcast(&state.cond);
+    virMutexUnlock(&state.lock);
+}
+
+static void
+testPoolReset(void)
+{
+    virMutexLock(&state.lock);
+    state.gateRunning = state.gateOpen = false;
+    memset(state.done, 0, sizeof(state.done));
+    state.ndone = 0;
+    virMutexUnlock(&state.lock);
+}
+
+static void
+testPoolWaitGate(void)
+{
+    virMutexLock(&state.lock);
+    while (!state.gateRunning)
+        ignore_value(virCondWait(&state.cond, &state.lock));
+    virMutexUnlock(&state.lock);
+}
+
+static void
+testPoolOpenGate(void)
+{
+    virMutexLock(&state.lock);
+    state.gateOpen = true;
+    virCondBroadcast(&state.cond);
+    virMutexUnlock(&state.lock);
+}
+
+static void
+testPoolWaitDone(size_t njobs)
+{
+    virMutexLock(&state.lock);
+    while (state.ndone < njobs)
+        ignore_value(virCondWait(&state.cond, &state.lock));
+    virMutexUnlock(&state.lock);
+}
+
+struct testFairData {
+    const char *jobs;   /* Job names, in the order they're queued */
+    bool owned;         /* Use the job name as owner */
+    const char *expect; /* Order they must run in, after 'G' */
+};
+
+static int
+testPoolFair(const void *opaque)
+{
+    const struct testFairData *data = opaque;
+    virThreadPoolPtr pool;
+    static const char gate = 'G';
+    static const char owners[] = "ABCDEFGH";
+    size_t njobs = strlen(data->jobs);
+    size_t i;
+    int ret = -1;
+
+    testPoolReset();
+
+    /* A single worker runs jobs one by one */
+    if (!(pool = virThreadPoolNew(1, 1, 0, testPoolJob, NULL)))
+        return -1;
+
+    if (virThreadPoolSendJob(pool, 0, (void *)&gate) < 0)
+        goto cleanup;
+    testPoolWaitGate();
+
+    for (i = 0 ; i < njobs ; i++) {
+        void *job = (void *)&data->jobs[i];
+        const void *owner = data->owned ? &owners[data->jobs[i] - 'A'] : NULL;
+
+        if (virThreadPoolSendOwnedJob(pool, owner, 0, job) < 0)
+            goto cleanup;
+    }
+
+    testPoolOpenGate();
+    testPoolWaitDone(njobs + 1);
+
+    if (STRNEQ(state.done + 1, data->expect)) {
+        if (virTestGetVerbose())
+            testError("\nexpected jobs to run as '%s', got '%s'",
+                      data->expect, state.done + 1);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    testPoolOpenGate();
+    virThreadPoolFree(pool);
+    return ret;
+}
+
+static int
+testPoolStats(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virThreadPoolPtr pool;
+    virThreadPoolStats stats;
+    static const char jobs[] = "GABC";
+    size_t i;
+    int ret = -1;
+
+    testPoolReset();
+
+    if (!(pool = virThreadPoolNew(1, 1, 0, testPoolJob, NULL)))
+        return -1;
+
+    for (i = 0 ; i < strlen(jobs) ; i++) {
+        if (virThreadPoolSendJob(pool, 0, (void *)&jobs[i]) < 0)
+            goto cleanup;
+        if (i == 0)
+            testPoolWaitGate();
+    }
+
+    virThreadPoolGetStats(pool, &stats);
+    if (stats.workers != 1 || stats.maxWorkers != 1 ||
+        stats.freeWorkers != 0 || stats.queueDepth != 3 ||
+        stats.maxQueueDepth != 3) {
+        if (virTestGetVerbose())
+            testError("\nunexpected stats while blocked: workers=%zu "
+                      "free=%zu depth=%zu max=%zu",
+                      stats.workers, stats.freeWorkers,
+                      stats.queueDepth, stats.maxQueueDepth);
+        goto cleanup;
+    }
+
+    testPoolOpenGate();
+    testPoolWaitDone(strlen(jobs));
+
+    /* Wait for the worker to account for the last job */
+    do {
+        virThreadPoolGetStats(pool, &stats);
+    } while (stats.jobs < strlen(jobs));
+
+    if (stats.queueDepth != 0 || stats.maxQueueDepth != 3 ||
+        stats.waitMax > stats.waitTotal) {
+        if (virTestGetVerbose())
+            testError("\nunexpected stats when done: depth=%zu max=%zu "
+                      "wait=%llu maxwait=%llu",
+                      stats.queueDepth, stats.maxQueueDepth,
+                      stats.waitTotal, stats.waitMax);
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    testPoolOpenGate();
+    virThreadPoolFree(pool);
+    return ret;
+}
+
+static int
+testPoolPriority(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virThreadPoolPtr pool;
+    static const char gate = 'G';
+    static const char prio = 'P';
+    int ret = -1;
+
+    testPoolReset();
+
+    if (!(pool = virThreadPoolNew(1, 1, 1, testPoolJob, NULL)))
+        return -1;
+
+    if (virThreadPoolSendJob(pool, 0, (void *)&gate) < 0)
+        goto cleanup;
+    testPoolWaitGate();
+
+    /* The priority worker must run this while the other one is stuck */
+    if (virThreadPoolSendJob(pool, 1, (void *)&prio) < 0)
+        goto cleanup;
+    testPoolWaitDone(1);
+
+    if (state.done[0] != 'P') {
+        if (virTestGetVerbose())
+            testError("\npriority job didn't run first");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    testPoolOpenGate();
+    virThreadPoolFree(pool);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virMutexInit(&state.lock) < 0 ||
+        virCondInit(&state.cond) < 0)
+        return EXIT_FAILURE;
+
+#define DO_TEST_FAIR(name, jobs, owned, expect)                         \
+    do {                                                                \
+        struct testFairData data = { jobs, owned, expect };             \
+        if (virtTestRun("Fair " name, 1, testPoolFair, &data) < 0)      \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST_FAIR("anonymous", "AAAAAABB", false, "AAAAAABB");
+    DO_TEST_FAIR("two owners", "AAAAAABB", true, "ABABAAAA");
+    DO_TEST_FAIR("three owners", "AAAABBCC", true, "ABCABCAA");
+    DO_TEST_FAIR("uneven owners", "AAAABBBD", true, "ABDABABA");
+    DO_TEST_FAIR("many owners", "AAABBCDEFHH", true, "ABCDEFHABHA");
+
+    if (virtTestRun("Stats", 1, testPoolStats, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Priority", 1, testPoolPriority, NULL) < 0)
+        ret = -1;
+
+    return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -0,0 +1,327 @@
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "internal.h"
+#include "testutils.h"
+#include "memory.h"
+#include "util.h"
+#include "virfile.h"
+#include "virtime.h"
+#include "capabilities.h"
+#include "domain_conf.h"
+
+
+#define NDOMAINS 500
+
+static virCapsPtr caps;
+static char *configDir;
+static char *autostartDir;
+static char *statusDir;
+
+static const char *domainXML =
+    "<domain type='qemu'>\n"
+    "  <name>dom%d</name>\n"
+    "  <uuid>c7a5fdbd-edaf-9455-926a-%012d</uuid>\n"
+    "  <memory>219136</memory>\n"
+    "  <vcpu>1</vcpu>\n"
+    "  <os>\n"
+    "    <type arch='x86_64' machine='pc'>hvm</type>\n"
+    "  </os>\n"
+    "  <devices>\n"
+    "    <emulator>/usr/bin/qemu</emulator>\n"
+    "    <disk type='file' device='disk'>\n"
+    "      <source file='/var/lib/libvirt/images/dom%d.img'/>\n"
+    "      <target dev='vda' bus='virtio'/>\n"
+    "    </disk>\n"
+    "    <interface type='network'>\n"
+    "      <mac address='52:54:00:00:%02x:%02x'/>\n"
+    "      <source network='default'/>\n"
+    "    </interface>\n"
+    "  </devices>\n"
+    "</domain>\n";
+
+/* Domains whose number is a multiple of 3 are marked for autostart */
+static bool
+testIsAutostart(int i)
+{
+    return i % 3 == 0;
+}
+
+static int
+testWriteFile(const char *dir, const char *name, const char *content)
+{
+    char *path = NULL;
+    int ret = -1;
+
+    if (virAsprintf(&path, "%s/%s", dir, name) < 0)
+        return -1;
+    if (virFileWriteStr(path, content, 0600) == 0)
+        ret = 0;
+    VIR_FREE(path);
+    return ret;
+}
+
+static int
+testPopulate(void)
+{
+    char *xml = NULL;
+    char *name = NULL;
+    char *config = NULL;
+    char *link = NULL;
+    int i;
+    int ret = -1;
+
+    for (i = 0; i < NDOMAINS; i++) {
+        if (virAsprintf(&xml, domainXML, i, i, i, i / 256, i % 256) < 0 ||
+            virAsprintf(&name, "dom%d.xml", i) < 0 ||
+            testWriteFile(configDir, name, xml) < 0)
+            goto cleanup;
+
+        if (testIsAutostart(i)) {
+            if (virAsprintf(&config, "%s/%s", configDir, name) < 0 ||
+                virAsprintf(&link, "%s/%s", autostartDir, name) < 0 ||
+                symlink(config, link) < 0)
+                goto cleanup;
+            VIR_FREE(config);
+            VIR_FREE(link);
+        }
+
+        VIR_FREE(xml);
+        VIR_FREE(name);
+    }
+
+    /* Ignored, and not preventing the others from being loaded */
+    if (testWriteFile(configDir, "broken.xml", "<domain type='qemu'>") < 0 ||
+        testWriteFile(configDir, "notes.txt", "not a config") < 0 ||
+        testWriteFile(configDir, ".hidden.xml", "<domain/>") < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(xml);
+    VIR_FREE(name);
+    VIR_FREE(config);
+    VIR_FREE(link);
+    return ret;
+}
+
+static int
+testCheckDomains(virDomainObjListPtr doms, bool active)
+{
+    char *name = NULL;
+    int i;
+    int ret = -1;
+
+    if (virHashSize(doms->objs) != NDOMAINS) {
+        if (virTestGetVerbose())
+            testError("\nexpected %d domains, got %zd",
+                      NDOMAINS, virHashSize(doms->objs));
+        return -1;
+    }
+
+    for (i = 0; i < NDOMAINS; i++) {
+        virDomainObjPtr dom;
+
+        if (virAsprintf(&name, "dom%d", i) < 0)
+            goto cleanup;
+
+        if (!(dom = virDomainFindByName(doms, name))) {
+            if (virTestGetVerbose())
+                testError("\ndomain %s not found", name);
+            goto cleanup;
+        }
+
+        if ((!active && (dom->autostart != testIsAutostart(i) ||
+                         !dom->persistent)) ||
+            virDomainObjIsActive(dom) != active ||
+            !dom->def->nets || dom->def->nets[0]->mac[5] != i % 256) {
+            if (virTestGetVerbose())
+                testError("\ndomain %s wrongly loaded", name);
+            virDomainObjUnlock(dom);
+            goto cleanup;
+        }
+
+        virDomainObjUnlock(dom);
+        VIR_FREE(name);
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(name);
+    return ret;
+}
+
+static int
+testLoad(virDomainObjListPtr doms, const char *dir, int liveStatus)
+{
+    unsigned long long start, now;
+
+    if (virTimeMillisNow(&start) < 0 ||
+        virDomainLoadAllConfigs(caps, doms, dir, autostartDir, liveStatus,
+                                1 << VIR_DOMAIN_VIRT_QEMU,
+                                NULL, NULL) < 0 ||
+        virTimeMillisNow(&now) < 0)
+        return -1;
+
+    if (virTestGetDebug())
+        fprintf(stderr, "\n%zd configs loaded in %llums\n%74s",
+                virHashSize(doms->objs), now - start, "... ");
+
+    return 0;
+}
+
+/* Write the status of every domain of @doms, as if it were running */
+static void
+testSaveStatus(void *payload, const void *name ATTRIBUTE_UNUSED,
+               void *opaque)
+{
+    virDomainObjPtr dom = payload;
+    int *ret = opaque;
+
+    virDomainObjLock(dom);
+    dom->def->id = 1;
+    dom->pid = 4242;
+    virDomainObjSetState(dom, VIR_DOMAIN_RUNNING, VIR_DOMAIN_RUNNING_BOOTED);
+    if (virDomainSaveStatus(caps, statusDir, dom) < 0)
+        *ret = -1;
+    virDomainObjUnlock(dom);
+}
+
+static int
+testLoadConfigs(const void *data ATTRIBUTE_UNUSED)
+{
+    virDomainObjList doms;
+    int ret = -1;
+
+    if (virDomainObjListInit(&doms) < 0)
+        return -1;
+
+    if (testLoad(&doms, configDir, 0) < 0 ||
+        testCheckDomains(&doms, false) < 0)
+        goto cleanup;
+
+    /* Loading again only updates the domains already known */
+    if (testLoad(&doms, configDir, 0) < 0 ||
+        testCheckDomains(&doms, false) < 0)
+        goto cleanup;
+
+    ret = 0;
+    virHashForEach(doms.objs, testSaveStatus, &ret);
+
+cleanup:
+    virDomainObjListDeinit(&doms);
+    return ret;
+}
+
+static int
+testLoadStatus(const void *data ATTRIBUTE_UNUSED)
+{
+    virDomainObjList doms;
+    int ret = -1;
+
+    if (virDomainObjListInit(&doms) < 0)
+        return -1;
+
+    if (testLoad(&doms, statusDir, 1) < 0 ||
+        testCheckDomains(&doms, true) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    virDomainObjListDeinit(&doms);
+    return ret;
+}
+
+static void
+testCleanupDir(const char *path)
+{
+    DIR *dir;
+    struct dirent *ent;
+    char *file;
+
+    if (!path || !(dir = opendir(path)))
+        return;
+
+    while ((ent = readdir(dir))) {
+        if (STREQ(ent->d_name, ".") || STREQ(ent->d_name, ".."))
+            continue;
+        if (virAsprintf(&file, "%s/%s", path, ent->d_name) < 0)
+            break;
+        unlink(file);
+        VIR_FREE(file);
+    }
+
+    closedir(dir);
+    rmdir(path);
+}
+
+static void
+testQuietError(void *userData ATTRIBUTE_UNUSED,
+               virErrorPtr error ATTRIBUTE_UNUSED)
+{
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    char tmpdir[] = "/tmp/virdomainloadtest-XXXXXX";
+    virCapsGuestPtr guest;
+
+    if (!mkdtemp(tmpdir)) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+
+    /* The broken config is expected to fail parsing */
+    if (!virTestGetDebug())
+        virSetErrorFunc(NULL, testQuietError);
+
+    if (virAsprintf(&configDir, "%s/config", tmpdir) < 0 ||
+        virAsprintf(&autostartDir, "%s/autostart", tmpdir) < 0 ||
+        virAsprintf(&statusDir, "%s/status", tmpdir) < 0 ||
+        mkdir(configDir, 0700) < 0 ||
+        mkdir(autostartDir, 0700) < 0 ||
+        mkdir(statusDir, 0700) < 0 ||
+        testPopulate() < 0) {
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (!(caps = virCapabilitiesNew("x86_64", 0, 0)) ||
+        !(guest = virCapabilitiesAddGuest(caps, "hvm", "x86_64", 64,
+                                          "/usr/bin/qemu", NULL,
+                                          0, NULL)) ||
+        !virCapabilitiesAddGuestDomain(guest, "qemu", NULL, NULL, 0, NULL)) {
+        ret = -1;
+        goto cleanup;
+    }
+
+    if (virtTestRun("Load configs", 1, testLoadConfigs, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Load status", 1, testLoadStatus, NULL) < 0)
+        ret = -1;
+
+cleanup:
+    virCapabilitiesFree(caps);
+    testCleanupDir(configDir);
+    testCleanupDir(autostartDir);
+    testCleanupDir(statusDir);
+    rmdir(tmpdir);
+    VIR_FREE(configDir);
+    VIR_FREE(autostartDir);
+    VIR_FREE(statusDir);
+
+    return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
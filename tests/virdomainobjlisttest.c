@@ -0,0 +1,285 @@
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+#include "testutils.h"
+#include "capabilities.h"
+#include "domain_conf.h"
+#include "memory.h"
+#include "util.h"
+#include "virtime.h"
+
+
+static virCapsPtr caps;
+
+static virDomainDefPtr
+testDomainDefNew(int i)
+{
+    virDomainDefPtr def;
+
+    if (VIR_ALLOC(def) < 0)
+        return NULL;
+
+    if (virAsprintf(&def->name, "dom%d", i) < 0) {
+        VIR_FREE(def);
+        return NULL;
+    }
+
+    def->uuid[0] = i & 0xff;
+    def->uuid[1] = (i >> 8) & 0xff;
+    def->uuid[2] = (i >> 16) & 0xff;
+    /* Only even domains are running */
+    def->id = (i % 2) ? -1 : i + 1;
+
+    return def;
+}
+
+static int
+testDomainObjListPopulate(virDomainObjListPtr doms, int count)
+{
+    int i;
+
+    for (i = 0; i < count; i++) {
+        virDomainDefPtr def;
+        virDomainObjPtr obj;
+
+        if (!(def = testDomainDefNew(i)))
+            return -1;
+
+        if (!(obj = virDomainAssignDef(caps, doms, def, false))) {
+            virDomainDefFree(def);
+            return -1;
+        }
+        virDomainObjUnlock(obj);
+    }
+
+    return 0;
+}
+
+static int
+testDomainObjListCheck(virDomainObjListPtr doms, int i, bool present)
+{
+    virDomainObjPtr obj;
+    char *name = NULL;
+    unsigned char uuid[VIR_UUID_BUFLEN] = { i & 0xff,
+                                            (i >> 8) & 0xff,
+                                            (i >> 16) & 0xff };
+    int ret = -1;
+
+    if (virAsprintf(&name, "dom%d", i) < 0)
+        return -1;
+
+    obj = virDomainFindByName(doms, name);
+    if (!!obj != present ||
+        (obj && STRNEQ(obj->def->name, name))) {
+        if (virTestGetVerbose())
+            testError("\nunexpected lookup by name result for %s", name);
+        goto cleanup;
+    }
+    if (obj)
+        virDomainObjUnlock(obj);
+
+    obj = virDomainFindByUUID(doms, uuid);
+    if (!!obj != present ||
+        (obj && STRNEQ(obj->def->name, name))) {
+        if (virTestGetVerbose())
+            testError("\nunexpected lookup by UUID result for %s", name);
+        goto cleanup;
+    }
+    if (obj)
+        virDomainObjUnlock(obj);
+
+    obj = virDomainFindByID(doms, i + 1);
+    if (!!obj != (present && i % 2 == 0) ||
+        (obj && STRNEQ(obj->def->name, name))) {
+        if (virTestGetVerbose())
+            testError("\nunexpected lookup by ID result for %s", name);
+        goto cleanup;
+    }
+    if (obj)
+        virDomainObjUnlock(obj);
+    obj = NULL;
+
+    ret = 0;
+
+cleanup:
+    if (obj)
+        virDomainObjUnlock(obj);
+    VIR_FREE(name);
+    return ret;
+}
+
+static int
+testDomainObjListLookup(const void *data)
+{
+    int count = *(const int *)data;
+    virDomainObjList doms;
+    unsigned long long start, end;
+    int ret = -1;
+    int i;
+
+    if (virDomainObjListInit(&doms) < 0)
+        return -1;
+
+    if (testDomainObjListPopulate(&doms, count) < 0)
+        goto cleanup;
+
+    if (virTimeMillisNow(&start) < 0)
+        goto cleanup;
+
+    for (i = 0; i < count; i++) {
+        if (testDomainObjListCheck(&doms, i, true) < 0)
+            goto cleanup;
+    }
+
+    if (virTimeMillisNow(&end) < 0)
+        goto cleanup;
+
+    if (virTestGetDebug())
+        fprintf(stderr, "\n%d lookups by name, UUID and ID in %llums\n%74s",
+                count, end - start, "... ");
+
+    if (virDomainFindByName(&doms, "nosuchdomain") ||
+        virDomainFindByID(&doms, count + 1) ||
+        virDomainFindByID(&doms, -1)) {
+        if (virTestGetVerbose())
+            testError("\nunexpected lookup success");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virDomainObjListDeinit(&doms);
+    return ret;
+}
+
+static int
+testDomainObjListRemove(const void *data)
+{
+    int count = *(const int *)data;
+    virDomainObjList doms;
+    virDomainObjPtr obj;
+    int ret = -1;
+    int i;
+
+    if (virDomainObjListInit(&doms) < 0)
+        return -1;
+
+    if (testDomainObjListPopulate(&doms, count) < 0)
+        goto cleanup;
+
+    for (i = 0; i < count; i += 4) {
+        unsigned char uuid[VIR_UUID_BUFLEN] = { i & 0xff,
+                                                (i >> 8) & 0xff,
+                                                (i >> 16) & 0xff };
+
+        if (!(obj = virDomainFindByUUID(&doms, uuid)))
+            goto cleanup;
+        virDomainRemoveInactive(&doms, obj);
+    }
+
+    for (i = 0; i < count; i++) {
+        if (testDomainObjListCheck(&doms, i, i % 4 != 0) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virDomainObjListDeinit(&doms);
+    return ret;
+}
+
+static int
+testDomainObjListRestart(const void *data ATTRIBUTE_UNUSED)
+{
+    virDomainObjList doms;
+    virDomainObjPtr obj = NULL;
+    int ret = -1;
+
+    if (virDomainObjListInit(&doms) < 0)
+        return -1;
+
+    if (testDomainObjListPopulate(&doms, 4) < 0)
+        goto cleanup;
+
+    /* dom0 runs with ID 1 */
+    if (!(obj = virDomainFindByID(&doms, 1)))
+        goto cleanup;
+
+    /* Stop and start it again */
+    if (virDomainObjListSetID(&doms, obj, -1) < 0 ||
+        virDomainObjListSetID(&doms, obj, 42) < 0)
+        goto cleanup;
+    virDomainObjUnlock(obj);
+
+    if ((obj = virDomainFindByID(&doms, 1))) {
+        if (virTestGetVerbose())
+            testError("\nfound domain by its old ID");
+        goto cleanup;
+    }
+
+    if (!(obj = virDomainFindByID(&doms, 42)) ||
+        STRNEQ(obj->def->name, "dom0")) {
+        if (virTestGetVerbose())
+            testError("\nfailed to find domain by its new ID");
+        goto cleanup;
+    }
+
+    if (virDomainObjListSetID(&doms, obj, -1) < 0)
+        goto cleanup;
+    virDomainObjUnlock(obj);
+
+    if ((obj = virDomainFindByID(&doms, 42))) {
+        if (virTestGetVerbose())
+            testError("\nfound inactive domain by ID");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    if (obj)
+        virDomainObjUnlock(obj);
+    virDomainObjListDeinit(&doms);
+    return ret;
+}
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (!(caps = virCapabilitiesNew("x86_64", 0, 0)))
+        return EXIT_FAILURE;
+
+#define DO_TEST_COUNT(name, cmd, count)                             \
+    do {                                                            \
+        int n = count;                                              \
+        if (virtTestRun(name "(" #count ")", 1,                     \
+                        testDomainObjList ## cmd, &n) < 0)          \
+            ret = -1;                                               \
+    } while (0)
+
+    DO_TEST_COUNT("Lookup", Lookup, 1);
+    DO_TEST_COUNT("Lookup", Lookup, 10);
+    DO_TEST_COUNT("Lookup", Lookup, 1000);
+    DO_TEST_COUNT("Remove", Remove, 10);
+    DO_TEST_COUNT("Remove", Remove, 1000);
+    /* As many domains as on the largest hosts. Half of the lookups by
+     * ID miss, as only even domains are running */
+    DO_TEST_COUNT("Lookup", Lookup, 10000);
+    DO_TEST_COUNT("Remove", Remove, 10000);
+    if (virtTestRun("Restart", 1, testDomainObjListRestart, NULL) < 0)
+        ret = -1;
+
+    virCapabilitiesFree(caps);
+
+    return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -0,0 +1,389 @@
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "internal.h"
+#include "testutils.h"
+#include "memory.h"
+#include "util.h"
+#include "virfile.h"
+#include "virtime.h"
+
+
+#define MiB (1024 * 1024)
+#define BUFLEN MiB
+
+static char *tmpdir;
+
+/* Whether the filesystem of tmpdir tells holes from data */
+static bool holesSupported;
+
+/* A sparse file: data segments of @datalen bytes every @stride bytes,
+ * starting after a hole and followed by one */
+struct testSparseFile {
+    const char *name;
+    off_t size;
+    off_t stride;
+    off_t datalen;
+};
+
+static int
+testPath(const char *name, char **path)
+{
+    return virAsprintf(path, "%s/%s", tmpdir, name);
+}
+
+static int
+testCreateSparse(const struct testSparseFile *file)
+{
+    char *path = NULL;
+    char *buf = NULL;
+    off_t offset;
+    int fd = -1;
+    int ret = -1;
+
+    if (testPath(file->name, &path) < 0 ||
+        VIR_ALLOC_N(buf, file->datalen) < 0)
+        goto cleanup;
+    memset(buf, 'x', file->datalen);
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+        goto cleanup;
+
+    for (offset = file->stride - file->datalen;
+         offset + file->stride <= file->size;
+         offset += file->stride) {
+        if (lseek(fd, offset, SEEK_SET) < 0 ||
+            safewrite(fd, buf, file->datalen) < 0)
+            goto cleanup;
+    }
+
+    if (ftruncate(fd, file->size) < 0 ||
+        VIR_CLOSE(fd) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    VIR_FORCE_CLOSE(fd);
+    VIR_FREE(path);
+    VIR_FREE(buf);
+    return ret;
+}
+
+static int
+testIsZero(const void *opaque ATTRIBUTE_UNUSED)
+{
+    char buf[4096];
+    size_t lens[] = { 0, 1, 15, 16, 17, 100, sizeof(buf) };
+    size_t i, j;
+
+    memset(buf, 0, sizeof(buf));
+
+    for (i = 0; i < ARRAY_CARDINALITY(lens); i++) {
+        if (!virMemIsZero(buf, lens[i])) {
+            if (virTestGetVerbose())
+                testError("\n%zu zeroes not seen as zero", lens[i]);
+            return -1;
+        }
+
+        for (j = 0; j < lens[i]; j++) {
+            buf[j] = 1;
+            if (virMemIsZero(buf, lens[i])) {
+                if (virTestGetVerbose())
+                    testError("\nbyte %zu of %zu not seen", j, lens[i]);
+                return -1;
+            }
+            buf[j] = 0;
+        }
+    }
+
+    return 0;
+}
+
+static int
+testInData(const void *opaque)
+{
+    const struct testSparseFile *file = opaque;
+    char *path = NULL;
+    bool inData;
+    bool expectData;
+    unsigned long long length;
+    unsigned long long expect;
+    off_t offset = 0;
+    int fd = -1;
+    int ret = -1;
+
+    if (testCreateSparse(file) < 0 ||
+        testPath(file->name, &path) < 0 ||
+        (fd = open(path, O_RDONLY)) < 0)
+        goto cleanup;
+
+    if (virFileInData(fd, &inData, &length) < 0)
+        goto cleanup;
+
+    /* Everything is data where holes can't be found, which is fine */
+    if (inData && length == file->size) {
+        if (virTestGetDebug())
+            fprintf(stderr, "\nholes not supported in %s\n%74s",
+                    tmpdir, "... ");
+        ret = 0;
+        goto cleanup;
+    }
+    holesSupported = true;
+
+    while (offset < file->size) {
+        off_t strideEnd = (offset / file->stride + 1) * file->stride;
+        off_t dataStart = strideEnd - file->datalen;
+
+        /* Data was only written to strides within the file */
+        if (strideEnd > file->size) {
+            expectData = false;
+            expect = file->size - offset;
+        } else if (offset < dataStart) {
+            expectData = false;
+            expect = dataStart - offset;
+        } else {
+            expectData = true;
+            expect = strideEnd - offset;
+        }
+
+        if (lseek(fd, offset, SEEK_SET) < 0 ||
+            virFileInData(fd, &inData, &length) < 0)
+            goto cleanup;
+
+        if (inData != expectData || length != expect) {
+            if (virTestGetVerbose())
+                testError("\nexpected %s of %llu at %lld, got %s of %llu",
+                          expectData ? "data" : "hole", expect,
+                          (long long)offset, inData ? "data" : "hole",
+                          length);
+            goto cleanup;
+        }
+
+        if (lseek(fd, 0, SEEK_CUR) != offset) {
+            if (virTestGetVerbose())
+                testError("\nposition at %lld moved", (long long)offset);
+            goto cleanup;
+        }
+
+        offset += length;
+    }
+
+    if (lseek(fd, offset, SEEK_SET) < 0 ||
+        virFileInData(fd, &inData, &length) < 0)
+        goto cleanup;
+    if (!inData || length) {
+        if (virTestGetVerbose())
+            testError("\nend of file not found");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    VIR_FORCE_CLOSE(fd);
+    if (path)
+        unlink(path);
+    VIR_FREE(path);
+    return ret;
+}
+
+/*
+ * Copy @in to @out, either byte after byte or like the I/O helper of
+ * volume streams does, skipping the holes of @in and not writing
+ * zeroes to @out. Returns the time it took in @ms.
+ */
+static int
+testCopy(int in, int out, bool sparse, unsigned long long *ms)
+{
+    char *buf = NULL;
+    unsigned long long start, end;
+    off_t pos = 0;
+    ssize_t got;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(buf, BUFLEN) < 0 ||
+        virTimeMillisNow(&start) < 0)
+        goto cleanup;
+
+    while (1) {
+        size_t want = BUFLEN;
+
+        if (sparse) {
+            bool inData;
+            unsigned long long length;
+
+            if (virFileInData(in, &inData, &length) < 0)
+                goto cleanup;
+            if (length && length < want)
+                want = length;
+            if (!inData) {
+                /* Holes read as zeroes, which aren't written either */
+                if (lseek(in, want, SEEK_CUR) < 0 ||
+                    lseek(out, want, SEEK_CUR) < 0)
+                    goto cleanup;
+                pos += want;
+                continue;
+            }
+        }
+
+        if ((got = saferead(in, buf, want)) < 0)
+            goto cleanup;
+        if (got == 0)
+            break;
+
+        pos += got;
+        if (sparse && virMemIsZero(buf, got)) {
+            if (lseek(out, got, SEEK_CUR) < 0)
+                goto cleanup;
+        } else if (safewrite(out, buf, got) < 0) {
+            goto cleanup;
+        }
+    }
+
+    if (ftruncate(out, pos) < 0 ||
+        virTimeMillisNow(&end) < 0)
+        goto cleanup;
+
+    *ms = end - start;
+    ret = 0;
+
+cleanup:
+    VIR_FREE(buf);
+    return ret;
+}
+
+static int
+testCompare(int fd1, int fd2)
+{
+    char *buf1 = NULL;
+    char *buf2 = NULL;
+    ssize_t got1, got2;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(buf1, BUFLEN) < 0 ||
+        VIR_ALLOC_N(buf2, BUFLEN) < 0 ||
+        lseek(fd1, 0, SEEK_SET) < 0 ||
+        lseek(fd2, 0, SEEK_SET) < 0)
+        goto cleanup;
+
+    do {
+        if ((got1 = saferead(fd1, buf1, BUFLEN)) < 0 ||
+            (got2 = saferead(fd2, buf2, BUFLEN)) < 0)
+            goto cleanup;
+        if (got1 != got2 || memcmp(buf1, buf2, got1) != 0)
+            goto cleanup;
+    } while (got1);
+
+    ret = 0;
+
+cleanup:
+    VIR_FREE(buf1);
+    VIR_FREE(buf2);
+    return ret;
+}
+
+/* With --debug, reports how long copying a mostly empty file took */
+static int
+testCopySparse(const void *opaque)
+{
+    const struct testSparseFile *file = opaque;
+    char *path = NULL;
+    char *fullpath = NULL;
+    char *sparsepath = NULL;
+    unsigned long long fullms, sparsems;
+    struct stat sb;
+    int in = -1, full = -1, sparse = -1;
+    int ret = -1;
+
+    if (testCreateSparse(file) < 0 ||
+        testPath(file->name, &path) < 0 ||
+        testPath("full.img", &fullpath) < 0 ||
+        testPath("sparse.img", &sparsepath) < 0)
+        goto cleanup;
+
+    if ((in = open(path, O_RDONLY)) < 0 ||
+        (full = open(fullpath, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0 ||
+        (sparse = open(sparsepath, O_RDWR | O_CREAT | O_TRUNC, 0600)) < 0)
+        goto cleanup;
+
+    if (testCopy(in, full, false, &fullms) < 0 ||
+        lseek(in, 0, SEEK_SET) < 0 ||
+        testCopy(in, sparse, true, &sparsems) < 0)
+        goto cleanup;
+
+    if (testCompare(full, sparse) < 0) {
+        if (virTestGetVerbose())
+            testError("\nsparse copy differs");
+        goto cleanup;
+    }
+
+    if (fstat(sparse, &sb) < 0)
+        goto cleanup;
+    if (holesSupported && sb.st_blocks * 512 > file->size / 2) {
+        if (virTestGetVerbose())
+            testError("\nsparse copy uses %lld bytes",
+                      (long long)sb.st_blocks * 512);
+        goto cleanup;
+    }
+
+    if (virTestGetDebug())
+        fprintf(stderr, "\n%lld MiB copied in %llums, "
+                "%llums skipping holes, %lld MiB allocated\n%74s",
+                (long long)file->size / MiB, fullms, sparsems,
+                (long long)sb.st_blocks * 512 / MiB, "... ");
+
+    ret = 0;
+
+cleanup:
+    VIR_FORCE_CLOSE(in);
+    VIR_FORCE_CLOSE(full);
+    VIR_FORCE_CLOSE(sparse);
+    if (path)
+        unlink(path);
+    if (fullpath)
+        unlink(fullpath);
+    if (sparsepath)
+        unlink(sparsepath);
+    VIR_FREE(path);
+    VIR_FREE(fullpath);
+    VIR_FREE(sparsepath);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    char dir[] = "/tmp/virfiletest-XXXXXX";
+    struct testSparseFile small = { "small.img", 5 * MiB, 2 * MiB, MiB };
+    struct testSparseFile large = {
+        "large.img", 512 * MiB, 64 * MiB, MiB
+    };
+
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    tmpdir = dir;
+
+    if (virtTestRun("Is zero", 1, testIsZero, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("In data", 1, testInData, &small) < 0)
+        ret = -1;
+    if (virtTestRun("Copy sparse file", 1, testCopySparse, &large) < 0)
+        ret = -1;
+
+    rmdir(tmpdir);
+
+    return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
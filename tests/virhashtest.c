@@ -14,18 +14,6 @@
 #include "logging.h"
 
 
-#define testError(...)                                          \
-    do {                                                        \
-        char *str;                                              \
-        if (virAsprintf(&str, __VA_ARGS__) == 0) {              \
-            fprintf(stderr, "%s", str);                         \
-            VIR_FREE(str);                                      \
-        }                                                       \
-        /* Pad to line up with test name ... in virTestRun */   \
-        fprintf(stderr, "%74s", "... ");                        \
-    } while (0)
-
-
 static virHashTablePtr
 testHashInit(int size)
 {
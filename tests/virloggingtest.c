@@ -0,0 +1,251 @@
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+
+#include "internal.h"
+#include "testutils.h"
+#include "logging.h"
+#include "memory.h"
+#include "threads.h"
+#include "util.h"
+#include "virfile.h"
+#include "virtime.h"
+
+
+#define MAX_THREADS 16
+
+/* What the test output saw; outputs are called one at a time, so no
+ * locking is needed. Like a real output, it writes messages out, to
+ * /dev/null. */
+struct testLogState {
+    int fd;
+    size_t count;               /* messages from the test threads */
+    int next[MAX_THREADS];      /* next message expected per thread */
+    bool misordered;
+};
+
+static struct testLogState state;
+
+static int
+testLogOutput(const char *category ATTRIBUTE_UNUSED,
+              int priority ATTRIBUTE_UNUSED,
+              const char *funcname ATTRIBUTE_UNUSED,
+              long long linenr ATTRIBUTE_UNUSED,
+              const char *timestamp ATTRIBUTE_UNUSED,
+              const char *str,
+              void *data ATTRIBUTE_UNUSED)
+{
+    const char *msg;
+    int thread, seq;
+
+    /* Skip the version announced by the first message */
+    if (!(msg = strstr(str, "thread ")) ||
+        sscanf(msg, "thread %d message %d", &thread, &seq) != 2)
+        return 0;
+
+    if (thread < 0 || thread >= MAX_THREADS || seq != state.next[thread])
+        state.misordered = true;
+    else
+        state.next[thread]++;
+    state.count++;
+    return safewrite(state.fd, str, strlen(str));
+}
+
+static int
+testLogSetup(bool async)
+{
+    int fd = state.fd;
+
+    memset(&state, 0, sizeof(state));
+    state.fd = fd;
+
+    if (virLogReset() < 0 ||
+        virLogSetDefaultPriority(VIR_LOG_INFO) < 0 ||
+        virLogDefineOutput(testLogOutput, NULL, NULL, VIR_LOG_DEBUG,
+                           VIR_LOG_TO_STDERR, NULL, 0) < 0 ||
+        virLogSetAsync(async) < 0)
+        return -1;
+    return 0;
+}
+
+struct testThroughputData {
+    bool async;
+    int nthreads;
+    int nmessages;
+};
+
+struct testThroughputThread {
+    virThread thread;
+    int id;
+    int nmessages;
+};
+
+static void
+testThroughputLog(void *opaque)
+{
+    struct testThroughputThread *t = opaque;
+    int i;
+
+    for (i = 0; i < t->nmessages; i++)
+        virLogMessage("file.tests/virloggingtest.c", VIR_LOG_INFO,
+                      __func__, __LINE__, 0,
+                      "thread %d message %d", t->id, i);
+}
+
+static int
+testThroughput(const void *opaque)
+{
+    const struct testThroughputData *data = opaque;
+    struct testThroughputThread threads[MAX_THREADS];
+    unsigned long long start, logged, written;
+    size_t expect = data->nthreads * data->nmessages;
+    int nstarted;
+    int i;
+
+    if (testLogSetup(data->async) < 0 ||
+        virTimeMillisNow(&start) < 0)
+        return -1;
+
+    for (nstarted = 0; nstarted < data->nthreads; nstarted++) {
+        threads[nstarted].id = nstarted;
+        threads[nstarted].nmessages = data->nmessages;
+        if (virThreadCreate(&threads[nstarted].thread, true,
+                            testThroughputLog, &threads[nstarted]) < 0)
+            break;
+    }
+    for (i = 0; i < nstarted; i++)
+        virThreadJoin(&threads[i].thread);
+    if (nstarted < data->nthreads ||
+        virTimeMillisNow(&logged) < 0)
+        return -1;
+
+    /* Wait for everything queued to be written */
+    if (virLogSetAsync(false) < 0 ||
+        virTimeMillisNow(&written) < 0)
+        return -1;
+
+    if (state.count != expect || state.misordered) {
+        if (virTestGetVerbose())
+            testError("\nexpected %zu messages in order, got %zu%s",
+                      expect, state.count,
+                      state.misordered ? " out of order" : "");
+        return -1;
+    }
+
+    if (virTestGetDebug())
+        fprintf(stderr, "\n%zu messages logged in %llums, "
+                "written in %llums\n%74s",
+                expect, logged - start, written - start, "... ");
+
+    return 0;
+}
+
+struct testFilterData {
+    bool async;
+};
+
+static int
+testFilterEmitted(const char *category, int priority, size_t *emitted)
+{
+    size_t before = state.count;
+
+    virLogMessage(category, priority, __func__, __LINE__, 0,
+                  "thread 0 message %d", state.next[0]);
+    if (virLogSetAsync(false) < 0)
+        return -1;
+    *emitted = state.count - before;
+    return 0;
+}
+
+#define CHECK_EMITTED(category, priority, expect)                       \
+    do {                                                                \
+        size_t emitted;                                                 \
+        if (testFilterEmitted(category, priority, &emitted) < 0)        \
+            return -1;                                                  \
+        if (emitted != (expect)) {                                      \
+            if (virTestGetVerbose())                                    \
+                testError("\n%s message for %s %s emitted at line %d", \
+                          #priority, category,                          \
+                          (expect) ? "not" : "wrongly", __LINE__);      \
+            return -1;                                                  \
+        }                                                               \
+        if (virLogSetAsync(data->async) < 0)                            \
+            return -1;                                                  \
+    } while (0)
+
+static int
+testFilters(const void *opaque)
+{
+    const struct testFilterData *data = opaque;
+
+    if (testLogSetup(data->async) < 0)
+        return -1;
+
+    CHECK_EMITTED("file.util/foo.c", VIR_LOG_DEBUG, 0);
+    CHECK_EMITTED("file.util/foo.c", VIR_LOG_INFO, 1);
+
+    /* The cached outcome must not survive a new filter */
+    if (virLogDefineFilter("util", VIR_LOG_DEBUG, 0) < 0)
+        return -1;
+    CHECK_EMITTED("file.util/foo.c", VIR_LOG_DEBUG, 1);
+    CHECK_EMITTED("file.conf/foo.c", VIR_LOG_DEBUG, 0);
+
+    /* Nor a changed one */
+    if (virLogDefineFilter("util", VIR_LOG_WARN, 0) < 0)
+        return -1;
+    CHECK_EMITTED("file.util/foo.c", VIR_LOG_INFO, 0);
+    CHECK_EMITTED("file.util/foo.c", VIR_LOG_WARN, 1);
+
+    /* Nor filters being dropped */
+    if (testLogSetup(data->async) < 0)
+        return -1;
+    CHECK_EMITTED("file.util/foo.c", VIR_LOG_INFO, 1);
+
+    return 0;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if ((state.fd = open("/dev/null", O_WRONLY)) < 0)
+        return EXIT_FAILURE;
+
+#define DO_TEST_THROUGHPUT(name, async, nthreads)                       \
+    do {                                                                \
+        struct testThroughputData data = { async, nthreads, 20000 };    \
+        if (virtTestRun("Throughput " name, 1,                          \
+                        testThroughput, &data) < 0)                     \
+            ret = -1;                                                   \
+    } while (0)
+
+#define DO_TEST_FILTERS(name, async)                                    \
+    do {                                                                \
+        struct testFilterData data = { async };                         \
+        if (virtTestRun("Filters " name, 1, testFilters, &data) < 0)    \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST_FILTERS("sync", false);
+    DO_TEST_FILTERS("async", true);
+
+    /* With --debug, reports how long logging took */
+    DO_TEST_THROUGHPUT("sync, 1 thread", false, 1);
+    DO_TEST_THROUGHPUT("async, 1 thread", true, 1);
+    DO_TEST_THROUGHPUT("sync, 8 threads", false, 8);
+    DO_TEST_THROUGHPUT("async, 8 threads", true, 8);
+    DO_TEST_THROUGHPUT("sync, 16 threads", false, 16);
+    DO_TEST_THROUGHPUT("async, 16 threads", true, 16);
+
+    virLogShutdown();
+    VIR_FORCE_CLOSE(state.fd);
+
+    return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -0,0 +1,513 @@
+#include <config.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "internal.h"
+#include "testutils.h"
+#include "command.h"
+#include "memory.h"
+#include "util.h"
+#include "virfile.h"
+#include "virlz4.h"
+#include "virtime.h"
+
+
+#define MiB (1024 * 1024)
+
+static char *tmpdir;
+
+static void
+testQuietError(void *userData ATTRIBUTE_UNUSED,
+               virErrorPtr error ATTRIBUTE_UNUSED)
+{
+    /* nada */
+}
+
+typedef enum {
+    TEST_DATA_ZERO,
+    TEST_DATA_RANDOM,
+    TEST_DATA_TEXT,
+    TEST_DATA_MEMORY,           /* Pages of all the above, like a guest's */
+} testDataType;
+
+struct testLZ4Data {
+    testDataType type;
+    size_t len;
+    unsigned int nthreads;
+};
+
+static uint32_t
+testRandom(uint32_t *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+static void
+testFill(char *buf, size_t len, testDataType type, uint32_t *seed)
+{
+    static const char *words[] = {
+        "libvirt ", "domain ", "save ", "image ", "memory ", "page ",
+        "guest ", "qemu ", "\n", "0x7f3a ",
+    };
+    size_t i;
+
+    switch (type) {
+    case TEST_DATA_ZERO:
+        memset(buf, 0, len);
+        break;
+
+    case TEST_DATA_RANDOM:
+        for (i = 0; i < len; i++)
+            buf[i] = testRandom(seed);
+        break;
+
+    case TEST_DATA_TEXT:
+        for (i = 0; i < len; ) {
+            const char *word = words[testRandom(seed) %
+                                     ARRAY_CARDINALITY(words)];
+            size_t n = MIN(strlen(word), len - i);
+
+            memcpy(buf + i, word, n);
+            i += n;
+        }
+        break;
+
+    case TEST_DATA_MEMORY:
+        for (i = 0; i < len; i += 4096)
+            testFill(buf + i, MIN(4096, len - i),
+                     testRandom(seed) % TEST_DATA_MEMORY, seed);
+        break;
+    }
+}
+
+static int
+testPath(const char *name, char **path)
+{
+    return virAsprintf(path, "%s/%s", tmpdir, name);
+}
+
+static int
+testWriteData(const char *path, testDataType type, size_t len)
+{
+    char *buf = NULL;
+    uint32_t seed = len;
+    int fd;
+    int ret = -1;
+
+    if (VIR_ALLOC_N(buf, MiB) < 0 ||
+        (fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+        goto cleanup;
+
+    while (len) {
+        size_t n = MIN(len, MiB);
+
+        testFill(buf, n, type, &seed);
+        if (safewrite(fd, buf, n) < 0) {
+            VIR_FORCE_CLOSE(fd);
+            goto cleanup;
+        }
+        len -= n;
+    }
+
+    if (VIR_CLOSE(fd) < 0)
+        goto cleanup;
+    ret = 0;
+
+cleanup:
+    VIR_FREE(buf);
+    return ret;
+}
+
+static int
+testWriteBuf(const char *path, const char *buf, size_t len)
+{
+    int fd;
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+        return -1;
+    if (safewrite(fd, buf, len) < 0) {
+        VIR_FORCE_CLOSE(fd);
+        return -1;
+    }
+    return VIR_CLOSE(fd);
+}
+
+/* Run a stream from @inpath to @outpath, in @ms if non-NULL */
+static int
+testStream(const char *inpath, const char *outpath, unsigned int nthreads,
+           unsigned int flags, unsigned long long *ms)
+{
+    virLZ4StreamPtr st = NULL;
+    unsigned long long start, end;
+    int infd = -1;
+    int outfd = -1;
+    int ret = -1;
+
+    if ((infd = open(inpath, O_RDONLY)) < 0 ||
+        (outfd = open(outpath, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0 ||
+        virTimeMillisNow(&start) < 0)
+        goto cleanup;
+
+    if (!(st = virLZ4StreamNew(infd, outfd, nthreads, flags)))
+        goto cleanup;
+    VIR_FORCE_CLOSE(infd);
+    VIR_FORCE_CLOSE(outfd);
+
+    if (virLZ4StreamWait(st) < 0 ||
+        virTimeMillisNow(&end) < 0)
+        goto cleanup;
+
+    if (ms)
+        *ms = end - start;
+    ret = 0;
+
+cleanup:
+    virLZ4StreamFree(st);
+    VIR_FORCE_CLOSE(infd);
+    VIR_FORCE_CLOSE(outfd);
+    return ret;
+}
+
+static int
+testCompare(const char *path1, const char *path2)
+{
+    char *buf1 = NULL;
+    char *buf2 = NULL;
+    int len1, len2;
+    int ret = -1;
+
+    if ((len1 = virFileReadAll(path1, 64 * MiB, &buf1)) < 0 ||
+        (len2 = virFileReadAll(path2, 64 * MiB, &buf2)) < 0)
+        goto cleanup;
+
+    if (len1 != len2 || memcmp(buf1, buf2, len1) != 0) {
+        if (virTestGetVerbose())
+            testError("\n%s and %s differ", path1, path2);
+        goto cleanup;
+    }
+    ret = 0;
+
+cleanup:
+    VIR_FREE(buf1);
+    VIR_FREE(buf2);
+    return ret;
+}
+
+static int
+testRoundTrip(const void *opaque)
+{
+    const struct testLZ4Data *data = opaque;
+    char *path = NULL;
+    char *lz4path = NULL;
+    char *outpath = NULL;
+    int ret = -1;
+
+    if (testPath("data", &path) < 0 ||
+        testPath("data.lz4", &lz4path) < 0 ||
+        testPath("data.out", &outpath) < 0 ||
+        testWriteData(path, data->type, data->len) < 0)
+        goto cleanup;
+
+    if (testStream(path, lz4path, data->nthreads, 0, NULL) < 0 ||
+        testStream(lz4path, outpath, data->nthreads,
+                   VIR_LZ4_STREAM_DECOMPRESS, NULL) < 0 ||
+        testCompare(path, outpath) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    if (path)
+        unlink(path);
+    if (lz4path)
+        unlink(lz4path);
+    if (outpath)
+        unlink(outpath);
+    VIR_FREE(path);
+    VIR_FREE(lz4path);
+    VIR_FREE(outpath);
+    return ret;
+}
+
+/* Streams must read what the lz4 program writes and vice versa */
+static int
+testProgram(const void *opaque ATTRIBUTE_UNUSED)
+{
+    char *prog = NULL;
+    char *path = NULL;
+    char *lz4path = NULL;
+    char *outpath = NULL;
+    virCommandPtr cmd = NULL;
+    int ret = -1;
+
+    if (!(prog = virFindFileInPath(VIR_LZ4_PROGRAM)))
+        return EXIT_AM_SKIP;
+
+    if (testPath("data", &path) < 0 ||
+        testPath("data.lz4", &lz4path) < 0 ||
+        testPath("data.out", &outpath) < 0 ||
+        testWriteData(path, TEST_DATA_MEMORY, 5 * MiB + 123) < 0)
+        goto cleanup;
+
+    cmd = virCommandNewArgList(prog, "-z", "-f", path, lz4path, NULL);
+    if (virCommandRun(cmd, NULL) < 0 ||
+        testStream(lz4path, outpath, 0, VIR_LZ4_STREAM_DECOMPRESS,
+                   NULL) < 0 ||
+        testCompare(path, outpath) < 0)
+        goto cleanup;
+    virCommandFree(cmd);
+
+    cmd = virCommandNewArgList(prog, "-d", "-f", lz4path, outpath, NULL);
+    if (testStream(path, lz4path, 0, 0, NULL) < 0 ||
+        virCommandRun(cmd, NULL) < 0 ||
+        testCompare(path, outpath) < 0)
+        goto cleanup;
+
+    ret = 0;
+
+cleanup:
+    if (path)
+        unlink(path);
+    if (lz4path)
+        unlink(lz4path);
+    if (outpath)
+        unlink(outpath);
+    virCommandFree(cmd);
+    VIR_FREE(prog);
+    VIR_FREE(path);
+    VIR_FREE(lz4path);
+    VIR_FREE(outpath);
+    return ret;
+}
+
+/* Damaged streams must fail to decompress, not crash */
+static int
+testCorrupt(const void *opaque ATTRIBUTE_UNUSED)
+{
+    char *path = NULL;
+    char *lz4path = NULL;
+    char *outpath = NULL;
+    char *buf = NULL;
+    int len;
+    int i;
+    int ret = -1;
+
+    if (testPath("data", &path) < 0 ||
+        testPath("data.lz4", &lz4path) < 0 ||
+        testPath("data.out", &outpath) < 0 ||
+        testWriteData(path, TEST_DATA_MEMORY, MiB) < 0 ||
+        testStream(path, lz4path, 0, 0, NULL) < 0 ||
+        (len = virFileReadAll(lz4path, 2 * MiB, &buf)) < 0)
+        goto cleanup;
+
+    for (i = 0; i < 100; i++) {
+        int offset = (i * 7919) % len;
+        bool truncated = i % 10 == 0;
+
+        buf[offset] ^= 0x20;
+        if (testWriteBuf(lz4path, buf, truncated ? offset : len) < 0)
+            goto cleanup;
+        buf[offset] ^= 0x20;
+
+        if (testStream(lz4path, outpath, 0, VIR_LZ4_STREAM_DECOMPRESS,
+                       NULL) == 0) {
+            if (virTestGetVerbose())
+                testError("\n%s stream at %d not detected",
+                          truncated ? "truncated" : "damaged", offset);
+            goto cleanup;
+        }
+    }
+
+    ret = 0;
+
+cleanup:
+    if (path)
+        unlink(path);
+    if (lz4path)
+        unlink(lz4path);
+    if (outpath)
+        unlink(outpath);
+    VIR_FREE(path);
+    VIR_FREE(lz4path);
+    VIR_FREE(outpath);
+    VIR_FREE(buf);
+    return ret;
+}
+
+/*
+ * Freeing a stream must stop it even though its input stays open,
+ * and whoever writes to it must then learn that it isn't read anymore,
+ * like QEMU would when saving a domain fails
+ */
+static int
+testAbort(const void *opaque ATTRIBUTE_UNUSED)
+{
+    virLZ4StreamPtr st = NULL;
+    char *outpath = NULL;
+    char buf[4096];
+    int pipefd[2] = { -1, -1 };
+    int outfd = -1;
+    int ret = -1;
+
+    memset(buf, 'x', sizeof(buf));
+
+    if (testPath("data.lz4", &outpath) < 0 ||
+        pipe(pipefd) < 0 ||
+        (outfd = open(outpath, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+        goto cleanup;
+
+    if (!(st = virLZ4StreamNew(pipefd[0], outfd, 2, 0)))
+        goto cleanup;
+    VIR_FORCE_CLOSE(pipefd[0]);
+
+    if (safewrite(pipefd[1], buf, sizeof(buf)) < 0)
+        goto cleanup;
+
+    virLZ4StreamFree(st);
+    st = NULL;
+
+    if (safewrite(pipefd[1], buf, sizeof(buf)) >= 0 || errno != EPIPE) {
+        if (virTestGetVerbose())
+            testError("\nstream still read after being freed");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virLZ4StreamFree(st);
+    VIR_FORCE_CLOSE(pipefd[0]);
+    VIR_FORCE_CLOSE(pipefd[1]);
+    VIR_FORCE_CLOSE(outfd);
+    if (outpath)
+        unlink(outpath);
+    VIR_FREE(outpath);
+    return ret;
+}
+
+/* Run with --debug only, reports how fast guest memory like data is
+ * compressed and decompressed */
+static int
+testThroughput(const void *opaque)
+{
+    const struct testLZ4Data *data = opaque;
+    char *path = NULL;
+    char *lz4path = NULL;
+    char *outpath = NULL;
+    unsigned long long cms, dms;
+    struct stat sb;
+    int ret = -1;
+
+    if (testPath("data", &path) < 0 ||
+        testPath("data.lz4", &lz4path) < 0 ||
+        testPath("data.out", &outpath) < 0 ||
+        testWriteData(path, data->type, data->len) < 0)
+        goto cleanup;
+
+    if (testStream(path, lz4path, data->nthreads, 0, &cms) < 0 ||
+        testStream(lz4path, outpath, data->nthreads,
+                   VIR_LZ4_STREAM_DECOMPRESS, &dms) < 0 ||
+        stat(lz4path, &sb) < 0)
+        goto cleanup;
+
+    if (virTestGetDebug())
+        fprintf(stderr, "\n%zu MiB compressed to %lld MiB in %llums, "
+                "decompressed in %llums\n%74s",
+                data->len / MiB, (long long)sb.st_size / MiB,
+                cms, dms, "... ");
+
+    ret = 0;
+
+cleanup:
+    if (path)
+        unlink(path);
+    if (lz4path)
+        unlink(lz4path);
+    if (outpath)
+        unlink(outpath);
+    VIR_FREE(path);
+    VIR_FREE(lz4path);
+    VIR_FREE(outpath);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+    char dir[] = "/tmp/virlz4test-XXXXXX";
+
+    /* Streams can't be compressed in process without liblz4 */
+    if (!virLZ4StreamAvailable())
+        return EXIT_AM_SKIP;
+
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Damaged streams fail to decompress on purpose */
+    if (!virTestGetDebug())
+        virSetErrorFunc(NULL, testQuietError);
+
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    tmpdir = dir;
+
+#define DO_TEST(name, type, len, nthreads)                              \
+    do {                                                                \
+        struct testLZ4Data data = { type, len, nthreads };              \
+        if (virtTestRun("Round trip " name " " #nthreads " threads",    \
+                        1, testRoundTrip, &data) < 0)                   \
+            ret = -1;                                                   \
+    } while (0)
+
+#define DO_TEST_THROUGHPUT(nthreads)                                    \
+    do {                                                                \
+        struct testLZ4Data data = { TEST_DATA_MEMORY, 256 * MiB,        \
+                                    nthreads };                         \
+        if (virtTestRun("Throughput " #nthreads " threads",             \
+                        1, testThroughput, &data) < 0)                  \
+            ret = -1;                                                   \
+    } while (0)
+
+    DO_TEST("empty", TEST_DATA_ZERO, 0, 1);
+    DO_TEST("1 byte", TEST_DATA_TEXT, 1, 1);
+    DO_TEST("12 bytes", TEST_DATA_TEXT, 12, 1);
+    DO_TEST("13 bytes", TEST_DATA_TEXT, 13, 1);
+    DO_TEST("zeroes", TEST_DATA_ZERO, 3 * MiB, 1);
+    DO_TEST("zeroes", TEST_DATA_ZERO, 3 * MiB, 4);
+    DO_TEST("random", TEST_DATA_RANDOM, 3 * MiB + 1, 1);
+    DO_TEST("random", TEST_DATA_RANDOM, 3 * MiB + 1, 4);
+    DO_TEST("text", TEST_DATA_TEXT, 5 * MiB - 7, 1);
+    DO_TEST("text", TEST_DATA_TEXT, 5 * MiB - 7, 4);
+    DO_TEST("memory", TEST_DATA_MEMORY, 16 * MiB + 4096, 3);
+
+    if (virtTestRun("lz4 program", 1, testProgram, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Corrupt streams", 1, testCorrupt, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Abort", 1, testAbort, NULL) < 0)
+        ret = -1;
+
+    /* Compressing this much takes a while, so only on request */
+    if (virTestGetDebug()) {
+        DO_TEST_THROUGHPUT(1);
+        DO_TEST_THROUGHPUT(2);
+        DO_TEST_THROUGHPUT(4);
+    }
+
+    rmdir(tmpdir);
+
+    return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
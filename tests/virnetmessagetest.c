@@ -35,7 +35,8 @@
 
 static int testMessageHeaderEncode(const void *args ATTRIBUTE_UNUSED)
 {
-    static virNetMessage msg;
+    virNetMessagePtr msg = virNetMessageNew(true);
+    int ret = -1;
     static const char expect[] = {
         0x00, 0x00, 0x00, 0x1c,  /* Length */
         0x11, 0x22, 0x33, 0x44,  /* Program */
@@ -45,128 +46,140 @@ static int testMessageHeaderEncode(const void *args ATTRIBUTE_UNUSED)
         0x00, 0x00, 0x00, 0x99,  /* Serial */
         0x00, 0x00, 0x00, 0x00,  /* Status */
     };
-    memset(&msg, 0, sizeof(msg));
-
-    msg.header.prog = 0x11223344;
-    msg.header.vers = 0x01;
-    msg.header.proc = 0x666;
-    msg.header.type = VIR_NET_CALL;
-    msg.header.serial = 0x99;
-    msg.header.status = VIR_NET_OK;
 
-    if (virNetMessageEncodeHeader(&msg) < 0)
+    if (!msg)
         return -1;
 
-    if (ARRAY_CARDINALITY(expect) != msg.bufferOffset) {
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.proc = 0x666;
+    msg->header.type = VIR_NET_CALL;
+    msg->header.serial = 0x99;
+    msg->header.status = VIR_NET_OK;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+
+    if (ARRAY_CARDINALITY(expect) != msg->bufferOffset) {
         VIR_DEBUG("Expect message offset %zu got %zu",
-                  sizeof(expect), msg.bufferOffset);
-        return -1;
+                  sizeof(expect), msg->bufferOffset);
+        goto cleanup;
     }
 
-    if (msg.bufferLength != sizeof(msg.buffer)) {
+    if (msg->bufferLength != VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX) {
         VIR_DEBUG("Expect message offset %zu got %zu",
-                  sizeof(msg.buffer), msg.bufferLength);
-        return -1;
+                  (size_t)VIR_NET_MESSAGE_INITIAL + VIR_NET_MESSAGE_LEN_MAX,
+                  msg->bufferLength);
+        goto cleanup;
     }
 
-    if (memcmp(expect, msg.buffer, sizeof(expect)) != 0) {
-        virtTestDifferenceBin(stderr, expect, msg.buffer, sizeof(expect));
-        return -1;
+    if (memcmp(expect, msg->buffer, sizeof(expect)) != 0) {
+        virtTestDifferenceBin(stderr, expect, msg->buffer, sizeof(expect));
+        goto cleanup;
     }
 
-    return 0;
+    ret = 0;
+cleanup:
+    virNetMessageFree(msg);
+    return ret;
 }
 
 static int testMessageHeaderDecode(const void *args ATTRIBUTE_UNUSED)
 {
-    static virNetMessage msg = {
-        .bufferOffset = 0,
-        .bufferLength = 0x4,
-        .buffer = {
-            0x00, 0x00, 0x00, 0x1c,  /* Length */
-            0x11, 0x22, 0x33, 0x44,  /* Program */
-            0x00, 0x00, 0x00, 0x01,  /* Version */
-            0x00, 0x00, 0x06, 0x66,  /* Procedure */
-            0x00, 0x00, 0x00, 0x01,  /* Type */
-            0x00, 0x00, 0x00, 0x99,  /* Serial */
-            0x00, 0x00, 0x00, 0x01,  /* Status */
-        },
-        .header = { 0, 0, 0, 0, 0, 0 },
+    virNetMessagePtr msg = virNetMessageNew(true);
+    static const char input[] = {
+        0x00, 0x00, 0x00, 0x1c,  /* Length */
+        0x11, 0x22, 0x33, 0x44,  /* Program */
+        0x00, 0x00, 0x00, 0x01,  /* Version */
+        0x00, 0x00, 0x06, 0x66,  /* Procedure */
+        0x00, 0x00, 0x00, 0x01,  /* Type */
+        0x00, 0x00, 0x00, 0x99,  /* Serial */
+        0x00, 0x00, 0x00, 0x01,  /* Status */
     };
+    int ret = -1;
+
+    if (!msg)
+        return -1;
 
-    msg.header.prog = 0x11223344;
-    msg.header.vers = 0x01;
-    msg.header.proc = 0x666;
-    msg.header.type = VIR_NET_CALL;
-    msg.header.serial = 0x99;
-    msg.header.status = VIR_NET_OK;
+    msg->bufferLength = 4;
+    memcpy(msg->buffer, input, sizeof(input));
 
-    if (virNetMessageDecodeLength(&msg) < 0) {
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.proc = 0x666;
+    msg->header.type = VIR_NET_CALL;
+    msg->header.serial = 0x99;
+    msg->header.status = VIR_NET_OK;
+
+    if (virNetMessageDecodeLength(msg) < 0) {
         VIR_DEBUG("Failed to decode message header");
-        return -1;
+        goto cleanup;
     }
 
-    if (msg.bufferOffset != 0x4) {
+    if (msg->bufferOffset != 0x4) {
         VIR_DEBUG("Expecting offset %zu got %zu",
-                  (size_t)4, msg.bufferOffset);
-        return -1;
+                  (size_t)4, msg->bufferOffset);
+        goto cleanup;
     }
 
-    if (msg.bufferLength != 0x1c) {
+    if (msg->bufferLength != 0x1c) {
         VIR_DEBUG("Expecting length %zu got %zu",
-                  (size_t)0x1c, msg.bufferLength);
-        return -1;
+                  (size_t)0x1c, msg->bufferLength);
+        goto cleanup;
     }
 
-    if (virNetMessageDecodeHeader(&msg) < 0) {
+    if (virNetMessageDecodeHeader(msg) < 0) {
         VIR_DEBUG("Failed to decode message header");
-        return -1;
+        goto cleanup;
     }
 
-    if (msg.bufferOffset != msg.bufferLength) {
+    if (msg->bufferOffset != msg->bufferLength) {
         VIR_DEBUG("Expect message offset %zu got %zu",
-                  msg.bufferOffset, msg.bufferLength);
-        return -1;
+                  msg->bufferOffset, msg->bufferLength);
+        goto cleanup;
     }
 
-    if (msg.header.prog != 0x11223344) {
+    if (msg->header.prog != 0x11223344) {
         VIR_DEBUG("Expect prog %d got %d",
-                  0x11223344, msg.header.prog);
-        return -1;
+                  0x11223344, msg->header.prog);
+        goto cleanup;
     }
-    if (msg.header.vers != 0x1) {
+    if (msg->header.vers != 0x1) {
         VIR_DEBUG("Expect vers %d got %d",
-                  0x11223344, msg.header.vers);
-        return -1;
+                  0x11223344, msg->header.vers);
+        goto cleanup;
     }
-    if (msg.header.proc != 0x666) {
+    if (msg->header.proc != 0x666) {
         VIR_DEBUG("Expect proc %d got %d",
-                  0x666, msg.header.proc);
-        return -1;
+                  0x666, msg->header.proc);
+        goto cleanup;
     }
-    if (msg.header.type != VIR_NET_REPLY) {
+    if (msg->header.type != VIR_NET_REPLY) {
         VIR_DEBUG("Expect type %d got %d",
-                  VIR_NET_REPLY, msg.header.type);
-        return -1;
+                  VIR_NET_REPLY, msg->header.type);
+        goto cleanup;
     }
-    if (msg.header.serial != 0x99) {
+    if (msg->header.serial != 0x99) {
         VIR_DEBUG("Expect serial %d got %d",
-                  0x99, msg.header.serial);
-        return -1;
+                  0x99, msg->header.serial);
+        goto cleanup;
     }
-    if (msg.header.status != VIR_NET_ERROR) {
+    if (msg->header.status != VIR_NET_ERROR) {
         VIR_DEBUG("Expect status %d got %d",
-                  VIR_NET_ERROR, msg.header.status);
-        return -1;
+                  VIR_NET_ERROR, msg->header.status);
+        goto cleanup;
     }
 
-    return 0;
+    ret = 0;
+cleanup:
+    virNetMessageFree(msg);
+    return ret;
 }
 
 static int testMessagePayloadEncode(const void *args ATTRIBUTE_UNUSED)
 {
     virNetMessageError err;
-    static virNetMessage msg;
+    virNetMessagePtr msg = virNetMessageNew(true);
     int ret = -1;
     static const char expect[] = {
         0x00, 0x00, 0x00, 0x74,  /* Length */
@@ -200,7 +213,10 @@ static int testMessagePayloadEncode(const void *args ATTRIBUTE_UNUSED)
         0x00, 0x00, 0x00, 0x02,  /* Error int2 */
         0x00, 0x00, 0x00, 0x00,  /* Error network pointer */
     };
-    memset(&msg, 0, sizeof(msg));
+
+    if (!msg)
+        return -1;
+
     memset(&err, 0, sizeof(err));
 
     err.code = VIR_ERR_INTERNAL_ERROR;
@@ -223,33 +239,33 @@ static int testMessagePayloadEncode(const void *args ATTRIBUTE_UNUSED)
     err.int1 = 1;
     err.int2 = 2;
 
-    msg.header.prog = 0x11223344;
-    msg.header.vers = 0x01;
-    msg.header.proc = 0x666;
-    msg.header.type = VIR_NET_MESSAGE;
-    msg.header.serial = 0x99;
-    msg.header.status = VIR_NET_ERROR;
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.proc = 0x666;
+    msg->header.type = VIR_NET_MESSAGE;
+    msg->header.serial = 0x99;
+    msg->header.status = VIR_NET_ERROR;
 
-    if (virNetMessageEncodeHeader(&msg) < 0)
+    if (virNetMessageEncodeHeader(msg) < 0)
         goto cleanup;
 
-    if (virNetMessageEncodePayload(&msg, (xdrproc_t)xdr_virNetMessageError, &err) < 0)
+    if (virNetMessageEncodePayload(msg, (xdrproc_t)xdr_virNetMessageError, &err) < 0)
         goto cleanup;
 
-    if (ARRAY_CARDINALITY(expect) != msg.bufferLength) {
+    if (ARRAY_CARDINALITY(expect) != msg->bufferLength) {
         VIR_DEBUG("Expect message length %zu got %zu",
-                  sizeof(expect), msg.bufferLength);
+                  sizeof(expect), msg->bufferLength);
         goto cleanup;
     }
 
-    if (msg.bufferOffset != 0) {
+    if (msg->bufferOffset != 0) {
         VIR_DEBUG("Expect message offset 0 got %zu",
-                  msg.bufferOffset);
+                  msg->bufferOffset);
         goto cleanup;
     }
 
-    if (memcmp(expect, msg.buffer, sizeof(expect)) != 0) {
-        virtTestDifferenceBin(stderr, expect, msg.buffer, sizeof(expect));
+    if (memcmp(expect, msg->buffer, sizeof(expect)) != 0) {
+        virtTestDifferenceBin(stderr, expect, msg->buffer, sizeof(expect));
         goto cleanup;
     }
 
@@ -267,166 +283,405 @@ cleanup:
     VIR_FREE(err.str1);
     VIR_FREE(err.str2);
     VIR_FREE(err.str3);
+    virNetMessageFree(msg);
     return ret;
 }
 
 static int testMessagePayloadDecode(const void *args ATTRIBUTE_UNUSED)
 {
     virNetMessageError err;
-    static virNetMessage msg = {
-        .bufferOffset = 0,
-        .bufferLength = 0x4,
-        .buffer = {
-            0x00, 0x00, 0x00, 0x74,  /* Length */
-            0x11, 0x22, 0x33, 0x44,  /* Program */
-            0x00, 0x00, 0x00, 0x01,  /* Version */
-            0x00, 0x00, 0x06, 0x66,  /* Procedure */
-            0x00, 0x00, 0x00, 0x02,  /* Type */
-            0x00, 0x00, 0x00, 0x99,  /* Serial */
-            0x00, 0x00, 0x00, 0x01,  /* Status */
-
-            0x00, 0x00, 0x00, 0x01,  /* Error code */
-            0x00, 0x00, 0x00, 0x07,  /* Error domain */
-            0x00, 0x00, 0x00, 0x01,  /* Error message pointer */
-            0x00, 0x00, 0x00, 0x0b,  /* Error message length */
-            'H', 'e', 'l', 'l',  /* Error message string */
-            'o', ' ', 'W', 'o',
-            'r', 'l', 'd', '\0',
-            0x00, 0x00, 0x00, 0x02,  /* Error level */
-            0x00, 0x00, 0x00, 0x00,  /* Error domain pointer */
-            0x00, 0x00, 0x00, 0x01,  /* Error str1 pointer */
-            0x00, 0x00, 0x00, 0x03,  /* Error str1 length */
-            'O', 'n', 'e', '\0',  /* Error str1 message */
-            0x00, 0x00, 0x00, 0x01,  /* Error str2 pointer */
-            0x00, 0x00, 0x00, 0x03,  /* Error str2 length */
-            'T', 'w', 'o', '\0',  /* Error str2 message */
-            0x00, 0x00, 0x00, 0x01,  /* Error str3 pointer */
-            0x00, 0x00, 0x00, 0x05,  /* Error str3 length */
-            'T', 'h', 'r', 'e',  /* Error str3 message */
-            'e', '\0', '\0', '\0',
-            0x00, 0x00, 0x00, 0x01,  /* Error int1 */
-            0x00, 0x00, 0x00, 0x02,  /* Error int2 */
-            0x00, 0x00, 0x00, 0x00,  /* Error network pointer */
-        },
-        .header = { 0, 0, 0, 0, 0, 0 },
+    virNetMessagePtr msg = virNetMessageNew(true);
+    static const char input[] = {
+        0x00, 0x00, 0x00, 0x74,  /* Length */
+        0x11, 0x22, 0x33, 0x44,  /* Program */
+        0x00, 0x00, 0x00, 0x01,  /* Version */
+        0x00, 0x00, 0x06, 0x66,  /* Procedure */
+        0x00, 0x00, 0x00, 0x02,  /* Type */
+        0x00, 0x00, 0x00, 0x99,  /* Serial */
+        0x00, 0x00, 0x00, 0x01,  /* Status */
+
+        0x00, 0x00, 0x00, 0x01,  /* Error code */
+        0x00, 0x00, 0x00, 0x07,  /* Error domain */
+        0x00, 0x00, 0x00, 0x01,  /* Error message pointer */
+        0x00, 0x00, 0x00, 0x0b,  /* Error message length */
+        'H', 'e', 'l', 'l',  /* Error message string */
+        'o', ' ', 'W', 'o',
+        'r', 'l', 'd', '\0',
+        0x00, 0x00, 0x00, 0x02,  /* Error level */
+        0x00, 0x00, 0x00, 0x00,  /* Error domain pointer */
+        0x00, 0x00, 0x00, 0x01,  /* Error str1 pointer */
+        0x00, 0x00, 0x00, 0x03,  /* Error str1 length */
+        'O', 'n', 'e', '\0',  /* Error str1 message */
+        0x00, 0x00, 0x00, 0x01,  /* Error str2 pointer */
+        0x00, 0x00, 0x00, 0x03,  /* Error str2 length */
+        'T', 'w', 'o', '\0',  /* Error str2 message */
+        0x00, 0x00, 0x00, 0x01,  /* Error str3 pointer */
+        0x00, 0x00, 0x00, 0x05,  /* Error str3 length */
+        'T', 'h', 'r', 'e',  /* Error str3 message */
+        'e', '\0', '\0', '\0',
+        0x00, 0x00, 0x00, 0x01,  /* Error int1 */
+        0x00, 0x00, 0x00, 0x02,  /* Error int2 */
+        0x00, 0x00, 0x00, 0x00,  /* Error network pointer */
     };
+    int ret = -1;
+
     memset(&err, 0, sizeof(err));
 
-    if (virNetMessageDecodeLength(&msg) < 0) {
-        VIR_DEBUG("Failed to decode message header");
+    if (!msg)
         return -1;
+
+    msg->bufferLength = 4;
+    memcpy(msg->buffer, input, sizeof(input));
+
+    if (virNetMessageDecodeLength(msg) < 0) {
+        VIR_DEBUG("Failed to decode message header");
+        goto cleanup;
     }
 
-    if (msg.bufferOffset != 0x4) {
+    if (msg->bufferOffset != 0x4) {
         VIR_DEBUG("Expecting offset %zu got %zu",
-                  (size_t)4, msg.bufferOffset);
-        return -1;
+                  (size_t)4, msg->bufferOffset);
+        goto cleanup;
     }
 
-    if (msg.bufferLength != 0x74) {
+    if (msg->bufferLength != 0x74) {
         VIR_DEBUG("Expecting length %zu got %zu",
-                  (size_t)0x74, msg.bufferLength);
-        return -1;
+                  (size_t)0x74, msg->bufferLength);
+        goto cleanup;
     }
 
-    if (virNetMessageDecodeHeader(&msg) < 0) {
+    if (virNetMessageDecodeHeader(msg) < 0) {
         VIR_DEBUG("Failed to decode message header");
-        return -1;
+        goto cleanup;
     }
 
-    if (msg.bufferOffset != 28) {
+    if (msg->bufferOffset != 28) {
         VIR_DEBUG("Expect message offset %zu got %zu",
-                  msg.bufferOffset, (size_t)28);
-        return -1;
+                  msg->bufferOffset, (size_t)28);
+        goto cleanup;
     }
 
-    if (msg.bufferLength != 0x74) {
+    if (msg->bufferLength != 0x74) {
         VIR_DEBUG("Expecting length %zu got %zu",
-                  (size_t)0x1c, msg.bufferLength);
-        return -1;
+                  (size_t)0x1c, msg->bufferLength);
+        goto cleanup;
     }
 
-    if (virNetMessageDecodePayload(&msg, (xdrproc_t)xdr_virNetMessageError, &err) < 0) {
+    if (virNetMessageDecodePayload(msg, (xdrproc_t)xdr_virNetMessageError, &err) < 0) {
         VIR_DEBUG("Failed to decode message payload");
-        return -1;
+        goto cleanup;
     }
 
     if (err.code != VIR_ERR_INTERNAL_ERROR) {
         VIR_DEBUG("Expect code %d got %d",
                   VIR_ERR_INTERNAL_ERROR, err.code);
-        return -1;
+        goto cleanup;
     }
 
     if (err.domain != VIR_FROM_RPC) {
         VIR_DEBUG("Expect domain %d got %d",
                   VIR_ERR_RPC, err.domain);
-        return -1;
+        goto cleanup;
     }
 
     if (err.message == NULL ||
         STRNEQ(*err.message, "Hello World")) {
         VIR_DEBUG("Expect str1 'Hello World' got %s",
                   err.message ? *err.message : "(null)");
-        return -1;
+        goto cleanup;
     }
 
     if (err.dom != NULL) {
         VIR_DEBUG("Expect NULL dom");
-        return -1;
+        goto cleanup;
     }
 
     if (err.level != VIR_ERR_ERROR) {
         VIR_DEBUG("Expect leve %d got %d",
                   VIR_ERR_ERROR, err.level);
-        return -1;
+        goto cleanup;
     }
 
     if (err.str1 == NULL ||
         STRNEQ(*err.str1, "One")) {
         VIR_DEBUG("Expect str1 'One' got %s",
                   err.str1 ? *err.str1 : "(null)");
-        return -1;
+        goto cleanup;
     }
 
     if (err.str2 == NULL ||
         STRNEQ(*err.str2, "Two")) {
         VIR_DEBUG("Expect str3 'Two' got %s",
                   err.str2 ? *err.str2 : "(null)");
-        return -1;
+        goto cleanup;
     }
 
     if (err.str3 == NULL ||
         STRNEQ(*err.str3, "Three")) {
         VIR_DEBUG("Expect str3 'Three' got %s",
                   err.str3 ? *err.str3 : "(null)");
-        return -1;
+        goto cleanup;
     }
 
     if (err.int1 != 1) {
         VIR_DEBUG("Expect int1 1 got %d",
                   err.int1);
-        return -1;
+        goto cleanup;
     }
 
     if (err.int2 != 2) {
         VIR_DEBUG("Expect int2 2 got %d",
                   err.int2);
-        return -1;
+        goto cleanup;
     }
 
     if (err.net != NULL) {
         VIR_DEBUG("Expect NULL network");
-        return -1;
+        goto cleanup;
     }
 
+    ret = 0;
+cleanup:
     xdr_free((xdrproc_t)xdr_virNetMessageError, (void*)&err);
-    return 0;
+    virNetMessageFree(msg);
+    return ret;
+}
+
+static int testMessagePayloadLarge(const void *args ATTRIBUTE_UNUSED)
+{
+    virNetMessageError err;
+    virNetMessageError got;
+    virNetMessagePtr msg = virNetMessageNew(true);
+    virNetMessagePtr rx = virNetMessageNew(true);
+    char *message = NULL;
+    int ret = -1;
+
+    memset(&err, 0, sizeof(err));
+    memset(&got, 0, sizeof(got));
+
+    if (!msg || !rx)
+        goto cleanup;
+
+    /* Too big for the initial buffer of either message */
+    if (VIR_ALLOC_N(message, 60 * 1024) < 0)
+        goto cleanup;
+    memset(message, 'x', 60 * 1024 - 1);
+
+    err.code = VIR_ERR_INTERNAL_ERROR;
+    err.domain = VIR_FROM_RPC;
+    err.level = VIR_ERR_ERROR;
+    err.message = &message;
+
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.proc = 0x666;
+    msg->header.type = VIR_NET_MESSAGE;
+    msg->header.serial = 0x99;
+    msg->header.status = VIR_NET_ERROR;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+
+    if (virNetMessageEncodePayload(msg, (xdrproc_t)xdr_virNetMessageError, &err) < 0)
+        goto cleanup;
+
+    if (msg->bufferLength <= 60 * 1024 ||
+        msg->bufferSize < msg->bufferLength) {
+        VIR_DEBUG("Unexpected message length %zu size %zu",
+                  msg->bufferLength, msg->bufferSize);
+        goto cleanup;
+    }
+
+    /* Feed the encoded message to another one the way it
+     * would be read off the wire */
+    rx->bufferLength = 4;
+    memcpy(rx->buffer, msg->buffer, 4);
+
+    if (virNetMessageDecodeLength(rx) < 0)
+        goto cleanup;
+
+    if (rx->bufferLength != msg->bufferLength) {
+        VIR_DEBUG("Expect length %zu got %zu",
+                  msg->bufferLength, rx->bufferLength);
+        goto cleanup;
+    }
+
+    memcpy(rx->buffer + 4, msg->buffer + 4, rx->bufferLength - 4);
+
+    if (virNetMessageDecodeHeader(rx) < 0)
+        goto cleanup;
+
+    if (virNetMessageDecodePayload(rx, (xdrproc_t)xdr_virNetMessageError, &got) < 0)
+        goto cleanup;
+
+    if (!got.message || STRNEQ(*got.message, message)) {
+        VIR_DEBUG("Message payload mismatch");
+        goto cleanup;
+    }
+
+    ret = 0;
+cleanup:
+    xdr_free((xdrproc_t)xdr_virNetMessageError, (void*)&got);
+    VIR_FREE(message);
+    virNetMessageFree(msg);
+    virNetMessageFree(rx);
+    return ret;
+}
+
+/* Stands for a reply too large for a single message */
+struct testMessageBlob {
+    u_int len;
+    char *data;
+};
+
+static bool_t
+testMessageBlobFilter(XDR *xdrs, struct testMessageBlob *blob)
+{
+    return xdr_bytes(xdrs, &blob->data, &blob->len,
+                     VIR_NET_MESSAGE_REPLY_MAX);
+}
+
+/* Copy @tx to @rx the way it would be read off the wire */
+static int testMessageReceive(virNetMessagePtr rx,
+                              virNetMessagePtr tx)
+{
+    virNetMessageClear(rx);
+
+    rx->bufferLength = 4;
+    memcpy(rx->buffer, tx->buffer, 4);
+
+    if (virNetMessageDecodeLength(rx) < 0)
+        return -1;
+
+    if (rx->bufferLength != tx->bufferLength) {
+        VIR_DEBUG("Expect length %zu got %zu",
+                  tx->bufferLength, rx->bufferLength);
+        return -1;
+    }
+
+    memcpy(rx->buffer + 4, tx->buffer + 4, rx->bufferLength - 4);
+
+    return virNetMessageDecodeHeader(rx);
+}
+
+static int testMessagePayloadChunks(const void *args ATTRIBUTE_UNUSED)
+{
+    struct testMessageBlob blob = { 1024 * 1024, NULL };
+    struct testMessageBlob got = { 0, NULL };
+    virNetMessagePtr msg = virNetMessageNew(true);
+    virNetMessagePtr rx = virNetMessageNew(true);
+    virNetMessagePtr reply = virNetMessageNew(true);
+    virNetMessagePtr chunks = NULL;
+    virNetMessagePtr chunk = NULL;
+    size_t nchunks = 0;
+    size_t i;
+    int ret = -1;
+
+    if (!msg || !rx || !reply)
+        goto cleanup;
+
+    if (VIR_ALLOC_N(blob.data, blob.len) < 0)
+        goto cleanup;
+    for (i = 0 ; i < blob.len ; i++)
+        blob.data[i] = i % 251;
+
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.proc = 0x666;
+    msg->header.type = VIR_NET_REPLY;
+    msg->header.serial = 0x99;
+    msg->header.status = VIR_NET_OK;
+
+    /* Without chunks, the reply can't be sent at all */
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+
+    if (virNetMessageEncodePayload(msg, (xdrproc_t)testMessageBlobFilter,
+                                   &blob) == 0) {
+        VIR_DEBUG("Expected encoding failure without chunks");
+        goto cleanup;
+    }
+
+    virNetMessageClear(msg);
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.proc = 0x666;
+    msg->header.type = VIR_NET_REPLY;
+    msg->header.serial = 0x99;
+    msg->header.status = VIR_NET_OK;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+
+    if (virNetMessageEncodePayloadChunks(msg, (xdrproc_t)testMessageBlobFilter,
+                                         &blob, &chunks) < 0)
+        goto cleanup;
+
+    while ((chunk = virNetMessageQueueServe(&chunks))) {
+        nchunks++;
+
+        if (testMessageReceive(rx, chunk) < 0)
+            goto cleanup;
+
+        if (rx->header.type != VIR_NET_REPLY_CHUNK ||
+            rx->header.status != VIR_NET_CONTINUE ||
+            rx->header.serial != msg->header.serial) {
+            VIR_DEBUG("Unexpected chunk header type %d status %d serial %d",
+                      rx->header.type, rx->header.status, rx->header.serial);
+            goto cleanup;
+        }
+
+        if (virNetMessageAppendPayload(reply, rx) < 0)
+            goto cleanup;
+
+        virNetMessageFree(chunk);
+    }
+
+    /* 1 MB and a bit doesn't fit in 4 messages */
+    if (nchunks != 4) {
+        VIR_DEBUG("Expected 4 chunks, got %zu", nchunks);
+        goto cleanup;
+    }
+
+    if (testMessageReceive(rx, msg) < 0 ||
+        virNetMessageAppendPayload(reply, rx) < 0)
+        goto cleanup;
+
+    if (reply->header.type != VIR_NET_REPLY ||
+        reply->header.status != VIR_NET_OK) {
+        VIR_DEBUG("Unexpected reply header type %d status %d",
+                  reply->header.type, reply->header.status);
+        goto cleanup;
+    }
+
+    if (virNetMessageDecodePayload(reply, (xdrproc_t)testMessageBlobFilter,
+                                   &got) < 0)
+        goto cleanup;
+
+    if (got.len != blob.len ||
+        memcmp(got.data, blob.data, blob.len) != 0) {
+        VIR_DEBUG("Reassembled payload mismatch");
+        goto cleanup;
+    }
+
+    ret = 0;
+cleanup:
+    xdr_free((xdrproc_t)testMessageBlobFilter, (void*)&got);
+    VIR_FREE(blob.data);
+    virNetMessageFree(chunk);
+    while ((chunk = virNetMessageQueueServe(&chunks)))
+        virNetMessageFree(chunk);
+    virNetMessageFree(msg);
+    virNetMessageFree(rx);
+    virNetMessageFree(reply);
+    return ret;
 }
 
 static int testMessagePayloadStreamEncode(const void *args ATTRIBUTE_UNUSED)
 {
     char stream[] = "The quick brown fox jumps over the lazy dog";
-    static virNetMessage msg;
+    virNetMessagePtr msg = virNetMessageNew(true);
+    int ret = -1;
     static const char expect[] = {
         0x00, 0x00, 0x00, 0x47,  /* Length */
         0x11, 0x22, 0x33, 0x44,  /* Program */
@@ -448,39 +703,120 @@ static int testMessagePayloadStreamEncode(const void *args ATTRIBUTE_UNUSED)
         'a', 'z', 'y', ' ',
         'd', 'o', 'g',
     };
-    memset(&msg, 0, sizeof(msg));
-
-    msg.header.prog = 0x11223344;
-    msg.header.vers = 0x01;
-    msg.header.proc = 0x666;
-    msg.header.type = VIR_NET_STREAM;
-    msg.header.serial = 0x99;
-    msg.header.status = VIR_NET_CONTINUE;
 
-    if (virNetMessageEncodeHeader(&msg) < 0)
+    if (!msg)
         return -1;
 
-    if (virNetMessageEncodePayloadRaw(&msg, stream, strlen(stream)) < 0)
-        return -1;
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.proc = 0x666;
+    msg->header.type = VIR_NET_STREAM;
+    msg->header.serial = 0x99;
+    msg->header.status = VIR_NET_CONTINUE;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
 
-    if (ARRAY_CARDINALITY(expect) != msg.bufferLength) {
+    if (virNetMessageEncodePayloadRaw(msg, stream, strlen(stream)) < 0)
+        goto cleanup;
+
+    if (ARRAY_CARDINALITY(expect) != msg->bufferLength) {
         VIR_DEBUG("Expect message length %zu got %zu",
-                  sizeof(expect), msg.bufferLength);
-        return -1;
+                  sizeof(expect), msg->bufferLength);
+        goto cleanup;
     }
 
-    if (msg.bufferOffset != 0) {
+    if (msg->bufferOffset != 0) {
         VIR_DEBUG("Expect message offset 0 got %zu",
-                  msg.bufferOffset);
-        return -1;
+                  msg->bufferOffset);
+        goto cleanup;
     }
 
-    if (memcmp(expect, msg.buffer, sizeof(expect)) != 0) {
-        virtTestDifferenceBin(stderr, expect, msg.buffer, sizeof(expect));
-        return -1;
+    if (memcmp(expect, msg->buffer, sizeof(expect)) != 0) {
+        virtTestDifferenceBin(stderr, expect, msg->buffer, sizeof(expect));
+        goto cleanup;
     }
 
-    return 0;
+    ret = 0;
+cleanup:
+    virNetMessageFree(msg);
+    return ret;
+}
+
+static int testMessagePayloadStreamHole(const void *args ATTRIBUTE_UNUSED)
+{
+    virNetStreamHole hole = { 0x123456789aULL };
+    virNetStreamHole got = { 0 };
+    virNetMessagePtr msg = virNetMessageNew(true);
+    virNetMessagePtr rx = virNetMessageNew(true);
+    int ret = -1;
+    static const char expect[] = {
+        0x00, 0x00, 0x00, 0x24,  /* Length */
+        0x11, 0x22, 0x33, 0x44,  /* Program */
+        0x00, 0x00, 0x00, 0x01,  /* Version */
+        0x00, 0x00, 0x06, 0x66,  /* Procedure */
+        0x00, 0x00, 0x00, 0x07,  /* Type */
+        0x00, 0x00, 0x00, 0x99,  /* Serial */
+        0x00, 0x00, 0x00, 0x02,  /* Status */
+
+        0x00, 0x00, 0x00, 0x12,  /* Hole length */
+        0x34, 0x56, 0x78, 0x9a,
+    };
+
+    if (!msg || !rx)
+        goto cleanup;
+
+    msg->header.prog = 0x11223344;
+    msg->header.vers = 0x01;
+    msg->header.proc = 0x666;
+    msg->header.type = VIR_NET_STREAM_HOLE;
+    msg->header.serial = 0x99;
+    msg->header.status = VIR_NET_CONTINUE;
+
+    if (virNetMessageEncodeHeader(msg) < 0)
+        goto cleanup;
+
+    if (virNetMessageEncodePayload(msg, (xdrproc_t)xdr_virNetStreamHole,
+                                   &hole) < 0)
+        goto cleanup;
+
+    if (ARRAY_CARDINALITY(expect) != msg->bufferLength) {
+        VIR_DEBUG("Expect message length %zu got %zu",
+                  sizeof(expect), msg->bufferLength);
+        goto cleanup;
+    }
+
+    if (memcmp(expect, msg->buffer, sizeof(expect)) != 0) {
+        virtTestDifferenceBin(stderr, expect, msg->buffer, sizeof(expect));
+        goto cleanup;
+    }
+
+    if (testMessageReceive(rx, msg) < 0)
+        goto cleanup;
+
+    if (rx->header.type != VIR_NET_STREAM_HOLE ||
+        rx->header.status != VIR_NET_CONTINUE) {
+        VIR_DEBUG("Unexpected hole header type %d status %d",
+                  rx->header.type, rx->header.status);
+        goto cleanup;
+    }
+
+    if (virNetMessageDecodePayload(rx, (xdrproc_t)xdr_virNetStreamHole,
+                                   &got) < 0)
+        goto cleanup;
+
+    if (got.length != hole.length) {
+        VIR_DEBUG("Expect hole length %llu got %llu",
+                  (unsigned long long)hole.length,
+                  (unsigned long long)got.length);
+        goto cleanup;
+    }
+
+    ret = 0;
+cleanup:
+    virNetMessageFree(msg);
+    virNetMessageFree(rx);
+    return ret;
 }
 
 
@@ -506,6 +842,15 @@ mymain(void)
     if (virtTestRun("Message Payload Stream Encode", 1, testMessagePayloadStreamEncode, NULL) < 0)
         ret = -1;
 
+    if (virtTestRun("Message Payload Stream Hole", 1, testMessagePayloadStreamHole, NULL) < 0)
+        ret = -1;
+
+    if (virtTestRun("Message Payload Large", 1, testMessagePayloadLarge, NULL) < 0)
+        ret = -1;
+
+    if (virtTestRun("Message Payload Chunks", 1, testMessagePayloadChunks, NULL) < 0)
+        ret = -1;
+
     return ret==0 ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
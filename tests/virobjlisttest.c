@@ -0,0 +1,675 @@
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "internal.h"
+#include "testutils.h"
+#include "network_conf.h"
+#include "storage_conf.h"
+#include "node_device_conf.h"
+#include "nwfilter_params.h"
+#include "nwfilter_conf.h"
+#include "memory.h"
+#include "util.h"
+#include "virtime.h"
+
+
+/* Objects are named and keyed after their number, every fourth one of
+ * them is removed half way through each test */
+#define REMOVED(i) ((i) % 4 == 0)
+
+static void
+testFillUUID(unsigned char *uuid, int i)
+{
+    memset(uuid, 0, VIR_UUID_BUFLEN);
+    uuid[0] = i & 0xff;
+    uuid[1] = (i >> 8) & 0xff;
+    uuid[2] = (i >> 16) & 0xff;
+}
+
+/* The lookup of object @i of a list gave @found instead of @expect */
+static int
+testCheckFound(const char *what, const char *by, int i,
+               const void *found, const void *expect)
+{
+    if (found == expect)
+        return 0;
+
+    if (virTestGetVerbose())
+        testError("\nunexpected lookup of %s %d by %s", what, i, by);
+    return -1;
+}
+
+/* The names of the objects left in a list must still be listed in the
+ * order the objects were added */
+static int
+testCheckOrder(const char *what, const char *fmt,
+               const char *name, int j, int *i)
+{
+    char *expect = NULL;
+    int ret = -1;
+
+    while (REMOVED(*i))
+        (*i)++;
+
+    if (virAsprintf(&expect, fmt, *i) < 0)
+        return -1;
+
+    if (STRNEQ(name, expect)) {
+        if (virTestGetVerbose())
+            testError("\n%s %s listed at %d, expected %s",
+                      what, name, j, expect);
+        goto cleanup;
+    }
+    (*i)++;
+    ret = 0;
+
+cleanup:
+    VIR_FREE(expect);
+    return ret;
+}
+
+static void
+testReportTime(int count, unsigned long long start)
+{
+    unsigned long long now;
+
+    if (virTestGetDebug() && virTimeMillisNow(&now) == 0)
+        fprintf(stderr, "\n%d objects looked up in %llums\n%74s",
+                count, now - start, "... ");
+}
+
+
+static int
+testNetworkCheck(virNetworkObjListPtr nets, virNetworkObjPtr *all, int i)
+{
+    virNetworkObjPtr expect = REMOVED(i) ? NULL : all[i];
+    virNetworkObjPtr net;
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    char name[32];
+
+    snprintf(name, sizeof(name), "net%d", i);
+    testFillUUID(uuid, i);
+
+    if ((net = virNetworkFindByName(nets, name)))
+        virNetworkObjUnlock(net);
+    if (testCheckFound("network", "name", i, net, expect) < 0)
+        return -1;
+
+    if ((net = virNetworkFindByUUID(nets, uuid)))
+        virNetworkObjUnlock(net);
+    if (testCheckFound("network", "UUID", i, net, expect) < 0)
+        return -1;
+
+    return 0;
+}
+
+static int
+testNetworks(const void *data)
+{
+    int count = *(const int *)data;
+    virNetworkObjList nets;
+    virNetworkObjPtr *all = NULL;
+    virNetworkDefPtr def = NULL;
+    unsigned long long start;
+    int ret = -1;
+    int i, j;
+
+    memset(&nets, 0, sizeof(nets));
+    if (VIR_ALLOC_N(all, count) < 0)
+        goto cleanup;
+
+    for (i = 0; i < count; i++) {
+        if (VIR_ALLOC(def) < 0 ||
+            virAsprintf(&def->name, "net%d", i) < 0)
+            goto cleanup;
+        testFillUUID(def->uuid, i);
+
+        if (!(all[i] = virNetworkAssignDef(&nets, def)))
+            goto cleanup;
+        def = NULL;
+        virNetworkObjUnlock(all[i]);
+    }
+
+    for (i = 0; i < count; i += 4) {
+        virNetworkObjLock(all[i]);
+        virNetworkRemoveInactive(&nets, all[i]);
+    }
+
+    if (virTimeMillisNow(&start) < 0)
+        goto cleanup;
+    for (i = 0; i < count; i++) {
+        if (testNetworkCheck(&nets, all, i) < 0)
+            goto cleanup;
+    }
+    testReportTime(count, start);
+
+    for (i = 0, j = 0; j < nets.count; j++) {
+        if (testCheckOrder("network", "net%d",
+                           nets.objs[j]->def->name, j, &i) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virNetworkDefFree(def);
+    virNetworkObjListFree(&nets);
+    VIR_FREE(all);
+    return ret;
+}
+
+
+static int
+testPoolCheck(virStoragePoolObjListPtr pools,
+              virStoragePoolObjPtr *all, int i)
+{
+    virStoragePoolObjPtr expect = REMOVED(i) ? NULL : all[i];
+    virStoragePoolObjPtr pool;
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    char name[32];
+
+    snprintf(name, sizeof(name), "pool%d", i);
+    testFillUUID(uuid, i);
+
+    if ((pool = virStoragePoolObjFindByName(pools, name)))
+        virStoragePoolObjUnlock(pool);
+    if (testCheckFound("pool", "name", i, pool, expect) < 0)
+        return -1;
+
+    if ((pool = virStoragePoolObjFindByUUID(pools, uuid)))
+        virStoragePoolObjUnlock(pool);
+    if (testCheckFound("pool", "UUID", i, pool, expect) < 0)
+        return -1;
+
+    return 0;
+}
+
+static int
+testPools(const void *data)
+{
+    int count = *(const int *)data;
+    virStoragePoolObjList pools;
+    virStoragePoolObjPtr *all = NULL;
+    virStoragePoolDefPtr def = NULL;
+    unsigned long long start;
+    int ret = -1;
+    int i, j;
+
+    memset(&pools, 0, sizeof(pools));
+    if (VIR_ALLOC_N(all, count) < 0)
+        goto cleanup;
+
+    for (i = 0; i < count; i++) {
+        if (VIR_ALLOC(def) < 0 ||
+            virAsprintf(&def->name, "pool%d", i) < 0)
+            goto cleanup;
+        testFillUUID(def->uuid, i);
+
+        if (!(all[i] = virStoragePoolObjAssignDef(&pools, def)))
+            goto cleanup;
+        def = NULL;
+        virStoragePoolObjUnlock(all[i]);
+    }
+
+    for (i = 0; i < count; i += 4) {
+        virStoragePoolObjLock(all[i]);
+        virStoragePoolObjRemove(&pools, all[i]);
+    }
+
+    if (virTimeMillisNow(&start) < 0)
+        goto cleanup;
+    for (i = 0; i < count; i++) {
+        if (testPoolCheck(&pools, all, i) < 0)
+            goto cleanup;
+    }
+    testReportTime(count, start);
+
+    for (i = 0, j = 0; j < pools.count; j++) {
+        if (testCheckOrder("pool", "pool%d",
+                           pools.objs[j]->def->name, j, &i) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virStoragePoolDefFree(def);
+    virStoragePoolObjListFree(&pools);
+    VIR_FREE(all);
+    return ret;
+}
+
+
+static virStorageVolDefPtr
+testVolNew(const char *name, const char *key, const char *path)
+{
+    virStorageVolDefPtr vol;
+
+    if (VIR_ALLOC(vol) < 0)
+        return NULL;
+
+    if (!(vol->name = strdup(name)) ||
+        !(vol->key = strdup(key)) ||
+        !(vol->target.path = strdup(path))) {
+        virStorageVolDefFree(vol);
+        return NULL;
+    }
+
+    return vol;
+}
+
+static int
+testVolCheck(virStoragePoolObjPtr pool, virStorageVolDefPtr *all, int i)
+{
+    virStorageVolDefPtr expect = REMOVED(i) ? NULL : all[i];
+    char name[32], key[32], path[32];
+
+    snprintf(name, sizeof(name), "vol%d", i);
+    snprintf(key, sizeof(key), "key%d", i);
+    snprintf(path, sizeof(path), "/pool/vol%d", i);
+
+    if (testCheckFound("volume", "name", i,
+                       virStorageVolDefFindByName(pool, name), expect) < 0 ||
+        testCheckFound("volume", "key", i,
+                       virStorageVolDefFindByKey(pool, key), expect) < 0 ||
+        testCheckFound("volume", "path", i,
+                       virStorageVolDefFindByPath(pool, path), expect) < 0)
+        return -1;
+
+    return 0;
+}
+
+static int
+testVolumes(const void *data)
+{
+    int count = *(const int *)data;
+    virStoragePoolObjPtr pool = NULL;
+    virStorageVolDefPtr *all = NULL;
+    unsigned long long start;
+    int ret = -1;
+    int i, j;
+
+    if (VIR_ALLOC(pool) < 0 ||
+        VIR_ALLOC_N(all, count) < 0)
+        goto cleanup;
+
+    for (i = 0; i < count; i++) {
+        char name[32], key[32], path[32];
+
+        snprintf(name, sizeof(name), "vol%d", i);
+        snprintf(key, sizeof(key), "key%d", i);
+        snprintf(path, sizeof(path), "/pool/vol%d", i);
+
+        if (!(all[i] = testVolNew(name, key, path)))
+            goto cleanup;
+        if (virStoragePoolObjAddVol(pool, all[i]) < 0) {
+            virStorageVolDefFree(all[i]);
+            goto cleanup;
+        }
+    }
+
+    for (i = 0; i < count; i += 4) {
+        virStoragePoolObjRemoveVol(pool, all[i]);
+        virStorageVolDefFree(all[i]);
+    }
+
+    if (virTimeMillisNow(&start) < 0)
+        goto cleanup;
+    for (i = 0; i < count; i++) {
+        if (testVolCheck(pool, all, i) < 0)
+            goto cleanup;
+    }
+    testReportTime(count, start);
+
+    for (i = 0, j = 0; j < pool->volumes.count; j++) {
+        if (testCheckOrder("volume", "vol%d",
+                           pool->volumes.objs[j]->name, j, &i) < 0)
+            goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    if (pool)
+        virStoragePoolObjClearVols(pool);
+    VIR_FREE(pool);
+    VIR_FREE(all);
+    return ret;
+}
+
+static int
+testVolumesShared(const void *data ATTRIBUTE_UNUSED)
+{
+    virStoragePoolObjPtr pool = NULL;
+    virStorageVolDefPtr first = NULL;
+    virStorageVolDefPtr second = NULL;
+    int ret = -1;
+
+    if (VIR_ALLOC(pool) < 0)
+        goto cleanup;
+
+    /* Volumes of some backends may share their key or path, such as
+     * disks seen through several paths */
+    if (!(first = testVolNew("first", "key", "/dev/sda")) ||
+        virStoragePoolObjAddVol(pool, first) < 0)
+        goto cleanup;
+    if (!(second = testVolNew("second", "key", "/dev/sda")) ||
+        virStoragePoolObjAddVol(pool, second) < 0) {
+        virStorageVolDefFree(second);
+        goto cleanup;
+    }
+
+    /* Just like the linear search did, the first one is found */
+    if (virStorageVolDefFindByKey(pool, "key") != first ||
+        virStorageVolDefFindByPath(pool, "/dev/sda") != first) {
+        if (virTestGetVerbose())
+            testError("\nshared key or path doesn't find first volume");
+        goto cleanup;
+    }
+
+    virStoragePoolObjRemoveVol(pool, first);
+    virStorageVolDefFree(first);
+    first = NULL;
+
+    if (virStorageVolDefFindByKey(pool, "key") != second ||
+        virStorageVolDefFindByPath(pool, "/dev/sda") != second ||
+        virStorageVolDefFindByName(pool, "first")) {
+        if (virTestGetVerbose())
+            testError("\nshared key or path lost with first volume");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    if (pool)
+        virStoragePoolObjClearVols(pool);
+    VIR_FREE(pool);
+    return ret;
+}
+
+
+static int
+testNodeDeviceCheck(virNodeDeviceObjListPtr devs,
+                    virNodeDeviceObjPtr *all, int i)
+{
+    virNodeDeviceObjPtr expect = REMOVED(i) ? NULL : all[i];
+    virNodeDeviceObjPtr dev;
+    char name[32], path[64];
+
+    snprintf(name, sizeof(name), "dev%d", i);
+    snprintf(path, sizeof(path), "/sys/devices/dev%d", i);
+
+    if ((dev = virNodeDeviceFindByName(devs, name)))
+        virNodeDeviceObjUnlock(dev);
+    if (testCheckFound("node device", "name", i, dev, expect) < 0)
+        return -1;
+
+    if ((dev = virNodeDeviceFindBySysfsPath(devs, path)))
+        virNodeDeviceObjUnlock(dev);
+    if (testCheckFound("node device", "sysfs path", i, dev, expect) < 0)
+        return -1;
+
+    return 0;
+}
+
+static virNodeDeviceDefPtr
+testNodeDeviceDefNew(const char *name, const char *path)
+{
+    virNodeDeviceDefPtr def;
+
+    if (VIR_ALLOC(def) < 0)
+        return NULL;
+
+    if (!(def->name = strdup(name)) ||
+        !(def->sysfs_path = strdup(path))) {
+        virNodeDeviceDefFree(def);
+        return NULL;
+    }
+
+    return def;
+}
+
+static int
+testNodeDevices(const void *data)
+{
+    int count = *(const int *)data;
+    virNodeDeviceObjList devs;
+    virNodeDeviceObjPtr *all = NULL;
+    virNodeDeviceDefPtr def = NULL;
+    virNodeDeviceObjPtr dev;
+    unsigned long long start;
+    int ret = -1;
+    int i, j;
+
+    memset(&devs, 0, sizeof(devs));
+    if (VIR_ALLOC_N(all, count) < 0)
+        goto cleanup;
+
+    for (i = 0; i < count; i++) {
+        char name[32], path[64];
+
+        snprintf(name, sizeof(name), "dev%d", i);
+        snprintf(path, sizeof(path), "/sys/devices/dev%d", i);
+
+        if (!(def = testNodeDeviceDefNew(name, path)) ||
+            !(all[i] = virNodeDeviceAssignDef(&devs, def)))
+            goto cleanup;
+        def = NULL;
+        virNodeDeviceObjUnlock(all[i]);
+    }
+
+    for (i = 0; i < count; i += 4) {
+        virNodeDeviceObjLock(all[i]);
+        virNodeDeviceObjRemove(&devs, all[i]);
+    }
+
+    if (virTimeMillisNow(&start) < 0)
+        goto cleanup;
+    for (i = 0; i < count; i++) {
+        if (testNodeDeviceCheck(&devs, all, i) < 0)
+            goto cleanup;
+    }
+    testReportTime(count, start);
+
+    for (i = 0, j = 0; j < devs.count; j++) {
+        if (testCheckOrder("node device", "dev%d",
+                           devs.objs[j]->def->name, j, &i) < 0)
+            goto cleanup;
+    }
+
+    /* A device showing up again may have moved in sysfs */
+    if (!(def = testNodeDeviceDefNew("dev1", "/sys/devices/moved")) ||
+        !(dev = virNodeDeviceAssignDef(&devs, def)))
+        goto cleanup;
+    def = NULL;
+    virNodeDeviceObjUnlock(dev);
+
+    if ((dev = virNodeDeviceFindBySysfsPath(&devs, "/sys/devices/dev1"))) {
+        virNodeDeviceObjUnlock(dev);
+        if (virTestGetVerbose())
+            testError("\nnode device found by its old sysfs path");
+        goto cleanup;
+    }
+    if (!(dev = virNodeDeviceFindBySysfsPath(&devs, "/sys/devices/moved")) ||
+        dev != all[1]) {
+        if (dev)
+            virNodeDeviceObjUnlock(dev);
+        if (virTestGetVerbose())
+            testError("\nnode device not found by its new sysfs path");
+        goto cleanup;
+    }
+    virNodeDeviceObjUnlock(dev);
+
+    ret = 0;
+
+cleanup:
+    virNodeDeviceDefFree(def);
+    virNodeDeviceObjListFree(&devs);
+    VIR_FREE(all);
+    return ret;
+}
+
+
+static virNWFilterDefPtr
+testNWFilterDefNew(int i, int uuid)
+{
+    virNWFilterDefPtr def;
+
+    if (VIR_ALLOC(def) < 0)
+        return NULL;
+
+    if (virAsprintf(&def->name, "filter%d", i) < 0 ||
+        !(def->chainsuffix = strdup("root"))) {
+        virNWFilterDefFree(def);
+        return NULL;
+    }
+    testFillUUID(def->uuid, uuid);
+
+    return def;
+}
+
+static int
+testNWFilterCheck(virNWFilterObjListPtr nwfilters,
+                  virNWFilterObjPtr *all, int i)
+{
+    virNWFilterObjPtr expect = REMOVED(i) ? NULL : all[i];
+    virNWFilterObjPtr nwfilter;
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    char name[32];
+
+    snprintf(name, sizeof(name), "filter%d", i);
+    testFillUUID(uuid, i);
+
+    if ((nwfilter = virNWFilterObjFindByName(nwfilters, name)))
+        virNWFilterObjUnlock(nwfilter);
+    if (testCheckFound("filter", "name", i, nwfilter, expect) < 0)
+        return -1;
+
+    if ((nwfilter = virNWFilterObjFindByUUID(nwfilters, uuid)))
+        virNWFilterObjUnlock(nwfilter);
+    if (testCheckFound("filter", "UUID", i, nwfilter, expect) < 0)
+        return -1;
+
+    return 0;
+}
+
+static int
+testNWFilters(const void *data)
+{
+    int count = *(const int *)data;
+    virNWFilterObjList nwfilters;
+    virNWFilterObjPtr *all = NULL;
+    virNWFilterDefPtr def = NULL;
+    virNWFilterObjPtr nwfilter;
+    unsigned char uuid[VIR_UUID_BUFLEN];
+    unsigned long long start;
+    int ret = -1;
+    int i, j;
+
+    memset(&nwfilters, 0, sizeof(nwfilters));
+    if (VIR_ALLOC_N(all, count) < 0)
+        goto cleanup;
+
+    for (i = 0; i < count; i++) {
+        if (!(def = testNWFilterDefNew(i, i)) ||
+            !(all[i] = virNWFilterObjAssignDef(NULL, &nwfilters, def)))
+            goto cleanup;
+        def = NULL;
+        virNWFilterObjUnlock(all[i]);
+    }
+
+    for (i = 0; i < count; i += 4) {
+        virNWFilterObjLock(all[i]);
+        virNWFilterObjRemove(&nwfilters, all[i]);
+    }
+
+    if (virTimeMillisNow(&start) < 0)
+        goto cleanup;
+    for (i = 0; i < count; i++) {
+        if (testNWFilterCheck(&nwfilters, all, i) < 0)
+            goto cleanup;
+    }
+    testReportTime(count, start);
+
+    for (i = 0, j = 0; j < nwfilters.count; j++) {
+        if (testCheckOrder("filter", "filter%d",
+                           nwfilters.objs[j]->def->name, j, &i) < 0)
+            goto cleanup;
+    }
+
+    /* Unlike with other objects, redefining a filter may change its UUID */
+    if (!(def = testNWFilterDefNew(1, count + 1)) ||
+        !(nwfilter = virNWFilterObjAssignDef(NULL, &nwfilters, def)))
+        goto cleanup;
+    def = NULL;
+    virNWFilterObjUnlock(nwfilter);
+
+    testFillUUID(uuid, 1);
+    if ((nwfilter = virNWFilterObjFindByUUID(&nwfilters, uuid))) {
+        virNWFilterObjUnlock(nwfilter);
+        if (virTestGetVerbose())
+            testError("\nfilter found by its old UUID");
+        goto cleanup;
+    }
+    testFillUUID(uuid, count + 1);
+    if (!(nwfilter = virNWFilterObjFindByUUID(&nwfilters, uuid)) ||
+        nwfilter != all[1]) {
+        if (nwfilter)
+            virNWFilterObjUnlock(nwfilter);
+        if (virTestGetVerbose())
+            testError("\nfilter not found by its new UUID");
+        goto cleanup;
+    }
+    virNWFilterObjUnlock(nwfilter);
+
+    ret = 0;
+
+cleanup:
+    virNWFilterDefFree(def);
+    virNWFilterObjListFree(&nwfilters);
+    VIR_FREE(all);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+    if (virNWFilterConfLayerInit(NULL) < 0)
+        return EXIT_FAILURE;
+
+#define DO_TEST_COUNT(name, cmd, count)                             \
+    do {                                                            \
+        int n = count;                                              \
+        if (virtTestRun(name "(" #count ")", 1,                     \
+                        test ## cmd, &n) < 0)                       \
+            ret = -1;                                               \
+    } while (0)
+
+    /* With --debug, reports how long the lookups took */
+    DO_TEST_COUNT("Networks", Networks, 10);
+    DO_TEST_COUNT("Networks", Networks, 5000);
+    DO_TEST_COUNT("Pools", Pools, 10);
+    DO_TEST_COUNT("Pools", Pools, 5000);
+    DO_TEST_COUNT("Volumes", Volumes, 10);
+    DO_TEST_COUNT("Volumes", Volumes, 20000);
+    DO_TEST_COUNT("Node devices", NodeDevices, 10);
+    DO_TEST_COUNT("Node devices", NodeDevices, 5000);
+    DO_TEST_COUNT("Filters", NWFilters, 10);
+    DO_TEST_COUNT("Filters", NWFilters, 5000);
+    if (virtTestRun("Volumes with shared key", 1,
+                    testVolumesShared, NULL) < 0)
+        ret = -1;
+
+    virNWFilterConfLayerShutdown();
+
+    return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
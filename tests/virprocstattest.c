@@ -0,0 +1,330 @@
+#include <config.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "internal.h"
+#include "testutils.h"
+#include "memory.h"
+#include "util.h"
+#include "virfile.h"
+#include "virprocstat.h"
+#include "virtime.h"
+
+
+#define BENCH_ITERATIONS 2000
+
+struct testParseData {
+    const char *line;
+    bool fail;
+    unsigned long long utime;
+    unsigned long long stime;
+    long rss;
+    int processor;
+};
+
+static int
+testProcStatParse(const void *opaque)
+{
+    const struct testParseData *data = opaque;
+    virProcStat info;
+    int rc;
+
+    memset(&info, 0, sizeof(info));
+    rc = virProcStatParse(data->line, &info);
+
+    if (data->fail) {
+        if (rc == 0) {
+            if (virTestGetVerbose())
+                testError("\nparsing should have failed");
+            return -1;
+        }
+        return 0;
+    }
+
+    if (rc < 0) {
+        if (virTestGetVerbose())
+            testError("\nparsing failed");
+        return -1;
+    }
+
+    if (info.utime != data->utime ||
+        info.stime != data->stime ||
+        info.rss != data->rss ||
+        info.processor != data->processor) {
+        if (virTestGetVerbose())
+            testError("\nexpected utime=%llu stime=%llu rss=%ld cpu=%d, "
+                      "got utime=%llu stime=%llu rss=%ld cpu=%d",
+                      data->utime, data->stime, data->rss, data->processor,
+                      info.utime, info.stime, info.rss, info.processor);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int
+testProcStatParseFields(const void *data ATTRIBUTE_UNUSED)
+{
+    const char *line = "cpu  4705 356 584 3699 23 23 0 0 0 0\n";
+    unsigned long long values[7];
+    const char *end;
+    int n;
+
+    n = virProcStatParseFields(line + strlen("cpu"), &end,
+                               values, ARRAY_CARDINALITY(values));
+    if (n != 7 || values[0] != 4705 || values[3] != 3699 ||
+        values[5] != 23 || STRNEQ(end, " 0 0 0\n")) {
+        if (virTestGetVerbose())
+            testError("\nunexpected result parsing '%s'", line);
+        return -1;
+    }
+
+    n = virProcStatParseFields(" 12 -3 4", NULL,
+                               values, ARRAY_CARDINALITY(values));
+    if (n != 1 || values[0] != 12) {
+        if (virTestGetVerbose())
+            testError("\nnegative values should stop parsing");
+        return -1;
+    }
+
+    return 0;
+}
+
+
+/* The way the QEMU driver used to read process statistics */
+static int
+testProcStatReadScanf(pid_t pid, virProcStatPtr info)
+{
+    char *proc;
+    FILE *pidinfo;
+    int ret = -1;
+
+    if (virAsprintf(&proc, "/proc/%d/stat", (int) pid) < 0)
+        return -1;
+
+    if (!(pidinfo = fopen(proc, "r"))) {
+        VIR_FREE(proc);
+        return -1;
+    }
+    VIR_FREE(proc);
+
+    if (fscanf(pidinfo,
+               /* pid -> stime */
+               "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu"
+               /* cutime -> endcode */
+               "%*d %*d %*d %*d %*d %*d %*u %*u %ld %*u %*u %*u"
+               /* startstack -> processor */
+               "%*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*d %d",
+               &info->utime, &info->stime, &info->rss,
+               &info->processor) == 4)
+        ret = 0;
+
+    VIR_FORCE_FCLOSE(pidinfo);
+    return ret;
+}
+
+static int
+testProcStatSelf(const void *data ATTRIBUTE_UNUSED)
+{
+    virProcStat info;
+    int fd = -1;
+    int ret = -1;
+
+    if (virProcStatRead(getpid(), 0, &info) < 0) {
+        if (virTestGetVerbose())
+            testError("\ncannot read own statistics");
+        goto cleanup;
+    }
+
+    if (info.rss <= 0 || info.processor < 0) {
+        if (virTestGetVerbose())
+            testError("\nimplausible rss=%ld cpu=%d",
+                      info.rss, info.processor);
+        goto cleanup;
+    }
+
+    if (virProcStatReadCached(&fd, getpid(), getpid(), &info) < 0 ||
+        fd < 0 ||
+        virProcStatReadCached(&fd, getpid(), getpid(), &info) < 0) {
+        if (virTestGetVerbose())
+            testError("\ncannot re-read own thread statistics");
+        goto cleanup;
+    }
+
+    if (virProcStatRead(getpid(), getpid() + 1000000, &info) == 0 ||
+        errno != ENOENT) {
+        if (virTestGetVerbose())
+            testError("\nreading a missing thread should fail with ENOENT");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virProcStatClose(&fd);
+    return ret;
+}
+
+/* A stat file kept open stays bound to its process, and is closed
+ * once the process is gone */
+static int
+testProcStatGone(const void *data ATTRIBUTE_UNUSED)
+{
+    virProcStat info;
+    pid_t pid;
+    int fd = -1;
+    int ret = -1;
+
+    if ((pid = fork()) < 0)
+        return -1;
+    if (pid == 0) {
+        pause();
+        _exit(0);
+    }
+
+    if (virProcStatReadCached(&fd, pid, 0, &info) < 0 || fd < 0) {
+        if (virTestGetVerbose())
+            testError("\ncannot keep child statistics open");
+        goto cleanup;
+    }
+
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    pid = -1;
+
+    /* Not even our own pid makes the descriptor read another process */
+    if (virProcStatReadCached(&fd, getpid(), 0, &info) == 0 ||
+        errno != ESRCH || fd != -1) {
+        if (virTestGetVerbose())
+            testError("\nstatistics of a reaped child should fail with ESRCH");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    if (pid > 0) {
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+    }
+    virProcStatClose(&fd);
+    return ret;
+}
+
+static int
+testProcStatBench(const void *data ATTRIBUTE_UNUSED)
+{
+    virProcStat info;
+    unsigned long long start, scanf_ms, read_ms, readfd_ms;
+    int fd = -1;
+    int ret = -1;
+    int i;
+
+    if (virTimeMillisNow(&start) < 0)
+        goto cleanup;
+    for (i = 0; i < BENCH_ITERATIONS; i++) {
+        if (testProcStatReadScanf(getpid(), &info) < 0)
+            goto cleanup;
+    }
+    if (virTimeMillisNow(&scanf_ms) < 0)
+        goto cleanup;
+    scanf_ms -= start;
+
+    if (virTimeMillisNow(&start) < 0)
+        goto cleanup;
+    for (i = 0; i < BENCH_ITERATIONS; i++) {
+        if (virProcStatRead(getpid(), 0, &info) < 0)
+            goto cleanup;
+    }
+    if (virTimeMillisNow(&read_ms) < 0)
+        goto cleanup;
+    read_ms -= start;
+
+    if (virTimeMillisNow(&start) < 0)
+        goto cleanup;
+    for (i = 0; i < BENCH_ITERATIONS; i++) {
+        if (virProcStatReadCached(&fd, getpid(), 0, &info) < 0)
+            goto cleanup;
+    }
+    if (virTimeMillisNow(&readfd_ms) < 0)
+        goto cleanup;
+    readfd_ms -= start;
+
+    if (virTestGetDebug())
+        fprintf(stderr,
+                "\n%d samples: fscanf %llums, virProcStatRead %llums, "
+                "virProcStatReadCached %llums\n%74s",
+                BENCH_ITERATIONS, scanf_ms, read_ms, readfd_ms, "... ");
+
+    ret = 0;
+
+cleanup:
+    virProcStatClose(&fd);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+#define DO_TEST_PARSE(name, line, fail, utime, stime, rss, cpu)         \
+    do {                                                                \
+        struct testParseData data = {                                   \
+            line, fail, utime, stime, rss, cpu                          \
+        };                                                              \
+        if (virtTestRun("Parse " name, 1,                               \
+                        testProcStatParse, &data) < 0)                  \
+            ret = -1;                                                   \
+    } while (0)
+
+#define STAT_TAIL                                                       \
+    " 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0"
+
+    DO_TEST_PARSE("qemu",
+                  "2187 (qemu-kvm) S 1 2186 2186 0 -1 4202816 163431 0 40 0 "
+                  "8467 3911 0 0 20 0 3 0 6120 1210634240 131623 "
+                  "18446744073709551615 1 1 0 0 0 0 2147221247 4096 25155 "
+                  "18446744073709551615 0 0 17 3 0 0 0 0 0\n",
+                  false, 8467, 3911, 131623, 3);
+    DO_TEST_PARSE("blanks in name",
+                  "42 (a b) c) R 1 42 42 0 -1 0 0 0 0 0 "
+                  "10 20 0 0 20 0 1 0 100 4096 7 "
+                  "0 0 0 0 0 0 0 0 0 0 0 0 0 17 1 0 0 0 0 0",
+                  false, 10, 20, 7, 1);
+    DO_TEST_PARSE("truncated",
+                  "42 (init) S 1 42 42 0 -1 0 0 0 0 0 10 20",
+                  true, 0, 0, 0, 0);
+    DO_TEST_PARSE("no name", "42 S" STAT_TAIL, true, 0, 0, 0, 0);
+    DO_TEST_PARSE("garbage",
+                  "42 (init) S 1 42 42 0 -1 0 0 0 0 0 ten" STAT_TAIL,
+                  true, 0, 0, 0, 0);
+    DO_TEST_PARSE("overflow",
+                  "42 (init) S 1 42 42 0 -1 0 0 0 0 0 "
+                  "18446744073709551616" STAT_TAIL,
+                  true, 0, 0, 0, 0);
+    DO_TEST_PARSE("empty", "", true, 0, 0, 0, 0);
+
+    if (virtTestRun("ParseFields", 1, testProcStatParseFields, NULL) < 0)
+        ret = -1;
+
+#ifdef __linux__
+    if (virtTestRun("Self", 1, testProcStatSelf, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Gone", 1, testProcStatGone, NULL) < 0)
+        ret = -1;
+    if (virtTestRun("Benchmark", 1, testProcStatBench, NULL) < 0)
+        ret = -1;
+#endif
+
+    return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
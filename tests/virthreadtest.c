@@ -0,0 +1,146 @@
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+
+#include "internal.h"
+#include "testutils.h"
+#include "threads.h"
+#include "util.h"
+#include "virtime.h"
+
+
+struct testWaitState {
+    virMutex lock;
+    virCond cond;
+    bool signaled;
+};
+
+/* Waits for a deadline and checks it did not return before it */
+static int
+testCondWaitUntil(const void *opaque)
+{
+    const unsigned long long *ms = opaque;
+    virMutex lock;
+    virCond cond;
+    unsigned long long start, end;
+    int rc;
+    int ret = -1;
+
+    if (virMutexInit(&lock) < 0)
+        return -1;
+    if (virCondInit(&cond) < 0) {
+        virMutexDestroy(&lock);
+        return -1;
+    }
+
+    virMutexLock(&lock);
+
+    if (virTimeMillisNow(&start) < 0)
+        goto cleanup;
+
+    /* Nothing signals the condition, so only the deadline ends this */
+    do {
+        rc = virCondWaitUntil(&cond, &lock, start + *ms);
+    } while (rc == 0);
+
+    if (errno != ETIMEDOUT || virTimeMillisNow(&end) < 0)
+        goto cleanup;
+
+    if (end - start < *ms) {
+        if (virTestGetVerbose())
+            fprintf(stderr, "\nwaited %llums for %llums\n%74s",
+                    end - start, *ms, "... ");
+        goto cleanup;
+    }
+
+    ret = 0;
+
+cleanup:
+    virMutexUnlock(&lock);
+    virCondDestroy(&cond);
+    virMutexDestroy(&lock);
+    return ret;
+}
+
+static void
+testSignalThread(void *opaque)
+{
+    struct testWaitState *state = opaque;
+
+    virMutexLock(&state->lock);
+    state->signaled = true;
+    virCondSignal(&state->cond);
+    virMutexUnlock(&state->lock);
+}
+
+/* A signal ends the wait before a deadline far away */
+static int
+testCondWaitUntilSignal(const void *opaque ATTRIBUTE_UNUSED)
+{
+    struct testWaitState state = { .signaled = false };
+    virThread thread;
+    unsigned long long start;
+    int ret = -1;
+
+    if (virMutexInit(&state.lock) < 0)
+        return -1;
+    if (virCondInit(&state.cond) < 0) {
+        virMutexDestroy(&state.lock);
+        return -1;
+    }
+
+    virMutexLock(&state.lock);
+
+    if (virTimeMillisNow(&start) < 0 ||
+        virThreadCreate(&thread, true, testSignalThread, &state) < 0)
+        goto cleanup;
+
+    while (!state.signaled) {
+        if (virCondWaitUntil(&state.cond, &state.lock, start + 60000) < 0)
+            break;
+    }
+
+    virMutexUnlock(&state.lock);
+    virThreadJoin(&thread);
+    virMutexLock(&state.lock);
+
+    if (state.signaled)
+        ret = 0;
+
+cleanup:
+    virMutexUnlock(&state.lock);
+    virCondDestroy(&state.cond);
+    virMutexDestroy(&state.lock);
+    return ret;
+}
+
+
+static int
+mymain(void)
+{
+    int ret = 0;
+
+#define DO_TEST(ms)                                                     \
+    do {                                                                \
+        static unsigned long long wait = ms;                            \
+        if (virtTestRun("Condition wait until " #ms "ms", 1,            \
+                        testCondWaitUntil, &wait) < 0)                  \
+            ret = -1;                                                   \
+    } while (0)
+
+    /* Deadlines within a second are not to be cut to the second */
+    DO_TEST(1);
+    DO_TEST(100);
+    DO_TEST(500);
+    DO_TEST(1200);
+
+    if (virtTestRun("Condition wait until signaled", 1,
+                    testCondWaitUntilSignal, NULL) < 0)
+        ret = -1;
+
+    return (ret == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+VIRT_TEST_MAIN(mymain)
@@ -4105,6 +4105,20 @@ static int vshStreamSink(virStreamPtr st ATTRIBUTE_UNUSED,
     return safewrite(*fd, bytes, nbytes);
 }
 
+/* Like vshStreamSink, but zeroes are skipped to leave holes in a file */
+static int vshStreamSparseSink(virStreamPtr st ATTRIBUTE_UNUSED,
+                               const char *bytes, size_t nbytes, void *opaque)
+{
+    int *fd = opaque;
+
+    if (!virMemIsZero(bytes, nbytes))
+        return safewrite(*fd, bytes, nbytes);
+
+    if (lseek(*fd, nbytes, SEEK_CUR) < 0)
+        return -1;
+    return nbytes;
+}
+
 /**
  * Generate string: '<domain name>-<timestamp>[<extension>]'
  */
@@ -11978,6 +11992,9 @@ cmdVolDownload (vshControl *ctl, const vshCmd *cmd)
     const char *name = NULL;
     unsigned long long offset = 0, length = 0;
     bool created = false;
+    bool sparse;
+    struct stat sb;
+    off_t end;
 
     if (!vshConnectionUsability(ctl, ctl->conn))
         return false;
@@ -12010,17 +12027,29 @@ cmdVolDownload (vshControl *ctl, const vshCmd *cmd)
         created = true;
     }
 
+    /* The file is empty, so zeroes needn't be written to regular files */
+    sparse = fstat(fd, &sb) == 0 && S_ISREG(sb.st_mode);
+
     st = virStreamNew(ctl->conn, 0);
     if (virStorageVolDownload(vol, st, offset, length, 0) < 0) {
         vshError(ctl, _("cannot download from volume %s"), name);
         goto cleanup;
     }
 
-    if (virStreamRecvAll(st, vshStreamSink, &fd) < 0) {
+    if (virStreamRecvAll(st, sparse ? vshStreamSparseSink : vshStreamSink,
+                         &fd) < 0) {
         vshError(ctl, _("cannot receive data from volume %s"), name);
         goto cleanup;
     }
 
+    /* Extend the file over a trailing hole */
+    if (sparse &&
+        ((end = lseek(fd, 0, SEEK_CUR)) < 0 || ftruncate(fd, end) < 0)) {
+        vshError(ctl, _("cannot write file %s"), file);
+        virStreamAbort(st);
+        goto cleanup;
+    }
+
     if (VIR_CLOSE(fd) < 0) {
         vshError(ctl, _("cannot close file %s"), file);
         virStreamAbort(st);
@@ -17304,6 +17333,80 @@ cleanup:
     return ret;
 }
 
+/*
+ * "domstats" command
+ */
+static const vshCmdInfo info_domstats[] = {
+    {"help", N_("get statistics about one or multiple domains")},
+    {"desc", N_("Gets statistics about all domains of the connection "
+                "in a single call. By default all supported statistics "
+                "groups are returned.")},
+    {NULL, NULL}
+};
+
+static const vshCmdOptDef opts_domstats[] = {
+    {"state", VSH_OT_BOOL, 0, N_("report domain state")},
+    {"cpu-total", VSH_OT_BOOL, 0, N_("report domain physical cpu usage")},
+    {"balloon", VSH_OT_BOOL, 0, N_("report domain balloon statistics")},
+    {"vcpu", VSH_OT_BOOL, 0, N_("report domain virtual cpu information")},
+    {"interface", VSH_OT_BOOL, 0, N_("report domain network interface information")},
+    {"block", VSH_OT_BOOL, 0, N_("report domain block device statistics")},
+    {"list-active", VSH_OT_BOOL, 0, N_("list only active domains")},
+    {"list-inactive", VSH_OT_BOOL, 0, N_("list only inactive domains")},
+    {"enforce", VSH_OT_BOOL, 0, N_("enforce requested stats parameters")},
+    {NULL, 0, 0, NULL}
+};
+
+static bool
+cmdDomstats(vshControl *ctl, const vshCmd *cmd)
+{
+    unsigned int stats = 0;
+    unsigned int flags = 0;
+    virDomainStatsRecordPtr *records = NULL;
+    virDomainStatsRecordPtr *next;
+    int i;
+
+    if (!vshConnectionUsability(ctl, ctl->conn))
+        return false;
+
+    if (vshCommandOptBool(cmd, "state"))
+        stats |= VIR_DOMAIN_STATS_STATE;
+    if (vshCommandOptBool(cmd, "cpu-total"))
+        stats |= VIR_DOMAIN_STATS_CPU_TOTAL;
+    if (vshCommandOptBool(cmd, "balloon"))
+        stats |= VIR_DOMAIN_STATS_BALLOON;
+    if (vshCommandOptBool(cmd, "vcpu"))
+        stats |= VIR_DOMAIN_STATS_VCPU;
+    if (vshCommandOptBool(cmd, "interface"))
+        stats |= VIR_DOMAIN_STATS_INTERFACE;
+    if (vshCommandOptBool(cmd, "block"))
+        stats |= VIR_DOMAIN_STATS_BLOCK;
+
+    if (vshCommandOptBool(cmd, "list-active"))
+        flags |= VIR_CONNECT_GET_ALL_DOMAINS_STATS_ACTIVE;
+    if (vshCommandOptBool(cmd, "list-inactive"))
+        flags |= VIR_CONNECT_GET_ALL_DOMAINS_STATS_INACTIVE;
+    if (vshCommandOptBool(cmd, "enforce"))
+        flags |= VIR_CONNECT_GET_ALL_DOMAINS_STATS_ENFORCE_STATS;
+
+    if (virConnectGetAllDomainStats(ctl->conn, stats, &records, flags) < 0)
+        return false;
+
+    for (next = records; *next; next++) {
+        vshPrint(ctl, "Domain: '%s'\n", virDomainGetName((*next)->dom));
+
+        for (i = 0; i < (*next)->nparams; i++) {
+            char *value = vshGetTypedParamValue(ctl, (*next)->params + i);
+            vshPrint(ctl, "  %s=%s\n", (*next)->params[i].field, value);
+            VIR_FREE(value);
+        }
+        vshPrint(ctl, "\n");
+    }
+
+    virDomainStatsRecordListFree(records);
+    return true;
+}
+
 /*
  * "qemu-monitor-command" command
  */
@@ -17521,6 +17624,7 @@ static const vshCmdDef domMonitoringCmds[] = {
     {"dominfo", cmdDominfo, opts_dominfo, info_dominfo, 0},
     {"dommemstat", cmdDomMemStat, opts_dommemstat, info_dommemstat, 0},
     {"domstate", cmdDomstate, opts_domstate, info_domstate, 0},
+    {"domstats", cmdDomstats, opts_domstats, info_domstats, 0},
     {"list", cmdList, opts_list, info_list, 0},
     {NULL, NULL, NULL, NULL, 0}
 };